@@ -26,11 +26,152 @@
 #include <memory>
 #include <array>
 #include <list>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <unordered_map>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#ifdef min
+#undef min
+#endif
+#ifdef max
+#undef max
+#endif
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace fs
 {
+view archive_like::load_view(const path &filename)
+{
+    auto file = load(filename);
+
+    if (!file) {
+        return {};
+    }
+
+    auto buffer = std::make_shared<std::vector<uint8_t>>(std::move(file.value()));
+    std::span<const uint8_t> bytes(*buffer);
+    return {std::move(buffer), bytes};
+}
+
+// read-only mapping of a whole file. if the platform refuses to
+// map it, the contents are read into memory instead, so callers
+// never have to care which one they got.
+class mapped_file
+{
+    const uint8_t *base = nullptr;
+    size_t length = 0;
+    std::vector<uint8_t> fallback;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+
+    void read_fallback(const path &p)
+    {
+        std::ifstream stream(p, std::ios_base::in | std::ios_base::binary);
+
+        if (!stream) {
+            throw std::runtime_error("can't open file");
+        }
+
+        fallback.resize(file_size(p));
+        stream.read(reinterpret_cast<char *>(fallback.data()), fallback.size());
+        base = fallback.data();
+        length = fallback.size();
+    }
+
+public:
+    explicit mapped_file(const path &p)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER size;
+
+            if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+                mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+                if (mapping) {
+                    base = reinterpret_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+                    if (base) {
+                        length = static_cast<size_t>(size.QuadPart);
+                    } else {
+                        CloseHandle(mapping);
+                        mapping = nullptr;
+                    }
+                }
+            }
+
+            // the mapping holds its own reference to the file
+            CloseHandle(file);
+        }
+#else
+        int fd = open(p.c_str(), O_RDONLY);
+
+        if (fd != -1) {
+            struct stat st;
+
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (ptr != MAP_FAILED) {
+                    base = reinterpret_cast<const uint8_t *>(ptr);
+                    length = static_cast<size_t>(st.st_size);
+                }
+            }
+
+            // the mapping holds its own reference to the file
+            close(fd);
+        }
+#endif
+
+        if (!base) {
+            read_fallback(p);
+        }
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    ~mapped_file()
+    {
+        if (!fallback.empty() || !base) {
+            return;
+        }
+
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+        CloseHandle(mapping);
+#else
+        munmap(const_cast<uint8_t *>(base), length);
+#endif
+    }
+
+    std::span<const uint8_t> bytes() const { return {base, length}; }
+
+    // returns an empty view if the range doesn't fit in the file
+    view subview(const std::shared_ptr<const mapped_file> &self, size_t offset, size_t size) const
+    {
+        if (offset > length || size > length - offset) {
+            return {};
+        }
+
+        return {self, bytes().subspan(offset, size)};
+    }
+};
+
 struct directory_archive : archive_like
 {
     using archive_like::archive_like;
@@ -61,9 +202,32 @@ struct directory_archive : archive_like
     }
 };
 
-struct pak_archive : archive_like
+// an archive file served from a memory mapping. the mapping can be
+// dropped and recreated while the parsed directory is kept, see
+// keep_archives().
+struct mapped_archive : archive_like
+{
+    std::shared_ptr<const mapped_file> mapping;
+
+    inline mapped_archive(const path &pathname, bool external)
+        : archive_like(pathname, external),
+          mapping(std::make_shared<mapped_file>(pathname))
+    {
+    }
+
+    // views already handed out keep their own reference to the mapping
+    void unmap() { mapping.reset(); }
+
+    void remap()
+    {
+        if (!mapping) {
+            mapping = std::make_shared<mapped_file>(pathname);
+        }
+    }
+};
+
+struct pak_archive : mapped_archive
 {
-    std::ifstream pakstream;
 
     struct pak_header
     {
@@ -87,16 +251,16 @@ struct pak_archive : archive_like
         files;
 
     inline pak_archive(const path &pathname, bool external)
-        : archive_like(pathname, external),
-          pakstream(pathname, std::ios_base::in | std::ios_base::binary)
+        : mapped_archive(pathname, external)
     {
+        imemstream pakstream(mapping->bytes().data(), mapping->bytes().size());
         pakstream >> endianness<std::endian::little>;
 
         pak_header header;
 
         pakstream >= header;
 
-        if (header.magic != std::array<char, 4>{'P', 'A', 'C', 'K'}) {
+        if (!pakstream || header.magic != std::array<char, 4>{'P', 'A', 'C', 'K'}) {
             throw std::runtime_error("Bad magic");
         }
 
@@ -111,6 +275,10 @@ struct pak_archive : archive_like
 
             pakstream >= file;
 
+            if (!pakstream) {
+                throw std::runtime_error("Truncated directory");
+            }
+
             files[file.name.data()] = std::make_tuple(file.offset, file.size);
         }
     }
@@ -118,24 +286,34 @@ struct pak_archive : archive_like
     bool contains(const path &filename) override { return files.find(filename.generic_string()) != files.end(); }
 
     data load(const path &filename) override
+    {
+        if (auto v = load_view(filename)) {
+            return v.copy();
+        }
+
+        return std::nullopt;
+    }
+
+    view load_view(const path &filename) override
     {
         auto it = files.find(filename.generic_string());
 
         if (it == files.end()) {
-            return std::nullopt;
+            return {};
         }
 
-        pakstream.seekg(std::get<0>(it->second));
-        uintmax_t size = std::get<1>(it->second);
-        std::vector<uint8_t> data(size);
-        pakstream.read(reinterpret_cast<char *>(data.data()), size);
-        return data;
+        auto v = mapping->subview(mapping, std::get<0>(it->second), std::get<1>(it->second));
+
+        if (!v) {
+            logging::funcprint("WARNING: '{}' overruns archive '{}'\n", filename, pathname);
+        }
+
+        return v;
     }
 };
 
-struct wad_archive : archive_like
+struct wad_archive : mapped_archive
 {
-    std::ifstream wadstream;
 
     // WAD Format
     struct wad_header
@@ -167,16 +345,16 @@ struct wad_archive : archive_like
         files;
 
     inline wad_archive(const path &pathname, bool external)
-        : archive_like(pathname, external),
-          wadstream(pathname, std::ios_base::in | std::ios_base::binary)
+        : mapped_archive(pathname, external)
     {
+        imemstream wadstream(mapping->bytes().data(), mapping->bytes().size());
         wadstream >> endianness<std::endian::little>;
 
         wad_header header;
 
         wadstream >= header;
 
-        if (header.identification != wad2_ident && header.identification != wad3_ident) {
+        if (!wadstream || (header.identification != wad2_ident && header.identification != wad3_ident)) {
             throw std::runtime_error("Bad magic");
         }
 
@@ -189,6 +367,10 @@ struct wad_archive : archive_like
 
             wadstream >= file;
 
+            if (!wadstream) {
+                throw std::runtime_error("Truncated directory");
+            }
+
             files[file.name.data()] = std::make_tuple(file.filepos, file.disksize);
         }
     }
@@ -196,33 +378,83 @@ struct wad_archive : archive_like
     bool contains(const path &filename) override { return files.find(filename.generic_string()) != files.end(); }
 
     data load(const path &filename) override
+    {
+        if (auto v = load_view(filename)) {
+            return v.copy();
+        }
+
+        return std::nullopt;
+    }
+
+    view load_view(const path &filename) override
     {
         auto it = files.find(filename.generic_string());
 
         if (it == files.end()) {
-            return std::nullopt;
+            return {};
+        }
+
+        auto v = mapping->subview(mapping, std::get<0>(it->second), std::get<1>(it->second));
+
+        if (!v) {
+            logging::funcprint("WARNING: '{}' overruns archive '{}'\n", filename, pathname);
         }
 
-        wadstream.seekg(std::get<0>(it->second));
-        uintmax_t size = std::get<1>(it->second);
-        std::vector<uint8_t> data(size);
-        wadstream.read(reinterpret_cast<char *>(data.data()), size);
-        return data;
+        return v;
     }
 };
 
 static std::shared_ptr<directory_archive> absrel_dir = std::make_shared<directory_archive>("", false);
 std::list<std::shared_ptr<archive_like>> archives, directories;
 
+// guards `archives` and `directories`; resolving is a read, so any
+// number of texture loader threads can resolve at once.
+static std::shared_mutex archives_mutex;
+
+// archives that outlive clear(), see keep_archives(). an entry is only
+// reused while the file on disk still has the size & time it was opened
+// with, so a file that changed (or shrank, which would make reading the old
+// mapping fault) is opened again rather than read through the old mapping.
+struct kept_archive_t
+{
+    std::shared_ptr<mapped_archive> archive;
+    uintmax_t size;
+    file_time_type time;
+};
+
+static bool keeping_archives = false;
+static std::unordered_map<std::string, kept_archive_t> kept_archives;
+
+void keep_archives(bool enable)
+{
+    std::unique_lock lock(archives_mutex);
+    keeping_archives = enable;
+
+    if (!enable) {
+        kept_archives.clear();
+    }
+}
+
 /** It's possible to compile quake 1/hexen 2 maps without a qdir */
 void clear()
 {
+    std::unique_lock lock(archives_mutex);
     archives.clear();
     directories.clear();
+
+#ifdef _WIN32
+    // a mapped file can't be written on Windows, so let go of the mappings
+    // between compiles; they're mapped again when the archive is reused
+    for (auto &[key, kept] : kept_archives) {
+        kept.archive->unmap();
+    }
+#endif
 }
 
 inline std::shared_ptr<archive_like> addArchiveInternal(const path &p, bool external)
 {
+    std::unique_lock lock(archives_mutex);
+
     if (is_directory(p)) {
         for (auto &dir : directories) {
             if (equivalent(dir->pathname, p)) {
@@ -240,25 +472,58 @@ inline std::shared_ptr<archive_like> addArchiveInternal(const path &p, bool exte
             }
         }
 
+        std::string key;
+        uintmax_t size = 0;
+        file_time_type time;
+
+        if (keeping_archives) {
+            key = fmt::format("{}|{}", weakly_canonical(p).generic_string(), external);
+            size = file_size(p);
+            time = last_write_time(p);
+
+            if (auto it = kept_archives.find(key); it != kept_archives.end()) {
+                if (it->second.size == size && it->second.time == time) {
+                    try {
+                        it->second.archive->remap();
+                        logging::print(logging::flag::VERBOSE, "Reusing archive '{}'\n", p);
+                        return archives.emplace_front(it->second.archive);
+                    } catch (std::exception &e) {
+                        logging::funcprint("WARNING: unable to load archive '{}': {}\n", p, e.what());
+                        kept_archives.erase(it);
+                        return nullptr;
+                    }
+                }
+
+                kept_archives.erase(it);
+            }
+        }
+
         auto ext = p.extension();
+        std::shared_ptr<mapped_archive> arch;
 
         try {
             if (string_iequals(ext.generic_string(), ".pak")) {
-                auto &arch = archives.emplace_front(std::make_shared<pak_archive>(p, external));
-                auto &pak = reinterpret_cast<std::shared_ptr<pak_archive> &>(arch);
+                auto pak = std::make_shared<pak_archive>(p, external);
                 logging::print(logging::flag::VERBOSE, "Added pak '{}' with {} files\n", p, pak->files.size());
-                return arch;
+                arch = pak;
             } else if (string_iequals(ext.generic_string(), ".wad")) {
-                auto &arch = archives.emplace_front(std::make_shared<wad_archive>(p, external));
-                auto &wad = reinterpret_cast<std::shared_ptr<wad_archive> &>(arch);
+                auto wad = std::make_shared<wad_archive>(p, external);
                 logging::print(logging::flag::VERBOSE, "Added wad '{}' with {} lumps\n", p, wad->files.size());
-                return arch;
+                arch = wad;
             } else {
                 logging::funcprint("WARNING: no idea what to do with archive '{}'\n", p);
             }
         } catch (std::exception e) {
             logging::funcprint("WARNING: unable to load archive '{}': {}\n", p, e.what());
         }
+
+        if (arch) {
+            if (keeping_archives) {
+                kept_archives[key] = {arch, size, time};
+            }
+
+            return archives.emplace_front(arch);
+        }
     }
 
     return nullptr;
@@ -307,6 +572,8 @@ resolve_result where(const path &p, bool prefer_loose)
                 return {absrel_dir, p};
             }
         } else if (!p.is_absolute()) { // absolute doesn't make sense for other load types
+            std::shared_lock lock(archives_mutex);
+
             for (int32_t archive_pass = 0; archive_pass < 2; archive_pass++) {
                 // check directories & archives, depending on whether
                 // we want loose first or not
@@ -338,6 +605,22 @@ data load(const path &p, bool prefer_loose)
     return load(where(p, prefer_loose));
 }
 
+view load_view(const resolve_result &pos)
+{
+    if (!pos) {
+        return {};
+    }
+
+    logging::print(logging::flag::VERBOSE, "Loaded '{}' from archive '{}'\n", pos.filename, pos.archive->pathname);
+
+    return pos.archive->load_view(pos.filename);
+}
+
+view load_view(const path &p, bool prefer_loose)
+{
+    return load_view(where(p, prefer_loose));
+}
+
 archive_components splitArchivePath(const path &source)
 {
     // check direct archive loading
@@ -4,8 +4,13 @@
 #include <common/entdata.h>
 #include <common/json.hh>
 #include <common/log.hh>
+#include <common/parallel.hh>
 #include <common/settings.hh>
 
+#include <atomic>
+#include <functional>
+#include <shared_mutex>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "../3rdparty/stb_image.h"
 
@@ -76,7 +81,7 @@ static bool LoadPCXPalette(const fs::path &filename, std::vector<qvec3b> &palett
     return true;
 }
 
-void init_palette(const gamedef_t *game)
+static void load_palette(const gamedef_t *game)
 {
     palette.clear();
 
@@ -96,6 +101,102 @@ void init_palette(const gamedef_t *game)
     std::copy(pal.begin(), pal.end(), std::back_inserter(palette));
 }
 
+/*
+============================================================================
+DECODE CACHE
+============================================================================
+*/
+
+// decoded results kept across clear() while keep_decoded() is enabled.
+// entries are keyed by what was asked for and where it was found, and
+// remember a hash of the bytes they were decoded from; an entry is only
+// reused if the file still has the same contents. the bytes themselves
+// aren't kept, so archive mappings can be released between compiles.
+template<typename T>
+class decode_cache_t
+{
+    struct entry_t
+    {
+        size_t size;
+        size_t hash;
+        T value;
+    };
+
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, entry_t> entries;
+
+    // only compared within one process, so the standard library's hash will do
+    static size_t hash_bytes(const fs::view &source)
+    {
+        return std::hash<std::string_view>{}(
+            std::string_view(reinterpret_cast<const char *>(source.data()), source.size()));
+    }
+
+public:
+    template<typename F>
+    std::optional<T> get(const std::string &key, const fs::view &source, F &&decode)
+    {
+        const size_t hash = hash_bytes(source);
+
+        {
+            std::shared_lock lock(mutex);
+
+            if (auto it = entries.find(key);
+                it != entries.end() && it->second.size == source.size() && it->second.hash == hash) {
+                return it->second.value;
+            }
+        }
+
+        std::optional<T> value = decode();
+
+        if (value) {
+            std::unique_lock lock(mutex);
+            entries.insert_or_assign(key, entry_t{source.size(), hash, *value});
+        }
+
+        return value;
+    }
+
+    void clear()
+    {
+        std::unique_lock lock(mutex);
+        entries.clear();
+    }
+};
+
+static std::atomic_bool keeping_decoded = false;
+static decode_cache_t<texture> decoded_textures;
+static decode_cache_t<texture_meta> decoded_metas;
+
+void keep_decoded(bool enable)
+{
+    keeping_decoded = enable;
+
+    if (!enable) {
+        decoded_textures.clear();
+        decoded_metas.clear();
+    }
+}
+
+static std::string decode_key(
+    const fs::resolve_result &pos, const std::string_view &name, bool meta_only, const gamedef_t *game)
+{
+    return fmt::format("{}|{}|{}|{}|{}", pos.archive->pathname.generic_string(), pos.filename.generic_string(), name,
+        meta_only, static_cast<int>(game->id));
+}
+
+void init_palette(const gamedef_t *game)
+{
+    std::vector<qvec3b> previous = std::move(palette);
+
+    load_palette(game);
+
+    // paletted textures in the cache were converted with the old palette
+    if (palette != previous) {
+        decoded_textures.clear();
+    }
+}
+
 static void convert_paletted_to_32_bit(
     const std::vector<uint8_t> &pixels, std::vector<qvec4b> &output, const std::vector<qvec3b> &pal)
 {
@@ -126,9 +227,9 @@ struct q2_miptex_t
 };
 
 std::optional<texture> load_wal(
-    const std::string_view &name, const fs::data &file, bool meta_only, const gamedef_t *game)
+    const std::string_view &name, std::span<const uint8_t> file, bool meta_only, const gamedef_t *game)
 {
-    imemstream stream(file->data(), file->size(), std::ios_base::in | std::ios_base::binary);
+    imemstream stream(file.data(), file.size(), std::ios_base::in | std::ios_base::binary);
     stream >> endianness<std::endian::little>;
 
     // Parse WAL
@@ -167,9 +268,9 @@ Quake/Half Life MIP
 */
 
 std::optional<texture> load_mip(
-    const std::string_view &name, const fs::data &file, bool meta_only, const gamedef_t *game)
+    const std::string_view &name, std::span<const uint8_t> file, bool meta_only, const gamedef_t *game)
 {
-    imemstream stream(file->data(), file->size());
+    imemstream stream(file.data(), file.size());
     stream >> endianness<std::endian::little>;
 
     // read header
@@ -201,7 +302,7 @@ std::optional<texture> load_mip(
 
         // convert the data into RGBA.
         // sanity check
-        if (header.offsets[0] + (header.width * header.height) > file->size()) {
+        if (header.offsets[0] + (header.width * header.height) > file.size()) {
             logging::funcprint("mip offset0 overrun for {}\n", name);
             return tex;
         }
@@ -226,7 +327,7 @@ std::optional<texture> load_mip(
             if (header.offsets[3] <= 0) {
                 logging::funcprint("mip palette needs offset3 to work, for {}\n", name);
                 valid_mip_palette = false;
-            } else if (header.offsets[3] + mip3_size + palette_size > file->size()) {
+            } else if (header.offsets[3] + mip3_size + palette_size > file.size()) {
                 logging::funcprint("mip palette overrun for {}\n", name);
                 valid_mip_palette = false;
             }
@@ -256,10 +357,10 @@ std::optional<texture> load_mip(
 }
 
 std::optional<texture> load_stb(
-    const std::string_view &name, const fs::data &file, bool meta_only, const gamedef_t *game)
+    const std::string_view &name, std::span<const uint8_t> file, bool meta_only, const gamedef_t *game)
 {
     int x, y, channels_in_file;
-    stbi_uc *rgba_data = stbi_load_from_memory(file->data(), file->size(), &x, &y, &channels_in_file, 4);
+    stbi_uc *rgba_data = stbi_load_from_memory(file.data(), file.size(), &x, &y, &channels_in_file, 4);
 
     if (!rgba_data) {
         logging::funcprint("stbi error: {}\n", stbi_failure_reason());
@@ -326,7 +427,7 @@ qvec3b calculate_average(const std::vector<qvec4b> &pixels)
     return avg /= n;
 }
 
-std::tuple<std::optional<img::texture>, fs::resolve_result, fs::data> load_texture(const std::string_view &name,
+std::tuple<std::optional<img::texture>, fs::resolve_result, fs::view> load_texture(const std::string_view &name,
     bool meta_only, const gamedef_t *game, const settings::common_settings &options, bool no_prefix)
 {
     fs::path prefix{};
@@ -339,8 +440,13 @@ std::tuple<std::optional<img::texture>, fs::resolve_result, fs::data> load_textu
         fs::path p = (no_prefix ? fs::path(name) : (prefix / name)) += ext.suffix;
 
         if (auto pos = fs::where(p, options.filepriority.value() == settings::search_priority_t::LOOSE)) {
-            if (auto data = fs::load(pos)) {
-                if (auto texture = ext.loader(name.data(), data, meta_only, game)) {
+            if (auto data = fs::load_view(pos)) {
+                auto decode = [&]() { return ext.loader(name.data(), data.bytes, meta_only, game); };
+                auto texture = keeping_decoded
+                                   ? decoded_textures.get(decode_key(pos, name, meta_only, game), data, decode)
+                                   : decode();
+
+                if (texture) {
                     return {texture, pos, data};
                 }
             }
@@ -350,7 +456,8 @@ std::tuple<std::optional<img::texture>, fs::resolve_result, fs::data> load_textu
     return {std::nullopt, {}, {}};
 }
 
-std::optional<texture_meta> load_wal_meta(const std::string_view &name, const fs::data &file, const gamedef_t *game)
+std::optional<texture_meta> load_wal_meta(
+    const std::string_view &name, std::span<const uint8_t> file, const gamedef_t *game)
 {
     if (auto tex = load_wal(name, file, true, game)) {
         return tex->meta;
@@ -401,10 +508,10 @@ std::optional<texture_meta> load_wal_meta(const std::string_view &name, const fs
     }
 */
 std::optional<texture_meta> load_wal_json_meta(
-    const std::string_view &name, const fs::data &file, const gamedef_t *game)
+    const std::string_view &name, std::span<const uint8_t> file, const gamedef_t *game)
 {
     try {
-        auto json = json::parse(file->begin(), file->end());
+        auto json = json::parse(file.begin(), file.end());
 
         texture_meta meta{};
 
@@ -413,8 +520,8 @@ std::optional<texture_meta> load_wal_json_meta(
         {
             fs::path wal = fs::path(name).replace_extension(".wal");
 
-            if (auto wal_file = fs::load(wal))
-                if (auto wal_meta = load_wal_meta(wal.string(), wal_file, game))
+            if (auto wal_file = fs::load_view(wal))
+                if (auto wal_meta = load_wal_meta(wal.string(), wal_file.bytes, game))
                     meta = *wal_meta;
         }
 
@@ -485,7 +592,7 @@ std::optional<texture_meta> load_wal_json_meta(
     }
 }
 
-std::tuple<std::optional<img::texture_meta>, fs::resolve_result, fs::data> load_texture_meta(
+std::tuple<std::optional<img::texture_meta>, fs::resolve_result, fs::view> load_texture_meta(
     const std::string_view &name, const gamedef_t *game, const settings::common_settings &options)
 {
     fs::path prefix;
@@ -498,8 +605,12 @@ std::tuple<std::optional<img::texture_meta>, fs::resolve_result, fs::data> load_
         fs::path p = (prefix / name) += ext.suffix;
 
         if (auto pos = fs::where(p, options.filepriority.value() == settings::search_priority_t::LOOSE)) {
-            if (auto data = fs::load(pos)) {
-                if (auto texture = ext.loader(name.data(), data, game)) {
+            if (auto data = fs::load_view(pos)) {
+                auto decode = [&]() { return ext.loader(name.data(), data.bytes, game); };
+                auto texture =
+                    keeping_decoded ? decoded_metas.get(decode_key(pos, name, true, game), data, decode) : decode();
+
+                if (texture) {
                     return {texture, pos, data};
                 }
             }
@@ -560,17 +671,41 @@ static qvec3b increase_saturation(const qvec3b &color)
     return color_int;
 }
 
-// Load the specified texture from the BSP
-static void AddTextureName(
-    const std::string_view &textureName, const mbsp_t *bsp, const settings::common_settings &options)
+static void CalculateAverageColor(img::texture &tex, const settings::common_settings &options)
+{
+    if (tex.meta.color_override) {
+        tex.averageColor = *tex.meta.color_override;
+    } else {
+        tex.averageColor = img::calculate_average(tex.pixels);
+
+        if (options.tex_saturation_boost.value() > 0.0f) {
+            tex.averageColor =
+                mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
+        }
+    }
+
+    if (tex.meta.width && tex.meta.height) {
+        tex.width_scale = (float)tex.width / (float)tex.meta.width;
+        tex.height_scale = (float)tex.height / (float)tex.meta.height;
+    }
+}
+
+// Add an empty entry for the specified texture to the cache, returning
+// it if it wasn't already there; the pixels are filled in later by
+// LoadTexture, which is safe to run on several entries at once.
+static img::texture *AddTextureName(const std::string_view &textureName)
 {
     if (img::find(textureName)) {
-        return;
+        return nullptr;
     }
 
-    // always add entry
-    auto &tex = img::textures.emplace(textureName, img::texture{}).first->second;
+    return &img::textures.emplace(textureName, img::texture{}).first->second;
+}
 
+// Load the specified texture from the BSP
+static void LoadTexture(const std::string_view &textureName, img::texture &tex, const mbsp_t *bsp,
+    const settings::common_settings &options)
+{
     // find texture & meta
     auto [texture, _0, _1] = img::load_texture(textureName, false, bsp->loadversion->game, options);
 
@@ -588,30 +723,22 @@ static void AddTextureName(
         tex.meta = std::move(texture_meta.value());
     }
 
-    if (tex.meta.color_override) {
-        tex.averageColor = *tex.meta.color_override;
-    } else {
-        tex.averageColor = img::calculate_average(tex.pixels);
-
-        if (options.tex_saturation_boost.value() > 0.0f) {
-            tex.averageColor =
-                mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
-        }
-    }
-
-    if (tex.meta.width && tex.meta.height) {
-        tex.width_scale = (float)tex.width / (float)tex.meta.width;
-        tex.height_scale = (float)tex.height / (float)tex.meta.height;
-    }
+    CalculateAverageColor(tex, options);
 }
 
 // Load all of the referenced textures from the BSP texinfos into
 // the texture cache.
 static void LoadTextures(const mbsp_t *bsp, const settings::common_settings &options)
 {
+    // the cache is only modified while gathering; unordered_map
+    // never moves its elements, so the pointers stay valid.
+    std::vector<std::tuple<std::string, img::texture *>> pending;
+
     // gather all loadable textures...
     for (auto &texinfo : bsp->texinfo) {
-        AddTextureName(texinfo.texture.data(), bsp, options);
+        if (auto *tex = AddTextureName(texinfo.texture.data())) {
+            pending.emplace_back(texinfo.texture.data(), tex);
+        }
     }
 
     // gather textures used by _project_texture.
@@ -621,10 +748,16 @@ static void LoadTextures(const mbsp_t *bsp, const settings::common_settings &opt
         if (entdict.get("classname").find("light") == 0) {
             const auto &tex = entdict.get("_project_texture");
             if (!tex.empty()) {
-                AddTextureName(tex.c_str(), bsp, options);
+                if (auto *entry = AddTextureName(tex)) {
+                    pending.emplace_back(tex, entry);
+                }
             }
         }
     }
+
+    logging::parallel_for_each(pending, [&](const std::tuple<std::string, img::texture *> &entry) {
+        LoadTexture(std::get<0>(entry), *std::get<1>(entry), bsp, options);
+    });
 }
 
 // Load all of the paletted textures from the BSP into
@@ -635,50 +768,41 @@ static void ConvertTextures(const mbsp_t *bsp, const settings::common_settings &
         return;
     }
 
+    std::vector<std::tuple<const miptex_t *, img::texture *>> pending;
+
     for (auto &miptex : bsp->dtex.textures) {
-        if (img::find(miptex.name)) {
+        if (auto *tex = AddTextureName(miptex.name)) {
+            pending.emplace_back(&miptex, tex);
+        } else {
             logging::funcprint("WARNING: Texture {} duplicated\n", miptex.name);
-            continue;
         }
+    }
 
-        // always add entry
-        auto &tex = img::textures.emplace(miptex.name, img::texture{}).first->second;
+    logging::parallel_for_each(pending, [&](const std::tuple<const miptex_t *, img::texture *> &entry) {
+        auto &[miptex, tex] = entry;
 
         // if the miptex entry isn't a dummy, use it as our base
-        if (miptex.data.size() >= sizeof(dmiptex_t)) {
-            if (auto loaded_tex = img::load_mip(miptex.name, miptex.data, false, bsp->loadversion->game)) {
-                tex = std::move(loaded_tex.value());
+        if (miptex->data.size() >= sizeof(dmiptex_t)) {
+            if (auto loaded_tex = img::load_mip(miptex->name, miptex->data, false, bsp->loadversion->game)) {
+                *tex = std::move(loaded_tex.value());
             }
         }
 
         // find replacement texture
-        if (auto [texture, _0, _1] = img::load_texture(miptex.name, false, bsp->loadversion->game, options); texture) {
-            tex.width = texture->width;
-            tex.height = texture->height;
-            tex.pixels = std::move(texture->pixels);
-        }
-
-        if (!tex.pixels.size() || !tex.width || !tex.meta.width) {
-            logging::funcprint("WARNING: invalid size data for {}\n", miptex.name);
-            continue;
+        if (auto [texture, _0, _1] = img::load_texture(miptex->name, false, bsp->loadversion->game, options);
+            texture) {
+            tex->width = texture->width;
+            tex->height = texture->height;
+            tex->pixels = std::move(texture->pixels);
         }
 
-        if (tex.meta.color_override) {
-            tex.averageColor = *tex.meta.color_override;
-        } else {
-            tex.averageColor = img::calculate_average(tex.pixels);
-
-            if (options.tex_saturation_boost.value() > 0.0f) {
-                tex.averageColor =
-                    mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
-            }
+        if (!tex->pixels.size() || !tex->width || !tex->meta.width) {
+            logging::funcprint("WARNING: invalid size data for {}\n", miptex->name);
+            return;
         }
 
-        if (tex.meta.width && tex.meta.height) {
-            tex.width_scale = (float)tex.width / (float)tex.meta.width;
-            tex.height_scale = (float)tex.height / (float)tex.meta.height;
-        }
-    }
+        CalculateAverageColor(*tex, options);
+    });
 }
 
 void load_textures(const mbsp_t *bsp, const settings::common_settings &options)
@@ -21,23 +21,30 @@
  * common/log.c
  */
 
+#include <atomic>
 #include <cstdarg>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <mutex>
+#include <memory>
+#include <thread>
 #include <fmt/ostream.h>
 #include <fmt/chrono.h>
 #include <fmt/color.h>
 #include <string>
+#include <vector>
 
 #include <common/log.hh>
 #include <common/settings.hh>
 #include <common/cmdlib.hh>
+#include <common/json.hh>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h> // for OutputDebugStringA
+#define PSAPI_VERSION 2 // GetProcessMemoryInfo from kernel32
+#include <psapi.h> // for GetProcessMemoryInfo
 
 #ifdef min
 #undef min
@@ -45,6 +52,8 @@
 #ifdef max
 #undef max
 #endif
+#else
+#include <sys/resource.h> // for getrusage
 #endif
 
 static std::ofstream logfile;
@@ -63,27 +72,432 @@ void preinitialize()
 #endif
 }
 
+static std::mutex print_mutex;
+static print_callback_t active_print_callback;
+
+void set_print_callback(print_callback_t cb)
+{
+    active_print_callback = cb;
+}
+
+// writes a message to the log file, debug output and stdout, without flushing
+static void write_message(flag logflag, const fmt::text_style &style, const char *str)
+{
+    if (logflag != flag::PERCENT) {
+        // log file, if open
+        if (logfile) {
+            logfile << str;
+        }
+
+#ifdef _WIN32
+        // print to windows console.
+        // if VS's Output window gets support for ANSI colors, we can change this to ansi_str.c_str()
+        OutputDebugStringA(str);
+#endif
+    }
+
+    if (enable_color_codes) {
+        // stdout (assume the terminal can render ANSI colors)
+        fmt::print(style, "{}", str);
+    } else {
+        std::cout << str;
+    }
+}
+
+static void flush_outputs()
+{
+    if (logfile) {
+        logfile.flush();
+    }
+
+    // for TB, etc...
+    fflush(stdout);
+}
+
+/*
+ * Bounded multi-producer, single-consumer queue of formatted messages
+ * (Vyukov's bounded queue). Printing threads claim a slot with a single CAS
+ * and never block each other; the writer thread drains everything that is
+ * ready, writes it out and flushes once per batch. If the queue is full,
+ * producers yield until the writer catches up, so nothing is dropped.
+ */
+class async_writer_t
+{
+    struct message_t
+    {
+        flag logflag;
+        fmt::text_style style;
+        std::string str;
+    };
+
+    struct slot_t
+    {
+        std::atomic<uint64_t> sequence;
+        message_t message;
+    };
+
+    static constexpr uint64_t capacity = 4096;
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+    std::unique_ptr<slot_t[]> slots;
+    // next ticket handed to a producer
+    std::atomic<uint64_t> enqueue_pos = 0;
+    // next ticket the writer will consume; only touched by the writer
+    uint64_t dequeue_pos = 0;
+    // number of messages written and flushed
+    std::atomic<uint64_t> written = 0;
+    // bumped after each publish so the writer can sleep on it
+    std::atomic<uint32_t> wake = 0;
+    // producers that got past the `stopping` check and haven't published yet;
+    // the writer doesn't exit while any are in flight
+    std::atomic<uint32_t> producers = 0;
+    std::atomic_bool stopping = false;
+    // stays set until the writer thread has joined, so nobody writes to the
+    // outputs directly while it's still draining
+    std::atomic_bool running = false;
+    std::thread thread;
+
+    bool try_pop(message_t &out)
+    {
+        slot_t &slot = slots[dequeue_pos & (capacity - 1)];
+
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            return false;
+        }
+
+        out = std::move(slot.message);
+        slot.sequence.store(dequeue_pos + capacity, std::memory_order_release);
+        dequeue_pos++;
+        return true;
+    }
+
+    void run()
+    {
+        message_t message;
+
+        while (true) {
+            uint32_t seen = wake.load(std::memory_order_acquire);
+            bool any = false;
+
+            while (try_pop(message)) {
+                write_message(message.logflag, message.style, message.str.c_str());
+                any = true;
+            }
+
+            if (any) {
+                flush_outputs();
+                written.store(dequeue_pos, std::memory_order_release);
+                written.notify_all();
+                continue;
+            }
+
+            if (stopping.load() && producers.load() == 0 &&
+                enqueue_pos.load(std::memory_order_acquire) == dequeue_pos) {
+                break;
+            }
+
+            wake.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+public:
+    bool is_running() const { return running.load(std::memory_order_acquire); }
+
+    void start()
+    {
+        if (is_running()) {
+            return;
+        }
+
+        if (!slots) {
+            slots = std::make_unique<slot_t[]>(capacity);
+        }
+
+        for (uint64_t i = 0; i < capacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        enqueue_pos = 0;
+        dequeue_pos = 0;
+        written = 0;
+        stopping = false;
+        thread = std::thread(&async_writer_t::run, this);
+        running = true;
+    }
+
+    // returns false if the writer is stopping; the caller has to wait for
+    // it with wait_stopped() and write the message itself
+    bool try_push(flag logflag, const fmt::text_style &style, const char *str)
+    {
+        // seq_cst pairs with stop() and the writer's exit check: either we see
+        // `stopping`, or the writer sees us in `producers` and waits for us
+        producers.fetch_add(1);
+
+        if (stopping.load()) {
+            producers.fetch_sub(1);
+            wake.fetch_add(1, std::memory_order_release);
+            wake.notify_one();
+            return false;
+        }
+
+        uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        slot_t *slot;
+
+        while (true) {
+            slot = &slots[pos & (capacity - 1)];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // full; wait for the writer to free up a slot
+                std::this_thread::yield();
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->message.logflag = logflag;
+        slot->message.style = style;
+        slot->message.str = str;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        producers.fetch_sub(1);
+        wake.fetch_add(1, std::memory_order_release);
+        wake.notify_one();
+        return true;
+    }
+
+    // blocks until everything queued before the call has been written and flushed
+    void flush()
+    {
+        uint64_t target = enqueue_pos.load(std::memory_order_acquire);
+
+        for (uint64_t done = written.load(std::memory_order_acquire); done < target;
+             done = written.load(std::memory_order_acquire)) {
+            written.wait(done, std::memory_order_acquire);
+        }
+    }
+
+    // drains the queue and joins the writer thread
+    void stop()
+    {
+        if (!is_running()) {
+            return;
+        }
+
+        stopping = true;
+        wake.fetch_add(1, std::memory_order_release);
+        wake.notify_one();
+        thread.join();
+
+        running = false;
+        running.notify_all();
+    }
+
+    // blocks until a stop() in progress has joined the writer thread
+    void wait_stopped() { running.wait(true); }
+
+    ~async_writer_t() { stop(); }
+};
+
+// declared after logfile, so it is drained & joined before the log file is destroyed
+static async_writer_t async_writer;
+
+// telemetry
+
+struct trace_event_t
+{
+    std::string name;
+    char phase; // 'X' for a timed scope, 'C' for a counter
+    uint32_t tid;
+    int64_t timestamp; // microseconds since init()
+    int64_t value; // duration in microseconds for scopes
+};
+
+static std::atomic_bool trace_enabled = false;
+static fs::path trace_path;
+static std::string trace_program_name;
+static time_point trace_start;
+static std::mutex trace_mutex;
+static std::vector<trace_event_t> trace_events;
+static std::atomic_uint32_t trace_next_tid = 0;
+
+static uint32_t trace_tid()
+{
+    thread_local uint32_t tid = trace_next_tid++;
+    return tid;
+}
+
+static int64_t trace_microseconds(duration d)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+static void trace_add(trace_event_t &&event)
+{
+    std::unique_lock lock(trace_mutex);
+    trace_events.push_back(std::move(event));
+}
+
+static uint64_t peak_memory_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return usage.ru_maxrss; // bytes
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+    }
+#endif
+    return 0;
+}
+
+bool tracing()
+{
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+void counter(const char *name, int64_t value)
+{
+    if (!tracing()) {
+        return;
+    }
+
+    trace_add({name, 'C', trace_tid(), trace_microseconds(I_FloatTime() - trace_start), value});
+}
+
+void sample_memory()
+{
+    if (!tracing()) {
+        return;
+    }
+
+    counter("peak memory (bytes)", static_cast<int64_t>(peak_memory_bytes()));
+}
+
+timed_scope_t::timed_scope_t(const char *name)
+    : name(name),
+      start(I_FloatTime())
+{
+}
+
+timed_scope_t::~timed_scope_t()
+{
+    if (!tracing()) {
+        return;
+    }
+
+    auto end = I_FloatTime();
+    trace_add({name, 'X', trace_tid(), trace_microseconds(start - trace_start), trace_microseconds(end - start)});
+    sample_memory();
+}
+
+static void write_trace()
+{
+    json events = json::array();
+    json phases = json::object();
+    json counters = json::object();
+
+    events.push_back({{"name", "process_name"}, {"ph", "M"}, {"pid", 1}, {"args", {{"name", trace_program_name}}}});
+
+    for (auto &event : trace_events) {
+        if (event.phase == 'X') {
+            events.push_back({{"name", event.name}, {"cat", "phase"}, {"ph", "X"}, {"pid", 1}, {"tid", event.tid},
+                {"ts", event.timestamp}, {"dur", event.value}});
+
+            json &phase = phases[event.name];
+            if (phase.is_null()) {
+                phase = {{"count", 0}, {"total_ms", 0.0}};
+            }
+            phase["count"] = phase["count"].get<int64_t>() + 1;
+            phase["total_ms"] = phase["total_ms"].get<double>() + event.value / 1000.0;
+        } else {
+            events.push_back({{"name", event.name}, {"ph", "C"}, {"pid", 1}, {"tid", event.tid},
+                {"ts", event.timestamp}, {"args", {{"value", event.value}}}});
+
+            // events are in time order, so this keeps the last value
+            counters[event.name] = event.value;
+        }
+    }
+
+    json trace = {{"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"},
+        {"summary", {{"program", trace_program_name}, {"version", ERICWTOOLS_VERSION}, {"phases", std::move(phases)},
+                        {"counters", std::move(counters)}, {"peak_memory_bytes", peak_memory_bytes()}}}};
+
+    std::ofstream stream(trace_path);
+
+    if (!stream) {
+        print("WARNING: couldn't write trace to {}\n", trace_path);
+        return;
+    }
+
+    stream << trace.dump(1);
+    print("wrote trace to {}\n", trace_path);
+}
+
 void init(const fs::path &filename, const settings::common_settings &settings)
 {
+    // the writer thread owns the outputs while it's running
+    async_writer.stop();
+
     if (settings.log.value()) {
         logfile.open(filename);
         fmt::print(logfile, "---- {} / ericw-tools {} ----\n", settings.program_name, ERICWTOOLS_VERSION);
     }
+
+    trace_enabled = false;
+    trace_events.clear();
+
+    if (!settings.trace.value().empty()) {
+        trace_path = settings.trace.value();
+        trace_program_name = settings.program_name;
+        trace_start = I_FloatTime();
+        trace_enabled = true;
+    }
+
+    async_writer.start();
 }
 
-void close()
+void flush()
 {
-    if (logfile) {
-        logfile.close();
+    if (async_writer.is_running()) {
+        async_writer.flush();
+    } else {
+        std::unique_lock lock(print_mutex);
+        flush_outputs();
     }
 }
 
-static std::mutex print_mutex;
-static print_callback_t active_print_callback;
-
-void set_print_callback(print_callback_t cb)
+void close()
 {
-    active_print_callback = cb;
+    if (tracing()) {
+        // the whole run, from init() to here
+        trace_add({trace_program_name, 'X', trace_tid(), 0, trace_microseconds(I_FloatTime() - trace_start)});
+        sample_memory();
+        trace_enabled = false;
+
+        std::unique_lock lock(trace_mutex);
+        write_trace();
+        trace_events.clear();
+    }
+
+    async_writer.stop();
+
+    if (logfile) {
+        logfile.close();
+    }
 }
 
 void print(flag logflag, const char *str)
@@ -98,9 +512,10 @@ void print(flag logflag, const char *str)
     }
 
     fmt::text_style style;
+    bool is_error = string_icontains(str, "error");
 
     if (enable_color_codes) {
-        if (string_icontains(str, "error")) {
+        if (is_error) {
             style = fmt::fg(fmt::color::red);
         } else if (string_icontains(str, "warning")) {
             style = fmt::fg(fmt::terminal_color::yellow);
@@ -111,33 +526,23 @@ void print(flag logflag, const char *str)
         }
     }
 
-    print_mutex.lock();
-
-    if (logflag != flag::PERCENT) {
-        // log file, if open
-        if (logfile) {
-            logfile << str;
-            logfile.flush();
+    if (async_writer.is_running()) {
+        if (async_writer.try_push(logflag, style, str)) {
+            // errors are often followed by an exit, so make sure they are out
+            if (is_error) {
+                async_writer.flush();
+            }
+            return;
         }
 
-#ifdef _WIN32
-        // print to windows console.
-        // if VS's Output window gets support for ANSI colors, we can change this to ansi_str.c_str()
-        OutputDebugStringA(str);
-#endif
-    }
-
-    if (enable_color_codes) {
-        // stdout (assume the terminal can render ANSI colors)
-        fmt::print(style, "{}", str);
-    } else {
-        std::cout << str;
+        // the writer is draining its last batch; writing directly now
+        // could interleave with it
+        async_writer.wait_stopped();
     }
 
-    // for TB, etc...
-    fflush(stdout);
-
-    print_mutex.unlock();
+    std::unique_lock lock(print_mutex);
+    write_message(logflag, style, str);
+    flush_outputs();
 }
 
 void vprint(flag logflag, fmt::string_view format, fmt::format_args args)
@@ -172,6 +577,7 @@ void assert_(bool success, const char *expr, const char *file, int line)
 {
     if (!success) {
         print("{}:{}: Q_assert({}) failed.\n", file, line, expr);
+        flush();
         // assert(0);
 #ifdef _WIN32
         __debugbreak();
@@ -360,6 +766,8 @@ void stat_tracker_t::print_stats()
     size_t number_padding = number_of_digit_padding() + 4;
 
     for (auto &stat : stats) {
+        counter(stat.name.c_str(), static_cast<int64_t>(stat.count.load()));
+
         if (stat.show_even_if_zero || stat.count) {
             print(flag::STAT, "{}{:{}} {}\n", stat.is_warning ? "WARNING: " : "", fmt::group_digits(stat.count.load()),
                 stat.is_warning ? 0 : number_padding, stat.name);
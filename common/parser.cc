@@ -154,38 +154,13 @@ skipspace:
                 // explicitly within strings. this means ONLY \n works, and double-quotes cannot be used either in maps
                 // _NOR SAVED GAMES_. certain editors can write "wad" "c:\foo\" which is completely fucked. so lets try
                 // to prevent more brokenness and encourage map editors to switch to using sane wad keys.
-                switch (pos[1]) {
-                    case 'n':
-                    case '\'':
-                    case 'r':
-                    case 't':
-                    case '\\':
-                    case 'b': // ericw-tools extension, parsed by light, used to toggle bold text
-                              // regular two-char escapes
-                        *token_p++ = *pos++;
-                        break;
-                    case 'x':
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9': // too lazy to validate these. doesn't break stuff.
-                        break;
-                    case '\"':
-                        if (pos[2] == '\r' || pos[2] == '\n') {
-                            logging::print("WARNING: {}: escaped double-quote at end of string\n", location);
-                        } else {
-                            *token_p++ = *pos++;
-                        }
-                        break;
-                    default:
-                        logging::print("WARNING: {}: Unrecognised string escape - \\{}\n", location, pos[1]);
-                        break;
+                if (escapes_next(pos)) {
+                    *token_p++ = *pos++;
+                } else if (pos[1] == '\"') {
+                    logging::print("WARNING: {}: escaped double-quote at end of string\n", location);
+                } else if (pos[1] != 'x' && (pos[1] < '0' || pos[1] > '9')) {
+                    // \x and \0-9 are too lazy to validate. doesn't break stuff.
+                    logging::print("WARNING: {}: Unrecognised string escape - \\{}\n", location, pos[1]);
                 }
             }
             *token_p++ = *pos++;
@@ -201,6 +176,26 @@ out:
     return true;
 }
 
+bool parser_t::escapes_next(const char *pos)
+{
+    switch (pos[1]) {
+        case 'n':
+        case '\'':
+        case 'r':
+        case 't':
+        case '\\':
+        case 'b': // ericw-tools extension, parsed by light, used to toggle bold text
+            // regular two-char escapes
+            return true;
+        case '\"':
+            // an escaped quote right before the end of the line is taken as
+            // the end of the string instead
+            return pos[2] != '\r' && pos[2] != '\n';
+        default:
+            return false;
+    }
+}
+
 parser_t::state_type parser_t::state()
 {
     return state_type(pos, location);
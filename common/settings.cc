@@ -729,6 +729,8 @@ common_settings::common_settings()
       nocolor{this, "nocolor", false, &logging_group, "don't output color codes (for TB, etc)"},
       quiet{this, {"quiet", "noverbose"}, {&nopercent, &nostat, &noprogress}, &logging_group,
           "suppress non-important messages (equivalent to -nopercent -nostat -noprogress)"},
+      trace{this, "trace", "", &logging_group,
+          "write per-phase timings, counters and peak memory to this file as a Chrome trace (JSON)"},
       gamedir{this, "gamedir", "", &game_group,
           "override the default mod base directory. if this is not set, or if it is relative, it will be derived from the input file or the basedir if specified."},
       basedir{this, "basedir", "", &game_group,
@@ -22,7 +22,9 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <span>
 #include <vector>
 
 namespace fs
@@ -31,6 +33,22 @@ using namespace std::filesystem;
 
 using data = std::optional<std::vector<uint8_t>>;
 
+// a read-only view of file data. `owner` keeps the backing storage
+// (a memory mapping or a heap buffer) alive for as long as the view
+// exists, so views can be handed freely between threads.
+struct view
+{
+    std::shared_ptr<const void> owner;
+    std::span<const uint8_t> bytes;
+
+    inline explicit operator bool() const { return (bool)owner; }
+    inline const uint8_t *data() const { return bytes.data(); }
+    inline size_t size() const { return bytes.size(); }
+
+    // copy the viewed bytes into an owned buffer
+    inline std::vector<uint8_t> copy() const { return {bytes.begin(), bytes.end()}; }
+};
+
 struct archive_like
 {
     path pathname;
@@ -47,11 +65,24 @@ struct archive_like
     virtual bool contains(const path &filename) = 0;
 
     virtual data load(const path &filename) = 0;
+
+    // load without copying, if the archive supports it. archives
+    // that override this must be safe to call from multiple threads.
+    // the default implementation wraps load().
+    virtual view load_view(const path &filename);
 };
 
 // clear all initialized/loaded data from fs
 void clear();
 
+// when enabled, pak & wad archives stay mapped after clear(), and adding
+// one again reuses the mapping and its parsed directory as long as the
+// file's size and modification time haven't changed. on Windows, where a
+// mapped file can't be written, clear() unmaps them and only the parsed
+// directory is kept. for processes that compile many maps against the same
+// assets.
+void keep_archives(bool enable);
+
 // add the specified archive to the search path. must be the full
 // path to the archive. Archives can be directories or archive-like
 // files. Returns the archive if it already exists, the new
@@ -87,6 +118,13 @@ data load(const resolve_result &pos);
 // shortcut to load(where(p))
 data load(const path &p, bool prefer_loose = false);
 
+// attempt to load the specified resolve result as a view;
+// pak & wad files are served straight out of their memory mapping.
+view load_view(const resolve_result &pos);
+
+// shortcut to load_view(where(p))
+view load_view(const path &p, bool prefer_loose = false);
+
 struct archive_components
 {
     path archive, filename;
@@ -87,21 +87,26 @@ extern std::unordered_map<std::string, texture, case_insensitive_hash, case_inse
 // clears the texture cache
 void clear();
 
+// when enabled, decoded textures and metadata are kept after clear(), and
+// loading the same file again with the same contents reuses them instead
+// of decoding it again. for processes that compile many maps.
+void keep_decoded(bool enable);
+
 qvec3b calculate_average(const std::vector<qvec4b> &pixels);
 
 const texture *find(const std::string_view &str);
 
 // Load wal
 std::optional<texture> load_wal(
-    const std::string_view &name, const fs::data &file, bool meta_only, const gamedef_t *game);
+    const std::string_view &name, std::span<const uint8_t> file, bool meta_only, const gamedef_t *game);
 
 // Load Quake/Half Life mip (raw data)
 std::optional<texture> load_mip(
-    const std::string_view &name, const fs::data &file, bool meta_only, const gamedef_t *game);
+    const std::string_view &name, std::span<const uint8_t> file, bool meta_only, const gamedef_t *game);
 
 // stb_image.h loaders
 std::optional<texture> load_stb(
-    const std::string_view &name, const fs::data &file, bool meta_only, const gamedef_t *game);
+    const std::string_view &name, std::span<const uint8_t> file, bool meta_only, const gamedef_t *game);
 
 // list of supported extensions and their loaders
 constexpr struct
@@ -113,7 +118,7 @@ constexpr struct
     {".wal", ext::WAL, load_wal}, {".mip", ext::MIP, load_mip}, {"", ext::MIP, load_mip}};
 
 // Attempt to load a texture from the specified name.
-std::tuple<std::optional<texture>, fs::resolve_result, fs::data> load_texture(const std::string_view &name,
+std::tuple<std::optional<texture>, fs::resolve_result, fs::view> load_texture(const std::string_view &name,
     bool meta_only, const gamedef_t *game, const settings::common_settings &options, bool no_prefix = false);
 
 enum class meta_ext
@@ -123,10 +128,11 @@ enum class meta_ext
 };
 
 // Load wal
-std::optional<texture_meta> load_wal_meta(const std::string_view &name, const fs::data &file, const gamedef_t *game);
+std::optional<texture_meta> load_wal_meta(
+    const std::string_view &name, std::span<const uint8_t> file, const gamedef_t *game);
 
 std::optional<texture_meta> load_wal_json_meta(
-    const std::string_view &name, const fs::data &file, const gamedef_t *game);
+    const std::string_view &name, std::span<const uint8_t> file, const gamedef_t *game);
 
 // list of supported meta extensions and their loaders
 constexpr struct
@@ -138,9 +144,10 @@ constexpr struct
     {".wal_json", meta_ext::WAL_JSON, load_wal_json_meta}, {".wal", meta_ext::WAL, load_wal_meta}};
 
 // Attempt to load a texture meta from the specified name.
-std::tuple<std::optional<texture_meta>, fs::resolve_result, fs::data> load_texture_meta(
+std::tuple<std::optional<texture_meta>, fs::resolve_result, fs::view> load_texture_meta(
     const std::string_view &name, const gamedef_t *game, const settings::common_settings &options);
 
 // Loads textures referenced by the bsp into the texture cache.
+// Textures are decoded in parallel.
 void load_textures(const mbsp_t *bsp, const settings::common_settings &options);
 }; // namespace img
@@ -67,10 +67,14 @@ void preinitialize();
 // initialize logging subsystem
 void init(const fs::path &filename, const settings::common_settings &settings);
 
-// shutdown logging subsystem
+// block until everything printed so far has been written to the log file & stdout
+void flush();
+
+// shutdown logging subsystem; drains any queued messages first
 void close();
 
-// print to respective targets based on log flag
+// print to respective targets based on log flag. between init() and close(),
+// messages are queued and written out by a background thread.
 void print(flag logflag, const char *str);
 
 // print to respective targets based on log flag
@@ -163,6 +167,35 @@ struct percent_clock
     ~percent_clock();
 };
 
+// Machine-readable telemetry. When -trace <file> is given, timed scopes,
+// counters and peak memory samples are collected between init() and close(),
+// and close() writes them out as a Chrome trace (chrome://tracing, Perfetto)
+// with an extra "summary" object of per-phase totals for dashboards.
+// These are all no-ops when tracing is off.
+
+// whether -trace is enabled
+bool tracing();
+
+// record the current value of a named counter
+void counter(const char *name, int64_t value);
+
+// record the peak resident memory of the process so far
+void sample_memory();
+
+// times a named phase from construction to destruction. scopes opened
+// on the same thread nest in the trace. `name` must outlive the scope.
+struct timed_scope_t
+{
+    const char *name;
+    time_point start;
+
+    timed_scope_t(const char *name);
+    ~timed_scope_t();
+
+    timed_scope_t(const timed_scope_t &) = delete;
+    timed_scope_t &operator=(const timed_scope_t &) = delete;
+};
+
 // base class intended to be inherited for stat trackers;
 // they will automatically print the results at the end,
 // in the order of registration.
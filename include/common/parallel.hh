@@ -19,53 +19,117 @@
 */
 
 #include "common/log.hh"
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
 
+#include <algorithm>
 #include <atomic>
 
 // parallel extensions to logging
 namespace logging
 {
-template<typename TS, typename TE, typename Body>
-void parallel_for(const TS &start, const TE &end, const Body &func)
+/**
+ * Progress counter for a parallel loop.
+ *
+ * Workers add up the items they finish locally and publish them in batches,
+ * and percent() is only called when the shared count crosses one of ~1000
+ * steps, so fine-grained loops don't bounce the shared counter (and
+ * percent()'s lock) between cores on every item.
+ */
+class parallel_progress_t
 {
-    auto length = end - start;
-    std::atomic<uint64_t> progress = 0;
+    std::atomic<uint64_t> m_progress = 0;
+    const uint64_t m_length;
+    const uint64_t m_step;
+
+public:
+    inline parallel_progress_t(uint64_t length) : m_length(length), m_step(std::max<uint64_t>(1, length / 1000))
+    {
+        // starts the clock for the elapsed time
+        if (m_length) {
+            percent(0, m_length);
+        }
+    }
+
+    // number of items a worker should accumulate locally before calling add()
+    inline uint64_t batch_size() const { return m_step; }
+
+    // count `count` more items as done
+    inline void add(uint64_t count)
+    {
+        const uint64_t before = m_progress.fetch_add(count, std::memory_order_relaxed);
+        const uint64_t after = before + count;
+
+        // reaching m_length is reported by finish()
+        if (after < m_length && before / m_step != after / m_step) {
+            percent(after, m_length);
+        }
+    }
+
+    inline void finish() { percent(m_length, m_length); }
+};
 
-    tbb::parallel_for(start, end, [&](const auto &it) {
-        percent(progress++, length);
-        func(it);
+/**
+ * Calls func(first, last) on subranges of [start, end) in parallel. Each
+ * subrange is at least `grainsize` items (except at the end), so per-item
+ * overhead in the body can be amortized.
+ */
+template<typename T, typename Body>
+void parallel_for_range(const T &start, const T &end, size_t grainsize, const Body &func)
+{
+    parallel_progress_t progress(end - start);
+
+    tbb::parallel_for(tbb::blocked_range<T>(start, end, std::max<size_t>(grainsize, 1)), [&](const auto &range) {
+        func(range.begin(), range.end());
+        progress.add(range.size());
     });
 
-    percent(progress, length);
+    progress.finish();
+}
+
+template<typename TS, typename TE, typename Body>
+void parallel_for(const TS &start, const TE &end, const Body &func)
+{
+    parallel_for_range(start, static_cast<TS>(end), 1, [&](TS first, TS last) {
+        for (TS it = first; it != last; ++it) {
+            func(it);
+        }
+    });
 }
 
+namespace detail
+{
 template<typename Container, typename Body>
 void parallel_for_each(Container &container, const Body &func)
 {
-    auto length = std::size(container);
-    std::atomic<uint64_t> progress = 0;
+    parallel_progress_t progress(std::size(container));
+    tbb::enumerable_thread_specific<uint64_t> done(0);
 
     tbb::parallel_for_each(container, [&](auto &f) {
-        percent(progress++, length);
         func(f);
+
+        uint64_t &local = done.local();
+        if (++local >= progress.batch_size()) {
+            progress.add(local);
+            local = 0;
+        }
     });
 
-    percent(progress, length);
+    progress.finish();
 }
+} // namespace detail
 
 template<typename Container, typename Body>
-void parallel_for_each(const Container &container, const Body &func)
+void parallel_for_each(Container &container, const Body &func)
 {
-    auto length = std::size(container);
-    std::atomic<uint64_t> progress = 0;
-
-    tbb::parallel_for_each(container, [&](const auto &f) {
-        percent(progress++, length);
-        func(f);
-    });
+    detail::parallel_for_each(container, func);
+}
 
-    percent(progress, length);
+template<typename Container, typename Body>
+void parallel_for_each(const Container &container, const Body &func)
+{
+    detail::parallel_for_each(container, func);
 }
-} // namespace logging
\ No newline at end of file
+} // namespace logging
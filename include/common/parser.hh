@@ -159,6 +159,12 @@ struct parser_t : parser_base_t
 
     bool parse_token(parseflags flags = PARSE_NORMAL) override;
 
+    // whether the backslash at `pos`, inside a quoted token, escapes the
+    // character after it; that character is then copied as-is and can't end
+    // the token. anything that skips quoted tokens without parsing them
+    // should use this so it agrees with parse_token.
+    static bool escapes_next(const char *pos);
+
     using state_type = decltype(std::tie(pos, location));
 
     state_type state();
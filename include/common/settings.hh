@@ -595,6 +595,7 @@ public:
     setting_bool noprogress;
     setting_bool nocolor;
     setting_redirect quiet;
+    setting_path trace;
     setting_path gamedir;
     setting_path basedir;
     setting_enum<search_priority_t> filepriority;
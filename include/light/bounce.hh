@@ -25,9 +25,9 @@ namespace settings
 class worldspawn_keys;
 }
 struct mbsp_t;
+struct light_context_t;
 
 // public functions
 
-void ResetBounce();
-const std::vector<struct surfacelight_t> &BounceLights();
-void MakeBounceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
+void MakeBounceLights(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
+void GatherExtraBounces(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -135,27 +137,32 @@ public:
  *    Stores the RGB values to determine the light color
  */
 
-void ResetLightEntities();
-std::string TargetnameForLightStyle(int style);
-std::vector<std::unique_ptr<light_t>> &GetLights();
-const std::vector<entdict_t> &GetEntdicts();
-std::vector<sun_t> &GetSuns();
-std::vector<entdict_t> &GetRadLights();
+/**
+ * Visible bounds of each BSP leaf for -visapprox rays on maps with vis data,
+ * computed the first time a bounce or surface light point lands in the leaf.
+ * Empty if the leaf has no pvs.
+ */
+struct leaf_visible_bounds_t
+{
+    std::once_flag once;
+    std::optional<aabb3d> bounds;
+};
 
-const std::vector<std::unique_ptr<light_t>> &GetSurfaceLightTemplates();
+std::string TargetnameForLightStyle(light_context_t &ctx, int style);
 
-bool FaceMatchesSurfaceLightTemplate(
-    const mbsp_t *bsp, const mface_t *face, const modelinfo_t *face_modelinfo, const light_t &surflight, int surf_type);
+bool FaceMatchesSurfaceLightTemplate(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const modelinfo_t *face_modelinfo, const light_t &surflight, int surf_type);
 
-const entdict_t *FindEntDictWithKeyPair(const std::string &key, const std::string &value);
+const entdict_t *FindEntDictWithKeyPair(light_context_t &ctx, const std::string &key, const std::string &value);
 
-void LoadEntities(const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
-void SetupLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
-bool ParseLightsFile(const fs::path &fname);
-void WriteEntitiesToString(const settings::worldspawn_keys &cfg, mbsp_t *bsp);
-aabb3d EstimateVisibleBoundsAtPoint(const qvec3d &point);
+void LoadEntities(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
+void SetupLights(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
+bool ParseLightsFile(light_context_t &ctx, const fs::path &fname);
+void WriteEntitiesToString(light_context_t &ctx, const settings::worldspawn_keys &cfg, mbsp_t *bsp);
+aabb3d EstimateVisibleBoundsAtPoint(light_context_t &ctx, const qvec3d &point);
+aabb3d EstimateVisibleBoundsInLeaf(light_context_t &ctx, const mbsp_t *bsp, const qvec3d &point);
 
 bool EntDict_CheckNoEmptyValues(const mbsp_t *bsp, const entdict_t &entdict);
 
-entdict_t &WorldEnt();
+entdict_t &WorldEnt(light_context_t &ctx);
 std::tuple<qvec3d, bool> FixLightOnFace(const mbsp_t *bsp, const qvec3d &point, bool warn = true, float max_dist = 2.f);
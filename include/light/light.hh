@@ -23,6 +23,17 @@
 #include <common/bsputils.hh> // for faceextents_t
 
 #include <common/qvec.hh>
+#include <common/entdata.h> // for entdict_t
+#include <light/phong.hh> // for face_cache_t
+#include <light/surflight.hh> // for surfacelight_t
+
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace img
 {
@@ -51,6 +62,18 @@ constexpr float LightSample_Brightness(const T &color)
     return ((color[0] + color[1] + color[2]) / 3.0);
 }
 
+/**
+ * How a sun_t spreads its light over directions. NONE is a single direction
+ * (sunvec); the others stand in for a whole skydome or penumbra, which is
+ * integrated with -skydomesamples stratified directions at light time.
+ */
+enum class sun_distribution_t
+{
+    NONE,
+    DOME,
+    PENUMBRA
+};
+
 /**
  * A directional light, emitted from "sky*" textured faces.
  */
@@ -58,6 +81,11 @@ class sun_t
 {
 public:
     qvec3d sunvec;
+    sun_distribution_t distribution = sun_distribution_t::NONE;
+    // DOME: +1 for the upper hemisphere (_sunlight2), -1 for the lower (_sunlight3)
+    vec_t dome_sign = 1.0;
+    // PENUMBRA: angle/elevation of the central direction and the jitter range, all in radians
+    vec_t penumbra_angle = 0.0, penumbra_elevation = 0.0, penumbra_deviance = 0.0;
     vec_t sunlight;
     qvec3d sunlight_color;
     bool dirt;
@@ -85,6 +113,21 @@ using lightmapdict_t = std::vector<lightmap_t>;
 struct surfacelight_t;
 class raystream_occlusion_t;
 class raystream_intersection_t;
+struct facesup_t;
+struct bspx_decoupled_lm_perface;
+
+// lightmaps picked by SaveLightmapSurface for one face header, waiting to be
+// written once every face's offset into the output buffers is known
+struct lightmap_output_t
+{
+    mface_t *face;
+    facesup_t *facesup;
+    bspx_decoupled_lm_perface *facesup_decoupled;
+    const faceextents_t *extents;
+    const faceextents_t *output_extents;
+    // indices into lightsurf_t::lightmapsByStyle, in output order
+    std::vector<size_t> lightmaps;
+};
 
 struct lightsurf_t
 {
@@ -129,9 +172,10 @@ struct lightsurf_t
 
     /*
      pvs for the entire light surface. generated by ORing together
-     the pvs at each of the sample points
+     the pvs at each of the sample points. points into the run's
+     all_uncompressed_vis or pvs_pool; nullptr if the map has no vis
      */
-    std::vector<uint8_t> pvs;
+    const uint8_t *pvs = nullptr;
 
     // output width * extra
     int width;
@@ -143,6 +187,15 @@ struct lightsurf_t
     std::unique_ptr<raystream_intersection_t> intersection_stream;
 
     lightmapdict_t lightmapsByStyle;
+
+    // filled by SaveLightmapSurface, written by WriteLightmapSurface
+    std::vector<lightmap_output_t> outputs;
+
+    // with "_bounces" > 1: transfer from each bounce emitter face to this face, averaged
+    // over the samples, and the per-sample shape of that light. Filled by the first
+    // indirect pass so later bounces can be gathered without tracing.
+    std::vector<std::pair<int32_t, float>> bounce_transfer;
+    std::vector<float> bounce_shape;
 };
 
 /* debug */
@@ -171,23 +224,14 @@ enum class lightfile
     lit2 = 4
 };
 
-/* tracelist is a std::vector of pointers to modelinfo_t to use for LOS tests */
-extern std::vector<const modelinfo_t *> tracelist;
-extern std::vector<const modelinfo_t *> selfshadowlist;
-extern std::vector<const modelinfo_t *> shadowworldonlylist;
-extern std::vector<const modelinfo_t *> switchableshadowlist;
-
-extern int numDirtVectors;
-
-// other flags
+/* Dirtmapping borrowed from q3map2, originally by RaP7oR */
 
-extern bool dirt_in_use; // should any dirtmapping take place? set in SetupDirt
+constexpr size_t DIRT_NUM_ANGLE_STEPS = 16;
+constexpr size_t DIRT_NUM_ELEVATION_STEPS = 3;
+constexpr size_t DIRT_NUM_VECTORS = (DIRT_NUM_ANGLE_STEPS * DIRT_NUM_ELEVATION_STEPS);
 
 constexpr qvec3d vec3_white{255};
 
-extern int dump_facenum;
-extern int dump_vertnum;
-
 constexpr int CHANNEL_MASK_DEFAULT = 1;
 
 class modelinfo_t : public settings::setting_container
@@ -237,6 +281,13 @@ enum class visapprox_t
     RAYS
 };
 
+enum class shadowprepass_t
+{
+    NONE,
+    CONSERVATIVE,
+    FAST
+};
+
 enum class emissivequality_t
 {
     LOW,
@@ -298,6 +349,7 @@ public:
 
     /* bounce */
     setting_bool bounce;
+    setting_int32 bounces;
     setting_bool bouncestyled;
     setting_scalar bouncescale;
     setting_scalar bouncecolorscale;
@@ -371,6 +423,8 @@ public:
     setting_bool novanilla;
     setting_scalar gate;
     setting_int32 sunsamples;
+    setting_int32 skydomesamples;
+    setting_int32 skydomeseed;
     setting_bool arghradcompat;
     setting_bool nolighting;
     setting_vec3 debugface;
@@ -380,6 +434,11 @@ public:
     setting_set radlights;
     setting_int32 lightmap_scale;
     setting_extra extra;
+    setting_scalar extra_adaptive;
+    setting_bool raysort;
+    setting_enum<shadowprepass_t> shadowprepass;
+    setting_int32 dirtstep;
+    setting_bool dirtsteperror;
     setting_enum<emissivequality_t> emissivequality;
     setting_enum<visapprox_t> visapprox;
     setting_func lit;
@@ -391,6 +450,7 @@ public:
     setting_func bspx;
     setting_scalar world_units_per_luxel;
     setting_bool litonly;
+    setting_bool dedup_lightmaps;
     setting_bool nolights;
     setting_int32 facestyles;
     setting_bool exportobj;
@@ -423,33 +483,185 @@ public:
 };
 }; // namespace settings
 
-extern settings::light_settings light_options;
+/**
+ * Decompressed visdata for the whole map, stored as one flat array of rows.
+ *
+ * Rows are indexed by cluster for Q2, and by leaf number otherwise. Q1 leafs
+ * sharing a visofs (e.g. because of func_detail) share a row.
+ */
+struct uncompressed_vis_t
+{
+    size_t rowbytes = 0;
+    std::vector<uint8_t> rows;
+    // offset into `rows` for each cluster/leaf, or -1 if it has no visdata
+    std::vector<int64_t> offsets;
+
+    inline const uint8_t *row(int index) const
+    {
+        if (index < 0 || index >= offsets.size() || offsets[index] < 0) {
+            return nullptr;
+        }
+        return rows.data() + offsets[index];
+    }
+
+    void clear();
+};
+
+// returns the index of the leaf's row in uncompressed_vis_t
+int UncompressedVisIndex(const mbsp_t *bsp, const mleaf_t *leaf);
+
+/**
+ * Pool of decompressed pvs rows shared between light surfaces; surfaces whose
+ * merged pvs comes out the same point at a single copy.
+ */
+class pvs_pool_t
+{
+    size_t m_rowbytes = 0;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<uint8_t[]>> m_rows;
+    std::unordered_multimap<uint64_t, const uint8_t *> m_rows_by_hash;
 
-extern std::vector<uint8_t> filebase;
-extern std::vector<uint8_t> lit_filebase;
-extern std::vector<uint8_t> lux_filebase;
+public:
+    void reset(size_t rowbytes);
+    // returns a pooled row with the same contents as `row`; it stays valid
+    // until the next reset()
+    const uint8_t *intern(const uint8_t *row);
+    inline size_t size() const { return m_rows.size(); }
+    inline size_t rowbytes() const { return m_rowbytes; }
+};
 
-const std::unordered_map<int, std::vector<uint8_t>> &UncompressedVis();
+struct face_texture_cache
+{
+    const img::texture *image;
+    qvec3b averageColor;
+    qvec3d bounceColor;
+};
 
-bool IsOutputtingSupplementaryData();
+class light_t;
+struct leaf_visible_bounds_t;
+struct embree_scene_t;
 
-std::vector<std::unique_ptr<lightsurf_t>> &LightSurfaces();
+/*
+ * Everything a single run of light works on. light_main() creates a fresh
+ * one for each call and passes it down, so nothing carries over between runs
+ * and several maps can be lit in the same process.
+ */
+struct light_context_t
+{
+    settings::light_settings options;
+
+    std::vector<std::unique_ptr<modelinfo_t>> modelinfo;
+    /* tracelist is a std::vector of pointers to modelinfo_t to use for LOS tests */
+    std::vector<const modelinfo_t *> tracelist;
+    std::vector<const modelinfo_t *> selfshadowlist;
+    std::vector<const modelinfo_t *> shadowworldonlylist;
+    std::vector<const modelinfo_t *> switchableshadowlist;
+
+    std::vector<surfflags_t> extended_texinfo_flags;
+    std::vector<face_texture_cache> face_textures;
+
+    // intermediate representation of lightmap surfaces
+    std::vector<std::unique_ptr<lightsurf_t>> light_surfaces;
+    std::vector<facesup_t> faces_sup; // lit2/bspx stuff
+    std::vector<bspx_decoupled_lm_perface> facesup_decoupled_global;
+
+    /// start of lightmap data
+    std::vector<uint8_t> filebase;
+    /// size of the lightmap data in greyscale samples (lit/lux data is 3x this)
+    int file_p = 0;
+    /// start of litfile data
+    std::vector<uint8_t> lit_filebase;
+    /// start of luxfile data
+    std::vector<uint8_t> lux_filebase;
+
+    uncompressed_vis_t all_uncompressed_vis;
+    pvs_pool_t pvs_pool;
+
+    bool dirt_in_use = false; // should any dirtmapping take place? set in SetupDirt
+    std::array<qvec3d, DIRT_NUM_VECTORS> dirtVectors{};
+    int numDirtVectors = 0;
+
+    int dump_facenum = -1;
+    int dump_vertnum = -1;
+
+    // entities
+    std::vector<std::unique_ptr<light_t>> all_lights;
+    std::vector<sun_t> all_suns;
+    std::vector<entdict_t> entdicts;
+    std::vector<entdict_t> radlights;
+    std::vector<std::pair<std::string, int>> lightstyleForTargetname;
+    std::vector<std::unique_ptr<light_t>> surfacelight_templates;
+    std::ofstream surflights_dump_file;
+    fs::path surflights_dump_filename;
+    std::vector<leaf_visible_bounds_t> leaf_visible_bounds;
+
+    // surface lights
+    std::vector<surfacelight_t> surfacelights;
+    std::map<int, std::vector<int>> surfacelightsByFacenum;
+    size_t total_surflight_points = 0;
+
+    // bounce lights
+    std::vector<surfacelight_t> bouncelights;
+    std::atomic_size_t bouncelightpoints = 0;
+    // style 0 color each face emits for the first bounce, for "_bounces"
+    std::vector<qvec3d> bounce_emitcolors;
+
+    // phong
+    bool builtPhongCaches = false;
+    const mbsp_t *phongBsp = nullptr;
+    // index of each face's first vertex in the per-face-vertex arrays below
+    std::vector<size_t> faceVertOffsets;
+    std::vector<face_normal_t> vertex_normals;
+    // for each face edge, the neighbouring face that is smoothed with it across that edge
+    std::vector<const mface_t *> edgeSmoothedFaces;
+    face_adjacency_t smoothFaces;
+    face_adjacency_t vertsToFaces;
+    face_adjacency_t planesToFaces;
+    std::vector<face_cache_t> FaceCache;
+
+    // shadow casting geometry; built by Embree_TraceInit
+    std::unique_ptr<embree_scene_t> embree;
+
+    // stats
+    std::atomic<uint32_t> total_light_rays = 0, total_light_ray_hits = 0, total_samplepoints = 0;
+    std::atomic<uint32_t> total_bounce_rays = 0, total_bounce_ray_hits = 0;
+    std::atomic<uint32_t> total_surflight_rays = 0, total_surflight_ray_hits = 0; // mxd
+    std::atomic<uint32_t> fully_transparent_lightmaps = 0;
+    std::atomic<uint32_t> total_adaptive_luxels = 0, total_adaptive_supersampled = 0;
+    std::atomic<uint32_t> total_prepass_rays_saved = 0, total_prepass_lit = 0, total_prepass_shadowed = 0,
+                          total_prepass_mixed = 0;
+    std::atomic<uint32_t> total_dirt_samples = 0, total_dirt_traced = 0;
+    // -dirtsteperror: sum and max of the per-sample occlusion error, in millionths
+    std::atomic<uint64_t> total_dirtstep_error_micro = 0;
+    std::atomic<uint32_t> max_dirtstep_error_micro = 0;
+    // rays traced by Embree_Intersect1M/Embree_Occluded1M, and the time spent in them
+    // (including -raysort's sorting), summed over all threads
+    std::atomic<uint64_t> total_traced_rays = 0, total_trace_time_ns = 0;
+    bool warned_about_light_map_overflow = false, warned_about_light_style_overflow = false;
+
+    // defined in light.cc, where the types only forward declared here are complete
+    light_context_t();
+    ~light_context_t();
+};
 
-extern std::vector<surfflags_t> extended_texinfo_flags;
+bool IsOutputtingSupplementaryData(const light_context_t &ctx);
 
 // public functions
 
-void FixupGlobalSettings(void);
-void GetFileSpace(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int size);
-void GetFileSpace_PreserveOffsetInBsp(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int lightofs);
-const modelinfo_t *ModelInfoForModel(const mbsp_t *bsp, int modelnum);
+void FixupGlobalSettings(light_context_t &ctx);
+void GetFileSpace(light_context_t &ctx, uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int offset);
+const modelinfo_t *ModelInfoForModel(const light_context_t &ctx, const mbsp_t *bsp, int modelnum);
 /**
  * returns nullptr for "skip" faces
  */
-const modelinfo_t *ModelInfoForFace(const mbsp_t *bsp, int facenum);
-const img::texture *Face_Texture(const mbsp_t *bsp, const mface_t *face);
-const qvec3b &Face_LookupTextureColor(const mbsp_t *bsp, const mface_t *face);
-const qvec3d &Face_LookupTextureBounceColor(const mbsp_t *bsp, const mface_t *face);
-void light_reset();
+const modelinfo_t *ModelInfoForFace(const light_context_t &ctx, const mbsp_t *bsp, int facenum);
+const img::texture *Face_Texture(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face);
+const qvec3b &Face_LookupTextureColor(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face);
+const qvec3d &Face_LookupTextureBounceColor(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face);
+// runs light on the bsp given on the command line in a fresh light_context_t
 int light_main(int argc, const char **argv);
 int light_main(const std::vector<std::string> &args);
+// the same, in a context supplied by the caller (which must not have been used
+// for another run), so the caller can inspect it afterwards
+int light_main(light_context_t &ctx, int argc, const char **argv);
+int light_main(light_context_t &ctx, const std::vector<std::string> &args);
@@ -23,5 +23,6 @@
 
 struct bspdata_t;
 
-std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3d world_point);
-void LightGrid(bspdata_t *bspdata);
+std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(
+    light_context_t &ctx, const mbsp_t *bsp, qvec3d world_point);
+void LightGrid(light_context_t &ctx, bspdata_t *bspdata);
@@ -0,0 +1,65 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <common/qvec.hh>
+
+#include <vector>
+
+// Filters applied to each lightmap when it's written out.
+//
+// Special handling of alpha channel:
+// - "alpha channel" is expected to be 0 or 1. This gets set to 0 if the sample
+// point is occluded (bmodel sticking outside of the world, or inside a shadow-
+// casting bmodel that is overlapping a world face), otherwise it's 1.
+//
+// - If alpha is 0 the sample doesn't contribute to the filter kernel.
+// - If all the samples in the filter kernel have alpha=0, write a sample with alpha=0
+//   (but still average the colors, important so that minlight still works properly
+//    for bmodels that go outside of the world).
+
+// an image stored as one float plane per channel, so the filters below can
+// run over whole rows at a time
+struct lightmap_image_t
+{
+    int width = 0, height = 0;
+    std::vector<float> r, g, b, a;
+
+    // doesn't shrink the planes, so images can be reused as scratch space
+    void resize(int w, int h);
+
+    inline size_t size() const { return static_cast<size_t>(width) * height; }
+
+    inline qvec4f get(size_t i) const { return {r[i], g[i], b[i], a[i]}; }
+
+    inline void set(size_t i, const qvec4f &color)
+    {
+        r[i] = color[0];
+        g[i] = color[1];
+        b[i] = color[2];
+        a[i] = color[3];
+    }
+};
+
+void HighlightSeams(lightmap_image_t &image);
+// returns true if the whole image is transparent
+bool FloodFillTransparent(lightmap_image_t &image);
+void BoxBlurImage(const lightmap_image_t &input, lightmap_image_t &output, int radius);
+void IntegerDownsampleImage(const lightmap_image_t &input, lightmap_image_t &output, int factor);
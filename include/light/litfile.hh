@@ -26,6 +26,7 @@
 #include <common/fs.hh>
 
 struct mbsp_t;
+struct light_context_t;
 
 constexpr int32_t LIT_VERSION = 1;
 
@@ -66,5 +67,6 @@ struct facesup_t
     twosided<uint16_t> extent;
 };
 
-void WriteLitFile(const mbsp_t *bsp, const std::vector<facesup_t> &facesup, const fs::path &filename, int version);
-void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version);
+void WriteLitFile(light_context_t &ctx, const mbsp_t *bsp, const std::vector<facesup_t> &facesup,
+    const fs::path &filename, int version);
+void WriteLuxFile(light_context_t &ctx, const mbsp_t *bsp, const fs::path &filename, int version);
@@ -22,7 +22,9 @@
 #include <common/qvec.hh>
 
 #include <atomic>
+#include <functional>
 #include <memory>
+#include <vector>
 
 struct mface_t;
 struct mbsp_t;
@@ -36,27 +38,36 @@ struct bspx_decoupled_lm_perface;
 class faceextents_t;
 class light_t;
 struct facesup_t;
+struct light_context_t;
 
-extern std::atomic<uint32_t> total_light_rays, total_light_ray_hits, total_samplepoints;
-extern std::atomic<uint32_t> total_bounce_rays, total_bounce_ray_hits;
-extern std::atomic<uint32_t> total_surflight_rays, total_surflight_ray_hits; // mxd
-extern std::atomic<uint32_t> fully_transparent_lightmaps;
-
-void PrintFaceInfo(const mface_t *face, const mbsp_t *bsp);
+void PrintFaceInfo(light_context_t &ctx, const mface_t *face, const mbsp_t *bsp);
 // FIXME: remove light param. add normal param and dir params.
 vec_t GetLightValue(const settings::worldspawn_keys &cfg, const light_t *entity, vec_t dist);
-void SetupDirt(settings::worldspawn_keys &cfg);
-std::unique_ptr<lightsurf_t> CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const facesup_t *facesup,
-    const bspx_decoupled_lm_perface *facesup_decoupled, const settings::worldspawn_keys &cfg);
-bool Face_IsLightmapped(const mbsp_t *bsp, const mface_t *face);
+void SetupDirt(light_context_t &ctx, settings::worldspawn_keys &cfg);
+std::unique_ptr<lightsurf_t> CreateLightmapSurface(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const facesup_t *facesup, const bspx_decoupled_lm_perface *facesup_decoupled, const settings::worldspawn_keys &cfg);
+bool Face_IsLightmapped(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face);
 bool Face_IsEmissive(const mbsp_t *bsp, const mface_t *face);
-void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
-void IndirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
-void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
+uint64_t EstimateDirectLightFaceCost(light_context_t &ctx, const mbsp_t *bsp, const lightsurf_t &lightsurf);
+void DirectLightFace(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
+// traces the dirt occlusion of the samples flagged in the second argument (all of them if it's empty)
+using dirt_trace_fn = std::function<void(lightsurf_t *, const std::vector<uint8_t> &)>;
+// -dirtstep: traces a grid of every `step` samples, interpolates the rest, and with
+// `measure_error` (-dirtsteperror) adds the error against tracing every sample to the stats
+void LightFace_CalculateDirtStepped(
+    light_context_t &ctx, lightsurf_t *lightsurf, int step, bool measure_error, const dirt_trace_fn &trace);
+void IndirectLightFace(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
+void AddExtraBounceToFace(light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const qvec3d &received);
+void PostProcessLightFace(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
 void FinishLightmapSurface(const mbsp_t *bsp, lightsurf_t *lightsurf);
-void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
+void SaveLightmapSurface(light_context_t &ctx, const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     bspx_decoupled_lm_perface *facesup_decoupled, lightsurf_t *lightsurf, const faceextents_t &extents,
     const faceextents_t &output_extents);
+std::vector<int> LightmapSurfaceBlocks(light_context_t &ctx, const lightsurf_t *lightsurf);
+void WriteLightmapSurface(light_context_t &ctx, const mbsp_t *bsp, lightsurf_t *lightsurf, const int *offsets);
 
 struct lightgrid_sample_t
 {
@@ -83,5 +94,4 @@ struct lightgrid_samples_t
     bool operator==(const lightgrid_samples_t &other) const;
 };
 
-lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_point);
-void ResetLtFace();
+lightgrid_samples_t CalcLightgridAtPoint(light_context_t &ctx, const mbsp_t *bsp, const qvec3d &world_point);
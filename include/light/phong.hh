@@ -20,14 +20,14 @@
 
 #pragma once
 
-#include <set>
-#include <map>
+#include <span>
 #include <vector>
 
 #include <common/qvec.hh>
 
 struct mbsp_t;
 struct mface_t;
+struct light_context_t;
 
 struct neighbour_t
 {
@@ -35,20 +35,35 @@ struct neighbour_t
     qvec3f p0, p1;
 };
 
-void CalculateVertexNormals(const mbsp_t *bsp);
-const face_normal_t &GetSurfaceVertexNormal(const mbsp_t *bsp, const mface_t *f, const int vertindex);
-bool FacesSmoothed(const mface_t *f1, const mface_t *f2);
-const std::set<const mface_t *> &GetSmoothFaces(const mface_t *face);
-const std::vector<const mface_t *> &GetPlaneFaces(const mface_t *face);
-const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const int edgeindex);
-int Q2_FacePhongValue(const mbsp_t *bsp, const mface_t *face);
-
-/// a directed edge can be used by more than one face, e.g. two cube touching just along an edge
-using edgeToFaceMap_t = std::map<std::pair<int, int>, std::vector<const mface_t *>>;
+void CalculateVertexNormals(light_context_t &ctx, const mbsp_t *bsp);
+const face_normal_t &GetSurfaceVertexNormal(
+    light_context_t &ctx, const mbsp_t *bsp, const mface_t *f, const int vertindex);
+bool FacesSmoothed(light_context_t &ctx, const mface_t *f1, const mface_t *f2);
+std::span<const mface_t *const> GetSmoothFaces(light_context_t &ctx, const mface_t *face);
+std::span<const mface_t *const> GetPlaneFaces(light_context_t &ctx, const mface_t *face);
+const mface_t *Face_EdgeIndexSmoothed(light_context_t &ctx, const mbsp_t *bsp, const mface_t *f, const int edgeindex);
+int Q2_FacePhongValue(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face);
 
 std::vector<neighbour_t> NeighbouringFaces_new(const mbsp_t *bsp, const mface_t *face);
-std::vector<const mface_t *> FacesUsingVert(int vertnum);
-const edgeToFaceMap_t &GetEdgeToFaceMap();
+std::vector<const mface_t *> FacesUsingVert(light_context_t &ctx, int vertnum);
+
+/**
+ * Flat "key -> faces" adjacency, stored as compressed sparse rows: the faces
+ * for `key` are faces[offsets[key]] up to faces[offsets[key + 1]], in face order.
+ */
+struct face_adjacency_t
+{
+    std::vector<size_t> offsets;
+    std::vector<const mface_t *> faces;
+
+    std::span<const mface_t *const> operator[](size_t key) const
+    {
+        if (key + 1 >= offsets.size()) {
+            return {};
+        }
+        return {faces.data() + offsets[key], faces.data() + offsets[key + 1]};
+    }
+};
 
 class face_cache_t
 {
@@ -73,5 +88,4 @@ public:
     const std::vector<neighbour_t> &neighbours() const { return m_neighbours; }
 };
 
-const face_cache_t &FaceCacheForFNum(int fnum);
-void ResetPhong();
+const face_cache_t &FaceCacheForFNum(light_context_t &ctx, int fnum);
@@ -30,6 +30,7 @@ See file, 'COPYING', for details.
 struct mleaf_t;
 struct mface_t;
 struct mbsp_t;
+struct light_context_t;
 namespace settings
 {
 class worldspawn_keys;
@@ -57,6 +58,10 @@ struct surfacelight_t
 
     int32_t style;
 
+    // bounce lights: the face they were made from and its area per point, for "_bounces"
+    int32_t facenum = -1;
+    float point_area = 0;
+
         // rescale faces to account for perpendicular lights
     bool rescale;
     std::optional<vec_t> minlight_scale;
@@ -64,9 +69,7 @@ struct surfacelight_t
 
 class light_t;
 
-void ResetSurflight();
-std::vector<surfacelight_t> &GetSurfaceLights();
-size_t GetSurflightPoints();
-std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(const mbsp_t *bsp, const mface_t *face);
-const std::vector<int> &SurfaceLightsForFaceNum(int facenum);
-void MakeRadiositySurfaceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
+std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(
+    light_context_t &ctx, const mbsp_t *bsp, const mface_t *face);
+const std::vector<int> &SurfaceLightsForFaceNum(light_context_t &ctx, int facenum);
+void MakeRadiositySurfaceLights(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
@@ -21,15 +21,17 @@
 
 #include <common/aligned_allocator.hh>
 #include <common/qvec.hh>
+#include <common/aabb.hh>
 #include <common/log.hh> // for FError
+#include <light/light.hh> // for light_context_t
 
 #include <vector>
+#include <atomic>
 
 struct mbsp_t;
 class modelinfo_t;
 
-void ResetEmbree();
-void Embree_TraceInit(const mbsp_t *bsp);
+void Embree_TraceInit(light_context_t &ctx, const mbsp_t *bsp);
 
 class raystream_embree_common_t
 {
@@ -39,7 +41,8 @@ public:
     std::vector<qvec3f> _ray_colors;
     std::vector<qvec3d> _ray_normalcontribs;
 
-    std::vector<bool> _ray_hit_glass;
+    // not vector<bool>: large streams are traced in parallel ranges, which would share its words
+    std::vector<uint8_t> _ray_hit_glass;
     std::vector<qvec3f> _ray_glass_color;
     std::vector<float> _ray_glass_opacity;
 
@@ -103,8 +106,6 @@ public:
 #include <embree3/rtcore.h>
 #include <embree3/rtcore_ray.h>
 
-extern RTCScene scene;
-
 class light_t;
 struct mface_t;
 struct mtexinfo_t;
@@ -139,13 +140,25 @@ inline RTCRayHit SetupRay(unsigned rayindex, const qvec3d &start, const qvec3d &
 
 class light_t;
 
+struct ray_source_info;
+
+// trace a ray stream, reordered for coherence first if -raysort is set; results are written back in push order.
+// large streams are traced in parallel ranges, so idle threads can help with a large face
+void Embree_Intersect1M(ray_source_info *context, RTCRayHit *rays, unsigned int numrays);
+void Embree_Occluded1M(ray_source_info *context, RTCRay *rays, unsigned int numrays);
+
+// returns true if no triangle in the scene can intersect a segment that lies inside bounds
+bool Embree_BoundsUnobstructed(const light_context_t &ctx, const aabb3d &bounds);
+
 struct ray_source_info : public RTCIntersectContext
 {
+    light_context_t &ctx; // the run the ray belongs to, for the scene and the trace counters
     raystream_embree_common_t *raystream; // may be null if this ray is not from a ray stream
     const modelinfo_t *self;
     int shadowmask;
 
-    ray_source_info(raystream_embree_common_t *raystream_, const modelinfo_t *self_, int shadowmask_);
+    ray_source_info(
+        light_context_t &ctx_, raystream_embree_common_t *raystream_, const modelinfo_t *self_, int shadowmask_);
 };
 
 struct triinfo
@@ -174,9 +187,23 @@ struct sceneinfo
     std::vector<triinfo> triInfo;
 };
 
-extern sceneinfo skygeom; // sky. always occludes.
-extern sceneinfo solidgeom; // solids. always occludes.
-extern sceneinfo filtergeom; // conditional occluders.. needs to run ray intersection filter
+// the Embree scene of one run, built by Embree_TraceInit
+struct embree_scene_t
+{
+    RTCDevice device = nullptr;
+    RTCScene scene = nullptr;
+
+    sceneinfo skygeom; // sky. always occludes.
+    sceneinfo solidgeom; // solids. always occludes.
+    sceneinfo filtergeom; // conditional occluders.. needs to run ray intersection filter
+
+    const mbsp_t *bsp = nullptr;
+
+    embree_scene_t() = default;
+    embree_scene_t(const embree_scene_t &) = delete;
+    embree_scene_t &operator=(const embree_scene_t &) = delete;
+    ~embree_scene_t();
+};
 
 enum class hittype_t : uint8_t
 {
@@ -185,14 +212,14 @@ enum class hittype_t : uint8_t
     SKY = 2
 };
 
-inline const sceneinfo &Embree_SceneinfoForGeomID(unsigned int geomID)
+inline const sceneinfo &Embree_SceneinfoForGeomID(const embree_scene_t &embree, unsigned int geomID)
 {
-    if (geomID == skygeom.geomID) {
-        return skygeom;
-    } else if (geomID == solidgeom.geomID) {
-        return solidgeom;
-    } else if (geomID == filtergeom.geomID) {
-        return filtergeom;
+    if (geomID == embree.skygeom.geomID) {
+        return embree.skygeom;
+    } else if (geomID == embree.solidgeom.geomID) {
+        return embree.solidgeom;
+    } else if (geomID == embree.filtergeom.geomID) {
+        return embree.filtergeom;
     } else {
         FError("unexpected geomID");
     }
@@ -232,32 +259,32 @@ public:
         _numrays++;
     }
 
-    inline void tracePushedRaysIntersection(const modelinfo_t *self, int shadowmask)
+    inline void tracePushedRaysIntersection(light_context_t &ctx, const modelinfo_t *self, int shadowmask)
     {
         if (!_numrays)
             return;
 
-        ray_source_info ctx2(this, self, shadowmask);
-        rtcIntersect1M(scene, &ctx2, _rays.data(), _numrays, sizeof(_rays[0]));
+        ray_source_info ctx2(ctx, this, self, shadowmask);
+        Embree_Intersect1M(&ctx2, _rays.data(), _numrays);
     }
 
     inline qvec3d getPushedRayDir(size_t j) { return {_rays[j].ray.dir_x, _rays[j].ray.dir_y, _rays[j].ray.dir_z}; }
 
     inline float getPushedRayHitDist(size_t j) { return _rays[j].ray.tfar; }
 
-    inline hittype_t getPushedRayHitType(size_t j)
+    inline hittype_t getPushedRayHitType(const light_context_t &ctx, size_t j)
     {
         const unsigned id = _rays[j].hit.geomID;
         if (id == RTC_INVALID_GEOMETRY_ID) {
             return hittype_t::NONE;
-        } else if (id == skygeom.geomID) {
+        } else if (id == ctx.embree->skygeom.geomID) {
             return hittype_t::SKY;
         } else {
             return hittype_t::SOLID;
         }
     }
 
-    inline const triinfo *getPushedRayHitFaceInfo(size_t j)
+    inline const triinfo *getPushedRayHitFaceInfo(const light_context_t &ctx, size_t j)
     {
         const RTCRayHit &ray = _rays[j];
 
@@ -265,7 +292,7 @@ public:
             return nullptr;
         }
 
-        const sceneinfo &si = Embree_SceneinfoForGeomID(ray.hit.geomID);
+        const sceneinfo &si = Embree_SceneinfoForGeomID(*ctx.embree, ray.hit.geomID);
         const triinfo *face = &si.triInfo.at(ray.hit.primID);
         Q_assert(face != nullptr);
 
@@ -306,13 +333,13 @@ public:
         _numrays++;
     }
 
-    inline void tracePushedRaysOcclusion(const modelinfo_t *self, int shadowmask)
+    inline void tracePushedRaysOcclusion(light_context_t &ctx, const modelinfo_t *self, int shadowmask)
     {
         if (!_numrays)
             return;
 
-        ray_source_info ctx2(this, self, shadowmask);
-        rtcOccluded1M(scene, &ctx2, _rays.data(), _numrays, sizeof(_rays[0]));
+        ray_source_info ctx2(ctx, this, self, shadowmask);
+        Embree_Occluded1M(&ctx2, _rays.data(), _numrays);
     }
 
     inline bool getPushedRayOccluded(size_t j) { return (_rays[j].tfar < 0.0f); }
@@ -31,8 +31,15 @@
 class mapentity_t;
 struct maptexinfo_t;
 struct mapface_t;
+struct mapdata_t;
+struct qbsp_context_t;
 struct qbsp_plane_t;
 
+namespace settings
+{
+class qbsp_settings;
+}
+
 struct side_t
 {
     winding_t w;
@@ -48,10 +55,10 @@ struct side_t
     side_t clone_non_winding_data() const;
     side_t clone() const;
 
-    bool is_visible() const;
-    const maptexinfo_t &get_texinfo() const;
-    const qbsp_plane_t &get_plane() const;
-    const qbsp_plane_t &get_positive_plane() const;
+    bool is_visible(const mapdata_t &map) const;
+    const maptexinfo_t &get_texinfo(const mapdata_t &map) const;
+    const qbsp_plane_t &get_plane(const mapdata_t &map) const;
+    const qbsp_plane_t &get_positive_plane(const mapdata_t &map) const;
 };
 
 class mapbrush_t;
@@ -86,15 +93,15 @@ struct bspbrush_t
     qvec3d sphere_origin;
     double sphere_radius;
 
-    bool update_bounds(bool warn_on_failures);
+    bool update_bounds(const settings::qbsp_settings &options, bool warn_on_failures);
 
     ptr copy_unique() const;
 
     bspbrush_t clone() const;
 
-    bool contains_point(const qvec3d &point, vec_t epsilon = 0.0) const;
+    bool contains_point(const mapdata_t &map, const qvec3d &point, vec_t epsilon = 0.0) const;
 };
 
-std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush, const contentflags_t &contents,
-    hull_index_t hullnum, std::optional<std::reference_wrapper<size_t>> num_clipped);
-bool CreateBrushWindings(bspbrush_t &brush);
\ No newline at end of file
+std::optional<bspbrush_t> LoadBrush(qbsp_context_t &ctx, const mapentity_t &src, mapbrush_t &mapbrush,
+    const contentflags_t &contents, hull_index_t hullnum, std::optional<std::reference_wrapper<size_t>> num_clipped);
+bool CreateBrushWindings(qbsp_context_t &ctx, bspbrush_t &brush);
\ No newline at end of file
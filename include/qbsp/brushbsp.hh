@@ -73,11 +73,11 @@ from basewinding for plane
 ================
 */
 template<typename T>
-bool WindingIsHuge(const T &w)
+bool WindingIsHuge(const settings::qbsp_settings &options, const T &w)
 {
     for (size_t i = 0; i < w.size(); i++) {
         for (size_t j = 0; j < 3; j++) {
-            if (fabs(w[i][j]) > qbsp_options.worldextent.value()) {
+            if (fabs(w[i][j]) > options.worldextent.value()) {
                 return true;
             }
         }
@@ -97,7 +97,8 @@ enum tree_split_t
     FAST
 };
 
-vec_t BrushVolume(const bspbrush_t &brush);
-bspbrush_t::ptr BrushFromBounds(const aabb3d &bounds);
-void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &brushes, tree_split_t split_type);
-void ChopBrushes(bspbrush_t::container &brushes, bool allow_fragmentation);
\ No newline at end of file
+vec_t BrushVolume(qbsp_context_t &ctx, const bspbrush_t &brush);
+bspbrush_t::ptr BrushFromBounds(qbsp_context_t &ctx, const aabb3d &bounds);
+void BrushBSP(qbsp_context_t &ctx, tree_t &tree, mapentity_t &entity, const bspbrush_t::container &brushes,
+    tree_split_t split_type);
+void ChopBrushes(qbsp_context_t &ctx, bspbrush_t::container &brushes, bool allow_fragmentation);
\ No newline at end of file
@@ -34,8 +34,8 @@ struct side_t;
 
 std::unique_ptr<face_t> NewFaceFromFace(const face_t *in);
 std::unique_ptr<face_t> CopyFace(const face_t *in);
-std::tuple<std::unique_ptr<face_t>, std::unique_ptr<face_t>> SplitFace(
+std::tuple<std::unique_ptr<face_t>, std::unique_ptr<face_t>> SplitFace(qbsp_context_t &ctx, 
     std::unique_ptr<face_t> in, const qplane3d &split);
 void UpdateFaceSphere(face_t *in);
 
-bspbrush_t::container CSGFaces(bspbrush_t::container brushes);
+bspbrush_t::container CSGFaces(qbsp_context_t &ctx, bspbrush_t::container brushes);
@@ -28,7 +28,7 @@
 struct face_t;
 struct node_t;
 
-void ExportObj_Faces(const std::string &filesuffix, const std::vector<const face_t *> &faces);
-void ExportObj_Brushes(const std::string &filesuffix, const bspbrush_t::container &brushes);
-void ExportObj_Nodes(const std::string &filesuffix, const node_t *nodes);
-void ExportObj_Marksurfaces(const std::string &filesuffix, const node_t *nodes);
+void ExportObj_Faces(qbsp_context_t &ctx, const std::string &filesuffix, const std::vector<const face_t *> &faces);
+void ExportObj_Brushes(qbsp_context_t &ctx, const std::string &filesuffix, const bspbrush_t::container &brushes);
+void ExportObj_Nodes(qbsp_context_t &ctx, const std::string &filesuffix, const node_t *nodes);
+void ExportObj_Marksurfaces(qbsp_context_t &ctx, const std::string &filesuffix, const node_t *nodes);
@@ -24,6 +24,7 @@
 #include <list>
 
 struct node_t;
+struct qbsp_context_t;
 
-void MakeMarkFaces(node_t *headnode);
-void MakeFaces(node_t *node);
+void MakeMarkFaces(qbsp_context_t &ctx, node_t *headnode);
+void MakeFaces(qbsp_context_t &ctx, node_t *node);
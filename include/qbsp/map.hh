@@ -37,6 +37,8 @@
 #include <shared_mutex>
 #include <string_view>
 
+#include <tbb/concurrent_vector.h>
+
 struct mapface_t
 {
     size_t planenum;
@@ -76,15 +78,15 @@ struct mapface_t
     // for the main hull.
     bool bevel = false;
 
-    bool set_planepts(const std::array<qvec3d, 3> &pts);
+    bool set_planepts(mapdata_t &map, const std::array<qvec3d, 3> &pts);
 
-    const maptexinfo_t &get_texinfo() const;
+    const maptexinfo_t &get_texinfo(const mapdata_t &map) const;
 
-    const texvecf &get_texvecs() const;
-    void set_texvecs(const texvecf &vecs);
+    const texvecf &get_texvecs(const mapdata_t &map) const;
+    void set_texvecs(qbsp_context_t &ctx, const texvecf &vecs);
 
-    const qbsp_plane_t &get_plane() const;
-    const qbsp_plane_t &get_positive_plane() const;
+    const qbsp_plane_t &get_plane(const mapdata_t &map) const;
+    const qbsp_plane_t &get_positive_plane(const mapdata_t &map) const;
 };
 
 enum class brushformat_t
@@ -174,19 +176,6 @@ struct mapplane_t : qbsp_plane_t
 struct planehash_t;
 struct vertexhash_t;
 
-struct hashedge_t
-{
-    size_t v1;
-    size_t v2;
-
-    int64_t edge_index;
-
-    /**
-     * the face that edge v1 -> v2 belongs to
-     */
-    const face_t *face;
-};
-
 struct mapdata_t
 {
     /* Arrays of actual items */
@@ -198,13 +187,19 @@ struct mapdata_t
     // this vector stores all of the planes that can potentially be
     // output in the BSP, from the map's own sides. The positive planes
     // come first (are even-numbered, with 0 being even) and the negative
-    // planes are odd-numbered.
-    std::vector<mapplane_t> planes;
+    // planes are odd-numbered. Lookups may run concurrently with each
+    // other and with insertions, and indices are never invalidated; but
+    // the number a new plane gets depends on the order planes are added
+    // in, so anything that has to produce the same .bsp regardless of
+    // thread count must add new planes from a single thread.
+    tbb::concurrent_vector<mapplane_t> planes;
 
     // planes indices (into the `planes` vector)
     std::unique_ptr<planehash_t> plane_hash;
 
     mapdata_t();
+    ~mapdata_t();
+    mapdata_t &operator=(mapdata_t &&);
 
     // add the specified plane to the list
     size_t add_plane(const qplane3d &plane);
@@ -216,10 +211,11 @@ struct mapdata_t
     size_t find_plane(const qplane3d &plane);
 
     // find the specified plane in the list if it exists, or
-    // return a new one
+    // return a new one. safe to call concurrently, but see `planes`
+    // for why new planes should be added serially.
     size_t add_or_find_plane(const qplane3d &plane);
 
-    const qbsp_plane_t &get_plane(size_t pnum);
+    const qbsp_plane_t &get_plane(size_t pnum) const;
 
     std::vector<maptexdata_t> miptex;
     std::vector<maptexinfo_t> mtexinfos;
@@ -236,10 +232,10 @@ struct mapdata_t
     // add vector to hash
     void add_hash_vector(const qvec3d &point, const size_t &num);
 
-    // hashed edges; generated by EmitEdges
-    std::map<std::pair<size_t, size_t>, hashedge_t> hashedges;
-
-    void add_hash_edge(size_t v1, size_t v2, int64_t edge_index, const face_t *face);
+    // find or emit each of the specified vertices, returning their
+    // output indices; numbering is the same as emitting them one at
+    // a time in order
+    std::vector<size_t> emit_hash_vectors(const std::vector<qvec3d> &points);
 
     /* Misc other global state for the compile process */
     bool leakfile = false; /* Flag once we've written a leak (.por/.pts) file */
@@ -261,7 +257,8 @@ struct mapdata_t
     // Small cache for image meta in the current map
     std::unordered_map<std::string, std::optional<img::texture_meta>> meta_cache;
     // load or fetch image meta associated with the specified name
-    const std::optional<img::texture_meta> &load_image_meta(const std::string_view &name);
+    const std::optional<img::texture_meta> &load_image_meta(
+        const settings::qbsp_settings &options, const std::string_view &name);
     // whether we had attempted loading texture stuff
     bool textures_loaded = false;
 
@@ -277,13 +274,20 @@ struct mapdata_t
 
     mapentity_t &world_entity();
     bool is_world_entity(const mapentity_t &entity);
-
-    void reset();
 };
 
-extern mapdata_t map;
+/*
+ * The options and map data of a single qbsp run. qbsp_main() creates one per
+ * call and passes it down explicitly, so runs in the same process don't see
+ * each other's planes, textures or entities.
+ */
+struct qbsp_context_t
+{
+    settings::qbsp_settings options;
+    mapdata_t map;
+};
 
-void CalculateWorldExtent(void);
+void CalculateWorldExtent(qbsp_context_t &ctx);
 
 struct texture_def_issues_t : logging::stat_tracker_t
 {
@@ -309,15 +313,15 @@ struct texture_def_issues_t : logging::stat_tracker_t
         true);
 };
 
-bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &issues_stats);
+bool ParseEntity(qbsp_context_t &ctx, parser_t &parser, mapentity_t &entity, texture_def_issues_t &issues_stats);
 
-void ProcessExternalMapEntity(mapentity_t &entity);
-void ProcessAreaPortal(mapentity_t &entity);
+void ProcessExternalMapEntity(qbsp_context_t &ctx, mapentity_t &entity);
+void ProcessAreaPortal(qbsp_context_t &ctx, mapentity_t &entity);
 bool IsWorldBrushEntity(const mapentity_t &entity);
 bool IsNonRemoveWorldBrushEntity(const mapentity_t &entity);
-void LoadMapFile(void);
-void ConvertMapFile(void);
-void ProcessMapBrushes();
+void LoadMapFile(qbsp_context_t &ctx);
+void ConvertMapFile(qbsp_context_t &ctx);
+void ProcessMapBrushes(qbsp_context_t &ctx);
 
 struct quark_tx_info_t
 {
@@ -327,32 +331,33 @@ struct quark_tx_info_t
     std::optional<extended_texinfo_t> info;
 };
 
-int FindMiptex(
+int FindMiptex(qbsp_context_t &ctx, 
     const char *name, std::optional<extended_texinfo_t> &extended_info, bool internal = false, bool recursive = true);
-int FindMiptex(const char *name, bool internal = false, bool recursive = true);
-int FindTexinfo(const maptexinfo_t &texinfo);
+int FindMiptex(qbsp_context_t &ctx, const char *name, bool internal = false, bool recursive = true);
+int FindTexinfo(qbsp_context_t &ctx, const maptexinfo_t &texinfo);
 
 void PrintEntity(const mapentity_t &entity);
 
-void WriteEntitiesToString();
+void WriteEntitiesToString(qbsp_context_t &ctx);
 
-qvec3d FixRotateOrigin(mapentity_t &entity);
+qvec3d FixRotateOrigin(qbsp_context_t &ctx, mapentity_t &entity);
 
 /* Create BSP brushes from map brushes */
-void Brush_LoadEntity(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::container &brushes, size_t &num_clipped);
+void Brush_LoadEntity(qbsp_context_t &ctx, mapentity_t &entity, hull_index_t hullnum, bspbrush_t::container &brushes,
+    size_t &num_clipped);
 
-size_t EmitFaces(node_t *headnode);
-void EmitVertices(node_t *headnode);
-void ExportClipNodes(mapentity_t &entity, node_t *headnode, hull_index_t::value_type hullnum);
-void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface);
+size_t EmitFaces(qbsp_context_t &ctx, node_t *headnode);
+void EmitVertices(qbsp_context_t &ctx, node_t *headnode);
+void ExportClipNodes(qbsp_context_t &ctx, mapentity_t &entity, node_t *headnode, hull_index_t::value_type hullnum);
+void ExportDrawNodes(qbsp_context_t &ctx, mapentity_t &entity, node_t *headnode, int firstface);
 
 struct bspxbrushes_s
 {
     std::vector<uint8_t> lumpdata;
 };
-void BSPX_Brushes_Finalize(struct bspxbrushes_s *ctx);
-void BSPX_Brushes_Init(struct bspxbrushes_s *ctx);
+void BSPX_Brushes_Finalize(qbsp_context_t &ctx, struct bspxbrushes_s *lump);
+void BSPX_Brushes_Init(struct bspxbrushes_s *lump);
 
-void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::container &list);
+void WriteBspBrushMap(qbsp_context_t &ctx, std::string_view filename_suffix, const bspbrush_t::container &list);
 
 bool IsValidTextureProjection(const qvec3f &faceNormal, const qvec3f &s_vec, const qvec3f &t_vec);
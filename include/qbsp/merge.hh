@@ -27,7 +27,8 @@
 
 struct face_t;
 struct node_t;
+struct qbsp_context_t;
 
-void MergeFaceToList(face_t *face, std::list<face_t *> &list);
-std::list<std::unique_ptr<face_t>> MergeFaceList(
+void MergeFaceToList(qbsp_context_t &ctx, face_t *face, std::list<face_t *> &list);
+std::list<std::unique_ptr<face_t>> MergeFaceList(qbsp_context_t &ctx, 
     std::list<std::unique_ptr<face_t>> input, logging::stat_tracker_t::stat &num_merged);
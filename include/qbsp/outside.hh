@@ -29,11 +29,11 @@
 struct node_t;
 struct tree_t;
 
-void WriteLeakTrail(std::ofstream &leakfile, qvec3d point1, const qvec3d &point2);
+void WriteLeakTrail(qbsp_context_t &ctx, std::ofstream &leakfile, qvec3d point1, const qvec3d &point2);
 
-bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
-void MarkBrushSidesInvisible(bspbrush_t::container &brushes);
+bool FillOutside(qbsp_context_t &ctx, tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
+void MarkBrushSidesInvisible(qbsp_context_t &ctx, bspbrush_t::container &brushes);
 
-void FillBrushEntity(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
+void FillBrushEntity(qbsp_context_t &ctx, tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
 
-void FillDetail(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
+void FillDetail(qbsp_context_t &ctx, tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
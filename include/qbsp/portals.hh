@@ -66,18 +66,18 @@ struct portalstats_t : logging::stat_tracker_t
     stat &c_tinyportals = register_stat("tiny portals");
 };
 
-contentflags_t ClusterContents(const node_t *node);
-bool Portal_VisFlood(const portal_t *p);
-bool Portal_EntityFlood(const portal_t *p, int32_t s);
+contentflags_t ClusterContents(qbsp_context_t &ctx, const node_t *node);
+bool Portal_VisFlood(qbsp_context_t &ctx, const portal_t *p);
+bool Portal_EntityFlood(qbsp_context_t &ctx, const portal_t *p, int32_t s);
 enum class portaltype_t
 {
     TREE,
     VIS
 };
-std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std::list<buildportal_t> boundary_portals,
-    portalstats_t &stats, logging::percent_clock &clock);
-void MakeTreePortals(tree_t &tree);
-std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree);
+std::list<buildportal_t> MakeTreePortals_r(qbsp_context_t &ctx, node_t *node, portaltype_t type,
+    std::list<buildportal_t> boundary_portals, portalstats_t &stats, logging::percent_clock &clock);
+void MakeTreePortals(qbsp_context_t &ctx, tree_t &tree);
+std::list<buildportal_t> MakeHeadnodePortals(qbsp_context_t &ctx, tree_t &tree);
 void MakePortalsFromBuildportals(tree_t &tree, std::list<buildportal_t> &buildportals);
-void EmitAreaPortals(node_t *headnode);
-void MarkVisibleSides(tree_t &tree, bspbrush_t::container &brushes);
+void EmitAreaPortals(qbsp_context_t &ctx, node_t *headnode);
+void MarkVisibleSides(qbsp_context_t &ctx, tree_t &tree, bspbrush_t::container &brushes);
@@ -26,7 +26,8 @@
 
 struct portal_t;
 struct tree_t;
+struct qbsp_context_t;
 
-void WritePortalFile(tree_t &tree);
-void WriteDebugTreePortalFile(tree_t &tree, std::string_view filename_suffix);
-void WriteDebugPortals(std::vector<portal_t *> portals, std::string_view filename_suffix);
+void WritePortalFile(qbsp_context_t &ctx, tree_t &tree);
+void WriteDebugTreePortalFile(qbsp_context_t &ctx, tree_t &tree, std::string_view filename_suffix);
+void WriteDebugPortals(qbsp_context_t &ctx, std::vector<portal_t *> portals, std::string_view filename_suffix);
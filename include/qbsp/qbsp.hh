@@ -209,6 +209,7 @@ public:
     setting_int32 leakdist;
     setting_bool forceprt1;
     setting_tjunc tjunc;
+    setting_int32 maxmwtvertices;
     setting_bool objexport;
     setting_bool noextendedsurfflags;
     setting_bool wrbrushes;
@@ -253,8 +254,6 @@ private:
 };
 }; // namespace settings
 
-extern settings::qbsp_settings qbsp_options;
-
 /*
  * The quality of the bsp output is highly sensitive to these epsilon values.
  * Notes:
@@ -293,7 +292,6 @@ class mapentity_t;
 struct face_fragment_t
 {
     std::vector<size_t> output_vertices; // filled in by TJunc
-    std::vector<int64_t> edges; // only filled in MakeFaceEdges
     std::optional<size_t> outputnumber; // only valid for original faces after
                                         // write surfaces
 };
@@ -319,10 +317,10 @@ struct face_t
     portal_t *portal;
     mapface_t *original_side;
 
-    const maptexinfo_t &get_texinfo() const;
+    const maptexinfo_t &get_texinfo(const mapdata_t &map) const;
 
-    const qbsp_plane_t &get_plane() const;
-    const qbsp_plane_t &get_positive_plane() const;
+    const qbsp_plane_t &get_plane(const mapdata_t &map) const;
+    const qbsp_plane_t &get_positive_plane(const mapdata_t &map) const;
 };
 
 // a semi-mutable version of plane that automatically manages the "type"
@@ -391,9 +389,9 @@ namespace qv
 }; // namespace qv
 
 template<typename T>
-T BaseWindingForPlane(const qplane3d &p)
+T BaseWindingForPlane(const settings::qbsp_settings &options, const qplane3d &p)
 {
-    return T::from_plane(p, qbsp_options.worldextent.value());
+    return T::from_plane(p, options.worldextent.value());
 }
 
 // there is a node_t structure for every node and leaf in the bsp tree
@@ -416,7 +414,7 @@ struct node_t
     // information for decision nodes
     size_t planenum; // decision node only
 
-    const qbsp_plane_t &get_plane() const;
+    const qbsp_plane_t &get_plane(const mapdata_t &map) const;
 
     int firstface; // decision node only
     int numfaces; // decision node only
@@ -443,9 +441,9 @@ struct node_t
     bspbrush_t::container bsp_brushes;
 };
 
-void InitQBSP(int argc, const char **argv);
-void InitQBSP(const std::vector<std::string> &args);
-void CountLeafs(node_t *headnode);
-void ProcessFile();
+void InitQBSP(qbsp_context_t &ctx, int argc, const char **argv);
+void InitQBSP(qbsp_context_t &ctx, const std::vector<std::string> &args);
+void CountLeafs(qbsp_context_t &ctx, node_t *headnode);
+void ProcessFile(qbsp_context_t &ctx);
 
 int qbsp_main(int argc, const char **argv);
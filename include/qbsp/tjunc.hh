@@ -22,5 +22,6 @@
 #pragma once
 
 struct node_t;
+struct qbsp_context_t;
 
-void TJunc(node_t *headnode);
+void TJunc(qbsp_context_t &ctx, node_t *headnode);
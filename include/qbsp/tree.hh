@@ -63,4 +63,4 @@ struct tree_t
     void clear();
 };
 
-void PruneNodes(node_t *node);
+void PruneNodes(qbsp_context_t &ctx, node_t *node);
@@ -21,9 +21,13 @@
 
 #pragma once
 
-size_t ExportMapTexinfo(size_t texinfonum);
-size_t ExportMapPlane(size_t planenum);
+#include <cstddef>
 
-void BeginBSPFile(void);
-void FinishBSPFile(void);
-void UpdateBSPFileEntitiesLump();
+struct qbsp_context_t;
+
+size_t ExportMapTexinfo(qbsp_context_t &ctx, size_t texinfonum);
+size_t ExportMapPlane(qbsp_context_t &ctx, size_t planenum);
+
+void BeginBSPFile(qbsp_context_t &ctx);
+void FinishBSPFile(qbsp_context_t &ctx);
+void UpdateBSPFileEntitiesLump(qbsp_context_t &ctx);
@@ -26,6 +26,8 @@
 #include <common/prtfile.hh>
 #include <vis/leafbits.hh>
 
+#include <mutex>
+
 constexpr vec_t VIS_ON_EPSILON = 0.1;
 constexpr vec_t VIS_EQUAL_EPSILON = 0.001;
 
@@ -177,51 +179,31 @@ struct pstack_t
     int numseparators[2];
 };
 
+struct vis_context_t;
+
 viswinding_t *AllocStackWinding(pstack_t &stack);
 void FreeStackWinding(viswinding_t *&w, pstack_t &stack);
-viswinding_t *ClipStackWinding(viswinding_t *in, pstack_t &stack, const qplane3d &split);
+viswinding_t *ClipStackWinding(vis_context_t &ctx, viswinding_t *in, pstack_t &stack, const qplane3d &split);
 
 struct threaddata_t
 {
+    vis_context_t &ctx;
     leafbits_t &leafvis;
     visportal_t *base;
     pstack_t pstack_head;
 };
 
-extern int numportals;
-extern int portalleafs;
-extern int portalleafs_real;
-
-extern std::vector<visportal_t> portals; // always numportals * 2; front and back
-extern std::vector<leaf_t> leafs;
-
-extern int c_noclip;
-extern int c_portaltest, c_portalpass, c_portalcheck;
-extern int c_vistest, c_mighttest;
-extern unsigned long c_chains;
-
-extern bool showgetleaf;
-
-extern std::vector<uint8_t> uncompressed;
-extern int leafbytes;
-extern int leafbytes_real;
-extern int leaflongs;
-
-extern fs::path portalfile, statefile, statetmpfile;
+void BasePortalVis(vis_context_t &ctx);
 
-void BasePortalVis(void);
+void PortalFlow(vis_context_t &ctx, visportal_t *p);
 
-void PortalFlow(visportal_t *p);
+void CalcAmbientSounds(vis_context_t &ctx, mbsp_t *bsp);
 
-void CalcAmbientSounds(mbsp_t *bsp);
+void CalcPHS(vis_context_t &ctx, mbsp_t *bsp);
 
-void CalcPHS(mbsp_t *bsp);
-
-extern time_point starttime, endtime, statetime;
-
-void SaveVisState(void);
-bool LoadVisState(void);
-void CleanVisState(void);
+void SaveVisState(vis_context_t &ctx);
+bool LoadVisState(vis_context_t &ctx);
+void CleanVisState(vis_context_t &ctx);
 
 #include <common/settings.hh>
 #include <common/fs.hh>
@@ -263,7 +245,50 @@ public:
 
 } // namespace settings
 
-extern settings::vis_settings vis_options;
+/*
+ * Everything a single run of vis works on. vis_main() creates a fresh one
+ * for each call, so nothing carries over between runs and several maps can
+ * be vis'ed in the same process.
+ */
+struct vis_context_t
+{
+    settings::vis_settings options;
+
+    /*
+     * If the portal file is "PRT2" format, then the leafs we are dealing with are
+     * really clusters of leaves. So, after the vis job is done we need to expand
+     * the clusters to the real leaf numbers before writing back to the bsp file.
+     */
+    int numportals = 0;
+    int portalleafs = 0; /* leafs (PRT1) or clusters (PRT2) */
+    int portalleafs_real = 0; /* real no. of leafs after expanding PRT2 clusters. Not used for Q2. */
+
+    std::vector<visportal_t> portals; // always numportals * 2; front and back
+    std::vector<leaf_t> leafs;
+
+    std::vector<uint8_t> uncompressed;
+    int leafbytes = 0; // (portalleafs+63)>>3
+    int leafbytes_real = 0; // (portalleafs_real+63)>>3, not used for Q2.
+
+    std::vector<uint8_t> vismap;
+    std::vector<uint8_t> compressed;
+    uint32_t originalvismapsize = 0;
+    int64_t totalvis = 0;
+
+    fs::path portalfile, statefile, statetmpfile;
+    time_point starttime, endtime, statetime;
+    duration stateinterval;
+
+    // guards portal status & mightsee while the full vis is running
+    std::mutex portal_mutex;
+
+    // stats
+    int c_portaltest = 0, c_portalpass = 0, c_portalcheck = 0, c_mightseeupdate = 0;
+    int c_noclip = 0;
+    int c_vistest = 0, c_mighttest = 0;
+    unsigned long c_chains = 0;
+    int c_portalskip = 0, c_leafskip = 0;
+};
 
 int vis_main(int argc, const char **argv);
 int vis_main(const std::vector<std::string> &args);
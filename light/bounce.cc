@@ -24,7 +24,7 @@
 #include <atomic>
 
 #include <light/light.hh>
-#include <light/entities.hh> // for EstimateVisibleBoundsAtPoint
+#include <light/entities.hh> // for EstimateVisibleBoundsInLeaf
 #include <light/ltface.hh>
 #include <light/surflight.hh>
 #include <light/trace.hh> // for Light_PointInLeaf
@@ -32,32 +32,25 @@
 #include <common/polylib.hh>
 #include <common/bsputils.hh>
 
+#include <algorithm>
+#include <iterator>
 #include <vector>
-#include <unordered_map>
-#include <mutex>
+#include <map>
 
 #include <common/qvec.hh>
 #include <common/parallel.hh>
 
-std::mutex bouncelights_lock;
-static std::vector<surfacelight_t> bouncelights;
-static std::atomic_size_t bouncelightpoints;
+#include <fmt/chrono.h>
 
-void ResetBounce()
-{
-    bouncelights.clear();
-    bouncelightpoints = 0;
-}
-
-static bool Face_ShouldBounce(const mbsp_t *bsp, const mface_t *face)
+static bool Face_ShouldBounce(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
     // make bounce light, only if this face is shadow casting
-    const modelinfo_t *mi = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+    const modelinfo_t *mi = ModelInfoForFace(ctx, bsp, Face_GetNum(bsp, face));
     if (!mi || !mi->shadow.boolValue()) {
         return false;
     }
 
-    if (!Face_IsLightmapped(bsp, face)) {
+    if (!Face_IsLightmapped(ctx, bsp, face)) {
         return false;
     }
 
@@ -67,13 +60,13 @@ static bool Face_ShouldBounce(const mbsp_t *bsp, const mface_t *face)
     }
 
     // check for "_bounce" "-1"
-    const auto &ext_info = extended_texinfo_flags[face->texinfo];
+    const auto &ext_info = ctx.extended_texinfo_flags[face->texinfo];
     if (ext_info.no_bounce) {
         return false;
     }
 
     // don't bounce *from* emission surfaces
-    if (IsSurfaceLitFace(bsp, face)) {
+    if (IsSurfaceLitFace(ctx, bsp, face)) {
         return false;
     }
 
@@ -88,22 +81,24 @@ static bool Face_ShouldBounce(const mbsp_t *bsp, const mface_t *face)
     return true;
 }
 
-static void MakeBounceLight(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, const mface_t *face,
-    qvec3d texture_color, int32_t style, const std::vector<qvec3f> &points, const polylib::winding_t &winding,
-    const vec_t &area, const qvec3d &facenormal, const qvec3d &facemidpoint)
+static void MakeBounceLight(light_context_t &ctx, const mbsp_t *bsp, const settings::worldspawn_keys &cfg,
+    const mface_t *face, qvec3d texture_color, int32_t style, const std::vector<qvec3f> &points,
+    const polylib::winding_t &winding, const vec_t &area, const qvec3d &facenormal, const qvec3d &facemidpoint,
+    std::vector<surfacelight_t> &out)
 {
     if (!Face_IsEmissive(bsp, face)) {
         return;
     }
 
-    bouncelightpoints += points.size();
+    ctx.bouncelightpoints += points.size();
 
     // Calculate emit color and intensity...
 
     // Calculate intensity...
     vec_t intensity = qv::max(texture_color);
 
-    if (intensity <= 0.0) {
+    // with "_bounces", faces that are dark now still need a light, so later bounces know what they can reach
+    if (intensity <= 0.0 && !(style == 0 && cfg.bounces.value() > 1)) {
         return;
     }
 
@@ -121,17 +116,19 @@ static void MakeBounceLight(const mbsp_t *bsp, const settings::worldspawn_keys &
     l.omnidirectional = false;
     l.points = points;
     l.style = style;
+    l.facenum = Face_GetNum(bsp, face);
+    l.point_area = area / points.size();
 
         // Init bbox...
-        if (light_options.visapprox.value() == visapprox_t::RAYS) {
-        l.bounds = EstimateVisibleBoundsAtPoint(facemidpoint);
+        if (ctx.options.visapprox.value() == visapprox_t::RAYS) {
+        l.bounds = EstimateVisibleBoundsInLeaf(ctx, bsp, facemidpoint);
         }
 
     for (auto &pt : l.points) {
-            if (light_options.visapprox.value() == visapprox_t::VIS) {
+            if (ctx.options.visapprox.value() == visapprox_t::VIS) {
             l.leaves.push_back(Light_PointInLeaf(bsp, pt));
-            } else if (light_options.visapprox.value() == visapprox_t::RAYS) {
-            l.bounds += EstimateVisibleBoundsAtPoint(pt);
+            } else if (ctx.options.visapprox.value() == visapprox_t::RAYS) {
+            l.bounds += EstimateVisibleBoundsInLeaf(ctx, bsp, pt);
             }
         }
 
@@ -143,31 +140,27 @@ static void MakeBounceLight(const mbsp_t *bsp, const settings::worldspawn_keys &
     l.color = texture_color;
 
     // Store light...
-    std::unique_lock<std::mutex> lck{bouncelights_lock};
-    bouncelights.push_back(l);
-    }
-
-const std::vector<surfacelight_t> &BounceLights()
-    {
-    return bouncelights;
+    out.push_back(std::move(l));
     }
 
-static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const mbsp_t *bsp, const mface_t &face)
+static void MakeBounceLightsThread(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp,
+    const mface_t &face, std::vector<surfacelight_t> &out)
 {
-    if (!Face_ShouldBounce(bsp, &face)) {
+    if (!Face_ShouldBounce(ctx, bsp, &face)) {
         return;
     }
 
-    auto &surf_ptr = LightSurfaces()[&face - bsp->dfaces.data()];
+    auto &surf_ptr = ctx.light_surfaces[&face - bsp->dfaces.data()];
 
     if (!surf_ptr) {
         return;
     }
 
     auto &surf = *surf_ptr.get();
+    const bool multibounce = cfg.bounces.value() > 1;
 
     // no lights
-    if (!surf.lightmapsByStyle.size()) {
+    if (!surf.lightmapsByStyle.size() && !multibounce) {
         return;
     }
 
@@ -183,8 +176,8 @@ static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const m
 
     // grab the average color across the whole set of lightmaps for this face.
     // this doesn't change regardless of the above settings.
-    std::unordered_map<int, qvec3d> sum;
-    vec_t sample_divisor = surf.lightmapsByStyle.front().samples.size();
+    std::map<int, qvec3d> sum;
+    vec_t sample_divisor = surf.samples.size();
 
     bool has_any_color = false;
 
@@ -207,20 +200,24 @@ static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const m
     }
 
     // no bounced color, we can leave early
-    if (!has_any_color) {
+    if (!has_any_color && !multibounce) {
         return;
     }
 
     // lerp between gray and the texture color according to `bouncecolorscale` (0 = use gray, 1 = use texture color)
-    const qvec3d &blendedcolor = Face_LookupTextureBounceColor(bsp, &face);
+    const qvec3d &blendedcolor = Face_LookupTextureBounceColor(ctx, bsp, &face);
 
     // final colors to emit
-    std::unordered_map<int, qvec3d> emitcolors;
+    std::map<int, qvec3d> emitcolors;
 
     for (const auto &styleColor : sum) {
         emitcolors[styleColor.first] = styleColor.second * blendedcolor;
     }
 
+    if (multibounce) {
+        ctx.bounce_emitcolors[&face - bsp->dfaces.data()] = emitcolors[0];
+    }
+
     qplane3d faceplane = winding.plane();
 
     // Get face normal and midpoint...
@@ -229,11 +226,11 @@ static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const m
 
     std::vector<qvec3f> points;
 
-    if (light_options.emissivequality.value() == emissivequality_t::LOW ||
-        light_options.emissivequality.value() == emissivequality_t::MEDIUM) {
+    if (ctx.options.emissivequality.value() == emissivequality_t::LOW ||
+        ctx.options.emissivequality.value() == emissivequality_t::MEDIUM) {
         points = {facemidpoint};
 
-        if (light_options.emissivequality.value() == emissivequality_t::MEDIUM) {
+        if (ctx.options.emissivequality.value() == emissivequality_t::MEDIUM) {
 
             for (auto &pt : winding) {
                 points.push_back(pt + faceplane.normal);
@@ -246,15 +243,88 @@ static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const m
 
     for (auto &style : emitcolors) {
             MakeBounceLight(
-                bsp, cfg, &face, style.second, style.first, points, winding, area, facenormal, facemidpoint);
+                ctx, bsp, cfg, &face, style.second, style.first, points, winding, area, facenormal, facemidpoint, out);
+    }
+}
+
+void MakeBounceLights(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
+{
+    logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
+
+    // each face fills its own slot, then the slots are concatenated in face order, so the
+    // list (and the order bounce light is accumulated in) doesn't depend on thread scheduling
+    std::vector<std::vector<surfacelight_t>> lights_by_face(bsp->dfaces.size());
+    ctx.bounce_emitcolors.assign(bsp->dfaces.size(), {});
+
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+        [&](size_t i) { MakeBounceLightsThread(ctx, cfg, bsp, bsp->dfaces[i], lights_by_face[i]); });
+
+    size_t total = 0;
+    for (const auto &lights : lights_by_face) {
+        total += lights.size();
+    }
+
+    ctx.bouncelights.reserve(total);
+    for (auto &lights : lights_by_face) {
+        std::move(lights.begin(), lights.end(), std::back_inserter(ctx.bouncelights));
     }
+
+    logging::print("{} bounce lights created, with {} points\n", ctx.bouncelights.size(), ctx.bouncelightpoints);
 }
 
-void MakeBounceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
+/*
+ * GatherExtraBounces
+ *
+ * Bounces 2.."_bounces", gathered through the face-to-face transfer that
+ * the first indirect pass recorded in each lightsurf_t (see
+ * LightFace_SurfaceLight), without tracing any more rays. Each bounce's
+ * emitters are the faces that received the previous bounce, tinted by their
+ * bounce color, the same way MakeBounceLights tints direct light.
+ */
+void GatherExtraBounces(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 {
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
+
+    const auto &surfaces = ctx.light_surfaces;
+
+    auto gather = [&](const std::vector<qvec3d> &emitcolors) {
+        std::vector<qvec3d> received(bsp->dfaces.size());
+
+        logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+            if (!surfaces[i]) {
+                return;
+            }
+            for (const auto &[facenum, transfer] : surfaces[i]->bounce_transfer) {
+                received[i] += emitcolors[facenum] * transfer;
+            }
+        });
+
+        return received;
+    };
 
-    logging::parallel_for_each(bsp->dfaces, [&](const mface_t &face) { MakeBounceLightsThread(cfg, bsp, face); });
+    std::vector<qvec3d> received = gather(ctx.bounce_emitcolors);
 
-    logging::print("{} bounce lights created, with {} points\n", bouncelights.size(), bouncelightpoints);
+    for (int bounce = 2; bounce <= cfg.bounces.value(); bounce++) {
+        const auto start = I_FloatTime();
+
+        std::vector<qvec3d> emitcolors(bsp->dfaces.size());
+        for (size_t i = 0; i < bsp->dfaces.size(); i++) {
+            const mface_t *face = &bsp->dfaces[i];
+            if (Face_ShouldBounce(ctx, bsp, face)) {
+                emitcolors[i] = received[i] * Face_LookupTextureBounceColor(ctx, bsp, face);
+            }
+        }
+
+        received = gather(emitcolors);
+
+        logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+            if (surfaces[i] && Face_IsLightmapped(ctx, bsp, &bsp->dfaces[i])) {
+                AddExtraBounceToFace(ctx, bsp, *surfaces[i], received[i]);
+            }
+        });
+
+        logging::print("bounce {}: {:.3} seconds\n", bounce, I_FloatTime() - start);
+    }
 }
@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <mutex>
 #include <common/imglib.hh> // for img::find
 #include <common/log.hh>
 #include <common/cmdlib.hh>
@@ -34,54 +35,8 @@
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
 
-static std::vector<std::unique_ptr<light_t>> all_lights;
-static std::vector<sun_t> all_suns;
-static std::vector<entdict_t> entdicts;
-static std::vector<entdict_t> radlights;
-static std::vector<std::pair<std::string, int>> lightstyleForTargetname;
-static std::vector<std::unique_ptr<light_t>> surfacelight_templates;
-static std::ofstream surflights_dump_file;
-static fs::path surflights_dump_filename;
-
-/**
- * Resets global data in this file
- */
-void ResetLightEntities()
-{
-    all_lights.clear();
-    all_suns.clear();
-    entdicts.clear();
-    radlights.clear();
-
-    lightstyleForTargetname.clear();
-
-    surfacelight_templates.clear();
-    surflights_dump_file = {};
-    surflights_dump_filename.clear();
-}
-
-std::vector<std::unique_ptr<light_t>> &GetLights()
-{
-    return all_lights;
-}
-
-const std::vector<entdict_t> &GetEntdicts()
-{
-    return entdicts;
-}
-
-std::vector<sun_t> &GetSuns()
-{
-    return all_suns;
-}
-
-std::vector<entdict_t> &GetRadLights()
-{
-    return radlights;
-}
-
 /* surface lights */
-static void MakeSurfaceLights(const mbsp_t *bsp);
+static void MakeSurfaceLights(light_context_t &ctx, const mbsp_t *bsp);
 
 // light_t
 light_t::light_t()
@@ -151,12 +106,12 @@ void light_t::expandAABB(const qvec3d &pt)
  * ============================================================================
  */
 
-entdict_t &WorldEnt()
+entdict_t &WorldEnt(light_context_t &ctx)
 {
-    if (entdicts.size() == 0 || entdicts.at(0).get("classname") != "worldspawn") {
-        Error("WorldEnt() failed to get worldspawn");
+    if (ctx.entdicts.size() == 0 || ctx.entdicts.at(0).get("classname") != "worldspawn") {
+        Error("WorldEnt(ctx) failed to get worldspawn");
     }
-    return entdicts.at(0);
+    return ctx.entdicts.at(0);
 }
 
 /**
@@ -165,33 +120,33 @@ entdict_t &WorldEnt()
  *
  * Pass an empty string to generate a new unique lightstyle.
  */
-int LightStyleForTargetname(const settings::worldspawn_keys &cfg, const std::string &targetname)
+int LightStyleForTargetname(light_context_t &ctx, const settings::worldspawn_keys &cfg, const std::string &targetname)
 {
     // check if already assigned
-    for (const auto &pr : lightstyleForTargetname) {
+    for (const auto &pr : ctx.lightstyleForTargetname) {
         if (pr.first == targetname && targetname.size() > 0) {
             return pr.second;
         }
     }
 
     // generate a new style number and return it
-    const int newStylenum = cfg.compilerstyle_start.value() + lightstyleForTargetname.size();
+    const int newStylenum = cfg.compilerstyle_start.value() + ctx.lightstyleForTargetname.size();
 
     // check if full
     if (newStylenum >= cfg.compilerstyle_max.value()) {
         FError("Too many unique light targetnames (max={})\n", cfg.compilerstyle_max.value());
     }
 
-    lightstyleForTargetname.emplace_back(targetname, newStylenum);
+    ctx.lightstyleForTargetname.emplace_back(targetname, newStylenum);
 
     logging::print(logging::flag::VERBOSE, "Allocated lightstyle {} for targetname '{}'\n", newStylenum, targetname);
 
     return newStylenum;
 }
 
-std::string TargetnameForLightStyle(int style)
+std::string TargetnameForLightStyle(light_context_t &ctx, int style)
 {
-    for (const auto &pr : lightstyleForTargetname) {
+    for (const auto &pr : ctx.lightstyleForTargetname) {
         if (pr.second == style) {
             return pr.first;
         }
@@ -208,15 +163,15 @@ std::string TargetnameForLightStyle(int style)
  * entdicts should not be modified after this (saves pointers to elements)
  * ==================
  */
-static void MatchTargets(void)
+static void MatchTargets(light_context_t &ctx)
 {
-    for (auto &entity : all_lights) {
+    for (auto &entity : ctx.all_lights) {
         const std::string &targetstr = entity->epairs->get("target");
         if (targetstr.empty()) {
             continue;
         }
 
-        for (const entdict_t &target : entdicts) {
+        for (const entdict_t &target : ctx.entdicts) {
             if (string_iequals(targetstr, target.get("targetname"))) {
                 entity->targetent = &target;
                 break;
@@ -255,9 +210,9 @@ bool EntDict_CheckNoEmptyValues(const mbsp_t *bsp, const entdict_t &entdict)
     return ok;
 }
 
-static void SetupSpotlights(const mbsp_t *bsp, const settings::worldspawn_keys &cfg)
+static void SetupSpotlights(light_context_t &ctx, const mbsp_t *bsp, const settings::worldspawn_keys &cfg)
 {
-    for (auto &entity : all_lights) {
+    for (auto &entity : ctx.all_lights) {
         vec_t targetdist = 0.0; // mxd
         if (entity->targetent) {
             qvec3d targetOrigin;
@@ -376,14 +331,14 @@ static bool Dirt_ResolveFlag(const settings::worldspawn_keys &cfg, int dirtInt)
  * AddSun
  * =============
  */
-static void AddSun(const settings::worldspawn_keys &cfg, const qvec3d &sunvec, vec_t light, const qvec3d &color,
-    int dirtInt, vec_t sun_anglescale, const int style, const std::string &suntexture)
+static sun_t *AddSun(light_context_t &ctx, const settings::worldspawn_keys &cfg, const qvec3d &sunvec, vec_t light,
+    const qvec3d &color, int dirtInt, vec_t sun_anglescale, const int style, const std::string &suntexture)
 {
     if (light == 0.0f)
-        return;
+        return nullptr;
 
     // add to list
-    sun_t &sun = all_suns.emplace_back();
+    sun_t &sun = ctx.all_suns.emplace_back();
     sun.sunvec = qv::normalize(sunvec) * -16384;
     sun.sunlight = light;
     sun.sunlight_color = color;
@@ -399,6 +354,8 @@ static void AddSun(const settings::worldspawn_keys &cfg, const qvec3d &sunvec, v
     //  anglescale,
     //  dirtInt,
     //  (int)sun->dirt);
+
+    return &sun;
 }
 
 /*
@@ -411,17 +368,28 @@ static void AddSun(const settings::worldspawn_keys &cfg, const qvec3d &sunvec, v
  * From q3map2
  * =============
  */
-static void SetupSun(const settings::worldspawn_keys &cfg, vec_t light, const qvec3d &color, const qvec3d &sunvec_in,
-    const vec_t sun_anglescale, const vec_t sun_deviance, const int sunlight_dirt, const int style,
-    const std::string &suntexture)
+static void SetupSun(light_context_t &ctx, const settings::worldspawn_keys &cfg, vec_t light, const qvec3d &color,
+    const qvec3d &sunvec_in, const vec_t sun_anglescale, const vec_t sun_deviance, const int sunlight_dirt,
+    const int style, const std::string &suntexture)
 {
     int i;
-    int sun_num_samples = (sun_deviance == 0 ? 1 : light_options.sunsamples.value()); // mxd
+    int sun_num_samples = (sun_deviance == 0 ? 1 : ctx.options.sunsamples.value()); // mxd
     vec_t sun_deviance_rad = DEG2RAD(sun_deviance); // mxd
     vec_t sun_deviance_sq = sun_deviance * sun_deviance; // mxd
 
     qvec3d sunvec = qv::normalize(sunvec_in);
 
+    // with -skydomesamples, keep the penumbra as one sun and integrate over it when tracing
+    if (sun_deviance != 0 && ctx.options.skydomesamples.value() > 0) {
+        if (sun_t *sun = AddSun(ctx, cfg, sunvec, light, color, sunlight_dirt, sun_anglescale, style, suntexture)) {
+            sun->distribution = sun_distribution_t::PENUMBRA;
+            sun->penumbra_angle = atan2(sunvec[1], sunvec[0]);
+            sun->penumbra_elevation = atan2(sunvec[2], sqrt(sunvec[0] * sunvec[0] + sunvec[1] * sunvec[1]));
+            sun->penumbra_deviance = sun_deviance_rad;
+        }
+        return;
+    }
+
     // fmt::print( "input sunvec {} {} {}. deviance is {}, {} samples\n",sunvec[0],sunvec[1], sunvec[2], sun_deviance,
     // sun_num_samples);
 
@@ -456,13 +424,13 @@ static void SetupSun(const settings::worldspawn_keys &cfg, vec_t light, const qv
 
         // fmt::print( "sun {} is using vector {} {} {}\n", i, direction[0], direction[1], direction[2]);
 
-        AddSun(cfg, direction, light, color, sunlight_dirt, sun_anglescale, style, suntexture);
+        AddSun(ctx, cfg, direction, light, color, sunlight_dirt, sun_anglescale, style, suntexture);
     }
 }
 
-static void SetupSuns(const settings::worldspawn_keys &cfg)
+static void SetupSuns(light_context_t &ctx, const settings::worldspawn_keys &cfg)
 {
-    for (auto &entity : all_lights) {
+    for (auto &entity : ctx.all_lights) {
         // mxd. Arghrad-style sun setup
         if (entity->sun.value() && entity->light.value() > 0) {
             // Set sun vector
@@ -479,7 +447,7 @@ static void SetupSuns(const settings::worldspawn_keys &cfg)
             }
 
             // Add the sun
-            SetupSun(cfg, entity->light.value(), entity->color.value(), sunvec, entity->anglescale.value(),
+            SetupSun(ctx, cfg, entity->light.value(), entity->color.value(), sunvec, entity->anglescale.value(),
                 entity->deviance.value(), entity->dirt.value(), entity->style.value(), entity->suntexture.value());
 
             // Disable the light itself...
@@ -487,12 +455,12 @@ static void SetupSuns(const settings::worldspawn_keys &cfg)
         }
     }
 
-    SetupSun(cfg, cfg.sunlight.value(), cfg.sunlight_color.value(), cfg.sunvec.value(), cfg.global_anglescale.value(),
-        cfg.sun_deviance.value(), cfg.sunlight_dirt.value(), 0, "");
+    SetupSun(ctx, cfg, cfg.sunlight.value(), cfg.sunlight_color.value(), cfg.sunvec.value(),
+        cfg.global_anglescale.value(), cfg.sun_deviance.value(), cfg.sunlight_dirt.value(), 0, "");
 
     if (cfg.sun2.value() != 0) {
         logging::print("creating sun2\n");
-        SetupSun(cfg, cfg.sun2.value(), cfg.sun2_color.value(), cfg.sun2vec.value(), cfg.global_anglescale.value(),
+        SetupSun(ctx, cfg, cfg.sun2.value(), cfg.sun2_color.value(), cfg.sun2vec.value(), cfg.global_anglescale.value(),
             cfg.sun_deviance.value(), cfg.sunlight_dirt.value(), 0, "");
     }
 }
@@ -508,10 +476,10 @@ static void SetupSuns(const settings::worldspawn_keys &cfg)
  * FIXME: this is becoming a mess
  * =============
  */
-static void SetupSkyDome(const settings::worldspawn_keys &cfg, vec_t upperLight, const qvec3d &upperColor,
-    const int upperDirt, const vec_t upperAnglescale, const int upperStyle, const std::string &upperSuntexture,
-    vec_t lowerLight, const qvec3d &lowerColor, const int lowerDirt, const vec_t lowerAnglescale, const int lowerStyle,
-    const std::string &lowerSuntexture)
+static void SetupSkyDome(light_context_t &ctx, const settings::worldspawn_keys &cfg, vec_t upperLight,
+    const qvec3d &upperColor, const int upperDirt, const vec_t upperAnglescale, const int upperStyle,
+    const std::string &upperSuntexture, vec_t lowerLight, const qvec3d &lowerColor, const int lowerDirt,
+    const vec_t lowerAnglescale, const int lowerStyle, const std::string &lowerSuntexture)
 {
     int i, j, numSuns;
     int angleSteps, elevationSteps;
@@ -521,7 +489,7 @@ static void SetupSkyDome(const settings::worldspawn_keys &cfg, vec_t upperLight,
     qvec3d direction;
 
     /* pick a value for 'iterations' so that 'numSuns' will be close to 'sunsamples' */
-    iterations = rint(sqrt((light_options.sunsamples.value() - 1) / 4)) + 1;
+    iterations = rint(sqrt((ctx.options.sunsamples.value() - 1) / 4)) + 1;
     iterations = std::max(iterations, 2);
 
     /* dummy check */
@@ -529,6 +497,25 @@ static void SetupSkyDome(const settings::worldspawn_keys &cfg, vec_t upperLight,
         return;
     }
 
+    /* with -skydomesamples, add one sun per hemisphere and integrate over it when tracing */
+    if (ctx.options.skydomesamples.value() > 0) {
+        if (upperLight > 0) {
+            if (sun_t *sun = AddSun(ctx, cfg, {0.0, 0.0, -1.0}, upperLight, upperColor, upperDirt, upperAnglescale,
+                    upperStyle, upperSuntexture)) {
+                sun->distribution = sun_distribution_t::DOME;
+                sun->dome_sign = 1.0;
+            }
+        }
+        if (lowerLight > 0) {
+            if (sun_t *sun = AddSun(ctx, cfg, {0.0, 0.0, 1.0}, lowerLight, lowerColor, lowerDirt, lowerAnglescale,
+                    lowerStyle, lowerSuntexture)) {
+                sun->distribution = sun_distribution_t::DOME;
+                sun->dome_sign = -1.0;
+            }
+        }
+        return;
+    }
+
     /* setup */
     elevationSteps = iterations - 1;
     angleSteps = elevationSteps * 4;
@@ -555,7 +542,7 @@ static void SetupSkyDome(const settings::worldspawn_keys &cfg, vec_t upperLight,
 
             /* insert top hemisphere light */
             if (sunlight2value > 0) {
-                AddSun(cfg, direction, sunlight2value, upperColor, upperDirt, upperAnglescale, upperStyle,
+                AddSun(ctx, cfg, direction, sunlight2value, upperColor, upperDirt, upperAnglescale, upperStyle,
                     upperSuntexture);
             }
 
@@ -563,7 +550,7 @@ static void SetupSkyDome(const settings::worldspawn_keys &cfg, vec_t upperLight,
 
             /* insert bottom hemisphere light */
             if (sunlight3value > 0) {
-                AddSun(cfg, direction, sunlight3value, lowerColor, lowerDirt, lowerAnglescale, lowerStyle,
+                AddSun(ctx, cfg, direction, sunlight3value, lowerColor, lowerDirt, lowerAnglescale, lowerStyle,
                     lowerSuntexture);
             }
 
@@ -578,33 +565,33 @@ static void SetupSkyDome(const settings::worldspawn_keys &cfg, vec_t upperLight,
 
     /* create vertical sun */
     if (sunlight2value > 0) {
-        AddSun(
-            cfg, {0.0, 0.0, -1.0}, sunlight2value, upperColor, upperDirt, upperAnglescale, upperStyle, upperSuntexture);
+        AddSun(ctx, cfg, {0.0, 0.0, -1.0}, sunlight2value, upperColor, upperDirt, upperAnglescale, upperStyle,
+            upperSuntexture);
     }
 
     if (sunlight3value > 0) {
-        AddSun(
-            cfg, {0.0, 0.0, 1.0}, sunlight3value, lowerColor, lowerDirt, lowerAnglescale, lowerStyle, lowerSuntexture);
+        AddSun(ctx, cfg, {0.0, 0.0, 1.0}, sunlight3value, lowerColor, lowerDirt, lowerAnglescale, lowerStyle,
+            lowerSuntexture);
     }
 }
 
-static void SetupSkyDomes(const settings::worldspawn_keys &cfg)
+static void SetupSkyDomes(light_context_t &ctx, const settings::worldspawn_keys &cfg)
 {
     // worldspawn "legacy" skydomes
-    SetupSkyDome(cfg, cfg.sunlight2.value(), cfg.sunlight2_color.value(), cfg.sunlight2_dirt.value(),
+    SetupSkyDome(ctx, cfg, cfg.sunlight2.value(), cfg.sunlight2_color.value(), cfg.sunlight2_dirt.value(),
         cfg.global_anglescale.value(), 0, "", cfg.sunlight3.value(), cfg.sunlight3_color.value(),
         cfg.sunlight2_dirt.value(), cfg.global_anglescale.value(), 0, "");
 
     // new per-entity sunlight2/3 skydomes
-    for (auto &entity : all_lights) {
+    for (auto &entity : ctx.all_lights) {
         if ((entity->sunlight2.value() || entity->sunlight3.value()) && entity->light.value() > 0) {
             if (entity->sunlight2.value()) {
                 // Add the upper dome, like sunlight2 (pointing down)
-                SetupSkyDome(cfg, entity->light.value(), entity->color.value(), entity->dirt.value(),
+                SetupSkyDome(ctx, cfg, entity->light.value(), entity->color.value(), entity->dirt.value(),
                     entity->anglescale.value(), entity->style.value(), entity->suntexture.value(), 0, {}, 0, 0, 0, "");
             } else {
                 // Add the lower dome, like sunlight3 (pointing up)
-                SetupSkyDome(cfg, 0, {}, 0, 0, 0, "", entity->light.value(), entity->color.value(),
+                SetupSkyDome(ctx, cfg, 0, {}, 0, 0, 0, "", entity->light.value(), entity->color.value(),
                     entity->dirt.value(), entity->anglescale.value(), entity->style.value(),
                     entity->suntexture.value());
             }
@@ -651,7 +638,7 @@ static std::unique_ptr<light_t> DuplicateEntity(const light_t &src)
  * From q3map2
  * =============
  */
-static void JitterEntity(const light_t &entity)
+static void JitterEntity(light_context_t &ctx, const light_t &entity)
 {
     // don't jitter suns
     if (entity.sun.value()) {
@@ -677,16 +664,16 @@ static void JitterEntity(const light_t &entity)
     // (don't modify the all_lights vector in the loop above, because it could invalidate the passed in `entity`
     // reference)
     for (auto &new_light : new_lights) {
-        all_lights.push_back(std::move(new_light));
+        ctx.all_lights.push_back(std::move(new_light));
     }
 }
 
-static void JitterEntities()
+static void JitterEntities(light_context_t &ctx)
 {
     // We will append to the list during iteration.
-    const size_t starting_size = all_lights.size();
+    const size_t starting_size = ctx.all_lights.size();
     for (size_t i = 0; i < starting_size; i++) {
-        JitterEntity(*all_lights.at(i));
+        JitterEntity(ctx, *ctx.all_lights.at(i));
     }
 }
 
@@ -884,32 +871,32 @@ static std::string ParseEscapeSequences(const std::string &input)
  * LoadEntities
  * ==================
  */
-void LoadEntities(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
+void LoadEntities(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 {
     logging::funcheader();
 
-    entdicts = EntData_Parse(*bsp);
+    ctx.entdicts = EntData_Parse(*bsp);
 
     // Make warnings
-    for (auto &entdict : entdicts) {
+    for (auto &entdict : ctx.entdicts) {
         EntDict_CheckNoEmptyValues(bsp, entdict);
     }
 
     /* handle worldspawn */
-    for (const auto &epair : WorldEnt()) {
-        if (light_options.set_setting(epair.first, epair.second, settings::source::MAP) ==
+    for (const auto &epair : WorldEnt(ctx)) {
+        if (ctx.options.set_setting(epair.first, epair.second, settings::source::MAP) ==
             settings::setting_error::INVALID) {
             logging::print("WARNING: worldspawn key {} has invalid value of \"{}\"\n", epair.first, epair.second);
         }
     }
 
     /* apply side effects of settings (in particular "dirt") */
-    FixupGlobalSettings();
+    FixupGlobalSettings(ctx);
     // NOTE: cfg is not valid until now.
 
     // First pass: make permanent changes to the bsp entdata that we will write out
     // at the end of the light process.
-    for (auto &entdict : entdicts) {
+    for (auto &entdict : ctx.entdicts) {
 
         // fix "lightmap_scale"
         const std::string &lmscale = entdict.get("lightmap_scale");
@@ -927,7 +914,7 @@ void LoadEntities(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
         if (classname.find("light") == 0) {
             const std::string &targetname = entdict.get("targetname");
             if (!targetname.empty()) {
-                const int style = LightStyleForTargetname(cfg, targetname);
+                const int style = LightStyleForTargetname(ctx, cfg, targetname);
                 entdict.set("style", std::to_string(style));
             }
         }
@@ -936,7 +923,7 @@ void LoadEntities(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
         if (entdict.get_int("_switchableshadow") == 1) {
             const std::string &targetname = entdict.get("targetname");
             // if targetname is "", generates a new unique lightstyle
-            const int style = LightStyleForTargetname(cfg, targetname);
+            const int style = LightStyleForTargetname(ctx, cfg, targetname);
             // TODO: Configurable key?
             entdict.set("switchshadstyle", std::to_string(style));
         }
@@ -947,20 +934,20 @@ void LoadEntities(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
         }
     }
 
-    Q_assert(all_lights.empty());
-    if (light_options.nolights.value()) {
+    Q_assert(ctx.all_lights.empty());
+    if (ctx.options.nolights.value()) {
         return;
     }
 
     /* go through all the entities */
-    for (auto &entdict : entdicts) {
+    for (auto &entdict : ctx.entdicts) {
 
         /*
          * Check light entity fields and any global settings in worldspawn.
          */
         if (entdict.get("classname").find("light") == 0) {
             // mxd. Convert some Arghrad3 settings...
-            if (light_options.arghradcompat.value()) {
+            if (ctx.options.arghradcompat.value()) {
                 entdict.rename("_falloff", "delay"); // _falloff -> delay
                 entdict.rename("_distance", "_falloff"); // _distance -> _falloff
                 entdict.rename("_fade", "wait"); // _fade -> wait
@@ -977,13 +964,13 @@ void LoadEntities(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
             }
 
             // Skip non-switchable lights if we're skipping world lighting
-            if (light_options.nolighting.value() && entdict.get("style").empty() &&
+            if (ctx.options.nolighting.value() && entdict.get("style").empty() &&
                 entdict.get("switchshadstyle").empty()) {
                 continue;
             }
 
             /* Allocate a new entity */
-            auto &entity = all_lights.emplace_back(std::make_unique<light_t>());
+            auto &entity = ctx.all_lights.emplace_back(std::make_unique<light_t>());
 
             // save pointer to the entdict
             entity->epairs = &entdict;
@@ -1038,7 +1025,7 @@ void LoadEntities(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
         }
     }
 
-    logging::print("{} entities read, {} are lights.\n", entdicts.size(), all_lights.size());
+    logging::print("{} entities read, {} are lights.\n", ctx.entdicts.size(), ctx.all_lights.size());
 }
 
 std::tuple<qvec3d, bool> FixLightOnFace(const mbsp_t *bsp, const qvec3d &point, bool warn, float max_dist)
@@ -1068,9 +1055,9 @@ std::tuple<qvec3d, bool> FixLightOnFace(const mbsp_t *bsp, const qvec3d &point,
     return {point, false};
 }
 
-void FixLightsOnFaces(const mbsp_t *bsp)
+void FixLightsOnFaces(light_context_t &ctx, const mbsp_t *bsp)
 {
-    for (auto &entity : all_lights) {
+    for (auto &entity : ctx.all_lights) {
         if (entity->light.value() != 0 && !entity->nonudge.value() &&
             entity->light_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
             entity->shadow_channel_mask.value() == CHANNEL_MASK_DEFAULT) {
@@ -1080,9 +1067,9 @@ void FixLightsOnFaces(const mbsp_t *bsp)
     }
 }
 
-static void SetupLightLeafnums(const mbsp_t *bsp)
+static void SetupLightLeafnums(light_context_t &ctx, const mbsp_t *bsp)
 {
-    for (auto &entity : all_lights) {
+    for (auto &entity : ctx.all_lights) {
         entity->leaf = Light_PointInLeaf(bsp, entity->origin.value());
     }
 }
@@ -1111,7 +1098,7 @@ inline qvec3d UniformPointOnSphere(vec_t u1, vec_t u2)
     return dir;
 }
 
-aabb3d EstimateVisibleBoundsAtPoint(const qvec3d &point)
+aabb3d EstimateVisibleBoundsAtPoint(light_context_t &ctx, const qvec3d &point)
 {
     constexpr size_t N = 32;
     constexpr size_t N2 = N * N;
@@ -1129,7 +1116,7 @@ aabb3d EstimateVisibleBoundsAtPoint(const qvec3d &point)
         }
     }
 
-    rs.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
+    rs.tracePushedRaysIntersection(ctx, nullptr, CHANNEL_MASK_DEFAULT);
 
     for (int i = 0; i < N2; i++) {
         const vec_t &dist = rs.getPushedRayHitDist(i);
@@ -1158,52 +1145,117 @@ aabb3d EstimateVisibleBoundsAtPoint(const qvec3d &point)
     */
 }
 
-inline void EstimateLightAABB(const std::unique_ptr<light_t> &light)
+/*
+ * Bounds of everything that can be seen from anywhere in the leaf: the
+ * union of the bounds of the leaves in its pvs. Since the pvs is
+ * conservative, so is this. Returns nothing if the leaf has no pvs.
+ */
+static std::optional<aabb3d> LeafPvsBounds(light_context_t &ctx, const mbsp_t *bsp, const mleaf_t *leaf)
+{
+    const uint8_t *pvs = ctx.all_uncompressed_vis.row(UncompressedVisIndex(bsp, leaf));
+
+    if (!pvs) {
+        return std::nullopt;
+    }
+
+    const bool is_q2 = bsp->loadversion->game->id == GAME_QUAKE_II;
+    const int numbits = ctx.all_uncompressed_vis.rowbytes * 8;
+
+    aabb3d bounds = aabb3f{leaf->mins, leaf->maxs};
+
+    for (size_t i = 0; i < bsp->dleafs.size(); i++) {
+        const mleaf_t &other = bsp->dleafs[i];
+        // Q1 rows skip leaf 0, the shared solid leaf
+        const int bit = is_q2 ? other.cluster : static_cast<int>(i) - 1;
+
+        if (bit < 0 || bit >= numbits || (!is_q2 && bit >= bsp->dmodels[0].visleafs)) {
+            continue;
+        }
+
+        if (pvs[bit >> 3] & (1 << (bit & 7))) {
+            bounds += aabb3f{other.mins, other.maxs};
+        }
+    }
+
+    // leaf bounds are stored rounded; make sure faces on them are inside
+    return bounds.grow(qvec3d(1.0, 1.0, 1.0));
+}
+
+/*
+ * Like EstimateVisibleBoundsAtPoint, but on maps with vis data, points use
+ * the pvs bounds of their leaf, which are shared between all points in the
+ * leaf, so dicing a face into more points doesn't cost more rays. Points
+ * in leaves without a pvs (including solid) and maps without vis data
+ * fall back to the per-point estimate; sharing a ray-based estimate per
+ * leaf wouldn't be conservative.
+ */
+aabb3d EstimateVisibleBoundsInLeaf(light_context_t &ctx, const mbsp_t *bsp, const qvec3d &point)
+{
+    if (!ctx.leaf_visible_bounds.empty()) {
+        const mleaf_t *leaf = Light_PointInLeaf(bsp, point);
+        auto &cached = ctx.leaf_visible_bounds[leaf - bsp->dleafs.data()];
+
+        std::call_once(cached.once, [&]() { cached.bounds = LeafPvsBounds(ctx, bsp, leaf); });
+
+        if (cached.bounds) {
+            return *cached.bounds + point;
+        }
+    }
+
+    return EstimateVisibleBoundsAtPoint(ctx, point);
+}
+
+inline void EstimateLightAABB(light_context_t &ctx, const std::unique_ptr<light_t> &light)
 {
-    light->bounds = EstimateVisibleBoundsAtPoint(light->origin.value());
+    light->bounds = EstimateVisibleBoundsAtPoint(ctx, light->origin.value());
 }
 
-void EstimateLightVisibility(void)
+void EstimateLightVisibility(light_context_t &ctx)
 {
     logging::funcheader();
 
-    logging::parallel_for_each(all_lights, EstimateLightAABB);
+    logging::parallel_for_each(
+        ctx.all_lights, [&ctx](const std::unique_ptr<light_t> &light) { EstimateLightAABB(ctx, light); });
 }
 
-void SetupLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
+void SetupLights(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 {
-    logging::print("SetupLights: {} initial lights\n", all_lights.size());
+    logging::print("SetupLights: {} initial lights\n", ctx.all_lights.size());
+
+    if (ctx.options.visapprox.value() == visapprox_t::RAYS && !bsp->dvis.bits.empty()) {
+        ctx.leaf_visible_bounds = std::vector<leaf_visible_bounds_t>(bsp->dleafs.size());
+    }
 
     // Creates more light entities, needs to be done before the rest
-    MakeSurfaceLights(bsp);
+    MakeSurfaceLights(ctx, bsp);
 
-    logging::print("SetupLights: {} after surface lights\n", all_lights.size());
+    logging::print("SetupLights: {} after surface lights\n", ctx.all_lights.size());
 
-    JitterEntities();
+    JitterEntities(ctx);
 
-    logging::print("SetupLights: {} after jittering\n", all_lights.size());
+    logging::print("SetupLights: {} after jittering\n", ctx.all_lights.size());
 
-    const size_t final_lightcount = all_lights.size();
+    const size_t final_lightcount = ctx.all_lights.size();
 
-    MatchTargets();
-    SetupSpotlights(bsp, cfg);
-    SetupSuns(cfg);
-    SetupSkyDomes(cfg);
-    FixLightsOnFaces(bsp);
-    if (light_options.visapprox.value() == visapprox_t::RAYS) {
-        EstimateLightVisibility();
-    } else if (light_options.visapprox.value() == visapprox_t::VIS) {
-        SetupLightLeafnums(bsp);
+    MatchTargets(ctx);
+    SetupSpotlights(ctx, bsp, cfg);
+    SetupSuns(ctx, cfg);
+    SetupSkyDomes(ctx, cfg);
+    FixLightsOnFaces(ctx, bsp);
+    if (ctx.options.visapprox.value() == visapprox_t::RAYS) {
+        EstimateLightVisibility(ctx);
+    } else if (ctx.options.visapprox.value() == visapprox_t::VIS) {
+        SetupLightLeafnums(ctx, bsp);
     }
 
-    logging::print("Final count: {} lights, {} suns in use.\n", all_lights.size(), all_suns.size());
+    logging::print("Final count: {} lights, {} suns in use.\n", ctx.all_lights.size(), ctx.all_suns.size());
 
-    Q_assert(final_lightcount == all_lights.size());
+    Q_assert(final_lightcount == ctx.all_lights.size());
 }
 
-const entdict_t *FindEntDictWithKeyPair(const std::string &key, const std::string &value)
+const entdict_t *FindEntDictWithKeyPair(light_context_t &ctx, const std::string &key, const std::string &value)
 {
-    for (const auto &entdict : entdicts) {
+    for (const auto &entdict : ctx.entdicts) {
         if (entdict.get(key) == value) {
             return &entdict;
         }
@@ -1218,12 +1270,12 @@ const entdict_t *FindEntDictWithKeyPair(const std::string &key, const std::strin
  * Re-write the entdata BSP lump because switchable lights need styles set.
  * ================
  */
-void WriteEntitiesToString(const settings::worldspawn_keys &cfg, mbsp_t *bsp)
+void WriteEntitiesToString(light_context_t &ctx, const settings::worldspawn_keys &cfg, mbsp_t *bsp)
 {
-    bsp->dentdata = EntData_Write(entdicts);
+    bsp->dentdata = EntData_Write(ctx.entdicts);
 
     /* FIXME - why are we printing this here? */
-    logging::print("{} switchable light styles ({} max)\n", lightstyleForTargetname.size(),
+    logging::print("{} switchable light styles ({} max)\n", ctx.lightstyleForTargetname.size(),
         cfg.compilerstyle_max.value() - cfg.compilerstyle_start.value());
 }
 
@@ -1233,12 +1285,7 @@ void WriteEntitiesToString(const settings::worldspawn_keys &cfg, mbsp_t *bsp)
  * =======================================================================
  */
 
-const std::vector<std::unique_ptr<light_t>> &GetSurfaceLightTemplates()
-{
-    return surfacelight_templates;
-}
-
-static void SurfLights_WriteEntityToFile(light_t *entity, const qvec3d &pos)
+static void SurfLights_WriteEntityToFile(light_context_t &ctx, light_t *entity, const qvec3d &pos)
 {
     Q_assert(entity->epairs != nullptr);
 
@@ -1246,12 +1293,13 @@ static void SurfLights_WriteEntityToFile(light_t *entity, const qvec3d &pos)
     epairs.remove("_surface");
     epairs.set("origin", qv::to_string(pos));
 
-    surflights_dump_file << EntData_Write({epairs});
+    ctx.surflights_dump_file << EntData_Write({epairs});
 }
 
-static void CreateSurfaceLight(const qvec3d &origin, const qvec3d &normal, const light_t *surflight_template)
+static void CreateSurfaceLight(
+    light_context_t &ctx, const qvec3d &origin, const qvec3d &normal, const light_t *surflight_template)
 {
-    auto &entity = all_lights.emplace_back(DuplicateEntity(*surflight_template));
+    auto &entity = ctx.all_lights.emplace_back(DuplicateEntity(*surflight_template));
 
     entity->origin.set_value(origin, settings::source::MAP);
 
@@ -1265,13 +1313,14 @@ static void CreateSurfaceLight(const qvec3d &origin, const qvec3d &normal, const
     }
 
     /* export it to a map file for debugging */
-    if (light_options.surflight_dump.value()) {
-        SurfLights_WriteEntityToFile(entity.get(), origin);
+    if (ctx.options.surflight_dump.value()) {
+        SurfLights_WriteEntityToFile(ctx, entity.get(), origin);
     }
 }
 
-static void CreateSurfaceLightOnFaceSubdivision(const mface_t *face, const modelinfo_t *face_modelinfo,
-    const light_t *surflight_template, const mbsp_t *bsp, int numverts, const qvec3d *verts)
+static void CreateSurfaceLightOnFaceSubdivision(light_context_t &ctx, const mface_t *face,
+    const modelinfo_t *face_modelinfo, const light_t *surflight_template, const mbsp_t *bsp, int numverts,
+    const qvec3d *verts)
 {
     qvec3d midpoint = qv::PolyCentroid(verts, verts + numverts);
     qplane3d plane = bsp->dplanes[face->planenum];
@@ -1290,7 +1339,7 @@ static void CreateSurfaceLightOnFaceSubdivision(const mface_t *face, const model
     /* Add the model offset */
     midpoint += face_modelinfo->offset;
 
-    CreateSurfaceLight(midpoint, plane.normal, surflight_template);
+    CreateSurfaceLight(ctx, midpoint, plane.normal, surflight_template);
 }
 
 static aabb3d BoundPoly(int numverts, qvec3d *verts)
@@ -1304,8 +1353,8 @@ static aabb3d BoundPoly(int numverts, qvec3d *verts)
     return bounds;
 }
 
-bool FaceMatchesSurfaceLightTemplate(
-    const mbsp_t *bsp, const mface_t *face, const modelinfo_t *face_modelinfo, const light_t &surflight, int surf_type)
+bool FaceMatchesSurfaceLightTemplate(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const modelinfo_t *face_modelinfo, const light_t &surflight, int surf_type)
 {
     const char *texname = Face_TextureName(bsp, face);
 
@@ -1314,14 +1363,14 @@ bool FaceMatchesSurfaceLightTemplate(
     if (surflight.epairs->has("_surface_radiosity")) {
         radiosity_type = surflight.epairs->get_int("_surface_radiosity");
     } else {
-        radiosity_type = light_options.surflight_radiosity.value();
+        radiosity_type = ctx.options.surflight_radiosity.value();
     }
 
     if (radiosity_type != surf_type) {
         return false;
     }
 
-    const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+    const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
 
     if (extended_flags.surflight_group) {
         if (surflight.surflight_group.value() && surflight.surflight_group.value() != extended_flags.surflight_group) {
@@ -1337,8 +1386,8 @@ bool FaceMatchesSurfaceLightTemplate(
  SubdividePolygon - from GLQuake
  ================
  */
-static void SubdividePolygon(const mface_t *face, const modelinfo_t *face_modelinfo, const mbsp_t *bsp, int numverts,
-    qvec3d *verts, vec_t subdivide_size)
+static void SubdividePolygon(light_context_t &ctx, const mface_t *face, const modelinfo_t *face_modelinfo,
+    const mbsp_t *bsp, int numverts, qvec3d *verts, vec_t subdivide_size)
 {
     int i, j;
     vec_t m;
@@ -1398,14 +1447,14 @@ static void SubdividePolygon(const mface_t *face, const modelinfo_t *face_modeli
             }
         }
 
-        SubdividePolygon(face, face_modelinfo, bsp, f, front, subdivide_size);
-        SubdividePolygon(face, face_modelinfo, bsp, b, back, subdivide_size);
+        SubdividePolygon(ctx, face, face_modelinfo, bsp, f, front, subdivide_size);
+        SubdividePolygon(ctx, face, face_modelinfo, bsp, b, back, subdivide_size);
         return;
     }
 
-    for (const auto &surflight : surfacelight_templates) {
-        if (FaceMatchesSurfaceLightTemplate(bsp, face, face_modelinfo, *surflight, SURFLIGHT_Q1)) {
-            CreateSurfaceLightOnFaceSubdivision(face, face_modelinfo, surflight.get(), bsp, numverts, verts);
+    for (const auto &surflight : ctx.surfacelight_templates) {
+        if (FaceMatchesSurfaceLightTemplate(ctx, bsp, face, face_modelinfo, *surflight, SURFLIGHT_Q1)) {
+            CreateSurfaceLightOnFaceSubdivision(ctx, face, face_modelinfo, surflight.get(), bsp, numverts, verts);
         }
     }
 }
@@ -1415,7 +1464,8 @@ static void SubdividePolygon(const mface_t *face, const modelinfo_t *face_modeli
  GL_SubdivideSurface - from GLQuake
  ================
  */
-static void GL_SubdivideSurface(const mface_t *face, const modelinfo_t *face_modelinfo, const mbsp_t *bsp)
+static void GL_SubdivideSurface(
+    light_context_t &ctx, const mface_t *face, const modelinfo_t *face_modelinfo, const mbsp_t *bsp)
 {
     int i;
     // TODO: is numedges ever > 64? should we use a winding_t here for
@@ -1431,18 +1481,18 @@ static void GL_SubdivideSurface(const mface_t *face, const modelinfo_t *face_mod
         }
     }
 
-    SubdividePolygon(face, face_modelinfo, bsp, face->numedges, verts, light_options.surflight_subdivide.value());
+    SubdividePolygon(ctx, face, face_modelinfo, bsp, face->numedges, verts, ctx.options.surflight_subdivide.value());
 }
 
-static bool ParseEntityLights(std::ifstream &f, const fs::path &fname)
+static bool ParseEntityLights(light_context_t &ctx, std::ifstream &f, const fs::path &fname)
 {
     std::string str{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
     parser_t p(str, {fname.string()});
-    EntData_ParseInto(p, radlights);
+    EntData_ParseInto(p, ctx.radlights);
     return true;
 }
 
-bool ParseLightsFile(const fs::path &fname)
+bool ParseLightsFile(light_context_t &ctx, const fs::path &fname)
 {
     std::ifstream f(fname);
 
@@ -1451,7 +1501,7 @@ bool ParseLightsFile(const fs::path &fname)
 
     // use entity-style format
     if (fname.extension() == ".ent") {
-        return ParseEntityLights(f, fname);
+        return ParseEntityLights(ctx, f, fname);
     }
 
     while (!f.eof()) {
@@ -1463,7 +1513,7 @@ bool ParseLightsFile(const fs::path &fname)
         if (!parser.parse_token())
             continue;
 
-        entdict_t &d = radlights.emplace_back();
+        entdict_t &d = ctx.radlights.emplace_back();
         d.set("_surface", parser.token);
         parser.parse_token();
         vec_t r = std::stod(parser.token);
@@ -1480,22 +1530,22 @@ bool ParseLightsFile(const fs::path &fname)
     return true;
 }
 
-static void MakeSurfaceLights(const mbsp_t *bsp)
+static void MakeSurfaceLights(light_context_t &ctx, const mbsp_t *bsp)
 {
     logging::funcheader();
 
-    Q_assert(surfacelight_templates.empty());
+    Q_assert(ctx.surfacelight_templates.empty());
 
-    for (entdict_t &l : radlights) {
-        auto &entity = surfacelight_templates.emplace_back(std::make_unique<light_t>());
+    for (entdict_t &l : ctx.radlights) {
+        auto &entity = ctx.surfacelight_templates.emplace_back(std::make_unique<light_t>());
         entity->epairs = &l;
         entity->set_settings(*entity->epairs, settings::source::MAP);
     }
 
-    for (auto &entity : all_lights) {
+    for (auto &entity : ctx.all_lights) {
         std::string tex = entity->epairs->get("_surface");
         if (!tex.empty()) {
-            surfacelight_templates.push_back(DuplicateEntity(*entity)); // makes a copy
+            ctx.surfacelight_templates.push_back(DuplicateEntity(*entity)); // makes a copy
 
             // Hack: clear templates light value to 0 so they don't cast light
             entity->light.set_value(0, settings::source::MAP);
@@ -1505,14 +1555,14 @@ static void MakeSurfaceLights(const mbsp_t *bsp)
         }
     }
 
-    if (surfacelight_templates.empty())
+    if (ctx.surfacelight_templates.empty())
         return;
 
-    if (light_options.surflight_dump.value()) {
-        surflights_dump_filename = light_options.sourceMap;
-        surflights_dump_filename.replace_filename(surflights_dump_filename.stem().string() + "-surflights")
+    if (ctx.options.surflight_dump.value()) {
+        ctx.surflights_dump_filename = ctx.options.sourceMap;
+        ctx.surflights_dump_filename.replace_filename(ctx.surflights_dump_filename.stem().string() + "-surflights")
             .replace_extension("map");
-        surflights_dump_file.open(surflights_dump_filename);
+        ctx.surflights_dump_file.open(ctx.surflights_dump_filename);
     }
 
     /* Create the surface lights */
@@ -1526,7 +1576,7 @@ static void MakeSurfaceLights(const mbsp_t *bsp)
         for (int k = 0; k < leaf.nummarksurfaces; k++) {
             const int facenum = bsp->dleaffaces[leaf.firstmarksurface + k];
             const mface_t *surf = BSP_GetFace(bsp, facenum);
-            const modelinfo_t *face_modelinfo = ModelInfoForFace(bsp, facenum);
+            const modelinfo_t *face_modelinfo = ModelInfoForFace(ctx, bsp, facenum);
 
             /* Skip face with no modelinfo */
             if (face_modelinfo == nullptr)
@@ -1544,18 +1594,20 @@ static void MakeSurfaceLights(const mbsp_t *bsp)
             face_visited.at(facenum) = true;
 
             /* Don't bother subdividing if it doesn't match any surface light templates */
-            if (!std::any_of(surfacelight_templates.begin(), surfacelight_templates.end(), [&](const auto &surflight) {
-                    return FaceMatchesSurfaceLightTemplate(bsp, surf, face_modelinfo, *surflight, SURFLIGHT_Q1);
-                }))
+            if (!std::any_of(ctx.surfacelight_templates.begin(), ctx.surfacelight_templates.end(),
+                    [&](const auto &surflight) {
+                        return FaceMatchesSurfaceLightTemplate(
+                            ctx, bsp, surf, face_modelinfo, *surflight, SURFLIGHT_Q1);
+                    }))
                 continue;
 
             /* Generate the lights */
-            GL_SubdivideSurface(surf, face_modelinfo, bsp);
+            GL_SubdivideSurface(ctx, surf, face_modelinfo, bsp);
         }
     }
 
-    if (surflights_dump_file.is_open()) {
-        surflights_dump_file.close();
-        fmt::print("wrote surface lights to '{}'\n", surflights_dump_filename);
+    if (ctx.surflights_dump_file.is_open()) {
+        ctx.surflights_dump_file.close();
+        fmt::print("wrote surface lights to '{}'\n", ctx.surflights_dump_filename);
     }
 }
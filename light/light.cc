@@ -38,6 +38,8 @@
 #include <common/fs.hh>
 #include <common/imglib.hh>
 #include <common/parallel.hh>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
 #include <common/ostream.hh>
 
 #if defined(HAVE_EMBREE) && defined(__SSE2__)
@@ -50,68 +52,126 @@
 #include <map>
 #include <set>
 #include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <string>
 
 #include <common/qvec.hh>
 #include <common/json.hh>
 
-bool dirt_in_use = false;
+light_context_t::light_context_t() = default;
+light_context_t::~light_context_t() = default;
 
-// intermediate representation of lightmap surfaces
-static std::vector<std::unique_ptr<lightsurf_t>> light_surfaces;
+bool IsOutputtingSupplementaryData(const light_context_t &ctx)
+{
+    return !ctx.faces_sup.empty();
+}
 
-std::vector<std::unique_ptr<lightsurf_t>> &LightSurfaces()
+void uncompressed_vis_t::clear()
 {
-    return light_surfaces;
+    rowbytes = 0;
+    rows.clear();
+    offsets.clear();
 }
 
-static std::vector<facesup_t> faces_sup; // lit2/bspx stuff
-static std::vector<bspx_decoupled_lm_perface> facesup_decoupled_global;
+int UncompressedVisIndex(const mbsp_t *bsp, const mleaf_t *leaf)
+{
+    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
+        return leaf->cluster;
+    }
 
-bool IsOutputtingSupplementaryData()
+    return leaf - bsp->dleafs.data();
+}
+
+/**
+ * Decompresses the visdata for the whole map into all_uncompressed_vis.
+ */
+static void LoadUncompressedVis(light_context_t &ctx, const mbsp_t *bsp)
 {
-    return !faces_sup.empty();
+    auto &vis = ctx.all_uncompressed_vis;
+
+    vis.clear();
+    vis.rowbytes = DecompressedVisSize(bsp);
+
+    auto decompress_row = [&](size_t visofs) -> int64_t {
+        const int64_t offset = vis.rows.size();
+        vis.rows.resize(offset + vis.rowbytes);
+        DecompressVis(bsp->dvis.bits.data() + visofs, bsp->dvis.bits.data() + bsp->dvis.bits.size(),
+            vis.rows.data() + offset, vis.rows.data() + offset + vis.rowbytes);
+        return offset;
+    };
+
+    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
+        const int num_clusters = bsp->dvis.bit_offsets.size();
+
+        vis.offsets.assign(num_clusters, -1);
+        vis.rows.reserve(num_clusters * vis.rowbytes);
+
+        for (int cluster = 0; cluster < num_clusters; ++cluster) {
+            if (bsp->dvis.get_bit_offset(VIS_PVS, cluster) >= bsp->dvis.bits.size()) {
+                logging::print("LoadUncompressedVis: invalid visofs for cluster {}\n", cluster);
+                continue;
+            }
+
+            vis.offsets[cluster] = decompress_row(bsp->dvis.get_bit_offset(VIS_PVS, cluster));
+        }
+    } else {
+        // if func_detail is in use, many leafs will share the same visofs;
+        // only decompress those once
+        std::unordered_map<int32_t, int64_t> offsets_by_visofs;
+
+        vis.offsets.assign(bsp->dleafs.size(), -1);
+
+        for (int leafnum = 0; leafnum < bsp->dleafs.size(); ++leafnum) {
+            auto &leaf = bsp->dleafs[leafnum];
+            if (leaf.visofs < 0) {
+                continue;
+            }
+
+            if (auto it = offsets_by_visofs.find(leaf.visofs); it != offsets_by_visofs.end()) {
+                vis.offsets[leafnum] = it->second;
+                continue;
+            }
+
+            if (leaf.visofs >= bsp->dvis.bits.size()) {
+                logging::print("LoadUncompressedVis: invalid visofs for leaf {}\n", leafnum);
+                continue;
+            }
+
+            vis.offsets[leafnum] = offsets_by_visofs[leaf.visofs] = decompress_row(leaf.visofs);
+        }
+    }
 }
 
-/// start of lightmap data
-std::vector<uint8_t> filebase;
-/// offset of start of free space after data (should be kept a multiple of 4)
-static int file_p;
-/// offset of end of free space for lightmap data
-static int file_end;
-
-/// start of litfile data
-std::vector<uint8_t> lit_filebase;
-/// offset of start of free space after litfile data (should be kept a multiple of 12)
-static int lit_file_p;
-/// offset of end of space for litfile data
-static int lit_file_end;
-
-/// start of luxfile data
-std::vector<uint8_t> lux_filebase;
-/// offset of start of free space after luxfile data (should be kept a multiple of 12)
-static int lux_file_p;
-/// offset of end of space for luxfile data
-static int lux_file_end;
-
-static std::unordered_map<int, std::vector<uint8_t>> all_uncompressed_vis;
-
-const std::unordered_map<int, std::vector<uint8_t>> &UncompressedVis()
+void pvs_pool_t::reset(size_t rowbytes)
 {
-    return all_uncompressed_vis;
+    m_rowbytes = rowbytes;
+    m_rows.clear();
+    m_rows_by_hash.clear();
 }
 
-std::vector<modelinfo_t *> modelinfo;
-std::vector<const modelinfo_t *> tracelist;
-std::vector<const modelinfo_t *> selfshadowlist;
-std::vector<const modelinfo_t *> shadowworldonlylist;
-std::vector<const modelinfo_t *> switchableshadowlist;
+const uint8_t *pvs_pool_t::intern(const uint8_t *row)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < m_rowbytes; i++) {
+        hash = (hash ^ row[i]) * 0x100000001b3ull;
+    }
 
-std::vector<surfflags_t> extended_texinfo_flags;
+    std::unique_lock lock(m_mutex);
 
-int dump_facenum = -1;
-int dump_vertnum = -1;
+    auto [first, last] = m_rows_by_hash.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        if (!memcmp(it->second, row, m_rowbytes)) {
+            return it->second;
+        }
+    }
+
+    auto &copy = m_rows.emplace_back(std::make_unique<uint8_t[]>(m_rowbytes));
+    memcpy(copy.get(), row, m_rowbytes);
+    m_rows_by_hash.emplace(hash, copy.get());
+    return copy.get();
+}
 
 // modelinfo_t
 
@@ -187,6 +247,7 @@ worldspawn_keys::worldspawn_keys()
       phongallowed{this, "phong", true, &worldspawn_group},
       phongangle{this, "phong_angle", 0, &worldspawn_group},
       bounce{this, "bounce", false, &worldspawn_group},
+      bounces{this, "bounces", 1, 1, 16, &worldspawn_group},
       bouncestyled{this, "bouncestyled", false, &worldspawn_group},
       bouncescale{this, "bouncescale", 1.0, 0.0, 100.0, &worldspawn_group},
       bouncecolorscale{this, "bouncecolorscale", 0.0, 0.0, 1.0, &worldspawn_group},
@@ -289,6 +350,11 @@ light_settings::light_settings()
       novanilla{this, "novanilla", false, &experimental_group, "implies -bspxlit; don't write vanilla lighting"},
       gate{this, "gate", LIGHT_EQUAL_EPSILON, &performance_group, "cutoff lights at this brightness level"},
       sunsamples{this, "sunsamples", 64, 8, 2048, &performance_group, "set samples for _sunlight2, default 64"},
+      skydomesamples{this, "skydomesamples", 0, 0, 4096, &performance_group,
+          "trace n stratified directions per sample for _sunlight2/3 and _sunlight_penumbra instead of expanding them "
+          "into suns; 0 = off"},
+      skydomeseed{this, "skydomeseed", 0, 0, std::numeric_limits<int32_t>::max(), &performance_group,
+          "seed for the per-sample rotation of -skydomesamples directions"},
       arghradcompat{this, "arghradcompat", false, &output_group, "enable compatibility for Arghrad-specific keys"},
       nolighting{this, "nolighting", false, &output_group, "don't output main world lighting (Q2RTX)"},
       debugface{this, "debugface", std::numeric_limits<vec_t>::quiet_NaN(), std::numeric_limits<vec_t>::quiet_NaN(),
@@ -304,6 +370,20 @@ light_settings::light_settings()
           this, "lightmap_scale", 0, &experimental_group, "force change lightmap scale; vanilla engines only allow 16"},
       extra{
           this, {"extra", "extra4"}, 1, &performance_group, "supersampling; 2x2 (extra) or 4x4 (extra4) respectively"},
+      extra_adaptive{this, "extra_adaptive", 0.0, 0.0, std::numeric_limits<vec_t>::max(), &performance_group,
+          "with -extra/-extra4, only supersample luxels on shadow edges or where light changes by more than n"},
+      raysort{this, "raysort", false, &performance_group,
+          "sort each batch of rays by direction and origin before tracing, for more coherent traversal"},
+      shadowprepass{this, "shadowprepass", shadowprepass_t::NONE,
+          {{"none", shadowprepass_t::NONE}, {"conservative", shadowprepass_t::CONSERVATIVE},
+              {"fast", shadowprepass_t::FAST}},
+          &performance_group,
+          "skip per-sample shadow rays for faces an entity light fully lights or shadows. "
+          "conservative = only when provably exact, fast = also guess from the corner samples"},
+      dirtstep{this, "dirtstep", 1, 1, 64, &performance_group,
+          "only trace dirt rays for every nth sample along each lightmap axis, and interpolate the rest"},
+      dirtsteperror{this, "dirtsteperror", false, &debug_group,
+          "with -dirtstep, also trace dirt at full resolution and report the error"},
       emissivequality{this, "emissivequality", emissivequality_t::LOW,
           {{"LOW", emissivequality_t::LOW}, {"MEDIUM", emissivequality_t::MEDIUM}, {"HIGH", emissivequality_t::HIGH}},
           &performance_group,
@@ -336,6 +416,8 @@ light_settings::light_settings()
       world_units_per_luxel{
           this, "world_units_per_luxel", 0, 0, 1024, &output_group, "enables output of DECOUPLED_LM BSPX lump"},
       litonly{this, "litonly", false, &output_group, "only write .lit file, don't modify BSP"},
+      dedup_lightmaps{this, "dedup_lightmaps", false, &output_group,
+          "share identical and single-colour lightmaps between faces to shrink the lighting lump"},
       nolights{this, "nolights", false, &output_group, "ignore light entities (only sunlight/minlight)"},
       facestyles{this, "facestyles", 4, &output_group, "max amount of styles per face; requires BSPX lump if > 4"},
       exportobj{this, "exportobj", false, &output_group, "export an .OBJ for inspection"},
@@ -436,12 +518,6 @@ void light_settings::postinitialize(int argc, const char **argv)
         logging::print("WARNING: -gate value greater than 1 may cause artifacts\n");
     }
 
-    if (radlights.is_changed()) {
-        if (!ParseLightsFile(*radlights.values().begin())) {
-            logging::print("Unable to read surface lights file {}\n", *radlights.values().begin());
-        }
-    }
-
     if (soft.value() == -1) {
         switch (extra.value()) {
             case 2: soft.set_value(1, settings::source::COMMANDLINE); break;
@@ -472,26 +548,26 @@ void light_settings::postinitialize(int argc, const char **argv)
     }
 
     if (debugmode == debugmodes::dirt) {
-        light_options.dirt.set_value(true, settings::source::COMMANDLINE);
+        dirt.set_value(true, settings::source::COMMANDLINE);
     } else if (debugmode == debugmodes::bounce || debugmode == debugmodes::bouncelights) {
-        light_options.bounce.set_value(true, settings::source::COMMANDLINE);
+        bounce.set_value(true, settings::source::COMMANDLINE);
     } else if (debugmode == debugmodes::debugneighbours && !debugface.is_changed()) {
         FError("-debugneighbours without -debugface specified\n");
     }
 
-    if (light_options.q2rtx.value()) {
-        if (!light_options.nolighting.is_changed()) {
-            light_options.nolighting.set_value(true, settings::source::GAME_TARGET);
+    if (q2rtx.value()) {
+        if (!nolighting.is_changed()) {
+            nolighting.set_value(true, settings::source::GAME_TARGET);
         }
 
-        if (!light_options.write_normals.is_changed()) {
-            light_options.write_normals.set_value(true, settings::source::GAME_TARGET);
+        if (!write_normals.is_changed()) {
+            write_normals.set_value(true, settings::source::GAME_TARGET);
         }
     }
 
     // upgrade to uint16 if facestyles is specified
-    if (light_options.facestyles.value() > MAXLIGHTMAPS && !light_options.compilerstyle_max.is_changed()) {
-        light_options.compilerstyle_max.set_value(INVALID_LIGHTSTYLE, settings::source::COMMANDLINE);
+    if (facestyles.value() > MAXLIGHTMAPS && !compilerstyle_max.is_changed()) {
+        compilerstyle_max.set_value(INVALID_LIGHTSTYLE, settings::source::COMMANDLINE);
     }
 
     common_settings::postinitialize(argc, argv);
@@ -509,9 +585,7 @@ void light_settings::reset()
 }
 } // namespace settings
 
-settings::light_settings light_options;
-
-void FixupGlobalSettings()
+void FixupGlobalSettings(light_context_t &ctx)
 {
     // NOTE: This is confusing.. Setting "dirt" "1" implies "minlight_dirt" "1"
     // (and sunlight_dir/sunlight2_dirt as well), unless those variables were
@@ -520,101 +594,78 @@ void FixupGlobalSettings()
     // We can't just default "minlight_dirt" to "1" because that would enable
     // dirtmapping by default.
 
-    if (light_options.dirt.value()) {
-        if (!light_options.minlight_dirt.is_changed()) {
-            light_options.minlight_dirt.set_value(true, settings::source::COMMANDLINE);
+    if (ctx.options.dirt.value()) {
+        if (!ctx.options.minlight_dirt.is_changed()) {
+            ctx.options.minlight_dirt.set_value(true, settings::source::COMMANDLINE);
         }
-        if (!light_options.sunlight_dirt.is_changed()) {
-            light_options.sunlight_dirt.set_value(1, settings::source::COMMANDLINE);
+        if (!ctx.options.sunlight_dirt.is_changed()) {
+            ctx.options.sunlight_dirt.set_value(1, settings::source::COMMANDLINE);
         }
-        if (!light_options.sunlight2_dirt.is_changed()) {
-            light_options.sunlight2_dirt.set_value(1, settings::source::COMMANDLINE);
+        if (!ctx.options.sunlight2_dirt.is_changed()) {
+            ctx.options.sunlight2_dirt.set_value(1, settings::source::COMMANDLINE);
         }
     }
 }
 
-static std::mutex light_mutex;
-
 /*
- * Return space for the lightmap and colourmap at the same time so it can
- * be done in a thread-safe manner.
- *
- * size is the number of greyscale pixels = number of bytes to allocate
- * and return in *lightdata
+ * Return pointers to the lightmap, colourmap and deluxemap data for the
+ * lightmap at `offset` (in greyscale samples; the colourmap and deluxemap
+ * offsets are 3x that). Used for the offsets laid out by
+ * SaveLightmapSurfaces, and with -litonly, for the offsets already in the bsp.
  */
-void GetFileSpace(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int size)
+void GetFileSpace(light_context_t &ctx, uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int offset)
 {
-    light_mutex.lock();
+    Q_assert(offset >= 0);
 
     *lightdata = *colordata = *deluxdata = nullptr;
 
-    if (!filebase.empty()) {
-        *lightdata = filebase.data() + file_p;
-    }
-    if (!lit_filebase.empty()) {
-        *colordata = lit_filebase.data() + lit_file_p;
-    }
-    if (!lux_filebase.empty()) {
-        *deluxdata = lux_filebase.data() + lux_file_p;
+    if (!ctx.filebase.empty()) {
+        *lightdata = ctx.filebase.data() + offset;
     }
 
-    // if size isn't a multiple of 4, round up to the next multiple of 4
-    if ((size % 4) != 0) {
-        size += (4 - (size % 4));
+    if (!ctx.lit_filebase.empty()) {
+        *colordata = ctx.lit_filebase.data() + (offset * 3);
     }
 
-    // increment the next writing offsets, aligning them to 4 uint8_t boundaries (file_p)
-    // and 12-uint8_t boundaries (lit_file_p/lux_file_p)
-    if (!filebase.empty()) {
-        file_p += size;
-    }
-    if (!lit_filebase.empty()) {
-        lit_file_p += 3 * size;
-    }
-    if (!lux_filebase.empty()) {
-        lux_file_p += 3 * size;
+    if (!ctx.lux_filebase.empty()) {
+        *deluxdata = ctx.lux_filebase.data() + (offset * 3);
     }
-
-    light_mutex.unlock();
-
-    if (file_p > file_end)
-        FError("overrun");
-
-    if (lit_file_p > lit_file_end)
-        FError("overrun");
 }
 
-/**
- * Special version of GetFileSpace for when we're relighting a .bsp and can't modify it.
- * In this case the offsets are already known.
+/*
+ * Allocates the output buffers for `size` greyscale samples of lightmap
+ * data (lit/lux data is 3x that).
  */
-void GetFileSpace_PreserveOffsetInBsp(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int lightofs)
+static void AllocateFileSpace(light_context_t &ctx, const mbsp_t *bsp, int size)
 {
-    Q_assert(lightofs >= 0);
-
-    *lightdata = *colordata = *deluxdata = nullptr;
+    ctx.filebase.clear();
+    ctx.lit_filebase.clear();
+    ctx.lux_filebase.clear();
 
-    if (!filebase.empty()) {
-        *lightdata = filebase.data() + lightofs;
+    if (!bsp->loadversion->game->has_rgb_lightmap) {
+        /* greyscale data stored in a separate buffer */
+        ctx.filebase.resize(size);
     }
 
-    if (colordata && !lit_filebase.empty()) {
-        *colordata = lit_filebase.data() + (lightofs * 3);
+    if (bsp->loadversion->game->has_rgb_lightmap || ctx.options.write_litfile) {
+        /* litfile data stored in a separate buffer */
+        ctx.lit_filebase.resize(size * 3);
     }
 
-    if (deluxdata && !lux_filebase.empty()) {
-        *deluxdata = lux_filebase.data() + (lightofs * 3);
+    if (ctx.options.write_luxfile) {
+        /* lux data stored in a separate buffer */
+        ctx.lux_filebase.resize(size * 3);
     }
 
-    // NOTE: file_p et. al. are not updated, since we're not dynamically allocating the lightmaps
+    ctx.file_p = size;
 }
 
-const modelinfo_t *ModelInfoForModel(const mbsp_t *bsp, int modelnum)
+const modelinfo_t *ModelInfoForModel(const light_context_t &ctx, const mbsp_t *bsp, int modelnum)
 {
-    return modelinfo.at(modelnum);
+    return ctx.modelinfo.at(modelnum).get();
 }
 
-const modelinfo_t *ModelInfoForFace(const mbsp_t *bsp, int facenum)
+const modelinfo_t *ModelInfoForFace(const light_context_t &ctx, const mbsp_t *bsp, int facenum)
 {
     int i;
     const dmodelh2_t *model;
@@ -629,63 +680,54 @@ const modelinfo_t *ModelInfoForFace(const mbsp_t *bsp, int facenum)
     if (i == bsp->dmodels.size()) {
         return NULL;
     }
-    return modelinfo.at(i);
+    return ctx.modelinfo.at(i).get();
 }
 
-struct face_texture_cache
+const img::texture *Face_Texture(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
-    const img::texture *image;
-    qvec3b averageColor;
-    qvec3d bounceColor;
-};
-
-static std::vector<face_texture_cache> face_textures;
-
-const img::texture *Face_Texture(const mbsp_t *bsp, const mface_t *face)
-{
-    return face_textures[face - bsp->dfaces.data()].image;
+    return ctx.face_textures[face - bsp->dfaces.data()].image;
 }
 
-const qvec3b &Face_LookupTextureColor(const mbsp_t *bsp, const mface_t *face)
+const qvec3b &Face_LookupTextureColor(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
-    return face_textures[face - bsp->dfaces.data()].averageColor;
+    return ctx.face_textures[face - bsp->dfaces.data()].averageColor;
 }
 
-const qvec3d &Face_LookupTextureBounceColor(const mbsp_t *bsp, const mface_t *face)
+const qvec3d &Face_LookupTextureBounceColor(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
-    return face_textures[face - bsp->dfaces.data()].bounceColor;
+    return ctx.face_textures[face - bsp->dfaces.data()].bounceColor;
 }
 
-static void CacheTextures(const mbsp_t &bsp)
+static void CacheTextures(light_context_t &ctx, const mbsp_t &bsp)
 {
-    face_textures.resize(bsp.dfaces.size());
+    ctx.face_textures.resize(bsp.dfaces.size());
 
     for (size_t i = 0; i < bsp.dfaces.size(); i++) {
         const char *name = Face_TextureName(&bsp, &bsp.dfaces[i]);
 
         if (!name || !*name) {
-            face_textures[i] = {nullptr, {127}, {0.5}};
+            ctx.face_textures[i] = {nullptr, {127}, {0.5}};
         } else {
             auto tex = img::find(name);
-            face_textures[i] = {tex, tex->averageColor,
+            ctx.face_textures[i] = {tex, tex->averageColor,
                 // lerp between gray and the texture color according to `bouncecolorscale` (0 = use gray, 1 = use
                 // texture color)
-                mix(qvec3d{127}, qvec3d(tex->averageColor), light_options.bouncecolorscale.value()) / 255.0};
+                mix(qvec3d{127}, qvec3d(tex->averageColor), ctx.options.bouncecolorscale.value()) / 255.0};
         }
     }
 }
 
-static void CreateLightmapSurfaces(mbsp_t *bsp)
+static void CreateLightmapSurfaces(light_context_t &ctx, mbsp_t *bsp)
 {
-    light_surfaces.resize(bsp->dfaces.size());
+    ctx.light_surfaces.resize(bsp->dfaces.size());
     logging::funcheader();
-    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&bsp](size_t i) {
-        auto facesup = faces_sup.empty() ? nullptr : &faces_sup[i];
-        auto facesup_decoupled = facesup_decoupled_global.empty() ? nullptr : &facesup_decoupled_global[i];
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&ctx, &bsp](size_t i) {
+        auto facesup = ctx.faces_sup.empty() ? nullptr : &ctx.faces_sup[i];
+        auto facesup_decoupled = ctx.facesup_decoupled_global.empty() ? nullptr : &ctx.facesup_decoupled_global[i];
         auto face = &bsp->dfaces[i];
 
         /* One extra lightmap is allocated to simplify handling overflow */
-        if (!light_options.litonly.value()) {
+        if (!ctx.options.litonly.value()) {
             // if litonly is set we need to preserve the existing lightofs
 
             /* some surfaces don't need lightmaps */
@@ -706,15 +748,191 @@ static void CreateLightmapSurfaces(mbsp_t *bsp)
             }
         }
 
-        light_surfaces[i] = CreateLightmapSurface(bsp, face, facesup, facesup_decoupled, light_options);
+        ctx.light_surfaces[i] = CreateLightmapSurface(ctx, bsp, face, facesup, facesup_decoupled, ctx.options);
     });
+
+    if (!bsp->dvis.bits.empty()) {
+        logging::print("{} shared surface pvs rows, {} bytes\n", ctx.pvs_pool.size(),
+            ctx.pvs_pool.size() * ctx.pvs_pool.rowbytes());
+    }
 }
 
-static void SaveLightmapSurfaces(mbsp_t *bsp)
+// allocations in the output buffers are kept a multiple of 4 samples
+static int LightmapAllocSize(int size)
+{
+    return (size + 3) & ~3;
+}
+
+/*
+ * -dedup_lightmaps: points each block of lightmap data that's identical to
+ * another one at a single copy, and each single-colour block at the largest
+ * block of that colour (smaller faces read a prefix of it). Then compacts
+ * the output buffers and updates the face headers.
+ */
+static void DeduplicateLightmaps(
+    light_context_t &ctx, mbsp_t *bsp, const std::vector<int> &offsets, const std::vector<int> &sizes)
 {
     logging::funcheader();
-    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&bsp](size_t i) {
-        auto &surf = light_surfaces[i];
+
+    struct buffer_t
+    {
+        std::vector<uint8_t> *data;
+        int scale;
+    };
+
+    std::vector<buffer_t> buffers;
+    if (!ctx.filebase.empty()) {
+        buffers.push_back({&ctx.filebase, 1});
+    }
+    if (!ctx.lit_filebase.empty()) {
+        buffers.push_back({&ctx.lit_filebase, 3});
+    }
+    if (!ctx.lux_filebase.empty()) {
+        buffers.push_back({&ctx.lux_filebase, 3});
+    }
+
+    const size_t numblocks = offsets.size();
+
+    // FNV-1a of the block's contents, or of its first sample for single-colour blocks
+    std::vector<uint64_t> hashes(numblocks);
+    std::vector<uint8_t> single_colour(numblocks);
+
+    logging::parallel_for(static_cast<size_t>(0), numblocks, [&](size_t b) {
+        uint64_t hash = 0xcbf29ce484222325ull, first_hash = hash;
+        bool is_single_colour = true;
+
+        for (const buffer_t &buffer : buffers) {
+            const uint8_t *data = buffer.data->data() + (offsets[b] * buffer.scale);
+            const int bytes = sizes[b] * buffer.scale;
+
+            for (int k = 0; k < bytes; k++) {
+                hash = (hash ^ data[k]) * 0x100000001b3ull;
+
+                if (k < buffer.scale) {
+                    first_hash = (first_hash ^ data[k]) * 0x100000001b3ull;
+                } else if (data[k] != data[k % buffer.scale]) {
+                    is_single_colour = false;
+                }
+            }
+        }
+
+        hashes[b] = is_single_colour ? first_hash : hash;
+        single_colour[b] = is_single_colour;
+    });
+
+    auto same_contents = [&](size_t a, size_t b, int size) {
+        for (const buffer_t &buffer : buffers) {
+            if (memcmp(buffer.data->data() + (offsets[a] * buffer.scale),
+                    buffer.data->data() + (offsets[b] * buffer.scale), size * buffer.scale)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // group identical blocks, in block order so the result is deterministic
+    std::vector<size_t> group_of(numblocks);
+    std::vector<size_t> group_rep;
+    std::unordered_map<uint64_t, std::vector<size_t>> groups_by_hash;
+
+    for (size_t b = 0; b < numblocks; b++) {
+        std::vector<size_t> &candidates = groups_by_hash[hashes[b]];
+        size_t group = group_rep.size();
+
+        for (const size_t candidate : candidates) {
+            const size_t rep = group_rep[candidate];
+
+            if (single_colour[b] != single_colour[rep]) {
+                continue;
+            }
+            if (single_colour[b] ? same_contents(b, rep, 1)
+                                 : (sizes[b] == sizes[rep] && same_contents(b, rep, sizes[b]))) {
+                group = candidate;
+                break;
+            }
+        }
+
+        if (group == group_rep.size()) {
+            candidates.push_back(group);
+            group_rep.push_back(b);
+        } else if (sizes[b] > sizes[group_rep[group]]) {
+            // single-colour groups are stored in their largest block
+            group_rep[group] = b;
+        }
+
+        group_of[b] = group;
+    }
+
+    // lay out one copy per group
+    std::vector<int> new_offsets(numblocks, -1);
+    int size = 0;
+
+    for (size_t b = 0; b < numblocks; b++) {
+        if (group_rep[group_of[b]] == b) {
+            new_offsets[b] = size;
+            size += LightmapAllocSize(sizes[b]);
+        }
+    }
+
+    std::unordered_map<int, int> remap;
+    size_t shared = 0, shared_single_colour = 0;
+
+    for (size_t b = 0; b < numblocks; b++) {
+        const size_t rep = group_rep[group_of[b]];
+        remap[offsets[b]] = new_offsets[rep];
+
+        if (rep != b) {
+            shared++;
+            shared_single_colour += single_colour[b];
+        }
+    }
+
+    for (const buffer_t &buffer : buffers) {
+        std::vector<uint8_t> compacted(size * buffer.scale);
+
+        for (size_t b = 0; b < numblocks; b++) {
+            if (new_offsets[b] != -1) {
+                memcpy(compacted.data() + (new_offsets[b] * buffer.scale),
+                    buffer.data->data() + (offsets[b] * buffer.scale), sizes[b] * buffer.scale);
+            }
+        }
+
+        *buffer.data = std::move(compacted);
+    }
+
+    // Q2/HL native colored lightmaps are addressed in bytes of rgb data
+    const int lightofs_scale = bsp->loadversion->game->has_rgb_lightmap ? 3 : 1;
+
+    auto remap_lightofs = [&](int32_t &lightofs) {
+        if (lightofs < 0) {
+            return;
+        }
+        if (auto it = remap.find(lightofs / lightofs_scale); it != remap.end()) {
+            lightofs = it->second * lightofs_scale;
+        }
+    };
+
+    for (auto &face : bsp->dfaces) {
+        remap_lightofs(face.lightofs);
+    }
+    for (auto &facesup : ctx.faces_sup) {
+        remap_lightofs(facesup.lightofs);
+    }
+    for (auto &decoupled : ctx.facesup_decoupled_global) {
+        remap_lightofs(decoupled.offset);
+    }
+
+    logging::print("{} of {} lightmap blocks shared ({} single-colour), {} -> {} samples\n", shared, numblocks,
+        shared_single_colour, ctx.file_p, size);
+
+    ctx.file_p = size;
+}
+
+static void SaveLightmapSurfaces(light_context_t &ctx, mbsp_t *bsp)
+{
+    logging::funcheader();
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&ctx, &bsp](size_t i) {
+        auto &surf = ctx.light_surfaces[i];
 
         if (!surf || surf->samples.empty()) {
             return;
@@ -723,55 +941,94 @@ static void SaveLightmapSurfaces(mbsp_t *bsp)
         FinishLightmapSurface(bsp, surf.get());
 
         auto f = &bsp->dfaces[i];
-        const modelinfo_t *face_modelinfo = ModelInfoForFace(bsp, i);
+        const modelinfo_t *face_modelinfo = ModelInfoForFace(ctx, bsp, i);
 
-        if (!facesup_decoupled_global.empty()) {
+        if (!ctx.facesup_decoupled_global.empty()) {
             SaveLightmapSurface(
-                bsp, f, nullptr, &facesup_decoupled_global[i], surf.get(), surf->extents, surf->extents);
-        } else if (faces_sup.empty()) {
-            SaveLightmapSurface(bsp, f, nullptr, nullptr, surf.get(), surf->extents, surf->extents);
-        } else if (light_options.novanilla.value() || faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
-            if (faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
-                f->lightofs = faces_sup[i].lightofs;
+                ctx, bsp, f, nullptr, &ctx.facesup_decoupled_global[i], surf.get(), surf->extents, surf->extents);
+        } else if (ctx.faces_sup.empty()) {
+            SaveLightmapSurface(ctx, bsp, f, nullptr, nullptr, surf.get(), surf->extents, surf->extents);
+        } else if (ctx.options.novanilla.value() || ctx.faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
+            if (ctx.faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
+                f->lightofs = ctx.faces_sup[i].lightofs;
             } else {
                 f->lightofs = -1;
             }
-            SaveLightmapSurface(bsp, f, &faces_sup[i], nullptr, surf.get(), surf->extents, surf->extents);
+            SaveLightmapSurface(ctx, bsp, f, &ctx.faces_sup[i], nullptr, surf.get(), surf->extents, surf->extents);
             for (int j = 0; j < MAXLIGHTMAPS; j++) {
-                f->styles[j] =
-                    faces_sup[i].styles[j] == INVALID_LIGHTSTYLE ? INVALID_LIGHTSTYLE_OLD : faces_sup[i].styles[j];
+                f->styles[j] = ctx.faces_sup[i].styles[j] == INVALID_LIGHTSTYLE ? INVALID_LIGHTSTYLE_OLD
+                                                                                 : ctx.faces_sup[i].styles[j];
             }
         } else {
-            SaveLightmapSurface(bsp, f, nullptr, nullptr, surf.get(), surf->extents, surf->vanilla_extents);
-            SaveLightmapSurface(bsp, f, &faces_sup[i], nullptr, surf.get(), surf->extents, surf->extents);
+            SaveLightmapSurface(ctx, bsp, f, nullptr, nullptr, surf.get(), surf->extents, surf->vanilla_extents);
+            SaveLightmapSurface(ctx, bsp, f, &ctx.faces_sup[i], nullptr, surf.get(), surf->extents, surf->extents);
+        }
+    });
+
+    if (ctx.options.litonly.value()) {
+        ctx.light_surfaces.clear();
+        return;
+    }
+
+    // lay the lightmaps out in face order, so the offsets don't depend on thread timing
+    std::vector<std::vector<int>> face_blocks(bsp->dfaces.size());
+
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        if (ctx.light_surfaces[i]) {
+            face_blocks[i] = LightmapSurfaceBlocks(ctx, ctx.light_surfaces[i].get());
         }
+    });
 
-        light_surfaces[i].reset();
+    std::vector<int> block_offsets, block_sizes;
+    std::vector<size_t> first_block(bsp->dfaces.size());
+    int size = 0;
+
+    for (size_t i = 0; i < face_blocks.size(); i++) {
+        first_block[i] = block_offsets.size();
+
+        for (const int block_size : face_blocks[i]) {
+            block_offsets.push_back(size);
+            block_sizes.push_back(block_size);
+            size += LightmapAllocSize(block_size);
+        }
+    }
+
+    AllocateFileSpace(ctx, bsp, size);
+
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        if (ctx.light_surfaces[i]) {
+            WriteLightmapSurface(ctx, bsp, ctx.light_surfaces[i].get(), block_offsets.data() + first_block[i]);
+            ctx.light_surfaces[i].reset();
+        }
     });
+
+    if (ctx.options.dedup_lightmaps.value()) {
+        DeduplicateLightmaps(ctx, bsp, block_offsets, block_sizes);
+    }
 }
 
-static void FindModelInfo(const mbsp_t *bsp)
+static void FindModelInfo(light_context_t &ctx, const mbsp_t *bsp)
 {
-    Q_assert(modelinfo.size() == 0);
-    Q_assert(tracelist.size() == 0);
-    Q_assert(selfshadowlist.size() == 0);
-    Q_assert(shadowworldonlylist.size() == 0);
-    Q_assert(switchableshadowlist.size() == 0);
+    Q_assert(ctx.modelinfo.size() == 0);
+    Q_assert(ctx.tracelist.size() == 0);
+    Q_assert(ctx.selfshadowlist.size() == 0);
+    Q_assert(ctx.shadowworldonlylist.size() == 0);
+    Q_assert(ctx.switchableshadowlist.size() == 0);
 
     if (!bsp->dmodels.size()) {
         FError("Corrupt .BSP: bsp->nummodels is 0!");
     }
 
-    if (light_options.lightmap_scale.is_changed()) {
-        WorldEnt().set("_lightmap_scale", light_options.lightmap_scale.string_value());
+    if (ctx.options.lightmap_scale.is_changed()) {
+        WorldEnt(ctx).set("_lightmap_scale", ctx.options.lightmap_scale.string_value());
     }
 
-    float lightmapscale = WorldEnt().get_int("_lightmap_scale");
+    float lightmapscale = WorldEnt(ctx).get_int("_lightmap_scale");
     if (!lightmapscale)
         lightmapscale = LMSCALE_DEFAULT; /* the default */
     if (lightmapscale <= 0)
         FError("lightmap scale is 0 or negative\n");
-    if (light_options.lightmap_scale.is_changed() || lightmapscale != LMSCALE_DEFAULT)
+    if (ctx.options.lightmap_scale.is_changed() || lightmapscale != LMSCALE_DEFAULT)
         logging::print("Forcing lightmap scale of {}qu\n", lightmapscale);
     /*I'm going to do this check in the hopes that there's a benefit to cheaper scaling in engines (especially software
      * ones that might be able to just do some mip hacks). This tool doesn't really care.*/
@@ -786,20 +1043,20 @@ static void FindModelInfo(const mbsp_t *bsp)
     }
 
     /* The world always casts shadows */
-    modelinfo_t *world = new modelinfo_t{bsp, &bsp->dmodels[0], lightmapscale};
+    modelinfo_t *world =
+        ctx.modelinfo.emplace_back(std::make_unique<modelinfo_t>(bsp, &bsp->dmodels[0], lightmapscale)).get();
     world->shadow.set_value(1.0f, settings::source::MAP); /* world always casts shadows */
-    world->phong_angle.copy_from(light_options.phongangle);
-    modelinfo.push_back(world);
-    tracelist.push_back(world);
+    world->phong_angle.copy_from(ctx.options.phongangle);
+    ctx.tracelist.push_back(world);
 
     for (int i = 1; i < bsp->dmodels.size(); i++) {
-        modelinfo_t *info = new modelinfo_t{bsp, &bsp->dmodels[i], lightmapscale};
-        modelinfo.push_back(info);
+        modelinfo_t *info =
+            ctx.modelinfo.emplace_back(std::make_unique<modelinfo_t>(bsp, &bsp->dmodels[i], lightmapscale)).get();
 
         /* Find the entity for the model */
         std::string modelname = fmt::format("*{}", i);
 
-        const entdict_t *entdict = FindEntDictWithKeyPair("model", modelname);
+        const entdict_t *entdict = FindEntDictWithKeyPair(ctx, "model", modelname);
         if (entdict == nullptr)
             FError("Couldn't find entity for model {}.\n", modelname);
 
@@ -809,74 +1066,100 @@ static void FindModelInfo(const mbsp_t *bsp)
         /* Check if this model will cast shadows (shadow => shadowself) */
         if (info->switchableshadow.boolValue()) {
             Q_assert(info->switchshadstyle.value() != 0);
-            switchableshadowlist.push_back(info);
+            ctx.switchableshadowlist.push_back(info);
         } else if (info->shadow.boolValue()) {
-            tracelist.push_back(info);
+            ctx.tracelist.push_back(info);
         } else if (info->shadowself.boolValue()) {
-            selfshadowlist.push_back(info);
+            ctx.selfshadowlist.push_back(info);
         } else if (info->shadowworldonly.boolValue()) {
-            shadowworldonlylist.push_back(info);
+            ctx.shadowworldonlylist.push_back(info);
         }
 
         /* Set up the offset for rotate_* entities */
         entdict->get_vector("origin", info->offset);
     }
 
-    Q_assert(modelinfo.size() == bsp->dmodels.size());
+    Q_assert(ctx.modelinfo.size() == bsp->dmodels.size());
 }
 
-// FIXME: in theory can't we calculate the exact amount of
-// storage required? we'd have to expand it by 4 to account for
-// lightstyles though
-static constexpr size_t MAX_MAP_LIGHTING = 0x8000000;
+/**
+ * Calls func(i) in parallel for each face with a nonzero cost, most expensive
+ * first, so a few huge faces near the end of the face list don't leave a
+ * single thread working alone at the end of a pass.
+ *
+ * Each worker takes the next face from the sorted list as soon as it's free
+ * (greedy longest-first scheduling). A pass then ends at most one face's cost
+ * after the total cost divided evenly over the workers. To get under that,
+ * a large face's rays are traced in sample ranges that the workers which ran
+ * out of faces pick up (see Embree_TraceRanges).
+ */
+template<typename F>
+static void ParallelForFacesByCost(const std::vector<uint64_t> &costs, F func)
+{
+    std::vector<size_t> order;
+    order.reserve(costs.size());
+    for (size_t i = 0; i < costs.size(); i++) {
+        if (costs[i]) {
+            order.push_back(i);
+        }
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    logging::parallel_progress_t progress(order.size());
+    std::atomic<size_t> next = 0;
+
+    // not tbb::parallel_for over `order`: its range splitting hands the
+    // cheap right halves to idle threads while one thread works through the
+    // expensive left end alone
+    const size_t workers = std::min<size_t>(tbb::this_task_arena::max_concurrency(), order.size());
+    tbb::task_group group;
+
+    for (size_t w = 0; w < workers; w++) {
+        group.run([&]() {
+            for (size_t k = next++; k < order.size(); k = next++) {
+                func(order[k]);
+                progress.add(1);
+            }
+        });
+    }
+
+    group.wait();
+    progress.finish();
+}
 
 /*
  * =============
  *  LightWorld
  * =============
  */
-static void LightWorld(bspdata_t *bspdata, bool forcedscale)
+static void LightWorld(light_context_t &ctx, bspdata_t *bspdata, bool forcedscale)
 {
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
 
     mbsp_t &bsp = std::get<mbsp_t>(bspdata->bsp);
 
-    light_surfaces.clear();
-    filebase.clear();
-    lit_filebase.clear();
-    lux_filebase.clear();
+    ctx.light_surfaces.clear();
 
-    if (!bsp.loadversion->game->has_rgb_lightmap) {
-        /* greyscale data stored in a separate buffer */
-        filebase.resize(MAX_MAP_LIGHTING);
-        file_p = 0;
-        file_end = MAX_MAP_LIGHTING;
-    }
-
-    if (bsp.loadversion->game->has_rgb_lightmap || light_options.write_litfile) {
-        /* litfile data stored in a separate buffer */
-        lit_filebase.resize(MAX_MAP_LIGHTING * 3);
-        lit_file_p = 0;
-        lit_file_end = (MAX_MAP_LIGHTING * 3);
-    }
-
-    if (light_options.write_luxfile) {
-        /* lux data stored in a separate buffer */
-        lux_filebase.resize(MAX_MAP_LIGHTING * 3);
-        lux_file_p = 0;
-        lux_file_end = (MAX_MAP_LIGHTING * 3);
+    if (ctx.options.litonly.value()) {
+        // lightmaps are written to the offsets already in the bsp
+        AllocateFileSpace(ctx, &bsp, bsp.dlightdata.size());
+    } else {
+        // sized by SaveLightmapSurfaces once the lightmaps are known
+        AllocateFileSpace(ctx, &bsp, 0);
     }
 
     if (forcedscale) {
         bspdata->bspx.entries.erase("LMSHIFT");
-    } else if (light_options.lmshift.is_changed()) {
+    } else if (ctx.options.lmshift.is_changed()) {
         // if we forcefully specified an lmshift lump, we have to generate one.
         bspdata->bspx.entries.erase("LMSHIFT");
 
         std::vector<uint8_t> shifts(bsp.dfaces.size());
 
         for (auto &shift : shifts) {
-            shift = light_options.lmshift.value();
+            shift = ctx.options.lmshift.value();
         }
 
         bspdata->bspx.transfer("LMSHIFT", shifts);
@@ -884,137 +1167,159 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
 
     auto lmshift_lump = bspdata->bspx.entries.find("LMSHIFT");
 
-    if (lmshift_lump == bspdata->bspx.entries.end() && light_options.write_litfile != lightfile::lit2 &&
-        light_options.facestyles.value() <= 4) {
-        faces_sup.clear(); // no scales, no lit2
+    if (lmshift_lump == bspdata->bspx.entries.end() && ctx.options.write_litfile != lightfile::lit2 &&
+        ctx.options.facestyles.value() <= 4) {
+        ctx.faces_sup.clear(); // no scales, no lit2
     } else { // we have scales or lit2 output. yay...
-        faces_sup.resize(bsp.dfaces.size());
+        ctx.faces_sup.resize(bsp.dfaces.size());
 
         if (lmshift_lump != bspdata->bspx.entries.end()) {
             for (int i = 0; i < bsp.dfaces.size(); i++) {
-                faces_sup[i].lmscale = nth_bit(reinterpret_cast<const char *>(lmshift_lump->second.data())[i]);
+                ctx.faces_sup[i].lmscale = nth_bit(reinterpret_cast<const char *>(lmshift_lump->second.data())[i]);
             }
         } else {
             for (int i = 0; i < bsp.dfaces.size(); i++) {
-                faces_sup[i].lmscale = modelinfo.at(0)->lightmapscale;
+                ctx.faces_sup[i].lmscale = ctx.modelinfo.at(0)->lightmapscale;
             }
         }
     }
 
     // decoupled lightmaps
-    facesup_decoupled_global.clear();
-    if (light_options.world_units_per_luxel.is_changed()) {
-        facesup_decoupled_global.resize(bsp.dfaces.size());
+    ctx.facesup_decoupled_global.clear();
+    if (ctx.options.world_units_per_luxel.is_changed()) {
+        ctx.facesup_decoupled_global.resize(bsp.dfaces.size());
     }
 
-    CalculateVertexNormals(&bsp);
+    CalculateVertexNormals(ctx, &bsp);
 
     // create lightmap surfaces
-    CreateLightmapSurfaces(&bsp);
+    CreateLightmapSurfaces(ctx, &bsp);
 
     const bool bouncerequired =
-        light_options.bounce.value() &&
-        (light_options.debugmode == debugmodes::none || light_options.debugmode == debugmodes::bounce ||
-            light_options.debugmode == debugmodes::bouncelights); // mxd
+        ctx.options.bounce.value() &&
+        (ctx.options.debugmode == debugmodes::none || ctx.options.debugmode == debugmodes::bounce ||
+            ctx.options.debugmode == debugmodes::bouncelights); // mxd
 
-    MakeRadiositySurfaceLights(light_options, &bsp);
+    MakeRadiositySurfaceLights(ctx, ctx.options, &bsp);
+
+    // estimated cost of each lit face; 0 for faces that aren't lit
+    std::vector<uint64_t> direct_costs(bsp.dfaces.size()), sample_costs(bsp.dfaces.size());
+    tbb::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [&](size_t i) {
+        if (ctx.light_surfaces[i] && Face_IsLightmapped(ctx, &bsp, &bsp.dfaces[i])) {
+            direct_costs[i] = 1 + EstimateDirectLightFaceCost(ctx, &bsp, *ctx.light_surfaces[i]);
+            sample_costs[i] = 1 + ctx.light_surfaces[i]->samples.size();
+        }
+    });
 
     logging::header("Direct Lighting"); // mxd
-    logging::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [&bsp](size_t i) {
-        if (light_surfaces[i] && Face_IsLightmapped(&bsp, &bsp.dfaces[i])) {
+    {
+        logging::timed_scope_t pass_scope("DirectLightFace");
+        ParallelForFacesByCost(direct_costs, [&ctx, &bsp](size_t i) {
 #if defined(HAVE_EMBREE) && defined(__SSE2__)
             _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
 #endif
 
-            DirectLightFace(&bsp, *light_surfaces[i].get(), light_options);
-        }
-    });
+            DirectLightFace(ctx, &bsp, *ctx.light_surfaces[i].get(), ctx.options);
+        });
+    }
 
-    if (bouncerequired && !light_options.nolighting.value()) {
-        MakeBounceLights(light_options, &bsp);
+    if (bouncerequired && !ctx.options.nolighting.value()) {
+        MakeBounceLights(ctx, ctx.options, &bsp);
 
         logging::header("Indirect Lighting"); // mxd
-        logging::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [&bsp](size_t i) {
-            if (light_surfaces[i] && Face_IsLightmapped(&bsp, &bsp.dfaces[i])) {
+        {
+            logging::timed_scope_t pass_scope("IndirectLightFace");
+            ParallelForFacesByCost(sample_costs, [&ctx, &bsp](size_t i) {
 #if defined(HAVE_EMBREE) && defined(__SSE2__)
                 _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
 #endif
 
-                IndirectLightFace(&bsp, *light_surfaces[i].get(), light_options);
-            }
-        });
+                IndirectLightFace(ctx, &bsp, *ctx.light_surfaces[i].get(), ctx.options);
+            });
+        }
+
+        if (ctx.options.bounces.value() > 1 && ctx.options.debugmode == debugmodes::none) {
+            GatherExtraBounces(ctx, ctx.options, &bsp);
+        }
     }
 
-    if (!light_options.nolighting.value()) {
+    if (!ctx.options.nolighting.value()) {
         logging::header("Post-Processing"); // mxd
-        logging::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [&bsp](size_t i) {
-            if (light_surfaces[i] && Face_IsLightmapped(&bsp, &bsp.dfaces[i])) {
+        logging::timed_scope_t pass_scope("PostProcessLightFace");
+        ParallelForFacesByCost(sample_costs, [&ctx, &bsp](size_t i) {
 #if defined(HAVE_EMBREE) && defined(__SSE2__)
-                _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+            _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
 #endif
 
-                PostProcessLightFace(&bsp, *light_surfaces[i].get(), light_options);
-            }
+            PostProcessLightFace(ctx, &bsp, *ctx.light_surfaces[i].get(), ctx.options);
         });
     }
 
-    SaveLightmapSurfaces(&bsp);
+    SaveLightmapSurfaces(ctx, &bsp);
 
     logging::print("Lighting Completed.\n\n");
 
     // Transfer greyscale lightmap (or color lightmap for Q2/HL) to the bsp and update lightdatasize
-    if (!light_options.litonly.value()) {
+    if (!ctx.options.litonly.value()) {
         if (bsp.loadversion->game->has_rgb_lightmap) {
-            bsp.dlightdata.resize(lit_file_p);
-            memcpy(bsp.dlightdata.data(), lit_filebase.data(), bsp.dlightdata.size());
+            bsp.dlightdata.resize(ctx.file_p * 3);
+            memcpy(bsp.dlightdata.data(), ctx.lit_filebase.data(), bsp.dlightdata.size());
         } else {
-            bsp.dlightdata.resize(file_p);
-            memcpy(bsp.dlightdata.data(), filebase.data(), bsp.dlightdata.size());
+            bsp.dlightdata.resize(ctx.file_p);
+            memcpy(bsp.dlightdata.data(), ctx.filebase.data(), bsp.dlightdata.size());
         }
     } else {
         // NOTE: bsp.lightdatasize is already valid in the -litonly case
     }
     logging::print("lightdatasize: {}\n", bsp.dlightdata.size());
 
+    // .lit/.lux files hold 3 bytes per byte of dlightdata
+    if (!ctx.lit_filebase.empty() && ctx.lit_filebase.size() < bsp.dlightdata.size() * 3) {
+        ctx.lit_filebase.resize(bsp.dlightdata.size() * 3);
+    }
+    if (!ctx.lux_filebase.empty() && ctx.lux_filebase.size() < bsp.dlightdata.size() * 3) {
+        ctx.lux_filebase.resize(bsp.dlightdata.size() * 3);
+    }
+
     // kill this stuff if its somehow found.
     bspdata->bspx.entries.erase("LMSTYLE16");
     bspdata->bspx.entries.erase("LMSTYLE");
     bspdata->bspx.entries.erase("LMOFFSET");
     bspdata->bspx.entries.erase("DECOUPLED_LM");
 
-    if (!faces_sup.empty()) {
+    if (!ctx.faces_sup.empty()) {
         bool needoffsets = false;
         bool needstyles = false;
         int maxstyle = 0;
         int stylesperface = 0;
 
         for (int i = 0; i < bsp.dfaces.size(); i++) {
-            if (bsp.dfaces[i].lightofs != faces_sup[i].lightofs)
+            if (bsp.dfaces[i].lightofs != ctx.faces_sup[i].lightofs)
                 needoffsets = true;
             int j = 0;
             for (; j < MAXLIGHTMAPSSUP; j++) {
-                if (faces_sup[i].styles[j] == INVALID_LIGHTSTYLE)
+                if (ctx.faces_sup[i].styles[j] == INVALID_LIGHTSTYLE)
                     break;
-                if (j < MAXLIGHTMAPS && bsp.dfaces[i].styles[j] != faces_sup[i].styles[j]) {
+                if (j < MAXLIGHTMAPS && bsp.dfaces[i].styles[j] != ctx.faces_sup[i].styles[j]) {
                     needstyles = true;
                 }
-                if (maxstyle < faces_sup[i].styles[j])
-                    maxstyle = faces_sup[i].styles[j];
+                if (maxstyle < ctx.faces_sup[i].styles[j])
+                    maxstyle = ctx.faces_sup[i].styles[j];
             }
             if (stylesperface < j)
                 stylesperface = j;
         }
 
-        if (stylesperface >= light_options.facestyles.value()) {
+        if (stylesperface >= ctx.options.facestyles.value()) {
             logging::print(
                 "WARNING: styles per face {} exceeds compiler-set max styles {}; use `-facestyles` if you need more.\n",
-                stylesperface, light_options.facestyles.value());
-            stylesperface = light_options.facestyles.value();
+                stylesperface, ctx.options.facestyles.value());
+            stylesperface = ctx.options.facestyles.value();
         }
 
         needstyles |= (stylesperface > 4);
 
-        logging::print("max {} styles per face, {} used{}\n", light_options.facestyles.value(), stylesperface,
+        logging::print("max {} styles per face, {} used{}\n", ctx.options.facestyles.value(), stylesperface,
             maxstyle >= INVALID_LIGHTSTYLE_OLD ? ", 16bit lightstyles" : "");
 
         if (needstyles) {
@@ -1027,7 +1332,7 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
 
                 for (size_t i = 0; i < bsp.dfaces.size(); i++) {
                     for (size_t j = 0; j < stylesperface; j++) {
-                        styles <= faces_sup[i].styles[j];
+                        styles <= ctx.faces_sup[i].styles[j];
                     }
                 }
 
@@ -1039,8 +1344,8 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
 
                 for (size_t i = 0, k = 0; i < bsp.dfaces.size(); i++) {
                     for (size_t j = 0; j < stylesperface; j++, k++) {
-                        styles_mem[k] = faces_sup[i].styles[j] == INVALID_LIGHTSTYLE ? INVALID_LIGHTSTYLE_OLD
-                                                                                     : faces_sup[i].styles[j];
+                        styles_mem[k] = ctx.faces_sup[i].styles[j] == INVALID_LIGHTSTYLE ? INVALID_LIGHTSTYLE_OLD
+                                                                                     : ctx.faces_sup[i].styles[j];
                     }
                 }
 
@@ -1056,7 +1361,7 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
             offsets << endianness<std::endian::little>;
 
             for (size_t i = 0; i < bsp.dfaces.size(); i++) {
-                offsets <= faces_sup[i].lightofs;
+                offsets <= ctx.faces_sup[i].lightofs;
             }
 
             logging::print("LMOFFSET BSPX lump written\n");
@@ -1064,14 +1369,14 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
         }
     }
 
-    if (!facesup_decoupled_global.empty()) {
+    if (!ctx.facesup_decoupled_global.empty()) {
         std::vector<uint8_t> mem(sizeof(bspx_decoupled_lm_perface) * bsp.dfaces.size());
 
         omemstream stream(mem.data(), mem.size(), std::ios_base::out | std::ios_base::binary);
         stream << endianness<std::endian::little>;
 
         for (size_t i = 0; i < bsp.dfaces.size(); i++) {
-            stream <= facesup_decoupled_global[i];
+            stream <= ctx.facesup_decoupled_global[i];
         }
 
         logging::print("DECOUPLED_LM BSPX lump written\n");
@@ -1079,10 +1384,10 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
     }
 }
 
-static void LoadExtendedTexinfoFlags(const fs::path &sourcefilename, const mbsp_t *bsp)
+static void LoadExtendedTexinfoFlags(light_context_t &ctx, const fs::path &sourcefilename, const mbsp_t *bsp)
 {
     // always create the zero'ed array
-    extended_texinfo_flags.resize(bsp->texinfo.size());
+    ctx.extended_texinfo_flags.resize(bsp->texinfo.size());
 
     fs::path filename(sourcefilename);
     filename.replace_extension("texinfo.json");
@@ -1103,12 +1408,12 @@ static void LoadExtendedTexinfoFlags(const fs::path &sourcefilename, const mbsp_
 
         if (index >= bsp->texinfo.size()) {
             logging::print("WARNING: Extended texinfo flags in {} does not match bsp, ignoring\n", filename);
-            memset(extended_texinfo_flags.data(), 0, bsp->texinfo.size() * sizeof(surfflags_t));
+            memset(ctx.extended_texinfo_flags.data(), 0, bsp->texinfo.size() * sizeof(surfflags_t));
             return;
         }
 
         auto &val = it.value();
-        auto &flags = extended_texinfo_flags[index];
+        auto &flags = ctx.extended_texinfo_flags[index];
 
         if (val.contains("is_nodraw")) {
             flags.is_nodraw = val.at("is_nodraw").get<bool>();
@@ -1196,12 +1501,13 @@ static void LoadExtendedTexinfoFlags(const fs::path &sourcefilename, const mbsp_
 
 // obj
 
-static void ExportObjFace(std::ofstream &f, const mbsp_t *bsp, const mface_t *face, int *vertcount)
+static void ExportObjFace(
+    light_context_t &ctx, std::ofstream &f, const mbsp_t *bsp, const mface_t *face, int *vertcount)
 {
     // export the vertices and uvs
     for (int i = 0; i < face->numedges; i++) {
         const int vertnum = Face_VertexAtIndex(bsp, face, i);
-        const qvec3f normal = GetSurfaceVertexNormal(bsp, face, i).normal;
+        const qvec3f normal = GetSurfaceVertexNormal(ctx, bsp, face, i).normal;
         const qvec3f &pos = bsp->dvertexes[vertnum];
         ewt::print(f, "v {:.9} {:.9} {:.9}\n", pos[0], pos[1], pos[2]);
         ewt::print(f, "vn {:.9} {:.9} {:.9}\n", normal[0], normal[1], normal[2]);
@@ -1219,7 +1525,7 @@ static void ExportObjFace(std::ofstream &f, const mbsp_t *bsp, const mface_t *fa
     *vertcount += face->numedges;
 }
 
-static void ExportObj(const fs::path &filename, const mbsp_t *bsp)
+static void ExportObj(light_context_t &ctx, const fs::path &filename, const mbsp_t *bsp)
 {
     std::ofstream objfile(filename);
     int vertcount = 0;
@@ -1228,7 +1534,7 @@ static void ExportObj(const fs::path &filename, const mbsp_t *bsp)
     const int end = bsp->dmodels[0].firstface + bsp->dmodels[0].numfaces;
 
     for (int i = start; i < end; i++) {
-        ExportObjFace(objfile, bsp, BSP_GetFace(bsp, i), &vertcount);
+        ExportObjFace(ctx, objfile, bsp, BSP_GetFace(bsp, i), &vertcount);
     }
 
     logging::print("Wrote {}\n", filename);
@@ -1257,20 +1563,20 @@ static const mface_t *Face_NearestCentroid(const mbsp_t *bsp, const qvec3f &poin
     return nearest_face;
 }
 
-static void FindDebugFace(const mbsp_t *bsp)
+static void FindDebugFace(light_context_t &ctx, const mbsp_t *bsp)
 {
-    if (!light_options.debugface.is_changed())
+    if (!ctx.options.debugface.is_changed())
         return;
 
-    const mface_t *f = Face_NearestCentroid(bsp, light_options.debugface.value());
+    const mface_t *f = Face_NearestCentroid(bsp, ctx.options.debugface.value());
     if (f == NULL)
         FError("f == NULL\n");
 
     const int facenum = f - bsp->dfaces.data();
 
-    dump_facenum = facenum;
+    ctx.dump_facenum = facenum;
 
-    const modelinfo_t *mi = ModelInfoForFace(bsp, facenum);
+    const modelinfo_t *mi = ModelInfoForFace(ctx, bsp, facenum);
     const int modelnum = mi ? (mi->model - bsp->dmodels.data()) : -1;
 
     const char *texname = Face_TextureName(bsp, f);
@@ -1297,40 +1603,40 @@ static int Vertex_NearestPoint(const mbsp_t *bsp, const qvec3d &point)
     return nearest_vert;
 }
 
-static void FindDebugVert(const mbsp_t *bsp)
+static void FindDebugVert(light_context_t &ctx, const mbsp_t *bsp)
 {
-    if (!light_options.debugvert.is_changed())
+    if (!ctx.options.debugvert.is_changed())
         return;
 
-    int v = Vertex_NearestPoint(bsp, light_options.debugvert.value());
+    int v = Vertex_NearestPoint(bsp, ctx.options.debugvert.value());
 
     logging::funcprint("dumping vert {} at {}\n", v, bsp->dvertexes[v]);
 
-    dump_vertnum = v;
+    ctx.dump_vertnum = v;
 }
 
-static void SetLitNeeded()
+static void SetLitNeeded(light_context_t &ctx)
 {
-    if (!light_options.write_litfile) {
-        if (light_options.novanilla.value()) {
-            light_options.write_litfile = lightfile::bspx;
+    if (!ctx.options.write_litfile) {
+        if (ctx.options.novanilla.value()) {
+            ctx.options.write_litfile = lightfile::bspx;
             logging::print("Colored light entities/settings detected: "
                            "bspxlit output enabled.\n");
         } else {
-            light_options.write_litfile = lightfile::external;
+            ctx.options.write_litfile = lightfile::external;
             logging::print("Colored light entities/settings detected: "
                            ".lit output enabled.\n");
         }
     }
 }
 
-static void CheckLitNeeded(const settings::worldspawn_keys &cfg)
+static void CheckLitNeeded(light_context_t &ctx, const settings::worldspawn_keys &cfg)
 {
     // check lights
-    for (const auto &light : GetLights()) {
+    for (const auto &light : ctx.all_lights) {
         if (!qv::epsilonEqual(vec3_white, light->color.value(), LIGHT_EQUAL_EPSILON) ||
             light->projectedmip != nullptr) { // mxd. Projected mips could also use .lit output
-            SetLitNeeded();
+            SetLitNeeded(ctx);
             return;
         }
     }
@@ -1342,7 +1648,7 @@ static void CheckLitNeeded(const settings::worldspawn_keys &cfg)
         !qv::epsilonEqual(cfg.sun2_color.value(), vec3_white, LIGHT_EQUAL_EPSILON) ||
         !qv::epsilonEqual(cfg.sunlight2_color.value(), vec3_white, LIGHT_EQUAL_EPSILON) ||
         !qv::epsilonEqual(cfg.sunlight3_color.value(), vec3_white, LIGHT_EQUAL_EPSILON)) {
-        SetLitNeeded();
+        SetLitNeeded(ctx);
         return;
     }
 }
@@ -1373,19 +1679,19 @@ static void PrintLights(void)
 {
     logging::print("===PrintLights===\n");
 
-    for (const auto &light : GetLights()) {
+    for (const auto &light : ctx.all_lights) {
         PrintLight(light);
     }
 }
 #endif
 
-static inline void WriteNormals(const mbsp_t &bsp, bspdata_t &bspdata)
+static inline void WriteNormals(light_context_t &ctx, const mbsp_t &bsp, bspdata_t &bspdata)
 {
     std::set<qvec3f> unique_normals;
     size_t num_normals = 0;
 
     for (auto &face : bsp.dfaces) {
-        auto &cache = FaceCacheForFNum(&face - bsp.dfaces.data());
+        auto &cache = FaceCacheForFNum(ctx, &face - bsp.dfaces.data());
         for (auto &normals : cache.normals()) {
             unique_normals.insert(qv::Snap(normals.normal));
             unique_normals.insert(qv::Snap(normals.tangent));
@@ -1409,7 +1715,7 @@ static inline void WriteNormals(const mbsp_t &bsp, bspdata_t &bspdata)
     }
 
     for (auto &face : bsp.dfaces) {
-        auto &cache = FaceCacheForFNum(&face - bsp.dfaces.data());
+        auto &cache = FaceCacheForFNum(ctx, &face - bsp.dfaces.data());
 
         for (auto &n : cache.normals()) {
             stream <= numeric_cast<uint32_t>(mapped_normals[qv::Snap(n.normal)]);
@@ -1425,54 +1731,6 @@ static inline void WriteNormals(const mbsp_t &bsp, bspdata_t &bspdata)
     bspdata.bspx.transfer("FACENORMALS", data);
 }
 
-/**
- * Resets globals in this file
- */
-static void ResetLight()
-{
-    dirt_in_use = false;
-    light_surfaces.clear();
-    faces_sup.clear();
-    facesup_decoupled_global.clear();
-
-    filebase.clear();
-    file_p = 0;
-    file_end = 0;
-
-    lit_filebase.clear();
-    lit_file_p = 0;
-    lit_file_end = 0;
-
-    lux_filebase.clear();
-    lux_file_p = 0;
-    lux_file_end = 0;
-
-    all_uncompressed_vis.clear();
-    modelinfo.clear();
-    tracelist.clear();
-    selfshadowlist.clear();
-    shadowworldonlylist.clear();
-    switchableshadowlist.clear();
-
-    extended_texinfo_flags.clear();
-
-    dump_facenum = -1;
-    dump_vertnum = -1;
-}
-
-void light_reset()
-{
-    ResetBounce();
-    ResetLightEntities();
-    ResetLight();
-    ResetLtFace();
-    ResetPhong();
-    ResetSurflight();
-    ResetEmbree();
-
-    light_options.reset();
-}
-
 /*
  * ==================
  * main
@@ -1481,34 +1739,46 @@ void light_reset()
  */
 int light_main(int argc, const char **argv)
 {
-    light_reset();
+    // heap allocated, since the settings are fairly large
+    auto context = std::make_unique<light_context_t>();
+
+    return light_main(*context, argc, argv);
+}
 
+int light_main(light_context_t &ctx, int argc, const char **argv)
+{
     bspdata_t bspdata;
 
-    light_options.preinitialize(argc, argv);
-    light_options.initialize(argc, argv);
+    ctx.options.preinitialize(argc, argv);
+    ctx.options.initialize(argc, argv);
+
+    if (ctx.options.radlights.is_changed()) {
+        if (!ParseLightsFile(ctx, *ctx.options.radlights.values().begin())) {
+            logging::print("Unable to read surface lights file {}\n", *ctx.options.radlights.values().begin());
+        }
+    }
 
     auto start = I_FloatTime();
-    fs::path source = light_options.sourceMap;
+    fs::path source = ctx.options.sourceMap;
 
     logging::init(
-        fs::path(source).replace_filename(source.stem().string() + "-light").replace_extension("log"), light_options);
+        fs::path(source).replace_filename(source.stem().string() + "-light").replace_extension("log"), ctx.options);
 
     // delete previous litfile
-    if (!light_options.onlyents.value()) {
+    if (!ctx.options.onlyents.value()) {
         source.replace_extension("lit");
         remove(source);
     }
 
     source.replace_extension("rad");
     if (source != "lights.rad")
-        ParseLightsFile("lights.rad"); // generic/default name
-    ParseLightsFile(source); // map-specific file name
+        ParseLightsFile(ctx, "lights.rad"); // generic/default name
+    ParseLightsFile(ctx, source); // map-specific file name
 
     source.replace_extension("bsp");
     LoadBSPFile(source, &bspdata);
 
-    bspdata.version->game->init_filesystem(source, light_options);
+    bspdata.version->game->init_filesystem(source, ctx.options);
 
     ConvertBSPFormat(&bspdata, &bspver_generic);
 
@@ -1516,129 +1786,130 @@ int light_main(int argc, const char **argv)
 
     // mxd. Use 1.0 rangescale as a default to better match with qrad3/arghrad
     if (bspdata.loadversion->game->id == GAME_QUAKE_II) {
-        if (!light_options.rangescale.is_changed()) {
-            light_options.rangescale.set_value(1.0, settings::source::GAME_TARGET);
+        if (!ctx.options.rangescale.is_changed()) {
+            ctx.options.rangescale.set_value(1.0, settings::source::GAME_TARGET);
         }
-        if (!light_options.bouncecolorscale.is_changed()) {
-            light_options.bouncecolorscale.set_value(0.5, settings::source::GAME_TARGET);
+        if (!ctx.options.bouncecolorscale.is_changed()) {
+            ctx.options.bouncecolorscale.set_value(0.5, settings::source::GAME_TARGET);
         }
-        if (!light_options.surflightscale.is_changed()) {
-            light_options.surflightscale.set_value(0.65f, settings::source::GAME_TARGET);
+        if (!ctx.options.surflightscale.is_changed()) {
+            ctx.options.surflightscale.set_value(0.65f, settings::source::GAME_TARGET);
         }
-        if (!light_options.surflightskyscale.is_changed()) {
-            light_options.surflightskyscale.set_value(0.65f, settings::source::GAME_TARGET);
+        if (!ctx.options.surflightskyscale.is_changed()) {
+            ctx.options.surflightskyscale.set_value(0.65f, settings::source::GAME_TARGET);
         }
-        if (!light_options.bouncescale.is_changed()) {
-            light_options.bouncescale.set_value(0.85f, settings::source::GAME_TARGET);
+        if (!ctx.options.bouncescale.is_changed()) {
+            ctx.options.bouncescale.set_value(0.85f, settings::source::GAME_TARGET);
         }
-        if (!light_options.bounce.is_changed()) {
-            light_options.bounce.set_value(true, settings::source::GAME_TARGET);
+        if (!ctx.options.bounce.is_changed()) {
+            ctx.options.bounce.set_value(true, settings::source::GAME_TARGET);
         }
-        if (!light_options.surflight_radiosity.is_changed()) {
-            light_options.surflight_radiosity.set_value(SURFLIGHT_RAD, settings::source::GAME_TARGET);
+        if (!ctx.options.surflight_radiosity.is_changed()) {
+            ctx.options.surflight_radiosity.set_value(SURFLIGHT_RAD, settings::source::GAME_TARGET);
         }
-        if (!light_options.bouncestyled.is_changed()) {
-            light_options.bouncestyled.set_value(true, settings::source::GAME_TARGET);
+        if (!ctx.options.bouncestyled.is_changed()) {
+            ctx.options.bouncestyled.set_value(true, settings::source::GAME_TARGET);
         }
     }
 
     // check vis approx type
-    if (light_options.visapprox.value() == visapprox_t::AUTO) {
+    if (ctx.options.visapprox.value() == visapprox_t::AUTO) {
         if (!bsp.dvis.bits.empty()) {
-            light_options.visapprox.set_value(visapprox_t::VIS, settings::source::DEFAULT);
+            ctx.options.visapprox.set_value(visapprox_t::VIS, settings::source::DEFAULT);
         } else {
-            light_options.visapprox.set_value(visapprox_t::RAYS, settings::source::DEFAULT);
+            ctx.options.visapprox.set_value(visapprox_t::RAYS, settings::source::DEFAULT);
         }
     }
 
-    img::load_textures(&bsp, light_options);
+    img::load_textures(&bsp, ctx.options);
 
-    CacheTextures(bsp);
+    CacheTextures(ctx, bsp);
 
-    LoadExtendedTexinfoFlags(source, &bsp);
-    LoadEntities(light_options, &bsp);
+    LoadExtendedTexinfoFlags(ctx, source, &bsp);
+    LoadEntities(ctx, ctx.options, &bsp);
 
-    light_options.postinitialize(argc, argv);
+    ctx.options.postinitialize(argc, argv);
 
-    all_uncompressed_vis = DecompressAllVis(&bsp, true);
-    FindModelInfo(&bsp);
+    LoadUncompressedVis(ctx, &bsp);
+    ctx.pvs_pool.reset(ctx.all_uncompressed_vis.rowbytes);
+    FindModelInfo(ctx, &bsp);
 
-    FindDebugFace(&bsp);
-    FindDebugVert(&bsp);
+    FindDebugFace(ctx, &bsp);
+    FindDebugVert(ctx, &bsp);
 
-    Embree_TraceInit(&bsp);
+    Embree_TraceInit(ctx, &bsp);
 
-    if (light_options.debugmode == debugmodes::phong_obj) {
-        CalculateVertexNormals(&bsp);
+    if (ctx.options.debugmode == debugmodes::phong_obj) {
+        CalculateVertexNormals(ctx, &bsp);
         source.replace_extension("obj");
-        ExportObj(source, &bsp);
+        ExportObj(ctx, source, &bsp);
 
         logging::close();
         return 0;
     }
 
-    SetupLights(light_options, &bsp);
+    SetupLights(ctx, ctx.options, &bsp);
 
     // PrintLights();
 
-    if (!light_options.onlyents.value()) {
+    if (!ctx.options.onlyents.value()) {
         if (!bspdata.loadversion->game->has_rgb_lightmap) {
-            CheckLitNeeded(light_options);
+            CheckLitNeeded(ctx, ctx.options);
         }
 
-        SetupDirt(light_options);
+        SetupDirt(ctx, ctx.options);
 
-        LightWorld(&bspdata, light_options.lightmap_scale.is_changed());
+        LightWorld(ctx, &bspdata, ctx.options.lightmap_scale.is_changed());
 
-        LightGrid(&bspdata);
+        LightGrid(ctx, &bspdata);
 
         // invalidate normals
         bspdata.bspx.entries.erase("FACENORMALS");
 
-        if (light_options.write_normals.value()) {
-            WriteNormals(bsp, bspdata);
+        if (ctx.options.write_normals.value()) {
+            WriteNormals(ctx, bsp, bspdata);
         }
 
         /*invalidate any bspx lighting info early*/
         bspdata.bspx.entries.erase("RGBLIGHTING");
         bspdata.bspx.entries.erase("LIGHTINGDIR");
 
-        if (light_options.write_litfile == lightfile::lit2) {
-            WriteLitFile(&bsp, faces_sup, source, 2);
+        if (ctx.options.write_litfile == lightfile::lit2) {
+            WriteLitFile(ctx, &bsp, ctx.faces_sup, source, 2);
             return 0; // run away before any files are written
         }
 
         /*fixme: add a new per-surface offset+lmscale lump for compat/versitility?*/
-        if (light_options.write_litfile & lightfile::external) {
-            WriteLitFile(&bsp, faces_sup, source, LIT_VERSION);
+        if (ctx.options.write_litfile & lightfile::external) {
+            WriteLitFile(ctx, &bsp, ctx.faces_sup, source, LIT_VERSION);
         }
-        if (light_options.write_litfile & lightfile::bspx) {
-            lit_filebase.resize(bsp.dlightdata.size() * 3);
-            bspdata.bspx.transfer("RGBLIGHTING", lit_filebase);
+        if (ctx.options.write_litfile & lightfile::bspx) {
+            ctx.lit_filebase.resize(bsp.dlightdata.size() * 3);
+            bspdata.bspx.transfer("RGBLIGHTING", ctx.lit_filebase);
         }
-        if (light_options.write_luxfile & lightfile::external) {
-            WriteLuxFile(&bsp, source, LIT_VERSION);
+        if (ctx.options.write_luxfile & lightfile::external) {
+            WriteLuxFile(ctx, &bsp, source, LIT_VERSION);
         }
-        if (light_options.write_luxfile & lightfile::bspx) {
-            lux_filebase.resize(bsp.dlightdata.size() * 3);
-            bspdata.bspx.transfer("LIGHTINGDIR", lux_filebase);
+        if (ctx.options.write_luxfile & lightfile::bspx) {
+            ctx.lux_filebase.resize(bsp.dlightdata.size() * 3);
+            bspdata.bspx.transfer("LIGHTINGDIR", ctx.lux_filebase);
         }
     }
 
     /* -novanilla + internal lighting = no grey lightmap */
-    if (light_options.novanilla.value() && (light_options.write_litfile & lightfile::bspx)) {
+    if (ctx.options.novanilla.value() && (ctx.options.write_litfile & lightfile::bspx)) {
         bsp.dlightdata.clear();
     }
 
-    if (light_options.exportobj.value()) {
-        ExportObj(fs::path{source}.replace_extension(".obj"), &bsp);
+    if (ctx.options.exportobj.value()) {
+        ExportObj(ctx, fs::path{source}.replace_extension(".obj"), &bsp);
     }
 
-    WriteEntitiesToString(light_options, &bsp);
+    WriteEntitiesToString(ctx, ctx.options, &bsp);
     /* Convert data format back if necessary */
     ConvertBSPFormat(&bspdata, bspdata.loadversion);
 
-    if (!light_options.litonly.value()) {
+    if (!ctx.options.litonly.value()) {
         WriteBSPFile(source, &bspdata);
     }
 
@@ -1647,15 +1918,41 @@ int light_main(int argc, const char **argv)
     logging::print("\n");
     logging::print("stats:\n");
     logging::print("{} lights tested, {} hits per sample point\n",
-        static_cast<double>(total_light_rays) / static_cast<double>(total_samplepoints),
-        static_cast<double>(total_light_ray_hits) / static_cast<double>(total_samplepoints));
+        static_cast<double>(ctx.total_light_rays) / static_cast<double>(ctx.total_samplepoints),
+        static_cast<double>(ctx.total_light_ray_hits) / static_cast<double>(ctx.total_samplepoints));
     logging::print("{} surface lights tested, {} hits per sample point\n",
-        static_cast<double>(total_surflight_rays) / static_cast<double>(total_samplepoints),
-        static_cast<double>(total_surflight_ray_hits) / static_cast<double>(total_samplepoints)); // mxd
+        static_cast<double>(ctx.total_surflight_rays) / static_cast<double>(ctx.total_samplepoints),
+        static_cast<double>(ctx.total_surflight_ray_hits) / static_cast<double>(ctx.total_samplepoints)); // mxd
     logging::print("{} bounce lights tested, {} hits per sample point\n",
-        static_cast<double>(total_bounce_rays) / static_cast<double>(total_samplepoints),
-        static_cast<double>(total_bounce_ray_hits) / static_cast<double>(total_samplepoints));
-    logging::print("{} empty lightmaps\n", static_cast<int>(fully_transparent_lightmaps));
+        static_cast<double>(ctx.total_bounce_rays) / static_cast<double>(ctx.total_samplepoints),
+        static_cast<double>(ctx.total_bounce_ray_hits) / static_cast<double>(ctx.total_samplepoints));
+    if (ctx.total_trace_time_ns) {
+        // only the time spent tracing, so -raysort's effect isn't diluted by the rest of the run
+        const double trace_seconds = ctx.total_trace_time_ns / 1e9;
+        logging::print("{} rays traced in {:.3} thread-seconds, {:.0f} rays per second per thread\n",
+            static_cast<uint64_t>(ctx.total_traced_rays), trace_seconds, ctx.total_traced_rays / trace_seconds);
+    }
+    if (ctx.options.shadowprepass.value() != shadowprepass_t::NONE) {
+        logging::print("{} light rays per sample point saved by -shadowprepass ({} lit, {} shadowed, {} mixed faces)\n",
+            static_cast<double>(ctx.total_prepass_rays_saved) / static_cast<double>(ctx.total_samplepoints),
+            static_cast<uint32_t>(ctx.total_prepass_lit), static_cast<uint32_t>(ctx.total_prepass_shadowed),
+            static_cast<uint32_t>(ctx.total_prepass_mixed));
+    }
+    if (ctx.total_dirt_samples && ctx.options.dirtstep.value() > 1) {
+        logging::print("{:.1f}% of dirt samples traced (-dirtstep)\n",
+            100.0 * static_cast<double>(ctx.total_dirt_traced) / static_cast<double>(ctx.total_dirt_samples));
+        if (ctx.options.dirtsteperror.value()) {
+            logging::print("-dirtstep occlusion error: {:.4f} mean, {:.4f} max\n",
+                static_cast<double>(ctx.total_dirtstep_error_micro) / 1e6 / static_cast<double>(ctx.total_dirt_samples),
+                static_cast<double>(ctx.max_dirtstep_error_micro) / 1e6);
+        }
+    }
+    logging::print("{} empty lightmaps\n", static_cast<int>(ctx.fully_transparent_lightmaps));
+    if (ctx.total_adaptive_luxels) {
+        logging::print("{:.1f}% of luxels supersampled (-extra_adaptive)\n",
+            100.0 * static_cast<double>(ctx.total_adaptive_supersampled) /
+                static_cast<double>(ctx.total_adaptive_luxels));
+    }
     logging::close();
 
     return 0;
@@ -1670,3 +1967,13 @@ int light_main(const std::vector<std::string> &args)
 
     return light_main(argPtrs.size(), argPtrs.data());
 }
+
+int light_main(light_context_t &ctx, const std::vector<std::string> &args)
+{
+    std::vector<const char *> argPtrs;
+    for (const std::string &arg : args) {
+        argPtrs.push_back(arg.data());
+    }
+
+    return light_main(ctx, argPtrs.size(), argPtrs.data());
+}
@@ -41,12 +41,12 @@ static std::vector<uint8_t> StringToVector(const std::string &str)
     return result;
 }
 
-static aabb3f LightGridBounds(const mbsp_t &bsp)
+static aabb3f LightGridBounds(light_context_t &ctx, const mbsp_t &bsp)
 {
     aabb3f result;
 
     // see if `_lightgrid_hint` entities are in use
-    for (auto &entity : GetEntdicts()) {
+    for (auto &entity : ctx.entdicts) {
         if (entity.get_int("_lightgrid_hint")) {
             qvec3d point{};
             entity.get_vector("origin", point);
@@ -79,7 +79,7 @@ struct lightgrid_raw_data
     qvec3f grid_index_to_world(const qvec3i &index) const { return grid_mins + (index * grid_dist); }
 };
 
-static std::vector<uint8_t> MakeOctreeLump(const mbsp_t &bsp, const lightgrid_raw_data &data)
+static std::vector<uint8_t> MakeOctreeLump(light_context_t &ctx, const mbsp_t &bsp, const lightgrid_raw_data &data)
 {
     /**
      * returns the octant index in [0..7]
@@ -255,7 +255,7 @@ static std::vector<uint8_t> MakeOctreeLump(const mbsp_t &bsp, const lightgrid_ra
             }
         }
 
-        WriteDebugPortals(windings, fs::path(light_options.sourceMap).replace_extension(".octree.prt"));
+        WriteDebugPortals(windings, fs::path(ctx.options.sourceMap).replace_extension(".octree.prt"));
     }
 
     // stats
@@ -386,7 +386,8 @@ static qvec3i MakePOT(const qvec3i &input)
     return qvec3i(static_cast<int>(x));
 }
 
-std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3d world_point)
+std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(
+    light_context_t &ctx, const mbsp_t *bsp, qvec3d world_point)
 {
     bool occluded = Light_PointInWorld(bsp, world_point);
     if (occluded) {
@@ -401,24 +402,25 @@ std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp
     lightgrid_samples_t samples;
 
     if (!occluded)
-        samples = CalcLightgridAtPoint(bsp, world_point);
+        samples = CalcLightgridAtPoint(ctx, bsp, world_point);
 
     return {samples, occluded};
 }
 
-void LightGrid(bspdata_t *bspdata)
+void LightGrid(light_context_t &ctx, bspdata_t *bspdata)
 {
-    if (!light_options.lightgrid.value())
+    if (!ctx.options.lightgrid.value())
         return;
 
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
 
     auto &bsp = std::get<mbsp_t>(bspdata->bsp);
 
     lightgrid_raw_data data;
-    data.grid_dist = light_options.lightgrid_dist.value();
+    data.grid_dist = ctx.options.lightgrid_dist.value();
 
-    auto grid_bounds = LightGridBounds(bsp);
+    auto grid_bounds = LightGridBounds(ctx, bsp);
 
     const qvec3f grid_maxs = grid_bounds.maxs();
     data.grid_mins = grid_bounds.mins();
@@ -442,7 +444,7 @@ void LightGrid(bspdata_t *bspdata)
         bool occluded;
         lightgrid_samples_t samples;
 
-        std::tie(samples, occluded) = FixPointAndCalcLightgrid(&bsp, world_point);
+        std::tie(samples, occluded) = FixPointAndCalcLightgrid(ctx, &bsp, world_point);
 
         data.grid_result[sample_index] = samples;
         data.occlusion[sample_index] = occluded;
@@ -464,7 +466,7 @@ void LightGrid(bspdata_t *bspdata)
     logging::print("     {} num_styles\n", data.num_styles);
 
     // octree lump
-    if (light_options.lightgrid_format.value() == lightgrid_format_t::OCTREE) {
-        bspdata->bspx.transfer("LIGHTGRID_OCTREE", MakeOctreeLump(bsp, data));
+    if (ctx.options.lightgrid_format.value() == lightgrid_format_t::OCTREE) {
+        bspdata->bspx.transfer("LIGHTGRID_OCTREE", MakeOctreeLump(ctx, bsp, data));
     }
 }
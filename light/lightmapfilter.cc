@@ -0,0 +1,320 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/lightmapfilter.hh>
+
+#include <common/log.hh> // for Q_assert
+
+#include <algorithm>
+
+void lightmap_image_t::resize(int w, int h)
+{
+    width = w;
+    height = h;
+
+    const size_t n = size();
+    if (r.size() < n) {
+        r.resize(n);
+        g.resize(n);
+        b.resize(n);
+        a.resize(n);
+    }
+}
+
+void HighlightSeams(lightmap_image_t &image)
+{
+    for (size_t i = 0; i < image.size(); i++) {
+        if (image.a[i] == 0) {
+            image.set(i, {255, 0, 0, 1});
+        }
+    }
+}
+
+bool FloodFillTransparent(lightmap_image_t &image)
+{
+    // transparent pixels take the average of their neighbours.
+
+    const int w = image.width, h = image.height;
+
+    // nothing to do for the common case of a fully opaque image
+    if (std::find(image.a.begin(), image.a.begin() + image.size(), 0.0f) == image.a.begin() + image.size()) {
+        return false;
+    }
+
+    // samples are filled in place, so later samples in a pass see the earlier ones
+    while (1) {
+        size_t unhandled_pixels = 0;
+
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                const int i = (y * w) + x;
+
+                if (image.a[i] != 0) {
+                    continue;
+                }
+
+                // average the neighbouring non-transparent samples
+                int opaque_neighbours = 0;
+                qvec3f neighbours_sum{};
+
+                for (int y1 = std::max(y - 1, 0); y1 <= std::min(y + 1, h - 1); y1++) {
+                    for (int x1 = std::max(x - 1, 0); x1 <= std::min(x + 1, w - 1); x1++) {
+                        const int j = (y1 * w) + x1;
+
+                        if (image.a[j] == 1) {
+                            opaque_neighbours++;
+                            neighbours_sum += qvec3f{image.r[j], image.g[j], image.b[j]};
+                        }
+                    }
+                }
+
+                if (opaque_neighbours > 0) {
+                    neighbours_sum *= (1.0f / (float)opaque_neighbours);
+                    image.set(i, {neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f});
+                } else {
+                    // all neighbours are transparent. need to perform more iterations (or the whole lightmap is
+                    // transparent).
+                    unhandled_pixels++;
+                }
+            }
+        }
+
+        if (unhandled_pixels == image.size()) {
+            return true;
+        }
+
+        if (unhandled_pixels == 0) {
+            return false;
+        }
+    }
+}
+
+// per-thread scratch planes for BoxBlurImage's horizontal pass
+struct box_blur_scratch_t
+{
+    std::vector<float> padded;
+    // sums of opaque colors, opaque count, and all colors
+    std::vector<float> opaque[3], opaque_weight, all[3];
+
+    void resize(size_t n, size_t row)
+    {
+        if (padded.size() < row) {
+            padded.resize(row);
+        }
+        if (opaque_weight.size() < n) {
+            for (int c = 0; c < 3; c++) {
+                opaque[c].resize(n);
+                all[c].resize(n);
+            }
+            opaque_weight.resize(n);
+        }
+    }
+};
+
+// the filters below work a row at a time on the separate planes so the inner
+// loops are plain float adds and selects over contiguous arrays. GCC vectorizes
+// the window sum in BoxBlur_SumRow, the masking loops, the vertical pass sums in
+// BoxBlurImage and the accumulation loops in IntegerDownsampleImage, but only at
+// -O3 or with -fvect-cost-model=dynamic (light/CMakeLists.txt sets the latter for
+// this file); build with -fopt-info-vec-optimized to check.
+
+// sums the 2*radius+1 wide window around each sample of `row`, clamping at the edges
+static void BoxBlur_SumRow(const float *row, float *out, int w, int radius, std::vector<float> &padded)
+{
+    for (int x = 0; x < w + 2 * radius; x++) {
+        padded[x] = row[std::clamp(x - radius, 0, w - 1)];
+    }
+
+    std::fill(out, out + w, 0.0f);
+
+    for (int k = 0; k <= 2 * radius; k++) {
+        const float *src = padded.data() + k;
+
+        for (int x = 0; x < w; x++) {
+            out[x] += src[x];
+        }
+    }
+}
+
+void BoxBlurImage(const lightmap_image_t &input, lightmap_image_t &output, int radius)
+{
+    // the 2D box is done as a horizontal then a vertical pass; the x/y are clamped
+    // to the image like the per-sample version did, which keeps it separable
+
+    thread_local box_blur_scratch_t scratch;
+    thread_local std::vector<float> masked;
+
+    const int w = input.width, h = input.height;
+    const size_t n = input.size();
+
+    scratch.resize(n, w + 2 * radius);
+    output.resize(w, h);
+
+    if (masked.size() < static_cast<size_t>(w)) {
+        masked.resize(w);
+    }
+
+    const float *planes[3] = {input.r.data(), input.g.data(), input.b.data()};
+
+    for (int y = 0; y < h; y++) {
+        const size_t row = static_cast<size_t>(y) * w;
+        const float *alpha = input.a.data() + row;
+
+        for (int c = 0; c < 3; c++) {
+            const float *color = planes[c] + row;
+
+            BoxBlur_SumRow(color, scratch.all[c].data() + row, w, radius, scratch.padded);
+
+            // occluded sample points don't contribute to the filter
+            for (int x = 0; x < w; x++) {
+                masked[x] = alpha[x] != 0.0f ? color[x] : 0.0f;
+            }
+            BoxBlur_SumRow(masked.data(), scratch.opaque[c].data() + row, w, radius, scratch.padded);
+        }
+
+        for (int x = 0; x < w; x++) {
+            masked[x] = alpha[x] != 0.0f ? 1.0f : 0.0f;
+        }
+        BoxBlur_SumRow(masked.data(), scratch.opaque_weight.data() + row, w, radius, scratch.padded);
+    }
+
+    const float all_weight = static_cast<float>((2 * radius + 1) * (2 * radius + 1));
+    float *out_planes[3] = {output.r.data(), output.g.data(), output.b.data()};
+
+    thread_local std::vector<float> sums[7];
+    for (auto &sum : sums) {
+        if (sum.size() < static_cast<size_t>(w)) {
+            sum.resize(w);
+        }
+    }
+
+    for (int y = 0; y < h; y++) {
+        for (auto &sum : sums) {
+            std::fill(sum.begin(), sum.begin() + w, 0.0f);
+        }
+
+        for (int k = -radius; k <= radius; k++) {
+            const size_t row = static_cast<size_t>(std::clamp(y + k, 0, h - 1)) * w;
+
+            for (int c = 0; c < 3; c++) {
+                const float *opaque = scratch.opaque[c].data() + row;
+                const float *all = scratch.all[c].data() + row;
+
+                for (int x = 0; x < w; x++) {
+                    sums[c][x] += opaque[x];
+                    sums[3 + c][x] += all[x];
+                }
+            }
+
+            const float *weight = scratch.opaque_weight.data() + row;
+            for (int x = 0; x < w; x++) {
+                sums[6][x] += weight[x];
+            }
+        }
+
+        const size_t row = static_cast<size_t>(y) * w;
+
+        for (int x = 0; x < w; x++) {
+            const float weight = sums[6][x];
+
+            if (weight > 0.0f) {
+                for (int c = 0; c < 3; c++) {
+                    out_planes[c][row + x] = sums[c][x] / weight;
+                }
+                output.a[row + x] = 1.0f;
+            } else {
+                for (int c = 0; c < 3; c++) {
+                    out_planes[c][row + x] = sums[3 + c][x] / all_weight;
+                }
+                output.a[row + x] = 0.0f;
+            }
+        }
+    }
+}
+
+void IntegerDownsampleImage(const lightmap_image_t &input, lightmap_image_t &output, int factor)
+{
+    Q_assert(factor >= 1);
+
+    const int outw = input.width / factor;
+    const int outh = input.height / factor;
+
+    output.resize(outw, outh);
+
+    // accumulators for one output row: opaque colors, opaque weight, and all colors
+    thread_local std::vector<float> sums[7];
+    for (auto &sum : sums) {
+        if (sum.size() < static_cast<size_t>(outw)) {
+            sum.resize(outw);
+        }
+    }
+
+    const float *planes[3] = {input.r.data(), input.g.data(), input.b.data()};
+    float *out_planes[3] = {output.r.data(), output.g.data(), output.b.data()};
+
+    // every sample is counted when ignoring occlusion
+    const float all_weight = static_cast<float>(factor * factor);
+
+    for (int y = 0; y < outh; y++) {
+        for (auto &sum : sums) {
+            std::fill(sum.begin(), sum.begin() + outw, 0.0f);
+        }
+
+        // same summation order per output sample as the per-sample version, so the results are identical
+        for (int y0 = 0; y0 < factor; y0++) {
+            const size_t row = static_cast<size_t>((y * factor) + y0) * input.width;
+            const float *alpha = input.a.data() + row;
+
+            for (int x0 = 0; x0 < factor; x0++) {
+                for (int c = 0; c < 3; c++) {
+                    const float *color = planes[c] + row;
+
+                    for (int x = 0; x < outw; x++) {
+                        const float sample = color[(x * factor) + x0];
+                        sums[3 + c][x] += sample;
+                        // occluded sample points don't contribute to the filter
+                        sums[c][x] += alpha[(x * factor) + x0] != 0.0f ? sample : 0.0f;
+                    }
+                }
+
+                for (int x = 0; x < outw; x++) {
+                    sums[6][x] += alpha[(x * factor) + x0] != 0.0f ? 1.0f : 0.0f;
+                }
+            }
+        }
+
+        const size_t row = static_cast<size_t>(y) * outw;
+
+        for (int x = 0; x < outw; x++) {
+            const float weight = sums[6][x];
+
+            if (weight > 0.0f) {
+                for (int c = 0; c < 3; c++) {
+                    out_planes[c][row + x] = sums[c][x] / weight;
+                }
+                output.a[row + x] = 1.0f;
+            } else {
+                for (int c = 0; c < 3; c++) {
+                    out_planes[c][row + x] = sums[3 + c][x] / all_weight;
+                }
+                output.a[row + x] = 0.0f;
+            }
+        }
+    }
+}
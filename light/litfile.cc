@@ -51,7 +51,8 @@ void litheader_t::v2_t::stream_read(std::istream &s)
     s >= std::tie(numsurfs, lmsamples);
 }
 
-void WriteLitFile(const mbsp_t *bsp, const std::vector<facesup_t> &facesup, const fs::path &filename, int version)
+void WriteLitFile(light_context_t &ctx, const mbsp_t *bsp, const std::vector<facesup_t> &facesup,
+    const fs::path &filename, int version)
 {
     litheader_t header;
 
@@ -81,13 +82,13 @@ void WriteLitFile(const mbsp_t *bsp, const std::vector<facesup_t> &facesup, cons
                 j++;
             litfile <= (uint8_t)j;
         }
-        litfile.write((const char *)lit_filebase.data(), bsp->dlightdata.size() * 3);
-        litfile.write((const char *)lux_filebase.data(), bsp->dlightdata.size() * 3);
+        litfile.write((const char *)ctx.lit_filebase.data(), bsp->dlightdata.size() * 3);
+        litfile.write((const char *)ctx.lux_filebase.data(), bsp->dlightdata.size() * 3);
     } else
-        litfile.write((const char *)lit_filebase.data(), bsp->dlightdata.size() * 3);
+        litfile.write((const char *)ctx.lit_filebase.data(), bsp->dlightdata.size() * 3);
 }
 
-void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version)
+void WriteLuxFile(light_context_t &ctx, const mbsp_t *bsp, const fs::path &filename, int version)
 {
     litheader_t header;
 
@@ -98,5 +99,5 @@ void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version)
 
     std::ofstream luxfile(luxname, std::ios_base::out | std::ios_base::binary);
     luxfile <= header.v1;
-    luxfile.write((const char *)lux_filebase.data(), bsp->dlightdata.size() * 3);
+    luxfile.write((const char *)ctx.lux_filebase.data(), bsp->dlightdata.size() * 3);
 }
@@ -28,6 +28,7 @@
 #include <light/trace.hh>
 #include <light/bounce.hh>
 #include <light/litfile.hh> // for facesup_t
+#include <light/lightmapfilter.hh>
 
 #include <common/imglib.hh>
 #include <common/log.hh>
@@ -41,14 +42,9 @@
 #include <algorithm>
 #include <fstream>
 
-std::atomic<uint32_t> total_light_rays, total_light_ray_hits, total_samplepoints;
-std::atomic<uint32_t> total_bounce_rays, total_bounce_ray_hits;
-std::atomic<uint32_t> total_surflight_rays, total_surflight_ray_hits; // mxd
-std::atomic<uint32_t> fully_transparent_lightmaps;
-static bool warned_about_light_map_overflow, warned_about_light_style_overflow;
 
 /* Debug helper - move elsewhere? */
-void PrintFaceInfo(const mface_t *face, const mbsp_t *bsp)
+void PrintFaceInfo(light_context_t &ctx, const mface_t *face, const mbsp_t *bsp)
 {
     const mtexinfo_t *tex = &bsp->texinfo[face->texinfo];
     const char *texname = Face_TextureName(bsp, face);
@@ -61,7 +57,7 @@ void PrintFaceInfo(const mface_t *face, const mbsp_t *bsp)
         int edge = bsp->dsurfedges[face->firstedge + i];
         int vert = Face_VertexAtIndex(bsp, face, i);
         const qvec3f &point = GetSurfaceVertexPoint(bsp, face, i);
-        const qvec3f norm = GetSurfaceVertexNormal(bsp, face, i).normal;
+        const qvec3f norm = GetSurfaceVertexNormal(ctx, bsp, face, i).normal;
         logging::print("{} {:3} ({:3.3}, {:3.3}, {:3.3}) :: normal ({:3.3}, {:3.3}, {:3.3}) :: edge {}\n",
             i ? "          " : "    verts ", vert, point[0], point[1], point[2], norm[0], norm[1], norm[2], edge);
     }
@@ -107,14 +103,14 @@ static constexpr float sampleOffPlaneDist = 1.0f;
    both for phong shading to look good, as well as general light quality
 
  */
-static position_t PositionSamplePointOnFace(
-    const mbsp_t *bsp, const mface_t *face, const bool phongShaded, const qvec3f &point, const qvec3f &modelOffset);
+static position_t PositionSamplePointOnFace(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const bool phongShaded, const qvec3f &point, const qvec3f &modelOffset);
 
-std::vector<const mface_t *> NeighbouringFaces_old(const mbsp_t *bsp, const mface_t *face)
+std::vector<const mface_t *> NeighbouringFaces_old(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
     std::vector<const mface_t *> result;
     for (int i = 0; i < face->numedges; i++) {
-        const mface_t *smoothed = Face_EdgeIndexSmoothed(bsp, face, i);
+        const mface_t *smoothed = Face_EdgeIndexSmoothed(ctx, bsp, face, i);
         if (smoothed != nullptr && smoothed != face) {
             result.push_back(smoothed);
         }
@@ -122,10 +118,10 @@ std::vector<const mface_t *> NeighbouringFaces_old(const mbsp_t *bsp, const mfac
     return result;
 }
 
-position_t CalcPointNormal(const mbsp_t *bsp, const mface_t *face, const qvec3f &origPoint, bool phongShaded,
-    const faceextents_t &faceextents, int recursiondepth, const qvec3f &modelOffset)
+position_t CalcPointNormal(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face, const qvec3f &origPoint,
+    bool phongShaded, const faceextents_t &faceextents, int recursiondepth, const qvec3f &modelOffset)
 {
-    const auto &facecache = FaceCacheForFNum(Face_GetNum(bsp, face));
+    const auto &facecache = FaceCacheForFNum(ctx, Face_GetNum(bsp, face));
     const qvec4f &surfplane = facecache.plane();
     const auto &points = facecache.points();
     const auto &edgeplanes = facecache.edgePlanes();
@@ -140,7 +136,7 @@ position_t CalcPointNormal(const mbsp_t *bsp, const mface_t *face, const qvec3f
 
     // check if in face..
     if (EdgePlanes_PointInside(edgeplanes, point)) {
-        return PositionSamplePointOnFace(bsp, face, phongShaded, point, modelOffset);
+        return PositionSamplePointOnFace(ctx, bsp, face, phongShaded, point, modelOffset);
     }
 
 #if 0
@@ -170,7 +166,7 @@ position_t CalcPointNormal(const mbsp_t *bsp, const mface_t *face, const qvec3f
         const float in1_dist = DistAbovePlane(in1, point);
         const float in2_dist = DistAbovePlane(in2, point);
         if (in1_dist >= 0 && in2_dist >= 0) {
-            const auto &n_facecache = FaceCacheForFNum(Face_GetNum(bsp, n.face));
+            const auto &n_facecache = FaceCacheForFNum(ctx, Face_GetNum(bsp, n.face));
             const qvec4f &n_surfplane = n_facecache.plane();
             const auto &n_edgeplanes = n_facecache.edgePlanes();
             
@@ -179,7 +175,7 @@ position_t CalcPointNormal(const mbsp_t *bsp, const mface_t *face, const qvec3f
             
             // check if in face..
             if (EdgePlanes_PointInside(n_edgeplanes, n_point)) {
-                return PositionSamplePointOnFace(bsp, n.face, phongShaded, n_point, modelOffset);
+                return PositionSamplePointOnFace(ctx, bsp, n.face, phongShaded, n_point, modelOffset);
             }
         }
     }
@@ -225,13 +221,13 @@ position_t CalcPointNormal(const mbsp_t *bsp, const mface_t *face, const qvec3f
 
         if (bestplane != -1) {
             // FIXME: Also need to handle non-smoothed but same plane
-            const mface_t *smoothed = Face_EdgeIndexSmoothed(bsp, face, bestplane);
+            const mface_t *smoothed = Face_EdgeIndexSmoothed(ctx, bsp, face, bestplane);
             if (smoothed) {
                 // try recursive search
                 if (recursiondepth < 3) {
                     // call recursively to look up normal in the adjacent face
                     return CalcPointNormal(
-                        bsp, smoothed, point, phongShaded, faceextents, recursiondepth + 1, modelOffset);
+                        ctx, bsp, smoothed, point, phongShaded, faceextents, recursiondepth + 1, modelOffset);
                 }
             }
         }
@@ -251,7 +247,7 @@ position_t CalcPointNormal(const mbsp_t *bsp, const mface_t *face, const qvec3f
     if (luxelSpaceDist <= 1) {
         // Snap it to the face edge. Add the 1 unit off plane.
         const qvec3f snapped = closest.second + (qvec3f(surfplane) * sampleOffPlaneDist);
-        return PositionSamplePointOnFace(bsp, face, phongShaded, snapped, modelOffset);
+        return PositionSamplePointOnFace(ctx, bsp, face, phongShaded, snapped, modelOffset);
     }
 
     // This point is too far from the polygon to be visible in game, so don't bother calculating lighting for it.
@@ -261,7 +257,7 @@ position_t CalcPointNormal(const mbsp_t *bsp, const mface_t *face, const qvec3f
 }
 
 // Dump points to a .map file
-static void CalcPoints_Debug(const lightsurf_t *surf, const mbsp_t *bsp)
+static void CalcPoints_Debug(light_context_t &ctx, const lightsurf_t *surf, const mbsp_t *bsp)
 {
     std::ofstream f("calcpoints.map");
 
@@ -287,7 +283,7 @@ static void CalcPoints_Debug(const lightsurf_t *surf, const mbsp_t *bsp)
     logging::print("wrote face {}'s sample points ({}x{}) to calcpoints.map\n", Face_GetNum(bsp, surf->face),
         surf->width, surf->height);
 
-    PrintFaceInfo(surf->face, bsp);
+    PrintFaceInfo(ctx, surf->face, bsp);
 }
 
 /// Checks if the point is in any solid (solid or sky leaf)
@@ -296,18 +292,18 @@ static void CalcPoints_Debug(const lightsurf_t *surf, const mbsp_t *bsp)
 /// 3. the `self` model (regardless of whether it's selfshadowing)
 ///
 /// This is used for marking sample points as occluded.
-static bool Light_PointInAnySolid(const mbsp_t *bsp, const dmodelh2_t *self, const qvec3d &point)
+static bool Light_PointInAnySolid(light_context_t &ctx, const mbsp_t *bsp, const dmodelh2_t *self, const qvec3d &point)
 {
     if (Light_PointInSolid(bsp, self, point))
         return true;
 
-    auto *self_modelinfo = ModelInfoForModel(bsp, self - bsp->dmodels.data());
+    auto *self_modelinfo = ModelInfoForModel(ctx, bsp, self - bsp->dmodels.data());
     if (self_modelinfo->object_channel_mask.value() == CHANNEL_MASK_DEFAULT) {
         if (Light_PointInWorld(bsp, point))
             return true;
     }
 
-    for (const auto &modelinfo : tracelist) {
+    for (const auto &modelinfo : ctx.tracelist) {
         if (modelinfo->object_channel_mask.value() != self_modelinfo->object_channel_mask.value())
             continue;
 
@@ -322,10 +318,10 @@ static bool Light_PointInAnySolid(const mbsp_t *bsp, const dmodelh2_t *self, con
 }
 
 // precondition: `point` is on the same plane as `face` and within the bounds.
-static position_t PositionSamplePointOnFace(
-    const mbsp_t *bsp, const mface_t *face, const bool phongShaded, const qvec3f &point, const qvec3f &modelOffset)
+static position_t PositionSamplePointOnFace(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const bool phongShaded, const qvec3f &point, const qvec3f &modelOffset)
 {
-    const auto &facecache = FaceCacheForFNum(Face_GetNum(bsp, face));
+    const auto &facecache = FaceCacheForFNum(ctx, Face_GetNum(bsp, face));
     const auto &points = facecache.points();
     const auto &normals = facecache.normals();
     const auto &edgeplanes = facecache.edgePlanes();
@@ -348,7 +344,7 @@ static position_t PositionSamplePointOnFace(
         return position_t(point);
     }
 
-    const modelinfo_t *mi = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+    const modelinfo_t *mi = ModelInfoForFace(ctx, bsp, Face_GetNum(bsp, face));
     if (mi == nullptr) {
         // missing model ("skip" faces) don't get lighting
         return position_t(point);
@@ -366,7 +362,7 @@ static position_t PositionSamplePointOnFace(
         pointNormal = plane;
     }
 
-    const bool inSolid = Light_PointInAnySolid(bsp, mi->model, point + modelOffset);
+    const bool inSolid = Light_PointInAnySolid(ctx, bsp, mi->model, point + modelOffset);
     if (inSolid) {
 #if 1
         // try +/- 0.5 units in X/Y/Z (8 tests)
@@ -377,7 +373,7 @@ static position_t PositionSamplePointOnFace(
                     const qvec3f jitter = qvec3f(x, y, z) * 0.5;
                     const qvec3f new_point = point + jitter;
 
-                    if (!Light_PointInAnySolid(bsp, mi->model, new_point + modelOffset)) {
+                    if (!Light_PointInAnySolid(ctx, bsp, mi->model, new_point + modelOffset)) {
                         return position_t(face, new_point, pointNormal);
                     }
                 }
@@ -394,7 +390,7 @@ static position_t PositionSamplePointOnFace(
             if (!shrunk.empty()) {
                 const pair<int, qvec3f> closest = ClosestPointOnPolyBoundary(shrunk, point);
                 const qvec3f newPoint = closest.second + (qvec3f(plane) * sampleOffPlaneDist);
-                if (!Light_PointInAnySolid(bsp, mi->model, newPoint + modelOffset))
+                if (!Light_PointInAnySolid(ctx, bsp, mi->model, newPoint + modelOffset))
                     return position_t(face, newPoint, pointNormal);
             }
         }
@@ -412,17 +408,17 @@ static position_t PositionSamplePointOnFace(
  * to get the world xyz value of the sample point
  * =================
  */
-static void CalcPoints(
-    const modelinfo_t *modelinfo, const qvec3d &offset, lightsurf_t *surf, const mbsp_t *bsp, const mface_t *face)
+static void CalcPoints(light_context_t &ctx, const modelinfo_t *modelinfo, const qvec3d &offset, lightsurf_t *surf,
+    const mbsp_t *bsp, const mface_t *face)
 {
     const settings::worldspawn_keys &cfg = *surf->cfg;
 
-    surf->width = surf->extents.width() * light_options.extra.value();
-    surf->height = surf->extents.height() * light_options.extra.value();
+    surf->width = surf->extents.width() * ctx.options.extra.value();
+    surf->height = surf->extents.height() * ctx.options.extra.value();
 
-    const float starts = -0.5 + (0.5 / light_options.extra.value());
-    const float startt = -0.5 + (0.5 / light_options.extra.value());
-    const float st_step = 1.0f / light_options.extra.value();
+    const float starts = -0.5 + (0.5 / ctx.options.extra.value());
+    const float startt = -0.5 + (0.5 / ctx.options.extra.value());
+    const float st_step = 1.0f / ctx.options.extra.value();
 
     /* Allocate surf->points */
     size_t num_points = surf->width * surf->height;
@@ -444,7 +440,7 @@ static void CalcPoints(
 
             // do this before correcting the point, so we can wrap around the inside of pipes
             const bool phongshaded = (surf->curved && cfg.phongallowed.value());
-            const auto res = CalcPointNormal(bsp, face, sample.point, phongshaded, surf->extents, 0, offset);
+            const auto res = CalcPointNormal(ctx, bsp, face, sample.point, phongshaded, surf->extents, 0, offset);
 
             sample.occluded = !res.m_unoccluded;
             sample.realfacenum = res.m_actualFace != nullptr ? Face_GetNum(bsp, res.m_actualFace) : -1;
@@ -453,38 +449,14 @@ static void CalcPoints(
         }
     }
 
-    if (dump_facenum == Face_GetNum(bsp, face)) {
-        CalcPoints_Debug(surf, bsp);
+    if (ctx.dump_facenum == Face_GetNum(bsp, face)) {
+        CalcPoints_Debug(ctx, surf, bsp);
     }
 }
 
-static bool Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf, uint8_t *out)
-{
-    const size_t num_pvsclusterbytes = DecompressedVisSize(bsp);
-
-    // init to all visible
-    memset(out, 0xFF, num_pvsclusterbytes);
-
-    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        auto it = UncompressedVis().find(leaf->cluster);
-        if (it == UncompressedVis().end()) {
-            return false;
-        }
-
-        memcpy(out, it->second.data(), num_pvsclusterbytes);
-    } else {
-        auto it = UncompressedVis().find(leaf->visofs);
-        if (it == UncompressedVis().end()) {
-            return false;
-        }
-
-        memcpy(out, it->second.data(), num_pvsclusterbytes);
-    }
-
-    return true;
-}
-
-static const std::vector<uint8_t> *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf)
+// returns the decompressed pvs row for the leaf, or nullptr if visdata
+// shouldn't be used to cull from it
+static const uint8_t *Mod_LeafPvs(light_context_t &ctx, const mbsp_t *bsp, const mleaf_t *leaf)
 {
     if (bsp->loadversion->game->contents_are_liquid({leaf->contents})) {
         // the liquid case is because leaf->contents might be in an opaque liquid,
@@ -493,15 +465,11 @@ static const std::vector<uint8_t> *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t
         return nullptr;
     }
 
-    const int key = (bsp->loadversion->game->id == GAME_QUAKE_II) ? leaf->cluster : leaf->visofs;
-    if (auto it = UncompressedVis().find(leaf->cluster); it != UncompressedVis().end()) {
-        return &it->second;
-    }
-    return nullptr;
+    return ctx.all_uncompressed_vis.row(UncompressedVisIndex(bsp, leaf));
 }
 
 // returns true if pvs can see leaf
-static bool Pvs_LeafVisible(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *leaf)
+static bool Pvs_LeafVisible(const mbsp_t *bsp, const uint8_t *pvs, const mleaf_t *leaf)
 {
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
         if (leaf->cluster < 0) {
@@ -528,21 +496,25 @@ static bool Pvs_LeafVisible(const mbsp_t *bsp, const std::vector<uint8_t> &pvs,
     }
 }
 
-static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
+static void CalcPvs(light_context_t &ctx, const mbsp_t *bsp, lightsurf_t *lightsurf)
 {
-    const int pvssize = DecompressedVisSize(bsp);
-    const mleaf_t *lastleaf = nullptr;
+    const size_t pvssize = ctx.all_uncompressed_vis.rowbytes;
 
     // set defaults
-    lightsurf->pvs.clear();
+    lightsurf->pvs = nullptr;
 
     if (!bsp->dvis.bits.size()) {
         return;
     }
 
-    // set lightsurf->pvs
-    uint8_t *pointpvs = (uint8_t *)alloca(pvssize);
-    lightsurf->pvs.resize(pvssize);
+    // the distinct rows touched by the sample points; leafs without
+    // visdata, or in liquid, see everything
+    thread_local std::vector<const uint8_t *> rows;
+    thread_local std::vector<uint8_t> merged;
+    const mleaf_t *lastleaf = nullptr;
+    bool all_visible = false;
+
+    rows.clear();
 
     for (auto &sample : lightsurf->samples) {
         const mleaf_t *leaf = Light_PointInLeaf(bsp, sample.point);
@@ -553,28 +525,56 @@ static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
 
         lastleaf = leaf;
 
-        /* copy the pvs for this leaf into pointpvs */
-        Mod_LeafPvs(bsp, leaf, pointpvs);
-
         if (bsp->loadversion->game->contents_are_liquid({leaf->contents})) {
             // hack for when the sample point might be in an opaque liquid, blocking vis,
             // but we typically want light to pass through these.
             // see also VisCullEntity() which handles the case when the light emitter is in liquid.
-            for (int j = 0; j < pvssize; j++) {
-                lightsurf->pvs[j] |= 0xff;
-            }
+            all_visible = true;
+            break;
+        }
+
+        const uint8_t *row = ctx.all_uncompressed_vis.row(UncompressedVisIndex(bsp, leaf));
+        if (!row) {
+            all_visible = true;
             break;
         }
 
-        /* merge the pvs for this sample point into lightsurf->pvs */
-        for (int j = 0; j < pvssize; j++) {
-            lightsurf->pvs[j] |= pointpvs[j];
+        if (std::find(rows.begin(), rows.end(), row) == rows.end()) {
+            rows.push_back(row);
+        }
+    }
+
+    if (all_visible) {
+        merged.assign(pvssize, 0xff);
+        lightsurf->pvs = ctx.pvs_pool.intern(merged.data());
+        return;
+    }
+
+    if (rows.empty()) {
+        merged.assign(pvssize, 0);
+        lightsurf->pvs = ctx.pvs_pool.intern(merged.data());
+        return;
+    }
+
+    // most faces are in a single leaf; just share that leaf's row
+    if (rows.size() == 1) {
+        lightsurf->pvs = rows[0];
+        return;
+    }
+
+    /* merge the pvs for each leaf into the surface pvs */
+    merged.assign(rows[0], rows[0] + pvssize);
+    for (size_t i = 1; i < rows.size(); i++) {
+        for (size_t j = 0; j < pvssize; j++) {
+            merged[j] |= rows[i][j];
         }
     }
+
+    lightsurf->pvs = ctx.pvs_pool.intern(merged.data());
 }
 
-static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo, const settings::worldspawn_keys &cfg,
-    const mface_t *face, const mbsp_t *bsp, const facesup_t *facesup,
+static std::unique_ptr<lightsurf_t> Lightsurf_Init(light_context_t &ctx, const modelinfo_t *modelinfo,
+    const settings::worldspawn_keys &cfg, const mface_t *face, const mbsp_t *bsp, const facesup_t *facesup,
     const bspx_decoupled_lm_perface *facesup_decoupled)
 {
     auto spaceToWorld = TexSpaceToWorld(bsp, face);
@@ -582,7 +582,7 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
     /* Check for invalid texture axes */
     if (std::isnan(spaceToWorld.at(0, 0))) {
         logging::print("Bad texture axes on face:\n");
-        PrintFaceInfo(face, bsp);
+        PrintFaceInfo(ctx, face, bsp);
         return nullptr;
     }
 
@@ -594,7 +594,7 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
     lightsurf->occlusion_stream = std::make_unique<raystream_occlusion_t>();
     lightsurf->intersection_stream = std::make_unique<raystream_intersection_t>();
 
-    if (Face_IsLightmapped(bsp, face)) {
+    if (Face_IsLightmapped(ctx, bsp, face)) {
         /* if liquid doesn't have the TEX_SPECIAL flag set, the map was qbsp'ed with
          * lit water in mind. In that case receive light from both top and bottom.
          * (lit will only be rendered in compatible engines, but degrades gracefully.)
@@ -605,8 +605,8 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
         lightsurf->lightmapscale =
             (facesup && facesup->lmscale < modelinfo->lightmapscale) ? facesup->lmscale : modelinfo->lightmapscale;
 
-        const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
-        lightsurf->curved = extended_flags.phong_angle != 0 || Q2_FacePhongValue(bsp, face);
+        const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
+        lightsurf->curved = extended_flags.phong_angle != 0 || Q2_FacePhongValue(ctx, bsp, face);
 
         // nodirt
         if (modelinfo->dirt.is_changed()) {
@@ -621,14 +621,14 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
         } else if (extended_flags.minlight) {
             lightsurf->minlight = *extended_flags.minlight;
         } else {
-            lightsurf->minlight = light_options.minlight.value();
+            lightsurf->minlight = ctx.options.minlight.value();
         }
 
         // minlightMottle
         if (modelinfo->minlightMottle.is_changed()) {
             lightsurf->minlightMottle = modelinfo->minlightMottle.value();
-        } else if (light_options.minlightMottle.is_changed()) {
-            lightsurf->minlightMottle = light_options.minlightMottle.value();
+        } else if (ctx.options.minlightMottle.is_changed()) {
+            lightsurf->minlightMottle = ctx.options.minlightMottle.value();
         } else {
             // default value depends on game
             if (bsp->loadversion->game->id == GAME_QUAKE_II) {
@@ -668,7 +668,7 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
         } else if (!qv::emptyExact(extended_flags.minlight_color)) {
             lightsurf->minlight_color = extended_flags.minlight_color;
         } else {
-            lightsurf->minlight_color = light_options.minlight_color.value();
+            lightsurf->minlight_color = ctx.options.minlight_color.value();
         }
 
         /* never receive dirtmapping on lit liquids */
@@ -708,7 +708,7 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
         lightsurf->tnormal = -qv::normalize(tex->vecs.row(1).xyz());
 
         /* Set up the surface points */
-        if (light_options.world_units_per_luxel.is_changed()) {
+        if (ctx.options.world_units_per_luxel.is_changed()) {
             if (bsp->loadversion->game->id == GAME_QUAKE_II && (Face_Texinfo(bsp, face)->flags.native & Q2_SURF_SKY)) {
                 lightsurf->extents = faceextents_t(*face, *bsp, world_units_per_luxel_t{}, 512.f);
             } else if (extended_flags.world_units_per_luxel) {
@@ -716,14 +716,14 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
                     faceextents_t(*face, *bsp, world_units_per_luxel_t{}, *extended_flags.world_units_per_luxel);
             } else {
                 lightsurf->extents =
-                    faceextents_t(*face, *bsp, world_units_per_luxel_t{}, light_options.world_units_per_luxel.value());
+                    faceextents_t(*face, *bsp, world_units_per_luxel_t{}, ctx.options.world_units_per_luxel.value());
             }
         } else {
             lightsurf->extents = faceextents_t(*face, *bsp, lightsurf->lightmapscale);
         }
         lightsurf->vanilla_extents = faceextents_t(*face, *bsp, LMSCALE_DEFAULT);
 
-        CalcPoints(modelinfo, modelinfo->offset, lightsurf.get(), bsp, face);
+        CalcPoints(ctx, modelinfo, modelinfo->offset, lightsurf.get(), bsp, face);
 
         /* Correct the plane for the model offset (must be done last,
            calculation of face extents / points needs the uncorrected plane) */
@@ -738,7 +738,7 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
         lightsurf->occlusion_stream->resize(lightsurf->samples.size());
 
         /* Setup vis data */
-        CalcPvs(bsp, lightsurf.get());
+        CalcPvs(ctx, bsp, lightsurf.get());
     }
 
     // emissiveness is handled later and allocated only if necessary
@@ -810,10 +810,10 @@ static void Lightmap_ClearAll(lightmapdict_t *lightmaps)
  * As long as we have space for the style, mark as allocated,
  * otherwise emit a warning.
  */
-static void Lightmap_Save(
-    const mbsp_t *bsp, lightmapdict_t *lightmaps, const lightsurf_t *lightsurf, lightmap_t *lightmap, const int style)
+static void Lightmap_Save(light_context_t &ctx, const mbsp_t *bsp, lightmapdict_t *lightmaps,
+    const lightsurf_t *lightsurf, lightmap_t *lightmap, const int style)
 {
-    Q_assert(Face_IsLightmapped(bsp, lightsurf->face));
+    Q_assert(Face_IsLightmapped(ctx, bsp, lightsurf->face));
 
     if (lightmap->style == INVALID_LIGHTSTYLE) {
         lightmap->style = style;
@@ -1037,15 +1037,15 @@ constexpr vec_t fraction(const vec_t &min, const vec_t &val, const vec_t &max)
  * returns scale factor for dirt/ambient occlusion
  * ============
  */
-inline vec_t Dirt_GetScaleFactor(const settings::worldspawn_keys &cfg, vec_t occlusion, const light_t *entity,
-    const vec_t entitydist, const lightsurf_t *surf)
+inline vec_t Dirt_GetScaleFactor(light_context_t &ctx, const settings::worldspawn_keys &cfg, vec_t occlusion,
+    const light_t *entity, const vec_t entitydist, const lightsurf_t *surf)
 {
     vec_t light_dirtgain = cfg.dirtgain.value();
     vec_t light_dirtscale = cfg.dirtscale.value();
     bool usedirt;
 
     /* is dirt processing disabled entirely? */
-    if (!dirt_in_use)
+    if (!ctx.dirt_in_use)
         return 1.0f;
     if (surf && surf->nodirt)
         return 1.0f;
@@ -1125,11 +1125,11 @@ inline vec_t Dirt_GetScaleFactor(const settings::worldspawn_keys &cfg, vec_t occ
  * Returns true if the given light doesn't reach lightsurf.
  * ================
  */
-inline bool CullLight(const light_t *entity, const lightsurf_t *lightsurf)
+inline bool CullLight(light_context_t &ctx, const light_t *entity, const lightsurf_t *lightsurf)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
 
-    if (light_options.visapprox.value() == visapprox_t::RAYS &&
+    if (ctx.options.visapprox.value() == visapprox_t::RAYS &&
         entity->bounds.disjoint(lightsurf->extents.bounds, 0.001) &&
         entity->light_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
         entity->shadow_channel_mask.value() == CHANNEL_MASK_DEFAULT) {
@@ -1150,12 +1150,12 @@ inline bool CullLight(const light_t *entity, const lightsurf_t *lightsurf)
     /* return true if the light level at the closest point on the
      surface bounding sphere to the light source is <= fadegate.
      need fabs to handle antilights. */
-    return fabs(GetLightValue(cfg, entity, dist)) <= light_options.gate.value();
+    return fabs(GetLightValue(cfg, entity, dist)) <= ctx.options.gate.value();
 }
 
-static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *entleaf)
+static bool VisCullEntity(const mbsp_t *bsp, const uint8_t *pvs, const mleaf_t *entleaf)
 {
-    if (pvs.empty()) {
+    if (!pvs) {
         return false;
     }
     if (entleaf == nullptr) {
@@ -1174,20 +1174,110 @@ static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, co
     return !Pvs_LeafVisible(bsp, pvs, entleaf);
 }
 
+enum class shadow_class_t
+{
+    FULLY_LIT,
+    FULLY_SHADOWED,
+    MIXED
+};
+
+// faces with fewer rays than this are just traced
+static constexpr size_t SHADOW_PREPASS_MIN_RAYS = 16;
+
+/*
+ * ================
+ * LightFace_ShadowPrepass
+ *
+ * Classifies the rays an entity light pushed to the occlusion stream before
+ * they are traced. Only MIXED faces need their rays traced; FULLY_LIT faces
+ * can use the rays as unoccluded, FULLY_SHADOWED faces can drop them.
+ *
+ * The unobstructed test is exact: no triangle can touch any of the segments.
+ * With -shadowprepass fast, the remaining faces are also classified from
+ * rays to the corner and center samples, which can miss small shadows.
+ * ================
+ */
+static shadow_class_t LightFace_ShadowPrepass(
+    light_context_t &ctx, const light_t *entity, const lightsurf_t *lightsurf, raystream_occlusion_t &rs)
+{
+    const shadowprepass_t mode = ctx.options.shadowprepass.value();
+    const size_t numrays = rs.numPushedRays();
+
+    if (mode == shadowprepass_t::NONE || numrays < SHADOW_PREPASS_MIN_RAYS) {
+        return shadow_class_t::MIXED;
+    }
+
+    aabb3d bounds;
+
+    for (size_t j = 0; j < numrays; j++) {
+        const qvec3d &point = lightsurf->samples[rs.getPushedRayPointIndex(j)].point;
+
+        bounds += point;
+        bounds += point + rs.getPushedRayDir(j) * rs._rays_maxdist[j];
+    }
+
+    if (Embree_BoundsUnobstructed(ctx, bounds)) {
+        ctx.total_prepass_lit++;
+        return shadow_class_t::FULLY_LIT;
+    }
+
+    if (mode == shadowprepass_t::FAST) {
+        thread_local raystream_occlusion_t probes(5);
+        probes.clearPushedRays();
+
+        const int w = lightsurf->width, h = lightsurf->height;
+        const int corners[] = {0, w - 1, (h - 1) * w, h * w - 1, (h / 2) * w + (w / 2)};
+
+        for (size_t j = 0; j < numrays; j++) {
+            const int i = rs.getPushedRayPointIndex(j);
+
+            if (std::find(std::begin(corners), std::end(corners), i) != std::end(corners)) {
+                probes.pushRay(j, lightsurf->samples[i].point, rs.getPushedRayDir(j), rs._rays_maxdist[j]);
+            }
+        }
+
+        if (probes.numPushedRays() >= 3) {
+            probes.tracePushedRaysOcclusion(ctx, lightsurf->modelinfo, entity->shadow_channel_mask.value());
+            ctx.total_light_rays += probes.numPushedRays();
+
+            int lit = 0, shadowed = 0;
+
+            for (size_t k = 0; k < probes.numPushedRays(); k++) {
+                if (probes.getPushedRayOccluded(k)) {
+                    shadowed++;
+                } else if (!probes._ray_hit_glass[k] && !probes.getPushedRayDynamicStyle(k)) {
+                    lit++;
+                }
+            }
+
+            if (lit == probes.numPushedRays()) {
+                ctx.total_prepass_lit++;
+                return shadow_class_t::FULLY_LIT;
+            } else if (shadowed == probes.numPushedRays()) {
+                ctx.total_prepass_shadowed++;
+                return shadow_class_t::FULLY_SHADOWED;
+            }
+        }
+    }
+
+    ctx.total_prepass_mixed++;
+    return shadow_class_t::MIXED;
+}
+
 /*
  * ================
  * LightFace_Entity
  * ================
  */
 static void LightFace_Entity(
-    const mbsp_t *bsp, const light_t *entity, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+    light_context_t &ctx, const mbsp_t *bsp, const light_t *entity, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     const modelinfo_t *modelinfo = lightsurf->modelinfo;
     const qplane3d *plane = &lightsurf->plane;
 
     /* vis cull */
-    if (light_options.visapprox.value() == visapprox_t::VIS &&
+    if (ctx.options.visapprox.value() == visapprox_t::VIS &&
         entity->light_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
         entity->shadow_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
         VisCullEntity(bsp, lightsurf->pvs, entity->leaf)) {
@@ -1208,7 +1298,7 @@ static void LightFace_Entity(
     }
 
     /* sphere cull surface and light */
-    if (CullLight(entity, lightsurf)) {
+    if (CullLight(ctx, entity, lightsurf)) {
         return;
     }
 
@@ -1240,20 +1330,32 @@ static void LightFace_Entity(
         GetLightContrib(cfg, entity, surfnorm, true, surfpoint, lightsurf->twosided, color, surfpointToLightDir,
             normalcontrib, &surfpointToLightDist);
 
-        const float occlusion = Dirt_GetScaleFactor(cfg, sample.occlusion, entity, surfpointToLightDist, lightsurf);
+        const float occlusion = Dirt_GetScaleFactor(
+            ctx, cfg, sample.occlusion, entity, surfpointToLightDist, lightsurf);
         color *= occlusion;
 
         /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+        if (fabs(LightSample_Brightness(color)) <= ctx.options.gate.value()) {
             continue;
         }
 
         rs.pushRay(i, surfpoint, surfpointToLightDir, surfpointToLightDist, &color, &normalcontrib);
     }
 
-    // don't need closest hit, just checking for occlusion between light and surface point
-    rs.tracePushedRaysOcclusion(modelinfo, entity->shadow_channel_mask.value());
-    total_light_rays += rs.numPushedRays();
+    const shadow_class_t shadow_class = LightFace_ShadowPrepass(ctx, entity, lightsurf, rs);
+
+    if (shadow_class == shadow_class_t::MIXED) {
+        // don't need closest hit, just checking for occlusion between light and surface point
+        rs.tracePushedRaysOcclusion(ctx, modelinfo, entity->shadow_channel_mask.value());
+        ctx.total_light_rays += rs.numPushedRays();
+    } else {
+        // untraced rays read as unoccluded
+        ctx.total_prepass_rays_saved += rs.numPushedRays();
+
+        if (shadow_class == shadow_class_t::FULLY_SHADOWED) {
+            rs.clearPushedRays();
+        }
+    }
 
     int cached_style = entity->style.value();
     lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
@@ -1264,7 +1366,7 @@ static void LightFace_Entity(
             continue;
         }
 
-        total_light_ray_hits++;
+        ctx.total_light_ray_hits++;
 
         int i = rs.getPushedRayPointIndex(j);
 
@@ -1295,7 +1397,7 @@ static void LightFace_Entity(
         sample.color += rs.getPushedRayColor(j);
         sample.direction += rs.getPushedRayNormalContrib(j);
 
-        Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+        Lightmap_Save(ctx, bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
     }
 }
 
@@ -1304,7 +1406,7 @@ static void LightFace_Entity(
 /**
  * Calculates light at a given point from an entity
  */
-static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, const light_t *entity,
+static void LightPoint_Entity(light_context_t &ctx, const mbsp_t *bsp, raystream_occlusion_t &rs, const light_t *entity,
     const qvec3d &surfpoint, lightgrid_samples_t &result)
 {
     rs.clearPushedRays();
@@ -1323,7 +1425,7 @@ static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, cons
 
             qvec3d normalcontrib_unused;
 
-            GetLightContrib(light_options, entity, cube_normal, true, surfpoint, false, cube_color, surfpointToLightDir,
+            GetLightContrib(ctx.options, entity, cube_normal, true, surfpoint, false, cube_color, surfpointToLightDir,
                 normalcontrib_unused, &surfpointToLightDist);
 
 #ifdef LIGHTPOINT_TAKE_MAX
@@ -1337,13 +1439,13 @@ static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, cons
     }
 
     /* Quick distance check first */
-    if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+    if (fabs(LightSample_Brightness(color)) <= ctx.options.gate.value()) {
         return;
     }
 
     rs.pushRay(0, surfpoint, surfpointToLightDir, surfpointToLightDist, &color);
 
-    rs.tracePushedRaysOcclusion(nullptr, CHANNEL_MASK_DEFAULT);
+    rs.tracePushedRaysOcclusion(ctx, nullptr, CHANNEL_MASK_DEFAULT);
 
     // add result
     const int N = rs.numPushedRays();
@@ -1356,12 +1458,69 @@ static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, cons
     }
 }
 
+/*
+ * =============
+ * SkyDome sampling
+ *
+ * Suns with a distribution (see sun_distribution_t) are integrated with
+ * -skydomesamples directions per sample point. The directions come from an
+ * s*s stratified grid over the distribution's (u, v) domain, rotated per
+ * sample point (Cranley-Patterson) by a hash of the seed, face and point so
+ * neighbouring samples don't share the same set of directions. The result
+ * is deterministic for a given seed and thread count.
+ * =============
+ */
+static uint32_t SkyDome_Hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static qvec2d SkyDome_Rotation(light_context_t &ctx, uint32_t a, uint32_t b)
+{
+    const uint32_t h =
+        SkyDome_Hash(SkyDome_Hash(SkyDome_Hash(static_cast<uint32_t>(ctx.options.skydomeseed.value())) ^ a) ^ b);
+    const uint32_t h2 = SkyDome_Hash(h);
+    return {(h >> 8) * (1.0 / 16777216.0), (h2 >> 8) * (1.0 / 16777216.0)};
+}
+
+static int SkyDome_Strata(light_context_t &ctx)
+{
+    return static_cast<int>(ceil(sqrt(static_cast<double>(ctx.options.skydomesamples.value()))));
+}
+
+// direction pointing towards the sky, for stratum `slot` of the `strata` * `strata` grid
+static qvec3d SkyDome_Direction(const sun_t &sun, int strata, int slot, const qvec2d &rotation)
+{
+    vec_t u = ((slot % strata) + 0.5) / strata + rotation[0];
+    vec_t v = ((slot / strata) + 0.5) / strata + rotation[1];
+    u -= floor(u);
+    v -= floor(v);
+
+    if (sun.distribution == sun_distribution_t::DOME) {
+        // uniform in elevation and angle, like the rings of suns SetupSkyDome makes without -skydomesamples
+        const vec_t elevation = u * (Q_PI * 0.5);
+        const vec_t angle = v * (Q_PI * 2.0);
+        return {cos(angle) * cos(elevation), sin(angle) * cos(elevation), sun.dome_sign * sin(elevation)};
+    }
+
+    // PENUMBRA: uniform in a square of +/- deviance around the central angle/elevation, like SetupSun's jitter
+    const vec_t angle = sun.penumbra_angle + (u * 2.0 - 1.0) * sun.penumbra_deviance;
+    const vec_t elevation = sun.penumbra_elevation + (v * 2.0 - 1.0) * sun.penumbra_deviance;
+    return {-cos(angle) * cos(elevation), -sin(angle) * cos(elevation), -sin(elevation)};
+}
+
 /*
  * =============
  * LightFace_Sky
  * =============
  */
-static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_Sky(
+    light_context_t &ctx, const mbsp_t *bsp, const sun_t *sun, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     const modelinfo_t *modelinfo = lightsurf->modelinfo;
@@ -1373,8 +1532,10 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
     qvec3d incoming = qv::normalize(sun->sunvec);
 
     /* Don't bother if surface facing away from sun */
-    const vec_t dp = qv::dot(incoming, plane->normal);
-    if (dp < -LIGHT_ANGLE_EPSILON && !lightsurf->curved && !lightsurf->twosided) {
+    auto facing_away = [&](const qvec3d &dir) {
+        return qv::dot(dir, plane->normal) < -LIGHT_ANGLE_EPSILON && !lightsurf->curved && !lightsurf->twosided;
+    };
+    if (sun->distribution == sun_distribution_t::NONE && facing_away(incoming)) {
         return;
     }
 
@@ -1385,18 +1546,14 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
 
     /* Check each point... */
     raystream_intersection_t &rs = *lightsurf->intersection_stream;
-    rs.clearPushedRays();
 
-    for (int i = 0; i < lightsurf->samples.size(); i++) {
+    auto push_sample = [&](int i, const qvec3d &dir, vec_t sunlight) {
         const auto &sample = lightsurf->samples[i];
 
-        if (sample.occluded)
-            continue;
-
         const qvec3d &surfpoint = sample.point;
         const qvec3d &surfnorm = sample.normal;
 
-        vec_t angle = qv::dot(incoming, surfnorm);
+        vec_t angle = qv::dot(dir, surfnorm);
         if (lightsurf->twosided) {
             if (angle < 0) {
                 angle = -angle;
@@ -1406,133 +1563,192 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
         angle = std::max(0.0, angle);
 
         angle = (1.0 - sun->anglescale) + sun->anglescale * angle;
-        vec_t value = angle * sun->sunlight;
+        vec_t value = angle * sunlight;
 
         if (sun->dirt) {
-            value *= Dirt_GetScaleFactor(cfg, sample.occlusion, NULL, 0.0, lightsurf);
+            value *= Dirt_GetScaleFactor(ctx, cfg, sample.occlusion, NULL, 0.0, lightsurf);
         }
 
         qvec3f color = sun->sunlight_color * (value / 255.0);
 
         /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            continue;
+        if (fabs(LightSample_Brightness(color)) <= ctx.options.gate.value()) {
+            return;
         }
 
-        qvec3d normalcontrib = incoming * value;
-
-        rs.pushRay(i, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
-    }
+        qvec3d normalcontrib = dir * value;
 
-    // We need to check if the first hit face is a sky face, so we need
-    // to test intersection (not occlusion)
-    rs.tracePushedRaysIntersection(modelinfo, CHANNEL_MASK_DEFAULT);
+        rs.pushRay(i, surfpoint, dir, MAX_SKY_DIST, &color, &normalcontrib);
+    };
 
     /* if sunlight is set, use a style 0 light map */
     int cached_style = sun->style;
     lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
 
-    const int N = rs.numPushedRays();
-    total_light_rays += N;
+    auto trace_and_accumulate = [&]() {
+        // We need to check if the first hit face is a sky face, so we need
+        // to test intersection (not occlusion)
+        rs.tracePushedRaysIntersection(ctx, modelinfo, CHANNEL_MASK_DEFAULT);
 
-    for (int j = 0; j < N; j++) {
-        if (rs.getPushedRayHitType(j) != hittype_t::SKY) {
-            continue;
-        }
+        const int N = rs.numPushedRays();
+        ctx.total_light_rays += N;
 
-        // check if we hit the wrong texture
-        if (sun->suntexture_value) {
-            const triinfo *face = rs.getPushedRayHitFaceInfo(j);
-            if (sun->suntexture_value != face->texture) {
+        for (int j = 0; j < N; j++) {
+            if (rs.getPushedRayHitType(ctx, j) != hittype_t::SKY) {
                 continue;
             }
-        }
 
-        const int i = rs.getPushedRayPointIndex(j);
+            // check if we hit the wrong texture
+            if (sun->suntexture_value) {
+                const triinfo *face = rs.getPushedRayHitFaceInfo(ctx, j);
+                if (sun->suntexture_value != face->texture) {
+                    continue;
+                }
+            }
+
+            const int i = rs.getPushedRayPointIndex(j);
 
-        // check if we hit a dynamic shadow caster
-        int desired_style = sun->style;
-        if (desired_style == 0) {
-            desired_style = rs.getPushedRayDynamicStyle(j);
+            // check if we hit a dynamic shadow caster
+            int desired_style = sun->style;
+            if (desired_style == 0) {
+                desired_style = rs.getPushedRayDynamicStyle(j);
+            }
+
+            // if necessary, switch which lightmap we are writing to.
+            if (desired_style != cached_style) {
+                cached_style = desired_style;
+                cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
+            }
+
+            lightsample_t &sample = cached_lightmap->samples[i];
+
+            sample.color += rs.getPushedRayColor(j);
+            sample.direction += rs.getPushedRayNormalContrib(j);
+            ctx.total_light_ray_hits++;
+
+            Lightmap_Save(ctx, bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
         }
+    };
 
-        // if necessary, switch which lightmap we are writing to.
-        if (desired_style != cached_style) {
-            cached_style = desired_style;
-            cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
+    if (sun->distribution == sun_distribution_t::NONE) {
+        rs.clearPushedRays();
+
+        for (int i = 0; i < lightsurf->samples.size(); i++) {
+            if (!lightsurf->samples[i].occluded) {
+                push_sample(i, incoming, sun->sunlight);
+            }
         }
 
-        lightsample_t &sample = cached_lightmap->samples[i];
+        trace_and_accumulate();
+        return;
+    }
 
-        sample.color += rs.getPushedRayColor(j);
-        sample.direction += rs.getPushedRayNormalContrib(j);
-        total_light_ray_hits++;
+    // the ray stream holds one ray per sample point, so trace one stratum at a time
+    const int strata = SkyDome_Strata(ctx);
+    const int num_directions = strata * strata;
+    const vec_t sunlight = sun->sunlight / num_directions;
+    const uint32_t face_num = static_cast<uint32_t>(Face_GetNum(bsp, lightsurf->face));
+
+    for (int slot = 0; slot < num_directions; slot++) {
+        rs.clearPushedRays();
+
+        for (int i = 0; i < lightsurf->samples.size(); i++) {
+            if (lightsurf->samples[i].occluded) {
+                continue;
+            }
+
+            const qvec3d dir =
+                SkyDome_Direction(*sun, strata, slot, SkyDome_Rotation(ctx, face_num, static_cast<uint32_t>(i)));
+            if (facing_away(dir)) {
+                continue;
+            }
 
-        Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+            push_sample(i, dir, sunlight);
+        }
+
+        trace_and_accumulate();
     }
 }
 
-static void LightPoint_Sky(const mbsp_t *bsp, raystream_intersection_t &rs, const sun_t *sun, const qvec3d &surfpoint,
-    lightgrid_samples_t &result)
+static void LightPoint_Sky(light_context_t &ctx, const mbsp_t *bsp, raystream_intersection_t &rs, const sun_t *sun,
+    const qvec3d &surfpoint, lightgrid_samples_t &result)
 {
     // FIXME: Normalized sun vector should be stored in the sun_t. Also clarify which way the vector points (towards or
     // away..)
     // FIXME: Much of this is copied/pasted from LightFace_Entity, should probably be merged
-    qvec3d incoming = qv::normalize(sun->sunvec);
-
-    rs.clearPushedRays();
+    auto trace_direction = [&](const qvec3d &incoming, vec_t sunlight) {
+        rs.clearPushedRays();
 
-    // only 1 ray
-    {
-        qvec3f color{};
+        // only 1 ray
+        {
+            qvec3f color{};
 
-        for (int axis = 0; axis < 3; ++axis) {
-            for (int sign = -1; sign <= +1; sign += 2) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int sign = -1; sign <= +1; sign += 2) {
 
-                qvec3f cube_color;
+                    qvec3f cube_color;
 
-                qvec3f cube_normal{};
-                cube_normal[axis] = sign;
+                    qvec3f cube_normal{};
+                    cube_normal[axis] = sign;
 
-                vec_t angle = qv::dot(incoming, cube_normal);
-                angle = std::max(0.0, angle);
-                angle = (1.0 - sun->anglescale) + sun->anglescale * angle;
+                    vec_t angle = qv::dot(incoming, cube_normal);
+                    angle = std::max(0.0, angle);
+                    angle = (1.0 - sun->anglescale) + sun->anglescale * angle;
 
-                float value = angle * sun->sunlight;
-                cube_color = sun->sunlight_color * (value / 255.0);
+                    float value = angle * sunlight;
+                    cube_color = sun->sunlight_color * (value / 255.0);
 
 #ifdef LIGHTPOINT_TAKE_MAX
-                if (qv::length2(cube_color) > qv::length2(color)) {
-                    color = cube_color;
-                }
+                    if (qv::length2(cube_color) > qv::length2(color)) {
+                        color = cube_color;
+                    }
 #else
-                color += cube_color / 6;
+                    color += cube_color / 6;
 #endif
+                }
             }
-        }
 
-        /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            return;
+            /* Quick distance check first */
+            if (fabs(LightSample_Brightness(color)) <= ctx.options.gate.value()) {
+                return;
+            }
+
+            qvec3d normalcontrib{}; // unused
+
+            rs.pushRay(0, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
         }
 
-        qvec3d normalcontrib{}; // unused
+        // We need to check if the first hit face is a sky face, so we need
+        // to test intersection (not occlusion)
+        rs.tracePushedRaysIntersection(ctx, nullptr, CHANNEL_MASK_DEFAULT);
+
+        // add result
+        const int N = rs.numPushedRays();
+        for (int j = 0; j < N; j++) {
+            if (rs.getPushedRayHitType(ctx, j) != hittype_t::SKY) {
+                continue;
+            }
+
+            result.add(rs.getPushedRayColor(j), sun->style);
+        }
+    };
 
-        rs.pushRay(0, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
+    if (sun->distribution == sun_distribution_t::NONE) {
+        trace_direction(qv::normalize(sun->sunvec), sun->sunlight);
+        return;
     }
 
-    // We need to check if the first hit face is a sky face, so we need
-    // to test intersection (not occlusion)
-    rs.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
+    // rotate the strata by a hash of the grid point, the same way LightFace_Sky does per sample
+    const qvec3i key{static_cast<int>(floor(surfpoint[0])), static_cast<int>(floor(surfpoint[1])),
+        static_cast<int>(floor(surfpoint[2]))};
+    const qvec2d rotation = SkyDome_Rotation(ctx,
+        SkyDome_Hash(static_cast<uint32_t>(key[0])) ^ static_cast<uint32_t>(key[1]), static_cast<uint32_t>(key[2]));
 
-    // add result
-    const int N = rs.numPushedRays();
-    for (int j = 0; j < N; j++) {
-        if (rs.getPushedRayHitType(j) != hittype_t::SKY) {
-            continue;
-        }
+    const int strata = SkyDome_Strata(ctx);
+    const int num_directions = strata * strata;
 
-        result.add(rs.getPushedRayColor(j), sun->style);
+    for (int slot = 0; slot < num_directions; slot++) {
+        trace_direction(SkyDome_Direction(*sun, strata, slot, rotation), sun->sunlight / num_directions);
     }
 }
 
@@ -1639,12 +1855,12 @@ static float Mottle(const qvec3d &position)
  * LightFace_Min
  * ============
  */
-static void LightFace_Min(const mbsp_t *bsp, const mface_t *face, const qvec3d &color, vec_t light,
-    lightsurf_t *lightsurf, lightmapdict_t *lightmaps, int32_t style)
+static void LightFace_Min(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face, const qvec3d &color,
+    vec_t light, lightsurf_t *lightsurf, lightmapdict_t *lightmaps, int32_t style)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
 
-    const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+    const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
     if (extended_flags.no_minlight) {
         return; /* this face is excluded from minlight */
     }
@@ -1659,7 +1875,7 @@ static void LightFace_Min(const mbsp_t *bsp, const mface_t *face, const qvec3d &
 
         vec_t value = light;
         if (cfg.minlight_dirt.value()) {
-            value *= Dirt_GetScaleFactor(cfg, surf_sample.occlusion, NULL, 0.0, lightsurf);
+            value *= Dirt_GetScaleFactor(ctx, cfg, surf_sample.occlusion, NULL, 0.0, lightsurf);
         }
         if (cfg.addminlight.value()) {
             sample.color += color * (value / 255.0);
@@ -1674,17 +1890,17 @@ static void LightFace_Min(const mbsp_t *bsp, const mface_t *face, const qvec3d &
     }
 
     if (hit) {
-        Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, style);
+        Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, style);
     }
 }
 
 static void LightFace_LocalMin(
-    const mbsp_t *bsp, const mface_t *face, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+    light_context_t &ctx, const mbsp_t *bsp, const mface_t *face, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     const modelinfo_t *modelinfo = lightsurf->modelinfo;
 
-    const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+    const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
     if (extended_flags.no_minlight) {
         return; /* this face is excluded from minlight */
     }
@@ -1694,7 +1910,7 @@ static void LightFace_LocalMin(
         return;
 
     /* Cast rays for local minlight entities */
-    for (const auto &entity : GetLights()) {
+    for (const auto &entity : ctx.all_lights) {
         if (entity->getFormula() != LF_LOCALMIN) {
             continue;
         }
@@ -1702,7 +1918,7 @@ static void LightFace_LocalMin(
             continue;
         }
 
-        if (CullLight(entity.get(), lightsurf)) {
+        if (CullLight(ctx, entity.get(), lightsurf)) {
             continue;
         }
 
@@ -1729,8 +1945,8 @@ static void LightFace_LocalMin(
         }
 
         // local minlight just needs occlusion, not closest hit
-        rs.tracePushedRaysOcclusion(modelinfo, CHANNEL_MASK_DEFAULT);
-        total_light_rays += rs.numPushedRays();
+        rs.tracePushedRaysOcclusion(ctx, modelinfo, CHANNEL_MASK_DEFAULT);
+        ctx.total_light_rays += rs.numPushedRays();
 
         const int N = rs.numPushedRays();
         for (int j = 0; j < N; j++) {
@@ -1743,7 +1959,7 @@ static void LightFace_LocalMin(
             lightsample_t &sample = lightmap->samples[i];
 
             value *= Dirt_GetScaleFactor(
-                cfg, lightsurf->samples[i].occlusion, entity.get(), 0.0 /* TODO: pass distance */, lightsurf);
+                ctx, cfg, lightsurf->samples[i].occlusion, entity.get(), 0.0 /* TODO: pass distance */, lightsurf);
             if (cfg.addminlight.value()) {
                 sample.color += entity->color.value() * (value / 255.0);
             } else {
@@ -1751,16 +1967,17 @@ static void LightFace_LocalMin(
             }
 
             hit = true;
-            total_light_ray_hits++;
+            ctx.total_light_ray_hits++;
         }
 
         if (hit) {
-            Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, entity->style.value());
+            Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, entity->style.value());
         }
     }
 }
 
-static void LightFace_AutoMin(const mbsp_t *bsp, const mface_t *face, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_AutoMin(
+    light_context_t &ctx, const mbsp_t *bsp, const mface_t *face, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     const modelinfo_t *modelinfo = lightsurf->modelinfo;
@@ -1792,7 +2009,7 @@ static void LightFace_AutoMin(const mbsp_t *bsp, const mface_t *face, lightsurf_
 
     qvec3f center = (modelinfo->model->mins + modelinfo->model->maxs) / 2;
     if (!modelinfo->autominlight_target.value().empty()) {
-        for (auto &entity : GetEntdicts()) {
+        for (auto &entity : ctx.entdicts) {
             if (entity.get("targetname") == modelinfo->autominlight_target.value()) {
                 qvec3d point{};
                 entity.get_vector("origin", point);
@@ -1802,7 +2019,7 @@ static void LightFace_AutoMin(const mbsp_t *bsp, const mface_t *face, lightsurf_
         }
     }
 
-    auto [grid_samples, occluded] = FixPointAndCalcLightgrid(bsp, center);
+    auto [grid_samples, occluded] = FixPointAndCalcLightgrid(ctx, bsp, center);
 
     if (!occluded) {
         // process each of the captured styles
@@ -1820,7 +2037,7 @@ static void LightFace_AutoMin(const mbsp_t *bsp, const mface_t *face, lightsurf_
                 }
             }
 
-            Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, grid_sample.style);
+            Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, grid_sample.style);
         }
 
         // clear occluded state, since we filled in all occluded samples with a color
@@ -1835,7 +2052,8 @@ static void LightFace_AutoMin(const mbsp_t *bsp, const mface_t *face, lightsurf_
  * LightFace_DirtDebug
  * =============
  */
-static void LightFace_DirtDebug(const mbsp_t *bsp, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_DirtDebug(
+    light_context_t &ctx, const mbsp_t *bsp, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     /* use a style 0 light map */
@@ -1844,11 +2062,12 @@ static void LightFace_DirtDebug(const mbsp_t *bsp, const lightsurf_t *lightsurf,
     /* Overwrite each point with the dirt value for that sample... */
     for (int i = 0; i < lightsurf->samples.size(); i++) {
         lightsample_t &sample = lightmap->samples[i];
-        const float light = 255 * Dirt_GetScaleFactor(cfg, lightsurf->samples[i].occlusion, nullptr, 0.0, lightsurf);
+        const float light =
+            255 * Dirt_GetScaleFactor(ctx, cfg, lightsurf->samples[i].occlusion, nullptr, 0.0, lightsurf);
         sample.color = {light};
     }
 
-    Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, 0);
+    Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, 0);
 }
 
 /*
@@ -1856,7 +2075,8 @@ static void LightFace_DirtDebug(const mbsp_t *bsp, const lightsurf_t *lightsurf,
  * LightFace_PhongDebug
  * =============
  */
-static void LightFace_PhongDebug(const mbsp_t *bsp, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_PhongDebug(
+    light_context_t &ctx, const mbsp_t *bsp, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     /* use a style 0 light map */
     lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, 0, lightsurf);
@@ -1872,10 +2092,11 @@ static void LightFace_PhongDebug(const mbsp_t *bsp, const lightsurf_t *lightsurf
         }
     }
 
-    Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, 0);
+    Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, 0);
 }
 
-static void LightFace_DebugMottle(const mbsp_t *bsp, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_DebugMottle(
+    light_context_t &ctx, const mbsp_t *bsp, const lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     /* use a style 0 light map */
     lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, 0, lightsurf);
@@ -1889,7 +2110,7 @@ static void LightFace_DebugMottle(const mbsp_t *bsp, const lightsurf_t *lightsur
         sample.color = qvec3f(minlight + Mottle(lightsurf->samples[i].point));
     }
 
-    Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, 0);
+    Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, 0);
 }
 
 // mxd. Surface light falloff. Returns color in [0,255]
@@ -1905,12 +2126,10 @@ inline qvec3f SurfaceLight_ColorAtDist(const settings::worldspawn_keys &cfg, con
 }
 
 // dir: vpl -> sample point direction
-// mxd. returns color in [0,255]
-inline qvec3f GetSurfaceLighting(const settings::worldspawn_keys &cfg, const surfacelight_t *vpl, const qvec3f &dir,
-    const float dist, const qvec3f &normal, bool use_normal, const vec_t &standard_scale, const vec_t &sky_scale,
-    const float &hotspot_clamp)
+// returns the cosine weighting between the vpl and sample point, 0 if either is behind the other
+inline float SurfaceLight_DotProductFactor(
+    const surfacelight_t *vpl, const qvec3f &dir, const qvec3f &normal, bool use_normal)
 {
-    qvec3f result;
     float dotProductFactor = 1.0f;
 
     float dp1 = qv::dot(vpl->surfnormal, dir);
@@ -1919,9 +2138,9 @@ inline qvec3f GetSurfaceLighting(const settings::worldspawn_keys &cfg, const sur
 
     if (!vpl->omnidirectional) {
         if (dp1 < -LIGHT_ANGLE_EPSILON)
-            return {0}; // sample point behind vpl
+            return 0; // sample point behind vpl
         if (dp2 < -LIGHT_ANGLE_EPSILON)
-            return {0}; // vpl behind sample face
+            return 0; // vpl behind sample face
 
         // Rescale a bit to brighten the faces nearly-perpendicular to the surface light plane...
         if (vpl->rescale) {
@@ -1935,7 +2154,20 @@ inline qvec3f GetSurfaceLighting(const settings::worldspawn_keys &cfg, const sur
         dotProductFactor = dp2;
     }
 
-    dotProductFactor = std::max(0.0f, dotProductFactor);
+    return std::max(0.0f, dotProductFactor);
+}
+
+// dir: vpl -> sample point direction
+// mxd. returns color in [0,255]
+inline qvec3f GetSurfaceLighting(light_context_t &ctx, const settings::worldspawn_keys &cfg, const surfacelight_t *vpl,
+    const qvec3f &dir, const float dist, const qvec3f &normal, bool use_normal, const vec_t &standard_scale,
+    const vec_t &sky_scale, const float &hotspot_clamp)
+{
+    qvec3f result;
+    const float dotProductFactor = SurfaceLight_DotProductFactor(vpl, dir, normal, use_normal);
+
+    if (dotProductFactor == 0.0f)
+        return {0};
 
     // Get light contribution
     result = SurfaceLight_ColorAtDist(
@@ -1948,11 +2180,13 @@ inline qvec3f GetSurfaceLighting(const settings::worldspawn_keys &cfg, const sur
     return resultscaled;
 }
 
+// assume_bright: cull as if the vpl were lit at full brightness, for bounce emitters that are
+// dark now but may light up in later bounces
 static bool // mxd
-SurfaceLight_SphereCull(
-    const surfacelight_t *vpl, const lightsurf_t *lightsurf, const vec_t &bouncelight_gate, const float &hotspot_clamp)
+SurfaceLight_SphereCull(light_context_t &ctx, const surfacelight_t *vpl, const lightsurf_t *lightsurf,
+    const vec_t &bouncelight_gate, const float &hotspot_clamp, bool assume_bright = false)
 {
-    if (light_options.visapprox.value() == visapprox_t::RAYS &&
+    if (ctx.options.visapprox.value() == visapprox_t::RAYS &&
         vpl->bounds.disjoint(lightsurf->extents.bounds, 0.001)) {
         return true;
     }
@@ -1964,37 +2198,49 @@ SurfaceLight_SphereCull(
     // Get light contribution
     const qvec3f color =
         SurfaceLight_ColorAtDist(cfg, vpl->omnidirectional ? cfg.surflightskyscale.value() : cfg.surflightscale.value(),
-            vpl->totalintensity, vpl->color, dist, hotspot_clamp);
+            assume_bright ? vpl->point_area * vpl->points.size() * 255.0f : vpl->totalintensity,
+            assume_bright ? qvec3d{1.0} : vpl->color, dist, hotspot_clamp);
 
     return qv::gate(color, (float)bouncelight_gate);
 }
 
 static void // mxd
-LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps,
+LightFace_SurfaceLight(light_context_t &ctx, const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps,
     const std::vector<surfacelight_t> &surface_lights, const vec_t &standard_scale, const vec_t &sky_scale,
-    const float &hotspot_clamp)
+    const float &hotspot_clamp, bool record_transfer = false)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     const float surflight_gate = 0.01f;
 
+    // for "_bounces": per pushed ray, the light it carries per unit of emitted color, and whether
+    // it's bright enough to be added now (dark emitters are traced too, they may light up later)
+    std::vector<float> ray_transfer;
+    std::vector<bool> ray_lit;
+
     // check lighting channels (currently surface lights are always on CHANNEL_MASK_DEFAULT)
     if (!(lightsurf->object_channel_mask & CHANNEL_MASK_DEFAULT)) {
         return;
     }
 
     for (const surfacelight_t &vpl : surface_lights) {
-        if (SurfaceLight_SphereCull(&vpl, lightsurf, surflight_gate, hotspot_clamp))
+        const bool record = record_transfer && vpl.facenum != -1 && vpl.style == 0;
+
+        if (SurfaceLight_SphereCull(ctx, &vpl, lightsurf, surflight_gate, hotspot_clamp, record))
             continue;
 
             raystream_occlusion_t &rs = *lightsurf->occlusion_stream;
 
+            float transfer_sum = 0;
+
             for (int c = 0; c < vpl.points.size(); c++) {
-                if (light_options.visapprox.value() == visapprox_t::VIS &&
+                if (ctx.options.visapprox.value() == visapprox_t::VIS &&
                     VisCullEntity(bsp, lightsurf->pvs, vpl.leaves[c])) {
                     continue;
                 }
 
                 rs.clearPushedRays();
+                ray_transfer.clear();
+                ray_lit.clear();
 
                 for (int i = 0; i < lightsurf->samples.size(); i++) {
                     const auto &sample = lightsurf->samples[i];
@@ -2018,17 +2264,29 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
                     }
 
                 const qvec3f indirect = GetSurfaceLighting(
-                    cfg, &vpl, dir, dist, lightsurf_normal, use_normal, standard_scale, sky_scale, hotspot_clamp);
-                    if (!qv::gate(indirect, surflight_gate)) { // Each point contributes very little to the final result
+                    ctx, cfg, &vpl, dir, dist, lightsurf_normal, use_normal, standard_scale, sky_scale, hotspot_clamp);
+                const bool lit =
+                    !qv::gate(indirect, surflight_gate); // Each point contributes very little to the final result
+
+                if (record) {
+                    const float d = std::max(dist, hotspot_clamp);
+                    const float transfer = vpl.point_area * standard_scale / (d * d) *
+                                           SurfaceLight_DotProductFactor(&vpl, dir, lightsurf_normal, use_normal);
+                    if (lit || transfer > 0) {
                         rs.pushRay(i, pos, dir, dist, &indirect);
+                        ray_transfer.push_back(transfer);
+                        ray_lit.push_back(lit);
                     }
+                } else if (lit) {
+                    rs.pushRay(i, pos, dir, dist, &indirect);
+                }
                 }
 
                 if (!rs.numPushedRays())
                     continue;
 
-                total_surflight_rays += rs.numPushedRays();
-                rs.tracePushedRaysOcclusion(lightsurf->modelinfo, CHANNEL_MASK_DEFAULT);
+                ctx.total_surflight_rays += rs.numPushedRays();
+                rs.tracePushedRaysOcclusion(ctx, lightsurf->modelinfo, CHANNEL_MASK_DEFAULT);
 
             const int lightmapstyle = vpl.style;
                 lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, lightmapstyle, lightsurf);
@@ -2046,34 +2304,53 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
 
                     // Use dirt scaling on the surface lighting.
                     const vec_t dirtscale =
-                        Dirt_GetScaleFactor(cfg, lightsurf->samples[i].occlusion, nullptr, 0.0, lightsurf);
+                        Dirt_GetScaleFactor(ctx, cfg, lightsurf->samples[i].occlusion, nullptr, 0.0, lightsurf);
                     indirect *= dirtscale;
 
+                    if (record) {
+                        const float transfer = ray_transfer[j] * dirtscale;
+                        transfer_sum += transfer;
+                        lightsurf->bounce_shape[i] += transfer;
+
+                        if (!ray_lit[j])
+                            continue;
+                    }
+
                     lightsample_t &sample = lightmap->samples[i];
                     sample.color += indirect;
 
                     hit = true;
-                    ++total_surflight_ray_hits;
+                    ++ctx.total_surflight_ray_hits;
                 }
 
                 // If surface light contributed anything, save.
                 if (hit)
-                    Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, lightmapstyle);
+                    Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, lightmapstyle);
+            }
+
+            // bounce lights are sorted by face, so a face's lights are next to each other
+            if (record && transfer_sum > 0) {
+                const float transfer = transfer_sum / lightsurf->samples.size();
+                if (!lightsurf->bounce_transfer.empty() && lightsurf->bounce_transfer.back().first == vpl.facenum) {
+                    lightsurf->bounce_transfer.back().second += transfer;
+                } else {
+                    lightsurf->bounce_transfer.emplace_back(vpl.facenum, transfer);
+                }
             }
         }
     }
 
 static void // mxd
-LightPoint_SurfaceLight(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, raystream_occlusion_t &rs,
+LightPoint_SurfaceLight(light_context_t &ctx, const mbsp_t *bsp, const uint8_t *pvs, raystream_occlusion_t &rs,
     const std::vector<surfacelight_t> &surface_lights, const vec_t &standard_scale, const vec_t &sky_scale,
     const float &hotspot_clamp, const qvec3d &surfpoint, lightgrid_samples_t &result)
 {
-    const settings::worldspawn_keys &cfg = light_options;
+    const settings::worldspawn_keys &cfg = ctx.options;
     const float surflight_gate = 0.01f;
 
     for (const surfacelight_t &vpl : surface_lights) {
         for (int c = 0; c < vpl.points.size(); c++) {
-            if (light_options.visapprox.value() == visapprox_t::VIS && pvs && VisCullEntity(bsp, *pvs, vpl.leaves[c])) {
+            if (ctx.options.visapprox.value() == visapprox_t::VIS && VisCullEntity(bsp, pvs, vpl.leaves[c])) {
                 continue;
             }
 
@@ -2101,7 +2378,7 @@ LightPoint_SurfaceLight(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, rays
                         cube_normal[axis] = sign;
 
                         cube_color = GetSurfaceLighting(
-                            cfg, &vpl, dir, dist, cube_normal, true, standard_scale, sky_scale, hotspot_clamp);
+                            ctx, cfg, &vpl, dir, dist, cube_normal, true, standard_scale, sky_scale, hotspot_clamp);
 
 #ifdef LIGHTPOINT_TAKE_MAX
                         if (qv::length2(cube_color) > qv::length2(indirect)) {
@@ -2121,7 +2398,7 @@ LightPoint_SurfaceLight(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, rays
                 if (!rs.numPushedRays())
                     continue;
 
-                rs.tracePushedRaysOcclusion(nullptr, CHANNEL_MASK_DEFAULT);
+                rs.tracePushedRaysOcclusion(ctx, nullptr, CHANNEL_MASK_DEFAULT);
 
                 const int numrays = rs.numPushedRays();
                 for (int j = 0; j < numrays; j++) {
@@ -2138,9 +2415,10 @@ LightPoint_SurfaceLight(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, rays
         }
     }
 
-static void LightFace_OccludedDebug(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_OccludedDebug(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
-    Q_assert(light_options.debugmode == debugmodes::debugoccluded);
+    Q_assert(ctx.options.debugmode == debugmodes::debugoccluded);
 
     /* use a style 0 light map */
     lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, 0, lightsurf);
@@ -2158,12 +2436,13 @@ static void LightFace_OccludedDebug(const mbsp_t *bsp, lightsurf_t *lightsurf, l
         surf_sample.occluded = false;
     }
 
-    Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, 0);
+    Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, 0);
 }
 
-static void LightFace_DebugNeighbours(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_DebugNeighbours(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
-    Q_assert(light_options.debugmode == debugmodes::debugneighbours);
+    Q_assert(ctx.options.debugmode == debugmodes::debugneighbours);
 
     /* use a style 0 light map */
     lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, 0, lightsurf);
@@ -2176,7 +2455,7 @@ static void LightFace_DebugNeighbours(const mbsp_t *bsp, lightsurf_t *lightsurf,
 
     bool has_sample_on_dumpface = false;
     for (int i = 0; i < lightsurf->samples.size(); i++) {
-        if (lightsurf->samples[i].realfacenum == dump_facenum) {
+        if (lightsurf->samples[i].realfacenum == ctx.dump_facenum) {
             has_sample_on_dumpface = true;
             break;
         }
@@ -2187,7 +2466,7 @@ static void LightFace_DebugNeighbours(const mbsp_t *bsp, lightsurf_t *lightsurf,
         lightsample_t &sample = lightmap->samples[i];
         const int &sample_face = lightsurf->samples[i].realfacenum;
 
-        if (sample_face == dump_facenum) {
+        if (sample_face == ctx.dump_facenum) {
             /* Red - the sample is on the selected face */
             sample.color = {255, 0, 0};
         } else if (has_sample_on_dumpface) {
@@ -2200,18 +2479,11 @@ static void LightFace_DebugNeighbours(const mbsp_t *bsp, lightsurf_t *lightsurf,
         lightsurf->samples[i].occluded = false;
     }
 
-    Lightmap_Save(bsp, lightmaps, lightsurf, lightmap, 0);
+    Lightmap_Save(ctx, bsp, lightmaps, lightsurf, lightmap, 0);
 }
 
 /* Dirtmapping borrowed from q3map2, originally by RaP7oR */
 
-constexpr size_t DIRT_NUM_ANGLE_STEPS = 16;
-constexpr size_t DIRT_NUM_ELEVATION_STEPS = 3;
-constexpr size_t DIRT_NUM_VECTORS = (DIRT_NUM_ANGLE_STEPS * DIRT_NUM_ELEVATION_STEPS);
-
-static qvec3d dirtVectors[DIRT_NUM_VECTORS];
-int numDirtVectors = 0;
-
 /*
  * ============
  * SetupDirt
@@ -2219,32 +2491,32 @@ int numDirtVectors = 0;
  * sets up dirtmap (ambient occlusion)
  * ============
  */
-void SetupDirt(settings::worldspawn_keys &cfg)
+void SetupDirt(light_context_t &ctx, settings::worldspawn_keys &cfg)
 {
     // check if needed
 
     if (!cfg.dirt.value() && cfg.dirt.get_source() == settings::source::COMMANDLINE) {
         // HACK: "-dirt 0" disables all dirtmapping even if we would otherwise use it.
-        dirt_in_use = false;
+        ctx.dirt_in_use = false;
         return;
     }
 
     if (cfg.dirt.value() || cfg.minlight_dirt.value() || cfg.sunlight_dirt.boolValue() ||
         cfg.sunlight2_dirt.boolValue()) {
-        dirt_in_use = true;
+        ctx.dirt_in_use = true;
     }
 
-    if (!dirt_in_use) {
+    if (!ctx.dirt_in_use) {
         // check entities, maybe only a few lights use it
-        for (const auto &light : GetLights()) {
+        for (const auto &light : ctx.all_lights) {
             if (light->dirt.boolValue()) {
-                dirt_in_use = true;
+                ctx.dirt_in_use = true;
                 break;
             }
         }
     }
 
-    if (!dirt_in_use) {
+    if (!ctx.dirt_in_use) {
         // dirtmapping is not used by this map.
         return;
     }
@@ -2258,20 +2530,20 @@ void SetupDirt(settings::worldspawn_keys &cfg)
 
     /* iterate angle */
     float angle = 0.0f;
-    numDirtVectors = 0;
+    ctx.numDirtVectors = 0;
     for (int i = 0; i < DIRT_NUM_ANGLE_STEPS; i++, angle += angleStep) {
         /* iterate elevation */
         float elevation = elevationStep * 0.5f;
         for (int j = 0; j < DIRT_NUM_ELEVATION_STEPS; j++, elevation += elevationStep) {
-            dirtVectors[numDirtVectors][0] = sin(elevation) * cos(angle);
-            dirtVectors[numDirtVectors][1] = sin(elevation) * sin(angle);
-            dirtVectors[numDirtVectors][2] = cos(elevation);
-            numDirtVectors++;
+            ctx.dirtVectors[ctx.numDirtVectors][0] = sin(elevation) * cos(angle);
+            ctx.dirtVectors[ctx.numDirtVectors][1] = sin(elevation) * sin(angle);
+            ctx.dirtVectors[ctx.numDirtVectors][2] = cos(elevation);
+            ctx.numDirtVectors++;
         }
     }
 
     /* emit some statistics */
-    logging::print("{:9} dirtmap vectors\n", numDirtVectors);
+    logging::print("{:9} dirtmap vectors\n", ctx.numDirtVectors);
 }
 
 // from q3map2
@@ -2282,9 +2554,9 @@ inline qvec3d TransformToTangentSpace(
 }
 
 // from q3map2
-inline qvec3d GetDirtVector(const settings::worldspawn_keys &cfg, int i)
+inline qvec3d GetDirtVector(light_context_t &ctx, const settings::worldspawn_keys &cfg, int i)
 {
-    Q_assert(i < numDirtVectors);
+    Q_assert(i < ctx.numDirtVectors);
 
     if (cfg.dirtmode.value() == 1) {
         /* get random vector */
@@ -2293,19 +2565,22 @@ inline qvec3d GetDirtVector(const settings::worldspawn_keys &cfg, int i)
         return {cos(angle) * sin(elevation), sin(angle) * sin(elevation), cos(elevation)};
     }
 
-    return dirtVectors[i];
+    return ctx.dirtVectors[i];
 }
 
 /*
  * ============
- * LightFace_CalculateDirt
+ * LightFace_TraceDirt
+ *
+ * traces dirt rays from the samples with traced[i] set (or all of them if
+ * traced is empty), and stores their occlusion
  * ============
  */
-static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
+static void LightFace_TraceDirt(light_context_t &ctx, lightsurf_t *lightsurf, const std::vector<uint8_t> &traced)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
 
-    Q_assert(dirt_in_use);
+    auto is_traced = [&traced](int i) { return traced.empty() || traced[i]; };
 
     // batch implementation:
 
@@ -2316,18 +2591,23 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
 
     // init
     for (int i = 0; i < lightsurf->samples.size(); i++) {
-        lightsurf->samples[i].occlusion = 0;
+        if (is_traced(i)) {
+            lightsurf->samples[i].occlusion = 0;
+        }
     }
 
     // this stuff is just per-point
     for (int i = 0; i < lightsurf->samples.size(); i++) {
+        if (!is_traced(i))
+            continue;
+
         const auto [tangent, bitangent] = qv::MakeTangentAndBitangentUnnormalized(lightsurf->samples[i].normal);
 
         myUps[i] = qv::normalize(tangent);
         myRts[i] = qv::normalize(bitangent);
     }
 
-    for (int j = 0; j < numDirtVectors; j++) {
+    for (int j = 0; j < ctx.numDirtVectors; j++) {
         raystream_intersection_t &rs = *lightsurf->intersection_stream;
         rs.clearPushedRays();
 
@@ -2336,10 +2616,10 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
         for (int i = 0; i < lightsurf->samples.size(); i++) {
             const auto &sample = lightsurf->samples[i];
 
-            if (sample.occluded)
+            if (sample.occluded || !is_traced(i))
                 continue;
 
-            qvec3d dirtvec = GetDirtVector(cfg, j);
+            qvec3d dirtvec = GetDirtVector(ctx, cfg, j);
             qvec3d dir = TransformToTangentSpace(sample.normal, myUps[i], myRts[i], dirtvec);
 
             rs.pushRay(i, sample.point, dir, cfg.dirtdepth.value());
@@ -2349,12 +2629,12 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
         //
         // use the model's own channel mask as the shadow mask, e.g. so a model in channel 2's AO rays will only hit
         // other things in channel 2
-        rs.tracePushedRaysIntersection(lightsurf->modelinfo, lightsurf->object_channel_mask);
+        rs.tracePushedRaysIntersection(ctx, lightsurf->modelinfo, lightsurf->object_channel_mask);
 
         // accumulate hitdists
         for (int k = 0; k < rs.numPushedRays(); k++) {
             const int i = rs.getPushedRayPointIndex(k);
-            if (rs.getPushedRayHitType(k) == hittype_t::SOLID) {
+            if (rs.getPushedRayHitType(ctx, k) == hittype_t::SOLID) {
                 vec_t dist = rs.getPushedRayHitDist(k);
                 lightsurf->samples[i].occlusion += std::min(cfg.dirtdepth.value(), dist);
             } else {
@@ -2365,68 +2645,238 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
 
     // process the results.
     for (int i = 0; i < lightsurf->samples.size(); i++) {
-        vec_t avgHitdist = lightsurf->samples[i].occlusion / (float)numDirtVectors;
+        if (!is_traced(i))
+            continue;
+
+        vec_t avgHitdist = lightsurf->samples[i].occlusion / (float)ctx.numDirtVectors;
         lightsurf->samples[i].occlusion = 1.0 - (avgHitdist / cfg.dirtdepth.value());
     }
 }
 
-// clamps negative values. applies gamma and rangescale. clamps values over 255
-// N.B. we want to do this before smoothing / downscaling, so huge values don't mess up the averaging.
-inline void LightFace_ScaleAndClamp(lightsurf_t *lightsurf)
+// a grid sample only contributes to an interpolated sample if their normals are
+// within this cosine of each other...
+constexpr vec_t DIRT_STEP_NORMAL_EPSILON = 0.9;
+// ...and it's no further than this from the interpolated sample's plane
+constexpr vec_t DIRT_STEP_PLANE_EPSILON = 1.0;
+// if the contributing grid samples' occlusion differs by more than this, there's
+// a dirt edge between them and the sample is traced instead
+constexpr float DIRT_STEP_EDGE_EPSILON = 0.1f;
+
+/*
+ * ============
+ * LightFace_InterpolateDirt
+ *
+ * fills in the occlusion of the samples between the ones traced on a grid of
+ * every `step` samples, from the surrounding grid samples. grid samples that
+ * are occluded, or face a different way, or aren't on the sample's plane
+ * (e.g. across a phong crease) don't contribute; samples with no usable grid
+ * samples, or with a dirt edge between them, are flagged in `traced` to be
+ * traced directly.
+ * ============
+ */
+static void LightFace_InterpolateDirt(lightsurf_t *lightsurf, int step, std::vector<uint8_t> &traced)
 {
-    const settings::worldspawn_keys &cfg = *lightsurf->cfg;
+    const int w = lightsurf->width, h = lightsurf->height;
 
-    for (lightmap_t &lightmap : lightsurf->lightmapsByStyle) {
-        for (int i = 0; i < lightsurf->samples.size(); i++) {
-            qvec3f &color = lightmap.samples[i].color;
+    for (int y = 0; y < h; y++) {
+        const int y0 = (y / step) * step;
+        const int y1 = std::min(y0 + step, h - 1);
+        const vec_t fy = (y1 == y0) ? 0.0 : static_cast<vec_t>(y - y0) / (y1 - y0);
 
-            /* Fix any negative values */
-            color = qv::max(color, {0});
+        for (int x = 0; x < w; x++) {
+            const int i = y * w + x;
 
-            // before any other scaling, apply maxlight
-            if (lightsurf->maxlight || cfg.maxlight.value()) {
-                vec_t maxcolor = qv::max(color);
-                // FIXME: for colored lighting, this doesn't seem to generate the right values...
-                vec_t maxval = (lightsurf->maxlight ? lightsurf->maxlight : cfg.maxlight.value()) * 2.0;
+            if (traced[i])
+                continue;
 
-                if (maxcolor > maxval) {
-                    color *= (maxval / maxcolor);
-                }
-            }
+            const int x0 = (x / step) * step;
+            const int x1 = std::min(x0 + step, w - 1);
+            const vec_t fx = (x1 == x0) ? 0.0 : static_cast<vec_t>(x - x0) / (x1 - x0);
 
-            // color scaling
-            if (lightsurf->lightcolorscale != 1.0) {
-                qvec3f grayscale{qv::max(color)};
-                color = mix(grayscale, color, lightsurf->lightcolorscale);
-            }
+            const auto &sample = lightsurf->samples[i];
 
-            /* Scale and handle gamma adjustment */
-            color *= cfg.rangescale.value();
+            const std::array<std::pair<int, vec_t>, 4> corners{{{y0 * w + x0, (1.0 - fx) * (1.0 - fy)},
+                {y0 * w + x1, fx * (1.0 - fy)}, {y1 * w + x0, (1.0 - fx) * fy}, {y1 * w + x1, fx * fy}}};
 
-            if (cfg.lightmapgamma.value() != 1.0) {
-                for (auto &c : color) {
-                    c = pow(c / 255.0f, 1.0 / cfg.lightmapgamma.value()) * 255.0f;
-                }
-            }
+            vec_t occlusion = 0, total_weight = 0;
+            float min_occlusion = 1.0f, max_occlusion = 0.0f;
 
-            // clamp
-            // FIXME: should this be a brightness clamp?
-            vec_t maxcolor = qv::max(color);
+            for (auto &[corner, bilinear_weight] : corners) {
+                const auto &grid_sample = lightsurf->samples[corner];
 
-            if (maxcolor > 255.0) {
-                color *= (255.0 / maxcolor);
-            }
-        }
-    }
-}
+                if (bilinear_weight <= 0 || grid_sample.occluded)
+                    continue;
 
-/**
+                const vec_t normal_dot = qv::dot(sample.normal, grid_sample.normal);
+                if (normal_dot < DIRT_STEP_NORMAL_EPSILON)
+                    continue;
+
+                if (fabs(qv::dot(sample.normal, grid_sample.point - sample.point)) > DIRT_STEP_PLANE_EPSILON)
+                    continue;
+
+                const vec_t weight = bilinear_weight * normal_dot;
+                occlusion += grid_sample.occlusion * weight;
+                total_weight += weight;
+                min_occlusion = std::min(min_occlusion, grid_sample.occlusion);
+                max_occlusion = std::max(max_occlusion, grid_sample.occlusion);
+            }
+
+            if (total_weight > 0.01 && max_occlusion - min_occlusion <= DIRT_STEP_EDGE_EPSILON) {
+                lightsurf->samples[i].occlusion = occlusion / total_weight;
+            } else {
+                traced[i] = 2;
+            }
+        }
+    }
+}
+
+/*
+ * ============
+ * LightFace_CalculateDirtStepped
+ * ============
+ */
+void LightFace_CalculateDirtStepped(
+    light_context_t &ctx, lightsurf_t *lightsurf, int step, bool measure_error, const dirt_trace_fn &trace)
+{
+    ctx.total_dirt_samples += lightsurf->samples.size();
+
+    if (step <= 1) {
+        trace(lightsurf, {});
+        ctx.total_dirt_traced += lightsurf->samples.size();
+        return;
+    }
+
+    // trace a grid of every `step` samples, always including the last row and column
+    const int w = lightsurf->width, h = lightsurf->height;
+    thread_local std::vector<uint8_t> traced;
+
+    traced.assign(lightsurf->samples.size(), 0);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            const int i = y * w + x;
+
+            // occluded samples don't cast rays, but their occlusion is still set by the trace
+            traced[i] =
+                ((x % step == 0 || x == w - 1) && (y % step == 0 || y == h - 1)) || lightsurf->samples[i].occluded;
+        }
+    }
+
+    trace(lightsurf, traced);
+    ctx.total_dirt_traced += std::count(traced.begin(), traced.end(), 1);
+    LightFace_InterpolateDirt(lightsurf, step, traced);
+
+    // trace the samples that couldn't be interpolated
+    if (std::find(traced.begin(), traced.end(), 2) != traced.end()) {
+        for (auto &t : traced) {
+            t = (t == 2);
+        }
+        trace(lightsurf, traced);
+        ctx.total_dirt_traced += std::count(traced.begin(), traced.end(), 1);
+    }
+
+    if (measure_error) {
+        // trace everything again at full resolution, and compare
+        thread_local std::vector<float> interpolated;
+
+        interpolated.resize(lightsurf->samples.size());
+        for (size_t i = 0; i < lightsurf->samples.size(); i++) {
+            interpolated[i] = lightsurf->samples[i].occlusion;
+        }
+
+        trace(lightsurf, {});
+
+        for (size_t i = 0; i < lightsurf->samples.size(); i++) {
+            const float error = fabs(interpolated[i] - lightsurf->samples[i].occlusion);
+            const uint32_t error_micro = static_cast<uint32_t>(error * 1e6f);
+
+            ctx.total_dirtstep_error_micro += error_micro;
+
+            uint32_t max_error = ctx.max_dirtstep_error_micro;
+            while (
+                error_micro > max_error && !ctx.max_dirtstep_error_micro.compare_exchange_weak(max_error, error_micro))
+                ;
+
+            lightsurf->samples[i].occlusion = interpolated[i];
+        }
+    }
+}
+
+/*
+ * ============
+ * LightFace_CalculateDirt
+ * ============
+ */
+static void LightFace_CalculateDirt(light_context_t &ctx, lightsurf_t *lightsurf)
+{
+    Q_assert(ctx.dirt_in_use);
+
+    LightFace_CalculateDirtStepped(ctx, lightsurf, ctx.options.dirtstep.value(), ctx.options.dirtsteperror.value(),
+        [&ctx](lightsurf_t *surf, const std::vector<uint8_t> &traced) { LightFace_TraceDirt(ctx, surf, traced); });
+}
+
+// clamps negative values. applies gamma and rangescale. clamps values over 255
+// N.B. we want to do this before smoothing / downscaling, so huge values don't mess up the averaging.
+inline void LightFace_ScaleAndClamp(lightsurf_t *lightsurf)
+{
+    const settings::worldspawn_keys &cfg = *lightsurf->cfg;
+
+    // settings are looked up once per face rather than per sample
+    const vec_t maxlight = lightsurf->maxlight ? lightsurf->maxlight : cfg.maxlight.value();
+    const vec_t lightcolorscale = lightsurf->lightcolorscale;
+    const vec_t rangescale = cfg.rangescale.value();
+    const vec_t lightmapgamma = cfg.lightmapgamma.value();
+
+    for (lightmap_t &lightmap : lightsurf->lightmapsByStyle) {
+        for (int i = 0; i < lightsurf->samples.size(); i++) {
+            qvec3f &color = lightmap.samples[i].color;
+
+            /* Fix any negative values */
+            color = qv::max(color, {0});
+
+            // before any other scaling, apply maxlight
+            if (maxlight) {
+                vec_t maxcolor = qv::max(color);
+                // FIXME: for colored lighting, this doesn't seem to generate the right values...
+                vec_t maxval = maxlight * 2.0;
+
+                if (maxcolor > maxval) {
+                    color *= (maxval / maxcolor);
+                }
+            }
+
+            // color scaling
+            if (lightcolorscale != 1.0) {
+                qvec3f grayscale{qv::max(color)};
+                color = mix(grayscale, color, lightcolorscale);
+            }
+
+            /* Scale and handle gamma adjustment */
+            color *= rangescale;
+
+            if (lightmapgamma != 1.0) {
+                for (auto &c : color) {
+                    c = pow(c / 255.0f, 1.0 / lightmapgamma) * 255.0f;
+                }
+            }
+
+            // clamp
+            // FIXME: should this be a brightness clamp?
+            vec_t maxcolor = qv::max(color);
+
+            if (maxcolor > 255.0) {
+                color *= (255.0 / maxcolor);
+            }
+        }
+    }
+}
+
+/**
  * Same as above LightFace_ScaleAndClamp, but for lightgrid
  * TODO: share code with above
  */
-static void LightPoint_ScaleAndClamp(qvec3d &color)
+static void LightPoint_ScaleAndClamp(light_context_t &ctx, qvec3d &color)
 {
-    const settings::worldspawn_keys &cfg = light_options;
+    const settings::worldspawn_keys &cfg = ctx.options;
 
     /* Fix any negative values */
     color = qv::max(color, {0});
@@ -2460,11 +2910,11 @@ static void LightPoint_ScaleAndClamp(qvec3d &color)
     }
 }
 
-static void LightPoint_ScaleAndClamp(lightgrid_samples_t &result)
+static void LightPoint_ScaleAndClamp(light_context_t &ctx, lightgrid_samples_t &result)
 {
     for (auto &sample : result.samples_by_style) {
         if (sample.used) {
-            LightPoint_ScaleAndClamp(sample.color);
+            LightPoint_ScaleAndClamp(ctx, sample.color);
         }
     }
 }
@@ -2575,242 +3025,24 @@ static std::vector<qvec4f> LightmapColorsToGLMVector(const lightsurf_t *lightsur
     return res;
 }
 
-static std::vector<qvec4f> LightmapNormalsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm)
-{
-    std::vector<qvec4f> res;
-    for (int i = 0; i < lightsurf->samples.size(); i++) {
-        const qvec3d &color = lm->samples[i].direction;
-        const float alpha = lightsurf->samples[i].occluded ? 0.0f : 1.0f;
-        res.emplace_back(color[0], color[1], color[2], alpha);
-    }
-    return res;
-}
-
-// Special handling of alpha channel:
-// - "alpha channel" is expected to be 0 or 1. This gets set to 0 if the sample
-// point is occluded (bmodel sticking outside of the world, or inside a shadow-
-// casting bmodel that is overlapping a world face), otherwise it's 1.
-//
-// - If alpha is 0 the sample doesn't contribute to the filter kernel.
-// - If all the samples in the filter kernel have alpha=0, write a sample with alpha=0
-//   (but still average the colors, important so that minlight still works properly
-//    for bmodels that go outside of the world).
-static std::vector<qvec4f> IntegerDownsampleImage(const std::vector<qvec4f> &input, int w, int h, int factor)
-{
-    Q_assert(factor >= 1);
-    if (factor == 1)
-        return input;
-
-    const int outw = w / factor;
-    const int outh = h / factor;
-
-    std::vector<qvec4f> res(static_cast<size_t>(outw * outh));
-
-    for (int y = 0; y < outh; y++) {
-        for (int x = 0; x < outw; x++) {
-
-            float totalWeight = 0.0f;
-            qvec3f totalColor{};
-
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion{};
-
-            const int extraradius = 0;
-            const int kernelextent = factor + (2 * extraradius);
-
-            for (int y0 = 0; y0 < kernelextent; y0++) {
-                for (int x0 = 0; x0 < kernelextent; x0++) {
-                    const int x1 = (x * factor) - extraradius + x0;
-                    const int y1 = (y * factor) - extraradius + y0;
-
-                    // check if the kernel goes outside of the source image
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
-
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f &inSample = input.at((y1 * w) + x1);
-
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
-
-                    // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
-
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
-                }
-            }
-
-            const int outIndex = (y * outw) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
-            } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
-            }
-        }
-    }
-
-    return res;
-}
-
-static std::vector<qvec4f> FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
-{
-    // transparent pixels take the average of their neighbours.
-
-    std::vector<qvec4f> res(input);
-
-    while (1) {
-        int unhandled_pixels = 0;
-
-        for (int y = 0; y < h; y++) {
-            for (int x = 0; x < w; x++) {
-                const int i = (y * w) + x;
-                const qvec4f &inSample = res.at(i);
-
-                if (inSample[3] == 0) {
-                    // average the neighbouring non-transparent samples
-
-                    int opaque_neighbours = 0;
-                    qvec3f neighbours_sum{};
-                    for (int y0 = -1; y0 <= 1; y0++) {
-                        for (int x0 = -1; x0 <= 1; x0++) {
-                            const int x1 = x + x0;
-                            const int y1 = y + y0;
-
-                            if (x1 < 0 || x1 >= w)
-                                continue;
-                            if (y1 < 0 || y1 >= h)
-                                continue;
-
-                            const qvec4f neighbourSample = res.at((y1 * w) + x1);
-                            if (neighbourSample[3] == 1) {
-                                opaque_neighbours++;
-                                neighbours_sum += qvec3f(neighbourSample);
-                            }
-                        }
-                    }
-
-                    if (opaque_neighbours > 0) {
-                        neighbours_sum *= (1.0f / (float)opaque_neighbours);
-                        res.at(i) = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
-
-                        // this sample is now opaque
-                    } else {
-                        unhandled_pixels++;
-
-                        // all neighbours are transparent. need to perform more iterations (or the whole lightmap is
-                        // transparent).
-                    }
-                }
-            }
-        }
-
-        if (unhandled_pixels == input.size()) {
-            // logging::funcprint("warning, fully transparent lightmap\n");
-            fully_transparent_lightmaps++;
-            break;
-        }
-
-        if (unhandled_pixels == 0)
-            break; // all done
-    }
-
-    return res;
-}
-
-static std::vector<qvec4f> HighlightSeams(const std::vector<qvec4f> &input, int w, int h)
+// copies the colors (or directions) of a lightmap to an image; occluded samples are transparent
+static void LightmapToImage(
+    const lightsurf_t *lightsurf, const lightmap_t *lm, bool directions, int w, int h, lightmap_image_t &image)
 {
-    std::vector<qvec4f> res(input);
-
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            const int i = (y * w) + x;
-            const qvec4f &inSample = res.at(i);
-
-            if (inSample[3] == 0) {
-                res.at(i) = qvec4f(255, 0, 0, 1);
-            }
-        }
-    }
-
-    return res;
-}
-
-static std::vector<qvec4f> BoxBlurImage(const std::vector<qvec4f> &input, int w, int h, int radius)
-{
-    std::vector<qvec4f> res(input.size());
-
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-
-            float totalWeight = 0.0f;
-            qvec3f totalColor{};
-
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion{};
-
-            for (int y0 = -radius; y0 <= radius; y0++) {
-                for (int x0 = -radius; x0 <= radius; x0++) {
-                    const int x1 = std::clamp(x + x0, 0, w - 1);
-                    const int y1 = std::clamp(y + y0, 0, h - 1);
-
-                    // check if the kernel goes outside of the source image
-
-                    // 2017-09-16: this is a hack, but clamping the
-                    // x/y instead of discarding the samples outside of the
-                    // kernel looks better in some cases:
-                    // https://github.com/ericwa/ericw-tools/issues/171
-#if 0
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
-#endif
-
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f &inSample = input.at((y1 * w) + x1);
-
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
-
-                    // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
-
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
-                }
-            }
+    image.resize(w, h);
+    Q_assert(image.size() == lightsurf->samples.size());
 
-            const int outIndex = (y * w) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
-            } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
-            }
-        }
+    for (size_t i = 0; i < lightsurf->samples.size(); i++) {
+        const qvec3f color = directions ? qvec3f(lm->samples[i].direction) : lm->samples[i].color;
+        image.r[i] = color[0];
+        image.g[i] = color[1];
+        image.b[i] = color[2];
+        image.a[i] = lightsurf->samples[i].occluded ? 0.0f : 1.0f;
     }
-
-    return res;
 }
 
 // check if the given face can actually store luxel data
-bool Face_IsLightmapped(const mbsp_t *bsp, const mface_t *face)
+bool Face_IsLightmapped(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
     const mtexinfo_t *texinfo = Face_Texinfo(bsp, face);
 
@@ -2821,9 +3053,9 @@ bool Face_IsLightmapped(const mbsp_t *bsp, const mface_t *face)
     const char *texname = Face_TextureName(bsp, face);
 
     return bsp->loadversion->game->surf_is_lightmapped(texinfo->flags, texname,
-        light_options.q2rtx.value() &&
+        ctx.options.q2rtx.value() &&
             bsp->loadversion->game->id == GAME_QUAKE_II, // FIXME: move to own config option. -light_nodraw?
-        light_options.lightgrid.value());
+        ctx.options.lightgrid.value());
 }
 
 // check if the given face can actually emit light
@@ -2845,36 +3077,50 @@ bool Face_IsEmissive(const mbsp_t *bsp, const mface_t *face)
  * - Writes (actual_width * actual_height * 3) bytes to `lit`
  * - Writes (actual_width * actual_height * 3) bytes to `lux`
  */
-static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const lightsurf_t *lightsurf,
-    const lightmap_t *lm, const int actual_width, const int actual_height, uint8_t *out, uint8_t *lit, uint8_t *lux,
-    const faceextents_t &output_extents)
+static void WriteSingleLightmap(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const lightsurf_t *lightsurf, const lightmap_t *lm, const int actual_width, const int actual_height, uint8_t *out,
+    uint8_t *lit, uint8_t *lux, const faceextents_t &output_extents)
 {
-    const int oversampled_width = actual_width * light_options.extra.value();
-    const int oversampled_height = actual_height * light_options.extra.value();
+    const int oversampled_width = actual_width * ctx.options.extra.value();
+    const int oversampled_height = actual_height * ctx.options.extra.value();
 
-    // allocate new float buffers for the output colors and directions
-    // these are the actual output width*height, without oversampling.
+    // per-thread images, reused between lightmaps
+    thread_local lightmap_image_t fullres, blurred, downsampled_color, fullres_dir, downsampled_dir;
 
-    std::vector<qvec4f> fullres = LightmapColorsToGLMVector(lightsurf, lm);
+    LightmapToImage(lightsurf, lm, false, oversampled_width, oversampled_height, fullres);
 
-    if (light_options.highlightseams.value()) {
-        fullres = HighlightSeams(fullres, oversampled_width, oversampled_height);
+    if (ctx.options.highlightseams.value()) {
+        HighlightSeams(fullres);
     }
 
     // removes all transparent pixels by averaging from adjacent pixels
-    fullres = FloodFillTransparent(fullres, oversampled_width, oversampled_height);
+    if (FloodFillTransparent(fullres)) {
+        // logging::funcprint("warning, fully transparent lightmap\n");
+        ctx.fully_transparent_lightmaps++;
+    }
+
+    const lightmap_image_t *output_color = &fullres;
+
+    if (ctx.options.soft.value() > 0) {
+        BoxBlurImage(fullres, blurred, ctx.options.soft.value());
+        output_color = &blurred;
+    }
 
-    if (light_options.soft.value() > 0) {
-        fullres = BoxBlurImage(fullres, oversampled_width, oversampled_height, light_options.soft.value());
+    if (ctx.options.extra.value() > 1) {
+        IntegerDownsampleImage(*output_color, downsampled_color, ctx.options.extra.value());
+        output_color = &downsampled_color;
     }
 
-    const std::vector<qvec4f> output_color =
-        IntegerDownsampleImage(fullres, oversampled_width, oversampled_height, light_options.extra.value());
-    std::optional<std::vector<qvec4f>> output_dir;
+    const lightmap_image_t *output_dir = nullptr;
 
     if (lux) {
-        output_dir = IntegerDownsampleImage(LightmapNormalsToGLMVector(lightsurf, lm), oversampled_width,
-            oversampled_height, light_options.extra.value());
+        LightmapToImage(lightsurf, lm, true, oversampled_width, oversampled_height, fullres_dir);
+        output_dir = &fullres_dir;
+
+        if (ctx.options.extra.value() > 1) {
+            IntegerDownsampleImage(fullres_dir, downsampled_dir, ctx.options.extra.value());
+            output_dir = &downsampled_dir;
+        }
     }
 
     // copy from the float buffers to byte buffers in .bsp / .lit / .lux
@@ -2888,7 +3134,7 @@ static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const li
             const int sampleindex = (input_sample_t * actual_width) + input_sample_s;
 
             if (lit || out) {
-                const qvec4f &color = output_color.at(sampleindex);
+                const qvec4f color = output_color->get(sampleindex);
 
                 if (lit) {
                     *lit++ = color[0];
@@ -2914,7 +3160,7 @@ static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const li
             }
 
             if (lux) {
-                qvec3d direction = output_dir->at(sampleindex).xyz();
+                qvec3d direction = output_dir->get(sampleindex).xyz();
                 qvec3d temp = {qv::dot(direction, lightsurf->snormal), qv::dot(direction, lightsurf->tnormal),
                     qv::dot(direction, lightsurf->plane.normal)};
 
@@ -2939,8 +3185,9 @@ static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const li
  * - Writes (output_width * output_height * 3) bytes to `lit`
  * - Writes (output_width * output_height * 3) bytes to `lux`
  */
-static void WriteSingleLightmap_FromDecoupled(const mbsp_t *bsp, const mface_t *face, const lightsurf_t *lightsurf,
-    const lightmap_t *lm, const int output_width, const int output_height, uint8_t *out, uint8_t *lit, uint8_t *lux)
+static void WriteSingleLightmap_FromDecoupled(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const lightsurf_t *lightsurf, const lightmap_t *lm, const int output_width, const int output_height, uint8_t *out,
+    uint8_t *lit, uint8_t *lux)
 {
     // this is the lightmap data in the "decoupled" coordinate system
     std::vector<qvec4f> fullres = LightmapColorsToGLMVector(lightsurf, lm);
@@ -2966,7 +3213,7 @@ static void WriteSingleLightmap_FromDecoupled(const mbsp_t *bsp, const mface_t *
             // convert from vanilla lm coord to decoupled lm coord
             qvec2f decoupled_lm_coord = vanillaLMToDecoupled * qvec4f(s, t, 0, 1);
 
-            decoupled_lm_coord = decoupled_lm_coord * light_options.extra.value();
+            decoupled_lm_coord = decoupled_lm_coord * ctx.options.extra.value();
 
             // split into integer/fractional part for bilinear interpolation
             const int coord_floor_x = (int)decoupled_lm_coord[0];
@@ -3004,7 +3251,7 @@ static void WriteSingleLightmap_FromDecoupled(const mbsp_t *bsp, const mface_t *
     }
 }
 
-void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
+void SaveLightmapSurface(light_context_t &ctx, const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     bspx_decoupled_lm_perface *facesup_decoupled, lightsurf_t *lightsurf, const faceextents_t &extents,
     const faceextents_t &output_extents)
 {
@@ -3015,7 +3262,7 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     const int output_height = output_extents.height();
     const int size = output_extents.numsamples();
 
-    if (light_options.litonly.value()) {
+    if (ctx.options.litonly.value()) {
         // special case for writing a .lit for a bsp without modifying the bsp.
         // involves looking at which styles were written to the bsp in the previous lighting run, and then
         // writing the same styles to the same offsets in the .lit file.
@@ -3026,7 +3273,7 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
         }
 
         uint8_t *out, *lit, *lux;
-        GetFileSpace_PreserveOffsetInBsp(&out, &lit, &lux, face->lightofs);
+        GetFileSpace(ctx, &out, &lit, &lux, face->lightofs);
 
         for (int mapnum = 0; mapnum < MAXLIGHTMAPS; mapnum++) {
             const int style = face->styles[mapnum];
@@ -3039,7 +3286,7 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
             for (const lightmap_t &lm : lightmaps) {
                 if (lm.style == style) {
                     WriteSingleLightmap(
-                        bsp, face, lightsurf, &lm, actual_width, actual_height, out, lit, lux, output_extents);
+                        ctx, bsp, face, lightsurf, &lm, actual_width, actual_height, out, lit, lux, output_extents);
                     break;
                 }
             }
@@ -3059,7 +3306,7 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
         return;
     }
 
-    size_t maxfstyles = std::min((size_t)light_options.facestyles.value(), facesup ? MAXLIGHTMAPSSUP : MAXLIGHTMAPS);
+    size_t maxfstyles = std::min((size_t)ctx.options.facestyles.value(), facesup ? MAXLIGHTMAPSSUP : MAXLIGHTMAPS);
     int maxstyle = facesup ? INVALID_LIGHTSTYLE : INVALID_LIGHTSTYLE_OLD;
 
     // intermediate collection for sorting lightmaps
@@ -3070,8 +3317,8 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
         if (lightmap.style == INVALID_LIGHTSTYLE)
             continue;
         if (lightmap.style > maxstyle || (facesup && lightmap.style > INVALID_LIGHTSTYLE_OLD)) {
-            if (!warned_about_light_style_overflow) {
-                if (IsOutputtingSupplementaryData()) {
+            if (!ctx.warned_about_light_style_overflow) {
+                if (IsOutputtingSupplementaryData(ctx)) {
                     logging::print(
                         "INFO: a face has exceeded max light style id ({});\n LMSTYLE16 will be output to hold the non-truncated data.\n Use -verbose to find which faces.\n",
                         maxstyle, lightsurf->samples[0].point);
@@ -3080,7 +3327,7 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
                         "WARNING: a face has exceeded max light style id ({}). Use -verbose to find which faces.\n",
                         maxstyle, lightsurf->samples[0].point);
                 }
-                warned_about_light_style_overflow = true;
+                ctx.warned_about_light_style_overflow = true;
             }
             logging::print(logging::flag::VERBOSE, "WARNING: Style {} too high on face near {}\n", lightmap.style,
                 lightsurf->samples[0].point);
@@ -3119,8 +3366,8 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     std::vector<const lightmap_t *> sorted;
     for (const auto &pair : sortable) {
         if (sorted.size() == maxfstyles) {
-            if (!warned_about_light_map_overflow) {
-                if (IsOutputtingSupplementaryData()) {
+            if (!ctx.warned_about_light_map_overflow) {
+                if (IsOutputtingSupplementaryData(ctx)) {
                     logging::print(
                         "INFO: a face has exceeded max light styles ({});\n LMSTYLE/LMSTYLE16 will be output to hold the non-truncated data.\n Use -verbose to find which faces.\n",
                         maxfstyles, lightsurf->samples[0].point);
@@ -3129,7 +3376,7 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
                         "WARNING: a face has exceeded max light styles ({}). Use -verbose to find which faces.\n",
                         maxfstyles, lightsurf->samples[0].point);
                 }
-                warned_about_light_map_overflow = true;
+                ctx.warned_about_light_map_overflow = true;
             }
             logging::print(logging::flag::VERBOSE,
                 "WARNING: {} light styles (max {}) on face near {}; styles: ", sortable.size(), maxfstyles,
@@ -3185,86 +3432,125 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     if (!numstyles)
         return;
 
-    uint8_t *out, *lit, *lux;
-    GetFileSpace(&out, &lit, &lux, size * numstyles);
+    // sanity check that we don't save a lightmap for a non-lightmapped face
+    Q_assert(Face_IsLightmapped(ctx, bsp, face));
 
-    int lightofs;
+    // the lightmaps are written by WriteLightmapSurface, once the space for every face is laid out
+    lightmap_output_t &output = lightsurf->outputs.emplace_back();
+    output.face = face;
+    output.facesup = facesup;
+    output.facesup_decoupled = facesup_decoupled;
+    output.extents = &extents;
+    output.output_extents = &output_extents;
 
-    // Q2/HL native colored lightmaps
-    if (bsp->loadversion->game->has_rgb_lightmap) {
-        lightofs = lit - lit_filebase.data();
-    } else {
-        lightofs = out - filebase.data();
+    for (const lightmap_t *lm : sorted) {
+        output.lightmaps.push_back(lm - lightmaps.data());
     }
+}
 
-    if (facesup_decoupled) {
-        facesup_decoupled->offset = lightofs;
-        face->lightofs = -1;
-    } else if (facesup) {
-        facesup->lightofs = lightofs;
-    } else {
-        face->lightofs = lightofs;
-    }
+// write vanilla lightmap if -world_units_per_luxel is in use but not -novanilla
+static bool LightmapOutput_HasVanilla(light_context_t &ctx, const lightmap_output_t &output)
+{
+    return output.facesup_decoupled && !ctx.options.novanilla.value();
+}
 
-    // sanity check that we don't save a lightmap for a non-lightmapped face
-    {
-        const char *texname = Face_TextureName(bsp, face);
-        Q_assert(Face_IsLightmapped(bsp, face));
-    }
+/*
+ * Returns the sizes, in greyscale samples, of the blocks of lightmap data
+ * WriteLightmapSurface writes for this surface, in order. Each block gets its
+ * own offset; lit/lux data takes three times as much space.
+ */
+std::vector<int> LightmapSurfaceBlocks(light_context_t &ctx, const lightsurf_t *lightsurf)
+{
+    std::vector<int> blocks;
 
-    for (int mapnum = 0; mapnum < numstyles; mapnum++) {
-        const lightmap_t *lm = sorted.at(mapnum);
+    for (const lightmap_output_t &output : lightsurf->outputs) {
+        const int numstyles = static_cast<int>(output.lightmaps.size());
 
-        WriteSingleLightmap(bsp, face, lightsurf, lm, actual_width, actual_height, out, lit, lux, output_extents);
+        blocks.push_back(output.output_extents->numsamples() * numstyles);
 
-        if (out) {
-            out += size;
-        }
-        if (lit) {
-            lit += (size * 3);
-        }
-        if (lux) {
-            lux += (size * 3);
+        if (LightmapOutput_HasVanilla(ctx, output)) {
+            blocks.push_back(lightsurf->vanilla_extents.numsamples() * numstyles);
         }
     }
 
-    // write vanilla lightmap if -world_units_per_luxel is in use but not -novanilla
-    if (facesup_decoupled && !light_options.novanilla.value()) {
-        // FIXME: duplicates some code from above
-        GetFileSpace(&out, &lit, &lux, lightsurf->vanilla_extents.numsamples() * numstyles);
+    return blocks;
+}
+
+/*
+ * Writes the lightmaps picked by SaveLightmapSurface to the output buffers,
+ * one block at each of `offsets` (in greyscale samples; see
+ * LightmapSurfaceBlocks), and points the face headers at them.
+ */
+void WriteLightmapSurface(light_context_t &ctx, const mbsp_t *bsp, lightsurf_t *lightsurf, const int *offsets)
+{
+    const lightmapdict_t &lightmaps = lightsurf->lightmapsByStyle;
+
+    // Q2/HL native colored lightmaps are addressed in bytes of rgb data
+    const int lightofs_scale = bsp->loadversion->game->has_rgb_lightmap ? 3 : 1;
 
-        // Q2/HL native colored lightmaps
-        if (bsp->loadversion->game->has_rgb_lightmap) {
-            lightofs = lit - lit_filebase.data();
+    for (const lightmap_output_t &output : lightsurf->outputs) {
+        const int size = output.output_extents->numsamples();
+        const int offset = *offsets++;
+
+        uint8_t *out, *lit, *lux;
+        GetFileSpace(ctx, &out, &lit, &lux, offset);
+
+        const int lightofs = offset * lightofs_scale;
+
+        if (output.facesup_decoupled) {
+            output.facesup_decoupled->offset = lightofs;
+            output.face->lightofs = -1;
+        } else if (output.facesup) {
+            output.facesup->lightofs = lightofs;
         } else {
-            lightofs = out - filebase.data();
+            output.face->lightofs = lightofs;
         }
-        face->lightofs = lightofs;
-
-        for (int mapnum = 0; mapnum < numstyles; mapnum++) {
-            const lightmap_t *lm = sorted.at(mapnum);
 
-            WriteSingleLightmap_FromDecoupled(bsp, face, lightsurf, lm, lightsurf->vanilla_extents.width(),
-                lightsurf->vanilla_extents.height(), out, lit, lux);
+        for (const size_t index : output.lightmaps) {
+            WriteSingleLightmap(ctx, bsp, output.face, lightsurf, &lightmaps[index], output.extents->width(),
+                output.extents->height(), out, lit, lux, *output.output_extents);
 
             if (out) {
-                out += lightsurf->vanilla_extents.numsamples();
+                out += size;
             }
             if (lit) {
-                lit += (lightsurf->vanilla_extents.numsamples() * 3);
+                lit += (size * 3);
             }
             if (lux) {
-                lux += (lightsurf->vanilla_extents.numsamples() * 3);
+                lux += (size * 3);
+            }
+        }
+
+        if (LightmapOutput_HasVanilla(ctx, output)) {
+            const int vanilla_size = lightsurf->vanilla_extents.numsamples();
+            const int vanilla_offset = *offsets++;
+
+            GetFileSpace(ctx, &out, &lit, &lux, vanilla_offset);
+            output.face->lightofs = vanilla_offset * lightofs_scale;
+
+            for (const size_t index : output.lightmaps) {
+                WriteSingleLightmap_FromDecoupled(ctx, bsp, output.face, lightsurf, &lightmaps[index],
+                    lightsurf->vanilla_extents.width(), lightsurf->vanilla_extents.height(), out, lit, lux);
+
+                if (out) {
+                    out += vanilla_size;
+                }
+                if (lit) {
+                    lit += (vanilla_size * 3);
+                }
+                if (lux) {
+                    lux += (vanilla_size * 3);
+                }
             }
         }
     }
 }
 
-std::unique_ptr<lightsurf_t> CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const facesup_t *facesup,
-    const bspx_decoupled_lm_perface *facesup_decoupled, const settings::worldspawn_keys &cfg)
+std::unique_ptr<lightsurf_t> CreateLightmapSurface(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face,
+    const facesup_t *facesup, const bspx_decoupled_lm_perface *facesup_decoupled, const settings::worldspawn_keys &cfg)
 {
     /* Find the correct model offset */
-    const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+    const modelinfo_t *modelinfo = ModelInfoForFace(ctx, bsp, Face_GetNum(bsp, face));
     if (modelinfo == nullptr) {
         return nullptr;
     }
@@ -3274,11 +3560,227 @@ std::unique_ptr<lightsurf_t> CreateLightmapSurface(const mbsp_t *bsp, const mfac
         return nullptr;
 
     // if we don't have a lightmap or emissive, we're done
-    if (!Face_IsEmissive(bsp, face) && !Face_IsLightmapped(bsp, face)) {
+    if (!Face_IsEmissive(bsp, face) && !Face_IsLightmapped(ctx, bsp, face)) {
         return nullptr;
     }
 
-    return Lightsurf_Init(modelinfo, cfg, face, bsp, facesup, facesup_decoupled);
+    return Lightsurf_Init(ctx, modelinfo, cfg, face, bsp, facesup, facesup_decoupled);
+}
+
+/*
+ * ============
+ * LightFace_Adaptive
+ *
+ * -extra_adaptive: runs `light_pass` on one sample per luxel first and copies
+ * its contribution to the luxel's other -extra sub-samples. Then it runs
+ * `light_pass` again on the sub-samples of luxels that straddle an occlusion
+ * edge, or whose contribution differs from a neighbouring luxel's by more than
+ * the threshold. The light passes skip occluded samples, so each run is
+ * restricted by temporarily marking the samples outside it as occluded.
+ * ============
+ */
+template<typename F>
+static void LightFace_Adaptive(light_context_t &ctx, lightsurf_t &lightsurf, bool count_stats, F &&light_pass)
+{
+    const int extra = ctx.options.extra.value();
+    const vec_t threshold = ctx.options.extra_adaptive.value();
+
+    if (extra == 1 || threshold <= 0) {
+        light_pass();
+        return;
+    }
+
+    auto &samples = lightsurf.samples;
+    const int width = lightsurf.width;
+    const int luxels_w = lightsurf.width / extra;
+    const int luxels_h = lightsurf.height / extra;
+    const size_t num_luxels = static_cast<size_t>(luxels_w) * luxels_h;
+
+    auto luxel_of = [&](size_t i) { return ((i / width) / extra) * luxels_w + (i % width) / extra; };
+
+    // the unoccluded sub-sample nearest the luxel center stands in for the whole luxel
+    std::vector<int> reps(num_luxels, -1);
+    std::vector<bool> refine(num_luxels, false);
+
+    for (int lt = 0; lt < luxels_h; lt++) {
+        for (int ls = 0; ls < luxels_w; ls++) {
+            const size_t l = lt * luxels_w + ls;
+            int best_dist = std::numeric_limits<int>::max();
+            bool any_occluded = false;
+
+            for (int t = 0; t < extra; t++) {
+                for (int s = 0; s < extra; s++) {
+                    const int i = (lt * extra + t) * width + (ls * extra + s);
+                    if (samples[i].occluded) {
+                        any_occluded = true;
+                        continue;
+                    }
+                    const int dist = abs(2 * s - (extra - 1)) + abs(2 * t - (extra - 1));
+                    if (dist < best_dist) {
+                        best_dist = dist;
+                        reps[l] = i;
+                    }
+                }
+            }
+
+            // partially occluded luxels always get supersampled
+            refine[l] = any_occluded && reps[l] != -1;
+        }
+    }
+
+    std::vector<bool> was_occluded(samples.size());
+    for (size_t i = 0; i < samples.size(); i++) {
+        was_occluded[i] = samples[i].occluded;
+    }
+
+    auto run_on = [&](auto &&active) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i].occluded = was_occluded[i] || !active(i);
+        }
+        light_pass();
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i].occluded = was_occluded[i];
+        }
+    };
+
+    // remember the representatives' values, so we can tell what this pass added
+    std::vector<std::pair<int, std::vector<lightsample_t>>> before;
+    for (const auto &lm : lightsurf.lightmapsByStyle) {
+        if (lm.style == INVALID_LIGHTSTYLE) {
+            continue;
+        }
+        auto &values = before.emplace_back(lm.style, std::vector<lightsample_t>(num_luxels)).second;
+        for (size_t l = 0; l < num_luxels; l++) {
+            if (reps[l] != -1) {
+                values[l] = lm.samples[reps[l]];
+            }
+        }
+    }
+
+    run_on([&](size_t i) { return reps[luxel_of(i)] == static_cast<int>(i); });
+
+    // contribution of this pass at each representative, per style
+    std::vector<std::pair<lightmap_t *, std::vector<lightsample_t>>> deltas;
+    for (auto &lm : lightsurf.lightmapsByStyle) {
+        if (lm.style == INVALID_LIGHTSTYLE) {
+            continue;
+        }
+        const std::vector<lightsample_t> *prev = nullptr;
+        for (const auto &[style, values] : before) {
+            if (style == lm.style) {
+                prev = &values;
+            }
+        }
+        auto &delta = deltas.emplace_back(&lm, std::vector<lightsample_t>(num_luxels)).second;
+        for (size_t l = 0; l < num_luxels; l++) {
+            if (reps[l] == -1) {
+                continue;
+            }
+            delta[l] = lm.samples[reps[l]];
+            if (prev) {
+                delta[l].color -= (*prev)[l].color;
+                delta[l].direction -= (*prev)[l].direction;
+            }
+        }
+    }
+
+    // supersample shadow edges and gradients steeper than the threshold
+    for (int lt = 0; lt < luxels_h; lt++) {
+        for (int ls = 0; ls < luxels_w; ls++) {
+            const size_t l = lt * luxels_w + ls;
+            if (reps[l] == -1 || refine[l]) {
+                continue;
+            }
+
+            constexpr int neighbours[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+            for (const auto &[ds, dt] : neighbours) {
+                const int ns = ls + ds, nt = lt + dt;
+                if (ns < 0 || ns >= luxels_w || nt < 0 || nt >= luxels_h) {
+                    continue;
+                }
+                const size_t n = nt * luxels_w + ns;
+                if (reps[n] == -1) {
+                    refine[l] = true;
+                    break;
+                }
+                for (const auto &[lm, delta] : deltas) {
+                    if (fabs(LightSample_Brightness(delta[l].color) - LightSample_Brightness(delta[n].color)) >
+                        threshold) {
+                        refine[l] = true;
+                        break;
+                    }
+                }
+                if (refine[l]) {
+                    break;
+                }
+            }
+        }
+    }
+
+    // the rest take the representative's contribution
+    for (size_t i = 0; i < samples.size(); i++) {
+        const size_t l = luxel_of(i);
+        if (was_occluded[i] || refine[l] || reps[l] == static_cast<int>(i)) {
+            continue;
+        }
+        for (const auto &[lm, delta] : deltas) {
+            lm->samples[i].color += delta[l].color;
+            lm->samples[i].direction += delta[l].direction;
+        }
+    }
+
+    run_on([&](size_t i) {
+        const size_t l = luxel_of(i);
+        return refine[l] && reps[l] != static_cast<int>(i);
+    });
+
+    if (count_stats) {
+        ctx.total_adaptive_luxels += std::count_if(reps.begin(), reps.end(), [](int r) { return r != -1; });
+        ctx.total_adaptive_supersampled += std::count(refine.begin(), refine.end(), true);
+    }
+}
+
+/*
+ * ============
+ * EstimateDirectLightFaceCost
+ *
+ * rough number of rays DirectLightFace will trace for the surface, used to
+ * schedule the most expensive faces first. the -extra level is accounted for
+ * by the sample count, -skydomesamples by the suns' strata.
+ * ============
+ */
+uint64_t EstimateDirectLightFaceCost(light_context_t &ctx, const mbsp_t *bsp, const lightsurf_t &lightsurf)
+{
+    uint64_t rays_per_sample = 1;
+
+    for (const sun_t &sun : ctx.all_suns) {
+        // see LightFace_Sky: a dome or penumbra traces one ray per -skydomesamples stratum
+        if (sun.distribution == sun_distribution_t::NONE) {
+            rays_per_sample++;
+        } else {
+            rays_per_sample += SkyDome_Strata(ctx) * SkyDome_Strata(ctx);
+        }
+    }
+
+    if (ctx.dirt_in_use) {
+        rays_per_sample += ctx.numDirtVectors;
+    }
+
+    for (const auto &entity : ctx.all_lights) {
+        if (entity->getFormula() == LF_LOCALMIN || entity->nostaticlight.value())
+            continue;
+
+        if (lightsurf.plane.distance_to(entity->origin.value()) < 0 && !entity->bleed.value() && !lightsurf.curved &&
+            !lightsurf.twosided)
+            continue;
+
+        if (CullLight(ctx, entity.get(), &lightsurf))
+            continue;
+
+        rays_per_sample++;
+    }
+
+    return lightsurf.samples.size() * rays_per_sample;
 }
 
 /*
@@ -3286,16 +3788,17 @@ std::unique_ptr<lightsurf_t> CreateLightmapSurface(const mbsp_t *bsp, const mfac
  * LightFace
  * ============
  */
-void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
+void DirectLightFace(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
 {
     auto face = lightsurf.face;
-    const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+    const modelinfo_t *modelinfo = ModelInfoForFace(ctx, bsp, Face_GetNum(bsp, face));
 
     lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
 
     /* calculate dirt (ambient occlusion) but don't use it yet */
-    if (dirt_in_use && (light_options.debugmode != debugmodes::phong))
-        LightFace_CalculateDirt(&lightsurf);
+    if (ctx.dirt_in_use && (ctx.options.debugmode != debugmodes::phong))
+        LightFace_CalculateDirt(ctx, &lightsurf);
 
     /*
      * The lighting procedure is: cast all positive lights, fix
@@ -3303,47 +3806,49 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
      * clamp any values that may have gone negative.
      */
 
-    if (light_options.debugmode == debugmodes::none) {
+    if (ctx.options.debugmode == debugmodes::none) {
 
-        total_samplepoints += lightsurf.samples.size();
+        ctx.total_samplepoints += lightsurf.samples.size();
 
-        const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+        const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
 
-        /* positive lights */
-        if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
-            for (const auto &entity : GetLights()) {
-                if (entity->getFormula() == LF_LOCALMIN)
-                    continue;
-                if (entity->nostaticlight.value())
-                    continue;
-                if (entity->light.value() > 0)
-                    LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
+        LightFace_Adaptive(ctx, lightsurf, true, [&]() {
+            /* positive lights */
+            if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
+                for (const auto &entity : ctx.all_lights) {
+                    if (entity->getFormula() == LF_LOCALMIN)
+                        continue;
+                    if (entity->nostaticlight.value())
+                        continue;
+                    if (entity->light.value() > 0)
+                        LightFace_Entity(ctx, bsp, entity.get(), &lightsurf, lightmaps);
+                }
+                for (const sun_t &sun : ctx.all_suns)
+                    if (sun.sunlight > 0)
+                        LightFace_Sky(ctx, bsp, &sun, &lightsurf, lightmaps);
+
+                // mxd. Add surface lights...
+                // FIXME: negative surface lights
+                LightFace_SurfaceLight(ctx, bsp, &lightsurf, lightmaps, ctx.surfacelights, cfg.surflightscale.value(),
+                    cfg.surflightskyscale.value(), 16.0f);
             }
-            for (const sun_t &sun : GetSuns())
-                if (sun.sunlight > 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
-
-            // mxd. Add surface lights...
-            // FIXME: negative surface lights
-            LightFace_SurfaceLight(bsp, &lightsurf, lightmaps, GetSurfaceLights(), cfg.surflightscale.value(),
-                cfg.surflightskyscale.value(), 16.0f);
-        }
 
-        LightFace_LocalMin(bsp, face, &lightsurf, lightmaps);
+            LightFace_LocalMin(ctx, bsp, face, &lightsurf, lightmaps);
+        });
     }
 
     /* replace lightmaps with AO for debugging */
-    if (light_options.debugmode == debugmodes::dirt)
-        LightFace_DirtDebug(bsp, &lightsurf, lightmaps);
+    if (ctx.options.debugmode == debugmodes::dirt)
+        LightFace_DirtDebug(ctx, bsp, &lightsurf, lightmaps);
 
-    if (light_options.debugmode == debugmodes::phong)
-        LightFace_PhongDebug(bsp, &lightsurf, lightmaps);
+    if (ctx.options.debugmode == debugmodes::phong)
+        LightFace_PhongDebug(ctx, bsp, &lightsurf, lightmaps);
 
-    if (light_options.debugmode == debugmodes::debugoccluded)
-        LightFace_OccludedDebug(bsp, &lightsurf, lightmaps);
+    if (ctx.options.debugmode == debugmodes::debugoccluded)
+        LightFace_OccludedDebug(ctx, bsp, &lightsurf, lightmaps);
 
-    if (light_options.debugmode == debugmodes::debugneighbours)
-        LightFace_DebugNeighbours(bsp, &lightsurf, lightmaps);
+    if (ctx.options.debugmode == debugmodes::debugneighbours)
+        LightFace_DebugNeighbours(ctx, bsp, &lightsurf, lightmaps);
 }
 
 /*
@@ -3351,43 +3856,92 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
  * IndirectLightFace
  * ============
  */
-void IndirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
+void IndirectLightFace(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
 {
     auto face = lightsurf.face;
-    const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+    const modelinfo_t *modelinfo = ModelInfoForFace(ctx, bsp, Face_GetNum(bsp, face));
     lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
 
-    if (light_options.debugmode == debugmodes::none) {
-        const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+    if (ctx.options.debugmode == debugmodes::none) {
+        const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
 
         /* positive lights */
         if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
 
             /* add bounce lighting */
             // note: scale here is just to keep it close-ish to the old code
-            LightFace_SurfaceLight(bsp, &lightsurf, lightmaps, BounceLights(), cfg.bouncescale.value() * 0.5,
-                cfg.bouncescale.value(), 128.0f);
+            if (cfg.bounces.value() > 1) {
+                // record what each bounce emitter delivers here, for GatherExtraBounces. this needs every
+                // sample traced, so -extra_adaptive doesn't apply.
+                lightsurf.bounce_transfer.clear();
+                lightsurf.bounce_shape.assign(lightsurf.samples.size(), 0.0f);
+
+                LightFace_SurfaceLight(ctx, bsp, &lightsurf, lightmaps, ctx.bouncelights, cfg.bouncescale.value() * 0.5,
+                    cfg.bouncescale.value(), 128.0f, true);
+            } else {
+                LightFace_Adaptive(ctx, lightsurf, false, [&]() {
+                    LightFace_SurfaceLight(ctx, bsp, &lightsurf, lightmaps, ctx.bouncelights,
+                        cfg.bouncescale.value() * 0.5, cfg.bouncescale.value(), 128.0f);
+                });
+            }
         }
     }
 }
 
+/*
+ * ============
+ * AddExtraBounceToFace
+ *
+ * Adds `received`, the average light this face gets from one of the extra
+ * "_bounces", spread over the samples in the shape recorded by the first
+ * indirect pass.
+ * ============
+ */
+void AddExtraBounceToFace(light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const qvec3d &received)
+{
+    if (qv::emptyExact(received) || lightsurf.bounce_shape.empty()) {
+        return;
+    }
+
+    float shape_sum = 0;
+    for (float shape : lightsurf.bounce_shape) {
+        shape_sum += shape;
+    }
+    if (shape_sum <= 0) {
+        return;
+    }
+
+    const float shape_scale = lightsurf.samples.size() / shape_sum;
+
+    lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
+    lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, 0, &lightsurf);
+
+    for (size_t i = 0; i < lightsurf.samples.size(); i++) {
+        lightmap->samples[i].color += qvec3f(received * (lightsurf.bounce_shape[i] * shape_scale));
+    }
+
+    Lightmap_Save(ctx, bsp, lightmaps, &lightsurf, lightmap, 0);
+}
+
 /*
  * ============
  * PostProcessLightFace
  * ============
  */
-void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
+void PostProcessLightFace(
+    light_context_t &ctx, const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
 {
     auto face = lightsurf.face;
-    const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+    const modelinfo_t *modelinfo = ModelInfoForFace(ctx, bsp, Face_GetNum(bsp, face));
 
     lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
 
-    if (light_options.debugmode == debugmodes::none) {
+    if (ctx.options.debugmode == debugmodes::none) {
 
-        total_samplepoints += lightsurf.samples.size();
+        ctx.total_samplepoints += lightsurf.samples.size();
 
-        const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+        const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
 
         float minlight = 0;
         qvec3d minlight_color;
@@ -3402,10 +3956,10 @@ void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const setti
         }
 
         if (minlight) {
-            LightFace_Min(bsp, face, minlight_color, minlight, &lightsurf, lightmaps, 0);
+            LightFace_Min(ctx, bsp, face, minlight_color, minlight, &lightsurf, lightmaps, 0);
         }
 
-            if (auto value = IsSurfaceLitFace(bsp, face)) {
+            if (auto value = IsSurfaceLitFace(ctx, bsp, face)) {
                 auto *entity = std::get<3>(value.value());
             float surface_minlight_scale = entity ? entity->surflight_minlight_scale.value() : 64.f;
                 surface_minlight_scale *= lightsurf.surflight_minlight_scale;
@@ -3414,32 +3968,32 @@ void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const setti
                     minlight = std::get<0>(value.value()) * surface_minlight_scale;
                     minlight_color = std::get<2>(value.value());
                     LightFace_Min(
-                        bsp, face, minlight_color, minlight, &lightsurf, lightmaps, std::get<1>(value.value()));
+                        ctx, bsp, face, minlight_color, minlight, &lightsurf, lightmaps, std::get<1>(value.value()));
                 }
             }
 
         if (!modelinfo->isWorld()) {
-            LightFace_AutoMin(bsp, face, &lightsurf, lightmaps);
+            LightFace_AutoMin(ctx, bsp, face, &lightsurf, lightmaps);
         }
 
         /* negative lights */
         if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
-            for (const auto &entity : GetLights()) {
+            for (const auto &entity : ctx.all_lights) {
                 if (entity->getFormula() == LF_LOCALMIN)
                     continue;
                 if (entity->nostaticlight.value())
                     continue;
                 if (entity->light.value() < 0)
-                    LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
+                    LightFace_Entity(ctx, bsp, entity.get(), &lightsurf, lightmaps);
             }
-            for (const sun_t &sun : GetSuns())
+            for (const sun_t &sun : ctx.all_suns)
                 if (sun.sunlight < 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
+                    LightFace_Sky(ctx, bsp, &sun, &lightsurf, lightmaps);
         }
     }
 
-    if (light_options.debugmode == debugmodes::mottle)
-        LightFace_DebugMottle(bsp, &lightsurf, lightmaps);
+    if (ctx.options.debugmode == debugmodes::mottle)
+        LightFace_DebugMottle(ctx, bsp, &lightsurf, lightmaps);
 }
 // lightgrid
 
@@ -3537,15 +4091,15 @@ bool lightgrid_samples_t::operator==(const lightgrid_samples_t &other) const
     return samples_by_style == other.samples_by_style;
 }
 
-lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_point)
+lightgrid_samples_t CalcLightgridAtPoint(light_context_t &ctx, const mbsp_t *bsp, const qvec3d &world_point)
 {
     // TODO: use more than 1 ray for better performance
     raystream_occlusion_t rs(1);
     raystream_intersection_t rsi(1);
 
-    const auto *pvs = Mod_LeafPvs(bsp, BSP_FindLeafAtPoint(bsp, &bsp->dmodels[0], world_point));
+    const auto *pvs = Mod_LeafPvs(ctx, bsp, BSP_FindLeafAtPoint(bsp, &bsp->dmodels[0], world_point));
 
-    auto &cfg = light_options;
+    auto &cfg = ctx.options;
 
     lightgrid_samples_t result;
 
@@ -3558,23 +4112,23 @@ lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_
      */
 
     /* positive lights */
-    for (const auto &entity : GetLights()) {
+    for (const auto &entity : ctx.all_lights) {
         if (entity->getFormula() == LF_LOCALMIN)
             continue;
         if (entity->nostaticlight.value())
             continue;
         if (entity->light.value() > 0)
-            LightPoint_Entity(bsp, rs, entity.get(), world_point, result);
+            LightPoint_Entity(ctx, bsp, rs, entity.get(), world_point, result);
     }
 
-    for (const sun_t &sun : GetSuns())
+    for (const sun_t &sun : ctx.all_suns)
         if (sun.sunlight > 0)
-            LightPoint_Sky(bsp, rsi, &sun, world_point, result);
+            LightPoint_Sky(ctx, bsp, rsi, &sun, world_point, result);
 
     // mxd. Add surface lights...
     // FIXME: negative surface lights
-    LightPoint_SurfaceLight(bsp, pvs, rs, GetSurfaceLights(), cfg.surflightscale.value(), cfg.surflightskyscale.value(),
-        16.0f, world_point, result);
+    LightPoint_SurfaceLight(ctx, bsp, pvs, rs, ctx.surfacelights, cfg.surflightscale.value(),
+        cfg.surflightskyscale.value(), 16.0f, world_point, result);
 
 #if 0
     // FIXME: port to lightgrid
@@ -3582,50 +4136,33 @@ lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_
     qvec3d minlight_color = cfg.minlight_color.value();
 
     if (minlight) {
-        LightFace_Min(bsp, face, minlight_color, minlight, &lightsurf, lightmaps, 0);
+        LightFace_Min(ctx, bsp, face, minlight_color, minlight, &lightsurf, lightmaps, 0);
     }
 
-    LightFace_LocalMin(bsp, face, &lightsurf, lightmaps);
+    LightFace_LocalMin(ctx, bsp, face, &lightsurf, lightmaps);
 #endif
 
     /* negative lights */
-    for (const auto &entity : GetLights()) {
+    for (const auto &entity : ctx.all_lights) {
         if (entity->getFormula() == LF_LOCALMIN)
             continue;
         if (entity->nostaticlight.value())
             continue;
         if (entity->light.value() < 0)
-            LightPoint_Entity(bsp, rs, entity.get(), world_point, result);
+            LightPoint_Entity(ctx, bsp, rs, entity.get(), world_point, result);
     }
-    for (const sun_t &sun : GetSuns())
+    for (const sun_t &sun : ctx.all_suns)
         if (sun.sunlight < 0)
-            LightPoint_Sky(bsp, rsi, &sun, world_point, result);
+            LightPoint_Sky(ctx, bsp, rsi, &sun, world_point, result);
 
     // from IndirectLightFace
 
     /* add bounce lighting */
     // note: scale here is just to keep it close-ish to the old code
-    LightPoint_SurfaceLight(bsp, pvs, rs, BounceLights(), cfg.bouncescale.value() * 0.5, cfg.bouncescale.value(),
+    LightPoint_SurfaceLight(ctx, bsp, pvs, rs, ctx.bouncelights, cfg.bouncescale.value() * 0.5, cfg.bouncescale.value(),
         128.0f, world_point, result);
 
-    LightPoint_ScaleAndClamp(result);
+    LightPoint_ScaleAndClamp(ctx, result);
 
     return result;
 }
-
-void ResetLtFace()
-{
-    total_light_rays = 0;
-    total_light_ray_hits = 0;
-    total_samplepoints = 0;
-
-    total_bounce_rays = 0;
-    total_bounce_ray_hits = 0;
-    total_surflight_rays = 0;
-    total_surflight_ray_hits = 0;
-
-    fully_transparent_lightmaps = 0;
-
-    warned_about_light_map_overflow = false;
-    warned_about_light_style_overflow = false;
-}
@@ -33,10 +33,15 @@
 #include <unordered_map>
 #include <set>
 #include <algorithm>
-#include <mutex>
+#include <atomic>
+#include <numeric>
 
 #include <common/qvec.hh>
+#include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
+#include <tbb/parallel_sort.h>
+
+#include <fmt/chrono.h>
 
 face_cache_t::face_cache_t(){};
 
@@ -177,81 +182,74 @@ static float AngleBetweenPoints(const qvec3f &p1, const qvec3f &p2, const qvec3f
     return result;
 }
 
-static bool s_builtPhongCaches;
-static std::unordered_map<const mface_t *, std::vector<face_normal_t>> vertex_normals;
-static std::map<const mface_t *, std::set<const mface_t *>> smoothFaces;
-static std::map<int, std::vector<const mface_t *>> vertsToFaces;
-static std::map<int, std::vector<const mface_t *>> planesToFaces;
-static edgeToFaceMap_t EdgeToFaceMap;
-static std::vector<face_cache_t> FaceCache;
-
-void ResetPhong()
+/**
+ * Per-face values used while building the smoothing groups and normals,
+ * computed once up front instead of for every neighbouring face.
+ */
+struct phong_face_t
 {
-    s_builtPhongCaches = false;
-    vertex_normals = {};
-    smoothFaces = {};
-    vertsToFaces = {};
-    planesToFaces = {};
-    EdgeToFaceMap = {};
-    FaceCache = {};
-}
+    const mtexinfo_t *texinfo;
+    // Q2 shading group
+    int phong_value;
+    // any face normal within this many degrees can be smoothed with this face
+    vec_t phong_angle, phong_angle_concave;
+    bool wants_phong;
+    qvec3d normal;
+    qplane3d plane;
+    qvec3f centroid;
+    float area;
+    std::tuple<qvec3f, qvec3f> tangents;
+};
 
-std::vector<const mface_t *> FacesUsingVert(int vertnum)
+/**
+ * A directed edge of a face; a directed edge can be used by more than one
+ * face, e.g. two cube touching just along an edge
+ */
+struct face_edge_t
 {
-    const auto &vertsToFaces_const = vertsToFaces;
+    int v0, v1;
+    const mface_t *face;
 
-    auto it = vertsToFaces_const.find(vertnum);
-    if (it != vertsToFaces_const.end())
-        return it->second;
-    return {};
-}
+    auto operator<=>(const face_edge_t &) const = default;
+};
 
-const edgeToFaceMap_t &GetEdgeToFaceMap()
+static size_t FaceIndex(light_context_t &ctx, const mface_t *face)
 {
-    Q_assert(s_builtPhongCaches);
-    return EdgeToFaceMap;
+    return face - ctx.phongBsp->dfaces.data();
 }
 
-// Uses `smoothFaces` static var
-bool FacesSmoothed(const mface_t *f1, const mface_t *f2)
+std::vector<const mface_t *> FacesUsingVert(light_context_t &ctx, int vertnum)
 {
-    Q_assert(s_builtPhongCaches);
-
-    const auto &facesIt = smoothFaces.find(f1);
-    if (facesIt == smoothFaces.end())
-        return false;
-
-    const std::set<const mface_t *> &faceSet = facesIt->second;
-    if (faceSet.find(f2) == faceSet.end())
-        return false;
+    if (vertnum < 0) {
+        return {};
+    }
 
-    return true;
+    const auto faces = ctx.vertsToFaces[vertnum];
+    return {faces.begin(), faces.end()};
 }
 
-const std::set<const mface_t *> &GetSmoothFaces(const mface_t *face)
+// Uses `smoothFaces` static var
+bool FacesSmoothed(light_context_t &ctx, const mface_t *f1, const mface_t *f2)
 {
-    Q_assert(s_builtPhongCaches);
-
-    static std::set<const mface_t *> empty;
-    const auto it = smoothFaces.find(face);
+    Q_assert(ctx.builtPhongCaches);
 
-    if (it == smoothFaces.end())
-        return empty;
-
-    return it->second;
+    // rows are sorted, since they're in face order
+    const auto faces = ctx.smoothFaces[FaceIndex(ctx, f1)];
+    return std::binary_search(faces.begin(), faces.end(), f2);
 }
 
-const std::vector<const mface_t *> &GetPlaneFaces(const mface_t *face)
+std::span<const mface_t *const> GetSmoothFaces(light_context_t &ctx, const mface_t *face)
 {
-    Q_assert(s_builtPhongCaches);
+    Q_assert(ctx.builtPhongCaches);
 
-    static std::vector<const mface_t *> empty;
-    const auto it = planesToFaces.find(face->planenum);
+    return ctx.smoothFaces[FaceIndex(ctx, face)];
+}
 
-    if (it == planesToFaces.end())
-        return empty;
+std::span<const mface_t *const> GetPlaneFaces(light_context_t &ctx, const mface_t *face)
+{
+    Q_assert(ctx.builtPhongCaches);
 
-    return it->second;
+    return ctx.planesToFaces[face->planenum];
 }
 
 // Adapted from https://github.com/NVIDIAGameWorks/donut/blob/main/src/engine/GltfImporter.cpp#L684
@@ -272,117 +270,113 @@ std::tuple<qvec3f, qvec3f> compute_tangents(
 }
 
 /* access the final phong-shaded vertex normal */
-const face_normal_t &GetSurfaceVertexNormal(const mbsp_t *bsp, const mface_t *f, const int vertindex)
+const face_normal_t &GetSurfaceVertexNormal(
+    light_context_t &ctx, const mbsp_t *bsp, const mface_t *f, const int vertindex)
 {
-    Q_assert(s_builtPhongCaches);
+    Q_assert(ctx.builtPhongCaches);
 
     // handle degenerate faces
-    const auto it = vertex_normals.find(f);
-    if (it == vertex_normals.end()) {
+    if (f->numedges < 3) {
         static const face_normal_t empty{};
         return empty;
     }
-    const auto &face_normals_vec = it->second;
-    return face_normals_vec.at(vertindex);
+
+    Q_assert(vertindex >= 0 && vertindex < f->numedges);
+    return ctx.vertex_normals[ctx.faceVertOffsets[FaceIndex(ctx, f)] + vertindex];
 }
 
-const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const int edgeindex)
+const mface_t *Face_EdgeIndexSmoothed(light_context_t &ctx, const mbsp_t *bsp, const mface_t *f, const int edgeindex)
 {
-    Q_assert(s_builtPhongCaches);
+    Q_assert(ctx.builtPhongCaches);
 
-    const int v0 = Face_VertexAtIndex(bsp, f, edgeindex);
-    const int v1 = Face_VertexAtIndex(bsp, f, (edgeindex + 1) % f->numedges);
-
-    auto it = EdgeToFaceMap.find(std::make_pair(v1, v0));
-    if (it != EdgeToFaceMap.end()) {
-        for (const mface_t *neighbour : it->second) {
-            if (neighbour == f) {
-                // Invalid face, e.g. with vertex numbers: [0, 1, 0, 2]
-                continue;
-            }
+    return ctx.edgeSmoothedFaces[ctx.faceVertOffsets[FaceIndex(ctx, f)] + edgeindex];
+}
 
-            const bool sameplane = (neighbour->planenum == f->planenum && neighbour->side == f->side);
+/**
+ * Builds a face_adjacency_t with `numkeys` rows. `keys_for_face(face, emit)`
+ * must call `emit(key)` for each key the face belongs to.
+ *
+ * Faces are counted and scattered into their rows in parallel, then each row
+ * is sorted back into face order so the result doesn't depend on scheduling.
+ */
+template<typename KeysForFace>
+static face_adjacency_t MakeFaceAdjacency(const mbsp_t *bsp, size_t numkeys, KeysForFace keys_for_face)
+{
+    std::vector<std::atomic<size_t>> cursors(numkeys);
 
-            // Check if these faces are smoothed or on the same plane
-            if (!(FacesSmoothed(f, neighbour) || sameplane)) {
-                continue;
-            }
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        keys_for_face(bsp->dfaces[i], [&](size_t key) { cursors[key].fetch_add(1, std::memory_order_relaxed); });
+    });
 
-            return neighbour;
-        }
+    face_adjacency_t result;
+    result.offsets.resize(numkeys + 1);
+    for (size_t key = 0; key < numkeys; key++) {
+        const size_t count = cursors[key].load(std::memory_order_relaxed);
+        cursors[key].store(result.offsets[key], std::memory_order_relaxed);
+        result.offsets[key + 1] = result.offsets[key] + count;
     }
-    return nullptr;
+    result.faces.resize(result.offsets[numkeys]);
 
-#if 0
-    if (smoothFaces.find(f) == smoothFaces.end()) {
-        return nullptr;
-    }
-    
-    int v0 = Face_VertexAtIndex(bsp, f, edgeindex);
-    int v1 = Face_VertexAtIndex(bsp, f, (edgeindex + 1) % f->numedges);
-    
-    const auto &v0_faces = vertsToFaces.at(v0);
-    const auto &v1_faces = vertsToFaces.at(v1);
-    
-    // find a face f2 that has both verts v0 and v1
-    for (auto f2 : v0_faces) {
-        if (f2 == f)
-            continue;
-        if (find(v1_faces.begin(), v1_faces.end(), f2) != v1_faces.end()) {
-            const auto &f_smoothfaces = smoothFaces.at(f);
-            bool smoothed = (f_smoothfaces.find(f2) != f_smoothfaces.end());
-            return smoothed ? f2 : nullptr;
-        }
-    }
-    return nullptr;
-#endif
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        const mface_t *face = &bsp->dfaces[i];
+        keys_for_face(*face, [&](size_t key) { result.faces[cursors[key]++] = face; });
+    });
+
+    tbb::parallel_for(static_cast<size_t>(0), numkeys, [&](size_t key) {
+        std::sort(result.faces.begin() + result.offsets[key], result.faces.begin() + result.offsets[key + 1]);
+    });
+
+    return result;
 }
 
-static edgeToFaceMap_t MakeEdgeToFaceMap(const mbsp_t *bsp)
+/**
+ * Returns every directed edge in the map, sorted by (v0, v1, face), so the
+ * faces using an edge can be found with a binary search.
+ */
+static std::vector<face_edge_t> MakeSortedFaceEdges(light_context_t &ctx, const mbsp_t *bsp)
 {
-    edgeToFaceMap_t result;
+    std::vector<face_edge_t> result(ctx.faceVertOffsets.back());
+
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        const mface_t *f = &bsp->dfaces[i];
 
-    for (auto &f : bsp->dfaces) {
         // walk edges
-        for (int j = 0; j < f.numedges; j++) {
-            const int v0 = Face_VertexAtIndex(bsp, &f, j);
-            const int v1 = Face_VertexAtIndex(bsp, &f, (j + 1) % f.numedges);
+        for (int j = 0; j < f->numedges; j++) {
+            const int v0 = Face_VertexAtIndex(bsp, f, j);
+            const int v1 = Face_VertexAtIndex(bsp, f, (j + 1) % f->numedges);
 
-            if (v0 == v1) {
-                // ad_swampy.bsp has faces with repeated verts...
-                continue;
-            }
+            result[ctx.faceVertOffsets[i] + j] = {v0, v1, f};
+        }
+    });
 
-            const auto edge = std::make_pair(v0, v1);
-            auto &edgeFacesRef = result[edge];
+    // ad_swampy.bsp has faces with repeated verts...
+    result.erase(std::remove_if(result.begin(), result.end(), [](const face_edge_t &e) { return e.v0 == e.v1; }),
+        result.end());
 
-            if (find(begin(edgeFacesRef), end(edgeFacesRef), &f) != end(edgeFacesRef)) {
-                // another sort of degenerate face where the same edge A->B appears more than once on the face
-                continue;
-            }
-            edgeFacesRef.push_back(&f);
-        }
-    }
+    tbb::parallel_sort(result.begin(), result.end());
+
+    // another sort of degenerate face where the same edge A->B appears more than once on the face
+    result.erase(std::unique(result.begin(), result.end()), result.end());
 
     return result;
 }
 
-static std::vector<face_normal_t> Face_VertexNormals(const mbsp_t *bsp, const mface_t *face)
+static std::vector<face_normal_t> Face_VertexNormals(light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
     std::vector<face_normal_t> normals(face->numedges);
-    tbb::parallel_for(0, face->numedges, [&](size_t i) { normals[i] = GetSurfaceVertexNormal(bsp, face, i); });
+    tbb::parallel_for(0, face->numedges, [&](size_t i) { normals[i] = GetSurfaceVertexNormal(ctx, bsp, face, i); });
     return normals;
 }
 
 #include <common/parallel.hh>
 
-static std::vector<face_cache_t> MakeFaceCache(const mbsp_t *bsp)
+static std::vector<face_cache_t> MakeFaceCache(light_context_t &ctx, const mbsp_t *bsp)
 {
     logging::funcheader();
     std::vector<face_cache_t> result(bsp->dfaces.size());
     logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
         auto &face = bsp->dfaces[i];
-        result[i] = face_cache_t(bsp, &bsp->dfaces[i], Face_VertexNormals(bsp, &face));
+        result[i] = face_cache_t(bsp, &bsp->dfaces[i], Face_VertexNormals(ctx, bsp, &face));
     });
     return result;
 }
@@ -391,13 +385,13 @@ static std::vector<face_cache_t> MakeFaceCache(const mbsp_t *bsp)
  * Q2: Returns nonzero if phong is requested on this face, in which case that is
  * the face tag to smooth with. Otherwise returns 0.
  */
-int Q2_FacePhongValue(const mbsp_t *bsp, const mface_t *face)
+int Q2_FacePhongValue(const light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
     const mtexinfo_t *texinfo = BSP_GetTexinfo(bsp, face->texinfo);
     if (texinfo != nullptr) {
         // FIXME: would be more convenient if common code loaded texinfo file
         // so we could access these in mtexinfo_t rather than extended_texinfo_flags
-        if (auto phong_group = extended_texinfo_flags[face->texinfo].phong_group) {
+        if (auto phong_group = ctx.extended_texinfo_flags[face->texinfo].phong_group) {
             // Q1 _phong_group syntax (also works in Q2 maps)
             return phong_group;
         }
@@ -421,260 +415,310 @@ inline bool isDegenerate(const qvec3f &a, const qvec3f &b, const qvec3f &c)
     return false;
 }
 
-void CalculateVertexNormals(const mbsp_t *bsp)
+static phong_face_t MakePhongFace(light_context_t &ctx, const mbsp_t *bsp, const mface_t *f)
 {
-    logging::funcheader();
+    phong_face_t result;
 
-    Q_assert(!s_builtPhongCaches);
-    s_builtPhongCaches = true;
+    result.texinfo = Face_Texinfo(bsp, f);
+    result.phong_value = Q2_FacePhongValue(ctx, bsp, f);
 
-    EdgeToFaceMap = MakeEdgeToFaceMap(bsp);
+    result.phong_angle = ctx.extended_texinfo_flags[f->texinfo].phong_angle;
+    if (result.phong_angle == 0 && result.phong_value != 0) {
+        // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
+        result.phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
+    }
+    result.phong_angle_concave = ctx.extended_texinfo_flags[f->texinfo].phong_angle_concave;
+    if (result.phong_angle_concave == 0) {
+        result.phong_angle_concave = result.phong_angle;
+    }
+    result.wants_phong = (result.phong_angle || result.phong_angle_concave) &&
+                         !ctx.extended_texinfo_flags[f->texinfo].no_phong;
 
-    // read _phong and _phong_angle from entities for compatibility with other qbsp's, at the expense of no
-    // support on func_detail/func_group
-    for (size_t i = 0; i < bsp->dmodels.size(); i++) {
-        const modelinfo_t *info = ModelInfoForModel(bsp, i);
-        const uint8_t phongangle_byte = (uint8_t)std::clamp((int)rint(info->getResolvedPhongAngle()), 0, 255);
+    const auto points = Face_Points(bsp, f);
+    result.normal = Face_Normal(bsp, f);
+    result.plane = Face_Plane(bsp, f);
+    result.centroid = qv::PolyCentroid(points.begin(), points.end());
+    result.area = qv::PolyArea(points.begin(), points.end());
 
-        if (!phongangle_byte)
-            continue;
+    // face tangent
+    auto t = TexSpaceToWorld(bsp, f);
+    result.tangents = {t.col(0).xyz(), qv::normalize(t.col(1).xyz())};
 
-        for (int j = info->model->firstface; j < info->model->firstface + info->model->numfaces; j++) {
-            const mface_t *f = BSP_GetFace(bsp, j);
+    return result;
+}
 
-            extended_texinfo_flags[f->texinfo].phong_angle = phongangle_byte;
-        }
-    }
+/**
+ * Returns the faces sharing a vertex with `f` that it should be smoothed
+ * with, in face order.
+ */
+static std::vector<const mface_t *> FindSmoothFaces(
+    light_context_t &ctx, const mbsp_t *bsp, const std::vector<phong_face_t> &phong_faces, const mface_t *f)
+{
+    std::vector<const mface_t *> result;
 
-    for (auto &f : bsp->dfaces) {
-        // build "plane -> faces" map
-        planesToFaces[f.planenum].push_back(&f);
+    const phong_face_t &fp = phong_faces[FaceIndex(ctx, f)];
 
-        // build "vert index -> faces" map
-        for (size_t j = 0; j < f.numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, &f, j);
-            vertsToFaces[v].push_back(&f);
-        }
-    }
+    if (!fp.wants_phong)
+        return result;
 
-    // build the "face -> faces to smooth with" map
-    for (auto &f : bsp->dfaces) {
-        // Q2 shading groups
-        const int f_phongValue = Q2_FacePhongValue(bsp, &f);
-
-        // Q1 phong angle stuff
-        auto *f_texinfo = Face_Texinfo(bsp, &f);
-        const auto f_points = Face_Points(bsp, &f);
-        const qvec3d f_norm = Face_Normal(bsp, &f);
-        const qplane3d f_plane = Face_Plane(bsp, &f);
-
-        // any face normal within this many degrees can be smoothed with this face
-        vec_t f_phong_angle = extended_texinfo_flags[f.texinfo].phong_angle;
-        if (f_phong_angle == 0 && f_phongValue != 0) {
-            // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-            f_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-        }
-        vec_t f_phong_angle_concave = extended_texinfo_flags[f.texinfo].phong_angle_concave;
-        if (f_phong_angle_concave == 0) {
-            f_phong_angle_concave = f_phong_angle;
+    for (int j = 0; j < f->numedges; j++) {
+        const int v = Face_VertexAtIndex(bsp, f, j);
+        // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
+        for (const mface_t *f2 : ctx.vertsToFaces[v]) {
+            if (f2 == f)
+                continue;
+
+            const phong_face_t &f2p = phong_faces[FaceIndex(ctx, f2)];
+
+            if (!f2p.wants_phong)
+                continue;
+
+            if (f2p.texinfo != nullptr && fp.texinfo != nullptr) {
+                if (!bsp->loadversion->game->surfflags_may_phong(fp.texinfo->flags, f2p.texinfo->flags)) {
+                    // phong may be blocked by the gamedef, e.g. warping and non-warping never phong
+                    continue;
+                }
+            }
+
+            if (fp.phong_value != f2p.phong_value) {
+                // mismatched smoothing groups never phong
+                continue;
+            }
+
+            const vec_t cosangle = qv::dot(fp.normal, f2p.normal);
+
+            const bool concave = fp.plane.dist_above(f2p.centroid) > 0.1;
+            const vec_t f_threshold = concave ? fp.phong_angle_concave : fp.phong_angle;
+            const vec_t f2_threshold = concave ? f2p.phong_angle_concave : f2p.phong_angle;
+            const vec_t min_threshold = std::min(f_threshold, f2_threshold);
+            const vec_t cosmaxangle = cos(DEG2RAD(min_threshold));
+
+            // check the angle between the face normals
+            if (cosangle >= cosmaxangle) {
+                result.push_back(f2);
+            }
         }
-        const bool f_wants_phong = (f_phong_angle || f_phong_angle_concave);
+    }
 
-        if (!f_wants_phong)
-            continue;
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
 
-        if (extended_texinfo_flags[f.texinfo].no_phong)
-            continue;
+    return result;
+}
 
+static void CalculateFaceVertexNormals(
+    light_context_t &ctx, const mbsp_t *bsp, const std::vector<phong_face_t> &phong_faces, const mface_t &f)
+{
+    if (f.numedges < 3) {
+        logging::funcprint("face {} is degenerate with {} edges\n", Face_GetNum(bsp, &f), f.numedges);
         for (int j = 0; j < f.numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, &f, j);
-            // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
-            for (const mface_t *f2 : vertsToFaces[v]) {
-                if (f2 == &f)
-                    continue;
+            logging::print("                         vert at {}\n", Face_PointAtIndex(bsp, &f, j));
+        }
+        return;
+    }
 
-                // FIXME: factor out and share with above?
-                const int f2_phongValue = Q2_FacePhongValue(bsp, f2);
-                vec_t f2_phong_angle = extended_texinfo_flags[f2->texinfo].phong_angle;
-                if (f2_phong_angle == 0 && f2_phongValue != 0) {
-                    // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-                    f2_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-                }
-                vec_t f2_phong_angle_concave = extended_texinfo_flags[f2->texinfo].phong_angle_concave;
-                if (f2_phong_angle_concave == 0) {
-                    f2_phong_angle_concave = f2_phong_angle;
-                }
-                const bool f2_wants_phong = (f2_phong_angle || f2_phong_angle_concave);
+    const phong_face_t &fp = phong_faces[FaceIndex(ctx, &f)];
+    const qvec3f f_norm = fp.normal; // get the face normal
+    const auto &tangents = fp.tangents;
 
-                if (!f2_wants_phong)
-                    continue;
+    // global vertex index -> smoothed normal
+    std::unordered_map<int, face_normal_t> smoothedNormals;
 
-                if (extended_texinfo_flags[f2->texinfo].no_phong)
-                    continue;
+    // walk f and the faces it's smoothed with
+    auto accumulate = [&](const mface_t *f2) {
+        const phong_face_t &f2p = phong_faces[FaceIndex(ctx, f2)];
+        const float f2_area = f2p.area;
+        const qvec3f f2_norm = f2p.normal;
+        const auto &f2_tangents = f2p.tangents;
 
-                auto *f2_texinfo = Face_Texinfo(bsp, f2);
-                if (f2_texinfo != nullptr && f_texinfo != nullptr) {
-                    if (!bsp->loadversion->game->surfflags_may_phong(f_texinfo->flags, f2_texinfo->flags)) {
-                        // phong may be blocked by the gamedef, e.g. warping and non-warping never phong
-                        continue;
-                    }
-                }
+        // walk the vertices of f2, and add their contribution to smoothedNormals
+        for (int j = 0; j < f2->numedges; j++) {
+            const int prev_vert_num = Face_VertexAtIndex(bsp, f2, ((j - 1) + f2->numedges) % f2->numedges);
+            const int curr_vert_num = Face_VertexAtIndex(bsp, f2, j);
+            const int next_vert_num = Face_VertexAtIndex(bsp, f2, (j + 1) % f2->numedges);
 
-                const auto f2_points = Face_Points(bsp, f2);
-                const qvec3f f2_centroid = qv::PolyCentroid(f2_points.begin(), f2_points.end());
-                const qvec3d f2_norm = Face_Normal(bsp, f2);
+            const qvec3f &prev_vert_pos = Vertex_GetPos(bsp, prev_vert_num);
+            const qvec3f &curr_vert_pos = Vertex_GetPos(bsp, curr_vert_num);
+            const qvec3f &next_vert_pos = Vertex_GetPos(bsp, next_vert_num);
 
-                const vec_t cosangle = qv::dot(f_norm, f2_norm);
+            const float angle_radians = AngleBetweenPoints(prev_vert_pos, curr_vert_pos, next_vert_pos);
 
-                const bool concave = f_plane.dist_above(f2_centroid) > 0.1;
-                const vec_t f_threshold = concave ? f_phong_angle_concave : f_phong_angle;
-                const vec_t f2_threshold = concave ? f2_phong_angle_concave : f2_phong_angle;
-                const vec_t min_threshold = std::min(f_threshold, f2_threshold);
-                const vec_t cosmaxangle = cos(DEG2RAD(min_threshold));
+            float weight = f2_area * angle_radians;
+            if (!std::isfinite(weight)) {
+                // TODO: not sure if needed?
+                weight = 0;
+            }
 
-                if (f_phongValue != f2_phongValue) {
-                    // mismatched smoothing groups never phong
-                    continue;
-                }
+            auto &n = smoothedNormals[curr_vert_num];
+            n.normal += f2_norm * weight;
+            n.tangent += std::get<0>(f2_tangents) * weight;
+            n.bitangent += std::get<1>(f2_tangents) * weight;
+        }
+    };
 
-                // check the angle between the face normals
-                if (cosangle >= cosmaxangle) {
-                    smoothFaces[&f].insert(f2);
-                }
+    accumulate(&f);
+    for (const mface_t *f2 : ctx.smoothFaces[FaceIndex(ctx, &f)]) {
+        accumulate(f2);
+    }
+
+    // normalize vertex normals (NOTE: updates smoothedNormals map)
+    for (auto &pair : smoothedNormals) {
+        face_normal_t &vertNormal = pair.second;
+        if (0 == qv::length(vertNormal.normal)) {
+            // this happens when there are colinear vertices, which give zero-area triangles,
+            // so there is no contribution to the normal of the triangle in the middle of the
+            // line. Not really an error, just set it to use the face normal.
+            vertNormal = {f_norm, std::get<0>(tangents), std::get<1>(tangents)};
+        } else {
+            vertNormal = {qv::normalize(vertNormal.normal), qv::normalize(vertNormal.tangent),
+                qv::normalize(vertNormal.bitangent)};
+        }
+
+        // FIXME: why
+        if (std::isnan(vertNormal.tangent[0])) {
+            vertNormal.tangent = std::get<0>(tangents);
+            if (std::isnan(vertNormal.tangent[0])) {
+                vertNormal.tangent = {0, 0, 0};
+            }
+        }
+        if (std::isnan(vertNormal.bitangent[0])) {
+            vertNormal.bitangent = std::get<1>(tangents);
+            if (std::isnan(vertNormal.bitangent[0])) {
+                vertNormal.bitangent = {0, 0, 0};
             }
         }
     }
 
-    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n", smoothFaces.size());
+    // now, record all of the smoothed normals that are actually part of `f`
+    face_normal_t *out = ctx.vertex_normals.data() + ctx.faceVertOffsets[FaceIndex(ctx, &f)];
+    for (int j = 0; j < f.numedges; j++) {
+        int v = Face_VertexAtIndex(bsp, &f, j);
+        Q_assert(smoothedNormals.find(v) != smoothedNormals.end());
 
-    // finally do the smoothing for each face
-    std::mutex normalsMutex;
+        out[j] = smoothedNormals[v];
+    }
+}
 
-    logging::parallel_for_each(bsp->dfaces, [bsp, &normalsMutex](const mface_t &f) {
-        if (f.numedges < 3) {
-            logging::funcprint("face {} is degenerate with {} edges\n", Face_GetNum(bsp, &f), f.numedges);
-            for (int j = 0; j < f.numedges; j++) {
-                logging::print("                         vert at {}\n", Face_PointAtIndex(bsp, &f, j));
-            }
-            return;
+void CalculateVertexNormals(light_context_t &ctx, const mbsp_t *bsp)
+{
+    logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
+
+    Q_assert(!ctx.builtPhongCaches);
+    ctx.builtPhongCaches = true;
+    ctx.phongBsp = bsp;
+
+    const auto start = I_FloatTime();
+
+    // read _phong and _phong_angle from entities for compatibility with other qbsp's, at the expense of no
+    // support on func_detail/func_group
+    for (size_t i = 0; i < bsp->dmodels.size(); i++) {
+        const modelinfo_t *info = ModelInfoForModel(ctx, bsp, i);
+        const uint8_t phongangle_byte = (uint8_t)std::clamp((int)rint(info->getResolvedPhongAngle()), 0, 255);
+
+        if (!phongangle_byte)
+            continue;
+
+        for (int j = info->model->firstface; j < info->model->firstface + info->model->numfaces; j++) {
+            const mface_t *f = BSP_GetFace(bsp, j);
+
+            ctx.extended_texinfo_flags[f->texinfo].phong_angle = phongangle_byte;
         }
+    }
 
-        const qvec3f f_norm = Face_Normal(bsp, &f); // get the face normal
+    // per-face-vertex arrays are laid out in face order
+    ctx.faceVertOffsets.resize(bsp->dfaces.size() + 1);
+    ctx.faceVertOffsets[0] = 0;
+    std::transform_inclusive_scan(bsp->dfaces.begin(), bsp->dfaces.end(), ctx.faceVertOffsets.begin() + 1,
+        std::plus<size_t>(), [](const mface_t &f) { return static_cast<size_t>(std::max(f.numedges, 0)); });
 
-        // face tangent
-        auto t1 = TexSpaceToWorld(bsp, &f);
-        std::tuple<qvec3f, qvec3f> tangents(t1.col(0).xyz(), qv::normalize(t1.col(1).xyz()));
+    std::vector<phong_face_t> phong_faces(bsp->dfaces.size());
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+        [&](size_t i) { phong_faces[i] = MakePhongFace(ctx, bsp, &bsp->dfaces[i]); });
 
-        // gather up f and neighboursToSmooth
-        std::vector<const mface_t *> fPlusNeighbours;
-        fPlusNeighbours.push_back(&f);
-        auto neighboursIt = smoothFaces.find(&f);
+    // build "plane -> faces" map
+    ctx.planesToFaces = MakeFaceAdjacency(
+        bsp, bsp->dplanes.size(), [](const mface_t &f, auto &&emit) { emit(f.planenum); });
 
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            std::copy(neighboursToSmooth.begin(), neighboursToSmooth.end(), std::back_inserter(fPlusNeighbours));
+    // build "vert index -> faces" map
+    ctx.vertsToFaces = MakeFaceAdjacency(bsp, bsp->dvertexes.size(), [bsp](const mface_t &f, auto &&emit) {
+        for (size_t j = 0; j < f.numedges; j++) {
+            emit(Face_VertexAtIndex(bsp, &f, j));
         }
+    });
 
-        // global vertex index -> smoothed normal
-        std::unordered_map<int, face_normal_t> smoothedNormals;
+    // build the "face -> faces to smooth with" map
+    {
+        std::vector<std::vector<const mface_t *>> rows(bsp->dfaces.size());
+        tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+            [&](size_t i) { rows[i] = FindSmoothFaces(ctx, bsp, phong_faces, &bsp->dfaces[i]); });
+
+        ctx.smoothFaces.offsets.resize(bsp->dfaces.size() + 1);
+        ctx.smoothFaces.offsets[0] = 0;
+        std::transform_inclusive_scan(rows.begin(), rows.end(), ctx.smoothFaces.offsets.begin() + 1,
+            std::plus<size_t>(), [](const std::vector<const mface_t *> &row) { return row.size(); });
+
+        ctx.smoothFaces.faces.resize(ctx.smoothFaces.offsets.back());
+        tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+            std::copy(rows[i].begin(), rows[i].end(), ctx.smoothFaces.faces.begin() + ctx.smoothFaces.offsets[i]);
+        });
+    }
 
-        // walk fPlusNeighbours
-        for (auto f2 : fPlusNeighbours) {
-            const auto f2_poly = Face_Points(bsp, f2);
-            const float f2_area = qv::PolyArea(f2_poly.begin(), f2_poly.end());
-            const qvec3f f2_norm = Face_Normal(bsp, f2);
+    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n",
+        std::count_if(bsp->dfaces.begin(), bsp->dfaces.end(),
+            [&ctx](const mface_t &f) { return !GetSmoothFaces(ctx, &f).empty(); }));
 
-            // f2 face tangent
-            auto t2 = TexSpaceToWorld(bsp, f2);
-            std::tuple<qvec3f, qvec3f> f2_tangents(t2.col(0).xyz(), qv::normalize(t2.col(1).xyz()));
+    // for each face edge, find the neighbour across it that is smoothed with the face
+    {
+        const std::vector<face_edge_t> edges = MakeSortedFaceEdges(ctx, bsp);
 
-            // walk the vertices of f2, and add their contribution to smoothedNormals
-            for (int j = 0; j < f2->numedges; j++) {
-                const int prev_vert_num = Face_VertexAtIndex(bsp, f2, ((j - 1) + f2->numedges) % f2->numedges);
-                const int curr_vert_num = Face_VertexAtIndex(bsp, f2, j);
-                const int next_vert_num = Face_VertexAtIndex(bsp, f2, (j + 1) % f2->numedges);
+        ctx.edgeSmoothedFaces.assign(ctx.faceVertOffsets.back(), nullptr);
 
-                const qvec3f &prev_vert_pos = Vertex_GetPos(bsp, prev_vert_num);
-                const qvec3f &curr_vert_pos = Vertex_GetPos(bsp, curr_vert_num);
-                const qvec3f &next_vert_pos = Vertex_GetPos(bsp, next_vert_num);
+        tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+            const mface_t *f = &bsp->dfaces[i];
 
-                const float angle_radians = AngleBetweenPoints(prev_vert_pos, curr_vert_pos, next_vert_pos);
+            for (int j = 0; j < f->numedges; j++) {
+                const int v0 = Face_VertexAtIndex(bsp, f, j);
+                const int v1 = Face_VertexAtIndex(bsp, f, (j + 1) % f->numedges);
 
-                float weight = f2_area * angle_radians;
-                if (!std::isfinite(weight)) {
-                    // TODO: not sure if needed?
-                    weight = 0;
-                }
+                // faces using the reverse edge
+                auto first = std::lower_bound(edges.begin(), edges.end(), face_edge_t{v1, v0, nullptr});
 
-                auto &n = smoothedNormals[curr_vert_num];
-                n.normal += f2_norm * weight;
-                n.tangent += std::get<0>(f2_tangents) * weight;
-                n.bitangent += std::get<1>(f2_tangents) * weight;
-            }
-        }
+                for (auto it = first; it != edges.end() && it->v0 == v1 && it->v1 == v0; ++it) {
+                    const mface_t *neighbour = it->face;
 
-        // normalize vertex normals (NOTE: updates smoothedNormals map)
-        for (auto &pair : smoothedNormals) {
-            face_normal_t &vertNormal = pair.second;
-            if (0 == qv::length(vertNormal.normal)) {
-                // this happens when there are colinear vertices, which give zero-area triangles,
-                // so there is no contribution to the normal of the triangle in the middle of the
-                // line. Not really an error, just set it to use the face normal.
-#if 0
-                const int vertIndex = pair.first;
-                logging::print("Failed to calculate normal for vertex {} at ({} {} {})\n",
-                         vertIndex,
-                         bsp->dvertexes[vertIndex].point[0],
-                         bsp->dvertexes[vertIndex].point[1],
-                         bsp->dvertexes[vertIndex].point[2]);
-#endif
-                vertNormal = {f_norm, std::get<0>(tangents), std::get<1>(tangents)};
-            } else {
-                vertNormal = {qv::normalize(vertNormal.normal), qv::normalize(vertNormal.tangent),
-                    qv::normalize(vertNormal.bitangent)};
-            }
+                    if (neighbour == f) {
+                        // Invalid face, e.g. with vertex numbers: [0, 1, 0, 2]
+                        continue;
+                    }
 
-            // FIXME: why
-            if (std::isnan(vertNormal.tangent[0])) {
-                vertNormal.tangent = std::get<0>(tangents);
-                if (std::isnan(vertNormal.tangent[0])) {
-                    vertNormal.tangent = {0, 0, 0};
-                }
-            }
-            if (std::isnan(vertNormal.bitangent[0])) {
-                vertNormal.bitangent = std::get<1>(tangents);
-                if (std::isnan(vertNormal.bitangent[0])) {
-                    vertNormal.bitangent = {0, 0, 0};
-                }
-            }
-        }
+                    const bool sameplane = (neighbour->planenum == f->planenum && neighbour->side == f->side);
 
-        // sanity check
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            if (!neighboursToSmooth.size()) {
-                for (auto &vertIndexNormalPair : smoothedNormals) {
-                    Q_assert(qv::epsilonEqual(vertIndexNormalPair.second.normal, f_norm, (float)LIGHT_EQUAL_EPSILON));
+                    // Check if these faces are smoothed or on the same plane
+                    if (!(FacesSmoothed(ctx, f, neighbour) || sameplane)) {
+                        continue;
+                    }
+
+                    ctx.edgeSmoothedFaces[ctx.faceVertOffsets[i] + j] = neighbour;
+                    break;
                 }
             }
-        }
+        });
+    }
 
-        // now, record all of the smoothed normals that are actually part of `f`
-        for (int j = 0; j < f.numedges; j++) {
-            int v = Face_VertexAtIndex(bsp, &f, j);
-            Q_assert(smoothedNormals.find(v) != smoothedNormals.end());
+    // finally do the smoothing for each face
+    ctx.vertex_normals.assign(ctx.faceVertOffsets.back(), face_normal_t{});
 
-            normalsMutex.lock();
-            vertex_normals[&f].push_back(smoothedNormals[v]);
-            normalsMutex.unlock();
-        }
-    });
+    logging::parallel_for_each(bsp->dfaces,
+        [&ctx, bsp, &phong_faces](const mface_t &f) { CalculateFaceVertexNormals(ctx, bsp, phong_faces, f); });
+
+    logging::print("phong setup: {:.3}\n", I_FloatTime() - start);
 
-    FaceCache = MakeFaceCache(bsp);
+    ctx.FaceCache = MakeFaceCache(ctx, bsp);
 }
 
-const face_cache_t &FaceCacheForFNum(int fnum)
+const face_cache_t &FaceCacheForFNum(light_context_t &ctx, int fnum)
 {
-    Q_assert(s_builtPhongCaches);
-    return FaceCache.at(fnum);
+    Q_assert(ctx.builtPhongCaches);
+    return ctx.FaceCache.at(fnum);
 }
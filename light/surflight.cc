@@ -33,42 +33,20 @@ See file, 'COPYING', for details.
 
 #include <vector>
 #include <map>
-#include <mutex>
 
 #include <common/qvec.hh>
 
-static std::mutex surfacelights_lock;
-static std::vector<surfacelight_t> surfacelights;
-static std::map<int, std::vector<int>> surfacelightsByFacenum;
-static size_t total_surflight_points = 0;
+int LightStyleForTargetname(light_context_t &ctx, const settings::worldspawn_keys &cfg, const std::string &targetname);
 
-void ResetSurflight()
-{
-    surfacelights = {};
-    surfacelightsByFacenum = {};
-    total_surflight_points = {};
-}
-
-std::vector<surfacelight_t> &GetSurfaceLights()
-{
-    return surfacelights;
-}
-
-size_t GetSurflightPoints()
-{
-    return total_surflight_points;
-}
-
-int LightStyleForTargetname(const settings::worldspawn_keys &cfg, const std::string &targetname);
-
-static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, const mface_t *face,
-    std::optional<qvec3f> texture_color, bool is_directional, bool is_sky, int32_t style, int32_t light_value)
+static void MakeSurfaceLight(light_context_t &ctx, const mbsp_t *bsp, const settings::worldspawn_keys &cfg,
+    const mface_t *face, std::optional<qvec3f> texture_color, bool is_directional, bool is_sky, int32_t style,
+    int32_t light_value, std::vector<surfacelight_t> &out)
 {
     // Create face points...
     auto poly = Face_Points(bsp, face);
     const float facearea = qv::PolyArea(poly.begin(), poly.end());
 
-    const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+    const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
 
     // Avoid small, or zero-area faces
     if (facearea < 1)
@@ -76,7 +54,7 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
 
     // Create winding...
     polylib::winding_t winding = polylib::winding_t::from_winding_points(poly);
-    auto face_modelinfo = ModelInfoForFace(bsp, face - bsp->dfaces.data());
+    auto face_modelinfo = ModelInfoForFace(ctx, bsp, face - bsp->dfaces.data());
 
     for (auto &pt : winding) {
         pt += face_modelinfo->offset;
@@ -119,7 +97,7 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
                 // FIXME: we require value to be nonzero, see the check above - not sure if this matches arghrad
                 texture_color = cfg.sky_surface.value() * 255.0;
             } else {
-                texture_color = qvec3f(Face_LookupTextureColor(bsp, face));
+                texture_color = qvec3f(Face_LookupTextureColor(ctx, bsp, face));
             }
         }
     }
@@ -147,7 +125,7 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
     l.omnidirectional = !is_directional;
     l.points = std::move(points);
     if (extended_flags.surflight_targetname) {
-        l.style = LightStyleForTargetname(cfg, extended_flags.surflight_targetname.value());
+        l.style = LightStyleForTargetname(ctx, cfg, extended_flags.surflight_targetname.value());
     } else if (extended_flags.surflight_style) {
         l.style = extended_flags.surflight_style.value();
     } else {
@@ -157,15 +135,15 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
     l.minlight_scale = extended_flags.surflight_minlight_scale;
 
         // Init bbox...
-        if (light_options.visapprox.value() == visapprox_t::RAYS) {
-        l.bounds = EstimateVisibleBoundsAtPoint(facemidpoint);
+        if (ctx.options.visapprox.value() == visapprox_t::RAYS) {
+        l.bounds = EstimateVisibleBoundsInLeaf(ctx, bsp, facemidpoint);
         }
 
     for (auto &pt : l.points) {
-            if (light_options.visapprox.value() == visapprox_t::VIS) {
+            if (ctx.options.visapprox.value() == visapprox_t::VIS) {
             l.leaves.push_back(Light_PointInLeaf(bsp, pt));
-            } else if (light_options.visapprox.value() == visapprox_t::RAYS) {
-            l.bounds += EstimateVisibleBoundsAtPoint(pt);
+            } else if (ctx.options.visapprox.value() == visapprox_t::RAYS) {
+            l.bounds += EstimateVisibleBoundsInLeaf(ctx, bsp, pt);
             }
         }
 
@@ -177,30 +155,27 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
     l.color = texture_color.value();
 
     // Store light...
-    std::unique_lock<std::mutex> lck{surfacelights_lock};
-    total_surflight_points += l.points.size();
-    surfacelights.push_back(l);
-
-    const int index = static_cast<int>(surfacelights.size()) - 1;
-    surfacelightsByFacenum[Face_GetNum(bsp, face)].push_back(index);
+    out.push_back(std::move(l));
 }
 
-std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(const mbsp_t *bsp, const mface_t *face)
+std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(
+    light_context_t &ctx, const mbsp_t *bsp, const mface_t *face)
 {
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
         // first, check if it's a Q2 surface
         const mtexinfo_t *info = Face_Texinfo(bsp, face);
 
         if (info != nullptr && (info->flags.native & Q2_SURF_LIGHT) && info->value > 0) {
-            return std::make_tuple(info->value, 0, qvec3d(Face_LookupTextureColor(bsp, face)), nullptr);
+            return std::make_tuple(info->value, 0, qvec3d(Face_LookupTextureColor(ctx, bsp, face)), nullptr);
         }
     }
 
-    for (const auto &surflight : GetSurfaceLightTemplates()) {
-        if (FaceMatchesSurfaceLightTemplate(
-                bsp, face, ModelInfoForFace(bsp, face - bsp->dfaces.data()), *surflight, SURFLIGHT_RAD)) {
+    for (const auto &surflight : ctx.surfacelight_templates) {
+        if (FaceMatchesSurfaceLightTemplate(ctx, bsp, face, ModelInfoForFace(ctx, bsp, face - bsp->dfaces.data()),
+            *surflight, SURFLIGHT_RAD)) {
             return std::make_tuple(surflight->light.value(), surflight->style.value(),
-                surflight->color.is_changed() ? surflight->color.value() : qvec3d(Face_LookupTextureColor(bsp, face)),
+                surflight->color.is_changed() ? surflight->color.value()
+                                              : qvec3d(Face_LookupTextureColor(ctx, bsp, face)),
                 surflight.get());
         }
     }
@@ -208,7 +183,8 @@ std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(
     return std::nullopt;
 }
 
-static void MakeSurfaceLightsThread(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, size_t i)
+static void MakeSurfaceLightsThread(light_context_t &ctx, const mbsp_t *bsp, const settings::worldspawn_keys &cfg,
+    size_t i, std::vector<surfacelight_t> &out)
 {
     const mface_t *face = BSP_GetFace(bsp, i);
 
@@ -226,36 +202,36 @@ static void MakeSurfaceLightsThread(const mbsp_t *bsp, const settings::worldspaw
                         "WARNING: surface light '{}' at [{}] has 0 intensity.\n", Face_TextureName(bsp, face), wc);
                 }
             } else {
-                MakeSurfaceLight(bsp, cfg, face, std::nullopt, !(info->flags.native & Q2_SURF_SKY),
-                    (info->flags.native & Q2_SURF_SKY), 0, info->value);
+                MakeSurfaceLight(ctx, bsp, cfg, face, std::nullopt, !(info->flags.native & Q2_SURF_SKY),
+                    (info->flags.native & Q2_SURF_SKY), 0, info->value, out);
             }
         }
     }
 
     // check matching templates
-    for (const auto &surflight : GetSurfaceLightTemplates()) {
-        if (FaceMatchesSurfaceLightTemplate(
-                bsp, face, ModelInfoForFace(bsp, face - bsp->dfaces.data()), *surflight, SURFLIGHT_RAD)) {
+    for (const auto &surflight : ctx.surfacelight_templates) {
+        if (FaceMatchesSurfaceLightTemplate(ctx, bsp, face, ModelInfoForFace(ctx, bsp, face - bsp->dfaces.data()),
+            *surflight, SURFLIGHT_RAD)) {
             std::optional<qvec3f> texture_color;
 
             if (surflight->color.is_changed()) {
                 texture_color = surflight->color.value();
             }
 
-            MakeSurfaceLight(bsp, cfg, face, texture_color,
+            MakeSurfaceLight(ctx, bsp, cfg, face, texture_color,
                 !surflight->epairs->has("_surface_spotlight") ? true
                                                               : !!surflight->epairs->get_int("_surface_spotlight"),
                 surflight->epairs->get_int("_surface_is_sky"), surflight->epairs->get_int("style"),
-                surflight->light.value());
+                surflight->light.value(), out);
         }
     }
 }
 
 // No surflight_debug (yet?), so unused...
-const std::vector<int> &SurfaceLightsForFaceNum(int facenum)
+const std::vector<int> &SurfaceLightsForFaceNum(light_context_t &ctx, int facenum)
 {
-    const auto &vec = surfacelightsByFacenum.find(facenum);
-    if (vec != surfacelightsByFacenum.end())
+    const auto &vec = ctx.surfacelightsByFacenum.find(facenum);
+    if (vec != ctx.surfacelightsByFacenum.end())
         return vec->second;
 
     static std::vector<int> empty;
@@ -263,14 +239,27 @@ const std::vector<int> &SurfaceLightsForFaceNum(int facenum)
 }
 
 void // Quake 2 surface lights
-MakeRadiositySurfaceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
+MakeRadiositySurfaceLights(light_context_t &ctx, const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 {
     logging::funcheader();
 
-    logging::parallel_for(
-        static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) { MakeSurfaceLightsThread(bsp, cfg, i); });
+    // each face fills its own slot, then the slots are concatenated in face order, so light
+    // indices (and the order surface light is accumulated in) don't depend on thread scheduling
+    std::vector<std::vector<surfacelight_t>> lights_by_face(bsp->dfaces.size());
+
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+        [&](size_t i) { MakeSurfaceLightsThread(ctx, bsp, cfg, i, lights_by_face[i]); });
+
+    for (size_t i = 0; i < lights_by_face.size(); i++) {
+        for (auto &l : lights_by_face[i]) {
+            ctx.total_surflight_points += l.points.size();
+            ctx.surfacelightsByFacenum[i].push_back(static_cast<int>(ctx.surfacelights.size()));
+            ctx.surfacelights.push_back(std::move(l));
+        }
+    }
 
-    if (surfacelights.size()) {
-        logging::print("{} surface lights ({} light points) in use.\n", surfacelights.size(), total_surflight_points);
+    if (ctx.surfacelights.size()) {
+        logging::print("{} surface lights ({} light points) in use.\n", ctx.surfacelights.size(),
+            ctx.total_surflight_points);
 }
 }
@@ -24,44 +24,22 @@
 
 #include <common/bsputils.hh>
 #include <common/polylib.hh>
+#include <algorithm>
 #include <vector>
 #include <climits>
 
-sceneinfo skygeom; // sky. always occludes.
-sceneinfo solidgeom; // solids. always occludes.
-sceneinfo filtergeom; // conditional occluders.. needs to run ray intersection filter
-
-static RTCDevice device;
-RTCScene scene;
-
-static const mbsp_t *bsp_static;
-
-void ResetEmbree()
-{
-    skygeom = {};
-    solidgeom = {};
-    filtergeom = {};
-
-    if (scene) {
-        rtcReleaseScene(scene);
-        scene = nullptr;
-    }
-
-    if (device) {
-        rtcReleaseDevice(device);
-        device = nullptr;
-    }
-
-    bsp_static = nullptr;
-}
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
 
 /**
  * Returns 1.0 unless a custom alpha value is set.
  * The priority is: "_light_alpha" (read from extended_texinfo_flags), then "alpha", then Q2 surface flags
  */
-static float Face_Alpha(const mbsp_t *bsp, const modelinfo_t *modelinfo, const mface_t *face)
+static float Face_Alpha(
+    const light_context_t &ctx, const mbsp_t *bsp, const modelinfo_t *modelinfo, const mface_t *face)
 {
-    const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+    const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
     const int surf_flags = Face_ContentsOrSurfaceFlags(bsp, face);
     const bool is_q2 = bsp->loadversion->game->id == GAME_QUAKE_II;
 
@@ -88,8 +66,8 @@ static float Face_Alpha(const mbsp_t *bsp, const modelinfo_t *modelinfo, const m
     return 1.0f;
 }
 
-sceneinfo CreateGeometry(
-    const mbsp_t *bsp, RTCDevice g_device, RTCScene scene, const std::vector<const mface_t *> &faces)
+sceneinfo CreateGeometry(const light_context_t &ctx, const mbsp_t *bsp, RTCDevice g_device, RTCScene scene,
+    const std::vector<const mface_t *> &faces)
 {
     unsigned int geomID;
     RTCGeometry geom_0 = rtcNewGeometry(g_device, RTC_GEOMETRY_TYPE_TRIANGLE);
@@ -134,7 +112,7 @@ sceneinfo CreateGeometry(
         int tri_index = tris_temp.size();
         tris_temp.push_back({first_vert_index, first_vert_index + 1, first_vert_index + 2});
 
-        const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+        const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
 
         triinfo info;
 
@@ -142,7 +120,7 @@ sceneinfo CreateGeometry(
         info.modelinfo = modelinfo;
         info.texinfo = &bsp->texinfo[face->texinfo];
 
-        info.texture = Face_Texture(bsp, face);
+        info.texture = Face_Texture(ctx, bsp, face);
 
         // FIXME: don't these need to check extended_flags?
         info.shadowworldonly = modelinfo->shadowworldonly.boolValue();
@@ -152,7 +130,7 @@ sceneinfo CreateGeometry(
 
         info.channelmask = extended_flags.object_channel_mask.value_or(modelinfo->object_channel_mask.value());
 
-        info.alpha = Face_Alpha(bsp, modelinfo, face);
+        info.alpha = Face_Alpha(ctx, bsp, modelinfo, face);
 
         // mxd
         if (bsp->loadversion->game->id == GAME_QUAKE_II) {
@@ -183,7 +161,7 @@ sceneinfo CreateGeometry(
 
     for (const mface_t *face : faces) {
         // NOTE: can be null for "skip" faces
-        const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
+        const modelinfo_t *modelinfo = ModelInfoForFace(ctx, bsp, Face_GetNum(bsp, face));
 
         if (modelinfo) {
             add_face(face, modelinfo);
@@ -276,9 +254,9 @@ void ErrorCallback(void *userptr, const RTCError code, const char *str)
     fmt::print("RTC Error {}: {}\n", static_cast<int>(code), str);
 }
 
-const triinfo &Embree_LookupTriangleInfo(unsigned int geomID, unsigned int primID)
+const triinfo &Embree_LookupTriangleInfo(const embree_scene_t &embree, unsigned int geomID, unsigned int primID)
 {
-    const sceneinfo &info = Embree_SceneinfoForGeomID(geomID);
+    const sceneinfo &info = Embree_SceneinfoForGeomID(embree, geomID);
     return info.triInfo.at(primID);
 }
 
@@ -321,7 +299,7 @@ static void Embree_FilterFuncN(const struct RTCFilterFunctionNArguments *args)
         const unsigned rayIndex = rayID;
 
         const modelinfo_t *source_modelinfo = rsi->self;
-        const triinfo &hit_triinfo = Embree_LookupTriangleInfo(geomID, primID);
+        const triinfo &hit_triinfo = Embree_LookupTriangleInfo(*rsi->ctx.embree, geomID, primID);
 
         if (!(hit_triinfo.channelmask & rsi->shadowmask)) {
             // reject hit
@@ -374,8 +352,8 @@ static void Embree_FilterFuncN(const struct RTCFilterFunctionNArguments *args)
             qvec3f rayDir =
                 qv::normalize(qvec3f{RTCRayN_dir_x(ray, N, i), RTCRayN_dir_y(ray, N, i), RTCRayN_dir_z(ray, N, i)});
             qvec3f hitpoint = Embree_RayEndpoint(ray, rayDir, N, i);
-            const qvec4b sample = SampleTexture(hit_triinfo.face, hit_triinfo.texinfo, hit_triinfo.texture, bsp_static,
-                hitpoint); // mxd. Palette index -> color_rgba
+            const qvec4b sample = SampleTexture(hit_triinfo.face, hit_triinfo.texinfo, hit_triinfo.texture,
+                rsi->ctx.embree->bsp,                hitpoint); // mxd. Palette index -> color_rgba
 
             if (hit_triinfo.is_glass) {
                 // hit glass...
@@ -443,7 +421,7 @@ static void PerRay_FilterFuncN(const struct RTCFilterFunctionNArguments *args)
         // unpack ray index
         const unsigned rayIndex = rayID;
 
-        const triinfo &hit_triinfo = Embree_LookupTriangleInfo(geomID, primID);
+        const triinfo &hit_triinfo = Embree_LookupTriangleInfo(*rsi->ctx.embree, geomID, primID);
 
         if (!(hit_triinfo.channelmask & rsi->shadowmask)) {
             // reject hit
@@ -537,16 +515,29 @@ static void MakeFaces(
     Q_assert(planes.empty());
 }
 
-void Embree_TraceInit(const mbsp_t *bsp)
+embree_scene_t::~embree_scene_t()
 {
-    bsp_static = bsp;
-    Q_assert(device == nullptr);
+    if (scene) {
+        rtcReleaseScene(scene);
+    }
+    if (device) {
+        rtcReleaseDevice(device);
+    }
+}
+
+void Embree_TraceInit(light_context_t &ctx, const mbsp_t *bsp)
+{
+    Q_assert(!ctx.embree);
+    ctx.embree = std::make_unique<embree_scene_t>();
+
+    embree_scene_t &embree = *ctx.embree;
+    embree.bsp = bsp;
 
     std::vector<const mface_t *> skyfaces, solidfaces, filterfaces;
 
     // check all modelinfos
     for (size_t mi = 0; mi < bsp->dmodels.size(); mi++) {
-        const modelinfo_t *model = ModelInfoForModel(bsp, mi);
+        const modelinfo_t *model = ModelInfoForModel(ctx, bsp, mi);
 
         // check reasons that a bmodel can be shadow casting
         const bool isWorld = model->isWorld();
@@ -563,7 +554,7 @@ void Embree_TraceInit(const mbsp_t *bsp)
             const mface_t *face = BSP_GetFace(bsp, model->model->firstface + i);
 
             // check for TEX_NOSHADOW
-            const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
+            const surfflags_t &extended_flags = ctx.extended_texinfo_flags[face->texinfo];
             if (extended_flags.no_shadow)
                 continue;
 
@@ -589,7 +580,7 @@ void Embree_TraceInit(const mbsp_t *bsp)
                 continue;
 
             // handle glass / water
-            const float alpha = Face_Alpha(bsp, model, face);
+            const float alpha = Face_Alpha(ctx, bsp, model, face);
             if (alpha < 1.0f ||
                 (is_q2 && (contents_or_surf_flags & (Q2_SURF_ALPHATEST | Q2_SURF_TRANS33 | Q2_SURF_TRANS66)))) {
                 filterfaces.push_back(face);
@@ -608,7 +599,7 @@ void Embree_TraceInit(const mbsp_t *bsp)
                 // Q2: arghrad compat: sky faces only emit sunlight if:
                 // sky flag set, light flag set, value nonzero
                 if ((contents_or_surf_flags & Q2_SURF_SKY) != 0 &&
-                    (!light_options.arghradcompat.value() ||
+                    (!ctx.options.arghradcompat.value() ||
                         ((contents_or_surf_flags & Q2_SURF_LIGHT) != 0 && texinfo->value != 0))) {
                     skyfaces.push_back(face);
                     continue;
@@ -644,36 +635,37 @@ void Embree_TraceInit(const mbsp_t *bsp)
 
     /* Special handling of skip-textured bmodels */
     std::vector<polylib::winding_t> skipwindings;
-    for (const modelinfo_t *modelinfo : tracelist) {
+    for (const modelinfo_t *modelinfo : ctx.tracelist) {
         if (modelinfo->model->numfaces == 0) {
             MakeFaces(bsp, modelinfo, modelinfo->model, skipwindings);
         }
     }
 
-    device = rtcNewDevice(NULL);
-    rtcSetDeviceErrorFunction(
-        device, ErrorCallback, nullptr); // mxd. Changed from rtcDeviceSetErrorFunction to silence compiler warning...
+    embree.device = rtcNewDevice(NULL);
+    rtcSetDeviceErrorFunction(embree.device, ErrorCallback,
+        nullptr); // mxd. Changed from rtcDeviceSetErrorFunction to silence compiler warning...
 
     // log version
-    const size_t ver_maj = rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_VERSION_MAJOR);
-    const size_t ver_min = rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_VERSION_MINOR);
-    const size_t ver_pat = rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_VERSION_PATCH);
+    const size_t ver_maj = rtcGetDeviceProperty(embree.device, RTC_DEVICE_PROPERTY_VERSION_MAJOR);
+    const size_t ver_min = rtcGetDeviceProperty(embree.device, RTC_DEVICE_PROPERTY_VERSION_MINOR);
+    const size_t ver_pat = rtcGetDeviceProperty(embree.device, RTC_DEVICE_PROPERTY_VERSION_PATCH);
     logging::funcprint("Embree version: {}.{}.{}\n", ver_maj, ver_min, ver_pat);
 
-    scene = rtcNewScene(device);
+    embree.scene = rtcNewScene(embree.device);
     // we're using RTCIntersectContext::filter so it's required that we set
     // RTC_SCENE_FLAG_CONTEXT_FILTER_FUNCTION
-    rtcSetSceneFlags(scene, RTC_SCENE_FLAG_CONTEXT_FILTER_FUNCTION);
-    rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_HIGH);
-    skygeom = CreateGeometry(bsp, device, scene, skyfaces);
-    solidgeom = CreateGeometry(bsp, device, scene, solidfaces);
-    filtergeom = CreateGeometry(bsp, device, scene, filterfaces);
-    CreateGeometryFromWindings(device, scene, skipwindings);
+    rtcSetSceneFlags(embree.scene, RTC_SCENE_FLAG_CONTEXT_FILTER_FUNCTION);
+    rtcSetSceneBuildQuality(embree.scene, RTC_BUILD_QUALITY_HIGH);
+    embree.skygeom = CreateGeometry(ctx, bsp, embree.device, embree.scene, skyfaces);
+    embree.solidgeom = CreateGeometry(ctx, bsp, embree.device, embree.scene, solidfaces);
+    embree.filtergeom = CreateGeometry(ctx, bsp, embree.device, embree.scene, filterfaces);
+    CreateGeometryFromWindings(embree.device, embree.scene, skipwindings);
 
-    rtcSetGeometryIntersectFilterFunction(rtcGetGeometry(scene, filtergeom.geomID), Embree_FilterFuncN);
-    rtcSetGeometryOccludedFilterFunction(rtcGetGeometry(scene, filtergeom.geomID), Embree_FilterFuncN);
+    rtcSetGeometryIntersectFilterFunction(
+        rtcGetGeometry(embree.scene, embree.filtergeom.geomID), Embree_FilterFuncN);
+    rtcSetGeometryOccludedFilterFunction(rtcGetGeometry(embree.scene, embree.filtergeom.geomID), Embree_FilterFuncN);
 
-    rtcCommitScene(scene);
+    rtcCommitScene(embree.scene);
 
     logging::funcprint("\n");
     logging::print("\t{} sky faces\n", skyfaces.size());
@@ -684,8 +676,8 @@ void Embree_TraceInit(const mbsp_t *bsp)
 
 static void AddGlassToRay(RTCIntersectContext *context, unsigned rayIndex, float opacity, const qvec3d &glasscolor)
 {
-    ray_source_info *ctx = static_cast<ray_source_info *>(context);
-    raystream_embree_common_t *rs = ctx->raystream;
+    ray_source_info *rsi = static_cast<ray_source_info *>(context);
+    raystream_embree_common_t *rs = rsi->raystream;
 
     if (rs == nullptr) {
         // FIXME: remove this.. once all ray casts use raystreams
@@ -705,16 +697,18 @@ static void AddGlassToRay(RTCIntersectContext *context, unsigned rayIndex, float
 
 static void AddDynamicOccluderToRay(RTCIntersectContext *context, unsigned rayIndex, int style)
 {
-    ray_source_info *ctx = static_cast<ray_source_info *>(context);
-    raystream_embree_common_t *rs = ctx->raystream;
+    ray_source_info *rsi = static_cast<ray_source_info *>(context);
+    raystream_embree_common_t *rs = rsi->raystream;
 
     if (rs != nullptr) {
         rs->_ray_dynamic_styles[rayIndex] = style;
     }
 }
 
-ray_source_info::ray_source_info(raystream_embree_common_t *raystream_, const modelinfo_t *self_, int shadowmask_)
-    : raystream(raystream_),
+ray_source_info::ray_source_info(
+    light_context_t &ctx_, raystream_embree_common_t *raystream_, const modelinfo_t *self_, int shadowmask_)
+    : ctx(ctx_),
+      raystream(raystream_),
       self(self_),
       shadowmask(shadowmask_)
 {
@@ -727,3 +721,237 @@ ray_source_info::ray_source_info(raystream_embree_common_t *raystream_, const mo
         filter = PerRay_FilterFuncN;
     }
 }
+
+static void Embree_CountTime(light_context_t &ctx, const time_point &start)
+{
+    ctx.total_trace_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(I_FloatTime() - start).count();
+}
+
+// -raysort
+
+// fewer rays than this aren't worth sorting
+static constexpr unsigned int RAYSORT_MIN_RAYS = 32;
+
+static inline const RTCRay &RaySortRay(const RTCRay &ray)
+{
+    return ray;
+}
+
+static inline const RTCRay &RaySortRay(const RTCRayHit &ray)
+{
+    return ray.ray;
+}
+
+// spreads the low 10 bits of v out to every third bit
+static inline uint32_t RaySort_Part1By2(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+/*
+ * Reorders the rays so that rays heading into the same direction octant are
+ * traced together, and within an octant, rays with nearby origins (along a
+ * Morton curve over the stream's bounds) are adjacent. Embree's stream tracer
+ * then gets much more coherent packets out of each batch.
+ *
+ * ray.id is left as the original push index, so the filter callbacks keep
+ * indexing the stream's per-ray arrays correctly; results are copied back
+ * into push order afterwards.
+ */
+template<typename T, typename F>
+static void Embree_TraceSorted(light_context_t &ctx, T *rays, unsigned int numrays, F &&trace)
+{
+    if (!ctx.options.raysort.value() || numrays < RAYSORT_MIN_RAYS) {
+        trace(rays, numrays);
+        return;
+    }
+
+    thread_local std::vector<std::pair<uint64_t, uint32_t>> keys;
+    thread_local aligned_vector<T> sorted;
+
+    // the sorting counts as trace time, so -raysort's overhead shows up in the throughput stats
+    auto start = I_FloatTime();
+
+    aabb3f bounds;
+
+    for (unsigned int i = 0; i < numrays; i++) {
+        const RTCRay &ray = RaySortRay(rays[i]);
+        bounds += qvec3f{ray.org_x, ray.org_y, ray.org_z};
+    }
+
+    const qvec3f mins = bounds.mins();
+    const qvec3f size = bounds.size();
+    qvec3f scale;
+
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = size[axis] > 0 ? 1023.f / size[axis] : 0.f;
+    }
+
+    keys.resize(numrays);
+
+    for (unsigned int i = 0; i < numrays; i++) {
+        const RTCRay &ray = RaySortRay(rays[i]);
+        const uint32_t octant = (ray.dir_x < 0 ? 1 : 0) | (ray.dir_y < 0 ? 2 : 0) | (ray.dir_z < 0 ? 4 : 0);
+        const uint32_t x = static_cast<uint32_t>((ray.org_x - mins[0]) * scale[0]);
+        const uint32_t y = static_cast<uint32_t>((ray.org_y - mins[1]) * scale[1]);
+        const uint32_t z = static_cast<uint32_t>((ray.org_z - mins[2]) * scale[2]);
+        const uint32_t morton = RaySort_Part1By2(x) | (RaySort_Part1By2(y) << 1) | (RaySort_Part1By2(z) << 2);
+
+        keys[i] = {(static_cast<uint64_t>(octant) << 30) | morton, i};
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    sorted.resize(numrays);
+
+    for (unsigned int i = 0; i < numrays; i++) {
+        sorted[i] = rays[keys[i].second];
+    }
+
+    Embree_CountTime(ctx, start);
+
+    trace(sorted.data(), numrays);
+
+    start = I_FloatTime();
+
+    for (unsigned int i = 0; i < numrays; i++) {
+        rays[keys[i].second] = sorted[i];
+    }
+
+    Embree_CountTime(ctx, start);
+}
+
+// rays per range when a large stream is split up
+static constexpr unsigned int RAYSPLIT_RANGE = 1024;
+
+/*
+ * Traces the rays in ranges of RAYSPLIT_RANGE in parallel. The face passes
+ * hand out whole faces, so without this a large face near the end of a pass
+ * keeps one thread busy while the others have nothing left to do; its rays
+ * (in sample order, or sorted with -raysort) are split up here so idle
+ * threads can take over some of the ranges. On a busy arena the ranges just
+ * run on the calling thread.
+ *
+ * Each ray only writes its own results, so the ranges are independent.
+ */
+template<typename T, typename F>
+static void Embree_TraceRanges(light_context_t &ctx, T *rays, unsigned int numrays, F &&trace)
+{
+    auto trace_range = [&ctx, &trace](T *r, unsigned int n) {
+        const auto start = I_FloatTime();
+        trace(r, n);
+        ctx.total_traced_rays += n;
+        Embree_CountTime(ctx, start);
+    };
+
+    if (numrays < 2 * RAYSPLIT_RANGE) {
+        trace_range(rays, numrays);
+        return;
+    }
+
+    // isolated, so while this thread waits it can only take ranges of this stream, and not a face
+    // whose trace would reuse this thread's thread_local -raysort buffers
+    tbb::this_task_arena::isolate([&]() {
+        tbb::parallel_for(tbb::blocked_range<unsigned int>(0, numrays, RAYSPLIT_RANGE),
+            [&](const tbb::blocked_range<unsigned int> &range) { trace_range(rays + range.begin(), range.size()); });
+    });
+}
+
+void Embree_Intersect1M(ray_source_info *context, RTCRayHit *rays, unsigned int numrays)
+{
+    light_context_t &ctx = context->ctx;
+
+    Embree_TraceSorted(ctx, rays, numrays, [&ctx, context](RTCRayHit *sorted, unsigned int numsorted) {
+        Embree_TraceRanges(ctx, sorted, numsorted, [&ctx, context](RTCRayHit *r, unsigned int n) {
+            // Embree may write to the context while tracing, so each range gets its own
+            ray_source_info range_context = *context;
+            rtcIntersect1M(ctx.embree->scene, &range_context, r, n, sizeof(RTCRayHit));
+        });
+    });
+}
+
+void Embree_Occluded1M(ray_source_info *context, RTCRay *rays, unsigned int numrays)
+{
+    light_context_t &ctx = context->ctx;
+
+    Embree_TraceSorted(ctx, rays, numrays, [&ctx, context](RTCRay *sorted, unsigned int numsorted) {
+        Embree_TraceRanges(ctx, sorted, numsorted, [&ctx, context](RTCRay *r, unsigned int n) {
+            ray_source_info range_context = *context;
+            rtcOccluded1M(ctx.embree->scene, &range_context, r, n, sizeof(RTCRay));
+        });
+    });
+}
+
+// shadow volume test
+
+// triangles closer to the volume's bounds than this are assumed to touch it
+static constexpr vec_t SHADOW_VOLUME_EPSILON = 0.1;
+
+struct shadow_volume_query_t
+{
+    const embree_scene_t &embree;
+    aabb3d bounds;
+    bool obstructed = false;
+};
+
+static bool ShadowVolume_QueryFunc(RTCPointQueryFunctionArguments *args)
+{
+    shadow_volume_query_t *q = static_cast<shadow_volume_query_t *>(args->userPtr);
+
+    const embree_scene_t &embree = q->embree;
+
+    if (args->geomID == embree.skygeom.geomID || args->geomID == embree.solidgeom.geomID ||
+        args->geomID == embree.filtergeom.geomID) {
+        const triinfo &tri = Embree_LookupTriangleInfo(embree, args->geomID, args->primID);
+
+        qplane3d plane = Face_Plane(embree.bsp, tri.face);
+        plane.dist += qv::dot(plane.normal, qvec3d(tri.modelinfo->offset));
+
+        // range of plane distances over the box
+        vec_t mindist = -plane.dist, maxdist = -plane.dist;
+
+        for (int i = 0; i < 3; i++) {
+            const vec_t lo = plane.normal[i] * q->bounds.mins()[i];
+            const vec_t hi = plane.normal[i] * q->bounds.maxs()[i];
+            mindist += std::min(lo, hi);
+            maxdist += std::max(lo, hi);
+        }
+
+        // the whole box is on one side of the triangle's plane, so no segment inside the box
+        // can touch the triangle
+        if (mindist > SHADOW_VOLUME_EPSILON || maxdist < -SHADOW_VOLUME_EPSILON) {
+            return false;
+        }
+    }
+
+    // possible occluder (or a triangle we know nothing about); stop looking
+    q->obstructed = true;
+    args->query->radius = 0.f;
+    return true;
+}
+
+bool Embree_BoundsUnobstructed(const light_context_t &ctx, const aabb3d &bounds)
+{
+    shadow_volume_query_t q{*ctx.embree, bounds};
+
+    const qvec3d center = bounds.centroid();
+
+    RTCPointQuery query;
+    query.x = center[0];
+    query.y = center[1];
+    query.z = center[2];
+    query.time = 0.f;
+    query.radius = qv::length(bounds.size()) * 0.5 + SHADOW_VOLUME_EPSILON;
+
+    RTCPointQueryContext context;
+    rtcInitPointQueryContext(&context);
+
+    rtcPointQuery(ctx.embree->scene, &query, &context, ShadowVolume_QueryFunc, &q);
+
+    return !q.obstructed;
+}
@@ -51,6 +51,7 @@ See file, 'COPYING', for details.
 
 #include <common/bspfile.hh>
 #include <qbsp/qbsp.hh>
+#include <qbsp/map.hh>
 #include <vis/vis.hh>
 #include <light/light.hh>
 #include <common/bspinfo.hh>
@@ -500,7 +501,8 @@ std::filesystem::path MakeFSPath(const QString &string)
 }
 
 bspdata_t MainWindow::QbspVisLight_Common(const std::filesystem::path &name, std::vector<std::string> extra_common_args,
-    std::vector<std::string> extra_qbsp_args, std::vector<std::string> extra_vis_args, std::vector<std::string> extra_light_args, bool run_vis)
+    std::vector<std::string> extra_qbsp_args, std::vector<std::string> extra_vis_args, std::vector<std::string> extra_light_args, bool run_vis,
+    settings::common_settings &light_settings)
 {
     auto resetActiveTabText = [&]() {
         QMetaObject::invokeMethod(this, std::bind(&MainWindow::logWidgetSetText, this, m_activeLogTab,
@@ -524,8 +526,11 @@ bspdata_t MainWindow::QbspVisLight_Common(const std::filesystem::path &name, std
     // run qbsp
     m_activeLogTab = ETLogTab::TAB_BSP;
 
-    InitQBSP(args);
-    ProcessFile();
+    {
+        qbsp_context_t ctx;
+        InitQBSP(ctx, args);
+        ProcessFile(ctx);
+    }
 
     resetActiveTabText();
 
@@ -561,7 +566,11 @@ bspdata_t MainWindow::QbspVisLight_Common(const std::filesystem::path &name, std
         }
         light_args.push_back(name.string());
 
-        light_main(light_args);
+        auto ctx = std::make_unique<light_context_t>();
+        light_main(*ctx, light_args);
+
+        // hand back the -path args light ran with, so the textures load from the same place
+        light_settings.paths.copy_from(ctx->options.paths);
     }
 
     resetActiveTabText();
@@ -684,14 +693,11 @@ int MainWindow::compileMap(const QString &file, bool is_reload)
             ConvertBSPFormat(&m_bspdata, &bspver_generic);
 
         } else {
-            m_bspdata = QbspVisLight_Common(fs_path, ParseArgs(common_options), ParseArgs(qbsp_options), ParseArgs(vis_options),
-                ParseArgs(light_options), vis_checkbox->isChecked());
-
             // FIXME: move to a lightpreview_settings
             settings::common_settings settings;
 
-            // FIXME: copy the -path args from light
-            settings.paths.copy_from(::light_options.paths);
+            m_bspdata = QbspVisLight_Common(fs_path, ParseArgs(common_options), ParseArgs(qbsp_options), ParseArgs(vis_options),
+                ParseArgs(light_options), vis_checkbox->isChecked(), settings);
 
             m_bspdata.loadversion->game->init_filesystem(file.toStdString(), settings);
         }
@@ -95,7 +95,8 @@ private:
     int compileMap(const QString &file, bool is_reload);
     void compileThreadExited();
     bspdata_t QbspVisLight_Common(const fs::path &name, std::vector<std::string> extra_common_args,
-        std::vector<std::string> extra_qbsp_args, std::vector<std::string> extra_vis_args, std::vector<std::string> extra_light_args, bool run_vis);
+        std::vector<std::string> extra_qbsp_args, std::vector<std::string> extra_vis_args, std::vector<std::string> extra_light_args, bool run_vis,
+        settings::common_settings &light_settings);
 
 protected:
     void dragEnterEvent(QDragEnterEvent *event) override;
@@ -47,12 +47,12 @@ side_t side_t::clone() const
     return result;
 }
 
-bool side_t::is_visible() const
+bool side_t::is_visible(const mapdata_t &map) const
 {
     // workaround for qbsp_q2_mist_clip.map - we want to treat nodraw faces as "!visible"
     // so they're used as splitters after mist
-    if (get_texinfo().flags.is_nodraw) {
-        if (get_texinfo().flags.is_hint) {
+    if (get_texinfo(map).flags.is_nodraw) {
+        if (get_texinfo(map).flags.is_hint) {
             return true;
         }
 
@@ -62,17 +62,17 @@ bool side_t::is_visible() const
     return source && source->visible;
 }
 
-const maptexinfo_t &side_t::get_texinfo() const
+const maptexinfo_t &side_t::get_texinfo(const mapdata_t &map) const
 {
     return map.mtexinfos[this->texinfo];
 }
 
-const qbsp_plane_t &side_t::get_plane() const
+const qbsp_plane_t &side_t::get_plane(const mapdata_t &map) const
 {
     return map.get_plane(planenum);
 }
 
-const qbsp_plane_t &side_t::get_positive_plane() const
+const qbsp_plane_t &side_t::get_positive_plane(const mapdata_t &map) const
 {
     return map.get_plane(planenum & ~1);
 }
@@ -106,10 +106,10 @@ bspbrush_t bspbrush_t::clone() const
     return result;
 }
 
-bool bspbrush_t::contains_point(const qvec3d &point, vec_t epsilon) const
+bool bspbrush_t::contains_point(const mapdata_t &map, const qvec3d &point, vec_t epsilon) const
 {
     for (auto &side : sides) {
-        if (side.get_plane().distance_to(point) > epsilon) {
+        if (side.get_plane(map).distance_to(point) > epsilon) {
             return false;
         }
     }
@@ -123,11 +123,11 @@ CheckFace
 Note: this will not catch 0 area polygons
 =================
 */
-static void CheckFace(
+static void CheckFace(qbsp_context_t &ctx, 
     side_t *face, const mapface_t &sourceface, std::optional<std::reference_wrapper<size_t>> num_clipped)
 {
     if (face->w.size() < 3) {
-        if (qbsp_options.verbose.value()) {
+        if (ctx.options.verbose.value()) {
             if (face->w.size() == 2) {
                 logging::print("WARNING: {}: partially clipped into degenerate polygon @ ({}) - ({})\n",
                     sourceface.line, face->w[0], face->w[1]);
@@ -147,7 +147,7 @@ static void CheckFace(
         return;
     }
 
-    const qbsp_plane_t &plane = face->get_plane();
+    const qbsp_plane_t &plane = face->get_plane(ctx.map);
     qvec3d facenormal = plane.get_normal();
 
     for (size_t i = 0; i < face->w.size(); i++) {
@@ -155,7 +155,7 @@ static void CheckFace(
         const qvec3d &p2 = face->w[(i + 1) % face->w.size()];
 
         for (auto &v : p1) {
-            if (fabs(v) > qbsp_options.worldextent.value()) {
+            if (fabs(v) > ctx.options.worldextent.value()) {
                 // this is fatal because a point should never lay outside the world
                 FError("{}: coordinate out of range ({})\n", sourceface.line, v);
             }
@@ -163,8 +163,8 @@ static void CheckFace(
 
         /* check the point is on the face plane */
         {
-            vec_t dist = face->get_plane().distance_to(p1);
-            if (fabs(dist) > qbsp_options.epsilon.value()) {
+            vec_t dist = face->get_plane(ctx.map).distance_to(p1);
+            if (fabs(dist) > ctx.options.epsilon.value()) {
                 logging::print("WARNING: {}: Point ({:.3} {:.3} {:.3}) off plane by {:2.4}\n", sourceface.line, p1[0],
                     p1[1], p1[2], dist);
             }
@@ -173,19 +173,19 @@ static void CheckFace(
         /* check the edge isn't degenerate */
         qvec3d edgevec = p2 - p1;
         vec_t length = qv::length(edgevec);
-        if (length < qbsp_options.epsilon.value()) {
+        if (length < ctx.options.epsilon.value()) {
             logging::print("WARNING: {}: Healing degenerate edge ({}) at ({:.3f} {:.3} {:.3})\n", sourceface.line,
                 length, p1[0], p1[1], p1[2]);
             for (size_t j = i + 1; j < face->w.size(); j++)
                 face->w[j - 1] = face->w[j];
             face->w.resize(face->w.size() - 1);
-            CheckFace(face, sourceface, num_clipped);
+            CheckFace(ctx, face, sourceface, num_clipped);
             break;
         }
 
         qvec3d edgenormal = qv::normalize(qv::cross(facenormal, edgevec));
         vec_t edgedist = qv::dot(p1, edgenormal);
-        edgedist += qbsp_options.epsilon.value();
+        edgedist += ctx.options.epsilon.value();
 
         /* all other points must be on front side */
         for (size_t j = 0; j < face->w.size(); j++) {
@@ -217,9 +217,9 @@ FindTargetEntity
 Finds the entity whose `targetname` value is case-insensitve-equal to `target`.
 =================
 */
-static const mapentity_t *FindTargetEntity(const std::string &target)
+static const mapentity_t *FindTargetEntity(qbsp_context_t &ctx, const std::string &target)
 {
-    for (const auto &entity : map.entities) {
+    for (const auto &entity : ctx.map.entities) {
         const std::string &name = entity.epairs.get("targetname");
         if (string_iequals(target, name)) {
             return &entity;
@@ -234,13 +234,13 @@ static const mapentity_t *FindTargetEntity(const std::string &target)
 FixRotateOrigin
 =================
 */
-qvec3d FixRotateOrigin(mapentity_t &entity)
+qvec3d FixRotateOrigin(qbsp_context_t &ctx, mapentity_t &entity)
 {
     const std::string &search = entity.epairs.get("target");
     const mapentity_t *target = nullptr;
 
     if (!search.empty()) {
-        target = FindTargetEntity(search);
+        target = FindTargetEntity(ctx, search);
     }
 
     qvec3d offset;
@@ -266,11 +266,11 @@ Create all of the windings for the specified brush, and
 calculate its bounds.
 ==================
 */
-bool CreateBrushWindings(bspbrush_t &brush)
+bool CreateBrushWindings(qbsp_context_t &ctx, bspbrush_t &brush)
 {
     for (int i = 0; i < brush.sides.size(); i++) {
         side_t &side = brush.sides[i];
-        std::optional<winding_t> w = BaseWindingForPlane<winding_t>(side.get_plane());
+        std::optional<winding_t> w = BaseWindingForPlane<winding_t>(ctx.options, side.get_plane(ctx.map));
 
         for (int j = 0; j < brush.sides.size() && w; j++) {
             if (i == j) {
@@ -279,14 +279,14 @@ bool CreateBrushWindings(bspbrush_t &brush)
             if (brush.sides[j].bevel) {
                 continue;
             }
-            const qplane3d &plane = map.planes[brush.sides[j].planenum ^ 1];
-            w = w->clip_front(plane, qbsp_options.epsilon.value(), false);
+            const qplane3d &plane = ctx.map.planes[brush.sides[j].planenum ^ 1];
+            w = w->clip_front(plane, ctx.options.epsilon.value(), false);
         }
 
         if (w) {
             for (auto &p : *w) {
                 for (auto &v : p) {
-                    if (fabs(v) > qbsp_options.worldextent.value()) {
+                    if (fabs(v) > ctx.options.worldextent.value()) {
                         logging::print("WARNING: {}: invalid winding point\n",
                             brush.mapbrush ? brush.mapbrush->line : parser_source_location{});
                         w = std::nullopt;
@@ -311,7 +311,7 @@ bool CreateBrushWindings(bspbrush_t &brush)
         }
     }
 
-    return brush.update_bounds(true);
+    return brush.update_bounds(ctx.options, true);
 }
 
 #define QBSP3
@@ -343,13 +343,13 @@ AddBrushPlane
 static bool AddBrushPlane(hullbrush_t &hullbrush, const qbsp_plane_t &plane)
 {
     for (auto &s : hullbrush.brush.sides) {
-        if (qv::epsilonEqual(s.get_plane(), plane)) {
+        if (qv::epsilonEqual(s.get_plane(ctx.map), plane)) {
             return false;
         }
     }
 
     auto &s = hullbrush.brush.sides.emplace_back();
-    s.planenum = map.add_or_find_plane(plane);
+    s.planenum = ctx.map.add_or_find_plane(plane);
     s.texinfo = 0;
     return true;
 }
@@ -366,7 +366,7 @@ static bool TestAddPlane(hullbrush_t &hullbrush, const qbsp_plane_t &plane)
 {
     /* see if the plane has already been added */
     for (auto &s : hullbrush.brush.sides) {
-        if (qv::epsilonEqual(plane, s.get_plane()) || qv::epsilonEqual(plane, s.get_positive_plane())) {
+        if (qv::epsilonEqual(plane, s.get_plane(ctx.map)) || qv::epsilonEqual(plane, s.get_positive_plane(ctx.map))) {
             return false;
         }
     }
@@ -378,12 +378,12 @@ static bool TestAddPlane(hullbrush_t &hullbrush, const qbsp_plane_t &plane)
     for (size_t i = 0; i < hullbrush.corners.size(); i++) {
         vec_t d = qv::dot(hullbrush.corners[i], plane.get_normal()) - plane.get_dist();
 
-        if (d < -qbsp_options.epsilon.value()) {
+        if (d < -ctx.options.epsilon.value()) {
             if (points_front) {
                 return false;
             }
             points_back = true;
-        } else if (d > qbsp_options.epsilon.value()) {
+        } else if (d > ctx.options.epsilon.value()) {
             if (points_back) {
                 return false;
             }
@@ -496,11 +496,11 @@ static void ExpandBrush(hullbrush_t &hullbrush, const aabb3d &hull_size)
 
     // expand all of the planes
     for (auto &f : hullbrush.brush.sides) {
-        if (f.get_texinfo().flags.no_expand) {
+        if (f.get_texinfo(ctx.map).flags.no_expand) {
             continue;
         }
         qvec3d corner = {};
-        qplane3d plane = f.get_plane();
+        qplane3d plane = f.get_plane(ctx.map);
         for (size_t x = 0; x < 3; x++) {
             if (plane.normal[x] > 0) {
                 corner[x] = hull_size[1][x];
@@ -509,7 +509,7 @@ static void ExpandBrush(hullbrush_t &hullbrush, const aabb3d &hull_size)
             }
         }
         plane.dist += qv::dot(corner, plane.normal);
-        f.planenum = map.add_or_find_plane(plane);
+        f.planenum = ctx.map.add_or_find_plane(plane);
     }
 
     // add any axis planes not contained in the brush to bevel off corners
@@ -551,8 +551,8 @@ LoadBrush
 Converts a mapbrush to a bsp brush
 ===============
 */
-std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush, const contentflags_t &contents,
-    hull_index_t hullnum, std::optional<std::reference_wrapper<size_t>> num_clipped)
+std::optional<bspbrush_t> LoadBrush(qbsp_context_t &ctx, const mapentity_t &src, mapbrush_t &mapbrush,
+    const contentflags_t &contents, hull_index_t hullnum, std::optional<std::reference_wrapper<size_t>> num_clipped)
 {
     // create the brush
     bspbrush_t brush{};
@@ -570,7 +570,7 @@ std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush
 #if 0
         if (!hullnum.value_or(0) && mapbrush.is_hint) {
             /* Don't generate hintskip faces */
-            const maptexinfo_t &texinfo = src.get_texinfo();
+            const maptexinfo_t &texinfo = src.get_texinfo(ctx.map);
 
             // any face that isn't a hint is assumed to be hintskip
             if (!texinfo.flags.is_hint) {
@@ -600,31 +600,31 @@ std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush
 
     // expand the brushes for the hull
     if (hullnum.value_or(0)) {
-        auto &hulls = qbsp_options.target_game->get_hull_sizes();
+        auto &hulls = ctx.options.target_game->get_hull_sizes();
         Q_assert(hullnum < hulls.size());
         auto &hull = *(hulls.begin() + hullnum.value());
 
 #ifdef QBSP3
         for (auto &mapface : brush.sides) {
-            if (mapface.get_texinfo().flags.no_expand) {
+            if (mapface.get_texinfo(ctx.map).flags.no_expand) {
                 continue;
             }
             qvec3d corner{};
             for (int32_t x = 0; x < 3; x++) {
-                if (mapface.get_plane().get_normal()[x] > 0) {
+                if (mapface.get_plane(ctx.map).get_normal()[x] > 0) {
                     corner[x] = hull[1][x];
-                } else if (mapface.get_plane().get_normal()[x] < 0) {
+                } else if (mapface.get_plane(ctx.map).get_normal()[x] < 0) {
                     corner[x] = hull[0][x];
                 }
             }
-            qplane3d plane = mapface.get_plane();
+            qplane3d plane = mapface.get_plane(ctx.map);
             plane.dist += qv::dot(corner, plane.normal);
-            mapface.planenum = map.add_or_find_plane(plane);
+            mapface.planenum = ctx.map.add_or_find_plane(plane);
             mapface.bevel = false;
         }
 #else
 
-        if (!CreateBrushWindings(brush)) {
+        if (!CreateBrushWindings(ctx, brush)) {
             return std::nullopt;
         }
 
@@ -633,12 +633,12 @@ std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush
 #endif
     }
 
-    if (!CreateBrushWindings(brush)) {
+    if (!CreateBrushWindings(ctx, brush)) {
         return std::nullopt;
     }
 
     for (auto &face : brush.sides) {
-        CheckFace(&face, *face.source, num_clipped);
+        CheckFace(ctx, &face, *face.source, num_clipped);
     }
 
     // Rotatable objects must have a bounding box big enough to
@@ -655,7 +655,7 @@ std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush
     // The idea behind the bounds expansion was to avoid incorrect vis culling (AFAIK).
     const bool shouldExpand = !qv::emptyExact(src.origin) && src.rotation == rotation_t::hipnotic &&
                               hullnum.has_value() &&
-                              qbsp_options.target_game->id != GAME_HEXEN_II; // never do this in Hexen 2
+                              ctx.options.target_game->id != GAME_HEXEN_II; // never do this in Hexen 2
 
     if (shouldExpand) {
         vec_t max = -std::numeric_limits<vec_t>::infinity(), min = std::numeric_limits<vec_t>::infinity();
@@ -678,8 +678,8 @@ std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush
 
 //=============================================================================
 
-static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hullnum, content_stats_base_t &stats,
-    bspbrush_t::container &brushes, logging::percent_clock &clock, size_t &num_clipped)
+static void Brush_LoadEntity(qbsp_context_t &ctx, mapentity_t &dst, mapentity_t &src, hull_index_t hullnum,
+    content_stats_base_t &stats, bspbrush_t::container &brushes, logging::percent_clock &clock, size_t &num_clipped)
 {
     clock.max += src.mapbrushes.size();
 
@@ -691,7 +691,7 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
     const std::string &classname = src.epairs.get("classname");
 
     /* If the source entity is func_detail, set the content flag */
-    if (!qbsp_options.nodetail.value()) {
+    if (!ctx.options.nodetail.value()) {
         if (!Q_strcasecmp(classname, "func_detail")) {
             all_detail = true;
         }
@@ -712,9 +712,9 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
     for (auto &mapbrush : src.mapbrushes) {
         clock();
 
-        if (map.is_world_entity(src) || IsWorldBrushEntity(src) || IsNonRemoveWorldBrushEntity(src)) {
-            if (map.region) {
-                if (map.region->bounds.disjoint(mapbrush.bounds)) {
+        if (ctx.map.is_world_entity(src) || IsWorldBrushEntity(src) || IsNonRemoveWorldBrushEntity(src)) {
+            if (ctx.map.region) {
+                if (ctx.map.region->bounds.disjoint(mapbrush.bounds)) {
                     // stats.regioned_brushes++;
                     // it = entity.mapbrushes.erase(it);
                     // logging::print("removed broosh\n");
@@ -722,7 +722,7 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
                 }
             }
 
-            for (auto &region : map.antiregions) {
+            for (auto &region : ctx.map.antiregions) {
                 if (!region.bounds.disjoint(mapbrush.bounds)) {
                     // stats.regioned_brushes++;
                     // it = entity.mapbrushes.erase(it);
@@ -740,12 +740,12 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
 
         contentflags_t contents = mapbrush.contents;
 
-        if (qbsp_options.nodetail.value()) {
-            contents = qbsp_options.target_game->clear_detail(contents);
+        if (ctx.options.nodetail.value()) {
+            contents = ctx.options.target_game->clear_detail(contents);
         }
 
         /* "origin" brushes always discarded beforehand */
-        Q_assert(!contents.is_origin(qbsp_options.target_game));
+        Q_assert(!contents.is_origin(ctx.options.target_game));
 
         // per-brush settings
         bool detail = false;
@@ -760,27 +760,27 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
         detail_wall |= all_detail_wall;
 
         /* -omitdetail option omits all types of detail */
-        if (qbsp_options.omitdetail.value() && detail)
+        if (ctx.options.omitdetail.value() && detail)
             continue;
-        if ((qbsp_options.omitdetail.value() || qbsp_options.omitdetailillusionary.value()) && detail_illusionary)
+        if ((ctx.options.omitdetail.value() || ctx.options.omitdetailillusionary.value()) && detail_illusionary)
             continue;
-        if ((qbsp_options.omitdetail.value() || qbsp_options.omitdetailfence.value()) && detail_fence)
+        if ((ctx.options.omitdetail.value() || ctx.options.omitdetailfence.value()) && detail_fence)
             continue;
-        if ((qbsp_options.omitdetail.value() || qbsp_options.omitdetailwall.value()) && detail_wall)
+        if ((ctx.options.omitdetail.value() || ctx.options.omitdetailwall.value()) && detail_wall)
             continue;
-        if (qbsp_options.omitdetail.value() && contents.is_any_detail(qbsp_options.target_game))
+        if (ctx.options.omitdetail.value() && contents.is_any_detail(ctx.options.target_game))
             continue;
 
         /* turn solid brushes into detail, if we're in hull0 */
-        if (!hullnum.value_or(0) && contents.is_any_solid(qbsp_options.target_game)) {
+        if (!hullnum.value_or(0) && contents.is_any_solid(ctx.options.target_game)) {
             if (detail_illusionary) {
-                contents = qbsp_options.target_game->create_detail_illusionary_contents(contents);
+                contents = ctx.options.target_game->create_detail_illusionary_contents(contents);
             } else if (detail_fence) {
-                contents = qbsp_options.target_game->create_detail_fence_contents(contents);
+                contents = ctx.options.target_game->create_detail_fence_contents(contents);
             } else if (detail_wall) {
-                contents = qbsp_options.target_game->create_detail_wall_contents(contents);
+                contents = ctx.options.target_game->create_detail_wall_contents(contents);
             } else if (detail) {
-                contents = qbsp_options.target_game->create_detail_solid_contents(contents);
+                contents = ctx.options.target_game->create_detail_solid_contents(contents);
             }
         }
 
@@ -795,15 +795,15 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
          * include them in the model bounds so collision detection works
          * correctly.
          */
-        if (hullnum.has_value() && contents.is_clip(qbsp_options.target_game)) {
+        if (hullnum.has_value() && contents.is_clip(ctx.options.target_game)) {
             if (hullnum.value() == 0) {
-                if (auto brush = LoadBrush(src, mapbrush, contents, hullnum, num_clipped)) {
+                if (auto brush = LoadBrush(ctx, src, mapbrush, contents, hullnum, num_clipped)) {
                     dst.bounds += brush->bounds;
                 }
                 continue;
                 // for hull1, 2, etc., convert clip to CONTENTS_SOLID
             } else {
-                contents = qbsp_options.target_game->create_solid_contents();
+                contents = ctx.options.target_game->create_solid_contents();
             }
         }
 
@@ -812,30 +812,30 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
             if (hullnum.value_or(0)) {
                 continue;
             }
-            contents = qbsp_options.target_game->create_empty_contents();
+            contents = ctx.options.target_game->create_empty_contents();
         }
 
         /* entities in some games never use water merging */
-        if (!map.is_world_entity(dst) &&
-            !(qbsp_options.target_game->allow_contented_bmodels || qbsp_options.bmodelcontents.value())) {
+        if (!ctx.map.is_world_entity(dst) &&
+            !(ctx.options.target_game->allow_contented_bmodels || ctx.options.bmodelcontents.value())) {
             // bmodels become solid in Q1
 
             // to allow use of _mirrorinside, we'll set it to detail fence, which will get remapped back
             // to CONTENTS_SOLID at export. (we wouldn't generate inside faces if the content was CONTENTS_SOLID
             // from the start.)
-            contents = qbsp_options.target_game->create_detail_fence_contents(
-                qbsp_options.target_game->create_solid_contents());
+            contents = ctx.options.target_game->create_detail_fence_contents(
+                ctx.options.target_game->create_solid_contents());
         }
 
         if (hullnum.value_or(0)) {
             /* nonsolid brushes don't show up in clipping hulls */
-            if (!contents.is_any_solid(qbsp_options.target_game) && !contents.is_sky(qbsp_options.target_game) &&
-                !contents.is_fence(qbsp_options.target_game)) {
+            if (!contents.is_any_solid(ctx.options.target_game) && !contents.is_sky(ctx.options.target_game) &&
+                !contents.is_fence(ctx.options.target_game)) {
                 continue;
             }
 
             /* all used brushes are solid in the collision hulls */
-            contents = qbsp_options.target_game->create_solid_contents();
+            contents = ctx.options.target_game->create_solid_contents();
         }
 
         // fixme-brushbsp: function calls above can override the values below
@@ -843,13 +843,13 @@ static void Brush_LoadEntity(mapentity_t &dst, mapentity_t &src, hull_index_t hu
         contents.set_mirrored(mapbrush.contents.mirror_inside);
         contents.set_clips_same_type(mapbrush.contents.clips_same_type);
 
-        auto brush = LoadBrush(src, mapbrush, contents, hullnum, num_clipped);
+        auto brush = LoadBrush(ctx, src, mapbrush, contents, hullnum, num_clipped);
 
         if (!brush) {
             continue;
         }
 
-        qbsp_options.target_game->count_contents_in_stats(brush->contents, stats);
+        ctx.options.target_game->count_contents_in_stats(brush->contents, stats);
 
         dst.bounds += brush->bounds;
         brushes.push_back(bspbrush_t::make_ptr(std::move(*brush)));
@@ -864,17 +864,18 @@ hullnum nullopt should contain ALL brushes; BSPX and Quake II, etc.
 hullnum 0 does not contain clip brushes.
 ============
 */
-void Brush_LoadEntity(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::container &brushes, size_t &num_clipped)
+void Brush_LoadEntity(
+    qbsp_context_t &ctx, mapentity_t &entity, hull_index_t hullnum, bspbrush_t::container &brushes, size_t &num_clipped)
 {
     logging::funcheader();
 
-    bool is_world_entity = map.is_world_entity(entity);
+    bool is_world_entity = ctx.map.is_world_entity(entity);
 
-    auto stats = qbsp_options.target_game->create_content_stats();
+    auto stats = ctx.options.target_game->create_content_stats();
     logging::percent_clock clock(0);
     clock.displayElapsed = is_world_entity;
 
-    Brush_LoadEntity(entity, entity, hullnum, *stats, brushes, clock, num_clipped);
+    Brush_LoadEntity(ctx, entity, entity, hullnum, *stats, brushes, clock, num_clipped);
 
     /*
      * If this is the world entity, find all func_group and func_detail
@@ -885,16 +886,16 @@ void Brush_LoadEntity(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::con
          * We no longer care about the order of adding func_detail and func_group,
          * Entity_SortBrushes will sort the brushes
          */
-        for (int i = 1; i < map.entities.size(); i++) {
-            mapentity_t &source = map.entities.at(i);
+        for (int i = 1; i < ctx.map.entities.size(); i++) {
+            mapentity_t &source = ctx.map.entities.at(i);
 
             /* Load external .map and change the classname, if needed */
-            ProcessExternalMapEntity(source);
+            ProcessExternalMapEntity(ctx, source);
 
-            ProcessAreaPortal(source);
+            ProcessAreaPortal(ctx, source);
 
             if (IsWorldBrushEntity(source) || IsNonRemoveWorldBrushEntity(source)) {
-                Brush_LoadEntity(entity, source, hullnum, *stats, brushes, clock, num_clipped);
+                Brush_LoadEntity(ctx, entity, source, hullnum, *stats, brushes, clock, num_clipped);
             }
         }
     }
@@ -903,7 +904,7 @@ void Brush_LoadEntity(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::con
 
     logging::header("CountBrushes");
 
-    qbsp_options.target_game->print_content_stats(*stats, "brushes");
+    ctx.options.target_game->print_content_stats(*stats, "brushes");
 
     logging::stat_tracker_t stat_print;
     auto &visible_sides_stat = stat_print.register_stat("visible sides");
@@ -922,7 +923,7 @@ void Brush_LoadEntity(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::con
     }
 }
 
-bool bspbrush_t::update_bounds(bool warn_on_failures)
+bool bspbrush_t::update_bounds(const settings::qbsp_settings &options, bool warn_on_failures)
 {
     this->bounds = {};
 
@@ -934,16 +935,16 @@ bool bspbrush_t::update_bounds(bool warn_on_failures)
 
     for (size_t i = 0; i < 3; i++) {
         // todo: map_source_location in bspbrush_t
-        if (this->bounds.mins()[i] <= -qbsp_options.worldextent.value() ||
-            this->bounds.maxs()[i] >= qbsp_options.worldextent.value()) {
+        if (this->bounds.mins()[i] <= -options.worldextent.value() ||
+            this->bounds.maxs()[i] >= options.worldextent.value()) {
             if (warn_on_failures) {
                 logging::print(
                     "WARNING: {}: brush bounds out of range\n", mapbrush ? mapbrush->line : parser_source_location());
             }
             return false;
         }
-        if (this->bounds.mins()[i] >= qbsp_options.worldextent.value() ||
-            this->bounds.maxs()[i] <= -qbsp_options.worldextent.value()) {
+        if (this->bounds.mins()[i] >= options.worldextent.value() ||
+            this->bounds.maxs()[i] <= -options.worldextent.value()) {
             if (warn_on_failures) {
                 logging::print(
                     "WARNING: {}: no visible sides on brush\n", mapbrush ? mapbrush->line : parser_source_location());
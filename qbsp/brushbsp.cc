@@ -78,7 +78,7 @@ BrushFromBounds
 Creates a new axial brush
 ==================
 */
-bspbrush_t::ptr BrushFromBounds(const aabb3d &bounds)
+bspbrush_t::ptr BrushFromBounds(qbsp_context_t &ctx, const aabb3d &bounds)
 {
     auto b = bspbrush_t::make_ptr();
 
@@ -90,7 +90,7 @@ bspbrush_t::ptr BrushFromBounds(const aabb3d &bounds)
             plane.dist = bounds.maxs()[i];
 
             side_t &side = b->sides[i];
-            side.planenum = map.add_or_find_plane(plane);
+            side.planenum = ctx.map.add_or_find_plane(plane);
         }
 
         {
@@ -99,11 +99,11 @@ bspbrush_t::ptr BrushFromBounds(const aabb3d &bounds)
             plane.dist = -bounds.mins()[i];
 
             side_t &side = b->sides[3 + i];
-            side.planenum = map.add_or_find_plane(plane);
+            side.planenum = ctx.map.add_or_find_plane(plane);
         }
     }
 
-    CreateBrushWindings(*b.get());
+    CreateBrushWindings(ctx, *b.get());
 
     return b;
 }
@@ -115,7 +115,7 @@ BrushVolume
 ==================
 */
 template<typename T>
-static vec_t BrushVolume(T begin, T end)
+static vec_t BrushVolume(qbsp_context_t &ctx, T begin, T end)
 {
     // grab the first valid point as the corner
 
@@ -143,7 +143,7 @@ static vec_t BrushVolume(T begin, T end)
             continue;
         }
 
-        auto &plane = face.get_plane();
+        auto &plane = face.get_plane(ctx.map);
         vec_t d = -(qv::dot(corner, plane.get_normal()) - plane.get_dist());
         vec_t area = face.w.area();
         volume += d * area;
@@ -153,9 +153,9 @@ static vec_t BrushVolume(T begin, T end)
     return volume;
 }
 
-vec_t BrushVolume(const bspbrush_t &brush)
+vec_t BrushVolume(qbsp_context_t &ctx, const bspbrush_t &brush)
 {
-    return BrushVolume(brush.sides.begin(), brush.sides.end());
+    return BrushVolume(ctx, brush.sides.begin(), brush.sides.end());
 }
 
 //========================================================
@@ -242,7 +242,7 @@ static int QuickTestBrushToPlanenum(const bspbrush_t &brush, int planenum, int *
     }
 
     // box on plane side
-    auto plane = map.get_plane(planenum);
+    auto plane = ctx.map.get_plane(planenum);
     int s = BoxOnPlaneSide(brush.bounds, plane);
 
     // if both sides, count the visible faces split
@@ -260,7 +260,7 @@ TestBrushToPlanenum
 
 ============
 */
-static int TestBrushToPlanenum(
+static int TestBrushToPlanenum(qbsp_context_t &ctx, 
     const bspbrush_t &brush, size_t planenum, int *numsplits, bool *hintsplit, int *epsilonbrush)
 {
     if (numsplits) {
@@ -282,7 +282,7 @@ static int TestBrushToPlanenum(
 
     // box on plane side
     // int s = SphereOnPlaneSide(brush.sphere_origin, brush.sphere_radius, plane);
-    const qbsp_plane_t &plane = map.get_plane(planenum);
+    const qbsp_plane_t &plane = ctx.map.get_plane(planenum);
     int s = BoxOnPlaneSide(brush.bounds, plane);
     if (s != PSIDE_BOTH)
         return s;
@@ -295,7 +295,7 @@ static int TestBrushToPlanenum(
         for (const side_t &side : brush.sides) {
             if (side.onnode)
                 continue; // on node, don't worry about splits
-            if (!side.is_visible())
+            if (!side.is_visible(ctx.map))
                 continue; // we don't care about non-visible
             auto &w = side.w;
             if (!w)
@@ -315,9 +315,9 @@ static int TestBrushToPlanenum(
                     back = 1;
             }
             if (front && back) {
-                if (!(side.get_texinfo().flags.is_hintskip)) {
+                if (!(side.get_texinfo(ctx.map).flags.is_hintskip)) {
                     (*numsplits)++;
-                    if (side.get_texinfo().flags.is_hint) {
+                    if (side.get_texinfo(ctx.map).flags.is_hint) {
                         *hintsplit = true;
                     }
                 }
@@ -345,22 +345,22 @@ Creates a leaf node.
 Called in parallel.
 ==================
 */
-static void LeafNode(node_t *leafnode, bspbrush_t::container brushes, bspstats_t &stats)
+static void LeafNode(qbsp_context_t &ctx, node_t *leafnode, bspbrush_t::container brushes, bspstats_t &stats)
 {
     leafnode->facelist.clear();
     leafnode->is_leaf = true;
 
-    leafnode->contents = qbsp_options.target_game->create_empty_contents();
+    leafnode->contents = ctx.options.target_game->create_empty_contents();
     for (auto &brush : brushes) {
-        leafnode->contents = qbsp_options.target_game->combine_contents(leafnode->contents, brush->contents);
+        leafnode->contents = ctx.options.target_game->combine_contents(leafnode->contents, brush->contents);
     }
     for (auto &brush : brushes) {
         leafnode->original_brushes.push_back(brush->original_brush());
     }
 
-    qbsp_options.target_game->count_contents_in_stats(leafnode->contents, *stats.leafstats);
+    ctx.options.target_game->count_contents_in_stats(leafnode->contents, *stats.leafstats);
 
-    if (qbsp_options.debugleak.value() || qbsp_options.debugbspbrushes.value()) {
+    if (ctx.options.debugleak.value() || ctx.options.debugbspbrushes.value()) {
         leafnode->bsp_brushes = brushes;
     } else {
         leafnode->volume.reset();
@@ -405,10 +405,10 @@ input.
 https://github.com/id-Software/Quake-2-Tools/blob/master/bsp/qbsp3/brushbsp.c#L935
 ================
 */
-static twosided<bspbrush_t::ptr> SplitBrush(
+static twosided<bspbrush_t::ptr> SplitBrush(qbsp_context_t &ctx, 
     bspbrush_t::ptr brush, size_t planenum, std::optional<std::reference_wrapper<bspstats_t>> stats)
 {
-    const qplane3d &split = map.planes[planenum];
+    const qplane3d &split = ctx.map.planes[planenum];
     twosided<bspbrush_t::ptr> result;
 
     // check all points
@@ -435,13 +435,13 @@ static twosided<bspbrush_t::ptr> SplitBrush(
     }
 
     // create a new winding from the split plane
-    std::optional<winding_t> w = BaseWindingForPlane<winding_t>(split);
+    std::optional<winding_t> w = BaseWindingForPlane<winding_t>(ctx.options, split);
 
     for (auto &face : brush->sides) {
         if (!w) {
             break;
         }
-        w = w->clip_back(face.get_plane());
+        w = w->clip_back(face.get_plane(ctx.map));
     }
 
     if (!w || WindingIsTiny(*w, 0.02)) { // the brush isn't really split
@@ -453,7 +453,7 @@ static twosided<bspbrush_t::ptr> SplitBrush(
         return result;
     }
 
-    if (WindingIsHuge(*w)) {
+    if (WindingIsHuge(ctx.options, *w)) {
         logging::print("WARNING: huge winding\n");
     }
 
@@ -496,15 +496,15 @@ static twosided<bspbrush_t::ptr> SplitBrush(
 
         if (result[i]->sides.size() < 3) {
             bogus = true;
-        } else if (!result[i]->update_bounds(false)) {
+        } else if (!result[i]->update_bounds(ctx.options, false)) {
             if (stats) {
                 stats->get().c_bogus++;
             }
             bogus = true;
         } else {
             for (int j = 0; j < 3; j++) {
-                if (result[i]->bounds.mins()[j] < -qbsp_options.worldextent.value() ||
-                    result[i]->bounds.maxs()[j] > qbsp_options.worldextent.value()) {
+                if (result[i]->bounds.mins()[j] < -ctx.options.worldextent.value() ||
+                    result[i]->bounds.maxs()[j] > ctx.options.worldextent.value()) {
                     if (stats) {
                         stats->get().c_bogus++;
                     }
@@ -548,10 +548,10 @@ static twosided<bspbrush_t::ptr> SplitBrush(
         // for the brush on the front side of the plane, the `midwinding`
         // (the face that is touching the plane) should have a normal opposite the plane's normal
         cs.planenum = planenum ^ i ^ 1;
-        cs.texinfo = map.skip_texinfo;
+        cs.texinfo = ctx.map.skip_texinfo;
         cs.tested = false;
         cs.onnode = true;
-        Q_assert(!cs.is_visible());
+        Q_assert(!cs.is_visible(ctx.map));
 
         if (brushOnFront) {
             cs.w = midwinding.flip();
@@ -561,8 +561,8 @@ static twosided<bspbrush_t::ptr> SplitBrush(
     }
 
     for (int i = 0; i < 2; i++) {
-        vec_t v1 = BrushVolume(*result[i]);
-        if (v1 < qbsp_options.microvolume.value()) {
+        vec_t v1 = BrushVolume(ctx, *result[i]);
+        if (v1 < ctx.options.microvolume.value()) {
             result[i] = nullptr;
             if (stats) {
                 stats->get().c_tinyvolumes++;
@@ -590,7 +590,7 @@ struct stack_side_t
     stack_winding_t w;
     size_t planenum;
 
-    inline const qbsp_plane_t &get_plane() const { return map.planes[planenum]; }
+    inline const qbsp_plane_t &get_plane(const mapdata_t &map) const { return map.planes[planenum]; }
 };
 
 struct stack_brush_t
@@ -608,7 +608,7 @@ struct stack_brush_t
         }
     }
 
-    inline bool update_bounds()
+    inline bool update_bounds(const settings::qbsp_settings &options)
     {
         this->bounds = {};
 
@@ -620,12 +620,12 @@ struct stack_brush_t
 
         for (size_t i = 0; i < 3; i++) {
             // todo: map_source_location in bspbrush_t
-            if (this->bounds.mins()[0] <= -qbsp_options.worldextent.value() ||
-                this->bounds.maxs()[0] >= qbsp_options.worldextent.value()) {
+            if (this->bounds.mins()[0] <= -options.worldextent.value() ||
+                this->bounds.maxs()[0] >= options.worldextent.value()) {
                 return false;
             }
-            if (this->bounds.mins()[0] >= qbsp_options.worldextent.value() ||
-                this->bounds.maxs()[0] <= -qbsp_options.worldextent.value()) {
+            if (this->bounds.mins()[0] >= options.worldextent.value() ||
+                this->bounds.maxs()[0] <= -options.worldextent.value()) {
                 return false;
             }
         }
@@ -642,9 +642,9 @@ A special, low-allocation version of SplitBrush. Checks if a brush split
 by the specified plane would result in two valid brushes.
 ================
 */
-static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
+static bool CheckSplitBrush(qbsp_context_t &ctx, const bspbrush_t::ptr &brush, size_t planenum)
 {
-    const qplane3d &split = map.planes[planenum];
+    const qplane3d &split = ctx.map.planes[planenum];
 
     // check all points
     vec_t d_front = 0;
@@ -670,13 +670,13 @@ static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
     }
 
     // create a new winding from the split plane
-    std::optional<stack_winding_t> w = BaseWindingForPlane<stack_winding_t>(split);
+    std::optional<stack_winding_t> w = BaseWindingForPlane<stack_winding_t>(ctx.options, split);
 
     for (auto &face : brush->sides) {
         if (!w) {
             return false;
         }
-        w = w->clip_back(face.get_plane());
+        w = w->clip_back(face.get_plane(ctx.map));
     }
 
     if (!w || WindingIsTiny(*w, 0.02)) { // the brush isn't really split
@@ -720,13 +720,13 @@ static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
             return false;
         }
 
-        if (!temporary_brushes[i].update_bounds()) {
+        if (!temporary_brushes[i].update_bounds(ctx.options)) {
             return false;
         }
 
         for (int j = 0; j < 3; j++) {
-            if (temporary_brushes[i].bounds.mins()[j] < -qbsp_options.worldextent.value() ||
-                temporary_brushes[i].bounds.maxs()[j] > qbsp_options.worldextent.value()) {
+            if (temporary_brushes[i].bounds.mins()[j] < -ctx.options.worldextent.value() ||
+                temporary_brushes[i].bounds.maxs()[j] > ctx.options.worldextent.value()) {
                 return false;
             }
         }
@@ -751,8 +751,9 @@ static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
     }
 
     for (int i = 0; i < 2; i++) {
-        vec_t v1 = BrushVolume(temporary_brushes[i].sides, temporary_brushes[i].sides + temporary_brushes[i].num_sides);
-        if (v1 < qbsp_options.microvolume.value()) {
+        vec_t v1 =
+            BrushVolume(ctx, temporary_brushes[i].sides, temporary_brushes[i].sides + temporary_brushes[i].num_sides);
+        if (v1 < ctx.options.microvolume.value()) {
             return false;
         }
     }
@@ -760,11 +761,11 @@ static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
     return true;
 }
 
-inline bool CheckPlaneAgainstVolume(size_t planenum, const node_t *node)
+inline bool CheckPlaneAgainstVolume(qbsp_context_t &ctx, size_t planenum, const node_t *node)
 {
-    bool valid = CheckSplitBrush(node->volume, planenum);
+    bool valid = CheckSplitBrush(ctx, node->volume, planenum);
 #ifdef PARANOID
-    auto [front, back] = SplitBrush(node->volume, planenum, std::nullopt);
+    auto [front, back] = SplitBrush(ctx, node->volume, planenum, std::nullopt);
     Q_assert(valid == (front && back));
 #endif
     return valid;
@@ -848,7 +849,7 @@ ChooseMidPlaneFromList
 The clipping hull BSP doesn't worry about avoiding splits
 ==================
 */
-static side_t *ChooseMidPlaneFromList(const bspbrush_t::container &brushes, const node_t *node)
+static side_t *ChooseMidPlaneFromList(qbsp_context_t &ctx, const bspbrush_t::container &brushes, const node_t *node)
 {
     vec_t bestaxialmetric = VECT_MAX;
     side_t *bestaxialplane = nullptr;
@@ -866,10 +867,10 @@ static side_t *ChooseMidPlaneFromList(const bspbrush_t::container &brushes, cons
             }
 
             size_t positive_planenum = side.planenum & ~1;
-            const qbsp_plane_t &plane = side.get_positive_plane();
+            const qbsp_plane_t &plane = side.get_positive_plane(ctx.map);
 
 #if CHECK_PLANE_AGAINST_VOLUME
-            if (!CheckPlaneAgainstVolume(positive_planenum, node)) {
+            if (!CheckPlaneAgainstVolume(ctx, positive_planenum, node)) {
                 continue; // would produce a tiny volume
             }
 #endif
@@ -904,7 +905,7 @@ Using heuristics, chooses a plane to partition the brushes with.
 Returns nullopt if there are no valid planes to split with.
 ================
 */
-static side_t *SelectSplitPlane(
+static side_t *SelectSplitPlane(qbsp_context_t &ctx, 
     const bspbrush_t::container &brushes, node_t *node, tree_split_t split_type, bspstats_t &stats)
 {
     // no brushes left to split, so we can't use any plane.
@@ -916,17 +917,17 @@ static side_t *SelectSplitPlane(
         if (split_type == tree_split_t::AUTO) {
 
             // decide if we should switch to the midsplit method
-            if (qbsp_options.midsplitbrushfraction.value() != 0.0) {
+            if (ctx.options.midsplitbrushfraction.value() != 0.0) {
                 // new way (opt-in)
                 // how much of the map are we partitioning?
-                double fractionOfMap = brushes.size() / (double)map.total_brushes;
-                if (fractionOfMap > qbsp_options.midsplitbrushfraction.value()) {
+                double fractionOfMap = brushes.size() / (double)ctx.map.total_brushes;
+                if (fractionOfMap > ctx.options.midsplitbrushfraction.value()) {
                     split_type = tree_split_t::FAST;
                 }
             } else {
                 // old way (ericw-tools 0.15.2+)
-                if (qbsp_options.maxnodesize.value() >= 64) {
-                    const vec_t maxnodesize = qbsp_options.maxnodesize.value() - qbsp_options.epsilon.value();
+                if (ctx.options.maxnodesize.value() >= 64) {
+                    const vec_t maxnodesize = ctx.options.maxnodesize.value() - ctx.options.epsilon.value();
 
                     if ((node->bounds.maxs()[0] - node->bounds.mins()[0]) > maxnodesize ||
                         (node->bounds.maxs()[1] - node->bounds.mins()[1]) > maxnodesize ||
@@ -938,11 +939,11 @@ static side_t *SelectSplitPlane(
         }
 
         if (split_type == tree_split_t::FAST) {
-            if (auto mid_plane = ChooseMidPlaneFromList(brushes, node)) {
+            if (auto mid_plane = ChooseMidPlaneFromList(ctx, brushes, node)) {
                 stats.c_midsplit++;
 
                 for (auto &b : brushes) {
-                    b->side = TestBrushToPlanenum(*b, mid_plane->planenum & ~1, nullptr, nullptr, nullptr);
+                    b->side = TestBrushToPlanenum(ctx, *b, mid_plane->planenum & ~1, nullptr, nullptr, nullptr);
                 }
 
                 return mid_plane;
@@ -966,7 +967,7 @@ static side_t *SelectSplitPlane(
     constexpr int numpasses = 4;
     for (int pass = 0; pass < numpasses; pass++) {
         for (auto &brush : brushes) {
-            if ((pass >= 2) != brush->contents.is_any_detail(qbsp_options.target_game))
+            if ((pass >= 2) != brush->contents.is_any_detail(ctx.options.target_game))
                 continue;
             for (auto &side : brush->sides) {
                 if (side.bevel)
@@ -977,18 +978,18 @@ static side_t *SelectSplitPlane(
                     continue; // allready a node splitter
                 if (side.tested)
                     continue; // we allready have metrics for this plane
-                if (side.get_texinfo().flags.is_hintskip)
+                if (side.get_texinfo(ctx.map).flags.is_hintskip)
                     continue; // skip surfaces are never chosen
-                if (side.is_visible() != (pass == 0 || pass == 2))
+                if (side.is_visible(ctx.map) != (pass == 0 || pass == 2))
                     continue; // only check visible faces on pass 0/2
 
                 size_t positive_planenum = side.planenum & ~1;
-                const qbsp_plane_t &plane = side.get_positive_plane(); // always use positive facing plane
+                const qbsp_plane_t &plane = side.get_positive_plane(ctx.map); // always use positive facing plane
 
                 CheckPlaneAgainstParents(positive_planenum, node);
 
 #if CHECK_PLANE_AGAINST_VOLUME
-                if (!CheckPlaneAgainstVolume(positive_planenum, node))
+                if (!CheckPlaneAgainstVolume(ctx, positive_planenum, node))
                     continue; // would produce a tiny volume
 #endif
 
@@ -1002,7 +1003,7 @@ static side_t *SelectSplitPlane(
 
                 for (auto &test : brushes) {
                     int bsplits;
-                    int s = TestBrushToPlanenum(*test, positive_planenum, &bsplits, &hintsplit, &epsilonbrush);
+                    int s = TestBrushToPlanenum(ctx, *test, positive_planenum, &bsplits, &hintsplit, &epsilonbrush);
 
                     splits += bsplits;
                     if (bsplits && (s & PSIDE_FACING))
@@ -1037,7 +1038,7 @@ static side_t *SelectSplitPlane(
                 value -= epsilonbrush * 1000; // avoid!
 
                 // never split a hint side except with another hint
-                if (hintsplit && !(side.get_texinfo().flags.is_hint))
+                if (hintsplit && !(side.get_texinfo(ctx.map).flags.is_hint))
                     value = -9999999;
 
                 // save off the side test so we don't need
@@ -1075,7 +1076,7 @@ static side_t *SelectSplitPlane(
         return nullptr;
     }
 
-    if (!bestside->is_visible()) {
+    if (!bestside->is_visible(ctx.map)) {
         stats.c_nonvis++;
     }
 
@@ -1089,7 +1090,7 @@ static side_t *SelectSplitPlane(
 SplitBrushList
 ================
 */
-static std::array<bspbrush_t::container, 2> SplitBrushList(
+static std::array<bspbrush_t::container, 2> SplitBrushList(qbsp_context_t &ctx, 
     bspbrush_t::container brushes, size_t planenum, bspstats_t &stats)
 {
     std::array<bspbrush_t::container, 2> result;
@@ -1099,7 +1100,7 @@ static std::array<bspbrush_t::container, 2> SplitBrushList(
 
         if (sides == PSIDE_BOTH) {
             // split into two brushes (destructively)
-            auto [front, back] = SplitBrush(std::move(brush), planenum, stats);
+            auto [front, back] = SplitBrush(ctx, std::move(brush), planenum, stats);
 
             if (front) {
                 result[0].push_back(std::move(front));
@@ -1142,11 +1143,11 @@ BuildTree_r
 Called in parallel.
 ==================
 */
-static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::container brushes, tree_split_t split_type,
-    bspstats_t &stats, logging::percent_clock &clock)
+static void BuildTree_r(qbsp_context_t &ctx, tree_t &tree, int level, node_t *node, bspbrush_t::container brushes,
+    tree_split_t split_type, bspstats_t &stats, logging::percent_clock &clock)
 {
     // find the best plane to use as a splitter
-    auto *bestside = SelectSplitPlane(brushes, node, split_type, stats);
+    auto *bestside = SelectSplitPlane(ctx, brushes, node, split_type, stats);
 
     if (!bestside) {
         // this is a leaf node
@@ -1155,7 +1156,7 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
         node->is_leaf = true;
 
         stats.c_leafs++;
-        LeafNode(node, std::move(brushes), stats);
+        LeafNode(ctx, node, std::move(brushes), stats);
 
         return;
     }
@@ -1171,8 +1172,8 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
 
     node->planenum = bestplane;
 
-    auto &plane = map.get_plane(bestplane);
-    auto children = SplitBrushList(std::move(brushes), bestplane, stats);
+    auto &plane = ctx.map.get_plane(bestplane);
+    auto children = SplitBrushList(ctx, std::move(brushes), bestplane, stats);
 
     // allocate children before recursing
     for (int i = 0; i < 2; i++) {
@@ -1191,7 +1192,7 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
 
     // to save time/memory we can destroy node's volume at this point
     if (node->volume) {
-        auto children_volumes = SplitBrush(std::move(node->volume), bestplane, stats);
+        auto children_volumes = SplitBrush(ctx, std::move(node->volume), bestplane, stats);
         node->volume = nullptr;
         node->children[0]->volume = std::move(children_volumes[0]);
         node->children[1]->volume = std::move(children_volumes[1]);
@@ -1199,8 +1200,12 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
 
     // recursively process children
     tbb::task_group g;
-    g.run([&]() { BuildTree_r(tree, level + 1, node->children[0], std::move(children[0]), split_type, stats, clock); });
-    g.run([&]() { BuildTree_r(tree, level + 1, node->children[1], std::move(children[1]), split_type, stats, clock); });
+    g.run([&]() {
+        BuildTree_r(ctx, tree, level + 1, node->children[0], std::move(children[0]), split_type, stats, clock);
+    });
+    g.run([&]() {
+        BuildTree_r(ctx, tree, level + 1, node->children[1], std::move(children[1]), split_type, stats, clock);
+    });
     g.wait();
 }
 
@@ -1217,9 +1222,11 @@ struct brushbsp_input_stats_t : logging::stat_tracker_t
 BrushBSP
 ==================
 */
-void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &brushlist, tree_split_t split_type)
+void BrushBSP(qbsp_context_t &ctx, tree_t &tree, mapentity_t &entity, const bspbrush_t::container &brushlist,
+    tree_split_t split_type)
 {
     logging::header(__func__);
+    logging::timed_scope_t timed_scope(__func__);
 
     if (brushlist.empty()) {
         /*
@@ -1235,11 +1242,11 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
         headnode->planenum = 0;
         headnode->children[0] = tree.create_node();
         headnode->children[0]->is_leaf = true;
-        headnode->children[0]->contents = qbsp_options.target_game->create_empty_contents();
+        headnode->children[0]->contents = ctx.options.target_game->create_empty_contents();
         headnode->children[0]->parent = headnode;
         headnode->children[1] = tree.create_node();
         headnode->children[1]->is_leaf = true;
-        headnode->children[1]->contents = qbsp_options.target_game->create_empty_contents();
+        headnode->children[1]->contents = ctx.options.target_game->create_empty_contents();
         headnode->children[1]->parent = headnode;
 
         tree.bounds = headnode->bounds;
@@ -1257,8 +1264,8 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
 #if 0
             // fixme-brushbsp: why does this just print and do nothing? should
             // the brush be removed?
-            double volume = BrushVolume(*b);
-            if (volume < qbsp_options.microvolume.value()) {
+            double volume = BrushVolume(ctx, *b);
+            if (volume < ctx.options.microvolume.value()) {
                 logging::print("WARNING: {}: microbrush\n",
                     b->mapbrush->line);
             }
@@ -1275,7 +1282,7 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
                     continue;
                 if (!side.w)
                     continue;
-                if (side.is_visible()) {
+                if (side.is_visible(ctx.map)) {
                     stats.faces++;
                 } else {
                     stats.nonvis_faces++;
@@ -1289,21 +1296,21 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
     auto node = tree.create_node();
 
     node->bounds = tree.bounds.grow(SIDESPACE);
-    node->volume = BrushFromBounds(node->bounds);
+    node->volume = BrushFromBounds(ctx, node->bounds);
 
     tree.headnode = node;
 
     bspstats_t stats{};
-    stats.leafstats = qbsp_options.target_game->create_content_stats();
+    stats.leafstats = ctx.options.target_game->create_content_stats();
 
     {
         logging::percent_clock clock;
-        BuildTree_r(tree, 0, tree.headnode, brushlist, split_type, stats, clock);
+        BuildTree_r(ctx, tree, 0, tree.headnode, brushlist, split_type, stats, clock);
     }
 
     stats.print_stats();
 
-    CountLeafs(tree.headnode);
+    CountLeafs(ctx, tree.headnode);
 }
 
 /*
@@ -1313,14 +1320,14 @@ BrushGE
 Returns true if b1 is allowed to bite b2
 ==================
 */
-inline bool BrushGE(const bspbrush_t &b1, const bspbrush_t &b2)
+inline bool BrushGE(qbsp_context_t &ctx, const bspbrush_t &b1, const bspbrush_t &b2)
 {
     // detail brushes never bite structural brushes
-    if ((b1.contents.is_any_detail(qbsp_options.target_game)) &&
-        !(b2.contents.is_any_detail(qbsp_options.target_game))) {
+    if ((b1.contents.is_any_detail(ctx.options.target_game)) &&
+        !(b2.contents.is_any_detail(ctx.options.target_game))) {
         return false;
     }
-    return b1.contents.is_any_solid(qbsp_options.target_game) && b2.contents.is_any_solid(qbsp_options.target_game);
+    return b1.contents.is_any_solid(ctx.options.target_game) && b2.contents.is_any_solid(ctx.options.target_game);
 }
 
 /*
@@ -1361,13 +1368,13 @@ May by empty if A is contained inside B.
 The originals are undisturbed.
 ===============
 */
-inline bspbrush_t::list SubtractBrush(const bspbrush_t::ptr &a, const bspbrush_t::ptr &b)
+inline bspbrush_t::list SubtractBrush(qbsp_context_t &ctx, const bspbrush_t::ptr &a, const bspbrush_t::ptr &b)
 {
     bspbrush_t::list out;
     bspbrush_t::ptr in = a;
 
     for (auto &side : b->sides) {
-        auto [front, back] = SplitBrush(in, side.planenum, std::nullopt);
+        auto [front, back] = SplitBrush(ctx, in, side.planenum, std::nullopt);
 
         if (front) {
             // add to list
@@ -1401,7 +1408,7 @@ of non-intersecting brushes.
 Modifies the input list and may free destroyed brushes.
 =================
 */
-void ChopBrushes(bspbrush_t::container &brushes, bool allow_fragmentation)
+void ChopBrushes(qbsp_context_t &ctx, bspbrush_t::container &brushes, bool allow_fragmentation)
 {
     size_t original_count = brushes.size();
     logging::funcheader();
@@ -1452,8 +1459,8 @@ newlist:
             bspbrush_t::list sub, sub2;
             size_t c1 = std::numeric_limits<size_t>::max(), c2 = c1;
 
-            if (BrushGE(*b2, *b1)) {
-                sub = SubtractBrush(b1, b2);
+            if (BrushGE(ctx, *b2, *b1)) {
+                sub = SubtractBrush(ctx, b1, b2);
                 if (sub.size() == 1 && sub.front() == b1) {
                     continue; // didn't really intersect
                 }
@@ -1466,8 +1473,8 @@ newlist:
                 c1 = sub.size();
             }
 
-            if (BrushGE(*b1, *b2)) {
-                sub2 = SubtractBrush(b2, b1);
+            if (BrushGE(ctx, *b1, *b2)) {
+                sub2 = SubtractBrush(ctx, b2, b1);
                 if (sub2.size() == 1 && sub2.front() == b2) {
                     continue; // didn't really intersect
                 }
@@ -1514,7 +1521,7 @@ newlist:
     brushes.insert(brushes.begin(), std::make_move_iterator(list.begin()), std::make_move_iterator(list.end()));
     logging::print(logging::flag::STAT, "chopped {} brushes into {}\n", original_count, brushes.size());
 
-    if (qbsp_options.debugchop.value()) {
-        WriteBspBrushMap("chopped", brushes);
+    if (ctx.options.debugchop.value()) {
+        WriteBspBrushMap(ctx, "chopped", brushes);
     }
 }
\ No newline at end of file
@@ -85,7 +85,7 @@ SplitFace
 Frees in. Returns {front, back}
 ==================
 */
-std::tuple<std::unique_ptr<face_t>, std::unique_ptr<face_t>> SplitFace(
+std::tuple<std::unique_ptr<face_t>, std::unique_ptr<face_t>> SplitFace(qbsp_context_t &ctx, 
     std::unique_ptr<face_t> in, const qplane3d &split)
 {
     if (in->w.size() < 0)
@@ -101,7 +101,7 @@ std::tuple<std::unique_ptr<face_t>, std::unique_ptr<face_t>> SplitFace(
         return {nullptr, std::move(in)};
     }
 
-    auto [front_winding, back_winding] = in->w.clip(split, qbsp_options.epsilon.value(), true);
+    auto [front_winding, back_winding] = in->w.clip(split, ctx.options.epsilon.value(), true);
 
     if (front_winding && !back_winding) {
         // all in front
@@ -129,7 +129,8 @@ SplitFace
 Moves from `in`. Returns {front, back}
 ==================
 */
-std::tuple<std::optional<side_t>, std::optional<side_t>> SplitFace(side_t &in, const qplane3d &split)
+std::tuple<std::optional<side_t>, std::optional<side_t>> SplitFace(
+    qbsp_context_t &ctx, side_t &in, const qplane3d &split)
 {
     // fixme-brushbsp: restore fast test
 #if 0
@@ -143,7 +144,7 @@ std::tuple<std::optional<side_t>, std::optional<side_t>> SplitFace(side_t &in, c
         counts[SIDE_BACK] = 1;
     } else
 #endif
-    auto [front, back] = in.w.clip(split, qbsp_options.epsilon.value(), false);
+    auto [front, back] = in.w.clip(split, ctx.options.epsilon.value(), false);
 
     // Plane doesn't split this face after all
     if (!front) {
@@ -174,7 +175,8 @@ inside  (inout)     input is the starting set of faces of `brush`, output is the
 outside (out)       outputs the faces of `brush` that are definitely not touching `clipbrush`
 =================
 */
-static void RemoveOutsideFaces(const bspbrush_t &clipbrush, std::vector<side_t> &inside, std::vector<side_t> &outside)
+static void RemoveOutsideFaces(
+    qbsp_context_t &ctx, const bspbrush_t &clipbrush, std::vector<side_t> &inside, std::vector<side_t> &outside)
 {
     std::vector<side_t> oldinside;
 
@@ -187,8 +189,8 @@ static void RemoveOutsideFaces(const bspbrush_t &clipbrush, std::vector<side_t>
         // clip `w` by all of `clipbrush`'s reversed planes,
         // which finds intersection of `w` and `clipbrush`
         for (auto &clipface : clipbrush.sides) {
-            qbsp_plane_t clipplane = -clipface.get_plane();
-            w = std::move(w->clip(clipplane, qbsp_options.epsilon.value(), true)[SIDE_FRONT]);
+            qbsp_plane_t clipplane = -clipface.get_plane(ctx.map);
+            w = std::move(w->clip(clipplane, ctx.options.epsilon.value(), true)[SIDE_FRONT]);
             if (!w)
                 break;
         }
@@ -213,7 +215,7 @@ Faces exactly on the plane will stay inside unless overdrawn by later brush
 clipface    a face of the clipbrush
 =================
 */
-static void ClipInside(
+static void ClipInside(qbsp_context_t &ctx, 
     const side_t &clipface, bool precedence, std::vector<side_t> &inside, std::vector<side_t> &outside)
 {
     std::vector<side_t> oldinside;
@@ -221,7 +223,7 @@ static void ClipInside(
     // effectively make a copy of `inside`, and clear it
     std::swap(inside, oldinside);
 
-    const qbsp_plane_t &splitplane = clipface.get_plane();
+    const qbsp_plane_t &splitplane = clipface.get_plane(ctx.map);
 
     for (side_t &face : oldinside) {
         /* HACK: Check for on-plane but not the same planenum
@@ -230,7 +232,7 @@ static void ClipInside(
         bool spurious_onplane = false;
         {
             std::array<size_t, SIDE_TOTAL> counts =
-                face.w.calc_sides(splitplane, nullptr, nullptr, qbsp_options.epsilon.value());
+                face.w.calc_sides(splitplane, nullptr, nullptr, ctx.options.epsilon.value());
 
             if (counts[SIDE_ON] && !counts[SIDE_FRONT] && !counts[SIDE_BACK]) {
                 spurious_onplane = true;
@@ -241,8 +243,8 @@ static void ClipInside(
 
         /* Handle exactly on-plane faces (ignoring direction) */
         if ((face.planenum ^ 1) == (clipface.planenum ^ 1) || spurious_onplane) {
-            const qplane3d faceplane = face.get_plane();
-            const qplane3d clipfaceplane = clipface.get_plane();
+            const qplane3d faceplane = face.get_plane(ctx.map);
+            const qplane3d clipfaceplane = clipface.get_plane(ctx.map);
             const vec_t dp = qv::dot(faceplane.normal, clipfaceplane.normal);
             const bool opposite = (dp < 0);
 
@@ -257,7 +259,7 @@ static void ClipInside(
             }
         } else {
             /* proper split */
-            std::tie(frags[SIDE_FRONT], frags[SIDE_BACK]) = SplitFace(face, splitplane);
+            std::tie(frags[SIDE_FRONT], frags[SIDE_BACK]) = SplitFace(ctx, face, splitplane);
         }
 
         if (frags[SIDE_FRONT]) {
@@ -309,9 +311,10 @@ Differences from Q1 version:
 fixme-brushbsp: lots of moving of side_t, which is slow
 ==================
 */
-bspbrush_t::container CSGFaces(bspbrush_t::container brushes)
+bspbrush_t::container CSGFaces(qbsp_context_t &ctx, bspbrush_t::container brushes)
 {
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
 
     {
         size_t precsgsides = 0;
@@ -355,7 +358,7 @@ bspbrush_t::container CSGFaces(bspbrush_t::container brushes)
                 overwrite = true;
                 continue;
             }
-            if (!brush->contents.equals(qbsp_options.target_game, clipbrush->contents)) {
+            if (!brush->contents.equals(ctx.options.target_game, clipbrush->contents)) {
                 /* Only consider clipping equal contents against each other */
                 continue;
             }
@@ -377,9 +380,9 @@ bspbrush_t::container CSGFaces(bspbrush_t::container brushes)
 
             std::swap(inside, outside);
 
-            RemoveOutsideFaces(*clipbrush, inside, outside);
+            RemoveOutsideFaces(ctx, *clipbrush, inside, outside);
             for (auto &clipface : clipbrush->sides) {
-                ClipInside(clipface, overwrite, inside, outside);
+                ClipInside(ctx, clipface, overwrite, inside, outside);
             }
 
             // inside = parts of `brush` that are inside `clipbrush`
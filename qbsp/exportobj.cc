@@ -30,36 +30,36 @@
 #include <fstream>
 #include <list>
 
-static std::ofstream InitObjFile(const std::string &filesuffix)
+static std::ofstream InitObjFile(qbsp_context_t &ctx, const std::string &filesuffix)
 {
-    fs::path name = qbsp_options.bsp_path;
-    name.replace_filename(qbsp_options.bsp_path.stem().string() + "_" + filesuffix).replace_extension("obj");
+    fs::path name = ctx.options.bsp_path;
+    name.replace_filename(ctx.options.bsp_path.stem().string() + "_" + filesuffix).replace_extension("obj");
 
     std::ofstream objfile(name);
     if (!objfile)
-        FError("Failed to open {}: {}", qbsp_options.bsp_path, strerror(errno));
+        FError("Failed to open {}: {}", ctx.options.bsp_path, strerror(errno));
 
     return objfile;
 }
 
-static std::ofstream InitMtlFile(const std::string &filesuffix)
+static std::ofstream InitMtlFile(qbsp_context_t &ctx, const std::string &filesuffix)
 {
-    fs::path name = qbsp_options.bsp_path;
-    name.replace_filename(qbsp_options.bsp_path.stem().string() + "_" + filesuffix).replace_extension("mtl");
+    fs::path name = ctx.options.bsp_path;
+    name.replace_filename(ctx.options.bsp_path.stem().string() + "_" + filesuffix).replace_extension("mtl");
 
     std::ofstream file(name);
     if (!file)
-        FError("Failed to open {}: {}", qbsp_options.bsp_path, strerror(errno));
+        FError("Failed to open {}: {}", ctx.options.bsp_path, strerror(errno));
 
     return file;
 }
 
-static void ExportObjFace(
+static void ExportObjFace(qbsp_context_t &ctx, 
     std::ofstream &f, std::string_view mtlname, const winding_t &w, const maptexinfo_t &texinfo, int *vertcount)
 {
-    const char *texname = map.miptexTextureName(texinfo.miptex).c_str();
+    const char *texname = ctx.map.miptexTextureName(texinfo.miptex).c_str();
 
-    const auto &texture = map.load_image_meta(texname);
+    const auto &texture = ctx.map.load_image_meta(ctx.options, texname);
     const int width = texture ? texture->width : 64;
     const int height = texture ? texture->height : 64;
 
@@ -99,10 +99,10 @@ static void WriteContentsMaterial(std::ofstream &mtlf, contentflags_t contents,
     mtlf << "illum 0\n";
 }
 
-void ExportObj_Faces(const std::string &filesuffix, const std::vector<const face_t *> &faces)
+void ExportObj_Faces(qbsp_context_t &ctx, const std::string &filesuffix, const std::vector<const face_t *> &faces)
 {
-    std::ofstream objfile = InitObjFile(filesuffix);
-    std::ofstream mtlfile = InitMtlFile(filesuffix);
+    std::ofstream objfile = InitObjFile(ctx, filesuffix);
+    std::ofstream mtlfile = InitMtlFile(ctx, filesuffix);
 
     WriteContentsMaterial(mtlfile, {}, 0, 0, 0);
     WriteContentsMaterial(mtlfile, {CONTENTS_EMPTY}, 0, 1, 0);
@@ -123,18 +123,18 @@ void ExportObj_Faces(const std::string &filesuffix, const std::vector<const face
     for (const face_t *face : faces) {
         std::string mtlname = fmt::format("contents{}\n", face->contents.back.native);
 
-        ExportObjFace(objfile, mtlname, face->w, face->get_texinfo(), &vertcount);
+        ExportObjFace(ctx, objfile, mtlname, face->w, face->get_texinfo(ctx.map), &vertcount);
     }
 }
 
-void ExportObj_Brushes(const std::string &filesuffix, const bspbrush_t::container &brushes)
+void ExportObj_Brushes(qbsp_context_t &ctx, const std::string &filesuffix, const bspbrush_t::container &brushes)
 {
-    std::ofstream objfile = InitObjFile(filesuffix);
+    std::ofstream objfile = InitObjFile(ctx, filesuffix);
 
     int vertcount = 0;
     for (auto &brush : brushes) {
         for (auto &side : brush->sides) {
-            ExportObjFace(objfile, {}, side.w, side.get_texinfo(), &vertcount);
+            ExportObjFace(ctx, objfile, {}, side.w, side.get_texinfo(ctx.map), &vertcount);
         }
     }
 }
@@ -153,33 +153,33 @@ static void ExportObj_Nodes_r(const node_t *node, std::vector<const face_t *> *d
     ExportObj_Nodes_r(node->children[1], dest);
 }
 
-void ExportObj_Nodes(const std::string &filesuffix, const node_t *nodes)
+void ExportObj_Nodes(qbsp_context_t &ctx, const std::string &filesuffix, const node_t *nodes)
 {
     std::vector<const face_t *> faces;
     ExportObj_Nodes_r(nodes, &faces);
-    ExportObj_Faces(filesuffix, faces);
+    ExportObj_Faces(ctx, filesuffix, faces);
 }
 
-static void ExportObj_Marksurfaces_r(const node_t *node, std::unordered_set<const face_t *> *dest)
+static void ExportObj_Marksurfaces_r(qbsp_context_t &ctx, const node_t *node, std::unordered_set<const face_t *> *dest)
 {
     if (!node->is_leaf) {
-        ExportObj_Marksurfaces_r(node->children[0], dest);
-        ExportObj_Marksurfaces_r(node->children[1], dest);
+        ExportObj_Marksurfaces_r(ctx, node->children[0], dest);
+        ExportObj_Marksurfaces_r(ctx, node->children[1], dest);
         return;
     }
 
     for (auto &face : node->markfaces) {
-        if (!face->get_texinfo().flags.is_nodraw) {
+        if (!face->get_texinfo(ctx.map).flags.is_nodraw) {
             dest->insert(face);
         }
     }
 }
 
-void ExportObj_Marksurfaces(const std::string &filesuffix, const node_t *nodes)
+void ExportObj_Marksurfaces(qbsp_context_t &ctx, const std::string &filesuffix, const node_t *nodes)
 {
     // many leafs will mark the same face, so collect them in an unordered_set to filter out duplicates
     std::unordered_set<const face_t *> faces;
-    ExportObj_Marksurfaces_r(nodes, &faces);
+    ExportObj_Marksurfaces_r(ctx, nodes, &faces);
 
     // copy to a vector
     std::vector<const face_t *> faces_vec;
@@ -187,5 +187,5 @@ void ExportObj_Marksurfaces(const std::string &filesuffix, const node_t *nodes)
     for (const face_t *face : faces) {
         faces_vec.push_back(face);
     }
-    ExportObj_Faces(filesuffix, faces_vec);
+    ExportObj_Faces(ctx, filesuffix, faces_vec);
 }
@@ -30,6 +30,10 @@
 #include <qbsp/writebsp.hh>
 
 #include <list>
+#include <numeric>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
 
 struct makefaces_stats_t : logging::stat_tracker_t
 {
@@ -38,88 +42,79 @@ struct makefaces_stats_t : logging::stat_tracker_t
     stat &c_subdivide = register_stat("subdivided");
 };
 
-static bool ShouldOmitFace(face_t *f)
+static bool ShouldOmitFace(qbsp_context_t &ctx, face_t *f)
 {
-    if (!qbsp_options.includeskip.value() && f->get_texinfo().flags.is_nodraw) {
+    if (!ctx.options.includeskip.value() && f->get_texinfo(ctx.map).flags.is_nodraw) {
         // TODO: move to game specific
         // always include LIGHT
-        if (qbsp_options.target_game->id == GAME_QUAKE_II && (f->get_texinfo().flags.native & Q2_SURF_LIGHT))
+        if (ctx.options.target_game->id == GAME_QUAKE_II && (f->get_texinfo(ctx.map).flags.native & Q2_SURF_LIGHT))
             return false;
 
         return true;
     }
-    if (map.mtexinfos.at(f->texinfo).flags.is_hint)
+    if (ctx.map.mtexinfos.at(f->texinfo).flags.is_hint)
         return true;
 
     // HACK: to save a few faces, don't output the interior faces of sky brushes
-    if (f->contents.front.is_sky(qbsp_options.target_game)) {
+    if (f->contents.front.is_sky(ctx.options.target_game)) {
         return true;
     }
 
     // omit faces fully covered by detail wall
     if (!f->markleafs.empty() && std::all_of(f->markleafs.begin(), f->markleafs.end(),
-                                     [](auto *l) { return l->contents.is_detail_wall(qbsp_options.target_game); })) {
+                                     [&](auto *l) { return l->contents.is_detail_wall(ctx.options.target_game); })) {
         return true;
     }
 
     return false;
 }
 
-static void MergeNodeFaces(node_t *node, makefaces_stats_t &stats)
+static void MergeNodeFaces(qbsp_context_t &ctx, node_t *node, makefaces_stats_t &stats)
 {
-    node->facelist = MergeFaceList(std::move(node->facelist), stats.c_merge);
+    node->facelist = MergeFaceList(ctx, std::move(node->facelist), stats.c_merge);
 }
 
-/*
-=============
-EmitVertex
-=============
-*/
-inline void EmitVertex(const qvec3d &vert, size_t &vert_id)
+static void GatherEmittedFaces_R(qbsp_context_t &ctx, node_t *node, std::vector<face_t *> &faces)
 {
-    // already added
-    if (auto v = map.find_emitted_hash_vector(vert)) {
-        vert_id = *v;
+    if (node->is_leaf) {
         return;
     }
 
-    // add new vertex!
-    map.add_hash_vector(vert, vert_id = map.bsp.dvertexes.size());
+    for (auto &f : node->facelist) {
+        if (!ShouldOmitFace(ctx, f.get())) {
+            faces.push_back(f.get());
+        }
+    }
 
-    map.bsp.dvertexes.emplace_back(vert);
+    GatherEmittedFaces_R(ctx, node->children[0], faces);
+    GatherEmittedFaces_R(ctx, node->children[1], faces);
 }
 
 // output final vertices
-static void EmitFaceVertices(face_t *f)
+void EmitVertices(qbsp_context_t &ctx, node_t *headnode)
 {
-    if (ShouldOmitFace(f)) {
-        return;
-    }
+    std::vector<face_t *> faces;
+    GatherEmittedFaces_R(ctx, headnode, faces);
 
-    f->original_vertices.resize(f->w.size());
+    // flatten the windings, in the same order a serial walk would emit them
+    std::vector<size_t> first_point(faces.size() + 1, 0);
 
-    for (size_t i = 0; i < f->w.size(); i++) {
-        EmitVertex(f->w[i], f->original_vertices[i]);
+    for (size_t i = 0; i < faces.size(); i++) {
+        first_point[i + 1] = first_point[i] + faces[i]->w.size();
     }
-}
 
-static void EmitVertices_R(node_t *node)
-{
-    if (node->is_leaf) {
-        return;
-    }
+    std::vector<qvec3d> points(first_point.back());
 
-    for (auto &f : node->facelist) {
-        EmitFaceVertices(f.get());
-    }
+    tbb::parallel_for(static_cast<size_t>(0), faces.size(), [&](size_t i) {
+        std::copy(faces[i]->w.begin(), faces[i]->w.end(), points.begin() + first_point[i]);
+    });
 
-    EmitVertices_R(node->children[0]);
-    EmitVertices_R(node->children[1]);
-}
+    std::vector<size_t> indices = ctx.map.emit_hash_vectors(points);
 
-void EmitVertices(node_t *headnode)
-{
-    EmitVertices_R(headnode);
+    tbb::parallel_for(static_cast<size_t>(0), faces.size(), [&](size_t i) {
+        faces[i]->original_vertices.assign(
+            indices.begin() + first_point[i], indices.begin() + first_point[i + 1]);
+    });
 }
 
 //===========================================================================
@@ -130,128 +125,139 @@ struct emit_faces_stats_t : logging::stat_tracker_t
     stat &unique_faces = register_stat("faces");
 };
 
+struct emitted_fragment_t
+{
+    face_t *face;
+    face_fragment_t *fragment;
+    // offset of the fragment's first half-edge
+    size_t first_edge;
+};
+
 /*
-==================
-GetEdge
+================
+GatherFragments_R
 
-Returns a global edge number, possibly negative to indicate a backwards edge.
-==================
+Collects the fragments to emit in tree order, and sets each node's face
+range to match.
+================
 */
-inline int64_t GetEdge(const size_t &v1, const size_t &v2, const face_t *face, emit_faces_stats_t &stats)
+static void GatherFragments_R(
+    qbsp_context_t &ctx, node_t *node, std::vector<emitted_fragment_t> &fragments, size_t &num_edges)
 {
-    if (!face->contents.front.is_valid(qbsp_options.target_game, false))
-        FError("Face with invalid contents");
-
-    if (!qbsp_options.noedgereuse.value()) {
-        // search for existing edges
-        if (auto it = map.hashedges.find(std::make_pair(v2, v1)); it != map.hashedges.end()) {
-            const hashedge_t &existing = it->second;
-            // this content check is required for software renderers
-            // (see q1_liquid_software test case)
-            if (existing.face->contents.front.equals(qbsp_options.target_game, face->contents.front)) {
-                return -existing.edge_index;
-            }
-        }
+    if (node->is_leaf) {
+        return;
     }
 
-    /* emit an edge */
-    int64_t i = map.bsp.dedges.size();
-
-    map.bsp.dedges.emplace_back(bsp2_dedge_t{static_cast<uint32_t>(v1), static_cast<uint32_t>(v2)});
+    node->firstface = static_cast<int>(ctx.map.bsp.dfaces.size() + fragments.size());
 
-    map.add_hash_edge(v1, v2, i, face);
+    for (auto &face : node->facelist) {
+        for (auto &fragment : face->fragments) {
+            Q_assert(fragment.outputnumber == std::nullopt);
 
-    stats.unique_edges++;
+            // this can't really happen, but just in case it ever does..
+            // (I use this in testing to find faces of interest)
+            if (!fragment.output_vertices.size()) {
+                logging::print("WARNING: zero-point triangle attempted to be emitted\n");
+                continue;
+            }
 
-    return i;
-}
+            if (ctx.options.maxedges.value() && fragment.output_vertices.size() > ctx.options.maxedges.value()) {
+                FError("Internal error: face->numpoints > max edges ({})", ctx.options.maxedges.value());
+            }
 
-static void EmitEdges(face_t *face, face_fragment_t *fragment, emit_faces_stats_t &stats)
-{
-    Q_assert(fragment->outputnumber == std::nullopt);
+            if (!face->contents.front.is_valid(ctx.options.target_game, false))
+                FError("Face with invalid contents");
 
-    if (qbsp_options.maxedges.value() && fragment->output_vertices.size() > qbsp_options.maxedges.value()) {
-        FError("Internal error: face->numpoints > max edges ({})", qbsp_options.maxedges.value());
+            fragments.push_back({face.get(), &fragment, num_edges});
+            num_edges += fragment.output_vertices.size();
+        }
     }
 
-    fragment->edges.resize(fragment->output_vertices.size());
+    node->numfaces = static_cast<int>(ctx.map.bsp.dfaces.size() + fragments.size()) - node->firstface;
 
-    for (size_t i = 0; i < fragment->output_vertices.size(); i++) {
-        auto &p1 = fragment->output_vertices[i];
-        auto &p2 = fragment->output_vertices[(i + 1) % fragment->output_vertices.size()];
-        fragment->edges[i] = GetEdge(p1, p2, face, stats);
-    }
+    GatherFragments_R(ctx, node->children[0], fragments, num_edges);
+    GatherFragments_R(ctx, node->children[1], fragments, num_edges);
 }
 
 /*
-==============
-EmitFaceFragment
-==============
+==================
+AssignEdges
+
+Works out which half-edges get a new edge and which reuse the edge of an
+earlier face running the other way. Returns, for each half-edge, either
+its own index (a new edge) or the index of the half-edge it reuses.
+
+A half-edge v1 -> v2 can only reuse an earlier v2 -> v1, so half-edges are
+grouped by their unordered vertex pair and each group is resolved in
+emission order independently of the others; the result is identical to
+resolving them all one at a time.
+==================
 */
-static void EmitFaceFragment(face_t *face, face_fragment_t *fragment, emit_faces_stats_t &stats)
+static std::vector<size_t> AssignEdges(qbsp_context_t &ctx, 
+    const std::vector<emitted_fragment_t> &fragments, const std::vector<std::array<size_t, 2>> &half_edges)
 {
-    // this can't really happen, but just in case it ever does..
-    // (I use this in testing to find faces of interest)
-    if (!fragment->output_vertices.size()) {
-        logging::print("WARNING: zero-point triangle attempted to be emitted\n");
-        return;
+    std::vector<size_t> source(half_edges.size());
+
+    if (ctx.options.noedgereuse.value()) {
+        std::iota(source.begin(), source.end(), 0);
+        return source;
     }
 
-    int i;
+    std::vector<const face_t *> faces(half_edges.size());
 
-    // emit a region
-    Q_assert(!fragment->outputnumber.has_value());
-    fragment->outputnumber = map.bsp.dfaces.size();
+    tbb::parallel_for(static_cast<size_t>(0), fragments.size(), [&](size_t i) {
+        std::fill_n(faces.begin() + fragments[i].first_edge, fragments[i].fragment->output_vertices.size(),
+            fragments[i].face);
+    });
 
-    mface_t &out = map.bsp.dfaces.emplace_back();
+    // sort by unordered vertex pair, then by emission order
+    std::vector<std::pair<std::pair<size_t, size_t>, size_t>> order(half_edges.size());
 
-    // emit lmshift
-    map.exported_lmshifts.push_back(face->original_side->lmshift);
-    Q_assert(map.bsp.dfaces.size() == map.exported_lmshifts.size());
+    tbb::parallel_for(static_cast<size_t>(0), half_edges.size(), [&](size_t i) {
+        auto [v1, v2] = half_edges[i];
+        order[i] = {std::minmax(v1, v2), i};
+    });
 
-    out.planenum = ExportMapPlane(face->planenum & ~1);
-    out.side = face->planenum & 1;
-    out.texinfo = ExportMapTexinfo(face->texinfo);
-    for (i = 0; i < MAXLIGHTMAPS; i++)
-        out.styles[i] = 255;
-    out.lightofs = -1;
+    tbb::parallel_sort(order.begin(), order.end());
 
-    // emit surfedges
-    out.firstedge = static_cast<int32_t>(map.bsp.dsurfedges.size());
-    std::copy(fragment->edges.cbegin(), fragment->edges.cbegin() + fragment->output_vertices.size(),
-        std::back_inserter(map.bsp.dsurfedges));
-    fragment->edges.clear();
+    std::vector<size_t> group_starts;
 
-    out.numedges = static_cast<int32_t>(map.bsp.dsurfedges.size()) - out.firstedge;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (i == 0 || order[i].first != order[i - 1].first) {
+            group_starts.push_back(i);
+        }
+    }
 
-    stats.unique_faces++;
-}
+    group_starts.push_back(order.size());
 
-/*
-================
-MakeFaceEdges_r
-================
-*/
-static void EmitFaces_R(node_t *node, emit_faces_stats_t &stats)
-{
-    if (node->is_leaf) {
-        return;
-    }
+    tbb::parallel_for(static_cast<size_t>(0), group_starts.size() - 1, [&](size_t g) {
+        // the first half-edge emitted in each direction; only the first
+        // one is hashed, later ones in the same direction can't replace it
+        std::array<std::optional<size_t>, 2> first_in_direction;
 
-    node->firstface = static_cast<int>(map.bsp.dfaces.size());
+        for (size_t i = group_starts[g]; i < group_starts[g + 1]; i++) {
+            const size_t e = order[i].second;
+            auto [v1, v2] = half_edges[e];
+            auto &reverse = first_in_direction[v2 < v1 ? 0 : 1];
 
-    for (auto &face : node->facelist) {
-        // emit a region
-        for (auto &fragment : face->fragments) {
-            EmitEdges(face.get(), &fragment, stats);
-            EmitFaceFragment(face.get(), &fragment, stats);
-        }
-    }
+            // this content check is required for software renderers
+            // (see q1_liquid_software test case)
+            if (reverse && faces[*reverse]->contents.front.equals(ctx.options.target_game, faces[e]->contents.front)) {
+                source[e] = *reverse;
+                continue;
+            }
+
+            source[e] = e;
+
+            auto &forward = first_in_direction[v1 < v2 ? 0 : 1];
 
-    node->numfaces = static_cast<int>(map.bsp.dfaces.size()) - node->firstface;
+            if (!forward) {
+                forward = e;
+            }
+        }
+    });
 
-    EmitFaces_R(node->children[0], stats);
-    EmitFaces_R(node->children[1], stats);
+    return source;
 }
 
 /*
@@ -259,19 +265,88 @@ static void EmitFaces_R(node_t *node, emit_faces_stats_t &stats)
 MakeFaceEdges
 ================
 */
-size_t EmitFaces(node_t *headnode)
+size_t EmitFaces(qbsp_context_t &ctx, node_t *headnode)
 {
     logging::funcheader();
 
-    Q_assert(map.hashedges.empty());
-
     emit_faces_stats_t stats;
 
-    size_t firstface = map.bsp.dfaces.size();
+    size_t firstface = ctx.map.bsp.dfaces.size();
 
-    EmitFaces_R(headnode, stats);
+    std::vector<emitted_fragment_t> fragments;
+    size_t num_half_edges = 0;
 
-    map.hashedges.clear();
+    GatherFragments_R(ctx, headnode, fragments, num_half_edges);
+
+    std::vector<std::array<size_t, 2>> half_edges(num_half_edges);
+
+    tbb::parallel_for(static_cast<size_t>(0), fragments.size(), [&](size_t i) {
+        auto &verts = fragments[i].fragment->output_vertices;
+
+        for (size_t j = 0; j < verts.size(); j++) {
+            half_edges[fragments[i].first_edge + j] = {verts[j], verts[(j + 1) % verts.size()]};
+        }
+    });
+
+    std::vector<size_t> source = AssignEdges(ctx, fragments, half_edges);
+
+    // number the new edges in emission order
+    const size_t first_edge = ctx.map.bsp.dedges.size();
+    std::vector<int64_t> edge_numbers(num_half_edges);
+    size_t num_edges = 0;
+
+    for (size_t i = 0; i < num_half_edges; i++) {
+        if (source[i] == i) {
+            edge_numbers[i] = first_edge + num_edges++;
+        }
+    }
+
+    stats.unique_edges += num_edges;
+
+    ctx.map.bsp.dedges.resize(first_edge + num_edges);
+
+    const size_t first_surfedge = ctx.map.bsp.dsurfedges.size();
+    ctx.map.bsp.dsurfedges.resize(first_surfedge + num_half_edges);
+
+    tbb::parallel_for(static_cast<size_t>(0), num_half_edges, [&](size_t i) {
+        if (source[i] == i) {
+            ctx.map.bsp.dedges[edge_numbers[i]] =
+                bsp2_dedge_t{static_cast<uint32_t>(half_edges[i][0]), static_cast<uint32_t>(half_edges[i][1])};
+            ctx.map.bsp.dsurfedges[first_surfedge + i] = static_cast<int32_t>(edge_numbers[i]);
+        } else {
+            ctx.map.bsp.dsurfedges[first_surfedge + i] = static_cast<int32_t>(-edge_numbers[source[i]]);
+        }
+    });
+
+    // exporting planes and texinfos assigns output numbers, so the faces
+    // themselves are emitted in order
+    ctx.map.bsp.dfaces.reserve(ctx.map.bsp.dfaces.size() + fragments.size());
+
+    for (auto &emitted : fragments) {
+        face_t *face = emitted.face;
+
+        // emit a region
+        emitted.fragment->outputnumber = ctx.map.bsp.dfaces.size();
+
+        mface_t &out = ctx.map.bsp.dfaces.emplace_back();
+
+        // emit lmshift
+        ctx.map.exported_lmshifts.push_back(face->original_side->lmshift);
+        Q_assert(ctx.map.bsp.dfaces.size() == ctx.map.exported_lmshifts.size());
+
+        out.planenum = ExportMapPlane(ctx, face->planenum & ~1);
+        out.side = face->planenum & 1;
+        out.texinfo = ExportMapTexinfo(ctx, face->texinfo);
+        for (int i = 0; i < MAXLIGHTMAPS; i++)
+            out.styles[i] = 255;
+        out.lightofs = -1;
+
+        // emit surfedges
+        out.firstedge = static_cast<int32_t>(first_surfedge + emitted.first_edge);
+        out.numedges = static_cast<int32_t>(emitted.fragment->output_vertices.size());
+
+        stats.unique_faces++;
+    }
 
     return firstface;
 }
@@ -285,7 +360,7 @@ AddMarksurfaces_r
 Adds the given face to the markfaces lists of all descendant leafs of `node`.
 ================
 */
-static void AddMarksurfaces_r(face_t *face, std::unique_ptr<face_t> face_copy, node_t *node)
+static void AddMarksurfaces_r(qbsp_context_t &ctx, face_t *face, std::unique_ptr<face_t> face_copy, node_t *node)
 {
     if (node->is_leaf) {
         node->markfaces.push_back(face);
@@ -293,14 +368,14 @@ static void AddMarksurfaces_r(face_t *face, std::unique_ptr<face_t> face_copy, n
         return;
     }
 
-    const qplane3d &splitplane = node->get_plane();
+    const qplane3d &splitplane = node->get_plane(ctx.map);
 
-    auto [frontFragment, backFragment] = SplitFace(std::move(face_copy), splitplane);
+    auto [frontFragment, backFragment] = SplitFace(ctx, std::move(face_copy), splitplane);
     if (frontFragment) {
-        AddMarksurfaces_r(face, std::move(frontFragment), node->children[0]);
+        AddMarksurfaces_r(ctx, face, std::move(frontFragment), node->children[0]);
     }
     if (backFragment) {
-        AddMarksurfaces_r(face, std::move(backFragment), node->children[1]);
+        AddMarksurfaces_r(ctx, face, std::move(backFragment), node->children[1]);
     }
 }
 
@@ -311,7 +386,7 @@ MakeMarkFaces
 Populates the `markfaces` vectors of all leafs
 ================
 */
-void MakeMarkFaces(node_t *node)
+void MakeMarkFaces(qbsp_context_t &ctx, node_t *node)
 {
     if (node->is_leaf) {
         return;
@@ -322,12 +397,12 @@ void MakeMarkFaces(node_t *node)
         // add this face to all descendant leafs it touches
 
         // make a copy we can clip
-        AddMarksurfaces_r(face.get(), CopyFace(face.get()), node->children[face->planenum & 1]);
+        AddMarksurfaces_r(ctx, face.get(), CopyFace(face.get()), node->children[face->planenum & 1]);
     }
 
     // process child nodes recursively
-    MakeMarkFaces(node->children[0]);
-    MakeMarkFaces(node->children[1]);
+    MakeMarkFaces(ctx, node->children[0]);
+    MakeMarkFaces(ctx, node->children[1]);
 }
 
 /*
@@ -338,7 +413,8 @@ If the face is >256 in either texture direction, carve a valid sized
 piece off and insert the remainder in the next link
 ===============
 */
-static std::list<std::unique_ptr<face_t>> SubdivideFace(std::unique_ptr<face_t> f, makefaces_stats_t &stats)
+static std::list<std::unique_ptr<face_t>> SubdivideFace(
+    qbsp_context_t &ctx, std::unique_ptr<face_t> f, makefaces_stats_t &stats)
 {
     vec_t mins, maxs;
     vec_t v;
@@ -349,9 +425,9 @@ static std::list<std::unique_ptr<face_t>> SubdivideFace(std::unique_ptr<face_t>
     int lmshift;
 
     /* special (non-surface cached) faces don't need subdivision */
-    const maptexinfo_t &tex = f->get_texinfo();
+    const maptexinfo_t &tex = f->get_texinfo(ctx.map);
 
-    if (tex.flags.is_nodraw || tex.flags.is_hint || !qbsp_options.target_game->surf_is_subdivided(tex.flags)) {
+    if (tex.flags.is_nodraw || tex.flags.is_hint || !ctx.options.target_game->surf_is_subdivided(tex.flags)) {
         std::list<std::unique_ptr<face_t>> result;
         result.push_back(std::move(f));
         return result;
@@ -366,7 +442,7 @@ static std::list<std::unique_ptr<face_t>> SubdivideFace(std::unique_ptr<face_t>
 
     // legacy engines support 18*18 max blocks (at 1:16 scale).
     // the 18*18 limit can be relaxed in certain engines, and doing so will generally give a performance boost.
-    subdiv = std::min(qbsp_options.subdivide.value(), 255 << lmshift);
+    subdiv = std::min(ctx.options.subdivide.value(), 255 << lmshift);
 
     //      subdiv += 8;
 
@@ -420,7 +496,7 @@ static std::list<std::unique_ptr<face_t>> SubdivideFace(std::unique_ptr<face_t>
 
             std::unique_ptr<face_t> front;
             std::unique_ptr<face_t> back;
-            std::tie(front, back) = SplitFace(std::move(f), plane);
+            std::tie(front, back) = SplitFace(ctx, std::move(f), plane);
             if (!front || !back) {
                 // logging::print("didn't split\n");
                 //  FError("Didn't split the polygon");
@@ -445,13 +521,13 @@ static std::list<std::unique_ptr<face_t>> SubdivideFace(std::unique_ptr<face_t>
     return surfaces;
 }
 
-static void SubdivideNodeFaces(node_t *node, makefaces_stats_t &stats)
+static void SubdivideNodeFaces(qbsp_context_t &ctx, node_t *node, makefaces_stats_t &stats)
 {
     std::list<std::unique_ptr<face_t>> result;
 
     // subdivide each face and push the results onto subdivided
     for (auto &face : node->facelist) {
-        result.splice(result.end(), SubdivideFace(std::move(face), stats));
+        result.splice(result.end(), SubdivideFace(ctx, std::move(face), stats));
     }
 
     node->facelist = std::move(result);
@@ -508,24 +584,24 @@ mark the side that originally created it
   water / water : none
 ===============
 */
-static void MakeFaces_r(node_t *node, makefaces_stats_t &stats)
+static void MakeFaces_r(qbsp_context_t &ctx, node_t *node, makefaces_stats_t &stats)
 {
     // recurse down to leafs
     if (!node->is_leaf) {
-        MakeFaces_r(node->children[0], stats);
-        MakeFaces_r(node->children[1], stats);
+        MakeFaces_r(ctx, node->children[0], stats);
+        MakeFaces_r(ctx, node->children[1], stats);
 
         // merge together all visible faces on the node
-        if (!qbsp_options.nomerge.value())
-            MergeNodeFaces(node, stats);
-        if (qbsp_options.subdivide.boolValue())
-            SubdivideNodeFaces(node, stats);
+        if (!ctx.options.nomerge.value())
+            MergeNodeFaces(ctx, node, stats);
+        if (ctx.options.subdivide.boolValue())
+            SubdivideNodeFaces(ctx, node, stats);
 
         return;
     }
 
     // solid leafs never have visible faces
-    if (node->contents.is_any_solid(qbsp_options.target_game))
+    if (node->contents.is_any_solid(ctx.options.target_game))
         return;
 
     // see which portals are valid
@@ -551,11 +627,12 @@ static void MakeFaces_r(node_t *node, makefaces_stats_t &stats)
 MakeFaces
 ============
 */
-void MakeFaces(node_t *node)
+void MakeFaces(qbsp_context_t &ctx, node_t *node)
 {
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
 
     makefaces_stats_t stats{};
 
-    MakeFaces_r(node, stats);
+    MakeFaces_r(ctx, node, stats);
 }
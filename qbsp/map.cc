@@ -42,25 +42,117 @@
 #include <common/qvec.hh>
 #include <common/ostream.hh>
 
-#include <pareto/spatial_map.h>
-
-mapdata_t map;
+#include <tbb/concurrent_unordered_map.h>
+#include <tbb/parallel_for.h>
 
 mapplane_t::mapplane_t(const qbsp_plane_t &copy)
     : qbsp_plane_t(copy)
 {
 }
 
+// hashes a point quantized onto a grid
+template<size_t N>
+struct cell_hash_t
+{
+    size_t operator()(const std::array<int64_t, N> &key) const noexcept
+    {
+        size_t h = 0;
+
+        for (auto &v : key) {
+            h ^= std::hash<int64_t>()(v) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        }
+
+        return h;
+    }
+};
+
+// the grid is offset by half a cell so that exact values (0, +/-1,
+// integers) sit in the middle of a cell
+static int64_t QuantizeToCell(vec_t value, vec_t cell)
+{
+    return static_cast<int64_t>(std::floor(value / cell + 0.5));
+}
+
+// calls func on every value stored in a cell overlapped by [first, last]
+template<typename Map, size_t N, typename F>
+static void VisitCells(
+    const Map &hash, const std::array<int64_t, N> &first, const std::array<int64_t, N> &last, F &&func)
+{
+    std::array<int64_t, N> key = first;
+
+    while (true) {
+        auto [begin, end] = hash.equal_range(key);
+
+        for (auto it = begin; it != end; ++it) {
+            func(it->second);
+        }
+
+        size_t i = 0;
+
+        for (; i < N; i++) {
+            if (key[i] < last[i]) {
+                key[i]++;
+                break;
+            }
+
+            key[i] = first[i];
+        }
+
+        if (i == N) {
+            break;
+        }
+    }
+}
+
+// planes are bucketed by quantizing each component onto a grid twice as
+// wide as its epsilon. a lookup only has to visit a neighbouring cell when
+// a component is near a cell boundary, so the common case is a single bucket.
 struct planehash_t
 {
-    // planes indices (into the `planes` vector)
-    pareto::spatial_map<vec_t, 4, size_t> hash;
+    static constexpr vec_t NORMAL_CELL = NORMAL_EPSILON * 2;
+    static constexpr vec_t DIST_CELL = DIST_EPSILON * 2;
+
+    using key_t = std::array<int64_t, 4>;
+
+    static key_t key(const qvec4d &point)
+    {
+        return {QuantizeToCell(point[0], NORMAL_CELL), QuantizeToCell(point[1], NORMAL_CELL),
+            QuantizeToCell(point[2], NORMAL_CELL), QuantizeToCell(point[3], DIST_CELL)};
+    }
+
+    static key_t key(const qplane3d &plane)
+    {
+        return key(qvec4d{plane.normal[0], plane.normal[1], plane.normal[2], plane.dist});
+    }
+
+    // planes indices (into the `planes` vector); safe to read while
+    // another thread is inserting
+    tbb::concurrent_unordered_multimap<key_t, size_t, cell_hash_t<4>> hash;
+
+    // serializes insertion, so that two threads can't add the same plane
+    std::mutex insert_lock;
 };
 
+// same scheme as planehash_t, with POINT_EQUAL_EPSILON
 struct vertexhash_t
 {
+    static constexpr vec_t CELL = POINT_EQUAL_EPSILON * 2;
+
+    using key_t = std::array<int64_t, 3>;
+
+    static key_t key(const qvec3d &point)
+    {
+        return {QuantizeToCell(point[0], CELL), QuantizeToCell(point[1], CELL), QuantizeToCell(point[2], CELL)};
+    }
+
+    struct entry_t
+    {
+        qvec3d point;
+        size_t index;
+    };
+
     // hashed vertices; generated by EmitVertices
-    pareto::spatial_map<vec_t, 3, size_t> hash;
+    tbb::concurrent_unordered_multimap<key_t, entry_t, cell_hash_t<3>> hash;
 };
 
 mapdata_t::mapdata_t()
@@ -69,17 +161,20 @@ mapdata_t::mapdata_t()
 {
 }
 
-// add the specified plane to the list
-size_t mapdata_t::add_plane(const qplane3d &plane)
+mapdata_t::~mapdata_t() = default;
+mapdata_t &mapdata_t::operator=(mapdata_t &&) = default;
+
+// add the specified plane to the list; insert_lock must be held
+static size_t AddPlaneLocked(mapdata_t &map, const qplane3d &plane)
 {
-    planes.emplace_back(plane);
-    planes.emplace_back(-plane);
+    map.planes.emplace_back(plane);
+    map.planes.emplace_back(-plane);
 
-    size_t positive_index = planes.size() - 2;
-    size_t negative_index = planes.size() - 1;
+    size_t positive_index = map.planes.size() - 2;
+    size_t negative_index = map.planes.size() - 1;
 
-    auto &positive = planes[positive_index];
-    auto &negative = planes[negative_index];
+    auto &positive = map.planes[positive_index];
+    auto &negative = map.planes[negative_index];
 
     size_t result;
 
@@ -90,31 +185,56 @@ size_t mapdata_t::add_plane(const qplane3d &plane)
         result = positive_index;
     }
 
-    plane_hash->hash.emplace(pareto::point<vec_t, 4>{positive.get_normal()[0], positive.get_normal()[1],
-                                 positive.get_normal()[2], positive.get_dist()},
-        positive_index);
-    plane_hash->hash.emplace(pareto::point<vec_t, 4>{negative.get_normal()[0], negative.get_normal()[1],
-                                 negative.get_normal()[2], negative.get_dist()},
-        negative_index);
+    // only publish the planes once they're in their final slots
+    map.plane_hash->hash.emplace(planehash_t::key(positive), positive_index);
+    map.plane_hash->hash.emplace(planehash_t::key(negative), negative_index);
 
     return result;
 }
 
+// add the specified plane to the list
+size_t mapdata_t::add_plane(const qplane3d &plane)
+{
+    std::unique_lock lock(plane_hash->insert_lock);
+
+    return AddPlaneLocked(*this, plane);
+}
+
 std::optional<size_t> mapdata_t::find_plane_nonfatal(const qplane3d &plane)
 {
     constexpr vec_t HALF_NORMAL_EPSILON = NORMAL_EPSILON * 0.5;
     constexpr vec_t HALF_DIST_EPSILON = DIST_EPSILON * 0.5;
 
-    if (auto it = plane_hash->hash.find_intersection(
-            {plane.normal[0] - HALF_NORMAL_EPSILON, plane.normal[1] - HALF_NORMAL_EPSILON,
-                plane.normal[2] - HALF_NORMAL_EPSILON, plane.dist - HALF_DIST_EPSILON},
-            {plane.normal[0] + HALF_NORMAL_EPSILON, plane.normal[1] + HALF_NORMAL_EPSILON,
-                plane.normal[2] + HALF_NORMAL_EPSILON, plane.dist + HALF_DIST_EPSILON});
-        it != plane_hash->hash.end()) {
-        return it->second;
-    }
+    const qvec4d mins{plane.normal[0] - HALF_NORMAL_EPSILON, plane.normal[1] - HALF_NORMAL_EPSILON,
+        plane.normal[2] - HALF_NORMAL_EPSILON, plane.dist - HALF_DIST_EPSILON};
+    const qvec4d maxs{plane.normal[0] + HALF_NORMAL_EPSILON, plane.normal[1] + HALF_NORMAL_EPSILON,
+        plane.normal[2] + HALF_NORMAL_EPSILON, plane.dist + HALF_DIST_EPSILON};
+
+    // the epsilon box is narrower than a cell, so it covers at most
+    // two cells along each axis. if several planes are within epsilon,
+    // always pick the lowest index so the result doesn't depend on hash
+    // iteration order
+    std::optional<size_t> result;
+
+    VisitCells(plane_hash->hash, planehash_t::key(mins), planehash_t::key(maxs), [&](size_t index) {
+        if (result && *result <= index) {
+            return;
+        }
+
+        const auto &candidate = planes[index];
+        const qvec4d point{
+            candidate.get_normal()[0], candidate.get_normal()[1], candidate.get_normal()[2], candidate.get_dist()};
+
+        for (size_t i = 0; i < 4; i++) {
+            if (point[i] < mins[i] || point[i] > maxs[i]) {
+                return;
+            }
+        }
+
+        result = index;
+    });
 
-    return std::nullopt;
+    return result;
 }
 
 // find the specified plane in the list if it exists. throws
@@ -129,17 +249,25 @@ size_t mapdata_t::find_plane(const qplane3d &plane)
 }
 
 // find the specified plane in the list if it exists, or
-// return a new one
+// return a new one. concurrent callers can't add the same plane
+// twice, but the numbers they get depend on scheduling.
 size_t mapdata_t::add_or_find_plane(const qplane3d &plane)
 {
     if (auto index = find_plane_nonfatal(plane)) {
         return *index;
     }
 
-    return add_plane(plane);
+    std::unique_lock lock(plane_hash->insert_lock);
+
+    // another thread may have added it while we were waiting
+    if (auto index = find_plane_nonfatal(plane)) {
+        return *index;
+    }
+
+    return AddPlaneLocked(*this, plane);
 }
 
-const qbsp_plane_t &mapdata_t::get_plane(size_t pnum)
+const qbsp_plane_t &mapdata_t::get_plane(size_t pnum) const
 {
     return planes[pnum];
 }
@@ -147,30 +275,134 @@ const qbsp_plane_t &mapdata_t::get_plane(size_t pnum)
 // find output index for specified already-output vector.
 std::optional<size_t> mapdata_t::find_emitted_hash_vector(const qvec3d &vert)
 {
-    constexpr vec_t HALF_EPSILON = POINT_EQUAL_EPSILON * 0.5;
+    constexpr qvec3d HALF_EPSILON{POINT_EQUAL_EPSILON * 0.5};
 
-    if (auto it =
-            hashverts->hash.find_intersection({vert[0] - HALF_EPSILON, vert[1] - HALF_EPSILON, vert[2] - HALF_EPSILON},
-                {vert[0] + HALF_EPSILON, vert[1] + HALF_EPSILON, vert[2] + HALF_EPSILON});
-        it != hashverts->hash.end()) {
-        return it->second;
-    }
+    const qvec3d mins = vert - HALF_EPSILON;
+    const qvec3d maxs = vert + HALF_EPSILON;
 
-    return std::nullopt;
+    std::optional<size_t> result;
+
+    auto visit = [&](const vertexhash_t::entry_t &entry) {
+        if (result && *result <= entry.index) {
+            return;
+        }
+
+        for (size_t i = 0; i < 3; i++) {
+            if (entry.point[i] < mins[i] || entry.point[i] > maxs[i]) {
+                return;
+            }
+        }
+
+        result = entry.index;
+    };
+
+    VisitCells(hashverts->hash, vertexhash_t::key(mins), vertexhash_t::key(maxs), visit);
+
+    return result;
 }
 
 // add vector to hash
 void mapdata_t::add_hash_vector(const qvec3d &point, const size_t &num)
 {
-    hashverts->hash.emplace(pareto::point<vec_t, 3>({point[0], point[1], point[2]}), num);
+    hashverts->hash.emplace(vertexhash_t::key(point), vertexhash_t::entry_t{point, num});
 }
 
-void mapdata_t::add_hash_edge(size_t v1, size_t v2, int64_t edge_index, const face_t *face)
+// find or emit each of the specified vertices. lookups run in parallel;
+// the numbering is the same as emitting them one at a time in order.
+std::vector<size_t> mapdata_t::emit_hash_vectors(const std::vector<qvec3d> &points)
 {
-    hashedges.emplace(std::make_pair(v1, v2), hashedge_t{.v1 = v1, .v2 = v2, .edge_index = edge_index, .face = face});
+    constexpr qvec3d HALF_EPSILON{POINT_EQUAL_EPSILON * 0.5};
+    constexpr size_t UNRESOLVED = std::numeric_limits<size_t>::max();
+
+    std::vector<size_t> result(points.size(), UNRESOLVED);
+
+    // vertices emitted by earlier calls
+    tbb::parallel_for(static_cast<size_t>(0), points.size(), [&](size_t i) {
+        if (auto index = find_emitted_hash_vector(points[i])) {
+            result[i] = *index;
+        }
+    });
+
+    // hash the rest, so each one can find the earlier points of this
+    // batch that it may be merged with
+    tbb::concurrent_unordered_multimap<vertexhash_t::key_t, size_t, cell_hash_t<3>> pending;
+
+    tbb::parallel_for(static_cast<size_t>(0), points.size(), [&](size_t i) {
+        if (result[i] == UNRESOLVED) {
+            pending.emplace(vertexhash_t::key(points[i]), i);
+        }
+    });
+
+    auto visit_earlier = [&](size_t i, auto &&func) {
+        const qvec3d mins = points[i] - HALF_EPSILON;
+        const qvec3d maxs = points[i] + HALF_EPSILON;
+
+        VisitCells(pending, vertexhash_t::key(mins), vertexhash_t::key(maxs), [&](size_t j) {
+            if (j >= i) {
+                return;
+            }
+
+            for (size_t k = 0; k < 3; k++) {
+                if (points[j][k] < mins[k] || points[j][k] > maxs[k]) {
+                    return;
+                }
+            }
+
+            func(j);
+        });
+    };
+
+    // gather the candidates of each point, lowest first
+    std::vector<size_t> first_candidate(points.size() + 1, 0);
+
+    tbb::parallel_for(static_cast<size_t>(0), points.size(), [&](size_t i) {
+        if (result[i] == UNRESOLVED) {
+            visit_earlier(i, [&](size_t) { first_candidate[i + 1]++; });
+        }
+    });
+
+    for (size_t i = 0; i < points.size(); i++) {
+        first_candidate[i + 1] += first_candidate[i];
+    }
+
+    std::vector<size_t> candidates(first_candidate.back());
+
+    tbb::parallel_for(static_cast<size_t>(0), points.size(), [&](size_t i) {
+        if (result[i] == UNRESOLVED) {
+            size_t n = first_candidate[i];
+            visit_earlier(i, [&](size_t j) { candidates[n++] = j; });
+            std::sort(candidates.begin() + first_candidate[i], candidates.begin() + n);
+        }
+    });
+
+    // a point merges with the first earlier candidate that was itself
+    // emitted, otherwise it becomes a new vertex
+    std::vector<uint8_t> emitted(points.size(), 0);
+
+    for (size_t i = 0; i < points.size(); i++) {
+        if (result[i] != UNRESOLVED) {
+            continue;
+        }
+
+        for (size_t n = first_candidate[i]; n < first_candidate[i + 1]; n++) {
+            if (emitted[candidates[n]]) {
+                result[i] = result[candidates[n]];
+                break;
+            }
+        }
+
+        if (result[i] == UNRESOLVED) {
+            add_hash_vector(points[i], result[i] = bsp.dvertexes.size());
+            bsp.dvertexes.emplace_back(points[i]);
+            emitted[i] = 1;
+        }
+    }
+
+    return result;
 }
 
-const std::optional<img::texture_meta> &mapdata_t::load_image_meta(const std::string_view &name)
+const std::optional<img::texture_meta> &mapdata_t::load_image_meta(
+    const settings::qbsp_settings &options, const std::string_view &name)
 {
     static std::optional<img::texture_meta> nullmeta = std::nullopt;
     auto it = meta_cache.find(name.data());
@@ -180,12 +412,12 @@ const std::optional<img::texture_meta> &mapdata_t::load_image_meta(const std::st
     }
 
     // try a meta-only texture first; this is all we really need anyways
-    if (auto [texture_meta, _0, _1] = img::load_texture_meta(name, qbsp_options.target_game, qbsp_options);
+    if (auto [texture_meta, _0, _1] = img::load_texture_meta(name, options.target_game, options);
         texture_meta) {
         // slight special case: if the meta has no width/height defined,
         // pull it from the real texture.
         if (!texture_meta->width || !texture_meta->height) {
-            auto [texture, _0, _1] = img::load_texture(name, true, qbsp_options.target_game, qbsp_options);
+            auto [texture, _0, _1] = img::load_texture(name, true, options.target_game, options);
 
             if (texture) {
                 texture_meta->width = texture->meta.width;
@@ -201,7 +433,7 @@ const std::optional<img::texture_meta> &mapdata_t::load_image_meta(const std::st
     }
 
     // couldn't find a meta texture, so pull it from the pixel image
-    if (auto [texture, _0, _1] = img::load_texture(name, true, qbsp_options.target_game, qbsp_options); texture) {
+    if (auto [texture, _0, _1] = img::load_texture(name, true, options.target_game, options); texture) {
         return meta_cache.emplace(name, texture->meta).first->second;
     }
 
@@ -210,7 +442,7 @@ const std::optional<img::texture_meta> &mapdata_t::load_image_meta(const std::st
     return nullmeta;
 }
 
-static std::shared_ptr<fs::archive_like> LoadTexturePath(const fs::path &path)
+static std::shared_ptr<fs::archive_like> LoadTexturePath(qbsp_context_t &ctx, const fs::path &path)
 {
     // if absolute, don't try anything else
     if (path.is_absolute()) {
@@ -218,7 +450,7 @@ static std::shared_ptr<fs::archive_like> LoadTexturePath(const fs::path &path)
     }
 
     // try wadpath (this includes relative to the .map file)
-    for (auto &wadpath : qbsp_options.wadpaths.pathsValue()) {
+    for (auto &wadpath : ctx.options.wadpaths.pathsValue()) {
         if (auto archive = fs::addArchive(wadpath.path / path, wadpath.external)) {
             return archive;
         }
@@ -232,19 +464,19 @@ static std::shared_ptr<fs::archive_like> LoadTexturePath(const fs::path &path)
     return nullptr;
 }
 
-static void EnsureTexturesLoaded()
+static void EnsureTexturesLoaded(qbsp_context_t &ctx)
 {
     // Q2 doesn't need this
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
+    if (ctx.options.target_game->id == GAME_QUAKE_II) {
         return;
     }
 
-    if (map.textures_loaded)
+    if (ctx.map.textures_loaded)
         return;
 
-    map.textures_loaded = true;
+    ctx.map.textures_loaded = true;
 
-    const mapentity_t &entity = map.world_entity();
+    const mapentity_t &entity = ctx.map.world_entity();
 
     std::string wadstring = entity.epairs.get("_wad");
 
@@ -261,7 +493,7 @@ static void EnsureTexturesLoaded()
         std::string wad;
 
         while (std::getline(stream, wad, ';')) {
-            if (LoadTexturePath(wad)) {
+            if (LoadTexturePath(ctx, wad)) {
                 loaded_any_archive = true;
             }
         }
@@ -273,12 +505,12 @@ static void EnsureTexturesLoaded()
         }
 
         /* Try the default wad name */
-        fs::path defaultwad = qbsp_options.map_path;
+        fs::path defaultwad = ctx.options.map_path;
         defaultwad.replace_extension("wad");
 
         if (fs::exists(defaultwad)) {
             logging::print("INFO: Using default WAD: {}\n", defaultwad);
-            LoadTexturePath(defaultwad);
+            LoadTexturePath(ctx, defaultwad);
         }
     }
 }
@@ -309,11 +541,6 @@ bool mapdata_t::is_world_entity(const mapentity_t &entity)
     return &entity == &world_entity();
 }
 
-void mapdata_t::reset()
-{
-    *this = mapdata_t{};
-}
-
 struct texdef_valve_t
 {
     qmat<vec_t, 2, 3> axis{};
@@ -345,13 +572,13 @@ struct texdef_etp_t
 CalculateBrushBounds
 ================
 */
-inline void CalculateBrushBounds(mapbrush_t &ob)
+inline void CalculateBrushBounds(qbsp_context_t &ctx, mapbrush_t &ob)
 {
     ob.bounds = {};
 
     for (size_t i = 0; i < ob.faces.size(); i++) {
-        const auto &plane = ob.faces[i].get_plane();
-        std::optional<winding_t> w = BaseWindingForPlane<winding_t>(plane);
+        const auto &plane = ob.faces[i].get_plane(ctx.map);
+        std::optional<winding_t> w = BaseWindingForPlane<winding_t>(ctx.options, plane);
 
         for (size_t j = 0; j < ob.faces.size() && w; j++) {
             if (i == j) {
@@ -360,7 +587,7 @@ inline void CalculateBrushBounds(mapbrush_t &ob)
             if (ob.faces[j].bevel) {
                 continue;
             }
-            const auto &plane = map.get_plane(ob.faces[j].planenum ^ 1);
+            const auto &plane = ctx.map.get_plane(ob.faces[j].planenum ^ 1);
             w = w->clip_front(plane, 0); // CLIP_EPSILON);
         }
 
@@ -374,12 +601,12 @@ inline void CalculateBrushBounds(mapbrush_t &ob)
     }
 
     for (size_t i = 0; i < 3; i++) {
-        if (ob.bounds.mins()[i] <= -qbsp_options.worldextent.value() ||
-            ob.bounds.maxs()[i] >= qbsp_options.worldextent.value()) {
+        if (ob.bounds.mins()[i] <= -ctx.options.worldextent.value() ||
+            ob.bounds.maxs()[i] >= ctx.options.worldextent.value()) {
             logging::print("WARNING: {}: brush bounds out of range\n", ob.line);
         }
-        if (ob.bounds.mins()[i] >= qbsp_options.worldextent.value() ||
-            ob.bounds.maxs()[i] <= -qbsp_options.worldextent.value()) {
+        if (ob.bounds.mins()[i] >= ctx.options.worldextent.value() ||
+            ob.bounds.maxs()[i] <= -ctx.options.worldextent.value()) {
             logging::print("WARNING: {}: no visible sides on brush\n", ob.line);
         }
     }
@@ -389,11 +616,12 @@ using texdef_brush_primitives_t = qmat<vec_t, 2, 3>;
 
 static texdef_valve_t TexDef_BSPToValve(const texvecf &in_vecs);
 static qvec2f projectToAxisPlane(const qvec3d &snapped_normal, const qvec3d &point);
-static texdef_quake_ed_noshift_t Reverse_QuakeEd(qmat2x2f M, const qbsp_plane_t &plane, bool preserveX);
-static void SetTexinfo_QuakeEd_New(
+static texdef_quake_ed_noshift_t Reverse_QuakeEd(
+    qbsp_context_t &ctx, qmat2x2f M, const qbsp_plane_t &plane, bool preserveX);
+static void SetTexinfo_QuakeEd_New(qbsp_context_t &ctx, 
     const qbsp_plane_t &plane, const qvec2d &shift, vec_t rotate, const qvec2d &scale, texvecf &out_vecs);
 
-static void AddAnimTex(const char *name)
+static void AddAnimTex(qbsp_context_t &ctx, const char *name)
 {
     int i, j, frame;
     char framename[16], basechar = '0';
@@ -420,24 +648,25 @@ static void AddAnimTex(const char *name)
     snprintf(framename, sizeof(framename), "%s", name);
     for (i = 0; i < frame; i++) {
         framename[1] = basechar + i;
-        for (j = 0; j < map.miptex.size(); j++) {
-            if (!Q_strcasecmp(framename, map.miptex.at(j).name.c_str()))
+        for (j = 0; j < ctx.map.miptex.size(); j++) {
+            if (!Q_strcasecmp(framename, ctx.map.miptex.at(j).name.c_str()))
                 break;
         }
-        if (j < map.miptex.size())
+        if (j < ctx.map.miptex.size())
             continue;
 
-        map.miptex.push_back({framename});
+        ctx.map.miptex.push_back({framename});
     }
 }
 
-int FindMiptex(const char *name, std::optional<extended_texinfo_t> &extended_info, bool internal, bool recursive)
+int FindMiptex(qbsp_context_t &ctx, const char *name, std::optional<extended_texinfo_t> &extended_info, bool internal,
+    bool recursive)
 {
     const char *pathsep;
     int i;
 
     // FIXME: figure out a way that we can move this to gamedef
-    if (qbsp_options.target_game->id != GAME_QUAKE_II) {
+    if (ctx.options.target_game->id != GAME_QUAKE_II) {
         /* Ignore leading path in texture names (Q2 map compatibility) */
         pathsep = strrchr(name, '/');
         if (pathsep)
@@ -447,24 +676,24 @@ int FindMiptex(const char *name, std::optional<extended_texinfo_t> &extended_inf
             extended_info = extended_texinfo_t{};
         }
 
-        for (i = 0; i < map.miptex.size(); i++) {
-            const maptexdata_t &tex = map.miptex.at(i);
+        for (i = 0; i < ctx.map.miptex.size(); i++) {
+            const maptexdata_t &tex = ctx.map.miptex.at(i);
 
             if (!Q_strcasecmp(name, tex.name.c_str())) {
                 return i;
             }
         }
 
-        i = map.miptex.size();
-        map.miptex.push_back({name});
+        i = ctx.map.miptex.size();
+        ctx.map.miptex.push_back({name});
 
         /* Handle animating textures carefully */
         if (name[0] == '+') {
-            AddAnimTex(name);
+            AddAnimTex(ctx, name);
         }
     } else {
         // load .wal first
-        auto wal = map.load_image_meta(name);
+        auto wal = ctx.map.load_image_meta(ctx.options, name);
 
         if (wal && !internal && !extended_info.has_value()) {
             extended_info = extended_texinfo_t{wal->contents, wal->flags, wal->value, wal->animation};
@@ -474,8 +703,8 @@ int FindMiptex(const char *name, std::optional<extended_texinfo_t> &extended_inf
             extended_info = extended_texinfo_t{};
         }
 
-        for (i = 0; i < map.miptex.size(); i++) {
-            const maptexdata_t &tex = map.miptex.at(i);
+        for (i = 0; i < ctx.map.miptex.size(); i++) {
+            const maptexdata_t &tex = ctx.map.miptex.at(i);
 
             if (!Q_strcasecmp(name, tex.name.c_str()) && tex.flags.native == extended_info->flags.native &&
                 tex.value == extended_info->value && tex.animation == extended_info->animation) {
@@ -484,8 +713,8 @@ int FindMiptex(const char *name, std::optional<extended_texinfo_t> &extended_inf
             }
         }
 
-        i = map.miptex.size();
-        map.miptex.push_back({name, extended_info->flags, extended_info->value, extended_info->animation});
+        i = ctx.map.miptex.size();
+        ctx.map.miptex.push_back({name, extended_info->flags, extended_info->value, extended_info->animation});
 
         /* Handle animating textures carefully */
         if (!extended_info->animation.empty() && recursive && Q_strcasecmp(name, wal->animation.c_str())) {
@@ -495,7 +724,7 @@ int FindMiptex(const char *name, std::optional<extended_texinfo_t> &extended_inf
             // recursively load animated textures until we loop back to us
             while (true) {
                 // wal for next chain
-                wal = map.load_image_meta(wal->animation.c_str());
+                wal = ctx.map.load_image_meta(ctx.options, wal->animation.c_str());
 
                 // can't find...
                 if (wal == std::nullopt)
@@ -506,8 +735,8 @@ int FindMiptex(const char *name, std::optional<extended_texinfo_t> &extended_inf
                 animation_info->animation = wal->animation;
 
                 // fetch animation chain
-                int next_i = FindMiptex(wal->name.data(), animation_info, internal, false);
-                map.miptex[last_i].animation_miptex = next_i;
+                int next_i = FindMiptex(ctx, wal->name.data(), animation_info, internal, false);
+                ctx.map.miptex[last_i].animation_miptex = next_i;
                 last_i = next_i;
 
                 // looped back
@@ -516,16 +745,16 @@ int FindMiptex(const char *name, std::optional<extended_texinfo_t> &extended_inf
             }
 
             // link back to the start
-            map.miptex[last_i].animation_miptex = i;
+            ctx.map.miptex[last_i].animation_miptex = i;
         }
     }
 
     return i;
 }
 
-static bool IsSkipName(const char *name)
+static bool IsSkipName(qbsp_context_t &ctx, const char *name)
 {
-    if (qbsp_options.noskip.value())
+    if (ctx.options.noskip.value())
         return false;
     if (!Q_strcasecmp(name, "skip"))
         return true;
@@ -555,11 +784,11 @@ static bool IsNoExpandName(const char *name)
  * "Special" refers to TEX_SPECIAL, which means "non-lightmapped" and
  * therefore non-subdivided.
  */
-static bool IsSpecialName(const char *name, bool allow_litwater)
+static bool IsSpecialName(qbsp_context_t &ctx, const char *name, bool allow_litwater)
 {
     if (name[0] == '*' && !allow_litwater)
         return true;
-    if (!Q_strncasecmp(name, "sky", 3) && !qbsp_options.splitsky.value())
+    if (!Q_strncasecmp(name, "sky", 3) && !ctx.options.splitsky.value())
         return true;
     return false;
 }
@@ -580,7 +809,7 @@ FindTexinfo
 Returns a global texinfo number
 ===============
 */
-int FindTexinfo(const maptexinfo_t &texinfo)
+int FindTexinfo(qbsp_context_t &ctx, const maptexinfo_t &texinfo)
 {
     // NaN's will break mtexinfo_lookup, since they're being used as a std::map key and don't compare properly with <.
     // They should have been stripped out already in ValidateTextureProjection.
@@ -591,42 +820,42 @@ int FindTexinfo(const maptexinfo_t &texinfo)
     }
 
     // check for an exact match in the reverse lookup
-    const auto it = map.mtexinfo_lookup.find(texinfo);
-    if (it != map.mtexinfo_lookup.end()) {
+    const auto it = ctx.map.mtexinfo_lookup.find(texinfo);
+    if (it != ctx.map.mtexinfo_lookup.end()) {
         return it->second;
     }
 
     /* Allocate a new texinfo at the end of the array */
-    const int num_texinfo = static_cast<int>(map.mtexinfos.size());
-    map.mtexinfos.emplace_back(texinfo);
-    map.mtexinfo_lookup[texinfo] = num_texinfo;
+    const int num_texinfo = static_cast<int>(ctx.map.mtexinfos.size());
+    ctx.map.mtexinfos.emplace_back(texinfo);
+    ctx.map.mtexinfo_lookup[texinfo] = num_texinfo;
 
     // catch broken < implementations in maptexinfo_t
-    assert(map.mtexinfo_lookup.find(texinfo) != map.mtexinfo_lookup.end());
+    assert(ctx.map.mtexinfo_lookup.find(texinfo) != ctx.map.mtexinfo_lookup.end());
 
     // create a copy of the miptex for animation chains
-    if (map.miptex[texinfo.miptex].animation_miptex.has_value()) {
+    if (ctx.map.miptex[texinfo.miptex].animation_miptex.has_value()) {
         maptexinfo_t anim_next = texinfo;
 
-        anim_next.miptex = map.miptex[texinfo.miptex].animation_miptex.value();
+        anim_next.miptex = ctx.map.miptex[texinfo.miptex].animation_miptex.value();
 
-        map.mtexinfos[num_texinfo].next = FindTexinfo(anim_next);
+        ctx.map.mtexinfos[num_texinfo].next = FindTexinfo(ctx, anim_next);
     }
 
     return num_texinfo;
 }
 
-int FindMiptex(const char *name, bool internal, bool recursive)
+int FindMiptex(qbsp_context_t &ctx, const char *name, bool internal, bool recursive)
 {
     std::optional<extended_texinfo_t> extended_info;
-    return FindMiptex(name, extended_info, internal, recursive);
+    return FindMiptex(ctx, name, extended_info, internal, recursive);
 }
 
-static surfflags_t SurfFlagsForEntity(
+static surfflags_t SurfFlagsForEntity(qbsp_context_t &ctx, 
     const maptexinfo_t &texinfo, const mapentity_t &entity, const contentflags_t &face_contents)
 {
     surfflags_t flags{};
-    const char *texname = map.miptex.at(texinfo.miptex).name.c_str();
+    const char *texname = ctx.map.miptex.at(texinfo.miptex).name.c_str();
     const int shadow = entity.epairs.get_int("_shadow");
     bool is_translucent = false;
 
@@ -639,7 +868,7 @@ static surfflags_t SurfFlagsForEntity(
     } else if (entity.epairs.has("_splitturb")) {
         allow_litwater = (entity.epairs.get_int("_splitturb") > 0);
     } else {
-        allow_litwater = qbsp_options.splitturb.value();
+        allow_litwater = ctx.options.splitturb.value();
     }
 
     // These flags are pulled from surf flags in Q2.
@@ -651,17 +880,17 @@ static surfflags_t SurfFlagsForEntity(
     // which we can just call instead of this block.
     // the only annoyance is we can't access the various options (noskip,
     // splitturb, etc) from there.
-    if (qbsp_options.target_game->id != GAME_QUAKE_II) {
-        if (IsSkipName(texname))
+    if (ctx.options.target_game->id != GAME_QUAKE_II) {
+        if (IsSkipName(ctx, texname))
             flags.is_nodraw = true;
         if (IsHintName(texname))
             flags.is_hint = true;
-        if (IsSpecialName(texname, allow_litwater))
+        if (IsSpecialName(ctx, texname, allow_litwater))
             flags.native |= TEX_SPECIAL;
     } else {
         flags.native = texinfo.flags.native;
 
-        if ((flags.native & Q2_SURF_NODRAW) || IsSkipName(texname))
+        if ((flags.native & Q2_SURF_NODRAW) || IsSkipName(ctx, texname))
             flags.is_nodraw = true;
         if ((flags.native & Q2_SURF_HINT) || IsHintName(texname))
             flags.is_hint = true;
@@ -701,8 +930,8 @@ static surfflags_t SurfFlagsForEntity(
         flags.surflight_minlight_scale = entity.epairs.get_float("_surflight_minlight_scale");
     // Paril: inherit _surflight_minlight_scale from worldspawn if unset
     else if (!entity.epairs.has("_surflight_minlight_scale") &&
-             map.world_entity().epairs.has("_surflight_minlight_scale"))
-        flags.surflight_minlight_scale = map.world_entity().epairs.get_float("_surflight_minlight_scale");
+             ctx.map.world_entity().epairs.has("_surflight_minlight_scale"))
+        flags.surflight_minlight_scale = ctx.map.world_entity().epairs.get_float("_surflight_minlight_scale");
 
     // "_minlight_exclude", "_minlight_exclude2", "_minlight_exclude3"...
     for (int i = 0; i <= 9; i++) {
@@ -725,7 +954,7 @@ static surfflags_t SurfFlagsForEntity(
             flags.no_shadow = true;
         }
     }
-    if (face_contents.is_liquid(qbsp_options.target_game) && !is_translucent) {
+    if (face_contents.is_liquid(ctx.options.target_game) && !is_translucent) {
         // opaque liquids don't cast shadow unless opted in
         if (shadow != 1) {
             flags.no_shadow = true;
@@ -737,13 +966,13 @@ static surfflags_t SurfFlagsForEntity(
     int phong = entity.epairs.get_int("_phong");
 
     // Paril: inherit phong from worldspawn if unset
-    if (!entity.epairs.has("_phong") && map.world_entity().epairs.has("_phong")) {
-        phong = map.world_entity().epairs.get_int("_phong");
+    if (!entity.epairs.has("_phong") && ctx.map.world_entity().epairs.has("_phong")) {
+        phong = ctx.map.world_entity().epairs.get_int("_phong");
     }
 
     // Paril: inherit phong from worldspawn if unset
-    if (!entity.epairs.has("_phong_angle") && map.world_entity().epairs.has("_phong_angle")) {
-        phongangle = map.world_entity().epairs.get_float("_phong_angle");
+    if (!entity.epairs.has("_phong_angle") && ctx.map.world_entity().epairs.has("_phong_angle")) {
+        phongangle = ctx.map.world_entity().epairs.get_float("_phong_angle");
     }
 
     if (phong && (phongangle == 0.0)) {
@@ -845,7 +1074,8 @@ static void ParseEpair(parser_t &parser, mapentity_t &entity)
     }
 }
 
-static void TextureAxisFromPlane(const qplane3d &plane, qvec3d &xv, qvec3d &yv, qvec3d &snapped_normal)
+static void TextureAxisFromPlane(
+    qbsp_context_t &ctx, const qplane3d &plane, qvec3d &xv, qvec3d &yv, qvec3d &snapped_normal)
 {
     constexpr qvec3d baseaxis[18] = {
         {0, 0, 1}, {1, 0, 0}, {0, -1, 0}, // floor
@@ -865,7 +1095,7 @@ static void TextureAxisFromPlane(const qplane3d &plane, qvec3d &xv, qvec3d &yv,
 
     for (i = 0; i < 6; i++) {
         dot = qv::dot(plane.normal, baseaxis[i * 3]);
-        if (dot > best || (dot == best && !qbsp_options.oldaxis.value())) {
+        if (dot > best || (dot == best && !ctx.options.oldaxis.value())) {
             best = dot;
             bestaxis = i;
         }
@@ -949,10 +1179,11 @@ static float extractRotation(qmat2x2f m)
     return rotation;
 }
 
-static qvec2f evalTexDefAtPoint(const texdef_quake_ed_t &texdef, const qbsp_plane_t &faceplane, const qvec3f &point)
+static qvec2f evalTexDefAtPoint(
+    qbsp_context_t &ctx, const texdef_quake_ed_t &texdef, const qbsp_plane_t &faceplane, const qvec3f &point)
 {
     texvecf temp;
-    SetTexinfo_QuakeEd_New(faceplane, texdef.shift, texdef.rotate, texdef.scale, temp);
+    SetTexinfo_QuakeEd_New(ctx, faceplane, texdef.shift, texdef.rotate, texdef.scale, temp);
 
     const qmat4x4f worldToTexSpace_res = texVecsTo4x4Matrix(faceplane, temp);
     const qvec2f uv = qvec2f(worldToTexSpace_res * qvec4f(point[0], point[1], point[2], 1.0f));
@@ -995,13 +1226,13 @@ qvec2f normalizeShift(const std::optional<img::texture_meta> &texture, const qve
 }
 
 /// `texture` is optional. If given, the "shift" values can be normalized
-static texdef_quake_ed_t TexDef_BSPToQuakeEd(const qbsp_plane_t &faceplane,
+static texdef_quake_ed_t TexDef_BSPToQuakeEd(qbsp_context_t &ctx, const qbsp_plane_t &faceplane,
     const std::optional<img::texture_meta> &texture, const texvecf &in_vecs, const std::array<qvec3d, 3> &facepoints)
 {
     // First get the un-rotated, un-scaled unit texture vecs (based on the face plane).
     qvec3d snapped_normal;
     qvec3d unrotated_vecs[2];
-    TextureAxisFromPlane(faceplane, unrotated_vecs[0], unrotated_vecs[1], snapped_normal);
+    TextureAxisFromPlane(ctx, faceplane, unrotated_vecs[0], unrotated_vecs[1], snapped_normal);
 
     const qmat4x4f worldToTexSpace = texVecsTo4x4Matrix(faceplane, in_vecs);
 
@@ -1072,11 +1303,11 @@ static texdef_quake_ed_t TexDef_BSPToQuakeEd(const qbsp_plane_t &faceplane,
         //        checkEq(uv02_test, p0p2_uv, 0.01);
     }
 
-    const texdef_quake_ed_noshift_t res = Reverse_QuakeEd(texPlaneToUV, faceplane, false);
+    const texdef_quake_ed_noshift_t res = Reverse_QuakeEd(ctx, texPlaneToUV, faceplane, false);
 
     // figure out shift based on facepoints[0]
     const qvec3f testpoint = facepoints[0];
-    qvec2f uv0_actual = evalTexDefAtPoint(addShift(res, qvec2f(0, 0)), faceplane, testpoint);
+    qvec2f uv0_actual = evalTexDefAtPoint(ctx, addShift(res, qvec2f(0, 0)), faceplane, testpoint);
     qvec2f uv0_desired = qvec2f(worldToTexSpace * qvec4f(testpoint[0], testpoint[1], testpoint[2], 1.0f));
     qvec2f shift = uv0_desired - uv0_actual;
 
@@ -1149,7 +1380,8 @@ float clockwiseDegreesBetween(qvec2f start, qvec2f end)
     return unsigned_degrees;
 }
 
-static texdef_quake_ed_noshift_t Reverse_QuakeEd(qmat2x2f M, const qbsp_plane_t &plane, bool preserveX)
+static texdef_quake_ed_noshift_t Reverse_QuakeEd(
+    qbsp_context_t &ctx, qmat2x2f M, const qbsp_plane_t &plane, bool preserveX)
 {
     // Check for shear, because we might tweak M to remove it
     {
@@ -1214,7 +1446,7 @@ static texdef_quake_ed_noshift_t Reverse_QuakeEd(qmat2x2f M, const qbsp_plane_t
 
     qvec3d vecs[2];
     qvec3d snapped_normal;
-    TextureAxisFromPlane(plane, vecs[0], vecs[1], snapped_normal);
+    TextureAxisFromPlane(ctx, plane, vecs[0], vecs[1], snapped_normal);
 
     const qvec2f sAxis = projectToAxisPlane(snapped_normal, vecs[0]);
     const qvec2f tAxis = projectToAxisPlane(snapped_normal, vecs[1]);
@@ -1272,7 +1504,7 @@ static texdef_quake_ed_noshift_t Reverse_QuakeEd(qmat2x2f M, const qbsp_plane_t
     return fail;
 }
 
-static void SetTexinfo_QuakeEd_New(
+static void SetTexinfo_QuakeEd_New(qbsp_context_t &ctx, 
     const qbsp_plane_t &plane, const qvec2d &shift, vec_t rotate, const qvec2d &scale, texvecf &out_vecs)
 {
     vec_t sanitized_scale[2];
@@ -1282,7 +1514,7 @@ static void SetTexinfo_QuakeEd_New(
 
     qvec3d vecs[2];
     qvec3d snapped_normal;
-    TextureAxisFromPlane(plane, vecs[0], vecs[1], snapped_normal);
+    TextureAxisFromPlane(ctx, plane, vecs[0], vecs[1], snapped_normal);
 
     qvec2f sAxis = projectToAxisPlane(snapped_normal, vecs[0]);
     qvec2f tAxis = projectToAxisPlane(snapped_normal, vecs[1]);
@@ -1298,7 +1530,7 @@ static void SetTexinfo_QuakeEd_New(
 
     if (false) {
         // Self-test for Reverse_QuakeEd
-        texdef_quake_ed_noshift_t reversed = Reverse_QuakeEd(M, plane, false);
+        texdef_quake_ed_noshift_t reversed = Reverse_QuakeEd(ctx, M, plane, false);
 
         // normalize
         if (!EqualDegrees(reversed.rotate, rotate)) {
@@ -1335,8 +1567,8 @@ static void SetTexinfo_QuakeEd_New(
     out_vecs.at(1, 3) = shift[1];
 }
 
-static void SetTexinfo_QuakeEd(const qbsp_plane_t &plane, const std::array<qvec3d, 3> &planepts, const qvec2d &shift,
-    const vec_t &rotate, const qvec2d &scale, maptexinfo_t *out)
+static void SetTexinfo_QuakeEd(qbsp_context_t &ctx, const qbsp_plane_t &plane, const std::array<qvec3d, 3> &planepts,
+    const qvec2d &shift, const vec_t &rotate, const qvec2d &scale, maptexinfo_t *out)
 {
     int i, j;
     qvec3d vecs[2];
@@ -1345,7 +1577,7 @@ static void SetTexinfo_QuakeEd(const qbsp_plane_t &plane, const std::array<qvec3
     vec_t ns, nt;
     qvec3d unused;
 
-    TextureAxisFromPlane(plane, vecs[0], vecs[1], unused);
+    TextureAxisFromPlane(ctx, plane, vecs[0], vecs[1], unused);
 
     /* Rotate axis */
     ang = rotate / 180.0 * Q_PI;
@@ -1384,11 +1616,11 @@ static void SetTexinfo_QuakeEd(const qbsp_plane_t &plane, const std::array<qvec3
     if (false) {
         // Self-test of SetTexinfo_QuakeEd_New
         texvecf check;
-        SetTexinfo_QuakeEd_New(plane, shift, rotate, scale, check);
+        SetTexinfo_QuakeEd_New(ctx, plane, shift, rotate, scale, check);
         for (int i = 0; i < 2; i++) {
             for (int j = 0; j < 4; j++) {
                 if (fabs(check.at(i, j) - out->vecs.at(i, j)) > 0.001) {
-                    SetTexinfo_QuakeEd_New(plane, shift, rotate, scale, check);
+                    SetTexinfo_QuakeEd_New(ctx, plane, shift, rotate, scale, check);
                     FError("fail");
                 }
             }
@@ -1397,7 +1629,7 @@ static void SetTexinfo_QuakeEd(const qbsp_plane_t &plane, const std::array<qvec3
 
     if (false) {
         // Self-test of TexDef_BSPToQuakeEd
-        texdef_quake_ed_t reversed = TexDef_BSPToQuakeEd(plane, std::nullopt, out->vecs, planepts);
+        texdef_quake_ed_t reversed = TexDef_BSPToQuakeEd(ctx, plane, std::nullopt, out->vecs, planepts);
 
         if (!EqualDegrees(reversed.rotate, rotate)) {
             reversed.rotate += 180;
@@ -1419,8 +1651,8 @@ static void SetTexinfo_QuakeEd(const qbsp_plane_t &plane, const std::array<qvec3
     }
 }
 
-static void SetTexinfo_QuArK(
-    parser_t &parser, const std::array<qvec3d, 3> &planepts, texcoord_style_t style, maptexinfo_t *out)
+static void SetTexinfo_QuArK(const parser_source_location &location, const std::array<qvec3d, 3> &planepts,
+    texcoord_style_t style, maptexinfo_t *out)
 {
     int i;
     qvec3d vecs[2];
@@ -1441,7 +1673,7 @@ static void SetTexinfo_QuArK(
             vecs[0] = planepts[1] - planepts[0];
             vecs[1] = planepts[2] - planepts[0];
             break;
-        default: FError("{}: bad texture coordinate style", parser.location);
+        default: FError("{}: bad texture coordinate style", location);
     }
 
     vecs[0] *= 1.0 / 128.0;
@@ -1463,7 +1695,7 @@ static void SetTexinfo_QuArK(
      */
     determinant = a * d - b * c;
     if (fabs(determinant) < ZERO_EPSILON) {
-        logging::print("WARNING: {}: Face with degenerate QuArK-style texture axes\n", parser.location);
+        logging::print("WARNING: {}: Face with degenerate QuArK-style texture axes\n", location);
         for (i = 0; i < 3; i++)
             out->vecs.at(0, i) = out->vecs.at(1, i) = 0;
     } else {
@@ -1482,7 +1714,8 @@ static void SetTexinfo_QuArK(
     out->vecs.at(1, 3) = -qv::dot(vecs[1], planepts[0]);
 }
 
-static void SetTexinfo_Valve220(qmat<vec_t, 2, 3> &axis, const qvec2d &shift, const qvec2d &scale, maptexinfo_t *out)
+static void SetTexinfo_Valve220(
+    const qmat<vec_t, 2, 3> &axis, const qvec2d &shift, const qvec2d &scale, maptexinfo_t *out)
 {
     int i;
 
@@ -1686,69 +1919,88 @@ parse_error:
     FError("{}: couldn't parse Brush Primitives texture info", parser.location);
 }
 
-static void ParseTextureDef(const mapentity_t &entity, parser_t &parser, mapface_t &mapface, const mapbrush_t &brush,
-    maptexinfo_t *tx, std::array<qvec3d, 3> &planepts, const qplane3d &plane, texture_def_issues_t &issue_stats)
+// a brush side exactly as it was read from the .map file. tokenizing
+// needs no global state, so LoadMapFile can do it for many brushes at once;
+// everything that touches `map` happens when the tokens are converted.
+struct mapface_tokens_t
 {
-    vec_t rotate;
-    qmat<vec_t, 2, 3> texMat, axis;
-    qvec2d shift, scale;
-    texcoord_style_t tx_type;
-
+    parser_source_location line;
+    std::array<qvec3d, 3> planepts{};
+    std::string texname;
+    texcoord_style_t tx_type = TX_QUAKED;
+    qmat<vec_t, 2, 3> texMat{}, axis{};
+    qvec2d shift{}, scale{};
+    vec_t rotate = 0;
     quark_tx_info_t extinfo;
+};
 
-    if (brush.format == brushformat_t::BRUSH_PRIMITIVES) {
-        ParseBrushPrimTX(parser, texMat);
-        tx_type = TX_BRUSHPRIM;
+struct mapbrush_tokens_t
+{
+    brushformat_t format = brushformat_t::NORMAL;
+    parser_source_location line;
+    std::vector<mapface_tokens_t> faces;
+};
+
+static void TokenizeTextureDef(parser_t &parser, brushformat_t format, mapface_tokens_t &face)
+{
+    if (format == brushformat_t::BRUSH_PRIMITIVES) {
+        ParseBrushPrimTX(parser, face.texMat);
+        face.tx_type = TX_BRUSHPRIM;
 
         parser.parse_token(PARSE_SAMELINE);
-        mapface.texname = parser.token;
+        face.texname = parser.token;
 
         // Read extra Q2 params
-        extinfo = ParseExtendedTX(parser);
-
-        mapface.raw_info = extinfo.info;
-    } else if (brush.format == brushformat_t::NORMAL) {
+        face.extinfo = ParseExtendedTX(parser);
+    } else if (format == brushformat_t::NORMAL) {
         parser.parse_token(PARSE_SAMELINE);
-        mapface.texname = parser.token;
+        face.texname = parser.token;
 
         parser.parse_token(PARSE_SAMELINE | PARSE_PEEK);
         if (parser.token == "[") {
-            ParseValve220TX(parser, axis, shift, rotate, scale);
-            tx_type = TX_VALVE_220;
+            ParseValve220TX(parser, face.axis, face.shift, face.rotate, face.scale);
+            face.tx_type = TX_VALVE_220;
 
             // Read extra Q2 params
-            extinfo = ParseExtendedTX(parser);
+            face.extinfo = ParseExtendedTX(parser);
         } else {
             parser.parse_token(PARSE_SAMELINE);
-            shift[0] = std::stod(parser.token);
+            face.shift[0] = std::stod(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            shift[1] = std::stod(parser.token);
+            face.shift[1] = std::stod(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            rotate = std::stod(parser.token);
+            face.rotate = std::stod(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            scale[0] = std::stod(parser.token);
+            face.scale[0] = std::stod(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            scale[1] = std::stod(parser.token);
+            face.scale[1] = std::stod(parser.token);
 
             // Read extra Q2 params and/or QuArK subtype
-            extinfo = ParseExtendedTX(parser);
-            if (extinfo.quark_tx1) {
-                tx_type = TX_QUARK_TYPE1;
-            } else if (extinfo.quark_tx2) {
-                tx_type = TX_QUARK_TYPE2;
+            face.extinfo = ParseExtendedTX(parser);
+            if (face.extinfo.quark_tx1) {
+                face.tx_type = TX_QUARK_TYPE1;
+            } else if (face.extinfo.quark_tx2) {
+                face.tx_type = TX_QUARK_TYPE2;
             } else {
-                tx_type = TX_QUAKED;
+                face.tx_type = TX_QUAKED;
             }
         }
-
-        mapface.raw_info = extinfo.info;
     } else {
         FError("{}: Bad brush format", parser.location);
     }
+}
+
+static void ParseTextureDef(qbsp_context_t &ctx, const mapentity_t &entity, const mapface_tokens_t &tokens,
+    mapface_t &mapface, maptexinfo_t *tx, const qplane3d &plane, texture_def_issues_t &issue_stats)
+{
+    quark_tx_info_t extinfo = tokens.extinfo;
+
+    mapface.texname = tokens.texname;
+    mapface.raw_info = extinfo.info;
 
     // if we have texture defs, see if we should remap this one
-    if (auto it = qbsp_options.loaded_texture_defs.find(mapface.texname);
-        it != qbsp_options.loaded_texture_defs.end()) {
+    if (auto it = ctx.options.loaded_texture_defs.find(mapface.texname);
+        it != ctx.options.loaded_texture_defs.end()) {
         mapface.texname = std::get<0>(it->second);
 
         if (std::get<1>(it->second).has_value()) {
@@ -1758,12 +2010,12 @@ static void ParseTextureDef(const mapentity_t &entity, parser_t &parser, mapface
 
     // If we're not Q2 but we're loading a Q2 map, just remove the extra
     // info so it can at least compile.
-    if (qbsp_options.target_game->id != GAME_QUAKE_II) {
+    if (ctx.options.target_game->id != GAME_QUAKE_II) {
         extinfo.info = std::nullopt;
     } else {
         // assign animation to extinfo, so that we load the animated
         // first one first
-        if (auto &wal = map.load_image_meta(mapface.texname.c_str())) {
+        if (auto &wal = ctx.map.load_image_meta(ctx.options, mapface.texname.c_str())) {
             if (!extinfo.info) {
                 extinfo.info = extended_texinfo_t{wal->contents, wal->flags, wal->value};
             }
@@ -1780,7 +2032,7 @@ static void ParseTextureDef(const mapentity_t &entity, parser_t &parser, mapface
             if (!(extinfo.info->flags.native & (Q2_SURF_TRANS33 | Q2_SURF_TRANS66))) {
                 extinfo.info->contents.native |= Q2_CONTENTS_DETAIL;
 
-                if (qbsp_options.verbose.value()) {
+                if (ctx.options.verbose.value()) {
                     logging::print("WARNING: {}: swapped TRANSLUCENT for DETAIL\n", mapface.line);
                 } else {
                     issue_stats.num_translucent++;
@@ -1792,7 +2044,7 @@ static void ParseTextureDef(const mapentity_t &entity, parser_t &parser, mapface
         if ((extinfo.info->flags.native & (Q2_SURF_SKY | Q2_SURF_NODRAW)) == (Q2_SURF_SKY | Q2_SURF_NODRAW)) {
             extinfo.info->flags.native &= ~Q2_SURF_NODRAW;
 
-            if (qbsp_options.verbose.value()) {
+            if (ctx.options.verbose.value()) {
                 logging::print("WARNING: {}: SKY | NODRAW mixed. Removing NODRAW.\n", mapface.line);
             } else {
                 issue_stats.num_sky_nodraw++;
@@ -1808,7 +2060,7 @@ static void ParseTextureDef(const mapentity_t &entity, parser_t &parser, mapface
                 if (visible_contents & i) {
                     if (visible_contents != i) {
                         FError("{}: Mixed visible contents: {}", mapface.line,
-                            extinfo.info->contents.to_string(qbsp_options.target_game));
+                            extinfo.info->contents.to_string(ctx.options.target_game));
                     }
                 }
             }
@@ -1817,7 +2069,7 @@ static void ParseTextureDef(const mapentity_t &entity, parser_t &parser, mapface
         // Other Q2 hard errors
         if (extinfo.info->contents.native & (Q2_CONTENTS_MONSTER | Q2_CONTENTS_DEADMONSTER)) {
             FError(
-                "{}: Illegal contents: {}", mapface.line, extinfo.info->contents.to_string(qbsp_options.target_game));
+                "{}: Illegal contents: {}", mapface.line, extinfo.info->contents.to_string(ctx.options.target_game));
         }
 
         // If Q2 style phong is enabled on a mirrored face, `light` will erroneously try to blend normals between
@@ -1838,36 +2090,38 @@ static void ParseTextureDef(const mapentity_t &entity, parser_t &parser, mapface
         }
     }
 
-    tx->miptex = FindMiptex(mapface.texname.c_str(), extinfo.info);
+    tx->miptex = FindMiptex(ctx, mapface.texname.c_str(), extinfo.info);
     mapface.contents = {extinfo.info->contents};
     tx->flags = {extinfo.info->flags};
     tx->value = extinfo.info->value;
 
-    if (!mapface.contents.is_valid(qbsp_options.target_game, false)) {
+    if (!mapface.contents.is_valid(ctx.options.target_game, false)) {
         auto old_contents = mapface.contents;
-        qbsp_options.target_game->contents_make_valid(mapface.contents);
+        ctx.options.target_game->contents_make_valid(mapface.contents);
         logging::print("WARNING: {}: face has invalid contents {}, remapped to {}\n", mapface.line,
-            old_contents.to_string(qbsp_options.target_game), mapface.contents.to_string(qbsp_options.target_game));
+            old_contents.to_string(ctx.options.target_game), mapface.contents.to_string(ctx.options.target_game));
     }
 
-    switch (tx_type) {
+    switch (tokens.tx_type) {
         case TX_QUARK_TYPE1:
-        case TX_QUARK_TYPE2: SetTexinfo_QuArK(parser, planepts, tx_type, tx); break;
-        case TX_VALVE_220: SetTexinfo_Valve220(axis, shift, scale, tx); break;
+        case TX_QUARK_TYPE2: SetTexinfo_QuArK(mapface.line, tokens.planepts, tokens.tx_type, tx); break;
+        case TX_VALVE_220: SetTexinfo_Valve220(tokens.axis, tokens.shift, tokens.scale, tx); break;
         case TX_BRUSHPRIM: {
-            const auto &texture = map.load_image_meta(mapface.texname.c_str());
+            const auto &texture = ctx.map.load_image_meta(ctx.options, mapface.texname.c_str());
             const int32_t width = texture ? texture->width : 64;
             const int32_t height = texture ? texture->height : 64;
 
-            SetTexinfo_BrushPrimitives(texMat, plane.normal, width, height, tx->vecs);
+            SetTexinfo_BrushPrimitives(tokens.texMat, plane.normal, width, height, tx->vecs);
             break;
         }
         case TX_QUAKED:
-        default: SetTexinfo_QuakeEd(plane, planepts, shift, rotate, scale, tx); break;
+        default:
+            SetTexinfo_QuakeEd(ctx, plane, tokens.planepts, tokens.shift, tokens.rotate, tokens.scale, tx);
+            break;
     }
 }
 
-bool mapface_t::set_planepts(const std::array<qvec3d, 3> &pts)
+bool mapface_t::set_planepts(mapdata_t &map, const std::array<qvec3d, 3> &pts)
 {
     planepts = pts;
 
@@ -1884,31 +2138,31 @@ bool mapface_t::set_planepts(const std::array<qvec3d, 3> &pts)
     return length >= NORMAL_EPSILON;
 }
 
-const maptexinfo_t &mapface_t::get_texinfo() const
+const maptexinfo_t &mapface_t::get_texinfo(const mapdata_t &map) const
 {
     return map.mtexinfos.at(this->texinfo);
 }
 
-const texvecf &mapface_t::get_texvecs() const
+const texvecf &mapface_t::get_texvecs(const mapdata_t &map) const
 {
-    return get_texinfo().vecs;
+    return get_texinfo(map).vecs;
 }
 
-void mapface_t::set_texvecs(const texvecf &vecs)
+void mapface_t::set_texvecs(qbsp_context_t &ctx, const texvecf &vecs)
 {
     // start with a copy of the current texinfo structure
-    maptexinfo_t texInfoNew = get_texinfo();
+    maptexinfo_t texInfoNew = get_texinfo(ctx.map);
     texInfoNew.outputnum = std::nullopt;
     texInfoNew.vecs = vecs;
-    this->texinfo = FindTexinfo(texInfoNew);
+    this->texinfo = FindTexinfo(ctx, texInfoNew);
 }
 
-const qbsp_plane_t &mapface_t::get_plane() const
+const qbsp_plane_t &mapface_t::get_plane(const mapdata_t &map) const
 {
     return map.get_plane(planenum);
 }
 
-const qbsp_plane_t &mapface_t::get_positive_plane() const
+const qbsp_plane_t &mapface_t::get_positive_plane(const mapdata_t &map) const
 {
     return map.get_plane(planenum & ~1);
 }
@@ -1932,15 +2186,17 @@ bool IsValidTextureProjection(const qvec3f &faceNormal, const qvec3f &s_vec, con
     return true;
 }
 
-inline bool IsValidTextureProjection(const mapface_t &mapface, const maptexinfo_t *tx)
+inline bool IsValidTextureProjection(qbsp_context_t &ctx, const mapface_t &mapface, const maptexinfo_t *tx)
 {
-    return IsValidTextureProjection(mapface.get_plane().get_normal(), tx->vecs.row(0).xyz(), tx->vecs.row(1).xyz());
+    return IsValidTextureProjection(
+        mapface.get_plane(ctx.map).get_normal(), tx->vecs.row(0).xyz(), tx->vecs.row(1).xyz());
 }
 
-static void ValidateTextureProjection(mapface_t &mapface, maptexinfo_t *tx, texture_def_issues_t &issue_stats)
+static void ValidateTextureProjection(
+    qbsp_context_t &ctx, mapface_t &mapface, maptexinfo_t *tx, texture_def_issues_t &issue_stats)
 {
-    if (!IsValidTextureProjection(mapface, tx)) {
-        if (qbsp_options.verbose.value()) {
+    if (!IsValidTextureProjection(ctx, mapface, tx)) {
+        if (ctx.options.verbose.value()) {
             logging::print("WARNING: {}: repairing invalid texture projection (\"{}\" near {} {} {})\n", mapface.line,
                 mapface.texname, (int)mapface.planepts[0][0], (int)mapface.planepts[0][1], (int)mapface.planepts[0][2]);
         } else {
@@ -1951,31 +2207,40 @@ static void ValidateTextureProjection(mapface_t &mapface, maptexinfo_t *tx, text
         const std::array<vec_t, 2> shift{0, 0};
         const vec_t rotate = 0;
         const std::array<vec_t, 2> scale = {1, 1};
-        SetTexinfo_QuakeEd(mapface.get_plane(), mapface.planepts, shift, rotate, scale, tx);
+        SetTexinfo_QuakeEd(ctx, mapface.get_plane(ctx.map), mapface.planepts, shift, rotate, scale, tx);
 
-        Q_assert(IsValidTextureProjection(mapface, tx));
+        Q_assert(IsValidTextureProjection(ctx, mapface, tx));
     }
 }
 
-static std::optional<mapface_t> ParseBrushFace(
-    parser_t &parser, const mapbrush_t &brush, const mapentity_t &entity, texture_def_issues_t &issue_stats)
+static mapface_tokens_t TokenizeBrushFace(parser_t &parser, brushformat_t format)
+{
+    mapface_tokens_t face;
+
+    face.line = parser.location;
+
+    ParsePlaneDef(parser, face.planepts);
+    TokenizeTextureDef(parser, format, face);
+
+    return face;
+}
+
+static std::optional<mapface_t> ConvertBrushFace(qbsp_context_t &ctx, 
+    const mapface_tokens_t &tokens, const mapentity_t &entity, texture_def_issues_t &issue_stats)
 {
-    std::array<qvec3d, 3> planepts;
     bool normal_ok;
     maptexinfo_t tx;
     int i, j;
     mapface_t face;
 
-    face.line = parser.location;
-
-    ParsePlaneDef(parser, planepts);
+    face.line = tokens.line;
 
-    normal_ok = face.set_planepts(planepts);
+    normal_ok = face.set_planepts(ctx.map, tokens.planepts);
 
-    ParseTextureDef(entity, parser, face, brush, &tx, face.planepts, face.get_plane(), issue_stats);
+    ParseTextureDef(ctx, entity, tokens, face, &tx, face.get_plane(ctx.map), issue_stats);
 
     if (!normal_ok) {
-        logging::print("WARNING: {}: Brush plane with no normal\n", parser.location);
+        logging::print("WARNING: {}: Brush plane with no normal\n", face.line);
         return std::nullopt;
     }
 
@@ -1990,10 +2255,10 @@ static std::optional<mapface_t> ParseBrushFace(
         }
     }
 
-    ValidateTextureProjection(face, &tx, issue_stats);
+    ValidateTextureProjection(ctx, face, &tx, issue_stats);
 
-    tx.flags = SurfFlagsForEntity(tx, entity, face.contents);
-    face.texinfo = FindTexinfo(tx);
+    tx.flags = SurfFlagsForEntity(ctx, tx, entity, face.contents);
+    face.texinfo = FindTexinfo(ctx, tx);
 
     return face;
 }
@@ -2009,7 +2274,7 @@ Adds any additional planes necessary to allow the brush to be expanded
 against axial bounding boxes
 =================
 */
-inline void AddBrushBevels(mapentity_t &e, mapbrush_t &b)
+inline void AddBrushBevels(qbsp_context_t &ctx, mapentity_t &e, mapbrush_t &b)
 {
     //
     // add the axial planes
@@ -2023,7 +2288,7 @@ inline void AddBrushBevels(mapentity_t &e, mapbrush_t &b)
             for (i = 0; i < b.faces.size(); i++) {
                 auto &s = b.faces[i];
 
-                if (map.get_plane(s.planenum).get_normal()[axis] == dir) {
+                if (ctx.map.get_plane(s.planenum).get_normal()[axis] == dir) {
                     break;
                 }
             }
@@ -2038,7 +2303,7 @@ inline void AddBrushBevels(mapentity_t &e, mapbrush_t &b)
                 } else {
                     plane.dist = -b.bounds.mins()[axis];
                 }
-                s.planenum = map.add_or_find_plane(plane);
+                s.planenum = ctx.map.add_or_find_plane(plane);
                 // FIXME: use the face closest to the new bevel for picking
                 // its surface info to copy from.
                 s.texinfo = b.faces[0].texinfo;
@@ -2109,7 +2374,7 @@ inline void AddBrushBevels(mapentity_t &e, mapbrush_t &b)
                     // behind this plane, it is a proper edge bevel
                     for (k = 0; k < b.faces.size(); k++) {
                         // if this plane has allready been used, skip it
-                        if (qv::epsilonEqual(b.faces[k].get_plane(), plane)) {
+                        if (qv::epsilonEqual(b.faces[k].get_plane(ctx.map), plane)) {
                             break;
                         }
 
@@ -2122,7 +2387,7 @@ inline void AddBrushBevels(mapentity_t &e, mapbrush_t &b)
                         size_t l = 0;
                         for (; l < w2.size(); l++) {
                             vec_t d = qv::dot(w2[l], plane.normal) - plane.dist;
-                            if (d > qbsp_options.epsilon.value()) {
+                            if (d > ctx.options.epsilon.value()) {
                                 break; // point in front
                             }
                         }
@@ -2138,7 +2403,7 @@ inline void AddBrushBevels(mapentity_t &e, mapbrush_t &b)
 
                     // add this plane
                     mapface_t &s = b.faces.emplace_back();
-                    s.planenum = map.add_or_find_plane(plane);
+                    s.planenum = ctx.map.add_or_find_plane(plane);
                     s.texinfo = b.faces[i].texinfo;
                     s.contents = b.faces[i].contents;
                     s.texname = b.faces[i].texname;
@@ -2177,7 +2442,7 @@ AddBrushPlane
 static bool AddBrushPlane(map_hullbrush_t &hullbrush, const qbsp_plane_t &plane, size_t &index)
 {
     for (auto &s : hullbrush.brush.faces) {
-        if (qv::epsilonEqual(s.get_plane(), plane)) {
+        if (qv::epsilonEqual(s.get_plane(ctx.map), plane)) {
             index = &s - hullbrush.brush.faces.data();
             return false;
         }
@@ -2185,7 +2450,7 @@ static bool AddBrushPlane(map_hullbrush_t &hullbrush, const qbsp_plane_t &plane,
 
     index = hullbrush.brush.faces.size();
     auto &s = hullbrush.brush.faces.emplace_back();
-    s.planenum = map.add_or_find_plane(plane);
+    s.planenum = ctx.map.add_or_find_plane(plane);
     // add this plane
     s.texinfo = hullbrush.brush.faces[0].texinfo;
     s.contents = hullbrush.brush.faces[0].contents;
@@ -2209,7 +2474,7 @@ static bool TestAddPlane(map_hullbrush_t &hullbrush, const qbsp_plane_t &plane)
 {
     /* see if the plane has already been added */
     for (auto &s : hullbrush.brush.faces) {
-        if (qv::epsilonEqual(plane, s.get_plane()) || qv::epsilonEqual(plane, s.get_positive_plane())) {
+        if (qv::epsilonEqual(plane, s.get_plane(ctx.map)) || qv::epsilonEqual(plane, s.get_positive_plane(ctx.map))) {
             return false;
         }
     }
@@ -2221,12 +2486,12 @@ static bool TestAddPlane(map_hullbrush_t &hullbrush, const qbsp_plane_t &plane)
     for (size_t i = 0; i < hullbrush.corners.size(); i++) {
         vec_t d = qv::dot(hullbrush.corners[i], plane.get_normal()) - plane.get_dist();
 
-        if (d < -qbsp_options.epsilon.value()) {
+        if (d < -ctx.options.epsilon.value()) {
             if (points_front) {
                 return false;
             }
             points_back = true;
-        } else if (d > qbsp_options.epsilon.value()) {
+        } else if (d > ctx.options.epsilon.value()) {
             if (points_back) {
                 return false;
             }
@@ -2348,11 +2613,11 @@ static void ExpandBrush(map_hullbrush_t &hullbrush, const aabb3d &hull_size)
 
     // expand all of the planes
     for (auto &f : hullbrush.brush.faces) {
-        /*if (f.get_texinfo().flags.no_expand) {
+        /*if (f.get_texinfo(ctx.map).flags.no_expand) {
             continue;
         }*/
         qvec3d corner = {};
-        qplane3d plane = f.get_plane();
+        qplane3d plane = f.get_plane(ctx.map);
         for (size_t x = 0; x < 3; x++) {
             if (plane.normal[x] > 0) {
                 corner[x] = hull_size[1][x];
@@ -2361,7 +2626,7 @@ static void ExpandBrush(map_hullbrush_t &hullbrush, const aabb3d &hull_size)
             }
         }
         plane.dist += qv::dot(corner, plane.normal);
-        f.planenum = map.add_or_find_plane(plane);
+        f.planenum = ctx.map.add_or_find_plane(plane);
     }
 
     // add any axis planes not contained in the brush to bevel off corners
@@ -2410,19 +2675,19 @@ Brush_GetContents
 Fetch the final contents flag of the given mapbrush.
 =================
 */
-static contentflags_t Brush_GetContents(const mapentity_t &entity, const mapbrush_t &mapbrush)
+static contentflags_t Brush_GetContents(qbsp_context_t &ctx, const mapentity_t &entity, const mapbrush_t &mapbrush)
 {
     bool base_contents_set = false;
-    contentflags_t base_contents = qbsp_options.target_game->create_empty_contents();
+    contentflags_t base_contents = ctx.options.target_game->create_empty_contents();
 
     // validate that all of the sides have valid contents
     for (auto &mapface : mapbrush.faces) {
-        const maptexinfo_t &texinfo = mapface.get_texinfo();
+        const maptexinfo_t &texinfo = mapface.get_texinfo(ctx.map);
 
         contentflags_t contents =
-            qbsp_options.target_game->face_get_contents(mapface.texname.data(), texinfo.flags, mapface.contents);
+            ctx.options.target_game->face_get_contents(mapface.texname.data(), texinfo.flags, mapface.contents);
 
-        if (contents.is_empty(qbsp_options.target_game)) {
+        if (contents.is_empty(ctx.options.target_game)) {
             continue;
         }
 
@@ -2432,16 +2697,16 @@ static contentflags_t Brush_GetContents(const mapentity_t &entity, const mapbrus
             base_contents = contents;
         }
 
-        if (!contents.types_equal(base_contents, qbsp_options.target_game)) {
+        if (!contents.types_equal(base_contents, ctx.options.target_game)) {
             logging::print("WARNING: {}: brush has multiple face contents ({} vs {}), the former will be used.\n",
-                mapface.line, base_contents.to_string(qbsp_options.target_game),
-                contents.to_string(qbsp_options.target_game));
+                mapface.line, base_contents.to_string(ctx.options.target_game),
+                contents.to_string(ctx.options.target_game));
             break;
         }
     }
 
     // make sure we found a valid type
-    Q_assert(base_contents.is_valid(qbsp_options.target_game, false));
+    Q_assert(base_contents.is_valid(ctx.options.target_game, false));
 
     // extended flags
     if (entity.epairs.has("_mirrorinside")) {
@@ -2490,9 +2755,11 @@ static mapbrush_t CloneBrush(const mapbrush_t &input, bool faces = false)
     return brush;
 }
 
-static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_issues_t &issue_stats)
+// read the body of a brush, after its opening {, up to and including
+// the closing }.
+static mapbrush_tokens_t TokenizeBrush(parser_t &parser)
 {
-    mapbrush_t brush;
+    mapbrush_tokens_t brush;
 
     // ericw -- brush primitives
     if (!parser.parse_token(PARSE_PEEK))
@@ -2516,8 +2783,6 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
     }
     // ericw -- end brush primitives
 
-    bool is_hint = false;
-
     while (parser.parse_token()) {
 
         // set linenum after first parsed token
@@ -2528,7 +2793,33 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
         if (parser.token == "}")
             break;
 
-        std::optional<mapface_t> face = ParseBrushFace(parser, brush, entity, issue_stats);
+        brush.faces.emplace_back(TokenizeBrushFace(parser, brush.format));
+    }
+
+    // ericw -- brush primitives - there should be another closing }
+    if (brush.format == brushformat_t::BRUSH_PRIMITIVES) {
+        if (!parser.parse_token())
+            FError("Brush primitives: unexpected EOF (no closing brace)");
+        if (parser.token != "}")
+            FError("Brush primitives: Expected }}, got: {}", parser.token);
+    }
+    // ericw -- end brush primitives
+
+    return brush;
+}
+
+static mapbrush_t ConvertBrush(
+    qbsp_context_t &ctx, const mapbrush_tokens_t &tokens, mapentity_t &entity, texture_def_issues_t &issue_stats)
+{
+    mapbrush_t brush;
+
+    brush.format = tokens.format;
+    brush.line = tokens.line;
+
+    bool is_hint = false;
+
+    for (auto &face_tokens : tokens.faces) {
+        std::optional<mapface_t> face = ConvertBrushFace(ctx, face_tokens, entity, issue_stats);
 
         if (!face) {
             continue;
@@ -2537,14 +2828,14 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
         /* Check for duplicate planes */
         bool discardFace = false;
         for (auto &check : brush.faces) {
-            if (qv::epsilonEqual(check.get_plane(), face->get_plane())) {
-                logging::print("{}: Brush with duplicate plane\n", parser.location);
+            if (qv::epsilonEqual(check.get_plane(ctx.map), face->get_plane(ctx.map))) {
+                logging::print("{}: Brush with duplicate plane\n", face->line);
                 discardFace = true;
                 continue;
             }
-            if (qv::epsilonEqual(-check.get_plane(), face->get_plane())) {
+            if (qv::epsilonEqual(-check.get_plane(ctx.map), face->get_plane(ctx.map))) {
                 /* FIXME - this is actually an invalid brush */
-                logging::print("{}: Brush with duplicate plane\n", parser.location);
+                logging::print("{}: Brush with duplicate plane\n", face->line);
                 continue;
             }
         }
@@ -2553,7 +2844,7 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
             continue;
         }
 
-        if (face->get_texinfo().flags.is_hint) {
+        if (face->get_texinfo(ctx.map).flags.is_hint) {
             is_hint = true;
         }
 
@@ -2585,14 +2876,14 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
 
     // check for region/antiregion brushes
     if (is_antiregion) {
-        if (!map.is_world_entity(entity)) {
-            FError("Region brush at {} isn't part of the world entity", parser.token);
+        if (!ctx.map.is_world_entity(entity)) {
+            FError("Region brush at {} isn't part of the world entity", brush.line);
         }
 
-        map.antiregions.push_back(CloneBrush(brush, true));
+        ctx.map.antiregions.push_back(CloneBrush(brush, true));
     } else if (is_region) {
-        if (!map.is_world_entity(entity)) {
-            FError("Region brush at {} isn't part of the world entity", parser.token);
+        if (!ctx.map.is_world_entity(entity)) {
+            FError("Region brush at {} isn't part of the world entity", brush.line);
         }
 
         // construct region brushes
@@ -2614,12 +2905,12 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
                     new_side.raw_info = side.raw_info;
                     new_side.texname = side.texname;
                     new_side.planenum = side.planenum;
-                    new_side.planenum = map.add_or_find_plane(
-                        {new_side.get_plane().get_normal(), new_side.get_plane().get_dist() + 16.f});
+                    new_side.planenum = ctx.map.add_or_find_plane(
+                        {new_side.get_plane(ctx.map).get_normal(), new_side.get_plane(ctx.map).get_dist() + 16.f});
 
                     new_brush.faces.emplace_back(std::move(new_side));
                     // the inverted side is special
-                } else if (side.get_plane().get_normal() == -new_brush_side.get_plane().get_normal()) {
+                } else if (side.get_plane(ctx.map).get_normal() == -new_brush_side.get_plane(ctx.map).get_normal()) {
 
                     // add the other side
                     mapface_t flipped_side;
@@ -2627,8 +2918,8 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
                     flipped_side.contents = side.contents;
                     flipped_side.raw_info = side.raw_info;
                     flipped_side.texname = side.texname;
-                    flipped_side.planenum = map.add_or_find_plane(
-                        {-new_brush_side.get_plane().get_normal(), -new_brush_side.get_plane().get_dist()});
+                    flipped_side.planenum = ctx.map.add_or_find_plane({-new_brush_side.get_plane(ctx.map).get_normal(),
+                        -new_brush_side.get_plane(ctx.map).get_dist()});
 
                     new_brush.faces.emplace_back(std::move(flipped_side));
                 } else {
@@ -2644,14 +2935,14 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
             }
 
             // add
-            new_brush.contents = Brush_GetContents(entity, new_brush);
-            map.world_entity().mapbrushes.push_back(std::move(new_brush));
+            new_brush.contents = Brush_GetContents(ctx, entity, new_brush);
+            ctx.map.world_entity().mapbrushes.push_back(std::move(new_brush));
         }
 
-        if (!map.region) {
-            map.region = std::move(brush);
+        if (!ctx.map.region) {
+            ctx.map.region = std::move(brush);
         } else {
-            FError("Multiple region brushes detected; newest at {}", parser.token);
+            FError("Multiple region brushes detected; newest at {}", brush.line);
         }
 
         return brush;
@@ -2661,30 +2952,127 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
     if (is_hint) {
 
         for (auto &face : brush.faces) {
-            if (qbsp_options.target_game->texinfo_is_hintskip(
-                    face.get_texinfo().flags, map.miptexTextureName(face.get_texinfo().miptex))) {
-                auto copy = face.get_texinfo();
+            if (ctx.options.target_game->texinfo_is_hintskip(
+                    face.get_texinfo(ctx.map).flags, ctx.map.miptexTextureName(face.get_texinfo(ctx.map).miptex))) {
+                auto copy = face.get_texinfo(ctx.map);
                 copy.flags.is_hintskip = true;
-                face.texinfo = FindTexinfo(copy);
+                face.texinfo = FindTexinfo(ctx, copy);
             }
         }
     }
 
-    // ericw -- brush primitives - there should be another closing }
-    if (brush.format == brushformat_t::BRUSH_PRIMITIVES) {
-        if (!parser.parse_token())
-            FError("Brush primitives: unexpected EOF (no closing brace)");
-        if (parser.token != "}")
-            FError("Brush primitives: Expected }}, got: {}", parser.token);
+    brush.contents = Brush_GetContents(ctx, entity, brush);
+
+    return brush;
+}
+
+static mapbrush_t ParseBrush(
+    qbsp_context_t &ctx, parser_t &parser, mapentity_t &entity, texture_def_issues_t &issue_stats)
+{
+    return ConvertBrush(ctx, TokenizeBrush(parser), entity, issue_stats);
+}
+
+// a brush located by the scanning pass of LoadMapFile, but not parsed yet
+struct pending_brush_t
+{
+    size_t entity;
+    parser_source_location location;
+    std::string_view text;
+};
+
+// skip the body of a brush whose opening { was just parsed, without
+// tokenizing it. braces only count when they're a token by themselves,
+// so textures like {fence don't confuse it. returns the body, up to
+// and including the closing }.
+static std::string_view SkipBrush(parser_t &parser)
+{
+    const char *start = parser.pos;
+    const char *&pos = parser.pos;
+    const char *end = parser.end;
+    size_t &line = parser.location.line_number.value();
+    size_t depth = 1;
+
+    while (pos < end && *pos) {
+        if (*pos == '\n') {
+            line++;
+            pos++;
+        } else if (*pos <= 32) {
+            pos++;
+        } else if ((pos[0] == '/' && pos + 1 < end && pos[1] == '/') || pos[0] == ';') {
+            // comments run to the end of the line; the newline is counted above
+            while (pos < end && *pos && *pos != '\n') {
+                pos++;
+            }
+        } else if (*pos == '"') {
+            // same rules as parse_token, which doesn't count lines inside
+            // quoted tokens either
+            for (pos++; pos < end && *pos && *pos != '"'; pos++) {
+                if (*pos == '\\' && pos + 1 < end && parser_t::escapes_next(pos)) {
+                    pos++;
+                }
+            }
+            pos++;
+        } else {
+            const char *token = pos;
+
+            while (pos < end && *pos > 32) {
+                pos++;
+            }
+
+            if (pos - token == 1) {
+                if (*token == '{') {
+                    depth++;
+                } else if (*token == '}' && !--depth) {
+                    return {start, static_cast<size_t>(pos - start)};
+                }
+            }
+        }
     }
-    // ericw -- end brush primitives
 
-    brush.contents = Brush_GetContents(entity, brush);
+    FError("{}: Unexpected EOF (no closing brace)", parser.location);
+}
+
+// tokenize all of the pending brushes in parallel, then convert them in
+// file order, so planes, textures and texinfos are numbered exactly as
+// if the whole file had been parsed serially.
+static void ParsePendingBrushes(
+    qbsp_context_t &ctx, std::vector<pending_brush_t> &pending, texture_def_issues_t &issue_stats)
+{
+    std::vector<mapbrush_tokens_t> tokens(pending.size());
 
-    return brush;
+    tbb::parallel_for(static_cast<size_t>(0), pending.size(), [&](size_t i) {
+        parser_t parser(pending[i].text, pending[i].location);
+        parser.location = pending[i].location;
+        tokens[i] = TokenizeBrush(parser);
+    });
+
+    for (size_t i = 0; i < pending.size(); i++) {
+        mapentity_t &entity = ctx.map.entities[pending[i].entity];
+        auto brush = ConvertBrush(ctx, tokens[i], entity, issue_stats);
+
+        if (brush.faces.size()) {
+            entity.mapbrushes.push_back(std::move(brush));
+        }
+    }
+
+    pending.clear();
 }
 
-bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &issue_stats)
+// brushes must only see the keys that came before them in their
+// entity, so anything that changes keys after a pending brush of
+// this entity has to parse the pending brushes first.
+static void ParsePendingBrushesOf(qbsp_context_t &ctx, 
+    size_t entity_index, std::vector<pending_brush_t> *pending, texture_def_issues_t &issue_stats)
+{
+    if (pending && !pending->empty() && pending->back().entity == entity_index) {
+        ParsePendingBrushes(ctx, *pending, issue_stats);
+    }
+}
+
+// if `pending` is set, brushes are only located and appended to it;
+// `entity` must then be ctx.map.entities[entity_index].
+static bool ParseEntity(qbsp_context_t &ctx, parser_t &parser, mapentity_t &entity, texture_def_issues_t &issue_stats,
+    std::vector<pending_brush_t> *pending, size_t entity_index)
 {
     entity.location = parser.location;
 
@@ -2712,7 +3100,7 @@ bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &is
         else if (parser.token == "{") {
             if (!first_brush) {
                 // once we run into the first brush, set up textures state.
-                EnsureTexturesLoaded();
+                EnsureTexturesLoaded(ctx);
                 first_brush = true;
 
                 omit = entity.epairs.get_int("_omitbrushes");
@@ -2725,22 +3113,28 @@ bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &is
                         FError("Unexpected EOF (no closing brace)");
                     }
                 } while (parser.token != "}");
+            } else if (pending) {
+                auto location = parser.location;
+                pending->push_back({entity_index, location, SkipBrush(parser)});
             } else {
-                auto brush = ParseBrush(parser, entity, issue_stats);
+                auto brush = ParseBrush(ctx, parser, entity, issue_stats);
 
                 if (brush.faces.size()) {
                     entity.mapbrushes.push_back(std::move(brush));
                 }
             }
         } else {
+            ParsePendingBrushesOf(ctx, entity_index, pending, issue_stats);
             ParseEpair(parser, entity);
         }
     } while (1);
 
     // replace aliases
-    auto alias_it = qbsp_options.loaded_entity_defs.find(entity.epairs.get("classname"));
+    auto alias_it = ctx.options.loaded_entity_defs.find(entity.epairs.get("classname"));
+
+    if (alias_it != ctx.options.loaded_entity_defs.end()) {
+        ParsePendingBrushesOf(ctx, entity_index, pending, issue_stats);
 
-    if (alias_it != qbsp_options.loaded_entity_defs.end()) {
         for (auto &pair : alias_it->second) {
             if (pair.first == "classname" || !entity.epairs.has(pair.first)) {
                 entity.epairs.set(pair.first, pair.second);
@@ -2751,7 +3145,43 @@ bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &is
     return true;
 }
 
-static void ScaleMapFace(mapface_t &face, const qvec3d &scale)
+bool ParseEntity(qbsp_context_t &ctx, parser_t &parser, mapentity_t &entity, texture_def_issues_t &issue_stats)
+{
+    return ParseEntity(ctx, parser, entity, issue_stats, nullptr, 0);
+}
+
+// parse every entity in the file into ctx.map.entities. brushes are parsed
+// in parallel batches; the results are identical to calling ParseEntity
+// on each entity in turn.
+static void ParseMapFile(qbsp_context_t &ctx, parser_t &parser, texture_def_issues_t &issue_stats, bool is_add)
+{
+    std::vector<pending_brush_t> pending;
+
+    for (;;) {
+        size_t entity_index = ctx.map.entities.size();
+        mapentity_t &entity = ctx.map.entities.emplace_back();
+
+        if (!ParseEntity(ctx, parser, entity, issue_stats, &pending, entity_index)) {
+            break;
+        }
+
+        if (is_add && entity.epairs.get("classname") == "worldspawn") {
+            ParsePendingBrushesOf(ctx, entity_index, &pending, issue_stats);
+
+            // The easiest way to get the additional map's worldspawn brushes
+            // into the base map's is to rename the additional map's worldspawn classname to func_group
+            entity.epairs.set("classname", "func_group");
+        }
+    }
+
+    ParsePendingBrushes(ctx, pending, issue_stats);
+
+    // Remove dummy entity inserted above
+    assert(!ctx.map.entities.back().epairs.size());
+    ctx.map.entities.pop_back();
+}
+
+static void ScaleMapFace(qbsp_context_t &ctx, mapface_t &face, const qvec3d &scale)
 {
     const qmat3x3d scaleM{// column-major...
         scale[0], 0.0, 0.0, 0.0, scale[1], 0.0, 0.0, 0.0, scale[2]};
@@ -2761,14 +3191,14 @@ static void ScaleMapFace(mapface_t &face, const qvec3d &scale)
         new_planepts[i] = scaleM * face.planepts[i];
     }
 
-    face.set_planepts(new_planepts);
+    face.set_planepts(ctx.map, new_planepts);
 
     // update texinfo
 
     const qmat3x3d inversescaleM{// column-major...
         1 / scale[0], 0.0, 0.0, 0.0, 1 / scale[1], 0.0, 0.0, 0.0, 1 / scale[2]};
 
-    const auto &texvecs = face.get_texvecs();
+    const auto &texvecs = face.get_texvecs(ctx.map);
     texvecf newtexvecs;
 
     for (int i = 0; i < 2; i++) {
@@ -2779,7 +3209,7 @@ static void ScaleMapFace(mapface_t &face, const qvec3d &scale)
         newtexvecs.set_row(i, {out_first3[0], out_first3[1], out_first3[2], in[3]});
     }
 
-    face.set_texvecs(newtexvecs);
+    face.set_texvecs(ctx, newtexvecs);
 
     // update winding
 
@@ -2788,7 +3218,7 @@ static void ScaleMapFace(mapface_t &face, const qvec3d &scale)
     }
 }
 
-static void RotateMapFace(mapface_t &face, const qvec3d &angles)
+static void RotateMapFace(qbsp_context_t &ctx, mapface_t &face, const qvec3d &angles)
 {
     const double pitch = DEG2RAD(angles[0]);
     const double yaw = DEG2RAD(angles[1]);
@@ -2801,11 +3231,11 @@ static void RotateMapFace(mapface_t &face, const qvec3d &angles)
         new_planepts[i] = rotation * face.planepts[i];
     }
 
-    face.set_planepts(new_planepts);
+    face.set_planepts(ctx.map, new_planepts);
 
     // update texinfo
 
-    const auto &texvecs = face.get_texvecs();
+    const auto &texvecs = face.get_texvecs(ctx.map);
     texvecf newtexvecs;
 
     for (int i = 0; i < 2; i++) {
@@ -2816,21 +3246,21 @@ static void RotateMapFace(mapface_t &face, const qvec3d &angles)
         newtexvecs.set_row(i, {out_first3[0], out_first3[1], out_first3[2], in[3]});
     }
 
-    face.set_texvecs(newtexvecs);
+    face.set_texvecs(ctx, newtexvecs);
 }
 
-static void TranslateMapFace(mapface_t &face, const qvec3d &offset)
+static void TranslateMapFace(qbsp_context_t &ctx, mapface_t &face, const qvec3d &offset)
 {
     std::array<qvec3d, 3> new_planepts;
     for (int i = 0; i < 3; i++) {
         new_planepts[i] = face.planepts[i] + offset;
     }
 
-    face.set_planepts(new_planepts);
+    face.set_planepts(ctx.map, new_planepts);
 
     // update texinfo
 
-    const auto &texvecs = face.get_texvecs();
+    const auto &texvecs = face.get_texvecs(ctx.map);
     texvecf newtexvecs;
 
     for (int i = 0; i < 2; i++) {
@@ -2840,15 +3270,15 @@ static void TranslateMapFace(mapface_t &face, const qvec3d &offset)
         newtexvecs.set_row(i, {out[0], out[1], out[2], out[3]});
     }
 
-    face.set_texvecs(newtexvecs);
+    face.set_texvecs(ctx, newtexvecs);
 }
 
 /**
  * Loads an external .map file.
  *
- * The loaded brushes/planes/etc. will be stored in the global mapdata_t.
+ * The loaded brushes/planes/etc. will be stored in ctx.map.
  */
-static mapentity_t LoadExternalMap(const std::string &filename)
+static mapentity_t LoadExternalMap(qbsp_context_t &ctx, const std::string &filename)
 {
     mapentity_t dest{};
 
@@ -2862,7 +3292,7 @@ static mapentity_t LoadExternalMap(const std::string &filename)
     texture_def_issues_t issue_stats;
 
     // parse the worldspawn
-    if (!ParseEntity(parser, dest, issue_stats)) {
+    if (!ParseEntity(ctx, parser, dest, issue_stats)) {
         FError("'{}': Couldn't parse worldspawn entity\n", filename);
     }
     const std::string &classname = dest.epairs.get("classname");
@@ -2872,7 +3302,7 @@ static mapentity_t LoadExternalMap(const std::string &filename)
 
     // parse any subsequent entities, move any brushes to worldspawn
     mapentity_t dummy{};
-    while (ParseEntity(parser, dummy, issue_stats)) {
+    while (ParseEntity(ctx, parser, dummy, issue_stats)) {
         // move the brushes to the worldspawn
         dest.mapbrushes.insert(dest.mapbrushes.end(), std::make_move_iterator(dummy.mapbrushes.begin()),
             std::make_move_iterator(dummy.mapbrushes.end()));
@@ -2891,9 +3321,9 @@ static mapentity_t LoadExternalMap(const std::string &filename)
     return dest;
 }
 
-void ProcessExternalMapEntity(mapentity_t &entity)
+void ProcessExternalMapEntity(qbsp_context_t &ctx, mapentity_t &entity)
 {
-    Q_assert(!qbsp_options.onlyents.value());
+    Q_assert(!ctx.options.onlyents.value());
 
     const std::string &classname = entity.epairs.get("classname");
 
@@ -2910,7 +3340,7 @@ void ProcessExternalMapEntity(mapentity_t &entity)
 
     Q_assert(entity.mapbrushes.empty()); // misc_external_map must be a point entity
 
-    mapentity_t external_worldspawn = LoadExternalMap(file);
+    mapentity_t external_worldspawn = LoadExternalMap(ctx, file);
 
     // copy the brushes into the target
     entity.mapbrushes = std::move(external_worldspawn.mapbrushes);
@@ -2938,9 +3368,9 @@ void ProcessExternalMapEntity(mapentity_t &entity)
 
     for (auto &brush : entity.mapbrushes) {
         for (auto &face : brush.faces) {
-            ScaleMapFace(face, scale);
-            RotateMapFace(face, angles);
-            TranslateMapFace(face, origin);
+            ScaleMapFace(ctx, face, scale);
+            RotateMapFace(ctx, face, angles);
+            TranslateMapFace(ctx, face, origin);
         }
     }
 
@@ -2949,9 +3379,9 @@ void ProcessExternalMapEntity(mapentity_t &entity)
     entity.epairs.set("origin", "0 0 0");
 }
 
-void ProcessAreaPortal(mapentity_t &entity)
+void ProcessAreaPortal(qbsp_context_t &ctx, mapentity_t &entity)
 {
-    Q_assert(!qbsp_options.onlyents.value());
+    Q_assert(!ctx.options.onlyents.value());
 
     const std::string &classname = entity.epairs.get("classname");
 
@@ -2970,17 +3400,17 @@ void ProcessAreaPortal(mapentity_t &entity)
 
         for (auto &face : brush.faces) {
             face.contents.native = brush.contents.native;
-            face.texinfo = map.skip_texinfo;
+            face.texinfo = ctx.map.skip_texinfo;
         }
     }
 
-    if (map.antiregions.size() || map.region) {
+    if (ctx.map.antiregions.size() || ctx.map.region) {
         return;
     }
 
-    entity.areaportalnum = ++map.numareaportals;
+    entity.areaportalnum = ++ctx.map.numareaportals;
     // set the portal number as "style"
-    entity.epairs.set("style", std::to_string(map.numareaportals));
+    entity.epairs.set("style", std::to_string(ctx.map.numareaportals));
 }
 
 /*
@@ -3026,10 +3456,10 @@ bool IsNonRemoveWorldBrushEntity(const mapentity_t &entity)
     return false;
 }
 
-inline bool MapBrush_IsHint(const mapbrush_t &brush)
+inline bool MapBrush_IsHint(qbsp_context_t &ctx, const mapbrush_t &brush)
 {
     for (auto &f : brush.faces) {
-        if (f.get_texinfo().flags.is_hint)
+        if (f.get_texinfo(ctx.map).flags.is_hint)
             return true;
     }
 
@@ -3043,7 +3473,8 @@ WriteBspBrushMap
 from q3map
 ==================
 */
-inline void WriteMapBrushMap(const fs::path &name, const std::vector<mapbrush_t> &list, const aabb3d &hull)
+inline void WriteMapBrushMap(
+    qbsp_context_t &ctx, const fs::path &name, const std::vector<mapbrush_t> &list, const aabb3d &hull)
 {
     logging::print("writing {}\n", name);
     std::ofstream f(name);
@@ -3058,7 +3489,7 @@ inline void WriteMapBrushMap(const fs::path &name, const std::vector<mapbrush_t>
         for (auto &face : brush.faces) {
 
             qvec3d corner = {};
-            qplane3d plane = face.get_plane();
+            qplane3d plane = face.get_plane(ctx.map);
             for (size_t x = 0; x < 3; x++) {
                 if (plane.normal[x] > 0) {
                     corner[x] = hull[1][x];
@@ -3068,7 +3499,7 @@ inline void WriteMapBrushMap(const fs::path &name, const std::vector<mapbrush_t>
             }
             plane.dist += qv::dot(corner, plane.normal);
 
-            winding_t w = BaseWindingForPlane<winding_t>(plane);
+            winding_t w = BaseWindingForPlane<winding_t>(ctx.options, plane);
 
             ewt::print(f, "( {} ) ", w[0]);
             ewt::print(f, "( {} ) ", w[1]);
@@ -3093,32 +3524,33 @@ inline void WriteMapBrushMap(const fs::path &name, const std::vector<mapbrush_t>
     f.close();
 }
 
-void ProcessMapBrushes()
+void ProcessMapBrushes(qbsp_context_t &ctx)
 {
     logging::funcheader();
 
     // calculate extents, if required
-    if (!qbsp_options.worldextent.value()) {
-        CalculateWorldExtent();
+    if (!ctx.options.worldextent.value()) {
+        CalculateWorldExtent(ctx);
     }
 
-    map.total_brushes = 0;
+    ctx.map.total_brushes = 0;
 
-    if (map.region) {
-        CalculateBrushBounds(map.region.value());
-        logging::print("NOTE: map region detected! only compiling map within {}\n", map.region.value().bounds);
+    if (ctx.map.region) {
+        CalculateBrushBounds(ctx, ctx.map.region.value());
+        logging::print("NOTE: map region detected! only compiling map within {}\n", ctx.map.region.value().bounds);
     }
 
-    if (map.antiregions.size()) {
-        logging::print("NOTE: map anti-regions detected! {} brush regions will be omitted\n", map.antiregions.size());
+    if (ctx.map.antiregions.size()) {
+        logging::print(
+            "NOTE: map anti-regions detected! {} brush regions will be omitted\n", ctx.map.antiregions.size());
 
-        for (auto &region : map.antiregions) {
-            CalculateBrushBounds(region);
+        for (auto &region : ctx.map.antiregions) {
+            CalculateBrushBounds(ctx, region);
         }
     }
 
     {
-        logging::percent_clock clock(map.entities.size());
+        logging::percent_clock clock(ctx.map.entities.size());
 
         struct map_brushes_stats_t : logging::stat_tracker_t
         {
@@ -3130,7 +3562,7 @@ void ProcessMapBrushes()
         } stats;
 
         // calculate brush extents and brush bevels
-        for (auto &entity : map.entities) {
+        for (auto &entity : ctx.map.entities) {
             clock();
 
             /* Origin brush support */
@@ -3159,7 +3591,7 @@ void ProcessMapBrushes()
                 // set properties calculated above
                 brush.lmshift = lmshift;
                 brush.func_areaportal = areaportal;
-                brush.is_hint = MapBrush_IsHint(brush);
+                brush.is_hint = MapBrush_IsHint(ctx, brush);
 
                 // _chop signals that a brush does not partake in the BSP chopping phase.
                 // this allows brushes embedded in others to be retained.
@@ -3175,12 +3607,12 @@ void ProcessMapBrushes()
                 }
 
                 // calculate brush bounds
-                CalculateBrushBounds(brush);
+                CalculateBrushBounds(ctx, brush);
 
                 // origin brushes are removed, and the origin of the entity is overwritten
                 // with its centroid.
-                if (brush.contents.is_origin(qbsp_options.target_game)) {
-                    if (map.is_world_entity(entity)) {
+                if (brush.contents.is_origin(ctx.options.target_game)) {
+                    if (ctx.map.is_world_entity(entity)) {
                         logging::print("WARNING: Ignoring origin brush in worldspawn\n");
                     } else if (entity.epairs.has("origin")) {
                         // fixme-brushbsp: entity.line
@@ -3204,7 +3636,7 @@ void ProcessMapBrushes()
 
                 // add the brush bevels
 #ifdef QBSP3
-                AddBrushBevels(entity, brush);
+                AddBrushBevels(ctx, entity, brush);
 #else
                 {
                     map_hullbrush_t hullbrush{entity, brush};
@@ -3220,13 +3652,13 @@ void ProcessMapBrushes()
                 it++;
             }
 
-            map.total_brushes += entity.mapbrushes.size();
+            ctx.map.total_brushes += entity.mapbrushes.size();
             stats.brushes += entity.mapbrushes.size();
 
             /* Hipnotic rotation */
             if (entity.rotation == rotation_t::none) {
                 if (!Q_strncasecmp(entity.epairs.get("classname"), "rotate_", 7)) {
-                    entity.origin = FixRotateOrigin(entity);
+                    entity.origin = FixRotateOrigin(ctx, entity);
                     entity.rotation = rotation_t::hipnotic;
                 }
             }
@@ -3237,43 +3669,43 @@ void ProcessMapBrushes()
 
                     for (auto &f : brush.faces) {
                         // account for texture offset, from txqbsp-xt
-                        if (!qbsp_options.oldrottex.value()) {
-                            maptexinfo_t texInfoNew = f.get_texinfo();
+                        if (!ctx.options.oldrottex.value()) {
+                            maptexinfo_t texInfoNew = f.get_texinfo(ctx.map);
                             texInfoNew.outputnum = std::nullopt;
 
                             texInfoNew.vecs.at(0, 3) += qv::dot(entity.origin, texInfoNew.vecs.row(0).xyz());
                             texInfoNew.vecs.at(1, 3) += qv::dot(entity.origin, texInfoNew.vecs.row(1).xyz());
 
-                            f.texinfo = FindTexinfo(texInfoNew);
+                            f.texinfo = FindTexinfo(ctx, texInfoNew);
                         }
 
-                        qplane3d plane = f.get_plane();
+                        qplane3d plane = f.get_plane(ctx.map);
                         plane.dist -= qv::dot(plane.normal, entity.origin);
-                        f.planenum = map.add_or_find_plane(plane);
+                        f.planenum = ctx.map.add_or_find_plane(plane);
                     }
 
                     // re-calculate brush bounds/windings
-                    CalculateBrushBounds(brush);
+                    CalculateBrushBounds(ctx, brush);
 
                     stats.offset_brushes++;
                 }
             }
 
             // apply global scale
-            if (qbsp_options.scale.value() != 1.0) {
+            if (ctx.options.scale.value() != 1.0) {
                 // scale brushes
                 for (auto &brush : entity.mapbrushes) {
                     for (auto &f : brush.faces) {
-                        ScaleMapFace(f, qvec3d(qbsp_options.scale.value()));
+                        ScaleMapFace(ctx, f, qvec3d(ctx.options.scale.value()));
                     }
-                    CalculateBrushBounds(brush);
+                    CalculateBrushBounds(ctx, brush);
                 }
 
                 // scale point entity origin
                 if (entity.epairs.find("origin") != entity.epairs.end()) {
                     qvec3d origin;
                     if (3 == entity.epairs.get_vector("origin", origin)) {
-                        origin *= qbsp_options.scale.value();
+                        origin *= ctx.options.scale.value();
 
                         entity.epairs.set("origin", qv::to_string(origin));
                     }
@@ -3295,23 +3727,23 @@ void ProcessMapBrushes()
     logging::print(logging::flag::STAT, "\n");
 
     // remove ents in region
-    if (map.region || map.antiregions.size()) {
+    if (ctx.map.region || ctx.map.antiregions.size()) {
 
-        for (auto it = map.entities.begin(); it != map.entities.end();) {
+        for (auto it = ctx.map.entities.begin(); it != ctx.map.entities.end();) {
             auto &entity = *it;
 
             bool removed = false;
 
             if (!entity.mapbrushes.size()) {
-                if (map.region && !map.region->bounds.containsPoint(entity.origin)) {
-                    it = map.entities.erase(it);
+                if (ctx.map.region && !ctx.map.region->bounds.containsPoint(entity.origin)) {
+                    it = ctx.map.entities.erase(it);
                     removed = true;
                 }
 
-                for (auto &region : map.antiregions) {
+                for (auto &region : ctx.map.antiregions) {
                     if (region.bounds.containsPoint(entity.origin)) {
                         logging::print("removed {}\n", entity.epairs.get("classname"));
-                        it = map.entities.erase(it);
+                        it = ctx.map.entities.erase(it);
                         removed = true;
                         break;
                     }
@@ -3324,29 +3756,29 @@ void ProcessMapBrushes()
         }
     }
 
-    if (qbsp_options.debugexpand.is_changed()) {
+    if (ctx.options.debugexpand.is_changed()) {
         aabb3d hull;
 
-        if (qbsp_options.debugexpand.is_hull()) {
-            const auto &hulls = qbsp_options.target_game->get_hull_sizes();
+        if (ctx.options.debugexpand.is_hull()) {
+            const auto &hulls = ctx.options.target_game->get_hull_sizes();
 
-            if (hulls.size() <= qbsp_options.debugexpand.hull_index_value()) {
+            if (hulls.size() <= ctx.options.debugexpand.hull_index_value()) {
                 FError("invalid hull index passed to debugexpand\n");
             }
 
-            hull = *(hulls.begin() + qbsp_options.debugexpand.hull_index_value());
+            hull = *(hulls.begin() + ctx.options.debugexpand.hull_index_value());
         } else {
-            hull = qbsp_options.debugexpand.hull_bounds_value();
+            hull = ctx.options.debugexpand.hull_bounds_value();
         }
 
-        fs::path name = qbsp_options.bsp_path;
+        fs::path name = ctx.options.bsp_path;
         name.replace_extension("expanded.map");
 
-        WriteMapBrushMap(name, map.world_entity().mapbrushes, hull);
+        WriteMapBrushMap(ctx, name, ctx.map.world_entity().mapbrushes, hull);
     }
 }
 
-void LoadMapFile(void)
+void LoadMapFile(qbsp_context_t &ctx)
 {
     logging::funcheader();
 
@@ -3354,55 +3786,30 @@ void LoadMapFile(void)
         texture_def_issues_t issue_stats;
 
         {
-            auto file = fs::load(qbsp_options.map_path);
+            auto file = fs::load(ctx.options.map_path);
 
             if (!file) {
-                FError("Couldn't load map file \"{}\".\n", qbsp_options.map_path);
+                FError("Couldn't load map file \"{}\".\n", ctx.options.map_path);
                 return;
             }
 
-            parser_t parser(file, {qbsp_options.map_path.string()});
+            parser_t parser(file, {ctx.options.map_path.string()});
 
-            for (int i = 0;; i++) {
-                mapentity_t &entity = map.entities.emplace_back();
-
-                if (!ParseEntity(parser, entity, issue_stats)) {
-                    break;
-                }
-            }
-
-            // Remove dummy entity inserted above
-            assert(!map.entities.back().epairs.size());
-            map.entities.pop_back();
+            ParseMapFile(ctx, parser, issue_stats, false);
         }
 
         // -add function
-        if (!qbsp_options.add.value().empty()) {
-            auto file = fs::load(qbsp_options.add.value());
+        if (!ctx.options.add.value().empty()) {
+            auto file = fs::load(ctx.options.add.value());
 
             if (!file) {
-                FError("Couldn't load map file \"{}\".\n", qbsp_options.add.value());
+                FError("Couldn't load map file \"{}\".\n", ctx.options.add.value());
                 return;
             }
 
-            parser_t parser(file, {qbsp_options.add.value()});
-
-            for (int i = 0;; i++) {
-                mapentity_t &entity = map.entities.emplace_back();
+            parser_t parser(file, {ctx.options.add.value()});
 
-                if (!ParseEntity(parser, entity, issue_stats)) {
-                    break;
-                }
-
-                if (entity.epairs.get("classname") == "worldspawn") {
-                    // The easiest way to get the additional map's worldspawn brushes
-                    // into the base map's is to rename the additional map's worldspawn classname to func_group
-                    entity.epairs.set("classname", "func_group");
-                }
-            }
-            // Remove dummy entity inserted above
-            assert(!map.entities.back().epairs.size());
-            map.entities.pop_back();
+            ParseMapFile(ctx, parser, issue_stats, true);
         }
     }
 
@@ -3415,10 +3822,10 @@ void LoadMapFile(void)
             stat &num_plane = register_stat("unique planes");
         } stats;
 
-        stats.num_entity += map.entities.size();
-        stats.num_miptex += map.miptex.size();
-        stats.num_texinfo += map.mtexinfos.size();
-        stats.num_plane += map.planes.size();
+        stats.num_entity += ctx.map.entities.size();
+        stats.num_miptex += ctx.map.miptex.size();
+        stats.num_texinfo += ctx.map.mtexinfos.size();
+        stats.num_plane += ctx.map.planes.size();
     }
 
     logging::print(logging::flag::STAT, "\n");
@@ -3466,11 +3873,11 @@ static void fprintDoubleAndSpc(std::ofstream &f, double v)
     }
 }
 
-static void ConvertMapFace(std::ofstream &f, const mapface_t &mapface, const conversion_t format)
+static void ConvertMapFace(qbsp_context_t &ctx, std::ofstream &f, const mapface_t &mapface, const conversion_t format)
 {
-    const auto &texture = map.load_image_meta(mapface.texname.c_str());
+    const auto &texture = ctx.map.load_image_meta(ctx.options, mapface.texname.c_str());
 
-    const maptexinfo_t &texinfo = mapface.get_texinfo();
+    const maptexinfo_t &texinfo = mapface.get_texinfo(ctx.map);
 
     // Write plane points
     for (int i = 0; i < 3; i++) {
@@ -3485,7 +3892,7 @@ static void ConvertMapFace(std::ofstream &f, const mapface_t &mapface, const con
         case conversion_t::quake:
         case conversion_t::quake2: {
             const texdef_quake_ed_t quakeed =
-                TexDef_BSPToQuakeEd(mapface.get_plane(), texture, texinfo.vecs, mapface.planepts);
+                TexDef_BSPToQuakeEd(ctx, mapface.get_plane(ctx.map), texture, texinfo.vecs, mapface.planepts);
 
             ewt::print(f, "{} ", mapface.texname);
             fprintDoubleAndSpc(f, quakeed.shift[0]);
@@ -3531,7 +3938,7 @@ static void ConvertMapFace(std::ofstream &f, const mapface_t &mapface, const con
             texSize[1] = texture ? texture->height : 64;
 
             const texdef_brush_primitives_t bp =
-                TexDef_BSPToBrushPrimitives(mapface.get_plane(), texSize, texinfo.vecs);
+                TexDef_BSPToBrushPrimitives(mapface.get_plane(ctx.map), texSize, texinfo.vecs);
             f << "( ( ";
             fprintDoubleAndSpc(f, bp.at(0, 0));
             fprintDoubleAndSpc(f, bp.at(0, 1));
@@ -3559,7 +3966,8 @@ static void ConvertMapFace(std::ofstream &f, const mapface_t &mapface, const con
     f << '\n';
 }
 
-static void ConvertMapBrush(std::ofstream &f, const mapbrush_t &mapbrush, const conversion_t format)
+static void ConvertMapBrush(
+    qbsp_context_t &ctx, std::ofstream &f, const mapbrush_t &mapbrush, const conversion_t format)
 {
     f << "{\n";
     if (format == conversion_t::bp) {
@@ -3567,7 +3975,7 @@ static void ConvertMapBrush(std::ofstream &f, const mapbrush_t &mapbrush, const
         f << "{\n";
     }
     for (int i = 0; i < mapbrush.faces.size(); i++) {
-        ConvertMapFace(f, mapbrush.faces[i], format);
+        ConvertMapFace(ctx, f, mapbrush.faces[i], format);
     }
     if (format == conversion_t::bp) {
         f << "}\n";
@@ -3575,7 +3983,7 @@ static void ConvertMapBrush(std::ofstream &f, const mapbrush_t &mapbrush, const
     f << "}\n";
 }
 
-static void ConvertEntity(std::ofstream &f, const mapentity_t &entity, const conversion_t format)
+static void ConvertEntity(qbsp_context_t &ctx, std::ofstream &f, const mapentity_t &entity, const conversion_t format)
 {
     f << "{\n";
 
@@ -3584,18 +3992,18 @@ static void ConvertEntity(std::ofstream &f, const mapentity_t &entity, const con
     }
 
     for (auto &mapbrush : entity.mapbrushes) {
-        ConvertMapBrush(f, mapbrush, format);
+        ConvertMapBrush(ctx, f, mapbrush, format);
     }
     f << "}\n";
 }
 
-void ConvertMapFile(void)
+void ConvertMapFile(qbsp_context_t &ctx)
 {
     logging::funcheader();
 
     std::string append;
 
-    switch (qbsp_options.convertmapformat.value()) {
+    switch (ctx.options.convertmapformat.value()) {
         case conversion_t::quake: append = "-quake"; break;
         case conversion_t::quake2: append = "-quake2"; break;
         case conversion_t::valve: append = "-valve"; break;
@@ -3603,16 +4011,16 @@ void ConvertMapFile(void)
         default: FError("Internal error: unknown conversion_t\n");
     }
 
-    fs::path filename = qbsp_options.bsp_path;
-    filename.replace_filename(qbsp_options.bsp_path.stem().string() + append).replace_extension(".map");
+    fs::path filename = ctx.options.bsp_path;
+    filename.replace_filename(ctx.options.bsp_path.stem().string() + append).replace_extension(".map");
 
     std::ofstream f(filename);
 
     if (!f)
         FError("Couldn't open file\n");
 
-    for (const mapentity_t &entity : map.entities) {
-        ConvertEntity(f, entity, qbsp_options.convertmapformat.value());
+    for (const mapentity_t &entity : ctx.map.entities) {
+        ConvertEntity(ctx, f, entity, ctx.options.convertmapformat.value());
     }
 
     logging::print("Conversion saved to {}\n", filename);
@@ -3625,15 +4033,15 @@ void PrintEntity(const mapentity_t &entity)
     }
 }
 
-void WriteEntitiesToString()
+void WriteEntitiesToString(qbsp_context_t &ctx)
 {
-    for (auto &entity : map.entities) {
+    for (auto &entity : ctx.map.entities) {
         /* Check if entity needs to be removed */
         if (!entity.epairs.size() || IsWorldBrushEntity(entity)) {
             continue;
         }
 
-        map.bsp.dentdata += "{\n";
+        ctx.map.bsp.dentdata += "{\n";
 
         for (auto &ep : entity.epairs) {
             if (ep.first.starts_with("_tb_")) {
@@ -3642,21 +4050,21 @@ void WriteEntitiesToString()
                 continue;
             }
 
-            if (ep.first.size() >= qbsp_options.target_game->max_entity_key - 1) {
+            if (ep.first.size() >= ctx.options.target_game->max_entity_key - 1) {
                 logging::print("WARNING: {} at {} has long key {} (length {} >= {})\n", entity.epairs.get("classname"),
-                    entity.origin, ep.first, ep.first.size(), qbsp_options.target_game->max_entity_key - 1);
+                    entity.origin, ep.first, ep.first.size(), ctx.options.target_game->max_entity_key - 1);
             }
 
-            if (ep.second.size() >= qbsp_options.target_game->max_entity_value - 1) {
+            if (ep.second.size() >= ctx.options.target_game->max_entity_value - 1) {
                 logging::print("WARNING: {} at {} has long value for key {} (length {} >= {})\n",
                     entity.epairs.get("classname"), entity.origin, ep.first, ep.second.size(),
-                    qbsp_options.target_game->max_entity_value - 1);
+                    ctx.options.target_game->max_entity_value - 1);
             }
 
-            fmt::format_to(std::back_inserter(map.bsp.dentdata), "\"{}\" \"{}\"\n", ep.first, ep.second);
+            fmt::format_to(std::back_inserter(ctx.map.bsp.dentdata), "\"{}\" \"{}\"\n", ep.first, ep.second);
         }
 
-        map.bsp.dentdata += "}\n";
+        ctx.map.bsp.dentdata += "}\n";
     }
 }
 
@@ -3680,7 +4088,7 @@ inline std::optional<qvec3d> GetIntersection(const qplane3d &p1, const qplane3d
 GetBrushExtents
 =================
 */
-inline vec_t GetBrushExtents(const mapbrush_t &hullbrush)
+inline vec_t GetBrushExtents(qbsp_context_t &ctx, const mapbrush_t &hullbrush)
 {
     vec_t extents = -std::numeric_limits<vec_t>::infinity();
 
@@ -3696,14 +4104,14 @@ inline vec_t GetBrushExtents(const mapbrush_t &hullbrush)
                 auto &fk = hullbrush.faces[k];
 
                 bool legal = true;
-                auto vertex = GetIntersection(fi.get_plane(), fj.get_plane(), fk.get_plane());
+                auto vertex = GetIntersection(fi.get_plane(ctx.map), fj.get_plane(ctx.map), fk.get_plane(ctx.map));
 
                 if (!vertex) {
                     continue;
                 }
 
                 for (int32_t m = 0; m < hullbrush.faces.size(); m++) {
-                    if (hullbrush.faces[m].get_plane().distance_to(*vertex) > NORMAL_EPSILON) {
+                    if (hullbrush.faces[m].get_plane(ctx.map).distance_to(*vertex) > NORMAL_EPSILON) {
                         legal = false;
                         break;
                     }
@@ -3719,8 +4127,8 @@ inline vec_t GetBrushExtents(const mapbrush_t &hullbrush)
         }
     }
 
-    if (qbsp_options.scale.value() != 1) {
-        extents *= qbsp_options.scale.value();
+    if (ctx.options.scale.value() != 1) {
+        extents *= ctx.options.scale.value();
     }
 
     return extents;
@@ -3729,13 +4137,13 @@ inline vec_t GetBrushExtents(const mapbrush_t &hullbrush)
 #include "tbb/parallel_for_each.h"
 #include <atomic>
 
-void CalculateWorldExtent(void)
+void CalculateWorldExtent(qbsp_context_t &ctx)
 {
     std::atomic<vec_t> extents = -std::numeric_limits<vec_t>::infinity();
 
-    tbb::parallel_for_each(map.entities, [&](const mapentity_t &entity) {
+    tbb::parallel_for_each(ctx.map.entities, [&](const mapentity_t &entity) {
         tbb::parallel_for_each(entity.mapbrushes, [&](const mapbrush_t &mapbrush) {
-            const vec_t brushExtents = std::max(extents.load(), GetBrushExtents(mapbrush));
+            const vec_t brushExtents = std::max(extents.load(), GetBrushExtents(ctx, mapbrush));
             vec_t currentExtents = extents;
             while (currentExtents < brushExtents && !extents.compare_exchange_weak(currentExtents, brushExtents))
                 ;
@@ -3744,15 +4152,15 @@ void CalculateWorldExtent(void)
 
     vec_t hull_extents = 0;
 
-    for (auto &hull : qbsp_options.target_game->get_hull_sizes()) {
+    for (auto &hull : ctx.options.target_game->get_hull_sizes()) {
         for (auto &v : hull.size()) {
             hull_extents = std::max(hull_extents, fabs(v));
         }
     }
 
-    qbsp_options.worldextent.set_value(ceil((extents + hull_extents) * 2) + SIDESPACE, settings::source::GAME_TARGET);
+    ctx.options.worldextent.set_value(ceil((extents + hull_extents) * 2) + SIDESPACE, settings::source::GAME_TARGET);
 
-    logging::print("INFO: world extents calculated to {} units\n", qbsp_options.worldextent.value());
+    logging::print("INFO: world extents calculated to {} units\n", ctx.options.worldextent.value());
 }
 
 /*
@@ -3762,9 +4170,9 @@ WriteBspBrushMap
 from q3map
 ==================
 */
-void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::container &list)
+void WriteBspBrushMap(qbsp_context_t &ctx, std::string_view filename_suffix, const bspbrush_t::container &list)
 {
-    fs::path name = qbsp_options.bsp_path;
+    fs::path name = ctx.options.bsp_path;
     name.replace_extension(std::string(filename_suffix) + ".map");
 
     logging::print("writing {}\n", name);
@@ -3781,7 +4189,7 @@ void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::contai
         }
         ewt::print(f, "{{\n");
         for (auto &face : brush->sides) {
-            winding_t w = BaseWindingForPlane<winding_t>(face.get_plane());
+            winding_t w = BaseWindingForPlane<winding_t>(ctx.options, face.get_plane(ctx.map));
 
             ewt::print(f, "( {} ) ", w[0]);
             ewt::print(f, "( {} ) ", w[1]);
@@ -3795,7 +4203,7 @@ void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::contai
             }
 #endif
 
-            ewt::print(f, "{} 0 0 0 1 1\n", map.miptex[face.get_texinfo().miptex].name);
+            ewt::print(f, "{} 0 0 0 1 1\n", ctx.map.miptex[face.get_texinfo(ctx.map).miptex].name);
         }
 
         ewt::print(f, "}}\n");
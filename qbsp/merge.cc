@@ -60,7 +60,7 @@ Returns NULL if the faces couldn't be merged, or the new face.
 The originals will NOT be freed.
 =============
 */
-static std::unique_ptr<face_t> TryMerge(const face_t *f1, const face_t *f2)
+static std::unique_ptr<face_t> TryMerge(qbsp_context_t &ctx, const face_t *f1, const face_t *f2)
 {
     qvec3d p1, p2, p3, p4, back;
     int i, j, k, l;
@@ -73,14 +73,14 @@ static std::unique_ptr<face_t> TryMerge(const face_t *f1, const face_t *f2)
         return NULL;
 
     // TODO: make this configurable?
-    if (qbsp_options.target_game->id != GAME_QUAKE_II) {
+    if (ctx.options.target_game->id != GAME_QUAKE_II) {
         // Q1: don't merge across water boundaries; ezQuake/nQuake water caustics will leak onto
         // above-water faces.
-        if (f1->contents[0].is_liquid(qbsp_options.target_game) != f2->contents[0].is_liquid(qbsp_options.target_game))
+        if (f1->contents[0].is_liquid(ctx.options.target_game) != f2->contents[0].is_liquid(ctx.options.target_game))
             return nullptr;
 
         // Q1: don't merge across sky boundary - we delete faces inside sky
-        if (f1->contents[0].is_sky(qbsp_options.target_game) != f2->contents[0].is_sky(qbsp_options.target_game))
+        if (f1->contents[0].is_sky(ctx.options.target_game) != f2->contents[0].is_sky(ctx.options.target_game))
             return nullptr;
     }
 
@@ -110,7 +110,7 @@ static std::unique_ptr<face_t> TryMerge(const face_t *f1, const face_t *f2)
 
     // check slope of connected lines
     // if the slopes are colinear, the point can be removed
-    const qvec3d &planenormal = f1->get_plane().get_normal();
+    const qvec3d &planenormal = f1->get_plane(ctx.map).get_normal();
 
     back = f1->w[(i + f1->w.size() - 1) % f1->w.size()];
     delta = p1 - back;
@@ -165,14 +165,14 @@ static std::unique_ptr<face_t> TryMerge(const face_t *f1, const face_t *f2)
 MergeFaceToList
 ===============
 */
-void MergeFaceToList(
+void MergeFaceToList(qbsp_context_t &ctx, 
     std::unique_ptr<face_t> face, std::list<std::unique_ptr<face_t>> &list, logging::stat_tracker_t::stat &num_merged)
 {
     for (auto it = list.begin(); it != list.end();) {
 #ifdef PARANOID
         CheckColinear(f);
 #endif
-        std::unique_ptr<face_t> newf = TryMerge(face.get(), it->get());
+        std::unique_ptr<face_t> newf = TryMerge(ctx, face.get(), it->get());
 
         if (newf) {
             list.erase(it);
@@ -193,13 +193,13 @@ void MergeFaceToList(
 MergeFaceList
 ===============
 */
-std::list<std::unique_ptr<face_t>> MergeFaceList(
+std::list<std::unique_ptr<face_t>> MergeFaceList(qbsp_context_t &ctx, 
     std::list<std::unique_ptr<face_t>> input, logging::stat_tracker_t::stat &num_merged)
 {
     std::list<std::unique_ptr<face_t>> result;
 
     for (auto &face : input) {
-        MergeFaceToList(std::move(face), result, num_merged);
+        MergeFaceToList(ctx, std::move(face), result, num_merged);
     }
 
     return result;
@@ -36,22 +36,22 @@
 #include <unordered_set>
 #include <utility>
 
-static bool LeafSealsMap(const node_t *node)
+static bool LeafSealsMap(qbsp_context_t &ctx, const node_t *node)
 {
     Q_assert(node->is_leaf);
 
-    return qbsp_options.target_game->contents_seals_map(node->contents);
+    return ctx.options.target_game->contents_seals_map(node->contents);
 }
 
-static bool LeafSealsForDetailFill(const node_t *node)
+static bool LeafSealsForDetailFill(qbsp_context_t &ctx, const node_t *node)
 {
     Q_assert(node->is_leaf);
 
     // NOTE: detail-solid is considered sealing for the detail fill,
     // but not the regular fill (LeafSealsMap).
 
-    return qbsp_options.target_game->contents_are_any_solid(node->contents) ||
-           qbsp_options.target_game->contents_are_sky(node->contents);
+    return ctx.options.target_game->contents_are_any_solid(node->contents) ||
+           ctx.options.target_game->contents_are_sky(node->contents);
 }
 
 /*
@@ -70,27 +70,27 @@ leaf, so an info_player_start 24 units off a floor causes the
 room to not get filled in as solid.
 ===========
 */
-static node_t *PointInLeaf(node_t *node, const qvec3d &point, bool prefer_sealing)
+static node_t *PointInLeaf(qbsp_context_t &ctx, node_t *node, const qvec3d &point, bool prefer_sealing)
 {
     if (node->is_leaf) {
         return node;
     }
 
-    vec_t dist = node->get_plane().distance_to(point);
+    vec_t dist = node->get_plane(ctx.map).distance_to(point);
 
     if (dist > 0) {
         // point is on the front of the node plane
-        return PointInLeaf(node->children[0], point, prefer_sealing);
+        return PointInLeaf(ctx, node->children[0], point, prefer_sealing);
     } else if (dist < 0) {
         // point is on the back of the node plane
-        return PointInLeaf(node->children[1], point, prefer_sealing);
+        return PointInLeaf(ctx, node->children[1], point, prefer_sealing);
     } else {
         // point is exactly on the node plane
 
-        node_t *front = PointInLeaf(node->children[0], point, prefer_sealing);
-        node_t *back = PointInLeaf(node->children[1], point, prefer_sealing);
+        node_t *front = PointInLeaf(ctx, node->children[0], point, prefer_sealing);
+        node_t *back = PointInLeaf(ctx, node->children[1], point, prefer_sealing);
 
-        if (prefer_sealing == LeafSealsMap(front)) {
+        if (prefer_sealing == LeafSealsMap(ctx, front)) {
             return front;
         }
         return back;
@@ -110,24 +110,24 @@ static void ClearOccupied_r(node_t *node)
     }
 }
 
-static bool OutsideFill_Passable(const portal_t *p)
+static bool OutsideFill_Passable(qbsp_context_t &ctx, const portal_t *p)
 {
     if (!p->onnode) {
         // portal to outside_node
         return false;
     }
 
-    return !LeafSealsMap(p->nodes[0]) && !LeafSealsMap(p->nodes[1]);
+    return !LeafSealsMap(ctx, p->nodes[0]) && !LeafSealsMap(ctx, p->nodes[1]);
 }
 
-static bool DetailFill_Passable(const portal_t *p)
+static bool DetailFill_Passable(qbsp_context_t &ctx, const portal_t *p)
 {
     if (!p->onnode) {
         // portal to outside_node
         return false;
     }
 
-    return !LeafSealsForDetailFill(p->nodes[0]) && !LeafSealsForDetailFill(p->nodes[1]);
+    return !LeafSealsForDetailFill(ctx, p->nodes[0]) && !LeafSealsForDetailFill(ctx, p->nodes[1]);
 }
 
 /*
@@ -140,7 +140,7 @@ preconditions:
 - all leafs have outside_distance set to -1
 ==================
 */
-static void FloodFillLeafsFromVoid(tree_t &tree)
+static void FloodFillLeafsFromVoid(qbsp_context_t &ctx, tree_t &tree)
 {
     // breadth-first search
     std::list<std::pair<node_t *, int>> queue;
@@ -155,7 +155,7 @@ static void FloodFillLeafsFromVoid(tree_t &tree)
         Q_assert(fillnode != &tree.outside_node);
 
         // this must be true because the map is made from closed brushes, beyond which is void
-        Q_assert(!LeafSealsMap(fillnode));
+        Q_assert(!LeafSealsMap(ctx, fillnode));
         queue.emplace_back(fillnode, 0);
     }
 
@@ -180,7 +180,7 @@ static void FloodFillLeafsFromVoid(tree_t &tree)
         for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
             side = (portal->nodes[0] == node);
 
-            if (!OutsideFill_Passable(portal))
+            if (!OutsideFill_Passable(ctx, portal))
                 continue;
 
             node_t *neighbour = portal->nodes[side];
@@ -196,7 +196,7 @@ FindPortalsToVoid
 Given an occupied leaf, returns a list of porals leading to the void
 =============
 */
-static std::vector<portal_t *> FindPortalsToVoid(node_t *occupied_leaf)
+static std::vector<portal_t *> FindPortalsToVoid(qbsp_context_t &ctx, node_t *occupied_leaf)
 {
     Q_assert(occupied_leaf->occupant != nullptr);
     Q_assert(occupied_leaf->outside_distance >= 0);
@@ -219,7 +219,7 @@ static std::vector<portal_t *> FindPortalsToVoid(node_t *occupied_leaf)
         for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
             side = (portal->nodes[0] == node);
 
-            if (!OutsideFill_Passable(portal))
+            if (!OutsideFill_Passable(ctx, portal))
                 continue;
 
             node_t *neighbour = portal->nodes[side];
@@ -249,16 +249,16 @@ static std::vector<portal_t *> FindPortalsToVoid(node_t *occupied_leaf)
 WriteLeakTrail
 ===============
 */
-void WriteLeakTrail(std::ofstream &leakfile, qvec3d point1, const qvec3d &point2)
+void WriteLeakTrail(qbsp_context_t &ctx, std::ofstream &leakfile, qvec3d point1, const qvec3d &point2)
 {
-    if (qbsp_options.leakdist.value()) {
+    if (ctx.options.leakdist.value()) {
         qvec3d vector = point2 - point1;
         vec_t dist = qv::normalizeInPlace(vector);
 
-        while (dist > qbsp_options.leakdist.value()) {
+        while (dist > ctx.options.leakdist.value()) {
             ewt::print(leakfile, "{}\n", point1);
-            point1 += vector * qbsp_options.leakdist.value();
-            dist -= qbsp_options.leakdist.value();
+            point1 += vector * ctx.options.leakdist.value();
+            dist -= ctx.options.leakdist.value();
         }
     } else {
         ewt::print(leakfile, "{}\n", point1);
@@ -273,9 +273,9 @@ WriteLeakLine
 leakline should be a sequence of portals leading from leakentity to the void
 ===============
 */
-static void WriteLeakLine(const mapentity_t &leakentity, const std::vector<portal_t *> &leakline)
+static void WriteLeakLine(qbsp_context_t &ctx, const mapentity_t &leakentity, const std::vector<portal_t *> &leakline)
 {
-    fs::path name = qbsp_options.bsp_path;
+    fs::path name = ctx.options.bsp_path;
     name.replace_extension("pts");
 
     std::ofstream ptsfile(name);
@@ -289,7 +289,7 @@ static void WriteLeakLine(const mapentity_t &leakentity, const std::vector<porta
         qvec3d currpt = portal->winding.center();
 
         // draw dots from prevpt to currpt
-        WriteLeakTrail(ptsfile, prevpt, currpt);
+        WriteLeakTrail(ctx, ptsfile, prevpt, currpt);
 
         prevpt = currpt;
     }
@@ -297,7 +297,8 @@ static void WriteLeakLine(const mapentity_t &leakentity, const std::vector<porta
     logging::print("Leak file written to {}\n", name);
 }
 
-static void WriteLeafVolumes(const std::vector<portal_t *> &leakline, std::string_view filename_suffix)
+static void WriteLeafVolumes(
+    qbsp_context_t &ctx, const std::vector<portal_t *> &leakline, std::string_view filename_suffix)
 {
     std::set<node_t *> used_leafs;
     std::vector<bspbrush_t::ptr> volumes_to_write;
@@ -315,7 +316,7 @@ static void WriteLeafVolumes(const std::vector<portal_t *> &leakline, std::strin
         }
     }
 
-    WriteBspBrushMap(filename_suffix, volumes_to_write);
+    WriteBspBrushMap(ctx, filename_suffix, volumes_to_write);
 }
 
 /**
@@ -337,10 +338,10 @@ MarkOccupiedLeafs
 sets node->occupant
 ==================
 */
-static void MarkOccupiedLeafs(node_t *headnode, hull_index_t hullnum)
+static void MarkOccupiedLeafs(qbsp_context_t &ctx, node_t *headnode, hull_index_t hullnum)
 {
-    for (int i = 1; i < map.entities.size(); i++) {
-        mapentity_t &entity = map.entities.at(i);
+    for (int i = 1; i < ctx.map.entities.size(); i++) {
+        mapentity_t &entity = ctx.map.entities.at(i);
 
         /* skip entities at (0 0 0) (bmodels) */
         if (qv::epsilonEmpty(entity.origin, QBSP_EQUAL_EPSILON))
@@ -353,9 +354,9 @@ static void MarkOccupiedLeafs(node_t *headnode, hull_index_t hullnum)
 
         /* find the leaf it's in. Skip opqaue leafs */
         bool prefer_sealing = !hullnum.has_value() || hullnum.value() == 0;
-        node_t *leaf = PointInLeaf(headnode, entity.origin, prefer_sealing);
+        node_t *leaf = PointInLeaf(ctx, headnode, entity.origin, prefer_sealing);
 
-        if (LeafSealsMap(leaf)) {
+        if (LeafSealsMap(ctx, leaf)) {
             continue;
         }
 
@@ -396,14 +397,14 @@ static std::vector<node_t *> FindOccupiedLeafs(node_t *headnode)
 
 //=============================================================================
 
-void MarkBrushSidesInvisible(bspbrush_t::container &brushes)
+void MarkBrushSidesInvisible(qbsp_context_t &ctx, bspbrush_t::container &brushes)
 {
     for (auto &brush : brushes) {
         for (auto &face : brush->sides) {
             if (face.source) {
                 face.source->visible = false;
 
-                if (face.source->get_texinfo().flags.is_hint) {
+                if (face.source->get_texinfo(ctx.map).flags.is_hint) {
                     face.source->visible = true; // hints are always visible
                 }
             }
@@ -418,16 +419,16 @@ MarkVisibleBrushSides
 Set f->touchesOccupiedLeaf=true on faces that are touching occupied leafs
 ==================
 */
-static void MarkVisibleBrushSides_R(node_t *node)
+static void MarkVisibleBrushSides_R(qbsp_context_t &ctx, node_t *node)
 {
     // descent to leafs
     if (!node->is_leaf) {
-        MarkVisibleBrushSides_R(node->children[0]);
-        MarkVisibleBrushSides_R(node->children[1]);
+        MarkVisibleBrushSides_R(ctx, node->children[0]);
+        MarkVisibleBrushSides_R(ctx, node->children[1]);
         return;
     }
 
-    if (LeafSealsForDetailFill(node)) {
+    if (LeafSealsForDetailFill(ctx, node)) {
         // this leaf is opaque
         return;
     }
@@ -450,7 +451,7 @@ static void MarkVisibleBrushSides_R(node_t *node)
                 for (auto &side : brush->sides) {
                     // fixme-brushbsp: should this be get_plane() ?
                     // fixme-brushbsp: planenum
-                    if (side.source && qv::epsilonEqual(side.get_positive_plane(), portal->plane)) {
+                    if (side.source && qv::epsilonEqual(side.get_positive_plane(ctx.map), portal->plane)) {
                         // we've found a brush side in an original brush in the neighbouring
                         // leaf, on a portal to this (non-opaque) leaf, so mark it as visible.
                         side.source->visible = true;
@@ -470,11 +471,11 @@ struct outleafs_stats_t : logging::stat_tracker_t
     stat &outleafs = register_stat("outside leaves");
 };
 
-static void OutLeafsToSolid_R(node_t *node, settings::filltype_t filltype, outleafs_stats_t &stats)
+static void OutLeafsToSolid_R(qbsp_context_t &ctx, node_t *node, settings::filltype_t filltype, outleafs_stats_t &stats)
 {
     if (!node->is_leaf) {
-        OutLeafsToSolid_R(node->children[0], filltype, stats);
-        OutLeafsToSolid_R(node->children[1], filltype, stats);
+        OutLeafsToSolid_R(ctx, node->children[0], filltype, stats);
+        OutLeafsToSolid_R(ctx, node->children[1], filltype, stats);
         return;
     }
 
@@ -490,12 +491,12 @@ static void OutLeafsToSolid_R(node_t *node, settings::filltype_t filltype, outle
     }
 
     // Don't fill sky, or count solids as outleafs
-    if (qbsp_options.target_game->contents_seals_map(node->contents)) {
+    if (ctx.options.target_game->contents_seals_map(node->contents)) {
         return;
     }
 
     // Finally, we can fill it in as void.
-    node->contents = qbsp_options.target_game->create_solid_contents();
+    node->contents = ctx.options.target_game->create_solid_contents();
     stats.outleafs++;
 }
 
@@ -504,11 +505,12 @@ struct detail_filled_leafs_stats_t : logging::stat_tracker_t
     stat &filledleafs = register_stat("detail filled leafs", true);
 };
 
-static void FillDetailEnclosedLeafsToDetailSolid_R(node_t *node, detail_filled_leafs_stats_t &stats)
+static void FillDetailEnclosedLeafsToDetailSolid_R(
+    qbsp_context_t &ctx, node_t *node, detail_filled_leafs_stats_t &stats)
 {
     if (!node->is_leaf) {
-        FillDetailEnclosedLeafsToDetailSolid_R(node->children[0], stats);
-        FillDetailEnclosedLeafsToDetailSolid_R(node->children[1], stats);
+        FillDetailEnclosedLeafsToDetailSolid_R(ctx, node->children[0], stats);
+        FillDetailEnclosedLeafsToDetailSolid_R(ctx, node->children[1], stats);
         return;
     }
 
@@ -518,13 +520,13 @@ static void FillDetailEnclosedLeafsToDetailSolid_R(node_t *node, detail_filled_l
     }
 
     // Don't fill sky, or count solids as outleafs
-    if (LeafSealsForDetailFill(node)) {
+    if (LeafSealsForDetailFill(ctx, node)) {
         return;
     }
 
     // Finally, we can fill it in as detail solid.
     node->contents =
-        qbsp_options.target_game->create_detail_solid_contents(qbsp_options.target_game->create_solid_contents());
+        ctx.options.target_game->create_detail_solid_contents(ctx.options.target_game->create_solid_contents());
     stats.filledleafs++;
 }
 
@@ -542,7 +544,7 @@ static void SetOccupied_R(node_t *node, int dist)
 }
 #endif
 
-using portal_passable_t = bool (*)(const portal_t *);
+using portal_passable_t = bool (*)(qbsp_context_t &ctx, const portal_t *);
 
 /*
 ==================
@@ -552,7 +554,7 @@ sets node->occupied to 1 or more to indicate the number of steps to a directly o
 ==================
 */
 static void BFSFloodFillFromOccupiedLeafs(
-    const std::vector<node_t *> &occupied_leafs, const portal_passable_t &predicate)
+    qbsp_context_t &ctx, const std::vector<node_t *> &occupied_leafs, const portal_passable_t &predicate)
 {
     std::list<std::pair<node_t *, int>> queue;
     for (node_t *leaf : occupied_leafs) {
@@ -576,7 +578,7 @@ static void BFSFloodFillFromOccupiedLeafs(
             for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
                 side = (portal->nodes[0] == node);
 
-                if (!predicate(portal))
+                if (!predicate(ctx, portal))
                     continue;
 
                 node_t *neighbour = portal->nodes[side];
@@ -586,7 +588,7 @@ static void BFSFloodFillFromOccupiedLeafs(
     }
 }
 
-static std::vector<portal_t *> MakeLeakLine(node_t *outleaf, mapentity_t *&leakentity)
+static std::vector<portal_t *> MakeLeakLine(qbsp_context_t &ctx, node_t *outleaf, mapentity_t *&leakentity)
 {
     std::vector<portal_t *> result;
 
@@ -608,7 +610,7 @@ static std::vector<portal_t *> MakeLeakLine(node_t *outleaf, mapentity_t *&leake
         for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
             side = (portal->nodes[0] == node);
 
-            if (!OutsideFill_Passable(portal))
+            if (!OutsideFill_Passable(ctx, portal))
                 continue;
 
             node_t *neighbour = portal->nodes[side];
@@ -667,18 +669,19 @@ get incorrectly marked as "invisible").
 Special cases: structural fully covered by detail still needs to be marked "visible".
 ===========
 */
-bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes)
+bool FillOutside(qbsp_context_t &ctx, tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes)
 {
     node_t *node = tree.headnode;
 
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
     logging::percent_clock clock;
 
     /* Clear the outside filling state on all nodes */
     ClearOccupied_r(node);
 
     // Sets leaf->occupant
-    MarkOccupiedLeafs(node, hullnum);
+    MarkOccupiedLeafs(ctx, node, hullnum);
     const std::vector<node_t *> occupied_leafs = FindOccupiedLeafs(node);
 
     for (auto *occupied_leaf : occupied_leafs) {
@@ -694,21 +697,21 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
     mapentity_t *leakentity = nullptr;
     std::vector<portal_t *> leakline;
 
-    settings::filltype_t filltype = qbsp_options.filltype.value();
+    settings::filltype_t filltype = ctx.options.filltype.value();
 
     if (filltype == settings::filltype_t::AUTO) {
         filltype = settings::filltype_t::INSIDE;
     }
 
     if (filltype == settings::filltype_t::INSIDE) {
-        BFSFloodFillFromOccupiedLeafs(occupied_leafs, OutsideFill_Passable);
+        BFSFloodFillFromOccupiedLeafs(ctx, occupied_leafs, OutsideFill_Passable);
 
         /* first check to see if an occupied leaf is hit */
         const int side = (tree.outside_node.portals->nodes[0] == &tree.outside_node);
         node_t *fillnode = tree.outside_node.portals->nodes[side];
 
         if (fillnode->occupied > 0) {
-            leakline = MakeLeakLine(fillnode, leakentity);
+            leakline = MakeLeakLine(ctx, fillnode, leakentity);
             std::reverse(leakline.begin(), leakline.end());
         }
     } else {
@@ -716,7 +719,7 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
         //
         // We tried inside -> out and it leads to things like monster boxes getting inadvertently sealed,
         // or even whole sections of the map with no point entities - problems compounded by hull expansion.
-        FloodFillLeafsFromVoid(tree);
+        FloodFillLeafsFromVoid(ctx, tree);
 
         // check for the occupied leaf closest to the void
         int best_leak_dist = INT_MAX;
@@ -735,35 +738,35 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
         if (best_leak) {
             leakentity = best_leak->occupant;
             Q_assert(leakentity != nullptr);
-            leakline = FindPortalsToVoid(best_leak);
+            leakline = FindPortalsToVoid(ctx, best_leak);
         }
     }
 
     if (leakentity) {
         logging::print("WARNING: Reached occupant \"{}\" at ({}), no filling performed.\n",
             leakentity->epairs.get("classname"), leakentity->origin);
-        if (map.leakfile)
+        if (ctx.map.leakfile)
             return false;
 
-        WriteLeakLine(*leakentity, leakline);
-        map.leakfile = true;
+        WriteLeakLine(ctx, *leakentity, leakline);
+        ctx.map.leakfile = true;
 
         // also write the leak portals to `<bsp_path>.leak.prt`
-        WriteDebugPortals(leakline, "leak");
+        WriteDebugPortals(ctx, leakline, "leak");
 
         // also write the leafs used in the leak line to <bsp_path>.leak-leaf-volumes.map`
-        if (qbsp_options.debugleak.value()) {
-            WriteLeafVolumes(leakline, "leak-leaf-volumes");
+        if (ctx.options.debugleak.value()) {
+            WriteLeafVolumes(ctx, leakline, "leak-leaf-volumes");
         }
 
         /* Get rid of the .prt file since the map has a leak */
-        if (!qbsp_options.keepprt.value()) {
-            fs::path name = qbsp_options.bsp_path;
+        if (!ctx.options.keepprt.value()) {
+            fs::path name = ctx.options.bsp_path;
             name.replace_extension("prt");
             remove(name);
         }
 
-        if (qbsp_options.leaktest.value()) {
+        if (ctx.options.leaktest.value()) {
             logging::print("Aborting because -leaktest was used.\n");
             exit(1);
         }
@@ -776,37 +779,37 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
 
     // change the leaf contents
     outleafs_stats_t stats;
-    OutLeafsToSolid_R(node, filltype, stats);
+    OutLeafsToSolid_R(ctx, node, filltype, stats);
 
     // See missing_face_simple.map for a test case with a brush that straddles between void and non-void
 
-    MarkBrushSidesInvisible(brushes);
+    MarkBrushSidesInvisible(ctx, brushes);
 
-    MarkVisibleBrushSides_R(node);
+    MarkVisibleBrushSides_R(ctx, node);
 
 #if 0
     // FIXME: move somewhere else
-    if (qbsp_options.outsidedebug.value() && (qbsp_options.target_game->get_hull_sizes().size() == 0 || hullnum == 0)) {
-        fs::path path = qbsp_options.bsp_path;
+    if (ctx.options.outsidedebug.value() && (ctx.options.target_game->get_hull_sizes().size() == 0 || hullnum == 0)) {
+        fs::path path = ctx.options.bsp_path;
         path.replace_extension(".outside.map");
 
-        WriteBspBrushMap(path, map.entities[0].brushes);
+        WriteBspBrushMap(ctx, path, ctx.map.entities[0].brushes);
     }
 #endif
 
     return true;
 }
 
-void FillBrushEntity(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes)
+void FillBrushEntity(qbsp_context_t &ctx, tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes)
 {
     logging::funcheader();
 
     // Clear the outside filling state on all nodes
     ClearOccupied_r(tree.headnode);
 
-    MarkBrushSidesInvisible(brushes);
+    MarkBrushSidesInvisible(ctx, brushes);
 
-    MarkVisibleBrushSides_R(tree.headnode);
+    MarkVisibleBrushSides_R(ctx, tree.headnode);
 }
 
 /**
@@ -815,7 +818,7 @@ void FillBrushEntity(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &
  * Intended to be run after FillOutside, so we preserve the visibility flag on brush sides, but
  * additionally mark some new brush sides as invisible.
  */
-void FillDetail(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes)
+void FillDetail(qbsp_context_t &ctx, tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes)
 {
     logging::funcheader();
 
@@ -823,7 +826,7 @@ void FillDetail(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brush
     ClearOccupied_r(tree.headnode);
 
     // Sets leaf->occupant
-    MarkOccupiedLeafs(tree.headnode, hullnum);
+    MarkOccupiedLeafs(ctx, tree.headnode, hullnum);
     const std::vector<node_t *> occupied_leafs = FindOccupiedLeafs(tree.headnode);
 
     if (occupied_leafs.empty()) {
@@ -831,15 +834,15 @@ void FillDetail(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brush
         return;
     }
 
-    BFSFloodFillFromOccupiedLeafs(occupied_leafs, DetailFill_Passable);
+    BFSFloodFillFromOccupiedLeafs(ctx, occupied_leafs, DetailFill_Passable);
 
     // change the leaf contents
     detail_filled_leafs_stats_t stats;
-    FillDetailEnclosedLeafsToDetailSolid_R(tree.headnode, stats);
+    FillDetailEnclosedLeafsToDetailSolid_R(ctx, tree.headnode, stats);
 
     // See missing_face_simple.map for a test case with a brush that straddles between void and non-void
 
-    MarkBrushSidesInvisible(brushes);
+    MarkBrushSidesInvisible(ctx, brushes);
 
-    MarkVisibleBrushSides_R(tree.headnode);
+    MarkVisibleBrushSides_R(ctx, tree.headnode);
 }
@@ -35,14 +35,14 @@
 #include "tbb/task_group.h"
 #include "common/vectorutils.hh"
 
-contentflags_t ClusterContents(const node_t *node)
+contentflags_t ClusterContents(qbsp_context_t &ctx, const node_t *node)
 {
     /* Pass the leaf contents up the stack */
     if (node->is_leaf)
         return node->contents;
 
-    return qbsp_options.target_game->cluster_contents(
-        ClusterContents(node->children[0]), ClusterContents(node->children[1]));
+    return ctx.options.target_game->cluster_contents(
+        ClusterContents(ctx, node->children[0]), ClusterContents(ctx, node->children[1]));
 }
 
 /*
@@ -55,22 +55,22 @@ The nodes on either side of the portal may actually be clusters,
 not leafs, so all contents should be ored together
 =============
 */
-bool Portal_VisFlood(const portal_t *p)
+bool Portal_VisFlood(qbsp_context_t &ctx, const portal_t *p)
 {
     if (!p->onnode) {
         return false; // to global outsideleaf
     }
 
-    contentflags_t contents0 = ClusterContents(p->nodes[0]);
-    contentflags_t contents1 = ClusterContents(p->nodes[1]);
+    contentflags_t contents0 = ClusterContents(ctx, p->nodes[0]);
+    contentflags_t contents1 = ClusterContents(ctx, p->nodes[1]);
 
     /* Can't see through func_illusionary_visblocker */
     if (contents0.illusionary_visblocker || contents1.illusionary_visblocker)
         return false;
 
     // Check per-game visibility
-    return qbsp_options.target_game->portal_can_see_through(
-        contents0, contents1, qbsp_options.transwater.value(), qbsp_options.transsky.value());
+    return ctx.options.target_game->portal_can_see_through(
+        contents0, contents1, ctx.options.transwater.value(), ctx.options.transsky.value());
 }
 
 /*
@@ -82,15 +82,15 @@ The entity flood determines which areas are
 Flowing from side s to side !s
 ===============
 */
-bool Portal_EntityFlood(const portal_t *p, int32_t s)
+bool Portal_EntityFlood(qbsp_context_t &ctx, const portal_t *p, int32_t s)
 {
     if (!p->nodes[0]->is_leaf || !p->nodes[1]->is_leaf) {
         FError("Portal_EntityFlood: not a leaf");
     }
 
     // can never cross to a solid
-    if (p->nodes[0]->contents.is_solid(qbsp_options.target_game) ||
-        p->nodes[1]->contents.is_solid(qbsp_options.target_game)) {
+    if (p->nodes[0]->contents.is_solid(ctx.options.target_game) ||
+        p->nodes[1]->contents.is_solid(ctx.options.target_game)) {
         return false;
     }
 
@@ -124,7 +124,7 @@ MakeHeadnodePortals
 The created portals will face the global outside_node
 ================
 */
-std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree)
+std::list<buildportal_t> MakeHeadnodePortals(qbsp_context_t &ctx, tree_t &tree)
 {
     int i, j, n;
     std::array<buildportal_t, 6> portals{};
@@ -134,7 +134,7 @@ std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree)
     aabb3d bounds = tree.bounds.grow(SIDESPACE);
 
     tree.outside_node.is_leaf = true;
-    tree.outside_node.contents = qbsp_options.target_game->create_solid_contents();
+    tree.outside_node.contents = ctx.options.target_game->create_solid_contents();
     tree.outside_node.portals = NULL;
 
     // create 6 portals forming a cube around the bounds of the map.
@@ -156,7 +156,7 @@ std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree)
             }
             bool side = p.plane.set_plane(pl, true);
 
-            p.winding = BaseWindingForPlane<winding_t>(pl);
+            p.winding = BaseWindingForPlane<winding_t>(ctx.options, pl);
             if (side) {
                 p.nodes = {&tree.outside_node, tree.headnode};
             } else {
@@ -172,7 +172,7 @@ std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree)
             if (j == i)
                 continue;
 
-            if (auto w2 = w.clip_front(bplanes[j], qbsp_options.epsilon.value(), true)) {
+            if (auto w2 = w.clip_front(bplanes[j], ctx.options.epsilon.value(), true)) {
                 w = std::move(*w2);
             } else {
                 FError("portal winding clipped away");
@@ -196,17 +196,17 @@ Creates a winding from the given node plane, clipped by all parent nodes.
 constexpr vec_t BASE_WINDING_EPSILON = 0.001;
 constexpr vec_t SPLIT_WINDING_EPSILON = 0.001;
 
-static std::optional<winding_t> BaseWindingForNode(const node_t *node)
+static std::optional<winding_t> BaseWindingForNode(qbsp_context_t &ctx, const node_t *node)
 {
-    std::optional<winding_t> w = BaseWindingForPlane<winding_t>(node->get_plane());
+    std::optional<winding_t> w = BaseWindingForPlane<winding_t>(ctx.options, node->get_plane(ctx.map));
 
     // clip by all the parents
     for (auto *np = node->parent; np && w;) {
 
         if (np->children[0] == node) {
-            w = w->clip_front(np->get_plane(), BASE_WINDING_EPSILON, false);
+            w = w->clip_front(np->get_plane(ctx.map), BASE_WINDING_EPSILON, false);
         } else {
-            w = w->clip_back(np->get_plane(), BASE_WINDING_EPSILON, false);
+            w = w->clip_back(np->get_plane(ctx.map), BASE_WINDING_EPSILON, false);
         }
 
         node = np;
@@ -225,10 +225,10 @@ and clipping it by all of parents of this node, as well as all the other
 portals in the node.
 ==================
 */
-static std::optional<buildportal_t> MakeNodePortal(
+static std::optional<buildportal_t> MakeNodePortal(qbsp_context_t &ctx, 
     node_t *node, const std::list<buildportal_t> &boundary_portals, portalstats_t &stats)
 {
-    auto w = BaseWindingForNode(node);
+    auto w = BaseWindingForNode(ctx, node);
 
     // clip the portal by all the other portals in the node
     for (auto &p : boundary_portals) {
@@ -259,7 +259,7 @@ static std::optional<buildportal_t> MakeNodePortal(
     }
 
     buildportal_t new_portal{};
-    new_portal.plane = node->get_plane();
+    new_portal.plane = node->get_plane(ctx.map);
     new_portal.onnode = node;
     new_portal.winding = std::move(*w);
     new_portal.nodes = node->children;
@@ -274,10 +274,10 @@ Move or split the portals that bound node so that the node's
 children have portals instead of node.
 ==============
 */
-static twosided<std::list<buildportal_t>> SplitNodePortals(
+static twosided<std::list<buildportal_t>> SplitNodePortals(qbsp_context_t &ctx, 
     const node_t *node, std::list<buildportal_t> boundary_portals, portalstats_t &stats)
 {
-    const auto &plane = node->get_plane();
+    const auto &plane = node->get_plane(ctx.map);
     node_t *f = node->children[0];
     node_t *b = node->children[1];
 
@@ -395,15 +395,15 @@ inline void CalcNodeBounds(node_t *node)
     }
 }
 
-static void CalcTreeBounds_r(node_t *node, logging::percent_clock &clock)
+static void CalcTreeBounds_r(qbsp_context_t &ctx, node_t *node, logging::percent_clock &clock)
 {
     if (node->is_leaf) {
         clock();
         CalcNodeBounds(node);
     } else {
         tbb::task_group g;
-        g.run([&]() { CalcTreeBounds_r(node->children[0], clock); });
-        g.run([&]() { CalcTreeBounds_r(node->children[1], clock); });
+        g.run([&]() { CalcTreeBounds_r(ctx, node->children[0], clock); });
+        g.run([&]() { CalcTreeBounds_r(ctx, node->children[1], clock); });
         g.wait();
 
         node->bounds = node->children[0]->bounds + node->children[1]->bounds;
@@ -418,7 +418,7 @@ static void CalcTreeBounds_r(node_t *node, logging::percent_clock &clock)
     }
 
     for (auto &v : node->bounds.mins()) {
-        if (fabs(v) > qbsp_options.worldextent.value()) {
+        if (fabs(v) > ctx.options.worldextent.value()) {
             logging::print("WARNING: {} with unbounded volume\n", node->is_leaf ? "leaf" : "node");
             break;
         }
@@ -435,7 +435,7 @@ descends the tree, splitting the portals as needed until they are connected to l
 The other side of the portals will remain untouched.
 ==================
 */
-static std::list<buildportal_t> ClipNodePortalsToTree_r(
+static std::list<buildportal_t> ClipNodePortalsToTree_r(qbsp_context_t &ctx, 
     node_t *node, portaltype_t type, std::list<buildportal_t> portals, portalstats_t &stats)
 {
     if (portals.empty()) {
@@ -445,12 +445,12 @@ static std::list<buildportal_t> ClipNodePortalsToTree_r(
         return portals;
     }
 
-    auto boundary_portals_split = SplitNodePortals(node, std::move(portals), stats);
+    auto boundary_portals_split = SplitNodePortals(ctx, node, std::move(portals), stats);
 
     auto front_fragments =
-        ClipNodePortalsToTree_r(node->children[0], type, std::move(boundary_portals_split.front), stats);
+        ClipNodePortalsToTree_r(ctx, node->children[0], type, std::move(boundary_portals_split.front), stats);
     auto back_fragments =
-        ClipNodePortalsToTree_r(node->children[1], type, std::move(boundary_portals_split.back), stats);
+        ClipNodePortalsToTree_r(ctx, node->children[1], type, std::move(boundary_portals_split.back), stats);
 
     std::list<buildportal_t> merged_result = std::move(front_fragments);
     merged_result.splice(merged_result.end(), back_fragments);
@@ -464,8 +464,8 @@ MakeTreePortals_r
 Given the list of portals bounding `node`, returns the portal list for a fully-portalized `node`.
 ==================
 */
-std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std::list<buildportal_t> boundary_portals,
-    portalstats_t &stats, logging::percent_clock &clock)
+std::list<buildportal_t> MakeTreePortals_r(qbsp_context_t &ctx, node_t *node, portaltype_t type,
+    std::list<buildportal_t> boundary_portals, portalstats_t &stats, logging::percent_clock &clock)
 {
     clock();
 
@@ -474,23 +474,23 @@ std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std:
     }
 
     // make the node portal before we move out the boundary_portals
-    std::optional<buildportal_t> nodeportal = MakeNodePortal(node, boundary_portals, stats);
+    std::optional<buildportal_t> nodeportal = MakeNodePortal(ctx, node, boundary_portals, stats);
 
     // parallel part: split boundary_portals between the front and back, and obtain the fully
     // portalized front/back sides in parallel
 
-    auto boundary_portals_split = SplitNodePortals(node, std::move(boundary_portals), stats);
+    auto boundary_portals_split = SplitNodePortals(ctx, node, std::move(boundary_portals), stats);
 
     std::list<buildportal_t> result_portals_front, result_portals_back;
 
     tbb::task_group g;
     g.run([&]() {
         result_portals_front =
-            MakeTreePortals_r(node->children[0], type, std::move(boundary_portals_split.front), stats, clock);
+            MakeTreePortals_r(ctx, node->children[0], type, std::move(boundary_portals_split.front), stats, clock);
     });
     g.run([&]() {
         result_portals_back =
-            MakeTreePortals_r(node->children[1], type, std::move(boundary_portals_split.back), stats, clock);
+            MakeTreePortals_r(ctx, node->children[1], type, std::move(boundary_portals_split.back), stats, clock);
     });
     g.wait();
 
@@ -504,9 +504,9 @@ std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std:
         // these portal fragments have node->children[1] on one side, and the leaf nodes from
         // node->children[0] on the other side
         std::list<buildportal_t> half_clipped =
-            ClipNodePortalsToTree_r(node->children[0], type, make_list(std::move(*nodeportal)), stats);
+            ClipNodePortalsToTree_r(ctx, node->children[0], type, make_list(std::move(*nodeportal)), stats);
 
-        result_portals_onnode = ClipNodePortalsToTree_r(node->children[1], type, std::move(half_clipped), stats);
+        result_portals_onnode = ClipNodePortalsToTree_r(ctx, node->children[1], type, std::move(half_clipped), stats);
     }
 
     // all done, merge together the lists and return
@@ -521,13 +521,14 @@ std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std:
 MakeTreePortals
 ==================
 */
-void MakeTreePortals(tree_t &tree)
+void MakeTreePortals(qbsp_context_t &ctx, tree_t &tree)
 {
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
 
     FreeTreePortals(tree);
 
-    auto headnodeportals = MakeHeadnodePortals(tree);
+    auto headnodeportals = MakeHeadnodePortals(ctx, tree);
 
     {
         logging::percent_clock clock(tree.nodes.size());
@@ -535,7 +536,7 @@ void MakeTreePortals(tree_t &tree)
         portalstats_t stats{};
 
         auto buildportals =
-            MakeTreePortals_r(tree.headnode, portaltype_t::TREE, std::move(headnodeportals), stats, clock);
+            MakeTreePortals_r(ctx, tree.headnode, portaltype_t::TREE, std::move(headnodeportals), stats, clock);
 
         MakePortalsFromBuildportals(tree, buildportals);
     }
@@ -543,7 +544,7 @@ void MakeTreePortals(tree_t &tree)
     logging::header("CalcTreeBounds");
 
     logging::percent_clock clock;
-    CalcTreeBounds_r(tree.headnode, clock);
+    CalcTreeBounds_r(ctx, tree.headnode, clock);
     clock.print();
 
     struct tree_portal_stats_t : logging::stat_tracker_t
@@ -562,13 +563,13 @@ FLOOD AREAS
 =========================================================
 */
 
-static void ApplyArea_r(node_t *node)
+static void ApplyArea_r(qbsp_context_t &ctx, node_t *node)
 {
-    node->area = map.c_areas;
+    node->area = ctx.map.c_areas;
 
     if (!node->is_leaf) {
-        ApplyArea_r(node->children[0]);
-        ApplyArea_r(node->children[1]);
+        ApplyArea_r(ctx, node->children[0]);
+        ApplyArea_r(ctx, node->children[1]);
     }
 }
 
@@ -595,9 +596,9 @@ static mapentity_t *AreanodeEntityForLeaf(node_t *node)
 FloodAreas_r
 =============
 */
-static void FloodAreas_r(node_t *node)
+static void FloodAreas_r(qbsp_context_t &ctx, node_t *node)
 {
-    if ((node->is_leaf || node->detail_separator) && (ClusterContents(node).native & Q2_CONTENTS_AREAPORTAL)) {
+    if ((node->is_leaf || node->detail_separator) && (ClusterContents(ctx, node).native & Q2_CONTENTS_AREAPORTAL)) {
         // grab the func_areanode entity
         mapentity_t *entity = AreanodeEntityForLeaf(node);
 
@@ -610,7 +611,7 @@ static void FloodAreas_r(node_t *node)
         // this node is part of an area portal;
         // if the current area has allready touched this
         // portal, we are done
-        if (entity->portalareas[0] == map.c_areas || entity->portalareas[1] == map.c_areas)
+        if (entity->portalareas[0] == ctx.map.c_areas || entity->portalareas[1] == ctx.map.c_areas)
             return;
 
         // note the current area as bounding the portal
@@ -621,9 +622,9 @@ static void FloodAreas_r(node_t *node)
         }
 
         if (entity->portalareas[0])
-            entity->portalareas[1] = map.c_areas;
+            entity->portalareas[1] = ctx.map.c_areas;
         else
-            entity->portalareas[0] = map.c_areas;
+            entity->portalareas[0] = ctx.map.c_areas;
 
         return;
     }
@@ -631,11 +632,11 @@ static void FloodAreas_r(node_t *node)
     if (node->area)
         return; // already got it
 
-    node->area = map.c_areas;
+    node->area = ctx.map.c_areas;
 
     // propagate area assignment to descendants if we're a cluster
     if (!node->is_leaf) {
-        ApplyArea_r(node);
+        ApplyArea_r(ctx, node);
     }
 
     int32_t s;
@@ -646,10 +647,10 @@ static void FloodAreas_r(node_t *node)
 		if (p->nodes[!s]->occupied)
 			continue;
 #endif
-        if (!Portal_EntityFlood(p, s))
+        if (!Portal_EntityFlood(ctx, p, s))
             continue;
 
-        FloodAreas_r(p->nodes[!s]);
+        FloodAreas_r(ctx, p->nodes[!s]);
     }
 }
 
@@ -661,18 +662,18 @@ Just decend the tree, and for each node that hasn't had an
 area set, flood fill out from there
 =============
 */
-static void FindAreas_r(node_t *node)
+static void FindAreas_r(qbsp_context_t &ctx, node_t *node)
 {
     if (!node->is_leaf) {
-        FindAreas_r(node->children[0]);
-        FindAreas_r(node->children[1]);
+        FindAreas_r(ctx, node->children[0]);
+        FindAreas_r(ctx, node->children[1]);
         return;
     }
 
     if (node->area)
         return; // already got it
 
-    if (node->contents.is_any_solid(qbsp_options.target_game))
+    if (node->contents.is_any_solid(ctx.options.target_game))
         return;
 
     if (!node->occupied)
@@ -683,8 +684,8 @@ static void FindAreas_r(node_t *node)
     if (node->contents.native & Q2_CONTENTS_AREAPORTAL)
         return;
 
-    map.c_areas++;
-    FloodAreas_r(node);
+    ctx.map.c_areas++;
+    FloodAreas_r(ctx, node);
 }
 
 /**
@@ -743,7 +744,8 @@ static std::list<node_t *> FindShortestPath(node_t *a, node_t *b, const std::fun
 
 using exit_t = std::tuple<portal_t *, node_t *>;
 
-static void FindAreaPortalExits_R(node_t *n, std::unordered_set<node_t *> &visited, std::vector<exit_t> &exits)
+static void FindAreaPortalExits_R(
+    qbsp_context_t &ctx, node_t *n, std::unordered_set<node_t *> &visited, std::vector<exit_t> &exits)
 {
     Q_assert(n->is_leaf);
 
@@ -761,7 +763,7 @@ static void FindAreaPortalExits_R(node_t *n, std::unordered_set<node_t *> &visit
 
         // is this an exit?
         if (!(neighbour->contents.native & Q2_CONTENTS_AREAPORTAL) &&
-            !neighbour->contents.is_solid(qbsp_options.target_game)) {
+            !neighbour->contents.is_solid(ctx.options.target_game)) {
             exits.emplace_back(p, neighbour);
             continue;
         }
@@ -772,7 +774,7 @@ static void FindAreaPortalExits_R(node_t *n, std::unordered_set<node_t *> &visit
             continue;
 
         // continue exploding
-        FindAreaPortalExits_R(neighbour, visited, exits);
+        FindAreaPortalExits_R(ctx, neighbour, visited, exits);
     }
 }
 
@@ -780,12 +782,12 @@ static void FindAreaPortalExits_R(node_t *n, std::unordered_set<node_t *> &visit
  * DFS to find all portals leading out of the Q2_CONTENTS_AREAPORTAL leaf `n`, into non-solid leafs.
  * Returns all of the portals and corresponding "outside" leafs.
  */
-static std::vector<exit_t> FindAreaPortalExits(node_t *n)
+static std::vector<exit_t> FindAreaPortalExits(qbsp_context_t &ctx, node_t *n)
 {
     std::unordered_set<node_t *> visited;
     std::vector<exit_t> exits;
 
-    FindAreaPortalExits_R(n, visited, exits);
+    FindAreaPortalExits_R(ctx, n, visited, exits);
 
     return exits;
 }
@@ -793,9 +795,9 @@ static std::vector<exit_t> FindAreaPortalExits(node_t *n)
 /**
  * Attempts to write a leak line showing how the two sides of the areaportal are reachable.
  */
-static void DebugAreaPortalBothSidesLeak(node_t *node)
+static void DebugAreaPortalBothSidesLeak(qbsp_context_t &ctx, node_t *node)
 {
-    std::vector<exit_t> exits = FindAreaPortalExits(node);
+    std::vector<exit_t> exits = FindAreaPortalExits(ctx, node);
 
     if (exits.size() < 2) {
         logging::funcprint("WARNING: only found {} exits\n", exits.size());
@@ -813,8 +815,8 @@ static void DebugAreaPortalBothSidesLeak(node_t *node)
     for (size_t i = 1; i < exits.size(); ++i) {
         auto [exit_portal_i, exit_leaf_i] = exits[i];
 
-        auto path = FindShortestPath(exit_leaf0, exit_leaf_i, [](portal_t *p) -> bool {
-            if (!Portal_EntityFlood(p, 0))
+        auto path = FindShortestPath(exit_leaf0, exit_leaf_i, [&](portal_t *p) -> bool {
+            if (!Portal_EntityFlood(ctx, p, 0))
                 return false;
 
             // don't go back into an areaportal
@@ -833,8 +835,8 @@ static void DebugAreaPortalBothSidesLeak(node_t *node)
 
     // write `longest_path` as the leak
 
-    fs::path name = qbsp_options.bsp_path;
-    name.replace_extension(fmt::format("areaportal_leak{}.pts", map.numareaportal_leaks));
+    fs::path name = ctx.options.bsp_path;
+    name.replace_extension(fmt::format("areaportal_leak{}.pts", ctx.map.numareaportal_leaks));
 
     std::ofstream ptsfile(name);
 
@@ -851,12 +853,12 @@ static void DebugAreaPortalBothSidesLeak(node_t *node)
         if (next_it == longest_path.end())
             break;
 
-        WriteLeakTrail(ptsfile, (*it)->bounds.centroid(), (*next_it)->bounds.centroid());
+        WriteLeakTrail(ctx, ptsfile, (*it)->bounds.centroid(), (*next_it)->bounds.centroid());
     }
 
     logging::print("Wrote areaportal leak to {}\n", name);
 
-    ++map.numareaportal_leaks;
+    ++ctx.map.numareaportal_leaks;
 }
 
 /*
@@ -867,11 +869,11 @@ Just decend the tree, and for each node that hasn't had an
 area set, flood fill out from there
 =============
 */
-static void SetAreaPortalAreas_r(node_t *node)
+static void SetAreaPortalAreas_r(qbsp_context_t &ctx, node_t *node)
 {
     if (!node->is_leaf) {
-        SetAreaPortalAreas_r(node->children[0]);
-        SetAreaPortalAreas_r(node->children[1]);
+        SetAreaPortalAreas_r(ctx, node->children[0]);
+        SetAreaPortalAreas_r(ctx, node->children[1]);
         return;
     }
 
@@ -895,9 +897,9 @@ static void SetAreaPortalAreas_r(node_t *node)
             entity->wrote_doesnt_touch_two_areas_warning = true;
             logging::print(
                 "WARNING: {}: areaportal entity {} with targetname {} doesn't touch two areas\n  Node bounds: {} -> {}\n",
-                entity->location, entity - map.entities.data(), entity->epairs.get("targetname"), node->bounds.mins(),
-                node->bounds.maxs());
-            DebugAreaPortalBothSidesLeak(node);
+                entity->location, entity - ctx.map.entities.data(), entity->epairs.get("targetname"),
+                node->bounds.mins(), node->bounds.maxs());
+            DebugAreaPortalBothSidesLeak(ctx, node);
         }
         return;
     }
@@ -911,19 +913,19 @@ Mark each leaf with an area, bounded by CONTENTS_AREAPORTAL and
 emit them.
 =============
 */
-void EmitAreaPortals(node_t *headnode)
+void EmitAreaPortals(qbsp_context_t &ctx, node_t *headnode)
 {
     logging::funcheader();
 
-    map.bsp.dareaportals.emplace_back();
-    map.bsp.dareas.emplace_back();
+    ctx.map.bsp.dareaportals.emplace_back();
+    ctx.map.bsp.dareas.emplace_back();
 
     // don't do anything else if we've leaked
-    if (map.leakfile || map.antiregions.size() || map.region) {
+    if (ctx.map.leakfile || ctx.map.antiregions.size() || ctx.map.region) {
 
-        map.bsp.dareas.emplace_back();
+        ctx.map.bsp.dareas.emplace_back();
 
-        for (auto &e : map.entities) {
+        for (auto &e : ctx.map.entities) {
             e.areaportalnum = 0;
 
             if (e.epairs.get("classname") == "func_areaportal") {
@@ -934,14 +936,14 @@ void EmitAreaPortals(node_t *headnode)
         return;
     }
 
-    FindAreas_r(headnode);
-    SetAreaPortalAreas_r(headnode);
+    FindAreas_r(ctx, headnode);
+    SetAreaPortalAreas_r(ctx, headnode);
 
-    for (size_t i = 1; i <= map.c_areas; i++) {
-        darea_t &area = map.bsp.dareas.emplace_back();
-        area.firstareaportal = map.bsp.dareaportals.size();
+    for (size_t i = 1; i <= ctx.map.c_areas; i++) {
+        darea_t &area = ctx.map.bsp.dareas.emplace_back();
+        area.firstareaportal = ctx.map.bsp.dareaportals.size();
 
-        for (auto &e : map.entities) {
+        for (auto &e : ctx.map.entities) {
 
             if (!e.areaportalnum)
                 continue;
@@ -957,21 +959,21 @@ void EmitAreaPortals(node_t *headnode)
 
             size_t j = 0;
 
-            for (; j < map.bsp.dareaportals.size(); j++) {
-                if (map.bsp.dareaportals[j] == dp)
+            for (; j < ctx.map.bsp.dareaportals.size(); j++) {
+                if (ctx.map.bsp.dareaportals[j] == dp)
                     break;
             }
 
-            if (j == map.bsp.dareaportals.size())
-                map.bsp.dareaportals.push_back(dp);
+            if (j == ctx.map.bsp.dareaportals.size())
+                ctx.map.bsp.dareaportals.push_back(dp);
         }
 
-        area.numareaportals = map.bsp.dareaportals.size() - area.firstareaportal;
+        area.numareaportals = ctx.map.bsp.dareaportals.size() - area.firstareaportal;
     }
 
     logging::stat_tracker_t area_stats;
-    area_stats.register_stat("areas").count += map.c_areas;
-    area_stats.register_stat("area portals").count += map.bsp.dareaportals.size();
+    area_stats.register_stat("areas").count += ctx.map.c_areas;
+    area_stats.register_stat("area portals").count += ctx.map.bsp.dareaportals.size();
 }
 
 //==============================================================
@@ -991,22 +993,22 @@ FindPortalSide
 Finds a brush side to use for texturing the given portal
 ============
 */
-static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
+static void FindPortalSide(qbsp_context_t &ctx, portal_t *p, visible_faces_stats_t &stats)
 {
     // decide which content change is strongest
     // solid > lava > water, etc
 
     // if either is "_noclipfaces" then we don't require a content change
     contentflags_t viscontents =
-        qbsp_options.target_game->portal_visible_contents(p->nodes[0]->contents, p->nodes[1]->contents);
-    if (viscontents.is_empty(qbsp_options.target_game))
+        ctx.options.target_game->portal_visible_contents(p->nodes[0]->contents, p->nodes[1]->contents);
+    if (viscontents.is_empty(ctx.options.target_game))
         return;
 
     // bestside[0] is the brushside visible on portal side[0] which is the positive side of the plane, always
     side_t *bestside[2] = {nullptr, nullptr};
     side_t *exactside[2] = {nullptr, nullptr};
     float bestdot = 0;
-    const qbsp_plane_t &p1 = p->onnode->get_plane();
+    const qbsp_plane_t &p1 = p->onnode->get_plane(ctx.map);
 
     // check brushes on both sides of the portal
     for (int j = 0; j < 2; j++) {
@@ -1017,9 +1019,9 @@ static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
         for (auto it = n->original_brushes.rbegin(); it != n->original_brushes.rend(); ++it) {
             auto *brush = *it;
             const bool generate_outside_face =
-                qbsp_options.target_game->portal_generates_face(viscontents, brush->contents, SIDE_FRONT);
+                ctx.options.target_game->portal_generates_face(viscontents, brush->contents, SIDE_FRONT);
             const bool generate_inside_face =
-                qbsp_options.target_game->portal_generates_face(viscontents, brush->contents, SIDE_BACK);
+                ctx.options.target_game->portal_generates_face(viscontents, brush->contents, SIDE_BACK);
 
             if (!(generate_outside_face || generate_inside_face)) {
                 continue;
@@ -1029,7 +1031,7 @@ static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
                 if (side.bevel)
                     continue;
 
-                if (p->winding.max_dist_off_plane(side.get_plane()) > 0.1) {
+                if (p->winding.max_dist_off_plane(side.get_plane(ctx.map)) > 0.1) {
                     continue;
                 }
 
@@ -1057,10 +1059,10 @@ static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
                     break;
                 }
                 // see how close the match is
-                const auto &p2 = side.get_positive_plane();
+                const auto &p2 = side.get_positive_plane(ctx.map);
                 double dot = qv::dot(p1.get_normal(), p2.get_normal());
 
-                // HACK: both the node plane and side.get_positive_plane() are supposed to be "positive", but the
+                // HACK: both the node plane and side.get_positive_plane(ctx.map) are supposed to be "positive", but the
                 // which would imply dot >= 0, but the meaning of "positive" is ambiguous on 45 degree planes.
                 // so take the absolute value to work around that case (this is an undirectional test anyway).
                 dot = std::fabs(dot);
@@ -1104,16 +1106,16 @@ MarkVisibleSides_r
 
 ===============
 */
-static void MarkVisibleSides_r(node_t *node, visible_faces_stats_t &stats)
+static void MarkVisibleSides_r(qbsp_context_t &ctx, node_t *node, visible_faces_stats_t &stats)
 {
     if (!node->is_leaf) {
-        MarkVisibleSides_r(node->children[0], stats);
-        MarkVisibleSides_r(node->children[1], stats);
+        MarkVisibleSides_r(ctx, node->children[0], stats);
+        MarkVisibleSides_r(ctx, node->children[1], stats);
         return;
     }
 
     // empty leafs are never boundary leafs
-    if (node->contents.is_empty(qbsp_options.target_game))
+    if (node->contents.is_empty(ctx.options.target_game))
         return;
 
     // see if there is a visible face
@@ -1123,7 +1125,7 @@ static void MarkVisibleSides_r(node_t *node, visible_faces_stats_t &stats)
         if (!p->onnode)
             continue; // edge of world
         if (!p->sidefound) {
-            FindPortalSide(p, stats);
+            FindPortalSide(ctx, p, stats);
         }
         for (int i = 0; i < 2; ++i) {
             if (p->sides[i] && p->sides[i]->source) {
@@ -1140,19 +1142,19 @@ MarkVisibleSides
 
 =============
 */
-void MarkVisibleSides(tree_t &tree, bspbrush_t::container &brushes)
+void MarkVisibleSides(qbsp_context_t &ctx, tree_t &tree, bspbrush_t::container &brushes)
 {
     logging::funcheader();
 
     // clear all the visible flags
-    MarkBrushSidesInvisible(brushes);
+    MarkBrushSidesInvisible(ctx, brushes);
 
     visible_faces_stats_t stats;
     // set visible flags on the sides that are used by portals
-    MarkVisibleSides_r(tree.headnode, stats);
+    MarkVisibleSides_r(ctx, tree.headnode, stats);
 
     if (!stats.missing_portal_sides.empty()) {
-        fs::path name = qbsp_options.bsp_path;
+        fs::path name = ctx.options.bsp_path;
         name.replace_extension("missing_portal_sides.prt");
         WriteDebugPortals(stats.missing_portal_sides, name);
     }
@@ -46,7 +46,7 @@ static void WriteFloat(std::ofstream &portalFile, vec_t v)
         ewt::print(portalFile, "{} ", v);
 }
 
-static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool clusters)
+static void WritePortals_r(qbsp_context_t &ctx, node_t *node, std::ofstream &portalFile, bool clusters)
 {
     const portal_t *p, *next;
     const winding_t *w;
@@ -54,19 +54,19 @@ static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool cluster
     qplane3d plane2;
 
     if (!node->is_leaf && !node->detail_separator) {
-        WritePortals_r(node->children[0], portalFile, clusters);
-        WritePortals_r(node->children[1], portalFile, clusters);
+        WritePortals_r(ctx, node->children[0], portalFile, clusters);
+        WritePortals_r(ctx, node->children[1], portalFile, clusters);
         return;
     }
     // at this point, `node` may be a leaf or a cluster
-    if (node->is_leaf && node->contents.is_any_solid(qbsp_options.target_game))
+    if (node->is_leaf && node->contents.is_any_solid(ctx.options.target_game))
         return;
 
     for (p = node->portals; p; p = next) {
         next = (p->nodes[0] == node) ? p->next[0] : p->next[1];
         if (!p->winding || p->nodes[0] != node)
             continue;
-        if (!Portal_VisFlood(p))
+        if (!Portal_VisFlood(ctx, p))
             continue;
 
         w = &p->winding;
@@ -74,12 +74,12 @@ static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool cluster
         back = clusters ? p->nodes[1]->viscluster : p->nodes[1]->visleafnum;
 
         if (front == -1 || back == -1) {
-            auto front_contents = ClusterContents(p->nodes.front);
-            auto back_contents = ClusterContents(p->nodes.back);
+            auto front_contents = ClusterContents(ctx, p->nodes.front);
+            auto back_contents = ClusterContents(ctx, p->nodes.back);
 
             FError("front {}, cluster contents: {}. back {}, cluster contents: {}. portal: {}", front,
-                front_contents.to_string(qbsp_options.target_game), back,
-                back_contents.to_string(qbsp_options.target_game), w->center());
+                front_contents.to_string(ctx.options.target_game), back,
+                back_contents.to_string(ctx.options.target_game), w->center());
         }
 
         /*
@@ -105,14 +105,14 @@ static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool cluster
     }
 }
 
-static int WritePTR2ClusterMapping_r(node_t *node, std::ofstream &portalFile, int viscluster)
+static int WritePTR2ClusterMapping_r(qbsp_context_t &ctx, node_t *node, std::ofstream &portalFile, int viscluster)
 {
     if (!node->is_leaf) {
-        viscluster = WritePTR2ClusterMapping_r(node->children[0], portalFile, viscluster);
-        viscluster = WritePTR2ClusterMapping_r(node->children[1], portalFile, viscluster);
+        viscluster = WritePTR2ClusterMapping_r(ctx, node->children[0], portalFile, viscluster);
+        viscluster = WritePTR2ClusterMapping_r(ctx, node->children[1], portalFile, viscluster);
         return viscluster;
     }
-    if (node->is_leaf && node->contents.is_any_solid(qbsp_options.target_game))
+    if (node->is_leaf && node->contents.is_any_solid(ctx.options.target_game))
         return viscluster;
 
     /* If we're in the next cluster, start a new line */
@@ -138,14 +138,14 @@ struct portal_state_t : logging::stat_tracker_t
     bool uses_detail;
 };
 
-static void CountPortals(const node_t *node, portal_state_t &state)
+static void CountPortals(qbsp_context_t &ctx, const node_t *node, portal_state_t &state)
 {
     const portal_t *portal;
 
     for (portal = node->portals; portal;) {
         /* only write out from first leaf */
         if (portal->nodes[0] == node) {
-            if (Portal_VisFlood(portal)) {
+            if (Portal_VisFlood(ctx, portal)) {
                 state.num_visportals++;
             }
             portal = portal->next[0];
@@ -163,7 +163,7 @@ NumberLeafs_r
 - Otherwise, assign the given cluster number because parent splitter is detail
 ================
 */
-static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
+static void NumberLeafs_r(qbsp_context_t &ctx, node_t *node, portal_state_t &state, int cluster)
 {
     /* decision node */
     if (!node->is_leaf) {
@@ -173,14 +173,14 @@ static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
             state.uses_detail = true;
             cluster = state.num_visclusters++;
             node->viscluster = cluster;
-            CountPortals(node, state);
+            CountPortals(ctx, node, state);
         }
-        NumberLeafs_r(node->children[0], state, cluster);
-        NumberLeafs_r(node->children[1], state, cluster);
+        NumberLeafs_r(ctx, node->children[0], state, cluster);
+        NumberLeafs_r(ctx, node->children[1], state, cluster);
         return;
     }
 
-    if (node->is_leaf && node->contents.is_any_solid(qbsp_options.target_game)) {
+    if (node->is_leaf && node->contents.is_any_solid(ctx.options.target_game)) {
         /* solid block, viewpoint never inside */
         node->visleafnum = -1;
         node->viscluster = -1;
@@ -189,7 +189,7 @@ static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
 
     node->visleafnum = state.num_visleafs++;
     node->viscluster = (cluster < 0) ? state.num_visclusters++ : cluster;
-    CountPortals(node, state);
+    CountPortals(ctx, node, state);
 }
 
 /*
@@ -197,7 +197,7 @@ static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
 WritePortalfile
 ================
 */
-static void WritePortalfile(node_t *headnode, portal_state_t &state)
+static void WritePortalfile(qbsp_context_t &ctx, node_t *headnode, portal_state_t &state)
 {
     int check;
 
@@ -205,10 +205,10 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
      * Set the visleafnum and viscluster field in every leaf and count the
      * total number of portals.
      */
-    NumberLeafs_r(headnode, state, -1);
+    NumberLeafs_r(ctx, headnode, state, -1);
 
     // write the file
-    fs::path name = qbsp_options.bsp_path;
+    fs::path name = ctx.options.bsp_path;
     name.replace_extension("prt");
 
     std::ofstream portalFile(name, std::ios_base::out); // .prt files are intentionally text mode
@@ -217,11 +217,11 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
 
     // q2 uses a PRT1 file, but with clusters.
     // (Since q2bsp natively supports clusters, we don't need PRT2.)
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
+    if (ctx.options.target_game->id == GAME_QUAKE_II) {
         ewt::print(portalFile, "PRT1\n");
         ewt::print(portalFile, "{}\n", state.num_visclusters.count.load());
         ewt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, true);
+        WritePortals_r(ctx, headnode, portalFile, true);
         return;
     }
 
@@ -230,21 +230,21 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
         ewt::print(portalFile, "PRT1\n");
         ewt::print(portalFile, "{}\n", state.num_visleafs.count.load());
         ewt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, false);
-    } else if (qbsp_options.forceprt1.value()) {
+        WritePortals_r(ctx, headnode, portalFile, false);
+    } else if (ctx.options.forceprt1.value()) {
         /* Write a PRT1 file for loading in the map editor. Vis will reject it. */
         ewt::print(portalFile, "PRT1\n");
         ewt::print(portalFile, "{}\n", state.num_visclusters.count.load());
         ewt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, true);
+        WritePortals_r(ctx, headnode, portalFile, true);
     } else {
         /* Write a PRT2 */
         ewt::print(portalFile, "PRT2\n");
         ewt::print(portalFile, "{}\n", state.num_visleafs.count.load());
         ewt::print(portalFile, "{}\n", state.num_visclusters.count.load());
         ewt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, true);
-        check = WritePTR2ClusterMapping_r(headnode, portalFile, 0);
+        WritePortals_r(ctx, headnode, portalFile, true);
+        check = WritePTR2ClusterMapping_r(ctx, headnode, portalFile, 0);
         if (check != state.num_visclusters.count.load() - 1) {
             FError("Internal error: Detail cluster mismatch");
         }
@@ -257,20 +257,20 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
 WritePortalFile
 ==================
 */
-void WritePortalFile(tree_t &tree)
+void WritePortalFile(qbsp_context_t &ctx, tree_t &tree)
 {
     logging::funcheader();
 
     FreeTreePortals(tree);
 
-    MakeHeadnodePortals(tree);
+    MakeHeadnodePortals(ctx, tree);
 
     {
         logging::percent_clock clock;
 
         // vis portal generation doesn't use headnode portals
         portalstats_t stats{};
-        auto buildportals = MakeTreePortals_r(tree.headnode, portaltype_t::VIS, {}, stats, clock);
+        auto buildportals = MakeTreePortals_r(ctx, tree.headnode, portaltype_t::VIS, {}, stats, clock);
 
         MakePortalsFromBuildportals(tree, buildportals);
     }
@@ -278,7 +278,7 @@ void WritePortalFile(tree_t &tree)
     portal_state_t state{};
 
     /* save portal file for vis tracing */
-    WritePortalfile(tree.headnode, state);
+    WritePortalfile(ctx, tree.headnode, state);
 }
 
 /*
@@ -342,7 +342,7 @@ static void CountTreePortals_r(node_t *node, size_t &count)
 WritePortalFile
 ==================
 */
-void WriteDebugTreePortalFile(tree_t &tree, std::string_view filename_suffix)
+void WriteDebugTreePortalFile(qbsp_context_t &ctx, tree_t &tree, std::string_view filename_suffix)
 {
     logging::funcheader();
 
@@ -350,7 +350,7 @@ void WriteDebugTreePortalFile(tree_t &tree, std::string_view filename_suffix)
     CountTreePortals_r(tree.headnode, portal_count);
 
     // write the file
-    fs::path name = qbsp_options.bsp_path;
+    fs::path name = ctx.options.bsp_path;
     name.replace_extension(std::string(filename_suffix) + ".prt");
 
     std::ofstream portalFile(name, std::ios_base::out); // .prt files are intentionally text mode
@@ -365,7 +365,7 @@ void WriteDebugTreePortalFile(tree_t &tree, std::string_view filename_suffix)
     logging::print(logging::flag::STAT, "     {:8} tree portals written to {}\n", portal_count, name);
 }
 
-void WriteDebugPortals(std::vector<portal_t *> portals, std::string_view filename_suffix)
+void WriteDebugPortals(qbsp_context_t &ctx, std::vector<portal_t *> portals, std::string_view filename_suffix)
 {
     logging::funcheader();
 
@@ -378,7 +378,7 @@ void WriteDebugPortals(std::vector<portal_t *> portals, std::string_view filenam
     }
 
     // write the file
-    fs::path name = qbsp_options.bsp_path;
+    fs::path name = ctx.options.bsp_path;
     name.replace_extension(std::string(filename_suffix) + ".prt");
 
     std::ofstream portal_file(name, std::ios_base::out); // .prt files are intentionally text mode
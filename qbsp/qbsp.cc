@@ -42,6 +42,7 @@
 #include <qbsp/csg.hh>
 
 #include <fmt/chrono.h>
+#include <tbb/parallel_for.h>
 
 namespace settings
 {
@@ -266,22 +267,22 @@ bool maptexinfo_t::operator>(const maptexinfo_t &other) const
     return as_tuple(*this) > as_tuple(other);
 }
 
-const maptexinfo_t &face_t::get_texinfo() const
+const maptexinfo_t &face_t::get_texinfo(const mapdata_t &map) const
 {
     return map.mtexinfos[texinfo];
 }
 
-const qbsp_plane_t &face_t::get_plane() const
+const qbsp_plane_t &face_t::get_plane(const mapdata_t &map) const
 {
     return map.get_plane(planenum);
 }
 
-const qbsp_plane_t &face_t::get_positive_plane() const
+const qbsp_plane_t &face_t::get_positive_plane(const mapdata_t &map) const
 {
     return map.get_plane(planenum & ~1);
 }
 
-const qbsp_plane_t &node_t::get_plane() const
+const qbsp_plane_t &node_t::get_plane(const mapdata_t &map) const
 {
     return map.get_plane(planenum);
 }
@@ -438,14 +439,14 @@ setting_group map_development_group{"Map development", 1, expected_source::comma
 setting_group common_format_group{"Common format options", 2, expected_source::commandline};
 setting_group debugging_group{"Advanced/tool debugging", 500, expected_source::commandline};
 
-inline void set_target_version(const bspversion_t *version)
+inline void set_target_version(qbsp_settings &options, const bspversion_t *version)
 {
-    if (qbsp_options.target_version) {
+    if (options.target_version) {
         FError("BSP version was set by multiple flags; currently {}, tried to change to {}\n",
-            qbsp_options.target_version->name, version->name);
+            options.target_version->name, version->name);
     }
 
-    qbsp_options.target_version = version;
+    options.target_version = version;
 }
 
 qbsp_settings::qbsp_settings()
@@ -516,6 +517,9 @@ qbsp_settings::qbsp_settings()
           {{"none", tjunclevel_t::NONE}, {"rotate", tjunclevel_t::ROTATE}, {"retopologize", tjunclevel_t::RETOPOLOGIZE},
               {"mwt", tjunclevel_t::MWT}},
           &debugging_group, "T-junction fix level"},
+      maxmwtvertices{this, "maxmwtvertices", 0, &debugging_group,
+          "faces with more vertices than this (after T-junction fixing) skip MWT and use the faster fan-based fixes; "
+          "0 = no limit"},
       objexport{
           this, "objexport", false, &debugging_group, "export the map file as .OBJ models during various CSG phases"},
       noextendedsurfflags{this, "noextendedsurfflags", false, &debugging_group, "suppress writing a .texinfo file"},
@@ -587,10 +591,10 @@ void qbsp_settings::initialize(int argc, const char **argv)
             print_help();
         }
 
-        qbsp_options.map_path = remainder[0];
+        map_path = remainder[0];
 
         if (remainder.size() == 2) {
-            qbsp_options.bsp_path = remainder[1];
+            bsp_path = remainder[1];
         }
     } catch (parse_exception &ex) {
         logging::print(ex.what());
@@ -676,50 +680,50 @@ void qbsp_settings::postinitialize(int argc, const char **argv)
 {
     // set target BSP type
     if (hlbsp.value()) {
-        set_target_version(&bspver_hl);
+        set_target_version(*this, &bspver_hl);
     }
 
     if (q2bsp.value() || (q2rtx.value() && !q2bsp.is_changed() && !qbism.is_changed())) {
-        set_target_version(&bspver_q2);
+        set_target_version(*this, &bspver_q2);
     }
 
     if (qbism.value()) {
-        set_target_version(&bspver_qbism);
+        set_target_version(*this, &bspver_qbism);
     }
 
     if (bsp2.value()) {
-        set_target_version(&bspver_bsp2);
+        set_target_version(*this, &bspver_bsp2);
     }
 
     if (bsp2rmq.value()) {
-        set_target_version(&bspver_bsp2rmq);
+        set_target_version(*this, &bspver_bsp2rmq);
     }
 
-    if (!qbsp_options.target_version) {
-        set_target_version(&bspver_q1);
+    if (!target_version) {
+        set_target_version(*this, &bspver_q1);
     }
 
     // if we wanted hexen2, update it now
     if (hexen2.value()) {
-        if (qbsp_options.target_version == &bspver_bsp2) {
-            qbsp_options.target_version = &bspver_h2bsp2;
-        } else if (qbsp_options.target_version == &bspver_bsp2rmq) {
-            qbsp_options.target_version = &bspver_h2bsp2rmq;
+        if (target_version == &bspver_bsp2) {
+            target_version = &bspver_h2bsp2;
+        } else if (target_version == &bspver_bsp2rmq) {
+            target_version = &bspver_h2bsp2rmq;
         } else {
-            qbsp_options.target_version = &bspver_h2;
+            target_version = &bspver_h2;
         }
     } else {
-        if (!qbsp_options.target_version) {
-            qbsp_options.target_version = &bspver_q1;
+        if (!target_version) {
+            target_version = &bspver_q1;
         }
     }
 
     // update target game
-    qbsp_options.target_game = qbsp_options.target_version->game;
+    target_game = target_version->game;
 
     /* If no wadpath given, default to the map directory */
     if (wadpaths.pathsValue().empty()) {
-        wadpath wp{qbsp_options.map_path.parent_path(), false};
+        wadpath wp{map_path.parent_path(), false};
 
         // If options.map_path is a relative path, StrippedFilename will return the empty string.
         // In that case, don't add it as a wad path.
@@ -740,12 +744,12 @@ void qbsp_settings::postinitialize(int argc, const char **argv)
     }
 
     // side effects from Quake II
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
+    if (target_game->id == GAME_QUAKE_II) {
         if (!maxedges.is_changed()) {
             maxedges.set_value(0, settings::source::GAME_TARGET);
         }
 
-        if (qbsp_options.target_version == &bspver_qbism) {
+        if (target_version == &bspver_qbism) {
             if (!software.is_changed()) {
                 software.set_value(false, settings::source::GAME_TARGET);
             }
@@ -755,8 +759,8 @@ void qbsp_settings::postinitialize(int argc, const char **argv)
             subdivide.set_value(496, settings::source::GAME_TARGET);
         }
 
-        if (!qbsp_options.chop.is_changed()) {
-            qbsp_options.chop.set_value(true, settings::source::GAME_TARGET);
+        if (!chop.is_changed()) {
+            chop.set_value(true, settings::source::GAME_TARGET);
         }
     }
 
@@ -785,8 +789,6 @@ void qbsp_settings::reset()
 }
 }; // namespace settings
 
-settings::qbsp_settings qbsp_options;
-
 struct brush_list_stats_t : logging::stat_tracker_t
 {
     stat &total_brushes = register_stat("total brushes");
@@ -794,29 +796,29 @@ struct brush_list_stats_t : logging::stat_tracker_t
     stat &total_leaf_brushes = register_stat("total leaf brushes");
 };
 
-static void ExportBrushList_r(const mapentity_t &entity, node_t *node, brush_list_stats_t &stats)
+static void ExportBrushList_r(qbsp_context_t &ctx, const mapentity_t &entity, node_t *node, brush_list_stats_t &stats)
 {
     if (node->is_leaf) {
         if (node->contents.native) {
             if (node->original_brushes.size()) {
                 node->numleafbrushes = node->original_brushes.size();
                 stats.total_leaf_brushes += node->numleafbrushes;
-                node->firstleafbrush = map.bsp.dleafbrushes.size();
+                node->firstleafbrush = ctx.map.bsp.dleafbrushes.size();
                 for (auto &b : node->original_brushes) {
 
                     if (!b->mapbrush->outputnumber.has_value()) {
-                        b->mapbrush->outputnumber = {static_cast<uint32_t>(map.bsp.dbrushes.size())};
+                        b->mapbrush->outputnumber = {static_cast<uint32_t>(ctx.map.bsp.dbrushes.size())};
 
-                        dbrush_t &brush = map.bsp.dbrushes.emplace_back(
-                            dbrush_t{.firstside = static_cast<int32_t>(map.bsp.dbrushsides.size()),
+                        dbrush_t &brush = ctx.map.bsp.dbrushes.emplace_back(
+                            dbrush_t{.firstside = static_cast<int32_t>(ctx.map.bsp.dbrushsides.size()),
                                 .numsides = 0,
-                                .contents = qbsp_options.target_game
+                                .contents = ctx.options.target_game
                                                 ->contents_remap_for_export(b->contents, gamedef_t::remap_type_t::brush)
                                                 .native});
 
                         for (auto &side : b->mapbrush->faces) {
-                            map.bsp.dbrushsides.push_back(
-                                {(uint32_t)ExportMapPlane(side.planenum), (int32_t)ExportMapTexinfo(side.texinfo)});
+                            ctx.map.bsp.dbrushsides.push_back({(uint32_t)ExportMapPlane(ctx, side.planenum),
+                                (int32_t)ExportMapTexinfo(ctx, side.texinfo)});
                             brush.numsides++;
                             stats.total_brush_sides++;
                         }
@@ -824,7 +826,7 @@ static void ExportBrushList_r(const mapentity_t &entity, node_t *node, brush_lis
                         stats.total_brushes++;
                     }
 
-                    map.bsp.dleafbrushes.push_back(b->mapbrush->outputnumber.value());
+                    ctx.map.bsp.dleafbrushes.push_back(b->mapbrush->outputnumber.value());
                 }
             }
         }
@@ -832,17 +834,17 @@ static void ExportBrushList_r(const mapentity_t &entity, node_t *node, brush_lis
         return;
     }
 
-    ExportBrushList_r(entity, node->children[0], stats);
-    ExportBrushList_r(entity, node->children[1], stats);
+    ExportBrushList_r(ctx, entity, node->children[0], stats);
+    ExportBrushList_r(ctx, entity, node->children[1], stats);
 }
 
-static void ExportBrushList(mapentity_t &entity, node_t *node)
+static void ExportBrushList(qbsp_context_t &ctx, mapentity_t &entity, node_t *node)
 {
     logging::funcheader();
 
     brush_list_stats_t stats;
 
-    ExportBrushList_r(entity, node, stats);
+    ExportBrushList_r(ctx, entity, node, stats);
 }
 
 static bool IsTrigger(const mapentity_t &entity)
@@ -862,14 +864,14 @@ static bool IsTrigger(const mapentity_t &entity)
     return trigger_pos == (tex.size() - strlen("trigger"));
 }
 
-static void CountLeafs_r(node_t *node, content_stats_base_t &stats)
+static void CountLeafs_r(qbsp_context_t &ctx, node_t *node, content_stats_base_t &stats)
 {
     if (node->is_leaf) {
-        qbsp_options.target_game->count_contents_in_stats(node->contents, stats);
+        ctx.options.target_game->count_contents_in_stats(node->contents, stats);
         return;
     }
-    CountLeafs_r(node->children[0], stats);
-    CountLeafs_r(node->children[1], stats);
+    CountLeafs_r(ctx, node->children[0], stats);
+    CountLeafs_r(ctx, node->children[1], stats);
 }
 
 static int NodeHeight(node_t *node)
@@ -890,13 +892,13 @@ static void CountLeafHeights_r(node_t *node, std::vector<int> &heights)
     CountLeafHeights_r(node->children[1], heights);
 }
 
-void CountLeafs(node_t *headnode)
+void CountLeafs(qbsp_context_t &ctx, node_t *headnode)
 {
     logging::funcheader();
 
-    auto stats = qbsp_options.target_game->create_content_stats();
-    CountLeafs_r(headnode, *stats);
-    qbsp_options.target_game->print_content_stats(*stats, "leafs");
+    auto stats = ctx.options.target_game->create_content_stats();
+    CountLeafs_r(ctx, headnode, *stats);
+    ctx.options.target_game->print_content_stats(*stats, "leafs");
 
     // count the heights of the tree at each leaf
     logging::stat_tracker_t stat_print;
@@ -927,17 +929,17 @@ static void GatherBspbrushes_r(node_t *node, bspbrush_t::container &container)
     GatherBspbrushes_r(node->children[1], container);
 }
 
-static void GatherLeafVolumes_r(node_t *node, bspbrush_t::container &container)
+static void GatherLeafVolumes_r(qbsp_context_t &ctx, node_t *node, bspbrush_t::container &container)
 {
     if (node->is_leaf) {
-        if (!node->contents.is_empty(qbsp_options.target_game)) {
+        if (!node->contents.is_empty(ctx.options.target_game)) {
             container.push_back(node->volume);
         }
         return;
     }
 
-    GatherLeafVolumes_r(node->children[0], container);
-    GatherLeafVolumes_r(node->children[1], container);
+    GatherLeafVolumes_r(ctx, node->children[0], container);
+    GatherLeafVolumes_r(ctx, node->children[1], container);
 }
 
 /*
@@ -945,11 +947,11 @@ static void GatherLeafVolumes_r(node_t *node, bspbrush_t::container &container)
 ProcessEntity
 ===============
 */
-static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
+static void ProcessEntity(qbsp_context_t &ctx, mapentity_t &entity, hull_index_t hullnum)
 {
     /* No map brushes means non-bmodel entity.
        We need to handle worldspawn containing no brushes, though. */
-    if (!entity.mapbrushes.size() && !map.is_world_entity(entity)) {
+    if (!entity.mapbrushes.size() && !ctx.map.is_world_entity(entity)) {
         return;
     }
 
@@ -961,27 +963,28 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         return;
 
     // for notriggermodels: if we have at least one trigger-like texture, do special trigger stuff
-    bool discarded_trigger = !map.is_world_entity(entity) && qbsp_options.notriggermodels.value() && IsTrigger(entity);
+    bool discarded_trigger =
+        !ctx.map.is_world_entity(entity) && ctx.options.notriggermodels.value() && IsTrigger(entity);
 
     // Export a blank model struct, and reserve the index (only do this once, for all hulls)
     if (!discarded_trigger) {
         if (!entity.outputmodelnumber.has_value()) {
-            entity.outputmodelnumber = map.bsp.dmodels.size();
-            map.bsp.dmodels.emplace_back();
+            entity.outputmodelnumber = ctx.map.bsp.dmodels.size();
+            ctx.map.bsp.dmodels.emplace_back();
         }
 
-        if (!map.is_world_entity(entity)) {
-            if (&entity == &map.entities[1]) {
+        if (!ctx.map.is_world_entity(entity)) {
+            if (&entity == &ctx.map.entities[1]) {
                 logging::header("Internal Entities");
             }
 
             std::string mod = fmt::format("*{}", entity.outputmodelnumber.value());
 
-            if (qbsp_options.verbose.value()) {
+            if (ctx.options.verbose.value()) {
                 PrintEntity(entity);
             }
 
-            if (!hullnum.value_or(0) || qbsp_options.loghulls.value()) {
+            if (!hullnum.value_or(0) || ctx.options.loghulls.value()) {
                 logging::print(logging::flag::STAT, "     MODEL: {}\n", mod);
             }
 
@@ -989,8 +992,8 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         }
     }
 
-    if (qbsp_options.lmscale.is_changed() && !entity.epairs.has("_lmscale")) {
-        entity.epairs.set("_lmscale", std::to_string(qbsp_options.lmscale.value()));
+    if (ctx.options.lmscale.is_changed() && !entity.epairs.has("_lmscale")) {
+        entity.epairs.set("_lmscale", std::to_string(ctx.options.lmscale.value()));
     }
 
     // Init the entity
@@ -1005,9 +1008,9 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
      * Convert the map brushes (planes) into BSP brushes (polygons)
      */
     size_t num_clipped = 0;
-    Brush_LoadEntity(entity, hullnum, brushes, num_clipped);
+    Brush_LoadEntity(ctx, entity, hullnum, brushes, num_clipped);
 
-    if (num_clipped && !qbsp_options.verbose.value()) {
+    if (num_clipped && !ctx.options.verbose.value()) {
         logging::print(logging::flag::STAT,
             "WARNING: {} faces were crunched away by being too small. {}Use -verbose to see which faces were affected.\n",
             num_clipped, hullnum.value_or(0) ? "This is normal for the hulls. " : "");
@@ -1022,7 +1025,7 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         logging::flag::STAT, "INFO: calculating BSP for {} brushes with {} sides\n", brushes.size(), num_sides);
 
     // always chop the other hulls to reduce brush tests
-    if (qbsp_options.chop.value() || hullnum.value_or(0)) {
+    if (ctx.options.chop.value() || hullnum.value_or(0)) {
         std::sort(brushes.begin(), brushes.end(), [](const bspbrush_t::ptr &a, const bspbrush_t::ptr &b) -> bool {
             if (a->mapbrush->chop_index == b->mapbrush->chop_index) {
                 return a->mapbrush->line.line_number < b->mapbrush->line.line_number;
@@ -1031,7 +1034,7 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
             return a->mapbrush->chop_index < b->mapbrush->chop_index;
         });
 
-        ChopBrushes(brushes, qbsp_options.chopfragment.value());
+        ChopBrushes(ctx, brushes, ctx.options.chopfragment.value());
     }
 
     // we're discarding the brush
@@ -1049,58 +1052,58 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
     // simpler operation for hulls
     if (hullnum.value_or(0)) {
         tree_t tree;
-        BrushBSP(tree, entity, brushes, tree_split_t::FAST);
-        if (map.is_world_entity(entity) && !qbsp_options.nofill.value()) {
+        BrushBSP(ctx, tree, entity, brushes, tree_split_t::FAST);
+        if (ctx.map.is_world_entity(entity) && !ctx.options.nofill.value()) {
             // assume non-world bmodels are simple
-            MakeTreePortals(tree);
-            if (FillOutside(tree, hullnum, brushes)) {
-                if (qbsp_options.filldetail.value())
-                    FillDetail(tree, hullnum, brushes);
+            MakeTreePortals(ctx, tree);
+            if (FillOutside(ctx, tree, hullnum, brushes)) {
+                if (ctx.options.filldetail.value())
+                    FillDetail(ctx, tree, hullnum, brushes);
 
                 // make a really good tree
                 tree.clear();
-                BrushBSP(tree, entity, brushes, tree_split_t::PRECISE);
+                BrushBSP(ctx, tree, entity, brushes, tree_split_t::PRECISE);
 
                 // fill again so PruneNodes works
-                MakeTreePortals(tree);
-                FillOutside(tree, hullnum, brushes);
-                if (qbsp_options.filldetail.value())
-                    FillDetail(tree, hullnum, brushes);
+                MakeTreePortals(ctx, tree);
+                FillOutside(ctx, tree, hullnum, brushes);
+                if (ctx.options.filldetail.value())
+                    FillDetail(ctx, tree, hullnum, brushes);
 
                 FreeTreePortals(tree);
-                PruneNodes(tree.headnode);
+                PruneNodes(ctx, tree.headnode);
             }
-            CountLeafs(tree.headnode);
+            CountLeafs(ctx, tree.headnode);
         }
-        ExportClipNodes(entity, tree.headnode, hullnum.value());
+        ExportClipNodes(ctx, entity, tree.headnode, hullnum.value());
         return;
     }
 
     // full operation for collision (or main hull)
     tree_t tree;
 
-    BrushBSP(tree, entity, brushes,
-        qbsp_options.forcegoodtree.value() ? tree_split_t::PRECISE : // we asked for the slow method
-            !map.is_world_entity(entity) ? tree_split_t::FAST
+    BrushBSP(ctx, tree, entity, brushes,
+        ctx.options.forcegoodtree.value() ? tree_split_t::PRECISE : // we asked for the slow method
+            !ctx.map.is_world_entity(entity) ? tree_split_t::FAST
                                          : // brush models are assumed to be simple
             tree_split_t::AUTO);
 
     // build all the portals in the bsp tree
     // some portals are solid polygons, and some are paths to other leafs
-    MakeTreePortals(tree);
+    MakeTreePortals(ctx, tree);
 
-    if (map.is_world_entity(entity)) {
+    if (ctx.map.is_world_entity(entity)) {
         // debug output of bspbrushes
         if (!hullnum.value_or(0)) {
-            if (qbsp_options.debugbspbrushes.value()) {
+            if (ctx.options.debugbspbrushes.value()) {
                 bspbrush_t::container all_bspbrushes;
                 GatherBspbrushes_r(tree.headnode, all_bspbrushes);
-                WriteBspBrushMap("first-brushbsp", all_bspbrushes);
+                WriteBspBrushMap(ctx, "first-brushbsp", all_bspbrushes);
             }
-            if (qbsp_options.debugleafvolumes.value()) {
+            if (ctx.options.debugleafvolumes.value()) {
                 bspbrush_t::container all_bspbrushes;
-                GatherLeafVolumes_r(tree.headnode, all_bspbrushes);
-                WriteBspBrushMap("first-brushbsp-volumes", all_bspbrushes);
+                GatherLeafVolumes_r(ctx, tree.headnode, all_bspbrushes);
+                WriteBspBrushMap(ctx, "first-brushbsp-volumes", all_bspbrushes);
             }
         }
 
@@ -1108,61 +1111,61 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         // marks brush sides which are *only* touching void;
         // we can skip using them as BSP splitters on the "really good tree"
         // (effectively expanding those brush sides outwards).
-        if (!qbsp_options.nofill.value() && FillOutside(tree, hullnum, brushes)) {
-            if (qbsp_options.filldetail.value())
-                FillDetail(tree, hullnum, brushes);
+        if (!ctx.options.nofill.value() && FillOutside(ctx, tree, hullnum, brushes)) {
+            if (ctx.options.filldetail.value())
+                FillDetail(ctx, tree, hullnum, brushes);
 
             // make a really good tree
             tree.clear();
-            BrushBSP(tree, entity, brushes, tree_split_t::PRECISE);
+            BrushBSP(ctx, tree, entity, brushes, tree_split_t::PRECISE);
 
             // debug output of bspbrushes
             if (!hullnum.value_or(0)) {
-                if (qbsp_options.debugbspbrushes.value()) {
+                if (ctx.options.debugbspbrushes.value()) {
                     bspbrush_t::container all_bspbrushes;
                     GatherBspbrushes_r(tree.headnode, all_bspbrushes);
-                    WriteBspBrushMap("second-brushbsp", all_bspbrushes);
+                    WriteBspBrushMap(ctx, "second-brushbsp", all_bspbrushes);
                 }
-                if (qbsp_options.debugleafvolumes.value()) {
+                if (ctx.options.debugleafvolumes.value()) {
                     bspbrush_t::container all_bspbrushes;
-                    GatherLeafVolumes_r(tree.headnode, all_bspbrushes);
-                    WriteBspBrushMap("second-brushbsp-volumes", all_bspbrushes);
+                    GatherLeafVolumes_r(ctx, tree.headnode, all_bspbrushes);
+                    WriteBspBrushMap(ctx, "second-brushbsp-volumes", all_bspbrushes);
                 }
             }
 
             // make the real portals for vis tracing
-            MakeTreePortals(tree);
+            MakeTreePortals(ctx, tree);
 
             // fill again so PruneNodes works
-            FillOutside(tree, hullnum, brushes);
+            FillOutside(ctx, tree, hullnum, brushes);
 
-            if (qbsp_options.filldetail.value())
-                FillDetail(tree, hullnum, brushes);
+            if (ctx.options.filldetail.value())
+                FillDetail(ctx, tree, hullnum, brushes);
         }
 
         // Area portals
-        if (qbsp_options.target_game->id == GAME_QUAKE_II) {
-            EmitAreaPortals(tree.headnode);
+        if (ctx.options.target_game->id == GAME_QUAKE_II) {
+            EmitAreaPortals(ctx, tree.headnode);
         }
     } else {
-        FillBrushEntity(tree, hullnum, brushes);
+        FillBrushEntity(ctx, tree, hullnum, brushes);
 
         // rebuild BSP now that we've marked invisible brush sides
         tree.clear();
-        BrushBSP(tree, entity, brushes, tree_split_t::PRECISE);
+        BrushBSP(ctx, tree, entity, brushes, tree_split_t::PRECISE);
     }
 
-    MakeTreePortals(tree);
+    MakeTreePortals(ctx, tree);
 
-    MarkVisibleSides(tree, brushes);
-    MakeFaces(tree.headnode);
+    MarkVisibleSides(ctx, tree, brushes);
+    MakeFaces(ctx, tree.headnode);
 
     FreeTreePortals(tree);
-    PruneNodes(tree.headnode);
+    PruneNodes(ctx, tree.headnode);
 
     // write out .prt for main hull
-    if (!hullnum.value_or(0) && map.is_world_entity(entity) && (!map.leakfile || qbsp_options.keepprt.value())) {
-        WritePortalFile(tree);
+    if (!hullnum.value_or(0) && ctx.map.is_world_entity(entity) && (!ctx.map.leakfile || ctx.options.keepprt.value())) {
+        WritePortalFile(ctx, tree);
     }
 
     auto MakeFaceFromSide = [](node_t *node, mapface_t &side) -> std::unique_ptr<face_t> {
@@ -1186,10 +1189,10 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
     };
 
     // super-detail
-    if (map.is_world_entity(entity)) {
+    if (ctx.map.is_world_entity(entity)) {
         if (!hullnum.value_or(0)) {
-            for (int i = 1; i < map.entities.size(); i++) {
-                mapentity_t &source = map.entities.at(i);
+            for (int i = 1; i < ctx.map.entities.size(); i++) {
+                mapentity_t &source = ctx.map.entities.at(i);
 
                 if (!source.epairs.get_int("_super_detail")) {
                     continue;
@@ -1211,29 +1214,29 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
     }
 
     // needs to come after any face creation
-    MakeMarkFaces(tree.headnode);
+    MakeMarkFaces(ctx, tree.headnode);
 
-    CountLeafs(tree.headnode);
+    CountLeafs(ctx, tree.headnode);
 
     // output vertices first, since TJunc needs it
-    EmitVertices(tree.headnode);
+    EmitVertices(ctx, tree.headnode);
 
-    TJunc(tree.headnode);
+    TJunc(ctx, tree.headnode);
 
-    if (qbsp_options.objexport.value() && map.is_world_entity(entity)) {
-        ExportObj_Nodes("pre_makefaceedges_plane_faces", tree.headnode);
-        ExportObj_Marksurfaces("pre_makefaceedges_marksurfaces", tree.headnode);
+    if (ctx.options.objexport.value() && ctx.map.is_world_entity(entity)) {
+        ExportObj_Nodes(ctx, "pre_makefaceedges_plane_faces", tree.headnode);
+        ExportObj_Marksurfaces(ctx, "pre_makefaceedges_marksurfaces", tree.headnode);
     }
 
     Q_assert(!entity.firstoutputfacenumber.has_value());
 
-    entity.firstoutputfacenumber = EmitFaces(tree.headnode);
+    entity.firstoutputfacenumber = EmitFaces(ctx, tree.headnode);
 
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
-        ExportBrushList(entity, tree.headnode);
+    if (ctx.options.target_game->id == GAME_QUAKE_II) {
+        ExportBrushList(ctx, entity, tree.headnode);
     }
 
-    ExportDrawNodes(entity, tree.headnode, entity.firstoutputfacenumber.value());
+    ExportDrawNodes(ctx, entity, tree.headnode, entity.firstoutputfacenumber.value());
     FreeTreePortals(tree);
 }
 
@@ -1243,19 +1246,19 @@ UpdateEntLump
 
 =================
 */
-static void UpdateEntLump(void)
+static void UpdateEntLump(qbsp_context_t &ctx)
 {
     logging::print(logging::flag::STAT, "     Updating entities lump...\n");
 
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
+    if (ctx.options.target_game->id == GAME_QUAKE_II) {
         FError("this won't work on Q2 maps; for Q2, please use bsputil --extract-entities & --replace-entities.");
         return;
     }
 
     size_t modnum = 1;
 
-    for (size_t i = 1; i < map.entities.size(); i++) {
-        mapentity_t &entity = map.entities.at(i);
+    for (size_t i = 1; i < ctx.map.entities.size(); i++) {
+        mapentity_t &entity = ctx.map.entities.at(i);
 
         /* Special handling for misc_external_map.
            Duplicates some logic from ProcessExternalMapEntity. */
@@ -1290,26 +1293,26 @@ static void UpdateEntLump(void)
         const std::string &classname = entity.epairs.get("classname");
 
         if (!classname.compare(0, 7, "rotate_")) {
-            FixRotateOrigin(entity);
+            FixRotateOrigin(ctx, entity);
         }
     }
 
-    WriteEntitiesToString();
-    UpdateBSPFileEntitiesLump();
+    WriteEntitiesToString(ctx);
+    UpdateBSPFileEntitiesLump(ctx);
 }
 
 /*
 Actually writes out the final bspx BRUSHLIST lump
 This lump replaces the clipnodes stuff for custom collision sizes.
 */
-void BSPX_Brushes_Finalize(struct bspxbrushes_s *ctx)
+void BSPX_Brushes_Finalize(qbsp_context_t &ctx, struct bspxbrushes_s *lump)
 {
     // Actually written in WriteBSPFile()
-    map.exported_bspxbrushes = std::move(ctx->lumpdata);
+    ctx.map.exported_bspxbrushes = std::move(lump->lumpdata);
 }
-void BSPX_Brushes_Init(struct bspxbrushes_s *ctx)
+void BSPX_Brushes_Init(struct bspxbrushes_s *lump)
 {
-    ctx->lumpdata.clear();
+    lump->lumpdata.clear();
 }
 
 /*
@@ -1318,7 +1321,8 @@ Generates a submodel's direct brush information to a separate file, so the engin
 hull sizes
 */
 
-static void BSPX_Brushes_AddModel(struct bspxbrushes_s *ctx, int modelnum, const std::vector<mapbrush_t *> &brushes)
+static void BSPX_Brushes_AddModel(
+    qbsp_context_t &ctx, struct bspxbrushes_s *lump, int modelnum, const std::vector<mapbrush_t *> &brushes)
 {
     bspxbrushes_permodel permodel{1, modelnum};
 
@@ -1326,7 +1330,7 @@ static void BSPX_Brushes_AddModel(struct bspxbrushes_s *ctx, int modelnum, const
         permodel.numbrushes++;
         for (auto &f : b->faces) {
             /*skip axial*/
-            const auto &plane = f.get_plane();
+            const auto &plane = f.get_plane(ctx.map);
             if (plane.get_type() < plane_type_t::PLANE_ANYX)
                 continue;
             permodel.numfaces++;
@@ -1344,7 +1348,7 @@ static void BSPX_Brushes_AddModel(struct bspxbrushes_s *ctx, int modelnum, const
 
         for (auto &f : b->faces) {
             /*skip axial*/
-            const auto &plane = f.get_plane();
+            const auto &plane = f.get_plane(ctx.map);
             if (plane.get_type() < plane_type_t::PLANE_ANYX)
                 continue;
             perbrush.numfaces++;
@@ -1362,7 +1366,7 @@ static void BSPX_Brushes_AddModel(struct bspxbrushes_s *ctx, int modelnum, const
             case CONTENTS_SLIME:
             case CONTENTS_LAVA:
             case CONTENTS_SKY:
-                if (contents.is_clip(qbsp_options.target_game)) {
+                if (contents.is_clip(ctx.options.target_game)) {
                     perbrush.contents = -8;
                 } else {
                     perbrush.contents = contents.native;
@@ -1372,11 +1376,11 @@ static void BSPX_Brushes_AddModel(struct bspxbrushes_s *ctx, int modelnum, const
             //                      perbrush.contents = -16;
             //                      break;
             default: {
-                if (contents.is_clip(qbsp_options.target_game)) {
+                if (contents.is_clip(ctx.options.target_game)) {
                     perbrush.contents = -8;
                 } else {
                     logging::print("WARNING: Unknown contents: {}. Translating to solid.\n",
-                        contents.to_string(qbsp_options.target_game));
+                        contents.to_string(ctx.options.target_game));
                     perbrush.contents = CONTENTS_SOLID;
                 }
                 break;
@@ -1387,7 +1391,7 @@ static void BSPX_Brushes_AddModel(struct bspxbrushes_s *ctx, int modelnum, const
 
         for (auto &f : b->faces) {
             /*skip axial*/
-            const auto &plane = f.get_plane();
+            const auto &plane = f.get_plane(ctx.map);
             if (plane.get_type() < plane_type_t::PLANE_ANYX)
                 continue;
 
@@ -1397,28 +1401,28 @@ static void BSPX_Brushes_AddModel(struct bspxbrushes_s *ctx, int modelnum, const
     }
 
     std::string data = str.str();
-    ctx->lumpdata.insert(ctx->lumpdata.end(), (uint8_t *)data.data(), ((uint8_t *)data.data()) + data.size());
+    lump->lumpdata.insert(lump->lumpdata.end(), (uint8_t *)data.data(), ((uint8_t *)data.data()) + data.size());
 }
 
 /* for generating BRUSHLIST bspx lump */
-static void BSPX_CreateBrushList(void)
+static void BSPX_CreateBrushList(qbsp_context_t &ctx)
 {
-    struct bspxbrushes_s ctx;
+    struct bspxbrushes_s lump;
 
-    if (!qbsp_options.wrbrushes.value())
+    if (!ctx.options.wrbrushes.value())
         return;
 
-    BSPX_Brushes_Init(&ctx);
+    BSPX_Brushes_Init(&lump);
 
-    for (size_t entnum = 0; entnum < map.entities.size(); ++entnum) {
-        mapentity_t &ent = map.entities.at(entnum);
+    for (size_t entnum = 0; entnum < ctx.map.entities.size(); ++entnum) {
+        mapentity_t &ent = ctx.map.entities.at(entnum);
         size_t modelnum;
 
         if (IsWorldBrushEntity(ent)) {
             continue;
         }
 
-        if (map.is_world_entity(ent)) {
+        if (ctx.map.is_world_entity(ent)) {
             modelnum = 0;
         } else {
             const std::string &mod = ent.epairs.get("model");
@@ -1438,8 +1442,8 @@ static void BSPX_CreateBrushList(void)
 
         if (modelnum == 0) {
 
-            for (size_t e = 1; e < map.entities.size(); ++e) {
-                mapentity_t &bent = map.entities.at(e);
+            for (size_t e = 1; e < ctx.map.entities.size(); ++e) {
+                mapentity_t &bent = ctx.map.entities.at(e);
 
                 brushes.reserve(brushes.size() + ent.mapbrushes.size());
 
@@ -1453,11 +1457,11 @@ static void BSPX_CreateBrushList(void)
         }
 
         if (!brushes.empty()) {
-            BSPX_Brushes_AddModel(&ctx, modelnum, brushes);
+            BSPX_Brushes_AddModel(ctx, &lump, modelnum, brushes);
         }
     }
 
-    BSPX_Brushes_Finalize(&ctx);
+    BSPX_Brushes_Finalize(ctx, &lump);
 }
 
 /*
@@ -1465,7 +1469,7 @@ static void BSPX_CreateBrushList(void)
 CreateSingleHull
 =================
 */
-static void CreateSingleHull(hull_index_t hullnum)
+static void CreateSingleHull(qbsp_context_t &ctx, hull_index_t hullnum)
 {
     if (hullnum.has_value()) {
         logging::print("Processing hull {}...\n", hullnum.value());
@@ -1474,15 +1478,15 @@ static void CreateSingleHull(hull_index_t hullnum)
     }
 
     // for each entity in the map file that has geometry
-    for (auto &entity : map.entities) {
+    for (auto &entity : ctx.map.entities) {
         bool wants_logging = true;
 
         // decide if we want to log this entity / hull combination
-        if (!map.is_world_entity(entity)) {
-            wants_logging = wants_logging && qbsp_options.logbmodels.value();
+        if (!ctx.map.is_world_entity(entity)) {
+            wants_logging = wants_logging && ctx.options.logbmodels.value();
         }
         if (hullnum.value_or(0)) {
-            wants_logging = wants_logging && qbsp_options.loghulls.value();
+            wants_logging = wants_logging && ctx.options.loghulls.value();
         }
 
         // update logging mask if requested
@@ -1492,7 +1496,7 @@ static void CreateSingleHull(hull_index_t hullnum)
                 bitflags<logging::flag>(logging::flag::STAT) | logging::flag::PROGRESS | logging::flag::CLOCK_ELAPSED);
         }
 
-        ProcessEntity(entity, hullnum);
+        ProcessEntity(ctx, entity, hullnum);
 
         // restore logging
         logging::mask = prev_logging_mask;
@@ -1504,55 +1508,61 @@ static void CreateSingleHull(hull_index_t hullnum)
 CreateHulls
 =================
 */
-static void CreateHulls(void)
+static void CreateHulls(qbsp_context_t &ctx)
 {
     /* create the hulls sequentially */
-    auto &hulls = qbsp_options.target_game->get_hull_sizes();
+    auto &hulls = ctx.options.target_game->get_hull_sizes();
 
     // game has no hulls, so we have to export brush lists and stuff.
     if (!hulls.size()) {
-        CreateSingleHull(std::nullopt);
+        CreateSingleHull(ctx, std::nullopt);
         return;
     }
 
     // all the hulls
     for (size_t i = 0; i < hulls.size(); i++) {
-        CreateSingleHull(i);
+        CreateSingleHull(ctx, i);
 
         // only create hull 0 if fNoclip is set
-        if (qbsp_options.noclip.value()) {
+        if (ctx.options.noclip.value()) {
             break;
         }
     }
 }
 
-// Fill the BSP's `dtex` data
-static void LoadTextureData()
+// Fill the BSP's `dtex` data; each miptex only touches its own slot,
+// and archives are safe to read from concurrently, so this runs in parallel.
+static void LoadTextureData(qbsp_context_t &ctx)
 {
-    for (size_t i = 0; i < map.miptex.size(); i++) {
+    // textures load in parallel; warnings are collected per texture and
+    // printed in order afterwards so the log doesn't depend on scheduling
+    std::vector<std::string> warnings(ctx.map.miptex.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), ctx.map.miptex.size(), [&](size_t i) {
         // always fill the name even if we can't find it
-        auto &miptex = map.bsp.dtex.textures[i];
-        miptex.name = map.miptex[i].name;
+        auto &miptex = ctx.map.bsp.dtex.textures[i];
+        miptex.name = ctx.map.miptex[i].name;
 
         {
-            auto [tex, pos, file] = img::load_texture(map.miptex[i].name, true, qbsp_options.target_game, qbsp_options);
+            auto [tex, pos, file] =
+                img::load_texture(ctx.map.miptex[i].name, true, ctx.options.target_game, ctx.options);
 
             if (!tex) {
                 if (pos.archive) {
-                    logging::print("WARNING: unable to load texture {} in archive {}\n", map.miptex[i].name,
-                        pos.archive->pathname);
+                    warnings[i] += fmt::format("WARNING: unable to load texture {} in archive {}\n",
+                        ctx.map.miptex[i].name, pos.archive->pathname);
                 } else {
-                    logging::print("WARNING: unable to find texture {}\n", map.miptex[i].name);
+                    warnings[i] += fmt::format("WARNING: unable to find texture {}\n", ctx.map.miptex[i].name);
                 }
             } else {
                 miptex.width = tex->meta.width;
                 miptex.height = tex->meta.height;
 
                 // only mips can be embedded directly
-                if (!qbsp_options.notextures.value() && !pos.archive->external &&
+                if (!ctx.options.notextures.value() && !pos.archive->external &&
                     tex->meta.extension == img::ext::MIP) {
-                    miptex.data = std::move(file.value());
-                    continue;
+                    miptex.data = file.copy();
+                    return;
                 }
             }
         }
@@ -1563,7 +1573,7 @@ static void LoadTextureData()
 
         dmiptex_t header{};
         if (miptex.name.size() >= 16) {
-            logging::print("WARNING: texture {} name too long for Quake miptex\n", miptex.name);
+            warnings[i] += fmt::format("WARNING: texture {} name too long for Quake miptex\n", miptex.name);
             std::copy_n(miptex.name.begin(), 15, header.name.begin());
         } else {
             std::copy(miptex.name.begin(), miptex.name.end(), header.name.begin());
@@ -1575,47 +1585,53 @@ static void LoadTextureData()
 
         omemstream stream(miptex.data.data(), miptex.data.size());
         stream <= header;
+    });
+
+    for (auto &warning : warnings) {
+        if (!warning.empty()) {
+            logging::print(warning.c_str());
+        }
     }
 }
 
-static void AddAnimationFrames()
+static void AddAnimationFrames(qbsp_context_t &ctx)
 {
-    size_t oldcount = map.miptex.size();
+    size_t oldcount = ctx.map.miptex.size();
 
     for (size_t i = 0; i < oldcount; i++) {
-        const std::string &existing_name = map.miptexTextureName(i);
+        const std::string &existing_name = ctx.map.miptexTextureName(i);
 
-        if (existing_name[0] != '+' && (qbsp_options.target_game->id != GAME_HALF_LIFE || existing_name[0] != '-')) {
+        if (existing_name[0] != '+' && (ctx.options.target_game->id != GAME_HALF_LIFE || existing_name[0] != '-')) {
             continue;
         }
 
-        std::string name = map.miptexTextureName(i);
+        std::string name = ctx.map.miptexTextureName(i);
 
         /* Search for all animations (0-9) and alt-animations (A-J) */
         for (size_t j = 0; j < 20; j++) {
             name[1] = (j < 10) ? '0' + j : 'a' + j - 10;
             if (fs::where(name)) {
-                FindMiptex(name.c_str());
+                FindMiptex(ctx, name.c_str());
             }
         }
     }
 
-    logging::print(logging::flag::STAT, "     {:8} texture frames added\n", map.miptex.size() - oldcount);
+    logging::print(logging::flag::STAT, "     {:8} texture frames added\n", ctx.map.miptex.size() - oldcount);
 }
 
-static void LoadSecondaryTextures()
+static void LoadSecondaryTextures(qbsp_context_t &ctx)
 {
     // Q2 doesn't use any secondary textures
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
+    if (ctx.options.target_game->id == GAME_QUAKE_II) {
         return;
     }
 
-    AddAnimationFrames();
+    AddAnimationFrames(ctx);
 
     /* Default texture data to store in worldmodel */
-    map.bsp.dtex.textures.resize(map.miptex.size());
+    ctx.map.bsp.dtex.textures.resize(ctx.map.miptex.size());
 
-    LoadTextureData();
+    LoadTextureData(ctx);
 }
 
 /*
@@ -1623,35 +1639,35 @@ static void LoadSecondaryTextures()
 ProcessFile
 =================
 */
-void ProcessFile()
+void ProcessFile(qbsp_context_t &ctx)
 {
     // load brushes and entities
-    LoadMapFile();
+    LoadMapFile(ctx);
 
-    if (qbsp_options.convertmapformat.value() != conversion_t::none) {
-        ConvertMapFile();
+    if (ctx.options.convertmapformat.value() != conversion_t::none) {
+        ConvertMapFile(ctx);
         return;
     }
-    if (qbsp_options.onlyents.value()) {
-        UpdateEntLump();
+    if (ctx.options.onlyents.value()) {
+        UpdateEntLump(ctx);
         return;
     }
 
     // handle load time operation on the .map
-    ProcessMapBrushes();
+    ProcessMapBrushes(ctx);
 
     // initialize secondary textures
-    LoadSecondaryTextures();
+    LoadSecondaryTextures(ctx);
 
     // init the tables to be shared by all models
-    BeginBSPFile();
+    BeginBSPFile(ctx);
 
     // create hulls!
-    CreateHulls();
+    CreateHulls(ctx);
 
-    WriteEntitiesToString();
-    BSPX_CreateBrushList();
-    FinishBSPFile();
+    WriteEntitiesToString(ctx);
+    BSPX_CreateBrushList(ctx);
+    FinishBSPFile(ctx);
 }
 
 /*
@@ -1659,14 +1675,14 @@ void ProcessFile()
 MakeSkipTexinfo
 ==================
 */
-static int MakeSkipTexinfo()
+static int MakeSkipTexinfo(qbsp_context_t &ctx)
 {
     maptexinfo_t mt{};
 
-    mt.miptex = FindMiptex("skip", true);
+    mt.miptex = FindMiptex(ctx, "skip", true);
     mt.flags.is_nodraw = true;
 
-    return FindTexinfo(mt);
+    return FindTexinfo(ctx, mt);
 }
 
 /*
@@ -1674,47 +1690,43 @@ static int MakeSkipTexinfo()
 InitQBSP
 ==================
 */
-void InitQBSP(int argc, const char **argv)
+void InitQBSP(qbsp_context_t &ctx, int argc, const char **argv)
 {
-    // In case we're launched more than once, in testqbsp
-    map.reset();
-    qbsp_options.reset();
-
-    qbsp_options.run(argc, argv);
+    ctx.options.run(argc, argv);
 
-    qbsp_options.map_path.replace_extension("map");
+    ctx.options.map_path.replace_extension("map");
 
     // The .map extension gets removed right away anyways...
-    if (qbsp_options.bsp_path.empty())
-        qbsp_options.bsp_path = qbsp_options.map_path;
+    if (ctx.options.bsp_path.empty())
+        ctx.options.bsp_path = ctx.options.map_path;
 
     /* Start logging to <bspname>.log */
-    logging::init(fs::path(qbsp_options.bsp_path).replace_extension("log"), qbsp_options);
+    logging::init(fs::path(ctx.options.bsp_path).replace_extension("log"), ctx.options);
 
     // Remove already existing files
-    if (!qbsp_options.onlyents.value() && qbsp_options.convertmapformat.value() == conversion_t::none) {
-        qbsp_options.bsp_path.replace_extension("bsp");
-        remove(qbsp_options.bsp_path);
+    if (!ctx.options.onlyents.value() && ctx.options.convertmapformat.value() == conversion_t::none) {
+        ctx.options.bsp_path.replace_extension("bsp");
+        remove(ctx.options.bsp_path);
 
         // Probably not the best place to do this
-        logging::print("Input file: {}\n", fs::absolute(qbsp_options.map_path));
-        logging::print("Output file: {}\n\n", fs::absolute(qbsp_options.bsp_path));
+        logging::print("Input file: {}\n", fs::absolute(ctx.options.map_path));
+        logging::print("Output file: {}\n\n", fs::absolute(ctx.options.bsp_path));
 
-        fs::path prtfile = qbsp_options.bsp_path;
+        fs::path prtfile = ctx.options.bsp_path;
         prtfile.replace_extension("prt");
         remove(prtfile);
 
-        fs::path ptsfile = qbsp_options.bsp_path;
+        fs::path ptsfile = ctx.options.bsp_path;
         ptsfile.replace_extension("pts");
         remove(ptsfile);
 
-        fs::path porfile = qbsp_options.bsp_path;
+        fs::path porfile = ctx.options.bsp_path;
         porfile.replace_extension("por");
         remove(porfile);
 
         // areaportal leaks
         for (int i = 0;; i++) {
-            fs::path name = qbsp_options.bsp_path;
+            fs::path name = ctx.options.bsp_path;
             name.replace_extension(fmt::format("areaportal_leak{}.pts", i));
 
             if (!remove(name)) {
@@ -1724,22 +1736,22 @@ void InitQBSP(int argc, const char **argv)
     }
 
     // onlyents might not load this yet
-    if (qbsp_options.target_game) {
-        qbsp_options.target_game->init_filesystem(qbsp_options.map_path, qbsp_options);
+    if (ctx.options.target_game) {
+        ctx.options.target_game->init_filesystem(ctx.options.map_path, ctx.options);
     }
 
     // make skip texinfo, in case map needs it (it'll get culled out if not)
-    map.skip_texinfo = MakeSkipTexinfo();
+    ctx.map.skip_texinfo = MakeSkipTexinfo(ctx);
 }
 
-void InitQBSP(const std::vector<std::string> &args)
+void InitQBSP(qbsp_context_t &ctx, const std::vector<std::string> &args)
 {
     std::vector<const char *> argPtrs;
     for (const std::string &arg : args) {
         argPtrs.push_back(arg.data());
     }
 
-    InitQBSP(argPtrs.size(), argPtrs.data());
+    InitQBSP(ctx, argPtrs.size(), argPtrs.data());
 }
 
 #include <fstream>
@@ -1751,11 +1763,15 @@ main
 */
 int qbsp_main(int argc, const char **argv)
 {
-    InitQBSP(argc, argv);
+    // heap allocated, since the settings and map data are fairly large
+    auto context = std::make_unique<qbsp_context_t>();
+    qbsp_context_t &ctx = *context;
+
+    InitQBSP(ctx, argc, argv);
 
     // do it!
     auto start = I_FloatTime();
-    ProcessFile();
+    ProcessFile(ctx);
     auto end = I_FloatTime();
 
     logging::print("\n{:.3} seconds elapsed\n", (end - start));
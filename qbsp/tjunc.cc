@@ -23,7 +23,12 @@
 
 #include <qbsp/qbsp.hh>
 #include <qbsp/map.hh>
+#include <common/parallel.hh>
+
 #include <atomic>
+#include <chrono>
+
+#include <tbb/parallel_sort.h>
 
 struct tjunc_stats_t : logging::stat_tracker_t
 {
@@ -51,6 +56,10 @@ struct tjunc_stats_t : logging::stat_tracker_t
     // # of faces that were created as a result of splitting faces that are too large
     // to be contained on a single face
     stat &faceoverflows = register_stat("faces added by splitting large faces");
+    // # of faces that had too many vertices to attempt MWT
+    stat &mwtskipped = register_stat("faces with too many vertices for MWT");
+    // time spent in MWT, summed over all threads
+    std::atomic<int64_t> mwt_time_us = 0;
 };
 
 static std::optional<vec_t> PointOnEdge(
@@ -84,7 +93,7 @@ TestEdge
 Can be recursively reentered
 ==========
 */
-static void TestEdge(vec_t start, vec_t end, size_t p1, size_t p2, size_t startvert,
+static void TestEdge(qbsp_context_t &ctx, vec_t start, vec_t end, size_t p1, size_t p2, size_t startvert,
     const std::vector<size_t> &edge_verts, const qvec3d &edge_start, const qvec3d &edge_dir,
     std::vector<size_t> &superface, tjunc_stats_t &stats)
 {
@@ -101,7 +110,7 @@ static void TestEdge(vec_t start, vec_t end, size_t p1, size_t p2, size_t startv
             continue;
         }
 
-        auto dist = PointOnEdge(map.bsp.dvertexes[j], edge_start, edge_dir, start, end);
+        auto dist = PointOnEdge(ctx.map.bsp.dvertexes[j], edge_start, edge_dir, start, end);
 
         if (!dist.has_value()) {
             continue;
@@ -110,8 +119,8 @@ static void TestEdge(vec_t start, vec_t end, size_t p1, size_t p2, size_t startv
         // break the edge
         stats.tjunctions++;
 
-        TestEdge(start, dist.value(), p1, j, k + 1, edge_verts, edge_start, edge_dir, superface, stats);
-        TestEdge(dist.value(), end, j, p2, k + 1, edge_verts, edge_start, edge_dir, superface, stats);
+        TestEdge(ctx, start, dist.value(), p1, j, k + 1, edge_verts, edge_start, edge_dir, superface, stats);
+        TestEdge(ctx, dist.value(), end, j, p2, k + 1, edge_verts, edge_start, edge_dir, superface, stats);
         return;
     }
 
@@ -130,7 +139,7 @@ Force a dumb check of everything
 static void FindEdgeVerts_BruteForce(
     const node_t *, const node_t *, const qvec3d &, const qvec3d &, std::vector<size_t> &verts)
 {
-    verts.resize(map.bsp.dvertexes.size());
+    verts.resize(ctx.map.bsp.dvertexes.size());
 
     for (size_t i = 0; i < verts.size(); i++) {
         verts[i] = i;
@@ -141,24 +150,64 @@ static void FindEdgeVerts_BruteForce(
 /**
  * This is to prevent func_detail_wall touching solid from creating
  * tjunc fixes. func_detail_wall is meant to act like a separate mesh,
- * so it shouldn't interact with solid.
+ * so it shouldn't interact with solid; faces only interact with
+ * faces of the same class.
  */
-static bool HasTJuncInteraction(const face_t *f1, const face_t *f2)
+static bool IsDetailWallFace(qbsp_context_t &ctx, const face_t *f)
 {
     // FIXME: handle func_detail_fence, func_detail_illusionary,
     // liquids? make sure a combination of solid + func_detail_wall
     // is treated as solid?
+    return f->contents.back.is_detail_wall(ctx.options.target_game);
+}
 
-    if (f1->contents.back.is_detail_wall(qbsp_options.target_game) &&
-        !f2->contents.back.is_detail_wall(qbsp_options.target_game))
-        return false;
+struct edge_line_vert_t
+{
+    // distance along the line
+    vec_t dist;
+    size_t vert;
+    bool detail_wall;
+    // position in tree order. TestEdge's results can depend on the order
+    // it sees the vertices in (vertices near the ends of an edge, with
+    // float rounding), so candidates are returned in the order a tree
+    // walk would find them, duplicates included.
+    size_t order;
+
+    bool operator<(const edge_line_vert_t &other) const
+    {
+        return std::tie(dist, order) < std::tie(other.dist, other.order);
+    }
+};
 
-    if (f2->contents.back.is_detail_wall(qbsp_options.target_game) &&
-        !f1->contents.back.is_detail_wall(qbsp_options.target_game))
-        return false;
+/*
+==========
+edge_line_t
 
-    return true;
-}
+All of the face edges that lie on (roughly) the same line share one of
+these. It stores every vertex that may lie on any of those edges, sorted
+by distance along the line, so finding the candidates for a single edge
+is a binary search instead of a tree walk.
+==========
+*/
+struct edge_line_t
+{
+    qvec3d origin;
+    qvec3d dir;
+    // the largest distance of a member edge's endpoint from this line
+    vec_t deviation = 0;
+    aabb3d bounds;
+    std::vector<edge_line_vert_t> verts;
+};
+
+struct edge_index_t
+{
+    std::vector<edge_line_t> lines;
+    // line of each face edge, indexed by the face's first_edge + edge number
+    std::vector<size_t> edge_lines;
+    std::vector<size_t> first_edge;
+
+    static constexpr size_t NO_LINE = std::numeric_limits<size_t>::max();
+};
 
 /*
 ==========
@@ -169,7 +218,7 @@ for vertex checking.
 ==========
 */
 static void FindEdgeVerts_FaceBounds_R(
-    const node_t *node, const face_t *f, const aabb3d &aabb, std::vector<size_t> &verts)
+    qbsp_context_t &ctx, const node_t *node, const aabb3d &aabb, std::vector<edge_line_vert_t> &verts)
 {
     if (node->is_leaf) {
         return;
@@ -178,36 +227,200 @@ static void FindEdgeVerts_FaceBounds_R(
     }
 
     for (auto &face : node->facelist) {
-        if (!HasTJuncInteraction(f, face.get()))
-            continue;
+        const bool detail_wall = IsDetailWallFace(ctx, face.get());
+
         for (auto &v : face->original_vertices) {
-            if (aabb.containsPoint(map.bsp.dvertexes[v])) {
-                verts.push_back(v);
+            if (aabb.containsPoint(ctx.map.bsp.dvertexes[v])) {
+                verts.push_back({0, v, detail_wall, 0});
             }
         }
     }
 
-    FindEdgeVerts_FaceBounds_R(node->children[0], f, aabb, verts);
-    FindEdgeVerts_FaceBounds_R(node->children[1], f, aabb, verts);
+    FindEdgeVerts_FaceBounds_R(ctx, node->children[0], aabb, verts);
+    FindEdgeVerts_FaceBounds_R(ctx, node->children[1], aabb, verts);
+}
+
+/*
+==========
+BuildEdgeIndex
+
+Buckets every face edge by the line it lies on, then gathers the
+vertices of each line once, with a loose AABB around all of its edges.
+==========
+*/
+static edge_index_t BuildEdgeIndex(qbsp_context_t &ctx, const node_t *headnode, const std::vector<face_t *> &faces)
+{
+    // cell sizes for bucketing lines; edges that fall into the same bucket
+    // don't have to be exactly collinear, since the gathered vertices
+    // cover each member edge's deviation from the shared line
+    constexpr vec_t DIR_CELL = 1.0 / 65536;
+    constexpr vec_t ORIGIN_CELL = 1.0 / 64;
+
+    edge_index_t index;
+
+    index.first_edge.resize(faces.size() + 1);
+
+    for (size_t i = 0; i < faces.size(); i++) {
+        index.first_edge[i + 1] = index.first_edge[i] + faces[i]->original_vertices.size();
+    }
+
+    const size_t num_edges = index.first_edge.back();
+
+    using line_key_t = std::array<int64_t, 6>;
+
+    std::vector<std::pair<line_key_t, size_t>> keys;
+    keys.reserve(num_edges);
+
+    std::vector<std::array<size_t, 2>> edges(num_edges);
+
+    for (size_t i = 0; i < faces.size(); i++) {
+        auto &verts = faces[i]->original_vertices;
+
+        for (size_t j = 0; j < verts.size(); j++) {
+            edges[index.first_edge[i] + j] = {verts[j], verts[(j + 1) % verts.size()]};
+        }
+    }
+
+    std::vector<std::optional<line_key_t>> edge_keys(num_edges);
+
+    tbb::parallel_for(static_cast<size_t>(0), num_edges, [&](size_t e) {
+        auto [v1, v2] = edges[e];
+
+        // degenerate; TestEdge won't look for vertices
+        if (v1 == v2) {
+            return;
+        }
+
+        const qvec3d p1 = ctx.map.bsp.dvertexes[v1];
+        qvec3d dir = qv::normalize(qvec3d(ctx.map.bsp.dvertexes[v2]) - p1);
+
+        // both directions share a line
+        if (dir[qv::indexOfLargestMagnitudeComponent(dir)] < 0) {
+            dir = -dir;
+        }
+
+        // closest point to the world origin
+        const qvec3d origin = p1 - (dir * qv::dot(p1, dir));
+
+        edge_keys[e] = line_key_t{static_cast<int64_t>(std::floor(dir[0] / DIR_CELL + 0.5)),
+            static_cast<int64_t>(std::floor(dir[1] / DIR_CELL + 0.5)),
+            static_cast<int64_t>(std::floor(dir[2] / DIR_CELL + 0.5)),
+            static_cast<int64_t>(std::floor(origin[0] / ORIGIN_CELL + 0.5)),
+            static_cast<int64_t>(std::floor(origin[1] / ORIGIN_CELL + 0.5)),
+            static_cast<int64_t>(std::floor(origin[2] / ORIGIN_CELL + 0.5))};
+    });
+
+    for (size_t e = 0; e < num_edges; e++) {
+        if (edge_keys[e]) {
+            keys.emplace_back(*edge_keys[e], e);
+        }
+    }
+
+    tbb::parallel_sort(keys.begin(), keys.end());
+
+    index.edge_lines.resize(num_edges, edge_index_t::NO_LINE);
+
+    std::vector<size_t> line_starts;
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i == 0 || keys[i].first != keys[i - 1].first) {
+            line_starts.push_back(i);
+        }
+
+        index.edge_lines[keys[i].second] = line_starts.size() - 1;
+    }
+
+    line_starts.push_back(keys.size());
+
+    index.lines.resize(line_starts.size() - 1);
+
+    logging::parallel_for(static_cast<size_t>(0), index.lines.size(), [&](size_t l) {
+        auto &line = index.lines[l];
+
+        // the first edge of the bucket defines the line
+        {
+            auto [v1, v2] = edges[keys[line_starts[l]].second];
+            line.origin = ctx.map.bsp.dvertexes[v1];
+            line.dir = qv::normalize(qvec3d(ctx.map.bsp.dvertexes[v2]) - line.origin);
+        }
+
+        for (size_t i = line_starts[l]; i < line_starts[l + 1]; i++) {
+            for (auto &v : edges[keys[i].second]) {
+                const qvec3d p = ctx.map.bsp.dvertexes[v];
+                const qvec3d on_line = line.origin + (line.dir * qv::dot(p - line.origin, line.dir));
+
+                line.deviation = std::max(line.deviation, qv::distance(p, on_line));
+                line.bounds += p;
+            }
+        }
+
+        // same loose bounds as a per-edge search would use; the walk
+        // visits nodes in the same order for any bounds
+        FindEdgeVerts_FaceBounds_R(ctx, headnode, line.bounds.grow(qvec3d(1.0, 1.0, 1.0)), line.verts);
+
+        for (size_t i = 0; i < line.verts.size(); i++) {
+            line.verts[i].order = i;
+        }
+
+        // anything on a member edge is within DEFAULT_ON_EPSILON of it,
+        // and so within DEFAULT_ON_EPSILON + deviation of the line
+        const vec_t max_dist = DEFAULT_ON_EPSILON + line.deviation + 0.001;
+
+        std::erase_if(line.verts, [&](edge_line_vert_t &v) {
+            const qvec3d p = ctx.map.bsp.dvertexes[v.vert];
+            v.dist = qv::dot(p - line.origin, line.dir);
+            return qv::distance(p, line.origin + (line.dir * v.dist)) > max_dist;
+        });
+
+        std::sort(line.verts.begin(), line.verts.end());
+    });
+
+    return index;
 }
 
 /*
 ==========
-FindEdgeVerts_FaceBounds
+FindEdgeVerts
 
-Use a loose AABB around the line and only capture vertices that intersect it.
+Finds the vertices that could lie on the given edge of face f, using
+the edge's line in the index.
 
 f is the face we're fixing; this will affect the candidate other faces
 because not everything has tjunc interactions (e.g. func_detail_wall and worldspawn.)
 ==========
 */
-static void FindEdgeVerts_FaceBounds(
-    const node_t *headnode, const face_t *f, const qvec3d &p1, const qvec3d &p2, std::vector<size_t> &verts)
+static void FindEdgeVerts(qbsp_context_t &ctx, const edge_index_t &index, size_t face_index, size_t edge,
+    const face_t *f, const qvec3d &p1, const qvec3d &p2, std::vector<size_t> &verts)
 {
-    // magic number, average of "usual" points per edge
-    verts.reserve(8);
+    const size_t l = index.edge_lines[index.first_edge[face_index] + edge];
+
+    if (l == edge_index_t::NO_LINE) {
+        return;
+    }
+
+    const auto &line = index.lines[l];
+    const vec_t slack = DEFAULT_ON_EPSILON + line.deviation + 0.001;
+    const vec_t d1 = qv::dot(p1 - line.origin, line.dir);
+    const vec_t d2 = qv::dot(p2 - line.origin, line.dir);
+
+    auto it = std::lower_bound(line.verts.begin(), line.verts.end(), std::min(d1, d2) - slack,
+        [](const edge_line_vert_t &v, vec_t dist) { return v.dist < dist; });
+    const vec_t end = std::max(d1, d2) + slack;
+    const bool detail_wall = IsDetailWallFace(ctx, f);
+
+    std::vector<std::pair<size_t, size_t>> found;
 
-    FindEdgeVerts_FaceBounds_R(headnode, f, (aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0)), verts);
+    for (; it != line.verts.end() && it->dist <= end; ++it) {
+        if (it->detail_wall == detail_wall) {
+            found.emplace_back(it->order, it->vert);
+        }
+    }
+
+    std::sort(found.begin(), found.end());
+
+    for (auto &[order, v] : found) {
+        verts.push_back(v);
+    }
 }
 
 /*
@@ -221,10 +434,10 @@ max edge count.
 Modifies `superface`. Adds the results to the end of `output`.
 ==================
 */
-static void SplitFaceIntoFragments(
+static void SplitFaceIntoFragments(qbsp_context_t &ctx, 
     std::vector<size_t> &superface, std::list<std::vector<size_t>> &output, tjunc_stats_t &stats)
 {
-    const int32_t &maxedges = qbsp_options.maxedges.value();
+    const int32_t &maxedges = ctx.options.maxedges.value();
 
     // split into multiple fragments, because of vertex overload
     while (superface.size() > maxedges) {
@@ -258,11 +471,13 @@ static float AngleOfTriangle(const qvec3d &a, const qvec3d &b, const qvec3d &c)
 // Check whether the given input triangle would be valid
 // on the given face and not have any other points
 // intersecting it.
-static bool TriangleIsValid(size_t v0, size_t v1, size_t v2, vec_t angle_epsilon)
+static bool TriangleIsValid(qbsp_context_t &ctx, size_t v0, size_t v1, size_t v2, vec_t angle_epsilon)
 {
-    if (AngleOfTriangle(map.bsp.dvertexes[v0], map.bsp.dvertexes[v1], map.bsp.dvertexes[v2]) < angle_epsilon ||
-        AngleOfTriangle(map.bsp.dvertexes[v1], map.bsp.dvertexes[v2], map.bsp.dvertexes[v0]) < angle_epsilon ||
-        AngleOfTriangle(map.bsp.dvertexes[v2], map.bsp.dvertexes[v0], map.bsp.dvertexes[v1]) < angle_epsilon) {
+    const auto &dvertexes = ctx.map.bsp.dvertexes;
+
+    if (AngleOfTriangle(dvertexes[v0], dvertexes[v1], dvertexes[v2]) < angle_epsilon ||
+        AngleOfTriangle(dvertexes[v1], dvertexes[v2], dvertexes[v0]) < angle_epsilon ||
+        AngleOfTriangle(dvertexes[v2], dvertexes[v0], dvertexes[v1]) < angle_epsilon) {
         return false;
     }
 
@@ -277,7 +492,8 @@ Generate a superface (the input face `f` but with all of the
 verts in the world added that lay on the line) and return it
 ==================
 */
-static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static std::vector<size_t> CreateSuperFace(qbsp_context_t &ctx, 
+    const edge_index_t &index, size_t face_index, face_t *f, tjunc_stats_t &stats)
 {
     std::vector<size_t> superface;
 
@@ -293,16 +509,16 @@ static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_st
         auto v1 = f->original_vertices[i];
         auto v2 = f->original_vertices[(i + 1) % f->original_vertices.size()];
 
-        qvec3d edge_start = map.bsp.dvertexes[v1];
-        qvec3d e2 = map.bsp.dvertexes[v2];
+        qvec3d edge_start = ctx.map.bsp.dvertexes[v1];
+        qvec3d e2 = ctx.map.bsp.dvertexes[v2];
 
         edge_verts.clear();
-        FindEdgeVerts_FaceBounds(headnode, f, edge_start, e2, edge_verts);
+        FindEdgeVerts(ctx, index, face_index, i, f, edge_start, e2, edge_verts);
 
         vec_t len;
         qvec3d edge_dir = qv::normalize(e2 - edge_start, len);
 
-        TestEdge(0, len, v1, v2, 0, edge_verts, edge_start, edge_dir, superface, stats);
+        TestEdge(ctx, 0, len, v1, v2, 0, edge_verts, edge_start, edge_dir, superface, stats);
     }
 
     return superface;
@@ -473,7 +689,7 @@ static std::list<std::vector<size_t>> compress_triangles_into_fans(
 
 // Function to calculate the weight of optimal triangulation of a convex polygon
 // represented by a given set of vertices
-static std::vector<qvectri> minimum_weight_triangulation(
+static std::vector<qvectri> minimum_weight_triangulation(qbsp_context_t &ctx, 
     const std::vector<size_t> &indices, const std::vector<qvec2d> &vertices)
 {
     // get the number of vertices in the polygon
@@ -500,7 +716,7 @@ static std::vector<qvectri> minimum_weight_triangulation(
                 // The weight of triangulation is the length of its perimeter
                 vec_t weight;
 
-                if (!TriangleIsValid(indices[i], indices[j], indices[k], 0.01)) {
+                if (!TriangleIsValid(ctx, indices[i], indices[j], indices[k], 0.01)) {
                     weight = std::nexttoward(std::numeric_limits<vec_t>::max(), 0.0);
                 } else {
                     weight = (qv::distance(vertices[i], vertices[j]) + qv::distance(vertices[j], vertices[k]) +
@@ -549,10 +765,10 @@ static std::vector<qvectri> minimum_weight_triangulation(
     return triangles;
 }
 
-static std::list<std::vector<size_t>> mwt_face(
+static std::list<std::vector<size_t>> mwt_face(qbsp_context_t &ctx, 
     const face_t *f, const std::vector<size_t> &vertices, tjunc_stats_t &stats)
 {
-    const auto &p = f->get_plane();
+    const auto &p = f->get_plane(ctx.map);
     auto [u, v] = qv::MakeTangentAndBitangentUnnormalized(p.get_normal());
     qv::normalizeInPlace(u);
     qv::normalizeInPlace(v);
@@ -560,10 +776,10 @@ static std::list<std::vector<size_t>> mwt_face(
     std::vector<qvec2d> points_2d(vertices.size());
 
     for (size_t i = 0; i < vertices.size(); i++) {
-        points_2d[i] = {qv::dot(map.bsp.dvertexes[vertices[i]], u), qv::dot(map.bsp.dvertexes[vertices[i]], v)};
+        points_2d[i] = {qv::dot(ctx.map.bsp.dvertexes[vertices[i]], u), qv::dot(ctx.map.bsp.dvertexes[vertices[i]], v)};
     }
 
-    auto tris = minimum_weight_triangulation(vertices, points_2d);
+    auto tris = minimum_weight_triangulation(ctx, vertices, points_2d);
 
     stats.trimwt += tris.size();
 
@@ -579,7 +795,8 @@ It's still a convex face with wound vertices, though, so we
 can split it into several triangle fans.
 ==================
 */
-static std::list<std::vector<size_t>> RetopologizeFace(const face_t *f, const std::vector<size_t> &vertices)
+static std::list<std::vector<size_t>> RetopologizeFace(
+    qbsp_context_t &ctx, const face_t *f, const std::vector<size_t> &vertices)
 {
     std::list<std::vector<size_t>> result;
     // the copy we're working on
@@ -603,16 +820,16 @@ static std::list<std::vector<size_t>> RetopologizeFace(const face_t *f, const st
             end = (seed + 2) % input.size();
             auto v2 = input[end];
 
-            if (!TriangleIsValid(v0, v1, v2, 0.01)) {
+            if (!TriangleIsValid(ctx, v0, v1, v2, 0.01)) {
                 continue;
             }
 
             // if the next point lays on the edge of v0-v2, this next
             // triangle won't be valid.
             float len;
-            qvec3d dir = qv::normalize(map.bsp.dvertexes[v0] - map.bsp.dvertexes[v2], len);
-            auto dist =
-                PointOnEdge(map.bsp.dvertexes[input[(end + 1) % input.size()]], map.bsp.dvertexes[v2], dir, 0, len);
+            qvec3d dir = qv::normalize(ctx.map.bsp.dvertexes[v0] - ctx.map.bsp.dvertexes[v2], len);
+            auto dist = PointOnEdge(
+                ctx.map.bsp.dvertexes[input[(end + 1) % input.size()]], ctx.map.bsp.dvertexes[v2], dir, 0, len);
 
             if (dist.has_value()) {
                 continue;
@@ -641,9 +858,9 @@ static std::list<std::vector<size_t>> RetopologizeFace(const face_t *f, const st
             // if the next point lays on the edge of v0-v2, this next
             // triangle won't be valid.
             float len;
-            qvec3d dir = qv::normalize(map.bsp.dvertexes[v0] - map.bsp.dvertexes[v2], len);
-            auto dist =
-                PointOnEdge(map.bsp.dvertexes[input[(end + 1) % input.size()]], map.bsp.dvertexes[v2], dir, 0, len);
+            qvec3d dir = qv::normalize(ctx.map.bsp.dvertexes[v0] - ctx.map.bsp.dvertexes[v2], len);
+            auto dist = PointOnEdge(
+                ctx.map.bsp.dvertexes[input[(end + 1) % input.size()]], ctx.map.bsp.dvertexes[v2], dir, 0, len);
 
             if (dist.has_value()) {
                 // the next point lays on this edge, so back up and stop
@@ -736,15 +953,16 @@ FixFaceEdges
 If the face has any T-junctions, fix them here.
 ==================
 */
-static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static void FixFaceEdges(
+    qbsp_context_t &ctx, const edge_index_t &index, size_t face_index, face_t *f, tjunc_stats_t &stats)
 {
     // we were asked not to bother fixing any of the faces.
-    if (qbsp_options.tjunc.value() == settings::tjunclevel_t::NONE) {
+    if (ctx.options.tjunc.value() == settings::tjunclevel_t::NONE) {
         f->fragments.emplace_back(face_fragment_t{f->original_vertices});
         return;
     }
 
-    std::vector<size_t> superface = CreateSuperFace(headnode, f, stats);
+    std::vector<size_t> superface = CreateSuperFace(ctx, index, face_index, f, stats);
 
     if (superface.size() < 3) {
         // entire face collapsed
@@ -763,18 +981,31 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
     std::list<std::vector<size_t>> faces;
 
     // do MWT first; it will generate optimal results for everything.
-    if (qbsp_options.tjunc.value() >= settings::tjunclevel_t::MWT) {
-        faces = mwt_face(f, superface, stats);
+    // it's cubic in the number of vertices though, so very large faces
+    // go straight to the fan-based fixes below.
+    if (ctx.options.tjunc.value() >= settings::tjunclevel_t::MWT) {
+        const size_t max_vertices = ctx.options.maxmwtvertices.value();
 
-        if (faces.size()) {
-            stats.mwt++;
-            stats.facemwt += faces.size() - 1;
+        if (max_vertices && superface.size() > max_vertices) {
+            stats.mwtskipped++;
+        } else {
+            auto start = I_FloatTime();
+
+            faces = mwt_face(ctx, f, superface, stats);
+
+            stats.mwt_time_us +=
+                std::chrono::duration_cast<std::chrono::microseconds>(I_FloatTime() - start).count();
+
+            if (faces.size()) {
+                stats.mwt++;
+                stats.facemwt += faces.size() - 1;
+            }
         }
     }
 
     // brute force rotating the start point until we find a valid winding
     // that doesn't have any T-junctions
-    if (!faces.size() && qbsp_options.tjunc.value() >= settings::tjunclevel_t::ROTATE) {
+    if (!faces.size() && ctx.options.tjunc.value() >= settings::tjunclevel_t::ROTATE) {
         size_t i = 0;
 
         for (; i < superface.size(); i++) {
@@ -786,7 +1017,7 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
                 auto v1 = superface[(i + x + 1) % superface.size()];
                 auto v2 = superface[(i + x + 2) % superface.size()];
 
-                if (!TriangleIsValid(v0, v1, v2, 0.01)) {
+                if (!TriangleIsValid(ctx, v0, v1, v2, 0.01)) {
                     break;
                 }
             }
@@ -800,8 +1031,8 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
         if (i == superface.size()) {
             // can't simply rotate to eliminate zero-area triangles, so we have
             // to do a bit of re-topology.
-            if (qbsp_options.tjunc.value() >= settings::tjunclevel_t::RETOPOLOGIZE) {
-                if (auto retopology = RetopologizeFace(f, superface); retopology.size() > 1) {
+            if (ctx.options.tjunc.value() >= settings::tjunclevel_t::RETOPOLOGIZE) {
+                if (auto retopology = RetopologizeFace(ctx, f, superface); retopology.size() > 1) {
                     stats.retopology++;
                     stats.faceretopology += retopology.size() - 1;
                     faces = std::move(retopology);
@@ -834,10 +1065,10 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
     Q_assert(faces.size());
 
     // split giant superfaces into subfaces if we have an edge limit.
-    if (qbsp_options.maxedges.value()) {
+    if (ctx.options.maxedges.value()) {
         for (auto &face : faces) {
             Q_assert(face.size() >= 3);
-            SplitFaceIntoFragments(face, faces, stats);
+            SplitFaceIntoFragments(ctx, face, faces, stats);
             Q_assert(face.size() >= 3);
         }
     }
@@ -854,14 +1085,12 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
     }
 }
 
-#include <common/parallel.hh>
-
 /*
 ==================
 FixEdges_r
 ==================
 */
-static void FindFaces_r(node_t *node, std::unordered_set<face_t *> &faces)
+static void FindFaces_r(node_t *node, std::vector<face_t *> &faces)
 {
     if (node->is_leaf) {
         return;
@@ -870,7 +1099,7 @@ static void FindFaces_r(node_t *node, std::unordered_set<face_t *> &faces)
     for (auto &f : node->facelist) {
         // might have been omitted, so `original_vertices` will be empty
         if (f->original_vertices.size()) {
-            faces.insert(f.get());
+            faces.push_back(f.get());
         }
     }
 
@@ -883,14 +1112,29 @@ static void FindFaces_r(node_t *node, std::unordered_set<face_t *> &faces)
 TJunc fixing entry point
 ===========
 */
-void TJunc(node_t *headnode)
+void TJunc(qbsp_context_t &ctx, node_t *headnode)
 {
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
 
     tjunc_stats_t stats{};
-    std::unordered_set<face_t *> faces;
+    std::vector<face_t *> faces;
 
     FindFaces_r(headnode, faces);
 
-    logging::parallel_for_each(faces, [&](auto &face) { FixFaceEdges(headnode, face, stats); });
+    // not needed if we aren't fixing anything
+    edge_index_t index;
+
+    if (ctx.options.tjunc.value() != settings::tjunclevel_t::NONE) {
+        index = BuildEdgeIndex(ctx, headnode, faces);
+    }
+
+    logging::parallel_for(
+        static_cast<size_t>(0), faces.size(), [&](size_t i) { FixFaceEdges(ctx, index, i, faces[i], stats); });
+
+    stats.print_stats();
+
+    if (stats.mwt_time_us) {
+        logging::print(logging::flag::STAT, "     {:.3} seconds spent in MWT\n", stats.mwt_time_us / 1000000.0);
+    }
 }
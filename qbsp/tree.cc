@@ -24,6 +24,7 @@
 #include <qbsp/qbsp.hh>
 #include <qbsp/brush.hh>
 #include <qbsp/portals.hh>
+#include <qbsp/map.hh>
 #include <tbb/task_group.h>
 
 #include <atomic>
@@ -116,30 +117,30 @@ struct prune_stats_t : logging::stat_tracker_t
     stat &nodes_pruned = register_stat("nodes pruned");
 };
 
-static bool IsAnySolidLeaf(const node_t *node)
+static bool IsAnySolidLeaf(qbsp_context_t &ctx, const node_t *node)
 {
-    return node->is_leaf && node->contents.is_any_solid(qbsp_options.target_game);
+    return node->is_leaf && node->contents.is_any_solid(ctx.options.target_game);
 }
 
-static void PruneNodes_R(node_t *node, prune_stats_t &stats)
+static void PruneNodes_R(qbsp_context_t &ctx, node_t *node, prune_stats_t &stats)
 {
     if (node->is_leaf) {
         // remap any contents
-        if (qbsp_options.target_game->id != GAME_QUAKE_II && node->contents.is_detail_wall(qbsp_options.target_game)) {
-            node->contents = qbsp_options.target_game->create_solid_contents();
+        if (ctx.options.target_game->id != GAME_QUAKE_II && node->contents.is_detail_wall(ctx.options.target_game)) {
+            node->contents = ctx.options.target_game->create_solid_contents();
         }
         return;
     }
 
     tbb::task_group g;
-    g.run([&]() { PruneNodes_R(node->children[0], stats); });
-    g.run([&]() { PruneNodes_R(node->children[1], stats); });
+    g.run([&]() { PruneNodes_R(ctx, node->children[0], stats); });
+    g.run([&]() { PruneNodes_R(ctx, node->children[1], stats); });
     g.wait();
 
     // fixme-brushbsp: is it correct to strip off detail flags here?
-    if (IsAnySolidLeaf(node->children[0]) && IsAnySolidLeaf(node->children[1])) {
+    if (IsAnySolidLeaf(ctx, node->children[0]) && IsAnySolidLeaf(ctx, node->children[1])) {
         // This discards any faces on-node. Should be safe (?)
-        ConvertNodeToLeaf(node, qbsp_options.target_game->create_solid_contents());
+        ConvertNodeToLeaf(node, ctx.options.target_game->create_solid_contents());
         stats.nodes_pruned++;
     }
 
@@ -155,11 +156,11 @@ static void PruneNodes_R(node_t *node, prune_stats_t &stats)
     // fixme-brushbsp: maybe merge if same content type, and all faces on node are invisible?
 }
 
-void PruneNodes(node_t *node)
+void PruneNodes(qbsp_context_t &ctx, node_t *node)
 {
     logging::funcheader();
 
     prune_stats_t stats;
 
-    PruneNodes_R(node, stats);
+    PruneNodes_R(ctx, node, stats);
 }
@@ -37,56 +37,56 @@ using nlohmann::json;
 /**
  * Returns the output plane number
  */
-size_t ExportMapPlane(size_t planenum)
+size_t ExportMapPlane(qbsp_context_t &ctx, size_t planenum)
 {
-    mapplane_t &plane = map.planes[planenum];
+    mapplane_t &plane = ctx.map.planes[planenum];
 
     if (plane.outputnum.has_value()) {
         return plane.outputnum.value(); // already output.
     }
 
-    plane.outputnum = map.bsp.dplanes.size();
-    dplane_t &dplane = map.bsp.dplanes.emplace_back();
+    plane.outputnum = ctx.map.bsp.dplanes.size();
+    dplane_t &dplane = ctx.map.bsp.dplanes.emplace_back();
     dplane.normal = plane.get_normal();
     dplane.dist = plane.get_dist();
     dplane.type = static_cast<int32_t>(plane.get_type());
     return plane.outputnum.value();
 }
 
-size_t ExportMapTexinfo(size_t texinfonum)
+size_t ExportMapTexinfo(qbsp_context_t &ctx, size_t texinfonum)
 {
-    maptexinfo_t &src = map.mtexinfos.at(texinfonum);
+    maptexinfo_t &src = ctx.map.mtexinfos.at(texinfonum);
 
     if (src.outputnum.has_value())
         return src.outputnum.value();
-    else if (!qbsp_options.includeskip.value() && src.flags.is_nodraw) {
+    else if (!ctx.options.includeskip.value() && src.flags.is_nodraw) {
         // TODO: move to game specific
         // always include LIGHT
-        if (qbsp_options.target_game->id != GAME_QUAKE_II || !(src.flags.native & Q2_SURF_LIGHT))
+        if (ctx.options.target_game->id != GAME_QUAKE_II || !(src.flags.native & Q2_SURF_LIGHT))
             return -1;
     }
 
     // this will be the index of the exported texinfo in the BSP lump
-    const size_t i = map.bsp.texinfo.size();
+    const size_t i = ctx.map.bsp.texinfo.size();
 
-    mtexinfo_t &dest = map.bsp.texinfo.emplace_back();
+    mtexinfo_t &dest = ctx.map.bsp.texinfo.emplace_back();
 
     // make sure we don't write any non-native flags.
     // e.g. Quake only accepts 0 or TEX_SPECIAL.
-    if (!src.flags.is_valid(qbsp_options.target_game)) {
+    if (!src.flags.is_valid(ctx.options.target_game)) {
         FError("Internal error: Texinfo {} has invalid surface flags {}", texinfonum, src.flags.native);
     }
 
     dest.flags = src.flags;
     dest.miptex = src.miptex;
     dest.vecs = src.vecs;
-    strcpy(dest.texture.data(), map.texinfoTextureName(texinfonum).c_str());
-    dest.value = map.miptex[src.miptex].value;
+    strcpy(dest.texture.data(), ctx.map.texinfoTextureName(texinfonum).c_str());
+    dest.value = ctx.map.miptex[src.miptex].value;
 
     src.outputnum = i;
 
     if (src.next.has_value()) {
-        map.bsp.texinfo[i].nexttexinfo = ExportMapTexinfo(src.next.value());
+        ctx.map.bsp.texinfo[i].nexttexinfo = ExportMapTexinfo(ctx, src.next.value());
     }
 
     return i;
@@ -99,22 +99,22 @@ size_t ExportMapTexinfo(size_t texinfonum)
 ExportClipNodes
 ==================
 */
-static size_t ExportClipNodes(node_t *node)
+static size_t ExportClipNodes(qbsp_context_t &ctx, node_t *node)
 {
     if (node->is_leaf) {
         return node->contents.native;
     }
 
     /* emit a clipnode */
-    const size_t nodenum = map.bsp.dclipnodes.size();
-    map.bsp.dclipnodes.emplace_back();
+    const size_t nodenum = ctx.map.bsp.dclipnodes.size();
+    ctx.map.bsp.dclipnodes.emplace_back();
 
-    const int child0 = ExportClipNodes(node->children[0]);
-    const int child1 = ExportClipNodes(node->children[1]);
+    const int child0 = ExportClipNodes(ctx, node->children[0]);
+    const int child1 = ExportClipNodes(ctx, node->children[1]);
 
     // Careful not to modify the vector while using this clipnode pointer
-    bsp2_dclipnode_t &clipnode = map.bsp.dclipnodes[nodenum];
-    clipnode.planenum = ExportMapPlane(node->planenum);
+    bsp2_dclipnode_t &clipnode = ctx.map.bsp.dclipnodes[nodenum];
+    clipnode.planenum = ExportMapPlane(ctx, node->planenum);
     clipnode.children[0] = child0;
     clipnode.children[1] = child1;
 
@@ -133,10 +133,10 @@ First time just store away data, second time fix up reference points to
 accomodate new data interleaved with old.
 ==================
 */
-void ExportClipNodes(mapentity_t &entity, node_t *nodes, hull_index_t::value_type hullnum)
+void ExportClipNodes(qbsp_context_t &ctx, mapentity_t &entity, node_t *nodes, hull_index_t::value_type hullnum)
 {
-    auto &model = map.bsp.dmodels.at(entity.outputmodelnumber.value());
-    model.headnode[hullnum] = ExportClipNodes(nodes);
+    auto &model = ctx.map.bsp.dmodels.at(entity.outputmodelnumber.value());
+    model.headnode[hullnum] = ExportClipNodes(ctx, nodes);
 }
 
 //===========================================================================
@@ -146,16 +146,16 @@ void ExportClipNodes(mapentity_t &entity, node_t *nodes, hull_index_t::value_typ
 ExportLeaf
 ==================
 */
-static void ExportLeaf(node_t *node)
+static void ExportLeaf(qbsp_context_t &ctx, node_t *node)
 {
-    mleaf_t &dleaf = map.bsp.dleafs.emplace_back();
+    mleaf_t &dleaf = ctx.map.bsp.dleafs.emplace_back();
 
     const contentflags_t remapped =
-        qbsp_options.target_game->contents_remap_for_export(node->contents, gamedef_t::remap_type_t::leaf);
+        ctx.options.target_game->contents_remap_for_export(node->contents, gamedef_t::remap_type_t::leaf);
 
-    if (!remapped.is_valid(qbsp_options.target_game, false)) {
-        FError("Internal error: On leaf {}, tried to save invalid contents type {}", map.bsp.dleafs.size() - 1,
-            remapped.to_string(qbsp_options.target_game));
+    if (!remapped.is_valid(ctx.options.target_game, false)) {
+        FError("Internal error: On leaf {}, tried to save invalid contents type {}", ctx.map.bsp.dleafs.size() - 1,
+            remapped.to_string(ctx.options.target_game));
     }
 
     dleaf.contents = remapped.native;
@@ -173,30 +173,31 @@ static void ExportLeaf(node_t *node)
     dleaf.visofs = -1; // no vis info yet
 
     // write the marksurfaces
-    dleaf.firstmarksurface = static_cast<int>(map.bsp.dleaffaces.size());
+    dleaf.firstmarksurface = static_cast<int>(ctx.map.bsp.dleaffaces.size());
 
     for (auto &face : node->markfaces) {
-        if (!qbsp_options.includeskip.value() && face->get_texinfo().flags.is_nodraw) {
+        if (!ctx.options.includeskip.value() && face->get_texinfo(ctx.map).flags.is_nodraw) {
 
             // TODO: move to game specific
             // always include LIGHT
-            if (qbsp_options.target_game->id != GAME_QUAKE_II || !(face->get_texinfo().flags.native & Q2_SURF_LIGHT))
+            if (ctx.options.target_game->id != GAME_QUAKE_II ||
+                !(face->get_texinfo(ctx.map).flags.native & Q2_SURF_LIGHT))
                 continue;
         }
 
         /* grab final output faces */
         for (auto &fragment : face->fragments) {
             if (fragment.outputnumber.has_value()) {
-                map.bsp.dleaffaces.push_back(fragment.outputnumber.value());
+                ctx.map.bsp.dleaffaces.push_back(fragment.outputnumber.value());
             }
         }
     }
-    dleaf.nummarksurfaces = static_cast<int>(map.bsp.dleaffaces.size()) - dleaf.firstmarksurface;
+    dleaf.nummarksurfaces = static_cast<int>(ctx.map.bsp.dleaffaces.size()) - dleaf.firstmarksurface;
 
     if (dleaf.contents & Q2_CONTENTS_SOLID) {
         dleaf.area = AREA_INVALID;
     } else {
-        if (map.leakfile || map.region || map.antiregions.size()) {
+        if (ctx.map.leakfile || ctx.map.region || ctx.map.antiregions.size()) {
             dleaf.area = 1;
         } else {
             dleaf.area = node->area;
@@ -216,15 +217,15 @@ constexpr int32_t PLANENUM_LEAF = -1;
 ExportDrawNodes
 ==================
 */
-static void ExportDrawNodes(node_t *node)
+static void ExportDrawNodes(qbsp_context_t &ctx, node_t *node)
 {
-    const size_t ourNodeIndex = map.bsp.dnodes.size();
-    bsp2_dnode_t *dnode = &map.bsp.dnodes.emplace_back();
+    const size_t ourNodeIndex = ctx.map.bsp.dnodes.size();
+    bsp2_dnode_t *dnode = &ctx.map.bsp.dnodes.emplace_back();
 
     dnode->mins = qv::floor(node->bounds.mins());
     dnode->maxs = qv::ceil(node->bounds.maxs());
 
-    dnode->planenum = ExportMapPlane(node->planenum);
+    dnode->planenum = ExportMapPlane(ctx, node->planenum);
     dnode->firstface = node->firstface;
     dnode->numfaces = node->numfaces;
 
@@ -232,23 +233,23 @@ static void ExportDrawNodes(node_t *node)
     for (size_t i = 0; i < 2; i++) {
         if (node->children[i]->is_leaf) {
             // In Q2, all leaves must have their own ID even if they share solidity.
-            if (qbsp_options.target_game->id != GAME_QUAKE_II &&
-                node->children[i]->contents.is_any_solid(qbsp_options.target_game)) {
+            if (ctx.options.target_game->id != GAME_QUAKE_II &&
+                node->children[i]->contents.is_any_solid(ctx.options.target_game)) {
                 dnode->children[i] = PLANENUM_LEAF;
             } else {
-                int32_t nextLeafIndex = static_cast<int32_t>(map.bsp.dleafs.size());
+                int32_t nextLeafIndex = static_cast<int32_t>(ctx.map.bsp.dleafs.size());
                 const int32_t childnum = -(nextLeafIndex + 1);
                 dnode->children[i] = childnum;
-                ExportLeaf(node->children[i]);
+                ExportLeaf(ctx, node->children[i]);
             }
         } else {
-            const int32_t childnum = static_cast<int32_t>(map.bsp.dnodes.size());
+            const int32_t childnum = static_cast<int32_t>(ctx.map.bsp.dnodes.size());
             dnode->children[i] = childnum;
-            ExportDrawNodes(node->children[i]);
+            ExportDrawNodes(ctx, node->children[i]);
 
             // Important: our dnode pointer may be invalid after the recursive call, if the vector got resized.
             // So re-set the pointer.
-            dnode = &map.bsp.dnodes[ourNodeIndex];
+            dnode = &ctx.map.bsp.dnodes[ourNodeIndex];
         }
     }
 
@@ -265,24 +266,24 @@ static void ExportDrawNodes(node_t *node)
 ExportDrawNodes
 ==================
 */
-void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface)
+void ExportDrawNodes(qbsp_context_t &ctx, mapentity_t &entity, node_t *headnode, int firstface)
 {
     // populate model struct (which was emitted previously)
-    dmodelh2_t &dmodel = map.bsp.dmodels.at(entity.outputmodelnumber.value());
-    dmodel.headnode[0] = static_cast<int32_t>(map.bsp.dnodes.size());
+    dmodelh2_t &dmodel = ctx.map.bsp.dmodels.at(entity.outputmodelnumber.value());
+    dmodel.headnode[0] = static_cast<int32_t>(ctx.map.bsp.dnodes.size());
     dmodel.firstface = firstface;
-    dmodel.numfaces = static_cast<int32_t>(map.bsp.dfaces.size()) - firstface;
+    dmodel.numfaces = static_cast<int32_t>(ctx.map.bsp.dfaces.size()) - firstface;
 
-    const size_t mapleafsAtStart = map.bsp.dleafs.size();
+    const size_t mapleafsAtStart = ctx.map.bsp.dleafs.size();
 
     if (headnode->is_leaf) {
-        ExportLeaf(headnode);
+        ExportLeaf(ctx, headnode);
     } else {
-        ExportDrawNodes(headnode);
+        ExportDrawNodes(ctx, headnode);
     }
 
     // count how many leafs were exported by the above calls
-    dmodel.visleafs = static_cast<int32_t>(map.bsp.dleafs.size() - mapleafsAtStart);
+    dmodel.visleafs = static_cast<int32_t>(ctx.map.bsp.dleafs.size() - mapleafsAtStart);
 
     /* remove the headnode padding */
     for (size_t i = 0; i < 3; i++) {
@@ -291,7 +292,7 @@ void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface)
     }
 
     // shrink the bounds in Q1 based games (Q1 engine compensates for this in Mod_LoadSubmodels)
-    if (qbsp_options.target_game->id != GAME_QUAKE_II) {
+    if (ctx.options.target_game->id != GAME_QUAKE_II) {
         dmodel.mins += qvec3d(1, 1, 1);
         dmodel.maxs -= qvec3d(1, 1, 1);
     }
@@ -304,33 +305,33 @@ void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface)
 BeginBSPFile
 ==================
 */
-void BeginBSPFile(void)
+void BeginBSPFile(qbsp_context_t &ctx)
 {
     // First edge must remain unused because 0 can't be negated
-    map.bsp.dedges.emplace_back();
-    Q_assert(map.bsp.dedges.size() == 1);
+    ctx.map.bsp.dedges.emplace_back();
+    Q_assert(ctx.map.bsp.dedges.size() == 1);
 
     // Leave room for leaf 0 (must be solid)
-    auto &solid_leaf = map.bsp.dleafs.emplace_back();
-    solid_leaf.contents = qbsp_options.target_game->create_solid_contents().native;
+    auto &solid_leaf = ctx.map.bsp.dleafs.emplace_back();
+    solid_leaf.contents = ctx.options.target_game->create_solid_contents().native;
     solid_leaf.cluster = CLUSTER_INVALID;
-    Q_assert(map.bsp.dleafs.size() == 1);
+    Q_assert(ctx.map.bsp.dleafs.size() == 1);
 }
 
 /*
  * Writes extended texinfo flags to a file so they can be read by the light tool.
  * Used for phong shading and other lighting settings on func_detail.
  */
-static void WriteExtendedTexinfoFlags(void)
+static void WriteExtendedTexinfoFlags(qbsp_context_t &ctx)
 {
-    auto file = fs::path(qbsp_options.bsp_path).replace_extension("texinfo.json");
+    auto file = fs::path(ctx.options.bsp_path).replace_extension("texinfo.json");
     bool needwrite = false;
 
     if (fs::exists(file)) {
         fs::remove(file);
     }
 
-    for (auto &texinfo : map.mtexinfos) {
+    for (auto &texinfo : ctx.map.mtexinfos) {
         if (texinfo.flags.needs_write()) {
             // this texinfo uses some extended flags, write them to a file
             needwrite = true;
@@ -338,11 +339,11 @@ static void WriteExtendedTexinfoFlags(void)
         }
     }
 
-    if (!needwrite || qbsp_options.noextendedsurfflags.value())
+    if (!needwrite || ctx.options.noextendedsurfflags.value())
         return;
 
     // sort by output texinfo number
-    std::vector<maptexinfo_t> texinfos_sorted(map.mtexinfos);
+    std::vector<maptexinfo_t> texinfos_sorted(ctx.map.mtexinfos);
     std::sort(texinfos_sorted.begin(), texinfos_sorted.end(),
         [](const maptexinfo_t &a, const maptexinfo_t &b) { return a.outputnum < b.outputnum; });
 
@@ -451,34 +452,34 @@ static bool Is16BitMarkfsurfaceFormat(const bspversion_t *version)
 WriteBSPFile
 =============
 */
-static void WriteBSPFile()
+static void WriteBSPFile(qbsp_context_t &ctx)
 {
     bspdata_t bspdata{};
 
-    bspdata.bsp = std::move(map.bsp);
+    bspdata.bsp = std::move(ctx.map.bsp);
 
     bspdata.version = &bspver_generic;
 
-    if (map.needslmshifts) {
-        bspdata.bspx.transfer("LMSHIFT", map.exported_lmshifts);
+    if (ctx.map.needslmshifts) {
+        bspdata.bspx.transfer("LMSHIFT", ctx.map.exported_lmshifts);
     }
-    if (!map.exported_bspxbrushes.empty()) {
-        bspdata.bspx.transfer("BRUSHLIST", map.exported_bspxbrushes);
+    if (!ctx.map.exported_bspxbrushes.empty()) {
+        bspdata.bspx.transfer("BRUSHLIST", ctx.map.exported_bspxbrushes);
     }
 
     const size_t num_faces = std::get<mbsp_t>(bspdata.bsp).dfaces.size();
 
     // convert to output format
-    if (!ConvertBSPFormat(&bspdata, qbsp_options.target_version)) {
-        const bspversion_t *extendedLimitsFormat = qbsp_options.target_version->extended_limits;
+    if (!ConvertBSPFormat(&bspdata, ctx.options.target_version)) {
+        const bspversion_t *extendedLimitsFormat = ctx.options.target_version->extended_limits;
 
         if (!extendedLimitsFormat) {
-            FError("No extended limits version of {} available", qbsp_options.target_version->name);
-        } else if (!qbsp_options.allow_upgrade.value()) {
-            FError("Limits exceeded for {} and allow_upgrade was disabled", qbsp_options.target_version->name);
+            FError("No extended limits version of {} available", ctx.options.target_version->name);
+        } else if (!ctx.options.allow_upgrade.value()) {
+            FError("Limits exceeded for {} and allow_upgrade was disabled", ctx.options.target_version->name);
         }
 
-        logging::print("NOTE: limits exceeded for {} - switching to {}\n", qbsp_options.target_version->name,
+        logging::print("NOTE: limits exceeded for {} - switching to {}\n", ctx.options.target_version->name,
             extendedLimitsFormat->name);
 
         Q_assert(ConvertBSPFormat(&bspdata, extendedLimitsFormat));
@@ -491,7 +492,7 @@ static void WriteBSPFile()
     // We don't model these as separate bspversion_t's, but this check allows -noallowupgrade
     // to force the vanilla format.
     if (Is16BitMarkfsurfaceFormat(bspdata.version) && num_faces > 32768) {
-        if (!qbsp_options.allow_upgrade.value()) {
+        if (!ctx.options.allow_upgrade.value()) {
             FError("{} faces requires an extended-limits BSP, but allow_upgrade was disabled", num_faces);
         } else {
             logging::print("WARNING: {} faces requires unsigned marksurfaces, which is not supported by all "
@@ -500,10 +501,10 @@ static void WriteBSPFile()
         }
     }
 
-    qbsp_options.bsp_path.replace_extension("bsp");
+    ctx.options.bsp_path.replace_extension("bsp");
 
-    WriteBSPFile(qbsp_options.bsp_path, &bspdata);
-    logging::print("Wrote {}\n", qbsp_options.bsp_path);
+    WriteBSPFile(ctx.options.bsp_path, &bspdata);
+    logging::print("Wrote {}\n", ctx.options.bsp_path);
 
     PrintBSPFileSizes(&bspdata);
 }
@@ -513,18 +514,18 @@ static void WriteBSPFile()
 FinishBSPFile
 ==================
 */
-void FinishBSPFile(void)
+void FinishBSPFile(qbsp_context_t &ctx)
 {
     logging::funcheader();
 
-    if (map.bsp.dvertexes.empty()) {
+    if (ctx.map.bsp.dvertexes.empty()) {
         // First vertex must remain unused because edge references it
-        map.bsp.dvertexes.emplace_back();
-        Q_assert(map.bsp.dvertexes.size() == 1);
+        ctx.map.bsp.dvertexes.emplace_back();
+        Q_assert(ctx.map.bsp.dvertexes.size() == 1);
     }
 
-    WriteExtendedTexinfoFlags();
-    WriteBSPFile();
+    WriteExtendedTexinfoFlags(ctx);
+    WriteBSPFile(ctx);
 }
 
 /*
@@ -532,27 +533,27 @@ void FinishBSPFile(void)
 UpdateBSPFileEntitiesLump
 ==================
 */
-void UpdateBSPFileEntitiesLump()
+void UpdateBSPFileEntitiesLump(qbsp_context_t &ctx)
 {
     bspdata_t bspdata;
 
-    qbsp_options.bsp_path.replace_extension("bsp");
+    ctx.options.bsp_path.replace_extension("bsp");
 
     // load the .bsp
-    LoadBSPFile(qbsp_options.bsp_path, &bspdata);
+    LoadBSPFile(ctx.options.bsp_path, &bspdata);
 
-    bspdata.version->game->init_filesystem(qbsp_options.bsp_path, qbsp_options);
+    bspdata.version->game->init_filesystem(ctx.options.bsp_path, ctx.options);
 
     ConvertBSPFormat(&bspdata, &bspver_generic);
 
     mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
 
     // replace the existing entities lump with map's exported entities
-    bsp.dentdata = std::move(map.bsp.dentdata);
+    bsp.dentdata = std::move(ctx.map.bsp.dentdata);
 
     // write the .bsp back to disk
     ConvertBSPFormat(&bspdata, bspdata.loadversion);
-    WriteBSPFile(qbsp_options.bsp_path, &bspdata);
+    WriteBSPFile(ctx.options.bsp_path, &bspdata);
 
-    logging::print("Wrote {}\n", qbsp_options.bsp_path);
+    logging::print("Wrote {}\n", ctx.options.bsp_path);
 }
@@ -0,0 +1,49 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+// compile server: reads one job per line from stdin ("qbsp <args>",
+// "vis <args>" or "light <args>"), runs it in-process and streams its log
+// to stdout, followed by a status line. archives and decoded textures are
+// kept between jobs, so only the first job against an asset tree pays for
+// mapping the paks/wads and decoding the textures.
+
+#include <server/server.hh>
+
+#include <common/fs.hh>
+#include <common/imglib.hh>
+#include <common/log.hh>
+
+#include <cstdio>
+#include <iostream>
+
+int main(int argc, const char **argv)
+{
+    logging::preinitialize();
+
+    fs::keep_archives(true);
+    img::keep_decoded(true);
+
+    // stdout goes to a client rather than a terminal
+    logging::enable_color_codes = false;
+
+    fmt::print("---- ericw-server / ericw-tools {} ----\n", ERICWTOOLS_VERSION);
+    std::fflush(stdout);
+
+    return server_main(std::cin, std::cout);
+}
@@ -0,0 +1,124 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <server/server.hh>
+
+#include <common/log.hh>
+#include <common/settings.hh>
+#include <light/light.hh>
+#include <qbsp/qbsp.hh>
+#include <vis/vis.hh>
+
+#include <cctype>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// splits a job line into arguments; whitespace separates them unless
+// it's inside double quotes
+static std::vector<std::string> split_arguments(const std::string &line)
+{
+    std::vector<std::string> args;
+    std::string current;
+    bool quoted = false, have_arg = false;
+
+    for (char c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+            have_arg = true;
+        } else if (!quoted && std::isspace(static_cast<unsigned char>(c))) {
+            if (have_arg) {
+                args.push_back(std::move(current));
+                current.clear();
+                have_arg = false;
+            }
+        } else {
+            current += c;
+            have_arg = true;
+        }
+    }
+
+    if (have_arg) {
+        args.push_back(std::move(current));
+    }
+
+    return args;
+}
+
+static int run_job(const std::vector<std::string> &args)
+{
+    const std::string &tool = args[0];
+
+    if (tool == "qbsp") {
+        std::vector<const char *> argPtrs;
+        for (const std::string &arg : args) {
+            argPtrs.push_back(arg.data());
+        }
+
+        return qbsp_main(argPtrs.size(), argPtrs.data());
+    } else if (tool == "vis") {
+        return vis_main(args);
+    } else if (tool == "light") {
+        return light_main(args);
+    }
+
+    throw std::invalid_argument(fmt::format("unknown tool '{}', expected qbsp, vis or light", tool));
+}
+
+int server_main(std::istream &jobs, std::ostream &status)
+{
+    // the tools' settings adjust the log mask; each job starts from the default
+    const auto default_mask = logging::mask;
+
+    std::string line;
+    size_t job = 0;
+
+    while (std::getline(jobs, line)) {
+        auto args = split_arguments(line);
+
+        if (args.empty() || args[0][0] == '#') {
+            continue;
+        } else if (args[0] == "quit") {
+            break;
+        }
+
+        job++;
+        logging::mask = default_mask;
+
+        int result;
+
+        try {
+            result = run_job(args);
+        } catch (const settings::quit_after_help_exception &) {
+            result = 0;
+        } catch (const std::exception &e) {
+            logging::print("************ ERROR ************\n{}\n", e.what());
+            logging::close();
+            result = 1;
+        }
+
+        status << fmt::format("---- job {} ({}) finished with status {} ----\n", job, args[0], result);
+        status.flush();
+    }
+
+    logging::mask = default_mask;
+
+    return 0;
+}
@@ -2,6 +2,13 @@
 #include <doctest/doctest.h>
 #include <common/qvec.hh>
 #include <common/polylib.hh>
+#include <light/light.hh>
+#include <light/ltface.hh>
+#include <light/trace_embree.hh>
+#include <qbsp/map.hh>
+#include <qbsp/qbsp.hh>
+#include <pareto/spatial_map.h>
+#include "test_qbsp.hh"
 
 #include <array>
 #include <vector>
@@ -78,3 +85,130 @@ TEST_CASE("SplitFace" * doctest::test_suite("benchmark"))
     // run with doctest assertions, to validate that they actually work
     test_polylib(true);
 }
+
+// the spatial_map based plane lookup that planehash_t replaced, kept for comparison
+struct spatial_map_planes_t
+{
+    std::vector<qbsp_plane_t> planes;
+    pareto::spatial_map<vec_t, 4, size_t> hash;
+
+    size_t add_or_find_plane(const qplane3d &plane)
+    {
+        constexpr vec_t HALF_NORMAL_EPSILON = NORMAL_EPSILON * 0.5;
+        constexpr vec_t HALF_DIST_EPSILON = DIST_EPSILON * 0.5;
+
+        if (auto it = hash.find_intersection(
+                {plane.normal[0] - HALF_NORMAL_EPSILON, plane.normal[1] - HALF_NORMAL_EPSILON,
+                    plane.normal[2] - HALF_NORMAL_EPSILON, plane.dist - HALF_DIST_EPSILON},
+                {plane.normal[0] + HALF_NORMAL_EPSILON, plane.normal[1] + HALF_NORMAL_EPSILON,
+                    plane.normal[2] + HALF_NORMAL_EPSILON, plane.dist + HALF_DIST_EPSILON});
+            it != hash.end()) {
+            return it->second;
+        }
+
+        for (auto &p : {qbsp_plane_t(plane), -qbsp_plane_t(plane)}) {
+            hash.emplace(pareto::point<vec_t, 4>{p.get_normal()[0], p.get_normal()[1], p.get_normal()[2], p.get_dist()},
+                planes.size());
+            planes.push_back(p);
+        }
+
+        return planes.size() - 2;
+    }
+};
+
+TEST_CASE("planehash" * doctest::test_suite("benchmark") * doctest::skip())
+{
+    // use the full plane set of a real map, including the hull expansions
+    LoadTestmapQ1("q1_mountain.map");
+
+    std::vector<qplane3d> input;
+
+    for (auto &plane : LastTestmapContext().map.planes) {
+        input.push_back(plane.get_plane());
+    }
+
+    ankerl::nanobench::Bench bench;
+    bench.relative(true).minEpochIterations(10);
+
+    bench.run("spatial_map add_or_find_plane", [&] {
+        spatial_map_planes_t planes;
+        for (auto &plane : input) {
+            ankerl::nanobench::doNotOptimizeAway(planes.add_or_find_plane(plane));
+        }
+    });
+    bench.run("planehash_t add_or_find_plane", [&] {
+        mapdata_t planes;
+        for (auto &plane : input) {
+            ankerl::nanobench::doNotOptimizeAway(planes.add_or_find_plane(plane));
+        }
+    });
+
+    // lookups only, on a populated table
+    spatial_map_planes_t spatial_map_planes;
+    mapdata_t hashed_planes;
+
+    for (auto &plane : input) {
+        spatial_map_planes.add_or_find_plane(plane);
+        hashed_planes.add_or_find_plane(plane);
+    }
+
+    CHECK(spatial_map_planes.planes.size() == hashed_planes.planes.size());
+
+    bench.run("spatial_map find", [&] {
+        for (auto &plane : input) {
+            ankerl::nanobench::doNotOptimizeAway(spatial_map_planes.add_or_find_plane(plane));
+        }
+    });
+    bench.run("planehash_t find", [&] {
+        for (auto &plane : input) {
+            ankerl::nanobench::doNotOptimizeAway(hashed_planes.find_plane_nonfatal(plane));
+        }
+    });
+}
+
+TEST_CASE("raysort" * doctest::test_suite("benchmark") * doctest::skip())
+{
+    // light a real map with and without -raysort, in rays per second of trace time; the rest of the
+    // run is the same either way and would only dilute the difference
+    LoadTestmapQ1("light_general.map");
+    const fs::path bsp_path = LastTestmapContext().options.bsp_path;
+
+    struct trace_stats_t
+    {
+        uint64_t rays = 0;
+        double seconds = 0;
+    };
+
+    auto light = [&](bool raysort) {
+        std::vector<std::string> args{"", "-nodefaultpaths", "-bounce"};
+        if (raysort) {
+            args.push_back("-raysort");
+        }
+        args.push_back(bsp_path.string());
+
+        auto ctx = std::make_unique<light_context_t>();
+        light_main(*ctx, args);
+
+        return trace_stats_t{ctx->total_traced_rays, ctx->total_trace_time_ns / 1e9};
+    };
+
+    constexpr int epochs = 3;
+    std::array<trace_stats_t, 2> stats{};
+
+    for (int i = 0; i < epochs; i++) {
+        for (bool raysort : {false, true}) {
+            const trace_stats_t run = light(raysort);
+            stats[raysort].rays += run.rays;
+            stats[raysort].seconds += run.seconds;
+        }
+    }
+
+    // sorting only changes the order the rays are traced in, not which ones are
+    CHECK(stats[false].rays == stats[true].rays);
+
+    for (bool raysort : {false, true}) {
+        fmt::print("light{}: {} rays in {:.3} thread-seconds, {:.0f} rays per second per thread\n",
+            raysort ? " -raysort" : "", stats[raysort].rays, stats[raysort].seconds,
+            stats[raysort].rays / stats[raysort].seconds);
+    }
+}
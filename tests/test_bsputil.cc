@@ -26,7 +26,8 @@ TEST_SUITE("bsputil")
         f.close();
 
         // checks on the .map file
-        auto &entity = LoadMapPath(path);
+        qbsp_context_t ctx;
+        auto &entity = LoadMapPath(ctx, path);
         CHECK(entity.mapbrushes.size() == 7); // two floor brushes
 
         // qbsp the decompiled map
@@ -69,7 +70,13 @@ TEST_SUITE("bsputil")
             INFO(texname);
             fs::data data = ar->load(texname);
             REQUIRE(data);
-            auto loaded_tex = img::load_mip(texname, data, false, bspver_q1.game);
+
+            // views are served straight out of the archive mapping
+            fs::view view = ar->load_view(texname);
+            REQUIRE(view);
+            CHECK(std::equal(view.bytes.begin(), view.bytes.end(), data->begin(), data->end()));
+
+            auto loaded_tex = img::load_mip(texname, *data, false, bspver_q1.game);
             CHECK(loaded_tex);
         }
     }
@@ -1,10 +1,23 @@
 #include <doctest/doctest.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include <common/bspfile.hh>
 #include <common/bspfile_q1.hh>
 #include <common/bspfile_q2.hh>
 #include <common/imglib.hh>
+#include <common/json.hh>
+#include <common/log.hh>
+#include <common/parallel.hh>
 #include <common/settings.hh>
 #include <testmaps.hh>
 
@@ -293,6 +306,272 @@ TEST_SUITE("common")
         CHECK(texture->width_scale == 1);
         CHECK(texture->height_scale == 1);
     }
+
+    TEST_CASE("kept archives and decoded textures are only reused while unchanged")
+    {
+        fs::keep_archives(true);
+        img::keep_decoded(true);
+
+        // a wad with one header-only mip, so only the size is decoded;
+        // `extra` pads the lump so the file can keep its size or shrink.
+        // written in place, like an editor saving over the file.
+        const fs::path wad_path = fs::temp_directory_path() / "ericw-tools-test-cache.wad";
+        auto write_wad = [&](uint32_t size, uint32_t extra) {
+            const uint32_t lump_size = 40 + extra;
+            const uint32_t file_size = 12 + lump_size + 32;
+
+            if (!fs::exists(wad_path)) {
+                std::ofstream(wad_path, std::ios::binary);
+            }
+            fs::resize_file(wad_path, file_size);
+
+            std::vector<uint8_t> bytes(file_size);
+            auto put = [&](size_t offset, const auto &value) { memcpy(bytes.data() + offset, &value, sizeof(value)); };
+            memcpy(bytes.data(), "WAD2", 4);
+            put(4, uint32_t{1});
+            put(8, uint32_t{12 + lump_size});
+            put(12 + 16, size);
+            put(12 + 20, size);
+            const size_t lump = 12 + lump_size;
+            put(lump, uint32_t{12});
+            put(lump + 4, lump_size);
+            put(lump + 8, lump_size);
+            bytes[lump + 12] = 'D';
+            memcpy(bytes.data() + lump + 16, "cachetest", 9);
+
+            std::fstream f(wad_path, std::ios::in | std::ios::out | std::ios::binary);
+            f.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+        };
+
+        auto *game = bspver_q1.game;
+        settings::common_settings settings;
+        auto load_width = [&]() {
+            auto [texture, pos, data] = img::load_texture("cachetest", false, game, settings);
+            return texture ? texture->width : 0;
+        };
+
+        write_wad(16, 64);
+        auto wad = fs::addArchive(wad_path);
+        REQUIRE(wad);
+        CHECK(load_width() == 16);
+        fs::clear();
+
+        // same size and time, so the archive is reused, but the texture
+        // has to be decoded again
+        const auto time = fs::last_write_time(wad_path);
+        write_wad(32, 64);
+        fs::last_write_time(wad_path, time);
+
+        CHECK(fs::addArchive(wad_path) == wad);
+        CHECK(load_width() == 32);
+        fs::clear();
+
+        // shrunk in place; nothing may read past the new end of the file
+        write_wad(8, 0);
+        CHECK(fs::addArchive(wad_path) != wad);
+        CHECK(load_width() == 8);
+
+        fs::keep_archives(false);
+        img::keep_decoded(false);
+        fs::clear();
+        fs::remove(wad_path);
+    }
+
+    TEST_CASE("logging writes every queued message in per-thread order")
+    {
+        settings::common_settings settings;
+        const fs::path path = fs::temp_directory_path() / "ericw-tools-test-log.log";
+
+        // enough messages to fill the queue several times over
+        constexpr int num_threads = 8;
+        constexpr int lines_per_thread = 2048;
+
+        logging::init(path, settings);
+        {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads; t++) {
+                threads.emplace_back([t]() {
+                    for (int i = 0; i < lines_per_thread; i++) {
+                        logging::print("log test {} {}\n", t, i);
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        }
+        logging::close();
+
+        std::ifstream stream(path);
+        REQUIRE(stream);
+
+        std::array<int, num_threads> next{};
+        std::string line;
+        while (std::getline(stream, line)) {
+            int t, i;
+            if (sscanf(line.c_str(), "log test %d %d", &t, &i) != 2) {
+                continue;
+            }
+            REQUIRE(t >= 0);
+            REQUIRE(t < num_threads);
+            CHECK(i == next[t]);
+            next[t] = i + 1;
+        }
+
+        for (int t = 0; t < num_threads; t++) {
+            CHECK(next[t] == lines_per_thread);
+        }
+
+        stream.close();
+        fs::remove(path);
+    }
+
+    TEST_CASE("logging keeps every message in order while the writer stops")
+    {
+        settings::common_settings settings;
+        settings.log.set_value(false, settings::source::COMMANDLINE);
+
+        constexpr int num_threads = 4;
+        constexpr int lines_per_thread = 4096;
+
+        // capture stdout, which sees messages from both the writer thread
+        // and, once it has stopped, the printing threads themselves
+        std::ostringstream captured;
+        auto *old_buf = std::cout.rdbuf(captured.rdbuf());
+        const bool old_color_codes = logging::enable_color_codes;
+        logging::enable_color_codes = false;
+
+        logging::init({}, settings);
+        {
+            std::atomic_int printed = 0;
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads; t++) {
+                threads.emplace_back([t, &printed]() {
+                    for (int i = 0; i < lines_per_thread; i++) {
+                        logging::print("stop test {} {}\n", t, i);
+                        printed++;
+                    }
+                });
+            }
+
+            // stop the writer while the threads are still printing
+            while (printed < num_threads * lines_per_thread / 4) {
+                std::this_thread::yield();
+            }
+            logging::close();
+
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        }
+
+        logging::enable_color_codes = old_color_codes;
+        std::cout.rdbuf(old_buf);
+
+        std::istringstream stream(captured.str());
+        std::array<int, num_threads> next{};
+        std::string line;
+        while (std::getline(stream, line)) {
+            int t, i;
+            if (sscanf(line.c_str(), "stop test %d %d", &t, &i) != 2) {
+                continue;
+            }
+            REQUIRE(t >= 0);
+            REQUIRE(t < num_threads);
+            CHECK(i == next[t]);
+            next[t] = i + 1;
+        }
+
+        for (int t = 0; t < num_threads; t++) {
+            CHECK(next[t] == lines_per_thread);
+        }
+    }
+
+    TEST_CASE("parallel_for_range visits every item and reports 100% exactly once")
+    {
+        const auto old_mask = logging::mask;
+        logging::mask |= logging::flag::CLOCK_ELAPSED;
+
+        std::atomic_int completions = 0, early_hundreds = 0;
+        logging::set_percent_callback([&](std::optional<uint32_t> percent, std::optional<duration> elapsed) {
+            if (elapsed) {
+                completions++;
+            } else if (percent && *percent >= 100) {
+                early_hundreds++;
+            }
+        });
+
+        for (size_t length : {0, 1, 100000}) {
+            CAPTURE(length);
+            completions = 0;
+            early_hundreds = 0;
+
+            std::vector<std::atomic_int> visits(length);
+            logging::parallel_for_range(static_cast<size_t>(0), length, 7, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    visits[i]++;
+                }
+            });
+
+            CHECK(std::all_of(visits.begin(), visits.end(), [](const auto &v) { return v == 1; }));
+            CHECK(completions == 1);
+            CHECK(early_hundreds == 0);
+        }
+
+        logging::set_percent_callback(nullptr);
+        logging::mask = old_mask;
+    }
+
+    TEST_CASE("trace records nested scopes and counters")
+    {
+        settings::common_settings settings;
+        settings.program_name = "tracetest";
+        const fs::path log_path = fs::temp_directory_path() / "ericw-tools-test-trace.log";
+        const fs::path trace_path = fs::temp_directory_path() / "ericw-tools-test-trace.json";
+        settings.log.set_value(false, settings::source::COMMANDLINE);
+        settings.trace.set_value(trace_path, settings::source::COMMANDLINE);
+
+        logging::init(log_path, settings);
+        CHECK(logging::tracing());
+        {
+            logging::timed_scope_t outer("outer");
+            for (int i = 0; i < 2; i++) {
+                logging::timed_scope_t inner("inner");
+            }
+            logging::counter("things", 42);
+        }
+        logging::close();
+        CHECK(!logging::tracing());
+
+        std::ifstream stream(trace_path);
+        REQUIRE(stream);
+        json trace = json::parse(stream);
+        stream.close();
+        fs::remove(trace_path);
+
+        const json &phases = trace.at("summary").at("phases");
+        CHECK(phases.at("outer").at("count") == 1);
+        CHECK(phases.at("inner").at("count") == 2);
+        CHECK(phases.contains("tracetest"));
+        CHECK(trace.at("summary").at("counters").at("things") == 42);
+        CHECK(trace.at("summary").at("peak_memory_bytes").get<uint64_t>() > 0);
+
+        // the inner scopes lie within the outer one
+        const json *outer = nullptr;
+        for (auto &event : trace.at("traceEvents")) {
+            if (event.at("name") == "outer") {
+                outer = &event;
+            }
+        }
+        REQUIRE(outer);
+        for (auto &event : trace.at("traceEvents")) {
+            if (event.at("name") == "inner") {
+                CHECK(event.at("ts").get<int64_t>() >= outer->at("ts").get<int64_t>());
+                CHECK(event.at("ts").get<int64_t>() + event.at("dur").get<int64_t>() <=
+                      outer->at("ts").get<int64_t>() + outer->at("dur").get<int64_t>());
+            }
+        }
+    }
 }
 
 TEST_SUITE("qmat")
@@ -1,8 +1,11 @@
 #include <doctest/doctest.h>
 
 #include <light/light.hh>
+#include <light/ltface.hh>
 #include <light/trace.hh> // for clamp_texcoord
+#include <light/trace_embree.hh> // for ~lightsurf_t
 #include <light/entities.hh>
+#include <light/lightmapfilter.hh>
 
 #include <random>
 #include <algorithm> // for std::sort
@@ -530,6 +533,111 @@ TEST_SUITE("light")
         REQUIRE(qv::epsilonEqual(qvec3f(2.5, 0, 0), res[1], static_cast<float>(POINT_EQUAL_EPSILON)));
     }
 
+    TEST_CASE("pvs_pool_t shares identical rows")
+    {
+        pvs_pool_t pool;
+        pool.reset(4);
+
+        const uint8_t a[4] = {1, 2, 3, 4};
+        const uint8_t a_copy[4] = {1, 2, 3, 4};
+        const uint8_t b[4] = {1, 2, 3, 5};
+
+        const uint8_t *pooled_a = pool.intern(a);
+        CHECK(pooled_a != a);
+        CHECK(pool.intern(a_copy) == pooled_a);
+        CHECK(pool.intern(b) != pooled_a);
+        CHECK(pool.size() == 2);
+        CHECK(std::equal(a, a + 4, pooled_a));
+    }
+
+    // a flat w*h face with one unit between samples, for the -dirtstep tests
+    static void MakeDirtTestSurface(lightsurf_t &surf, int w, int h)
+    {
+        surf.width = w;
+        surf.height = h;
+        surf.samples.resize(w * h);
+
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                auto &sample = surf.samples[y * w + x];
+                sample.point = {static_cast<vec_t>(x), static_cast<vec_t>(y), 0};
+                sample.normal = {0, 0, 1};
+                sample.occluded = false;
+                sample.occlusion = -1.0f;
+            }
+        }
+    }
+
+    // stands in for tracing the dirt rays, with the occlusion given by a function of the sample point
+    static dirt_trace_fn DirtTestTrace(std::function<float(const qvec3d &)> occlusion_at, int &traces)
+    {
+        return [occlusion_at, &traces](lightsurf_t *surf, const std::vector<uint8_t> &traced) {
+            for (size_t i = 0; i < surf->samples.size(); i++) {
+                if (traced.empty() || traced[i]) {
+                    surf->samples[i].occlusion = occlusion_at(surf->samples[i].point);
+                    traces++;
+                }
+            }
+        };
+    }
+
+    TEST_CASE("dirtstep 1 traces every sample")
+    {
+        // uncorrelated between neighbours, so any interpolation would show
+        std::mt19937 engine(0);
+        std::uniform_real_distribution<float> unit(0, 1);
+        std::vector<float> noise(13 * 7);
+        for (auto &n : noise) {
+            n = unit(engine);
+        }
+        auto occlusion_at = [&](const qvec3d &point) {
+            return noise[static_cast<int>(point[1]) * 13 + static_cast<int>(point[0])];
+        };
+
+        lightsurf_t expected, stepped;
+        MakeDirtTestSurface(expected, 13, 7);
+        MakeDirtTestSurface(stepped, 13, 7);
+
+        int expected_traces = 0, stepped_traces = 0;
+        DirtTestTrace(occlusion_at, expected_traces)(&expected, {});
+
+        light_context_t ctx;
+        LightFace_CalculateDirtStepped(ctx, &stepped, 1, false, DirtTestTrace(occlusion_at, stepped_traces));
+
+        CHECK(stepped_traces == expected_traces);
+        CHECK(ctx.total_dirt_traced == stepped.samples.size());
+        for (size_t i = 0; i < stepped.samples.size(); i++) {
+            CHECK(stepped.samples[i].occlusion == expected.samples[i].occlusion);
+        }
+    }
+
+    TEST_CASE("dirtstep refines dirt edges")
+    {
+        // a smooth gradient, which interpolates exactly, with a hard dirt edge
+        // part way between two grid columns
+        auto occlusion_at = [](const qvec3d &point) {
+            return static_cast<float>(0.005 * point[0] + 0.01 * point[1] + (point[0] >= 10.0 ? 0.5 : 0.0));
+        };
+
+        lightsurf_t surf;
+        MakeDirtTestSurface(surf, 17, 17);
+
+        int traces = 0;
+        light_context_t ctx;
+        LightFace_CalculateDirtStepped(ctx, &surf, 4, true, DirtTestTrace(occlusion_at, traces));
+
+        // only the 5x5 grid and the column of cells across the edge are traced...
+        CHECK(ctx.total_dirt_traced == (5 * 5) + (3 * 17));
+        // ...and -dirtsteperror traces everything again
+        CHECK(traces == ctx.total_dirt_traced + surf.samples.size());
+
+        // the edge is as sharp as tracing every sample, within float rounding
+        CHECK(ctx.max_dirtstep_error_micro <= 1);
+        for (auto &sample : surf.samples) {
+            CHECK(sample.occlusion == doctest::Approx(occlusion_at(sample.point)).epsilon(1e-5));
+        }
+    }
+
 // FIXME: this is failing
 #if 0
 TEST_CASE("RandomPointInPoly") {
@@ -1022,3 +1130,261 @@ TEST_SUITE("settings")
         CHECK(LF_INVERSE2 == light.formula.value());
     }
 }
+
+TEST_SUITE("lightmapfilter")
+{
+    // the original per-sample implementations of the filters in
+    // light/lightmapfilter.cc, kept here as a reference
+
+    static std::vector<qvec4f> ScalarIntegerDownsampleImage(const std::vector<qvec4f> &input, int w, int h, int factor)
+    {
+        Q_assert(factor >= 1);
+        if (factor == 1)
+            return input;
+
+        const int outw = w / factor;
+        const int outh = h / factor;
+
+        std::vector<qvec4f> res(static_cast<size_t>(outw * outh));
+
+        for (int y = 0; y < outh; y++) {
+            for (int x = 0; x < outw; x++) {
+
+                float totalWeight = 0.0f;
+                qvec3f totalColor{};
+
+                // These are only used if all the samples in the kernel have alpha = 0
+                float totalWeightIgnoringOcclusion = 0.0f;
+                qvec3f totalColorIgnoringOcclusion{};
+
+                const int extraradius = 0;
+                const int kernelextent = factor + (2 * extraradius);
+
+                for (int y0 = 0; y0 < kernelextent; y0++) {
+                    for (int x0 = 0; x0 < kernelextent; x0++) {
+                        const int x1 = (x * factor) - extraradius + x0;
+                        const int y1 = (y * factor) - extraradius + y0;
+
+                        // check if the kernel goes outside of the source image
+                        if (x1 < 0 || x1 >= w)
+                            continue;
+                        if (y1 < 0 || y1 >= h)
+                            continue;
+
+                        // read the input sample
+                        const float weight = 1.0f;
+                        const qvec4f &inSample = input.at((y1 * w) + x1);
+
+                        totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
+                        totalWeightIgnoringOcclusion += weight;
+
+                        // Occluded sample points don't contribute to the filter
+                        if (inSample[3] == 0.0f)
+                            continue;
+
+                        totalColor += qvec3f(inSample) * weight;
+                        totalWeight += weight;
+                    }
+                }
+
+                const int outIndex = (y * outw) + x;
+                if (totalWeight > 0.0f) {
+                    const qvec3f tmp = totalColor / totalWeight;
+                    const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
+                    res[outIndex] = resultColor;
+                } else {
+                    const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
+                    const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
+                    res[outIndex] = resultColor;
+                }
+            }
+        }
+
+        return res;
+    }
+
+    static std::vector<qvec4f> ScalarFloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
+    {
+        // transparent pixels take the average of their neighbours.
+
+        std::vector<qvec4f> res(input);
+
+        while (1) {
+            int unhandled_pixels = 0;
+
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    const int i = (y * w) + x;
+                    const qvec4f &inSample = res.at(i);
+
+                    if (inSample[3] == 0) {
+                        // average the neighbouring non-transparent samples
+
+                        int opaque_neighbours = 0;
+                        qvec3f neighbours_sum{};
+                        for (int y0 = -1; y0 <= 1; y0++) {
+                            for (int x0 = -1; x0 <= 1; x0++) {
+                                const int x1 = x + x0;
+                                const int y1 = y + y0;
+
+                                if (x1 < 0 || x1 >= w)
+                                    continue;
+                                if (y1 < 0 || y1 >= h)
+                                    continue;
+
+                                const qvec4f neighbourSample = res.at((y1 * w) + x1);
+                                if (neighbourSample[3] == 1) {
+                                    opaque_neighbours++;
+                                    neighbours_sum += qvec3f(neighbourSample);
+                                }
+                            }
+                        }
+
+                        if (opaque_neighbours > 0) {
+                            neighbours_sum *= (1.0f / (float)opaque_neighbours);
+                            res.at(i) = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
+
+                            // this sample is now opaque
+                        } else {
+                            unhandled_pixels++;
+
+                            // all neighbours are transparent. need to perform more iterations (or the whole lightmap is
+                            // transparent).
+                        }
+                    }
+                }
+            }
+
+            if (unhandled_pixels == input.size()) {
+                break;
+            }
+
+            if (unhandled_pixels == 0)
+                break; // all done
+        }
+
+        return res;
+    }
+
+    static std::vector<qvec4f> ScalarBoxBlurImage(const std::vector<qvec4f> &input, int w, int h, int radius)
+    {
+        std::vector<qvec4f> res(input.size());
+
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+
+                float totalWeight = 0.0f;
+                qvec3f totalColor{};
+
+                // These are only used if all the samples in the kernel have alpha = 0
+                float totalWeightIgnoringOcclusion = 0.0f;
+                qvec3f totalColorIgnoringOcclusion{};
+
+                for (int y0 = -radius; y0 <= radius; y0++) {
+                    for (int x0 = -radius; x0 <= radius; x0++) {
+                        const int x1 = std::clamp(x + x0, 0, w - 1);
+                        const int y1 = std::clamp(y + y0, 0, h - 1);
+
+                        // check if the kernel goes outside of the source image
+
+                        // 2017-09-16: this is a hack, but clamping the
+                        // x/y instead of discarding the samples outside of the
+                        // kernel looks better in some cases:
+                        // https://github.com/ericwa/ericw-tools/issues/171
+#if 0
+                        if (x1 < 0 || x1 >= w)
+                            continue;
+                        if (y1 < 0 || y1 >= h)
+                            continue;
+#endif
+
+                        // read the input sample
+                        const float weight = 1.0f;
+                        const qvec4f &inSample = input.at((y1 * w) + x1);
+
+                        totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
+                        totalWeightIgnoringOcclusion += weight;
+
+                        // Occluded sample points don't contribute to the filter
+                        if (inSample[3] == 0.0f)
+                            continue;
+
+                        totalColor += qvec3f(inSample) * weight;
+                        totalWeight += weight;
+                    }
+                }
+
+                const int outIndex = (y * w) + x;
+                if (totalWeight > 0.0f) {
+                    const qvec3f tmp = totalColor / totalWeight;
+                    const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
+                    res[outIndex] = resultColor;
+                } else {
+                    const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
+                    const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
+                    res[outIndex] = resultColor;
+                }
+            }
+        }
+
+        return res;
+    }
+
+    static void CheckImagesMatch(const std::vector<qvec4f> &expected, const lightmap_image_t &actual, float epsilon)
+    {
+        REQUIRE(expected.size() == actual.size());
+
+        for (size_t i = 0; i < expected.size(); i++) {
+            const qvec4f sample = actual.get(i);
+
+            for (int c = 0; c < 4; c++) {
+                INFO("sample ", i, " channel ", c);
+                if (epsilon == 0.0f) {
+                    CHECK(sample[c] == expected[i][c]);
+                } else {
+                    CHECK(sample[c] == doctest::Approx(expected[i][c]).epsilon(epsilon));
+                }
+            }
+        }
+    }
+
+    TEST_CASE("image filters match the scalar versions")
+    {
+        std::mt19937 engine(0);
+        std::uniform_real_distribution<float> color(0, 300), unit(0, 1);
+
+        for (int iteration = 0; iteration < 200; iteration++) {
+            const int factor = 1 + (iteration % 4);
+            const int w = factor * (1 + (engine() % 9));
+            const int h = factor * (1 + (engine() % 9));
+            const int radius = engine() % 4;
+            const float transparent_fraction = (iteration % 5) * 0.25f;
+
+            std::vector<qvec4f> scalar(w * h);
+            lightmap_image_t image;
+            image.resize(w, h);
+
+            for (size_t i = 0; i < scalar.size(); i++) {
+                const float alpha = unit(engine) < transparent_fraction ? 0.f : 1.f;
+                scalar[i] = {color(engine), color(engine), color(engine), alpha};
+                image.set(i, scalar[i]);
+            }
+
+            INFO(w, "x", h, " radius ", radius, " factor ", factor);
+
+            // flood fill and downsampling add up the same samples in the same order, so match exactly
+            scalar = ScalarFloodFillTransparent(scalar, w, h);
+            FloodFillTransparent(image);
+            CheckImagesMatch(scalar, image, 0.0f);
+
+            lightmap_image_t downsampled;
+            IntegerDownsampleImage(image, downsampled, factor);
+            CheckImagesMatch(ScalarIntegerDownsampleImage(scalar, w, h, factor), downsampled, 0.0f);
+
+            // the blur is done as two passes, so is only close
+            lightmap_image_t blurred;
+            BoxBlurImage(image, blurred, radius);
+            CheckImagesMatch(ScalarBoxBlurImage(scalar, w, h, radius), blurred, 1e-5f);
+        }
+    }
+}
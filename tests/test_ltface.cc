@@ -1,13 +1,30 @@
 #include <doctest/doctest.h>
 
 #include <light/light.hh>
+#include <light/ltface.hh>
+#include <light/phong.hh>
 #include <light/surflight.hh>
 #include <common/bspinfo.hh>
+#include <common/bsputils.hh>
 #include <qbsp/qbsp.hh>
+#include <qbsp/map.hh>
 #include <testmaps.hh>
 #include <vis/vis.hh>
 #include "test_qbsp.hh"
 
+#include <map>
+#include <set>
+#include <unordered_map>
+
+// the context of the last QbspVisLight_Common() run; replaced by the next one
+static std::unique_ptr<light_context_t> last_light_context;
+
+light_context_t &LastLightContext()
+{
+    Q_assert(last_light_context != nullptr);
+    return *last_light_context;
+}
+
 static testresults_t QbspVisLight_Common(const std::filesystem::path &name, std::vector<std::string> extra_qbsp_args,
     std::vector<std::string> extra_light_args, runvis_t run_vis)
 {
@@ -31,8 +48,9 @@ static testresults_t QbspVisLight_Common(const std::filesystem::path &name, std:
 
     // run qbsp
 
-    InitQBSP(args);
-    ProcessFile();
+    qbsp_context_t ctx;
+    InitQBSP(ctx, args);
+    ProcessFile(ctx);
 
     // run vis
     if (run_vis == runvis_t::yes) {
@@ -55,7 +73,8 @@ static testresults_t QbspVisLight_Common(const std::filesystem::path &name, std:
         }
         light_args.push_back(bsp_path.string());
 
-        light_main(light_args);
+        last_light_context = std::make_unique<light_context_t>();
+        light_main(*last_light_context, light_args);
     }
 
     // serialize obj
@@ -67,7 +86,7 @@ static testresults_t QbspVisLight_Common(const std::filesystem::path &name, std:
 
         // write to .json for inspection
         serialize_bsp(
-            bspdata, std::get<mbsp_t>(bspdata.bsp), fs::path(qbsp_options.bsp_path).replace_extension(".bsp.json"));
+            bspdata, std::get<mbsp_t>(bspdata.bsp), fs::path(ctx.options.bsp_path).replace_extension(".bsp.json"));
 
         return {std::move(std::get<mbsp_t>(bspdata.bsp)), std::move(bspdata.bspx.entries)};
     }
@@ -295,6 +314,240 @@ TEST_CASE("q2_phong_doesnt_cross_contents")
     auto [bsp, bspx] = QbspVisLight_Q2("q2_phong_doesnt_cross_contents.map", {"-wrnormals"});
 }
 
+// the original map-based phong smoothing, kept as a reference for CalculateVertexNormals
+struct reference_phong_t
+{
+    std::map<const mface_t *, std::set<const mface_t *>> smoothFaces;
+    std::map<std::pair<int, int>, std::vector<const mface_t *>> edgeToFaces;
+    std::unordered_map<const mface_t *, std::vector<face_normal_t>> vertexNormals;
+};
+
+static float ReferenceAngleBetweenPoints(const qvec3f &p1, const qvec3f &p2, const qvec3f &p3)
+{
+    const qvec3f d1 = p1 - p2;
+    const qvec3f d2 = p3 - p2;
+    float length_product = (qv::length(d1) * qv::length(d2));
+    if (length_product == 0)
+        return 0;
+    return acos(std::clamp(qv::dot(d1, d2) / length_product, -1.0f, 1.0f));
+}
+
+static reference_phong_t ReferencePhong(const light_context_t &ctx, const mbsp_t *bsp)
+{
+    reference_phong_t result;
+    std::map<int, std::vector<const mface_t *>> vertsToFaces;
+
+    for (auto &f : bsp->dfaces) {
+        for (int j = 0; j < f.numedges; j++) {
+            const int v0 = Face_VertexAtIndex(bsp, &f, j);
+            const int v1 = Face_VertexAtIndex(bsp, &f, (j + 1) % f.numedges);
+
+            vertsToFaces[v0].push_back(&f);
+
+            if (v0 == v1)
+                continue;
+
+            auto &edgeFaces = result.edgeToFaces[std::make_pair(v0, v1)];
+            if (std::find(edgeFaces.begin(), edgeFaces.end(), &f) == edgeFaces.end())
+                edgeFaces.push_back(&f);
+        }
+    }
+
+    auto phong_angles = [&ctx, bsp](const mface_t *f) {
+        const int phongValue = Q2_FacePhongValue(ctx, bsp, f);
+        vec_t angle = ctx.extended_texinfo_flags[f->texinfo].phong_angle;
+        if (angle == 0 && phongValue != 0)
+            angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
+        vec_t angle_concave = ctx.extended_texinfo_flags[f->texinfo].phong_angle_concave;
+        if (angle_concave == 0)
+            angle_concave = angle;
+        const bool wants_phong = (angle || angle_concave) && !ctx.extended_texinfo_flags[f->texinfo].no_phong;
+        return std::make_tuple(phongValue, angle, angle_concave, wants_phong);
+    };
+
+    for (auto &f : bsp->dfaces) {
+        const auto [f_phongValue, f_phong_angle, f_phong_angle_concave, f_wants_phong] = phong_angles(&f);
+        if (!f_wants_phong)
+            continue;
+
+        auto *f_texinfo = Face_Texinfo(bsp, &f);
+        const qvec3d f_norm = Face_Normal(bsp, &f);
+        const qplane3d f_plane = Face_Plane(bsp, &f);
+
+        for (int j = 0; j < f.numedges; j++) {
+            for (const mface_t *f2 : vertsToFaces[Face_VertexAtIndex(bsp, &f, j)]) {
+                if (f2 == &f)
+                    continue;
+
+                const auto [f2_phongValue, f2_phong_angle, f2_phong_angle_concave, f2_wants_phong] = phong_angles(f2);
+                if (!f2_wants_phong)
+                    continue;
+
+                auto *f2_texinfo = Face_Texinfo(bsp, f2);
+                if (f2_texinfo != nullptr && f_texinfo != nullptr &&
+                    !bsp->loadversion->game->surfflags_may_phong(f_texinfo->flags, f2_texinfo->flags))
+                    continue;
+
+                const auto f2_points = Face_Points(bsp, f2);
+                const qvec3f f2_centroid = qv::PolyCentroid(f2_points.begin(), f2_points.end());
+                const bool concave = f_plane.dist_above(f2_centroid) > 0.1;
+                const vec_t min_threshold = std::min(concave ? f_phong_angle_concave : f_phong_angle,
+                    concave ? f2_phong_angle_concave : f2_phong_angle);
+
+                if (f_phongValue != f2_phongValue)
+                    continue;
+
+                if (qv::dot(f_norm, Face_Normal(bsp, f2)) >= cos(DEG2RAD(min_threshold)))
+                    result.smoothFaces[&f].insert(f2);
+            }
+        }
+    }
+
+    for (auto &f : bsp->dfaces) {
+        if (f.numedges < 3)
+            continue;
+
+        const qvec3f f_norm = Face_Normal(bsp, &f);
+        const auto t1 = TexSpaceToWorld(bsp, &f);
+        const qvec3f f_tangent = t1.col(0).xyz(), f_bitangent = qv::normalize(t1.col(1).xyz());
+
+        std::vector<const mface_t *> fPlusNeighbours{&f};
+        if (auto it = result.smoothFaces.find(&f); it != result.smoothFaces.end())
+            fPlusNeighbours.insert(fPlusNeighbours.end(), it->second.begin(), it->second.end());
+
+        std::unordered_map<int, face_normal_t> smoothedNormals;
+
+        for (auto f2 : fPlusNeighbours) {
+            const auto f2_poly = Face_Points(bsp, f2);
+            const float f2_area = qv::PolyArea(f2_poly.begin(), f2_poly.end());
+            const qvec3f f2_norm = Face_Normal(bsp, f2);
+            const auto t2 = TexSpaceToWorld(bsp, f2);
+            const qvec3f f2_tangent = t2.col(0).xyz(), f2_bitangent = qv::normalize(t2.col(1).xyz());
+
+            for (int j = 0; j < f2->numedges; j++) {
+                const int prev = Face_VertexAtIndex(bsp, f2, (j + f2->numedges - 1) % f2->numedges);
+                const int curr = Face_VertexAtIndex(bsp, f2, j);
+                const int next = Face_VertexAtIndex(bsp, f2, (j + 1) % f2->numedges);
+
+                float weight = f2_area * ReferenceAngleBetweenPoints(Vertex_GetPos(bsp, prev),
+                                             Vertex_GetPos(bsp, curr), Vertex_GetPos(bsp, next));
+                if (!std::isfinite(weight))
+                    weight = 0;
+
+                auto &n = smoothedNormals[curr];
+                n.normal += f2_norm * weight;
+                n.tangent += f2_tangent * weight;
+                n.bitangent += f2_bitangent * weight;
+            }
+        }
+
+        for (auto &[v, n] : smoothedNormals) {
+            if (0 == qv::length(n.normal)) {
+                n = {f_norm, f_tangent, f_bitangent};
+            } else {
+                n = {qv::normalize(n.normal), qv::normalize(n.tangent), qv::normalize(n.bitangent)};
+            }
+            if (std::isnan(n.tangent[0]))
+                n.tangent = std::isnan(f_tangent[0]) ? qvec3f{} : f_tangent;
+            if (std::isnan(n.bitangent[0]))
+                n.bitangent = std::isnan(f_bitangent[0]) ? qvec3f{} : f_bitangent;
+        }
+
+        for (int j = 0; j < f.numedges; j++) {
+            result.vertexNormals[&f].push_back(smoothedNormals.at(Face_VertexAtIndex(bsp, &f, j)));
+        }
+    }
+
+    return result;
+}
+
+static const mface_t *ReferenceEdgeIndexSmoothed(
+    const reference_phong_t &reference, const mbsp_t *bsp, const mface_t *f, int edgeindex)
+{
+    const int v0 = Face_VertexAtIndex(bsp, f, edgeindex);
+    const int v1 = Face_VertexAtIndex(bsp, f, (edgeindex + 1) % f->numedges);
+
+    auto it = reference.edgeToFaces.find(std::make_pair(v1, v0));
+    if (it == reference.edgeToFaces.end())
+        return nullptr;
+
+    for (const mface_t *neighbour : it->second) {
+        if (neighbour == f)
+            continue;
+
+        const bool sameplane = (neighbour->planenum == f->planenum && neighbour->side == f->side);
+        auto smoothed = reference.smoothFaces.find(f);
+        if (sameplane || (smoothed != reference.smoothFaces.end() && smoothed->second.count(neighbour)))
+            return neighbour;
+    }
+    return nullptr;
+}
+
+static void CheckPhongMatchesReference(light_context_t &ctx, mbsp_t &bsp)
+{
+    // CalculateVertexNormals reads the per-model _phong keys through the modelinfo,
+    // which only light sets up; the fixtures request phong through texinfo instead
+    bsp.dmodels.clear();
+
+    CalculateVertexNormals(ctx, &bsp);
+
+    const reference_phong_t reference = ReferencePhong(ctx, &bsp);
+    CHECK(!reference.smoothFaces.empty());
+
+    for (auto &f : bsp.dfaces) {
+        INFO("face ", Face_GetNum(&bsp, &f));
+
+        const auto smoothed = GetSmoothFaces(ctx, &f);
+        auto it = reference.smoothFaces.find(&f);
+        CHECK(std::set<const mface_t *>(smoothed.begin(), smoothed.end()) ==
+              (it == reference.smoothFaces.end() ? std::set<const mface_t *>{} : it->second));
+
+        if (f.numedges < 3)
+            continue;
+
+        for (int j = 0; j < f.numedges; j++) {
+            const face_normal_t &normal = GetSurfaceVertexNormal(ctx, &bsp, &f, j);
+            const face_normal_t &expected = reference.vertexNormals.at(&f)[j];
+
+            CHECK(normal.normal == expected.normal);
+            CHECK(normal.tangent == expected.tangent);
+            CHECK(normal.bitangent == expected.bitangent);
+            CHECK(Face_EdgeIndexSmoothed(ctx, &bsp, &f, j) == ReferenceEdgeIndexSmoothed(reference, &bsp, &f, j));
+        }
+    }
+}
+
+TEST_CASE("phong adjacency matches the map-based version")
+{
+    {
+        INFO("q1: phong angles, concave angles and groups from the texinfo flags");
+
+        auto [bsp, bspx, prt] = LoadTestmapQ1("phongtest2.map");
+
+        light_context_t ctx;
+        ctx.extended_texinfo_flags.assign(bsp.texinfo.size(), {});
+        for (size_t i = 0; i < ctx.extended_texinfo_flags.size(); i++) {
+            ctx.extended_texinfo_flags[i].phong_angle = 40 + (i % 4) * 20;
+            if (i % 3 == 0) {
+                ctx.extended_texinfo_flags[i].phong_angle_concave = 95;
+            }
+            ctx.extended_texinfo_flags[i].phong_group = i % 5 == 0 ? 2 : 1;
+        }
+
+        CheckPhongMatchesReference(ctx, bsp);
+    }
+
+    {
+        INFO("q2: phong groups from the texinfo values");
+
+        auto [bsp, bspx, prt] = LoadTestmapQ2("q2_phong_doesnt_cross_contents.map");
+
+        light_context_t ctx;
+        ctx.extended_texinfo_flags.assign(bsp.texinfo.size(), {});
+        CheckPhongMatchesReference(ctx, bsp);
+    }
+}
+
 TEST_CASE("q2_minlight_nomottle")
 {
     INFO("_minlightMottle 0 works on worldspawn");
@@ -605,6 +858,129 @@ TEST_CASE("q2_light_sun")
     CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {220, 0, 0}, shadow_pos + qvec3d{-128, 0, 0});
 }
 
+TEST_CASE("q2_light_sunlight2 -skydomesamples")
+{
+    const qvec3d open_pos{1112 + 48, 1248, 944};
+
+    auto luxel_at = [&](const mbsp_t &bsp) {
+        auto *face = BSP_FindFaceAtPoint(&bsp, &bsp.dmodels[0], open_pos);
+        REQUIRE(face);
+        faceextents_t extents(*face, bsp, LMSCALE_DEFAULT);
+        const auto coord = extents.worldToLMCoord(open_pos);
+        return LM_Sample(&bsp, nullptr, extents, face->lightofs, qvec2i(round(coord[0]), round(coord[1])));
+    };
+
+    const qvec3b legacy =
+        luxel_at(QbspVisLight_Q2("q2_light_sunlight_default_mangle.map", {"-sunlight2", "100"}).bsp);
+
+    // seeds change the noise, not the result; both should land near the ring of suns
+    for (const char *seed : {"0", "1"}) {
+        const qvec3b sampled = luxel_at(QbspVisLight_Q2("q2_light_sunlight_default_mangle.map",
+            {"-sunlight2", "100", "-skydomesamples", "256", "-skydomeseed", seed})
+                                            .bsp);
+
+        INFO("legacy: ", legacy, " sampled: ", sampled);
+        for (int i = 0; i < 3; i++) {
+            CHECK(abs(int(legacy[i]) - int(sampled[i])) <= 4);
+        }
+    }
+}
+
+TEST_CASE("q2_light_sun -extra_adaptive")
+{
+    auto [full_bsp, full_bspx] = QbspVisLight_Q2("q2_light_sun.map", {"-extra4"});
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_light_sun.map", {"-extra4", "-extra_adaptive", "4"});
+
+    INFO("adaptive supersampling should match -extra4 to within a few levels");
+    REQUIRE(full_bsp.dlightdata.size() == bsp.dlightdata.size());
+    int max_diff = 0;
+    for (size_t i = 0; i < bsp.dlightdata.size(); i++) {
+        max_diff = std::max(max_diff, abs(int(full_bsp.dlightdata[i]) - int(bsp.dlightdata[i])));
+    }
+    CHECK(max_diff <= 8);
+
+    const qvec3d shadow_pos{1084, 1284, 944};
+    CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {0, 0, 0}, shadow_pos);
+}
+
+TEST_CASE("-bounce output doesn't depend on thread scheduling")
+{
+    auto [first_bsp, first_bspx] = QbspVisLight_Q2("q2_light_sun.map", {"-bounce"});
+    auto [second_bsp, second_bspx] = QbspVisLight_Q2("q2_light_sun.map", {"-bounce"});
+
+    CHECK(first_bsp.dlightdata == second_bsp.dlightdata);
+}
+
+TEST_CASE("-bounces adds light without tracing more bounces")
+{
+    auto [one_bsp, one_bspx] = QbspVisLight_Q2("q2_light_sun.map", {"-bounce"});
+    auto [three_bsp, three_bspx] = QbspVisLight_Q2("q2_light_sun.map", {"-bounce", "-bounces", "3"});
+
+    REQUIRE(one_bsp.dlightdata.size() == three_bsp.dlightdata.size());
+
+    int64_t one_total = 0, three_total = 0;
+    for (size_t i = 0; i < one_bsp.dlightdata.size(); i++) {
+        one_total += one_bsp.dlightdata[i];
+        three_total += three_bsp.dlightdata[i];
+    }
+    CHECK(three_total > one_total);
+}
+
+TEST_CASE("lightmaps are laid out in face order")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_light_sun.map", {});
+
+    int32_t last_lightofs = -1;
+    for (const mface_t &face : bsp.dfaces) {
+        if (face.lightofs == -1) {
+            continue;
+        }
+        CHECK(face.lightofs > last_lightofs);
+        last_lightofs = face.lightofs;
+    }
+    CHECK(last_lightofs < static_cast<int32_t>(bsp.dlightdata.size()));
+}
+
+TEST_CASE("-dedup_lightmaps shrinks lighting without changing any face's lightmap")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_light_sun.map", {});
+    auto [dedup_bsp, dedup_bspx] = QbspVisLight_Q2("q2_light_sun.map", {"-dedup_lightmaps"});
+
+    CHECK(dedup_bsp.dlightdata.size() < bsp.dlightdata.size());
+
+    REQUIRE(bsp.dfaces.size() == dedup_bsp.dfaces.size());
+    for (size_t i = 0; i < bsp.dfaces.size(); i++) {
+        const mface_t &face = bsp.dfaces[i];
+        const mface_t &dedup_face = dedup_bsp.dfaces[i];
+
+        REQUIRE((face.lightofs == -1) == (dedup_face.lightofs == -1));
+        if (face.lightofs == -1) {
+            continue;
+        }
+
+        const int numstyles = std::count_if(
+            std::begin(face.styles), std::end(face.styles), [](uint8_t style) { return style != 255; });
+        const size_t bytes = faceextents_t(face, bsp, LMSCALE_DEFAULT).numsamples() * numstyles * 3;
+
+        INFO("face ", i);
+        CHECK(std::equal(bsp.dlightdata.begin() + face.lightofs, bsp.dlightdata.begin() + face.lightofs + bytes,
+            dedup_bsp.dlightdata.begin() + dedup_face.lightofs));
+    }
+}
+
+TEST_CASE("-shadowprepass conservative doesn't change output")
+{
+    // the floor is subdivided, and the chunks away from the walls have nothing between them and the light
+    auto [traced_bsp, traced_bspx] = QbspVisLight_Q2("q2_light_shadowprepass.map", {});
+    auto [prepass_bsp, prepass_bspx] =
+        QbspVisLight_Q2("q2_light_shadowprepass.map", {"-shadowprepass", "conservative"});
+
+    // make sure the prepass actually skipped some tracing
+    CHECK(LastLightContext().total_prepass_lit + LastLightContext().total_prepass_shadowed > 0);
+
+    CHECK(traced_bsp.dlightdata == prepass_bsp.dlightdata);
+}
+
 TEST_CASE("q2_light_origin_brush_shadow")
 {
     auto [bsp, bspx] = QbspVisLight_Q2("q2_light_origin_brush_shadow.map", {});
@@ -633,7 +1009,7 @@ TEST_CASE("q2_surface_lights_culling" * doctest::may_fail())
 {
     auto [bsp, bspx] = QbspVisLight_Q2("q2_surface_lights_culling.map", {});
 
-    CHECK(7 == GetSurflightPoints());
+    CHECK(7 == LastLightContext().total_surflight_points);
 
     CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {155, 78, 39}, {-480, 168, 64});
 }
@@ -18,11 +18,11 @@
 #include <stdexcept>
 #include <tuple>
 #include <map>
+#include <set>
 #include <doctest/doctest.h>
+#include <tbb/parallel_for.h>
 #include "testutils.hh"
 
-// FIXME: Clear global data (planes, etc) between each test
-
 const mapface_t *Mapbrush_FirstFaceWithTextureName(const mapbrush_t &brush, const std::string &texname)
 {
     for (auto &face : brush.faces) {
@@ -33,37 +33,42 @@ const mapface_t *Mapbrush_FirstFaceWithTextureName(const mapbrush_t &brush, cons
     return nullptr;
 }
 
-mapentity_t &LoadMap(const char *map, size_t length)
+mapentity_t &LoadMap(qbsp_context_t &ctx, const char *map, size_t length)
 {
-    ::map.reset();
-    qbsp_options.reset();
-
-    qbsp_options.target_version = &bspver_q1;
-    qbsp_options.target_game = qbsp_options.target_version->game;
+    ctx.options.target_version = &bspver_q1;
+    ctx.options.target_game = ctx.options.target_version->game;
 
     parser_t parser(map, length, {doctest::getContextOptions()->currentTest->m_name});
 
-    mapentity_t &entity = ::map.entities.emplace_back();
+    mapentity_t &entity = ctx.map.entities.emplace_back();
     texture_def_issues_t issue_stats;
 
-    // FIXME: adds the brush to the global map...
-    Q_assert(ParseEntity(parser, entity, issue_stats));
+    Q_assert(ParseEntity(ctx, parser, entity, issue_stats));
 
-    CalculateWorldExtent();
+    CalculateWorldExtent(ctx);
 
     return entity;
 }
 
-mapentity_t &LoadMap(const char *map)
+mapentity_t &LoadMap(qbsp_context_t &ctx, const char *map)
 {
-    return LoadMap(map, strlen(map));
+    return LoadMap(ctx, map, strlen(map));
 }
 
-mapentity_t &LoadMapPath(const std::filesystem::path &name)
+mapentity_t &LoadMapPath(qbsp_context_t &ctx, const std::filesystem::path &name)
 {
     auto filename = std::filesystem::path(testmaps_dir) / name;
     fs::data file_data = fs::load(filename);
-    return LoadMap(reinterpret_cast<const char *>(file_data->data()), file_data->size());
+    return LoadMap(ctx, reinterpret_cast<const char *>(file_data->data()), file_data->size());
+}
+
+// the context of the last LoadTestmap() run; replaced by the next one
+static std::unique_ptr<qbsp_context_t> last_testmap_context;
+
+qbsp_context_t &LastTestmapContext()
+{
+    Q_assert(last_testmap_context != nullptr);
+    return *last_testmap_context;
 }
 
 #include <common/bspinfo.hh>
@@ -87,19 +92,22 @@ std::tuple<mbsp_t, bspxentries_t, std::optional<prtfile_t>> LoadTestmap(
 
     // run qbsp
 
-    InitQBSP(args);
-    ProcessFile();
+    last_testmap_context = std::make_unique<qbsp_context_t>();
+    qbsp_context_t &ctx = *last_testmap_context;
+
+    InitQBSP(ctx, args);
+    ProcessFile(ctx);
 
     const char *destdir = "";
 
     // read cmake variables TEST_QUAKE_MAP_EXPORT_DIR / TEST_QUAKE2_MAP_EXPORT_DIR
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
+    if (ctx.options.target_game->id == GAME_QUAKE_II) {
         destdir = test_quake2_maps_dir;
-    } else if (qbsp_options.target_game->id == GAME_QUAKE) {
+    } else if (ctx.options.target_game->id == GAME_QUAKE) {
         destdir = test_quake_maps_dir;
-    } else if (qbsp_options.target_game->id == GAME_HEXEN_II) {
+    } else if (ctx.options.target_game->id == GAME_HEXEN_II) {
         destdir = test_hexen2_maps_dir;
-    } else if (qbsp_options.target_game->id == GAME_HALF_LIFE) {
+    } else if (ctx.options.target_game->id == GAME_HALF_LIFE) {
         destdir = test_halflife_maps_dir;
     }
 
@@ -107,23 +115,23 @@ std::tuple<mbsp_t, bspxentries_t, std::optional<prtfile_t>> LoadTestmap(
     if (strlen(destdir) > 0) {
         auto dest = fs::path(destdir) / name.filename();
         dest.replace_extension(".bsp");
-        fs::copy(qbsp_options.bsp_path, dest, fs::copy_options::overwrite_existing);
-        logging::print("copied from {} to {}\n", qbsp_options.bsp_path, dest);
+        fs::copy(ctx.options.bsp_path, dest, fs::copy_options::overwrite_existing);
+        logging::print("copied from {} to {}\n", ctx.options.bsp_path, dest);
     }
 
     // re-open the .bsp and return it
-    qbsp_options.bsp_path.replace_extension("bsp");
+    ctx.options.bsp_path.replace_extension("bsp");
 
     bspdata_t bspdata;
-    LoadBSPFile(qbsp_options.bsp_path, &bspdata);
+    LoadBSPFile(ctx.options.bsp_path, &bspdata);
 
-    bspdata.version->game->init_filesystem(qbsp_options.bsp_path, qbsp_options);
+    bspdata.version->game->init_filesystem(ctx.options.bsp_path, ctx.options);
 
     ConvertBSPFormat(&bspdata, &bspver_generic);
 
     // write to .json for inspection
     serialize_bsp(
-        bspdata, std::get<mbsp_t>(bspdata.bsp), fs::path(qbsp_options.bsp_path).replace_extension(".bsp.json"));
+        bspdata, std::get<mbsp_t>(bspdata.bsp), fs::path(ctx.options.bsp_path).replace_extension(".bsp.json"));
 
     std::optional<prtfile_t> prtfile;
     if (const auto prtpath = fs::path(bsp_path).replace_extension(".prt"); fs::exists(prtpath)) {
@@ -131,8 +139,8 @@ std::tuple<mbsp_t, bspxentries_t, std::optional<prtfile_t>> LoadTestmap(
     }
 
     // decompile .bsp hulls
-    if (qbsp_options.target_game->id == GAME_QUAKE) {
-        fs::path decompiled_map_path = qbsp_options.bsp_path;
+    if (ctx.options.target_game->id == GAME_QUAKE) {
+        fs::path decompiled_map_path = ctx.options.bsp_path;
         decompiled_map_path.replace_extension("");
         decompiled_map_path.replace_filename(decompiled_map_path.stem().string() + "-decompiled-hull1");
         decompiled_map_path.replace_extension(".map");
@@ -221,15 +229,16 @@ std::map<std::string, std::vector<const mface_t *>> MakeTextureToFaceMap(const m
     return result;
 }
 
-const texvecf &GetTexvecs(const char *map, const char *texname)
+texvecf GetTexvecs(const char *map, const char *texname)
 {
-    mapentity_t &worldspawn = LoadMap(map);
+    qbsp_context_t ctx;
+    mapentity_t &worldspawn = LoadMap(ctx, map);
 
     const mapbrush_t &mapbrush = worldspawn.mapbrushes.front();
     const mapface_t *mapface = Mapbrush_FirstFaceWithTextureName(mapbrush, "tech02_1");
     Q_assert(nullptr != mapface);
 
-    return mapface->get_texvecs();
+    return mapface->get_texvecs(ctx.map);
 }
 
 std::vector<std::string> TexNames(const mbsp_t &bsp, std::vector<const mface_t *> faces)
@@ -316,14 +325,70 @@ TEST_CASE("duplicatePlanes" * doctest::test_suite("qbsp"))
     }
     )";
 
-    mapentity_t &worldspawn = LoadMap(mapWithDuplicatePlanes);
+    qbsp_context_t ctx;
+    mapentity_t &worldspawn = LoadMap(ctx, mapWithDuplicatePlanes);
     REQUIRE(1 == worldspawn.mapbrushes.size());
     CHECK(6 == worldspawn.mapbrushes.front().faces.size());
 
-    auto brush = LoadBrush(worldspawn, worldspawn.mapbrushes.front(), {CONTENTS_SOLID}, 0, std::nullopt);
+    auto brush = LoadBrush(ctx, worldspawn, worldspawn.mapbrushes.front(), {CONTENTS_SOLID}, 0, std::nullopt);
     CHECK(6 == brush->sides.size());
 }
 
+TEST_CASE("planeInterning" * doctest::test_suite("qbsp"))
+{
+    std::vector<qplane3d> input;
+
+    // axial planes (which sit in the middle of a hash cell), planes a
+    // fraction of an epsilon apart (which straddle cell boundaries),
+    // and flipped copies of earlier planes
+    for (int i = 0; i < 200; i++) {
+        input.push_back({{0, 0, 1}, static_cast<vec_t>(i * 8)});
+        input.push_back({qv::normalize(qvec3d{1, static_cast<vec_t>(i), 0}), i * 0.5 + DIST_EPSILON * 0.4});
+        input.push_back({qv::normalize(qvec3d{1, static_cast<vec_t>(i), 0}), i * 0.5});
+        input.push_back(-input[input.size() - 3]);
+    }
+
+    mapdata_t serial;
+    std::vector<size_t> serial_nums;
+
+    for (auto &plane : input) {
+        serial_nums.push_back(serial.add_or_find_plane(plane));
+    }
+
+    // planes within epsilon collapse, flipped planes map to the other
+    // side of the same pair
+    CHECK(serial_nums[1] == serial_nums[2]);
+    CHECK((serial_nums[0] ^ 1) == serial_nums[3]);
+
+    for (size_t i = 0; i < input.size(); i++) {
+        CHECK(serial.find_plane(input[i]) == serial_nums[i]);
+    }
+
+    // concurrent inserts must not create duplicates (the numbering
+    // depends on scheduling though, which is why qbsp adds planes serially)
+    mapdata_t concurrent;
+
+    tbb::parallel_for(static_cast<size_t>(0), input.size(), [&](size_t i) { concurrent.add_or_find_plane(input[i]); });
+
+    CHECK(concurrent.planes.size() == serial.planes.size());
+}
+
+TEST_CASE("vertexEmission" * doctest::test_suite("qbsp"))
+{
+    mapdata_t data;
+
+    // b is within epsilon of a, and c of b; but c isn't within epsilon of
+    // any emitted vertex, so it must not be merged through b
+    const qvec3d a{0, 0, 0}, b{0.02, 0, 0}, c{0.04, 0, 0}, d{64, 0, 0};
+
+    CHECK(data.emit_hash_vectors({a, d, b, c, d}) == std::vector<size_t>{0, 1, 0, 2, 1});
+    CHECK(data.bsp.dvertexes.size() == 3);
+
+    // later batches reuse the vertices of earlier ones
+    CHECK(data.emit_hash_vectors({{0.01, 0, 0}, {128, 0, 0}, {64, 0.01, 0}}) == std::vector<size_t>{0, 3, 1});
+    CHECK(data.bsp.dvertexes.size() == 4);
+}
+
 /**
  * Test that this skip face gets auto-corrected.
  */
@@ -345,13 +410,14 @@ TEST_CASE("InvalidTextureProjection" * doctest::test_suite("qbsp"))
     }
     )";
 
-    mapentity_t &worldspawn = LoadMap(map);
+    qbsp_context_t ctx;
+    mapentity_t &worldspawn = LoadMap(ctx, map);
     Q_assert(1 == worldspawn.mapbrushes.size());
 
     const mapface_t *face = &worldspawn.mapbrushes.front().faces[5];
     REQUIRE("skip" == face->texname);
-    const auto texvecs = face->get_texvecs();
-    CHECK(IsValidTextureProjection(face->get_plane().get_normal(), texvecs.row(0), texvecs.row(1)));
+    const auto texvecs = face->get_texvecs(ctx.map);
+    CHECK(IsValidTextureProjection(face->get_plane(ctx.map).get_normal(), texvecs.row(0), texvecs.row(1)));
 }
 
 /**
@@ -375,13 +441,14 @@ TEST_CASE("InvalidTextureProjection2" * doctest::test_suite("qbsp"))
     }
     )";
 
-    mapentity_t &worldspawn = LoadMap(map);
+    qbsp_context_t ctx;
+    mapentity_t &worldspawn = LoadMap(ctx, map);
     Q_assert(1 == worldspawn.mapbrushes.size());
 
     const mapface_t *face = &worldspawn.mapbrushes.front().faces[5];
     REQUIRE("skip" == face->texname);
-    const auto texvecs = face->get_texvecs();
-    CHECK(IsValidTextureProjection(face->get_plane().get_normal(), texvecs.row(0), texvecs.row(1)));
+    const auto texvecs = face->get_texvecs(ctx.map);
+    CHECK(IsValidTextureProjection(face->get_plane(ctx.map).get_normal(), texvecs.row(0), texvecs.row(1)));
 }
 
 /**
@@ -406,13 +473,14 @@ TEST_CASE("InvalidTextureProjection3" * doctest::test_suite("qbsp"))
     }
     )";
 
-    mapentity_t &worldspawn = LoadMap(map);
+    qbsp_context_t ctx;
+    mapentity_t &worldspawn = LoadMap(ctx, map);
     Q_assert(1 == worldspawn.mapbrushes.size());
 
     const mapface_t *face = &worldspawn.mapbrushes.front().faces[3];
     REQUIRE("*lava1" == face->texname);
-    const auto texvecs = face->get_texvecs();
-    CHECK(IsValidTextureProjection(face->get_plane().get_normal(), texvecs.row(0), texvecs.row(1)));
+    const auto texvecs = face->get_texvecs(ctx.map);
+    CHECK(IsValidTextureProjection(face->get_plane(ctx.map).get_normal(), texvecs.row(0), texvecs.row(1)));
 }
 
 TEST_SUITE("mathlib")
@@ -440,16 +508,18 @@ TEST_CASE("options_reset1" * doctest::test_suite("testmaps_q1"))
 {
     LoadTestmap("qbsp_simple_sealed.map", {"-transsky"});
 
-    CHECK_FALSE(qbsp_options.forcegoodtree.value());
-    CHECK(qbsp_options.transsky.value());
+    const auto &options = LastTestmapContext().options;
+    CHECK_FALSE(options.forcegoodtree.value());
+    CHECK(options.transsky.value());
 }
 
 TEST_CASE("options_reset2" * doctest::test_suite("testmaps_q1"))
 {
     LoadTestmap("qbsp_simple_sealed.map", {"-forcegoodtree"});
 
-    CHECK(qbsp_options.forcegoodtree.value());
-    CHECK_FALSE(qbsp_options.transsky.value());
+    const auto &options = LastTestmapContext().options;
+    CHECK(options.forcegoodtree.value());
+    CHECK_FALSE(options.transsky.value());
 }
 
 /**
@@ -988,6 +1058,91 @@ TEST_CASE("tjunc_angled_face" * doctest::test_suite("testmaps_q1"))
     CHECK(bolt6_face->numedges == 5);
 }
 
+// counts the edges of world faces that pass through a vertex of another
+// world face, i.e. the T-junctions that are left in the output
+static size_t CountTJunctions(const mbsp_t &bsp)
+{
+    const dmodelh2_t &model = bsp.dmodels[0];
+    std::set<int> verts;
+
+    for (int i = model.firstface; i < model.firstface + model.numfaces; i++) {
+        for (int j = 0; j < bsp.dfaces[i].numedges; j++) {
+            verts.insert(Face_VertexAtIndex(&bsp, &bsp.dfaces[i], j));
+        }
+    }
+
+    size_t count = 0;
+
+    for (int i = model.firstface; i < model.firstface + model.numfaces; i++) {
+        const mface_t *face = &bsp.dfaces[i];
+
+        for (int j = 0; j < face->numedges; j++) {
+            const qvec3d start = Face_PointAtIndex(&bsp, face, j);
+            const qvec3d end = Face_PointAtIndex(&bsp, face, (j + 1) % face->numedges);
+            vec_t length;
+            const qvec3d dir = qv::normalize(end - start, length);
+
+            for (int v : verts) {
+                const qvec3d point = bsp.dvertexes[v];
+                const vec_t dist = qv::dot(point - start, dir);
+
+                if (dist > 0.01 && dist < length - 0.01 && qv::distance(point, start + (dir * dist)) < 0.01) {
+                    count++;
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+/**
+ * TJunc finds the vertices on each face edge through an index of the lines
+ * the edges lie on; if it misses any, T-junctions are left in the output.
+ **/
+TEST_CASE("tjunc_edge_index" * doctest::test_suite("testmaps_q1"))
+{
+    for (const char *mapname : {"q1_tjunc_angled_face.map", "qbsp_tjunc_many_sided_face.map"}) {
+        SUBCASE(mapname)
+        {
+            // make sure there's something to fix
+            {
+                const auto [bsp, bspx, prt] = LoadTestmapQ1(mapname, {"-tjunc", "none"});
+                CHECK(CountTJunctions(bsp) > 0);
+            }
+
+            const auto [bsp, bspx, prt] = LoadTestmapQ1(mapname);
+            CHECK(CountTJunctions(bsp) == 0);
+        }
+    }
+}
+
+/**
+ * Faces with more vertices than -maxmwtvertices skip MWT and use the
+ * fan-based fixes instead.
+ **/
+TEST_CASE("tjunc_maxmwtvertices" * doctest::test_suite("testmaps_q1"))
+{
+    const size_t mwt_faces = std::get<0>(LoadTestmapQ1("qbsp_tjunc_many_sided_face.map")).dfaces.size();
+    const size_t retopologize_faces =
+        std::get<0>(LoadTestmapQ1("qbsp_tjunc_many_sided_face.map", {"-tjunc", "retopologize"})).dfaces.size();
+
+    // MWT splits this map's faces differently from the fan-based fixes
+    REQUIRE(mwt_faces != retopologize_faces);
+
+    // every face that gets to MWT has more than 3 vertices, so this
+    // skips MWT entirely
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_tjunc_many_sided_face.map", {"-maxmwtvertices", "3"});
+    CHECK(bsp.dfaces.size() == retopologize_faces);
+    CHECK(CountTJunctions(bsp) == 0);
+
+    // with a limit in between, only the larger faces skip it
+    const size_t limited_faces =
+        std::get<0>(LoadTestmapQ1("qbsp_tjunc_many_sided_face.map", {"-maxmwtvertices", "20"})).dfaces.size();
+    CHECK(limited_faces != mwt_faces);
+    CHECK(limited_faces != retopologize_faces);
+}
+
 /**
  * Because it comes second, the sbutt2 brush should "win" in clipping against the floor,
  * in both a worldspawn test case, as well as a func_wall.
@@ -1374,20 +1529,21 @@ TEST_CASE("q1_sealing" * doctest::test_suite("testmaps_q1"))
 
 TEST_CASE("q1_csg" * doctest::test_suite("testmaps_q1"))
 {
-    auto &entity = LoadMapPath("q1_csg.map");
+    qbsp_context_t ctx;
+    auto &entity = LoadMapPath(ctx, "q1_csg.map");
 
     REQUIRE(entity.mapbrushes.size() == 2);
 
     bspbrush_t::container bspbrushes;
     for (int i = 0; i < 2; ++i) {
-        auto b = LoadBrush(entity, entity.mapbrushes[i], {CONTENTS_SOLID}, 0, std::nullopt);
+        auto b = LoadBrush(ctx, entity, entity.mapbrushes[i], {CONTENTS_SOLID}, 0, std::nullopt);
 
         CHECK(6 == b->sides.size());
 
         bspbrushes.push_back(bspbrush_t::make_ptr(std::move(*b)));
     }
 
-    auto csged = CSGFaces(bspbrushes);
+    auto csged = CSGFaces(ctx, bspbrushes);
     CHECK(2 == csged.size());
 
     for (int i = 0; i < 2; ++i) {
@@ -1461,6 +1617,46 @@ TEST_CASE("q1_wad_mapname" * doctest::test_suite("testmaps_q1"))
     CHECK(bsp.dtex.textures[1].data.size() > sizeof(dmiptex_t));
 }
 
+/**
+ * Brushes are parsed in batches after the entity scan; they must still only
+ * see the keys that precede them, and braces in comments must be ignored.
+ **/
+TEST_CASE("q1_keys_after_brushes" * doctest::test_suite("testmaps_q1"))
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_keys_after_brushes.map");
+    auto &map = LastTestmapContext().map;
+
+    REQUIRE(map.entities.size() == 3);
+    CHECK(map.world_entity().mapbrushes.size() == 1);
+
+    auto &func_wall = map.entities[1];
+    REQUIRE(func_wall.mapbrushes.size() == 2);
+
+    CHECK(func_wall.mapbrushes[0].line.line_number == 22);
+    CHECK(func_wall.mapbrushes[1].line.line_number == 32);
+
+    CHECK(!func_wall.mapbrushes[0].faces[0].get_texinfo(map).flags.no_dirt);
+    CHECK(func_wall.mapbrushes[1].faces[0].get_texinfo(map).flags.no_dirt);
+}
+
+/**
+ * The brush scan has to find the end of each quoted texture name the same way
+ * the tokenizer does, or it gets the brush boundaries wrong.
+ **/
+TEST_CASE("q1_quoted_texture_names" * doctest::test_suite("testmaps_q1"))
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_quoted_texture_names.map");
+
+    auto &worldspawn = LastTestmapContext().map.world_entity();
+    REQUIRE(worldspawn.mapbrushes.size() == 2);
+    REQUIRE(worldspawn.mapbrushes[0].faces.size() == 6);
+    REQUIRE(worldspawn.mapbrushes[1].faces.size() == 6);
+
+    CHECK(worldspawn.mapbrushes[0].faces[0].texname == "orangestuff8\\\\");
+    CHECK(worldspawn.mapbrushes[1].faces[0].texname == "orangestuff8\\\"}");
+    CHECK(worldspawn.mapbrushes[1].line.line_number == 18);
+}
+
 TEST_CASE("q1_merge_maps" * doctest::test_suite("testmaps_q1"))
 {
     const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_merge_maps_base.map", {"-add", "q1_merge_maps_addition.map"});
@@ -1684,11 +1880,10 @@ TEST_CASE("q1_hull1_content_types" * doctest::test_suite("testmaps_q1"))
 
 TEST_CASE("BrushFromBounds")
 {
-    map.reset();
-    qbsp_options.reset();
-    qbsp_options.worldextent.set_value(1024, settings::source::COMMANDLINE);
+    qbsp_context_t ctx;
+    ctx.options.worldextent.set_value(1024, settings::source::COMMANDLINE);
 
-    auto brush = BrushFromBounds({{2, 2, 2}, {32, 32, 32}});
+    auto brush = BrushFromBounds(ctx, {{2, 2, 2}, {32, 32, 32}});
 
     CHECK(brush->sides.size() == 6);
 
@@ -1702,14 +1897,14 @@ TEST_CASE("BrushFromBounds")
 
         if (side.w.directional_equal(top_winding)) {
             found++;
-            auto &plane = side.get_plane();
+            auto &plane = side.get_plane(ctx.map);
             CHECK(plane.get_normal() == qvec3d{0, 0, 1});
             CHECK(plane.get_dist() == 32);
         }
 
         if (side.w.directional_equal(bottom_winding)) {
             found++;
-            auto plane = side.get_plane();
+            auto plane = side.get_plane(ctx.map);
             CHECK(plane.get_normal() == qvec3d{0, 0, -1});
             CHECK(plane.get_dist() == -2);
         }
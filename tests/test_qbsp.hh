@@ -7,10 +7,14 @@
 class mapbrush_t;
 struct mapface_t;
 class mapentity_t;
+struct qbsp_context_t;
+struct light_context_t;
 
 const mapface_t *Mapbrush_FirstFaceWithTextureName(const mapbrush_t &brush, const std::string &texname);
-mapentity_t &LoadMap(const char *map);
-mapentity_t &LoadMapPath(const std::filesystem::path &name);
+mapentity_t &LoadMap(qbsp_context_t &ctx, const char *map);
+mapentity_t &LoadMapPath(qbsp_context_t &ctx, const std::filesystem::path &name);
+// qbsp's state after the last LoadTestmap*() call, for tests that inspect it
+qbsp_context_t &LastTestmapContext();
 std::tuple<mbsp_t, bspxentries_t, std::optional<prtfile_t>> LoadTestmap(
     const std::filesystem::path &name, std::vector<std::string> extra_args = {});
 std::tuple<mbsp_t, bspxentries_t, std::optional<prtfile_t>> LoadTestmapQ2(
@@ -20,7 +24,7 @@ std::tuple<mbsp_t, bspxentries_t, std::optional<prtfile_t>> LoadTestmapQ1(
 void CheckFilled(const mbsp_t &bsp, hull_index_t hullnum);
 void CheckFilled(const mbsp_t &bsp);
 std::map<std::string, std::vector<const mface_t *>> MakeTextureToFaceMap(const mbsp_t &bsp);
-const texvecf &GetTexvecs(const char *map, const char *texname);
+texvecf GetTexvecs(const char *map, const char *texname);
 std::vector<std::string> TexNames(const mbsp_t &bsp, std::vector<const mface_t *> faces);
 std::vector<const mface_t *> FacesWithTextureName(const mbsp_t &bsp, const std::string &name);
 std::map<int, int> CountClipnodeLeafsByContentType(const mbsp_t &bsp, int hullnum);
@@ -51,4 +55,6 @@ enum class runvis_t
 testresults_lit_t QbspVisLight_Q1(
     const std::filesystem::path &name, std::vector<std::string> extra_light_args, runvis_t run_vis = runvis_t::no);
 testresults_t QbspVisLight_Q2(
-    const std::filesystem::path &name, std::vector<std::string> extra_light_args, runvis_t run_vis = runvis_t::no);
\ No newline at end of file
+    const std::filesystem::path &name, std::vector<std::string> extra_light_args, runvis_t run_vis = runvis_t::no);
+// light's state after the last QbspVisLight_*() call, for tests that inspect it
+light_context_t &LastLightContext();
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include <doctest/doctest.h>
+
+#include <server/server.hh>
+
+#include <filesystem>
+#include <sstream>
+
+#include <fmt/format.h>
+
+#include "testmaps.hh"
+
+TEST_SUITE("server")
+{
+    TEST_CASE("jobs run in order and report their status")
+    {
+        const auto map_path = std::filesystem::path(testmaps_dir) / "qbsp_simple_sealed.map";
+        auto bsp_path = map_path;
+        bsp_path.replace_extension(".bsp");
+
+        // a failing job doesn't stop the ones after it, and the same map can be compiled again
+        std::istringstream jobs(fmt::format("# comment\n"
+                                            "\n"
+                                            "qbsp -noverbose \"{0}\" \"{1}\"\n"
+                                            "vis -fast \"{1}\"\n"
+                                            "bspinfo \"{1}\"\n"
+                                            "qbsp -noverbose \"{0}\" \"{1}\"\n"
+                                            "quit\n"
+                                            "vis \"{1}\"\n",
+            map_path.string(), bsp_path.string()));
+        std::ostringstream status;
+
+        CHECK(server_main(jobs, status) == 0);
+        CHECK(status.str() == "---- job 1 (qbsp) finished with status 0 ----\n"
+                              "---- job 2 (vis) finished with status 0 ----\n"
+                              "---- job 3 (bspinfo) finished with status 1 ----\n"
+                              "---- job 4 (qbsp) finished with status 0 ----\n");
+    }
+}
@@ -46,3 +46,42 @@ TEST_CASE("q2_detail_leak_test.map" * doctest::may_fail())
         CHECK(!leaf_sees(player_start_leaf, item_enviro_leaf));
     }
 }
+
+TEST_CASE("q2 phs is the union of the visible pvs rows")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_detail_leak_test.map", {}, runvis_t::yes);
+    const auto pvs = DecompressAllVis(&bsp);
+
+    const int num_clusters = bsp.dvis.bit_offsets.size();
+    const size_t rowbytes = DecompressedVisSize(&bsp);
+    REQUIRE(num_clusters > 0);
+
+    for (int cluster = 0; cluster < num_clusters; ++cluster) {
+        std::vector<uint8_t> phs(rowbytes);
+        DecompressVis(bsp.dvis.bits.data() + bsp.dvis.get_bit_offset(VIS_PHS, cluster),
+            bsp.dvis.bits.data() + bsp.dvis.bits.size(), phs.data(), phs.data() + phs.size());
+
+        std::vector<uint8_t> expected = pvs.at(cluster);
+        for (int other = 0; other < num_clusters; ++other) {
+            if (!(pvs.at(cluster)[other >> 3] & (1 << (other & 7))))
+                continue;
+            for (size_t i = 0; i < rowbytes; ++i)
+                expected[i] |= pvs.at(other)[i];
+        }
+
+        INFO("cluster ", cluster);
+        CHECK(phs == expected);
+    }
+}
+
+TEST_CASE("vis gives the same result when run again in the same process")
+{
+    // each vis_main call works on its own vis_context_t, so nothing from the
+    // previous run (of this map or another) leaks into the next one
+    auto [first, first_bspx] = QbspVisLight_Q2("q2_detail_leak_test.map", {}, runvis_t::yes);
+    auto [other, other_bspx] = QbspVisLight_Q2("q2_areaportal.map", {}, runvis_t::yes);
+    auto [second, second_bspx] = QbspVisLight_Q2("q2_detail_leak_test.map", {}, runvis_t::yes);
+
+    CHECK(first.dvis.bit_offsets == second.dvis.bit_offsets);
+    CHECK(first.dvis.bits == second.dvis.bits);
+}
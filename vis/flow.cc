@@ -4,12 +4,6 @@
 #include <common/parallel.hh>
 #include <atomic>
 
-unsigned long c_chains;
-int c_vistest, c_mighttest;
-
-static int c_portalskip;
-static int c_leafskip;
-
 /*
   ==============
   ClipToSeparators
@@ -30,8 +24,8 @@ static int c_leafskip;
   pointer, was measurably faster
   ==============
 */
-static void ClipToSeparators(const viswinding_t *source, const qplane3d src_pl, const viswinding_t *pass,
-    viswinding_t *&target, unsigned int test, pstack_t &stack)
+static void ClipToSeparators(vis_context_t &ctx, const viswinding_t *source, const qplane3d src_pl,
+    const viswinding_t *pass, viswinding_t *&target, unsigned int test, pstack_t &stack)
 {
     int i, j, k, l;
     qplane3d sep;
@@ -114,7 +108,7 @@ static void ClipToSeparators(const viswinding_t *source, const qplane3d src_pl,
                 stack.numseparators[test]++;
             }
 
-            target = ClipStackWinding(target, stack, sep);
+            target = ClipStackWinding(ctx, target, stack, sep);
 
             if (!target)
                 return; // target is not visible
@@ -149,10 +143,11 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
     qplane3d backplane;
     leaf_t *leaf;
     int i, j, err, numblocks;
+    vis_context_t &ctx = thread->ctx;
 
-    ++c_chains;
+    ++ctx.c_chains;
 
-    leaf = &leafs[leafnum];
+    leaf = &ctx.leafs[leafnum];
 
     /*
      * Check we haven't recursed into a leaf already on the stack
@@ -175,7 +170,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
 
     stack.leaf = leaf;
 
-    leafbits_t local(portalleafs);
+    leafbits_t local(ctx.portalleafs);
     stack.mightsee = &local;
 
     auto might = stack.mightsee->data();
@@ -186,7 +181,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         p = leaf->portals[i];
 
         if (!(*prevstack.mightsee)[p->leaf]) {
-            c_leafskip++;
+            ctx.c_leafskip++;
             continue; // can't possibly see it
         }
 
@@ -194,15 +189,15 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
 
         // if the portal can't see anything we haven't allready seen, skip it
         if (p->status == pstat_done) {
-            c_vistest++;
+            ctx.c_vistest++;
             test = p->visbits.data();
         } else {
-            c_mighttest++;
+            ctx.c_mighttest++;
             test = p->mightsee.data();
         }
 
         uint32_t more = 0;
-        numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+        numblocks = (ctx.portalleafs + leafbits_t::mask) >> leafbits_t::shift;
         for (j = 0; j < numblocks; j++) {
             might[j] = prevstack.mightsee->data()[j] & test[j];
             more |= (might[j] & ~vis[j]);
@@ -210,7 +205,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
 
         if (!more) {
             // can't see anything new
-            c_portalskip++;
+            ctx.c_portalskip++;
             continue;
         }
         // get plane of portal, point normal into the neighbor leaf
@@ -220,7 +215,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         if (qv::epsilonEqual(prevstack.portalplane.normal, backplane.normal, VIS_EQUAL_EPSILON))
             continue; // can't go out a coplanar face
 
-        c_portalcheck++;
+        ctx.c_portalcheck++;
 
         stack.portal = p;
         stack.next = NULL;
@@ -237,7 +232,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
          */
 
         /* Clip any part of the target portal behind the source portal */
-        stack.pass = ClipStackWinding(&p->winding, stack, thread->pstack_head.portalplane);
+        stack.pass = ClipStackWinding(ctx, &p->winding, stack, thread->pstack_head.portalplane);
         if (!stack.pass)
             continue;
 
@@ -250,31 +245,31 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         }
 
         /* Clip any part of the target portal behind the pass portal */
-        stack.pass = ClipStackWinding(stack.pass, stack, prevstack.portalplane);
+        stack.pass = ClipStackWinding(ctx, stack.pass, stack, prevstack.portalplane);
         if (!stack.pass)
             continue;
 
         /* Clip any part of the source portal in front of the target portal */
-        stack.source = ClipStackWinding(prevstack.source, stack, backplane);
+        stack.source = ClipStackWinding(ctx, prevstack.source, stack, backplane);
         if (!stack.source) {
             FreeStackWinding(stack.pass, stack);
             continue;
         }
 
-        c_portaltest++;
+        ctx.c_portaltest++;
 
         /* TEST 0 :: source -> pass -> target */
-        if (vis_options.level.value() > 0) {
+        if (ctx.options.level.value() > 0) {
             if (stack.numseparators[0]) {
                 for (j = 0; j < stack.numseparators[0]; j++) {
-                    stack.pass = ClipStackWinding(stack.pass, stack, stack.separators[0][j]);
+                    stack.pass = ClipStackWinding(ctx, stack.pass, stack, stack.separators[0][j]);
                     if (!stack.pass)
                         break;
                 }
             } else {
                 /* Using prevstack source for separator cache correctness */
                 ClipToSeparators(
-                    prevstack.source, thread->pstack_head.portalplane, prevstack.pass, stack.pass, 0, stack);
+                    ctx, prevstack.source, thread->pstack_head.portalplane, prevstack.pass, stack.pass, 0, stack);
             }
             if (!stack.pass) {
                 FreeStackWinding(stack.source, stack);
@@ -283,16 +278,16 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         }
 
         /* TEST 1 :: pass -> source -> target */
-        if (vis_options.level.value() > 1) {
+        if (ctx.options.level.value() > 1) {
             if (stack.numseparators[1]) {
                 for (j = 0; j < stack.numseparators[1]; j++) {
-                    stack.pass = ClipStackWinding(stack.pass, stack, stack.separators[1][j]);
+                    stack.pass = ClipStackWinding(ctx, stack.pass, stack, stack.separators[1][j]);
                     if (!stack.pass)
                         break;
                 }
             } else {
                 /* Using prevstack source for separator cache correctness */
-                ClipToSeparators(prevstack.pass, prevstack.portalplane, prevstack.source, stack.pass, 1, stack);
+                ClipToSeparators(ctx, prevstack.pass, prevstack.portalplane, prevstack.source, stack.pass, 1, stack);
             }
             if (!stack.pass) {
                 FreeStackWinding(stack.source, stack);
@@ -301,8 +296,8 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         }
 
         /* TEST 2 :: target -> pass -> source */
-        if (vis_options.level.value() > 2) {
-            ClipToSeparators(stack.pass, stack.portalplane, prevstack.pass, stack.source, 2, stack);
+        if (ctx.options.level.value() > 2) {
+            ClipToSeparators(ctx, stack.pass, stack.portalplane, prevstack.pass, stack.source, 2, stack);
             if (!stack.source) {
                 FreeStackWinding(stack.pass, stack);
                 continue;
@@ -310,15 +305,15 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         }
 
         /* TEST 3 :: pass -> target -> source */
-        if (vis_options.level.value() > 3) {
-            ClipToSeparators(prevstack.pass, prevstack.portalplane, stack.pass, stack.source, 3, stack);
+        if (ctx.options.level.value() > 3) {
+            ClipToSeparators(ctx, prevstack.pass, prevstack.portalplane, stack.pass, stack.source, 3, stack);
             if (!stack.source) {
                 FreeStackWinding(stack.pass, stack);
                 continue;
             }
         }
 
-        c_portalpass++;
+        ctx.c_portalpass++;
 
         // flow through it for real
         RecursiveLeafFlow(p->leaf, thread, stack);
@@ -333,14 +328,14 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
   PortalFlow
   ===============
 */
-void PortalFlow(visportal_t *p)
+void PortalFlow(vis_context_t &ctx, visportal_t *p)
 {
-    threaddata_t data{p->visbits};
+    threaddata_t data{ctx, p->visbits};
 
     if (p->status != pstat_working)
         FError("reflowed");
 
-    data.leafvis.resize(portalleafs);
+    data.leafvis.resize(ctx.portalleafs);
 
     data.base = p;
 
@@ -359,7 +354,7 @@ void PortalFlow(visportal_t *p)
   ============================================================================
 */
 
-static void SimpleFlood(visportal_t &srcportal, int leafnum, const leafbits_t &portalsee)
+static void SimpleFlood(vis_context_t &ctx, visportal_t &srcportal, int leafnum, const leafbits_t &portalsee)
 {
     if (srcportal.mightsee[leafnum])
         return;
@@ -367,12 +362,12 @@ static void SimpleFlood(visportal_t &srcportal, int leafnum, const leafbits_t &p
     srcportal.mightsee[leafnum] = true;
     srcportal.nummightsee++;
 
-    leaf_t &leaf = leafs[leafnum];
+    leaf_t &leaf = ctx.leafs[leafnum];
     for (size_t i = 0; i < leaf.numportals; i++) {
         const visportal_t *p = leaf.portals[i];
 
-        if (portalsee[p - portals.data()]) {
-            SimpleFlood(srcportal, p->leaf, portalsee);
+        if (portalsee[p - ctx.portals.data()]) {
+            SimpleFlood(ctx, srcportal, p->leaf, portalsee);
         }
     }
 }
@@ -382,23 +377,23 @@ static void SimpleFlood(visportal_t &srcportal, int leafnum, const leafbits_t &p
   BasePortalVis
   ==============
 */
-static void BasePortalThread(size_t portalnum)
+static void BasePortalThread(vis_context_t &ctx, size_t portalnum)
 {
     int j;
     float d;
-    leafbits_t portalsee(numportals * 2);
+    leafbits_t portalsee(ctx.numportals * 2);
 
-    visportal_t &p = portals[portalnum];
+    visportal_t &p = ctx.portals[portalnum];
     viswinding_t &w = p.winding;
 
-    p.mightsee.resize(portalleafs);
+    p.mightsee.resize(ctx.portalleafs);
 
-    for (size_t i = 0; i < numportals * 2; i++) {
+    for (size_t i = 0; i < ctx.numportals * 2; i++) {
         if (i == portalnum) {
             continue;
         }
 
-        visportal_t &tp = portals[i];
+        visportal_t &tp = ctx.portals[i];
         viswinding_t &tw = tp.winding;
 
         // Quick test - completely at the back?
@@ -429,9 +424,9 @@ static void BasePortalThread(size_t portalnum)
         if (j == w.size())
             continue; // no points on back
 
-        if (vis_options.visdist.value() > 0) {
-            if (tp.winding.distFromPortal(p) > vis_options.visdist.value() ||
-                p.winding.distFromPortal(tp) > vis_options.visdist.value())
+        if (ctx.options.visdist.value() > 0) {
+            if (tp.winding.distFromPortal(p) > ctx.options.visdist.value() ||
+                p.winding.distFromPortal(tp) > ctx.options.visdist.value())
                 continue;
         }
 
@@ -439,7 +434,7 @@ static void BasePortalThread(size_t portalnum)
     }
 
     p.nummightsee = 0;
-    SimpleFlood(p, p.leaf, portalsee);
+    SimpleFlood(ctx, p, p.leaf, portalsee);
 
     portalsee.clear();
 }
@@ -449,7 +444,8 @@ static void BasePortalThread(size_t portalnum)
   BasePortalVis
   ==============
 */
-void BasePortalVis(void)
+void BasePortalVis(vis_context_t &ctx)
 {
-    logging::parallel_for(0, numportals * 2, BasePortalThread);
+    logging::timed_scope_t timed_scope(__func__);
+    logging::parallel_for(0, ctx.numportals * 2, [&ctx](int portalnum) { BasePortalThread(ctx, portalnum); });
 }
@@ -21,6 +21,10 @@
 #include <vis/vis.hh>
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
+
+#include <atomic>
+#include <bit>
+
 /*
 
 Some textures (sky, water, slime, lava) are considered ambien sound emiters.
@@ -56,14 +60,14 @@ static aabb3d SurfaceBBox(const mbsp_t *bsp, const mface_t *surf)
   CalcAmbientSounds
   ====================
 */
-void CalcAmbientSounds(mbsp_t *bsp)
+void CalcAmbientSounds(vis_context_t &ctx, mbsp_t *bsp)
 {
     logging::funcheader();
 
     // fast path for -noambient
-    if (vis_options.noambientsky.value() && vis_options.noambientwater.value() && vis_options.noambientslime.value() &&
-        vis_options.noambientlava.value()) {
-        for (int i = 0; i < portalleafs_real; i++) {
+    if (ctx.options.noambientsky.value() && ctx.options.noambientwater.value() &&
+        ctx.options.noambientslime.value() && ctx.options.noambientlava.value()) {
+        for (int i = 0; i < ctx.portalleafs_real; i++) {
             mleaf_t *leaf = &bsp->dleafs[i + 1];
             for (int j = 0; j < NUM_AMBIENTS; j++) {
                 leaf->ambient_level[j] = 0;
@@ -72,7 +76,7 @@ void CalcAmbientSounds(mbsp_t *bsp)
         return;
     }
 
-    logging::parallel_for(0, portalleafs_real, [&bsp](int i) {
+    logging::parallel_for(0, ctx.portalleafs_real, [&ctx, &bsp](int i) {
         mleaf_t *leaf = &bsp->dleafs[i + 1];
 
         float dists[NUM_AMBIENTS];
@@ -84,13 +88,13 @@ void CalcAmbientSounds(mbsp_t *bsp)
             dists[j] = 1020;
 
         uint8_t *vis;
-        if (portalleafs != portalleafs_real) {
-            vis = &uncompressed[leaf->cluster * leafbytes_real];
+        if (ctx.portalleafs != ctx.portalleafs_real) {
+            vis = &ctx.uncompressed[leaf->cluster * ctx.leafbytes_real];
         } else {
-            vis = &uncompressed[i * leafbytes_real];
+            vis = &ctx.uncompressed[i * ctx.leafbytes_real];
         }
 
-        for (int j = 0; j < portalleafs_real; j++) {
+        for (int j = 0; j < ctx.portalleafs_real; j++) {
             if (!(vis[j >> 3] & nth_bit(j & 7)))
                 continue;
 
@@ -105,15 +109,15 @@ void CalcAmbientSounds(mbsp_t *bsp)
                 const auto &miptex = bsp->dtex.textures[info->miptex];
 
                 ambient_type_t ambient_type;
-                if (!Q_strncasecmp(miptex.name.data(), "sky", 3) && !vis_options.noambientsky.value())
+                if (!Q_strncasecmp(miptex.name.data(), "sky", 3) && !ctx.options.noambientsky.value())
                     ambient_type = AMBIENT_SKY;
-                else if (!Q_strncasecmp(miptex.name.data(), "*water", 6) && !vis_options.noambientwater.value())
+                else if (!Q_strncasecmp(miptex.name.data(), "*water", 6) && !ctx.options.noambientwater.value())
                     ambient_type = AMBIENT_WATER;
-                else if (!Q_strncasecmp(miptex.name.data(), "*04water", 8) && !vis_options.noambientwater.value())
+                else if (!Q_strncasecmp(miptex.name.data(), "*04water", 8) && !ctx.options.noambientwater.value())
                     ambient_type = AMBIENT_WATER;
-                else if (!Q_strncasecmp(miptex.name.data(), "*slime", 6) && !vis_options.noambientslime.value())
+                else if (!Q_strncasecmp(miptex.name.data(), "*slime", 6) && !ctx.options.noambientslime.value())
                     ambient_type = AMBIENT_WATER; // AMBIENT_SLIME;
-                else if (!Q_strncasecmp(miptex.name.data(), "*lava", 5) && !vis_options.noambientlava.value())
+                else if (!Q_strncasecmp(miptex.name.data(), "*lava", 5) && !ctx.options.noambientlava.value())
                     ambient_type = AMBIENT_LAVA;
                 else
                     continue;
@@ -161,67 +165,94 @@ Calculate the PHS (Potentially Hearable Set)
 by ORing together all the PVS visible from a leaf
 ================
 */
-void CalcPHS(mbsp_t *bsp)
+void CalcPHS(vis_context_t &ctx, mbsp_t *bsp)
 {
     logging::funcheader();
+    logging::timed_scope_t timed_scope(__func__);
 
-    const int32_t leafbytes = (portalleafs + 7) >> 3;
-    const int32_t leaflongs = leafbytes / sizeof(long);
+    const int32_t leafbytes = (ctx.portalleafs + 7) >> 3;
+    // rows of the bit matrix are padded out to whole words
+    const size_t rowwords = (ctx.portalleafs + 63) >> 6;
 
-    // increase the bits size with approximately how much space we'll need
-    bsp->dvis.bits.reserve(bsp->dvis.bits.size() * 2);
+    // decompress every PVS row once into a packed bit matrix, so the OR pass
+    // below doesn't have to decode the same rows over and over
+    std::vector<uint64_t> pvs(rowwords * ctx.portalleafs);
 
-    std::vector<uint8_t> uncompressed(leafbytes);
-    std::vector<uint8_t> uncompressed_2(leafbytes);
-    std::vector<uint8_t> compressed(leafbytes * 2);
-    std::vector<uint8_t> uncompressed_orig(leafbytes);
+    // rows are cheap, so they're handed out in ranges that share a scratch buffer
+    logging::parallel_for_range(0, ctx.portalleafs, 16, [&](int32_t first, int32_t last) {
+        std::vector<uint8_t> uncompressed;
 
-    int32_t count = 0;
-    for (int32_t i = 0; i < portalleafs; i++) {
-        const uint8_t *scan = bsp->dvis.bits.data() + bsp->dvis.get_bit_offset(VIS_PVS, i);
+        for (int32_t i = first; i < last; i++) {
+            uncompressed.assign(rowwords * 8, 0);
 
-        DecompressVis(scan, bsp->dvis.bits.data() + bsp->dvis.bits.size(), uncompressed.data(),
-            uncompressed.data() + uncompressed.size());
-        std::copy(uncompressed.begin(), uncompressed.end(), uncompressed_orig.begin());
+            const uint8_t *scan = bsp->dvis.bits.data() + bsp->dvis.get_bit_offset(VIS_PVS, i);
+            DecompressVis(scan, bsp->dvis.bits.data() + bsp->dvis.bits.size(), uncompressed.data(),
+                uncompressed.data() + leafbytes);
 
-        scan = uncompressed_orig.data();
+            uint64_t *row = pvs.data() + rowwords * i;
+            for (size_t w = 0; w < rowwords; w++) {
+                uint64_t word = 0;
+                for (size_t b = 0; b < 8; b++)
+                    word |= static_cast<uint64_t>(uncompressed[(w << 3) + b]) << (b << 3);
+                row[w] = word;
+            }
 
-        for (int32_t j = 0; j < leafbytes; j++) {
-            uint8_t bitbyte = scan[j];
-            if (!bitbyte)
-                continue;
-            for (int32_t k = 0; k < 8; k++) {
-                if (!(bitbyte & nth_bit(k)))
-                    continue;
-                // OR this pvs row into the phs
-                int32_t index = ((j << 3) + k);
-                if (index >= portalleafs)
-                    FError("Bad bit in PVS"); // pad bits should be 0
-                const uint8_t *src_compressed = bsp->dvis.bits.data() + bsp->dvis.get_bit_offset(VIS_PVS, index);
-                DecompressVis(src_compressed, bsp->dvis.bits.data() + bsp->dvis.bits.size(), uncompressed_2.data(),
-                    uncompressed_2.data() + uncompressed_2.size());
-                const long *src = reinterpret_cast<long *>(uncompressed_2.data());
-                long *dest = reinterpret_cast<long *>(uncompressed.data());
-                for (int32_t l = 0; l < leaflongs; l++)
-                    dest[l] |= src[l];
+            // pad bits should be 0
+            if (ctx.portalleafs & 63) {
+                if (row[rowwords - 1] & (~uint64_t(0) << (ctx.portalleafs & 63)))
+                    FError("Bad bit in PVS");
+            }
+        }
+    });
+
+    // OR together the PVS rows of every cluster visible from each cluster, and
+    // compress the result; rows are independent, so they're all done in parallel
+    std::vector<std::vector<uint8_t>> compressed_rows(ctx.portalleafs);
+    std::atomic<int64_t> count = 0;
+
+    logging::parallel_for(0, ctx.portalleafs, [&](int32_t i) {
+        thread_local std::vector<uint64_t> phs;
+        thread_local std::vector<uint8_t> uncompressed;
+
+        const uint64_t *row = pvs.data() + rowwords * i;
+        phs.assign(row, row + rowwords);
+
+        for (size_t w = 0; w < rowwords; w++) {
+            for (uint64_t bits = row[w]; bits; bits &= bits - 1) {
+                const size_t index = (w << 6) + std::countr_zero(bits);
+                const uint64_t *src = pvs.data() + rowwords * index;
+                for (size_t l = 0; l < rowwords; l++)
+                    phs[l] |= src[l];
             }
         }
-        for (int32_t j = 0; j < portalleafs; j++)
-            if (uncompressed[j >> 3] & nth_bit(j & 7))
-                count++;
+
+        int64_t row_count = 0;
+        uncompressed.resize(rowwords * 8);
+        for (size_t w = 0; w < rowwords; w++) {
+            row_count += std::popcount(phs[w]);
+            for (size_t b = 0; b < 8; b++)
+                uncompressed[(w << 3) + b] = static_cast<uint8_t>(phs[w] >> (b << 3));
+        }
+        count += row_count;
 
         //
         // compress the bit string
         //
-        compressed.clear();
-        CompressRow(uncompressed.data(), leafbytes, std::back_inserter(compressed));
+        CompressRow(uncompressed.data(), leafbytes, std::back_inserter(compressed_rows[i]));
+    });
 
-        bsp->dvis.set_bit_offset(VIS_PHS, i, bsp->dvis.bits.size());
+    // assign offsets in cluster order, so the output doesn't depend on scheduling
+    size_t total_size = bsp->dvis.bits.size();
+    for (auto &compressed : compressed_rows)
+        total_size += compressed.size();
+    bsp->dvis.bits.reserve(total_size);
 
-        std::copy(compressed.begin(), compressed.end(), std::back_inserter(bsp->dvis.bits));
+    for (int32_t i = 0; i < ctx.portalleafs; i++) {
+        bsp->dvis.set_bit_offset(VIS_PHS, i, bsp->dvis.bits.size());
+        std::copy(compressed_rows[i].begin(), compressed_rows[i].end(), std::back_inserter(bsp->dvis.bits));
     }
 
-    fmt::print("Average clusters hearable: {}\n", count / portalleafs);
+    fmt::print("Average clusters hearable: {}\n", count.load() / ctx.portalleafs);
 
     bsp->dvis.bits.shrink_to_fit();
-}
\ No newline at end of file
+}
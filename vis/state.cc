@@ -54,13 +54,13 @@ struct dportal_t
     auto stream_data() { return std::tie(status, might, vis, nummightsee, numcansee); }
 };
 
-static int CompressBits(uint8_t *out, const leafbits_t &in)
+static int CompressBits(uint8_t *out, const leafbits_t &in, int numleafs)
 {
     int i, rep, shift, numbytes;
     uint8_t val, repval, *dst;
 
     dst = out;
-    numbytes = (portalleafs + 7) >> 3;
+    numbytes = (numleafs + 7) >> 3;
     for (i = 0; i < numbytes && dst - out < numbytes; i++) {
         shift = (i << 3) & leafbits_t::mask;
         val = (in.data()[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
@@ -94,11 +94,11 @@ static int CompressBits(uint8_t *out, const leafbits_t &in)
     return numbytes;
 }
 
-static void DecompressBits(leafbits_t &dst, const uint8_t *src)
+static void DecompressBits(leafbits_t &dst, const uint8_t *src, int numleafs)
 {
-    const size_t numbytes = (portalleafs + 7) >> 3;
+    const size_t numbytes = (numleafs + 7) >> 3;
 
-    dst.resize(portalleafs);
+    dst.resize(numleafs);
 
     for (size_t i = 0; i < numbytes; i++) {
         uint8_t val = *src++;
@@ -131,32 +131,32 @@ static void CopyLeafBits(leafbits_t &dst, const uint8_t *src, size_t numleafs)
     }
 }
 
-void SaveVisState(void)
+void SaveVisState(vis_context_t &ctx)
 {
     int vis_len, might_len;
     dvisstate_t state;
     dportal_t pstate;
 
-    std::ofstream out(statetmpfile, std::ios_base::out | std::ios_base::binary);
+    std::ofstream out(ctx.statetmpfile, std::ios_base::out | std::ios_base::binary);
     out << endianness<std::endian::little>;
 
     /* Write out a header */
     state.version = VIS_STATE_VERSION;
-    state.numportals = numportals;
-    state.numleafs = portalleafs;
-    state.testlevel = vis_options.visdist.value();
-    state.time_elapsed = (uint32_t)(statetime - starttime).count();
+    state.numportals = ctx.numportals;
+    state.numleafs = ctx.portalleafs;
+    state.testlevel = ctx.options.visdist.value();
+    state.time_elapsed = (uint32_t)(ctx.statetime - ctx.starttime).count();
 
     out <= state;
 
     /* Allocate memory for compressed bitstrings */
-    std::vector<uint8_t> might((portalleafs + 7) >> 3);
-    std::vector<uint8_t> vis((portalleafs + 7) >> 3);
+    std::vector<uint8_t> might((ctx.portalleafs + 7) >> 3);
+    std::vector<uint8_t> vis((ctx.portalleafs + 7) >> 3);
 
-    for (const auto &p : portals) {
-        might_len = CompressBits(might.data(), p.mightsee);
+    for (const auto &p : ctx.portals) {
+        might_len = CompressBits(might.data(), p.mightsee, ctx.portalleafs);
         if (p.status == pstat_done) {
-            vis_len = CompressBits(vis.data(), p.visbits);
+            vis_len = CompressBits(vis.data(), p.visbits, ctx.portalleafs);
         } else {
             vis_len = 0;
         }
@@ -178,55 +178,55 @@ void SaveVisState(void)
 
     std::error_code ec;
 
-    fs::remove(statefile, ec);
+    fs::remove(ctx.statefile, ec);
     if (ec && ec.value() != ENOENT)
         FError("error removing old state ({})", ec.message());
 
-    fs::rename(statetmpfile, statefile, ec);
+    fs::rename(ctx.statetmpfile, ctx.statefile, ec);
     if (ec)
         FError("error renaming state file ({})", ec.message());
 }
 
-void CleanVisState(void)
+void CleanVisState(vis_context_t &ctx)
 {
-    if (fs::exists(statefile)) {
-        fs::remove(statefile);
+    if (fs::exists(ctx.statefile)) {
+        fs::remove(ctx.statefile);
     }
 }
 
-bool LoadVisState(void)
+bool LoadVisState(vis_context_t &ctx)
 {
     fs::file_time_type prt_time, state_time;
     int numbytes;
     dvisstate_t state;
     dportal_t pstate;
 
-    if (vis_options.nostate.value()) {
+    if (ctx.options.nostate.value()) {
         return false;
     }
 
-    if (!fs::exists(statefile)) {
+    if (!fs::exists(ctx.statefile)) {
         /* No state file, maybe temp file is there? */
-        if (!fs::exists(statetmpfile))
+        if (!fs::exists(ctx.statetmpfile))
             return false;
-        state_time = fs::last_write_time(statetmpfile);
+        state_time = fs::last_write_time(ctx.statetmpfile);
 
         std::error_code ec;
-        fs::rename(statetmpfile, statefile, ec);
+        fs::rename(ctx.statetmpfile, ctx.statefile, ec);
 
         if (ec)
             return false;
     } else {
-        state_time = fs::last_write_time(statefile);
+        state_time = fs::last_write_time(ctx.statefile);
     }
 
-    prt_time = fs::last_write_time(portalfile);
+    prt_time = fs::last_write_time(ctx.portalfile);
     if (prt_time > state_time) {
         logging::print("State file is out of date, will be overwritten\n");
         return false;
     }
 
-    std::ifstream in(statefile, std::ios_base::in | std::ios_base::binary);
+    std::ifstream in(ctx.statefile, std::ios_base::in | std::ios_base::binary);
     in >> endianness<std::endian::little>;
 
     in >= state;
@@ -235,18 +235,18 @@ bool LoadVisState(void)
     if (state.version != VIS_STATE_VERSION) {
         FError("state file version does not match");
     }
-    if (state.numportals != numportals || state.numleafs != portalleafs) {
-        FError("state file {} does not match portal file {}", statefile, portalfile);
+    if (state.numportals != ctx.numportals || state.numleafs != ctx.portalleafs) {
+        FError("state file {} does not match portal file {}", ctx.statefile, ctx.portalfile);
     }
 
     /* Move back the start time to simulate already elapsed time */
-    starttime -= duration(state.time_elapsed);
+    ctx.starttime -= duration(state.time_elapsed);
 
-    numbytes = (portalleafs + 7) >> 3;
+    numbytes = (ctx.portalleafs + 7) >> 3;
     std::vector<uint8_t> compressed(numbytes);
 
     /* Update the portal information */
-    for (auto &p : portals) {
+    for (auto &p : ctx.portals) {
         in >= pstate;
 
         p.status = static_cast<pstatus_t>(pstate.status);
@@ -254,22 +254,22 @@ bool LoadVisState(void)
         p.numcansee = pstate.numcansee;
 
         in.read((char *)compressed.data(), pstate.might);
-        p.mightsee.resize(portalleafs);
+        p.mightsee.resize(ctx.portalleafs);
 
         if (pstate.might < numbytes) {
-            DecompressBits(p.mightsee, compressed.data());
+            DecompressBits(p.mightsee, compressed.data(), ctx.portalleafs);
         } else {
-            CopyLeafBits(p.mightsee, compressed.data(), portalleafs);
+            CopyLeafBits(p.mightsee, compressed.data(), ctx.portalleafs);
         }
 
-        p.visbits.resize(portalleafs);
+        p.visbits.resize(ctx.portalleafs);
 
         if (pstate.vis) {
             in.read((char *)compressed.data(), pstate.vis);
             if (pstate.vis < numbytes) {
-                DecompressBits(p.visbits, compressed.data());
+                DecompressBits(p.visbits, compressed.data(), ctx.portalleafs);
             } else {
-                CopyLeafBits(p.visbits, compressed.data(), portalleafs);
+                CopyLeafBits(p.visbits, compressed.data(), ctx.portalleafs);
             }
         }
 
@@ -3,6 +3,7 @@
 #include <climits>
 #include <cstdint>
 #include <bit> // for std::countr_zero
+#include <memory>
 
 #include <vis/leafbits.hh>
 #include <vis/vis.hh>
@@ -12,33 +13,6 @@
 #include <common/parallel.hh>
 #include <fmt/chrono.h>
 
-/*
- * If the portal file is "PRT2" format, then the leafs we are dealing with are
- * really clusters of leaves. So, after the vis job is done we need to expand
- * the clusters to the real leaf numbers before writing back to the bsp file.
- */
-int numportals;
-int portalleafs; /* leafs (PRT1) or clusters (PRT2) */
-int portalleafs_real; /* real no. of leafs after expanding PRT2 clusters. Not used for Q2. */
-
-std::vector<visportal_t> portals; // always numportals * 2; front and back
-std::vector<leaf_t> leafs;
-
-int c_portaltest, c_portalpass, c_portalcheck, c_mightseeupdate;
-int c_noclip = 0;
-
-bool showgetleaf = true;
-
-static std::vector<uint8_t> vismap;
-
-uint32_t originalvismapsize;
-
-std::vector<uint8_t> uncompressed;
-
-int leafbytes; // (portalleafs+63)>>3
-int leaflongs;
-int leafbytes_real; // (portalleafs_real+63)>>3, not used for Q2.
-
 namespace settings
 {
 setting_group vis_output_group{"Output", 200, expected_source::commandline};
@@ -62,10 +36,6 @@ void vis_settings::initialize(int argc, const char **argv)
 }
 } // namespace settings
 
-settings::vis_settings vis_options;
-
-fs::path portalfile, statefile, statetmpfile;
-
 /*
   ==================
   AllocStackWinding
@@ -113,7 +83,7 @@ void FreeStackWinding(viswinding_t *&w, pstack_t &stack)
   is returned.
   ==================
 */
-viswinding_t *ClipStackWinding(viswinding_t *in, pstack_t &stack, const qplane3d &split)
+viswinding_t *ClipStackWinding(vis_context_t &ctx, viswinding_t *in, pstack_t &stack, const qplane3d &split)
 {
     vec_t *dists = (vec_t *)alloca(sizeof(vec_t) * (in->size() + 1));
     int *sides = (int *)alloca(sizeof(int) * (in->size() + 1));
@@ -212,17 +182,12 @@ viswinding_t *ClipStackWinding(viswinding_t *in, pstack_t &stack, const qplane3d
 
 noclip:
     FreeStackWinding(neww, stack);
-    c_noclip++;
+    ctx.c_noclip++;
     return in;
 }
 
 //============================================================================
 
-#include <mutex>
-
-static std::mutex portal_mutex;
-static std::atomic_int64_t portalIndex;
-
 /*
   =============
   GetNextPortal
@@ -232,14 +197,14 @@ static std::atomic_int64_t portalIndex;
   the earlier information.
   =============
 */
-visportal_t *GetNextPortal(void)
+static visportal_t *GetNextPortal(vis_context_t &ctx)
 {
     visportal_t *ret = nullptr;
     uint32_t min = INT_MAX;
 
-    portal_mutex.lock();
+    ctx.portal_mutex.lock();
 
-    for (auto &p : portals) {
+    for (auto &p : ctx.portals) {
         if (p.nummightsee < min && p.status == pstat_none) {
             min = p.nummightsee;
             ret = &p;
@@ -250,7 +215,7 @@ visportal_t *GetNextPortal(void)
         ret->status = pstat_working;
     }
 
-    portal_mutex.unlock();
+    ctx.portal_mutex.unlock();
 
     return ret;
 }
@@ -267,9 +232,9 @@ visportal_t *GetNextPortal(void)
   Called with the lock held.
   =============
 */
-static void UpdateMightsee(const leaf_t &source, const leaf_t &dest)
+static void UpdateMightsee(vis_context_t &ctx, const leaf_t &source, const leaf_t &dest)
 {
-    size_t leafnum = &dest - leafs.data();
+    size_t leafnum = &dest - ctx.leafs.data();
     for (size_t i = 0; i < source.numportals; i++) {
         visportal_t *p = source.portals[i];
         if (p->status != pstat_none) {
@@ -278,7 +243,7 @@ static void UpdateMightsee(const leaf_t &source, const leaf_t &dest)
         if (p->mightsee[leafnum]) {
             p->mightsee[leafnum] = false;
             p->nummightsee--;
-            c_mightseeupdate++;
+            ctx.c_mightseeupdate++;
         }
     }
 }
@@ -293,14 +258,14 @@ static void UpdateMightsee(const leaf_t &source, const leaf_t &dest)
   Called with the lock held.
   =============
 */
-static void PortalCompleted(visportal_t *completed)
+static void PortalCompleted(vis_context_t &ctx, visportal_t *completed)
 {
     int i, j, k, bit, numblocks;
     int leafnum;
     const visportal_t *p, *p2;
     uint32_t changed;
 
-    portal_mutex.lock();
+    ctx.portal_mutex.lock();
 
     completed->status = pstat_done;
 
@@ -308,7 +273,7 @@ static void PortalCompleted(visportal_t *completed)
      * For each portal on the leaf, check the leafs we eliminated from
      * mightsee during the full vis so far.
      */
-    const leaf_t &myleaf = leafs[completed->leaf];
+    const leaf_t &myleaf = ctx.leafs[completed->leaf];
     for (i = 0; i < myleaf.numportals; i++) {
         p = myleaf.portals[i];
         if (p->status != pstat_done)
@@ -316,7 +281,7 @@ static void PortalCompleted(visportal_t *completed)
 
         auto might = p->mightsee.data();
         auto vis = p->visbits.data();
-        numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+        numblocks = (ctx.portalleafs + leafbits_t::mask) >> leafbits_t::shift;
         for (j = 0; j < numblocks; j++) {
             changed = might[j] & ~vis[j];
             if (!changed)
@@ -345,45 +310,42 @@ static void PortalCompleted(visportal_t *completed)
                 bit = std::countr_zero(changed);
                 changed &= ~nth_bit(bit);
                 leafnum = (j << leafbits_t::shift) + bit;
-                UpdateMightsee(leafs[leafnum], myleaf);
+                UpdateMightsee(ctx, ctx.leafs[leafnum], myleaf);
             }
         }
     }
 
-    portal_mutex.unlock();
+    ctx.portal_mutex.unlock();
 }
 
-time_point starttime, endtime, statetime;
-static duration stateinterval;
-
 /*
   ==============
   LeafThread
   ==============
 */
-void LeafThread(size_t)
+static void LeafThread(vis_context_t &ctx)
 {
     visportal_t *p;
 
-    portal_mutex.lock();
+    ctx.portal_mutex.lock();
     /* Save state if sufficient time has elapsed */
     auto now = I_FloatTime();
-    if (now > statetime + stateinterval) {
-        statetime = now;
-        SaveVisState();
+    if (now > ctx.statetime + ctx.stateinterval) {
+        ctx.statetime = now;
+        SaveVisState(ctx);
     }
-    portal_mutex.unlock();
+    ctx.portal_mutex.unlock();
 
-    p = GetNextPortal();
+    p = GetNextPortal(ctx);
     if (!p)
         return;
 
-    PortalFlow(p);
+    PortalFlow(ctx, p);
 
-    PortalCompleted(p);
+    PortalCompleted(ctx, p);
 
-    logging::print(logging::flag::VERBOSE, "portal:{:4}  mightsee:{:4}  cansee:{:4}\n", (ptrdiff_t)(p - portals.data()),
-        p->nummightsee, p->numcansee);
+    logging::print(logging::flag::VERBOSE, "portal:{:4}  mightsee:{:4}  cansee:{:4}\n",
+        (ptrdiff_t)(p - ctx.portals.data()), p->nummightsee, p->numcansee);
 }
 
 /*
@@ -393,11 +355,7 @@ void LeafThread(size_t)
   Builds the entire visibility list for a leaf
   ===============
 */
-int64_t totalvis;
-
-static std::vector<uint8_t> compressed;
-
-static void ClusterFlow(int clusternum, leafbits_t &buffer, mbsp_t *bsp)
+static void ClusterFlow(vis_context_t &ctx, int clusternum, leafbits_t &buffer, mbsp_t *bsp)
 {
     leaf_t *leaf;
     uint8_t *outbuffer;
@@ -408,8 +366,8 @@ static void ClusterFlow(int clusternum, leafbits_t &buffer, mbsp_t *bsp)
     /*
      * Collect visible bits from all portals into buffer
      */
-    leaf = &leafs[clusternum];
-    numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+    leaf = &ctx.leafs[clusternum];
+    numblocks = (ctx.portalleafs + leafbits_t::mask) >> leafbits_t::shift;
     for (i = 0; i < leaf->numportals; i++) {
         p = leaf->portals[i];
         if (p->status != pstat_done)
@@ -431,16 +389,16 @@ static void ClusterFlow(int clusternum, leafbits_t &buffer, mbsp_t *bsp)
     numvis = 0;
 
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        outbuffer = uncompressed.data() + clusternum * leafbytes;
-        for (i = 0; i < portalleafs; i++) {
+        outbuffer = ctx.uncompressed.data() + clusternum * ctx.leafbytes;
+        for (i = 0; i < ctx.portalleafs; i++) {
             if (buffer[i]) {
                 outbuffer[i >> 3] |= nth_bit(i & 7);
                 numvis++;
             }
         }
     } else {
-        outbuffer = uncompressed.data() + clusternum * leafbytes_real;
-        for (i = 0; i < portalleafs_real; i++) {
+        outbuffer = ctx.uncompressed.data() + clusternum * ctx.leafbytes_real;
+        for (i = 0; i < ctx.portalleafs_real; i++) {
             if (buffer[bsp->dleafs[i + 1].cluster]) {
                 outbuffer[i >> 3] |= nth_bit(i & 7);
                 numvis++;
@@ -459,39 +417,39 @@ static void ClusterFlow(int clusternum, leafbits_t &buffer, mbsp_t *bsp)
      */
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
         // FIXME: not sure what this is supposed to be?
-        totalvis += numvis;
+        ctx.totalvis += numvis;
     } else {
-        for (i = 0; i < portalleafs_real; i++) {
+        for (i = 0; i < ctx.portalleafs_real; i++) {
             if (bsp->dleafs[i + 1].cluster == clusternum) {
-                totalvis += numvis;
+                ctx.totalvis += numvis;
             }
         }
     }
 
-    compressed.clear();
+    ctx.compressed.clear();
 
     /* Allocate for worst case where RLE might grow the data (unlikely) */
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        CompressRow(outbuffer, (portalleafs + 7) >> 3, std::back_inserter(compressed));
+        CompressRow(outbuffer, (ctx.portalleafs + 7) >> 3, std::back_inserter(ctx.compressed));
     } else {
-        CompressRow(outbuffer, (portalleafs_real + 7) >> 3, std::back_inserter(compressed));
+        CompressRow(outbuffer, (ctx.portalleafs_real + 7) >> 3, std::back_inserter(ctx.compressed));
     }
 
     /* leaf 0 is a common solid */
-    int32_t visofs = vismap.size();
+    int32_t visofs = ctx.vismap.size();
 
     bsp->dvis.set_bit_offset(VIS_PVS, clusternum, visofs);
 
     // Set pointers
     if (bsp->loadversion->game->id != GAME_QUAKE_II) {
-        for (i = 0; i < portalleafs_real; i++) {
+        for (i = 0; i < ctx.portalleafs_real; i++) {
             if (bsp->dleafs[i + 1].cluster == clusternum) {
                 bsp->dleafs[i + 1].visofs = visofs;
             }
         }
     }
 
-    std::copy(compressed.begin(), compressed.end(), std::back_inserter(vismap));
+    std::copy(ctx.compressed.begin(), ctx.compressed.end(), std::back_inserter(ctx.vismap));
 }
 
 /*
@@ -499,11 +457,12 @@ static void ClusterFlow(int clusternum, leafbits_t &buffer, mbsp_t *bsp)
   CalcPortalVis
   ==================
 */
-void CalcPortalVis(const mbsp_t *bsp)
+static void CalcPortalVis(vis_context_t &ctx, const mbsp_t *bsp)
 {
+    logging::timed_scope_t timed_scope(__func__);
     // fastvis just uses mightsee for a very loose bound
-    if (vis_options.fast.value()) {
-        for (auto &p : portals) {
+    if (ctx.options.fast.value()) {
+        for (auto &p : ctx.portals) {
             p.visbits = p.mightsee;
             p.status = pstat_done;
         }
@@ -514,21 +473,20 @@ void CalcPortalVis(const mbsp_t *bsp)
      * Count the already completed portals in case we loaded previous state
      */
     int32_t startcount = 0;
-    for (auto &p : portals) {
+    for (auto &p : ctx.portals) {
         if (p.status == pstat_done) {
             startcount++;
         }
     }
 
-    portalIndex = startcount;
-    logging::parallel_for(startcount, numportals * 2, LeafThread);
+    logging::parallel_for(startcount, ctx.numportals * 2, [&ctx](int32_t) { LeafThread(ctx); });
 
-    SaveVisState();
+    SaveVisState(ctx);
 
-    logging::print(logging::flag::VERBOSE, "portalcheck: {}  portaltest: {}  portalpass: {}\n", c_portalcheck,
-        c_portaltest, c_portalpass);
-    logging::print(logging::flag::VERBOSE, "c_vistest: {}  c_mighttest: {}  c_mightseeupdate {}\n", c_vistest,
-        c_mighttest, c_mightseeupdate);
+    logging::print(logging::flag::VERBOSE, "portalcheck: {}  portaltest: {}  portalpass: {}\n", ctx.c_portalcheck,
+        ctx.c_portaltest, ctx.c_portalpass);
+    logging::print(logging::flag::VERBOSE, "c_vistest: {}  c_mighttest: {}  c_mightseeupdate {}\n", ctx.c_vistest,
+        ctx.c_mighttest, ctx.c_mightseeupdate);
 }
 
 /*
@@ -536,38 +494,38 @@ void CalcPortalVis(const mbsp_t *bsp)
   CalcVis
   ==================
 */
-void CalcVis(mbsp_t *bsp)
+static void CalcVis(vis_context_t &ctx, mbsp_t *bsp)
 {
     int i;
 
-    if (LoadVisState()) {
+    if (LoadVisState(ctx)) {
         logging::print("Loaded previous state. Resuming progress...\n");
     } else {
         logging::print("Calculating Base Vis:\n");
-        BasePortalVis();
+        BasePortalVis(ctx);
     }
 
     logging::print("Calculating Full Vis:\n");
-    CalcPortalVis(bsp);
+    CalcPortalVis(ctx, bsp);
 
     //
     // assemble the leaf vis lists by oring and compressing the portal lists
     //
     logging::print("Expanding clusters...\n");
-    leafbits_t buffer(portalleafs);
-    for (i = 0; i < portalleafs; i++) {
-        ClusterFlow(i, buffer, bsp);
+    leafbits_t buffer(ctx.portalleafs);
+    for (i = 0; i < ctx.portalleafs; i++) {
+        ClusterFlow(ctx, i, buffer, bsp);
         buffer.clear();
     }
 
-    int64_t avg = totalvis;
+    int64_t avg = ctx.totalvis;
 
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        avg /= static_cast<int64_t>(portalleafs);
+        avg /= static_cast<int64_t>(ctx.portalleafs);
 
         logging::print("average clusters visible: {}\n", avg);
     } else {
-        avg /= static_cast<int64_t>(portalleafs_real);
+        avg /= static_cast<int64_t>(ctx.portalleafs_real);
 
         logging::print("average leafs visible: {}\n", avg);
     }
@@ -583,53 +541,52 @@ void CalcVis(mbsp_t *bsp)
   LoadPortals
   ============
 */
-static void LoadPortals(const fs::path &name, mbsp_t *bsp)
+static void LoadPortals(vis_context_t &ctx, const fs::path &name, mbsp_t *bsp)
 {
     const prtfile_t prtfile = LoadPrtFile(name, bsp->loadversion);
 
-    portalleafs = prtfile.portalleafs;
-    portalleafs_real = prtfile.portalleafs_real;
+    ctx.portalleafs = prtfile.portalleafs;
+    ctx.portalleafs_real = prtfile.portalleafs_real;
 
     /* Allocate for worst case where RLE might grow the data (unlikely) */
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        compressed.reserve(std::max(1, (portalleafs * 2) / 8));
+        ctx.compressed.reserve(std::max(1, (ctx.portalleafs * 2) / 8));
     } else {
-        compressed.reserve(std::max(1, (portalleafs_real * 2) / 8));
+        ctx.compressed.reserve(std::max(1, (ctx.portalleafs_real * 2) / 8));
     }
 
-    numportals = prtfile.portals.size();
+    ctx.numportals = prtfile.portals.size();
 
     if (bsp->loadversion->game->id != GAME_QUAKE_II) {
         // since q2bsp has native cluster support, we shouldn't look at portalleafs_real at all.
-        logging::print("{:6} leafs\n", portalleafs_real);
+        logging::print("{:6} leafs\n", ctx.portalleafs_real);
     }
-    logging::print("{:6} clusters\n", portalleafs);
-    logging::print("{:6} portals\n", numportals);
+    logging::print("{:6} clusters\n", ctx.portalleafs);
+    logging::print("{:6} portals\n", ctx.numportals);
 
-    leafbytes = ((portalleafs + 63) & ~63) >> 3;
-    leaflongs = leafbytes / sizeof(long);
+    ctx.leafbytes = ((ctx.portalleafs + 63) & ~63) >> 3;
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
         // not used in Q2
-        leafbytes_real = 0;
+        ctx.leafbytes_real = 0;
     } else {
-        leafbytes_real = ((portalleafs_real + 63) & ~63) >> 3;
+        ctx.leafbytes_real = ((ctx.portalleafs_real + 63) & ~63) >> 3;
     }
 
     // each file portal is split into two memory portals
-    portals.resize(numportals * 2);
-    leafs.resize(portalleafs);
+    ctx.portals.resize(ctx.numportals * 2);
+    ctx.leafs.resize(ctx.portalleafs);
 
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        originalvismapsize = portalleafs * ((portalleafs + 7) / 8);
+        ctx.originalvismapsize = ctx.portalleafs * ((ctx.portalleafs + 7) / 8);
     } else {
-        originalvismapsize = portalleafs_real * ((portalleafs_real + 7) / 8);
+        ctx.originalvismapsize = ctx.portalleafs_real * ((ctx.portalleafs_real + 7) / 8);
     }
 
-    bsp->dvis.resize(portalleafs);
+    bsp->dvis.resize(ctx.portalleafs);
 
-    vismap.reserve(originalvismapsize * 2);
+    ctx.vismap.reserve(ctx.originalvismapsize * 2);
 
-    auto dest_portal_it = portals.begin();
+    auto dest_portal_it = ctx.portals.begin();
 
     for (auto source_portal_it = prtfile.portals.begin(); source_portal_it != prtfile.portals.end();
          source_portal_it++) {
@@ -644,7 +601,7 @@ static void LoadPortals(const fs::path &name, mbsp_t *bsp)
             plane = p.winding.plane();
 
             // create forward portal
-            auto &l = leafs[sourceportal.leafnums[0]];
+            auto &l = ctx.leafs[sourceportal.leafnums[0]];
             if (l.numportals == MAX_PORTALS_ON_LEAF)
                 FError("Leaf with too many portals");
             l.portals[l.numportals] = &p;
@@ -658,7 +615,7 @@ static void LoadPortals(const fs::path &name, mbsp_t *bsp)
         {
             auto &p = *dest_portal_it;
             // create backwards portal
-            auto &l = leafs[sourceportal.leafnums[1]];
+            auto &l = ctx.leafs[sourceportal.leafnums[1]];
             if (l.numportals == MAX_PORTALS_ON_LEAF)
                 FError("Leaf with too many portals");
             l.portals[l.numportals] = &p;
@@ -684,93 +641,87 @@ static void LoadPortals(const fs::path &name, mbsp_t *bsp)
     }
 }
 
-void vis_reset()
-{
-    // FIXME: clear other data
-
-    vis_options.reset();
-}
-
 int vis_main(int argc, const char **argv)
 {
-    vis_reset();
+    // heap allocated, since the settings are fairly large
+    auto context = std::make_unique<vis_context_t>();
+    vis_context_t &ctx = *context;
 
     bspdata_t bspdata;
     const bspversion_t *loadversion;
 
-    vis_options.run(argc, argv);
+    ctx.options.run(argc, argv);
 
-    vis_options.sourceMap.replace_extension("bsp");
+    ctx.options.sourceMap.replace_extension("bsp");
 
-    logging::init(fs::path(vis_options.sourceMap)
-                      .replace_filename(vis_options.sourceMap.stem().string() + "-vis")
+    logging::init(fs::path(ctx.options.sourceMap)
+                      .replace_filename(ctx.options.sourceMap.stem().string() + "-vis")
                       .replace_extension("log"),
-        vis_options);
+        ctx.options);
 
-    stateinterval = std::chrono::minutes(5); /* 5 minutes */
-    starttime = statetime = I_FloatTime();
+    ctx.stateinterval = std::chrono::minutes(5); /* 5 minutes */
+    ctx.starttime = ctx.statetime = I_FloatTime();
 
-    LoadBSPFile(vis_options.sourceMap, &bspdata);
+    LoadBSPFile(ctx.options.sourceMap, &bspdata);
 
-    bspdata.version->game->init_filesystem(vis_options.sourceMap, vis_options);
+    bspdata.version->game->init_filesystem(ctx.options.sourceMap, ctx.options);
 
     loadversion = bspdata.version;
     ConvertBSPFormat(&bspdata, &bspver_generic);
 
     mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
 
-    if (vis_options.phsonly.value()) {
+    if (ctx.options.phsonly.value()) {
         if (bsp.loadversion->game->id != GAME_QUAKE_II) {
             FError("need a Q2-esque BSP for -phsonly");
         }
 
-        portalleafs = bsp.dvis.bit_offsets.size();
-        leafbytes = ((portalleafs + 63) & ~63) >> 3;
-        leaflongs = leafbytes / sizeof(long);
+        ctx.portalleafs = bsp.dvis.bit_offsets.size();
+        ctx.leafbytes = ((ctx.portalleafs + 63) & ~63) >> 3;
 
         if (bsp.loadversion->game->id == GAME_QUAKE_II) {
-            originalvismapsize = portalleafs * ((portalleafs + 7) / 8);
+            ctx.originalvismapsize = ctx.portalleafs * ((ctx.portalleafs + 7) / 8);
         }
     } else {
-        portalfile = fs::path(vis_options.sourceMap).replace_extension("prt");
-        LoadPortals(portalfile, &bsp);
+        ctx.portalfile = fs::path(ctx.options.sourceMap).replace_extension("prt");
+        LoadPortals(ctx, ctx.portalfile, &bsp);
 
-        statefile = fs::path(vis_options.sourceMap).replace_extension("vis");
-        statetmpfile = fs::path(vis_options.sourceMap).replace_extension("vi0");
+        ctx.statefile = fs::path(ctx.options.sourceMap).replace_extension("vis");
+        ctx.statetmpfile = fs::path(ctx.options.sourceMap).replace_extension("vi0");
 
         if (bsp.loadversion->game->id != GAME_QUAKE_II) {
-            uncompressed.resize(portalleafs * leafbytes_real);
+            ctx.uncompressed.resize(ctx.portalleafs * ctx.leafbytes_real);
         } else {
-            uncompressed.resize(portalleafs * leafbytes);
+            ctx.uncompressed.resize(ctx.portalleafs * ctx.leafbytes);
         }
 
-        CalcVis(&bsp);
+        CalcVis(ctx, &bsp);
 
-        logging::print("c_noclip: {}\n", c_noclip);
-        logging::print("c_chains: {}\n", c_chains);
+        logging::print("c_noclip: {}\n", ctx.c_noclip);
+        logging::print("c_chains: {}\n", ctx.c_chains);
 
-        bsp.dvis.bits = std::move(vismap);
+        bsp.dvis.bits = std::move(ctx.vismap);
         bsp.dvis.bits.shrink_to_fit();
-        logging::print("visdatasize:{}  compressed from {}\n", bsp.dvis.bits.size(), originalvismapsize);
+        logging::print("visdatasize:{}  compressed from {}\n", bsp.dvis.bits.size(), ctx.originalvismapsize);
     }
 
     // no ambient sounds for Q2
     if (bsp.loadversion->game->id != GAME_QUAKE_II) {
-        CalcAmbientSounds(&bsp);
+        CalcAmbientSounds(ctx, &bsp);
     } else {
-        CalcPHS(&bsp);
+        CalcPHS(ctx, &bsp);
     }
 
     /* Convert data format back if necessary */
     ConvertBSPFormat(&bspdata, loadversion);
 
-    WriteBSPFile(vis_options.sourceMap, &bspdata);
+    WriteBSPFile(ctx.options.sourceMap, &bspdata);
 
-    endtime = I_FloatTime();
-    logging::print("{:.2} elapsed\n", (endtime - starttime));
+    ctx.endtime = I_FloatTime();
+    logging::print("{:.2} elapsed\n", (ctx.endtime - ctx.starttime));
 
-    if (vis_options.autoclean.value()) {
-        CleanVisState();
+    if (ctx.options.autoclean.value()) {
+        CleanVisState(ctx);
     }
 
     logging::close();